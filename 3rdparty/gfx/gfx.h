@@ -59,6 +59,8 @@ uint32_t gfxGetBackBufferCount(GfxContext context);
 
 bool gfxIsRaytracingSupported(GfxContext context);
 bool gfxIsInteropContext(GfxContext context);
+bool gfxIsShaderDebuggingEnabled(GfxContext context);           // programs are compiled with -Zi -O0 -Zss
+char const *gfxGetShaderCompilerVersion(GfxContext context);    // DXC major.minor.commit_count-commit_hash, for keying caches of compiled programs
 
 //!
 //! Buffer resources.
@@ -244,16 +246,28 @@ inline GfxResult gfxDrawStateEnableAlphaBlending(GfxDrawState draw_state)
 class GfxProgram { GFX_INTERNAL_HANDLE(GfxProgram); char name[kGfxConstant_MaxNameLength + 1]; public:
                    inline char const *getName() const { return name; } };
 
-class GfxProgramDesc { public: inline GfxProgramDesc() : cs(nullptr), vs(nullptr), gs(nullptr), ps(nullptr) {}
+class GfxProgramDesc { public: inline GfxProgramDesc() : cs(nullptr), vs(nullptr), gs(nullptr), ps(nullptr), cs_bytecode(nullptr), cs_bytecode_size(0), cs_reflection(nullptr), cs_reflection_size(0) {}
                        char const *cs;
                        char const *vs;
                        char const *gs;
                        char const *ps;
+                       void const *cs_bytecode;     // precompiled DXIL, skips the compiler when set
+                       uint32_t    cs_bytecode_size;
+                       void const *cs_reflection;   // DXC_OUT_REFLECTION blob matching cs_bytecode
+                       uint32_t    cs_reflection_size;
                        static GfxProgramDesc Compute(char const* cs) {
                            GfxProgramDesc d = {};
                            d.cs = cs;
                            return d;
                        }
+                       static GfxProgramDesc ComputeBinary(void const *bytecode, uint32_t bytecode_size, void const *reflection, uint32_t reflection_size) {
+                           GfxProgramDesc d = {};
+                           d.cs_bytecode = bytecode;
+                           d.cs_bytecode_size = bytecode_size;
+                           d.cs_reflection = reflection;
+                           d.cs_reflection_size = reflection_size;
+                           return d;
+                       }
 };
 
 GfxProgram gfxCreateProgram(GfxContext context, char const *file_name, char const *file_path = nullptr, char const *shader_model = nullptr);
@@ -304,6 +318,7 @@ GfxKernel gfxCreateGraphicsKernel(GfxContext context, GfxProgram program, char c
 GfxKernel gfxCreateGraphicsKernel(GfxContext context, GfxProgram program, GfxDrawState draw_state, char const *entry_point = nullptr, char const **defines = nullptr, uint32_t define_count = 0);
 char const *gfxKernelGetIsa(GfxContext context, GfxKernel kernel);
 void   *gfxKernelGetComputeBytecode(GfxContext context, GfxKernel kernel);
+void   *gfxKernelGetComputeReflection(GfxContext context, GfxKernel kernel);
 GfxResult gfxDestroyKernel(GfxContext context, GfxKernel kernel);
 
 uint32_t const *gfxKernelGetNumThreads(GfxContext context, GfxKernel kernel);
@@ -489,6 +504,7 @@ class GfxInternal
     uint64_t *fence_values_ = nullptr;
 
     bool debug_shaders_ = false;
+    char dxc_version_[128] = {};
     IDxcUtils *dxc_utils_ = nullptr;
     IDxcCompiler3 *dxc_compiler_ = nullptr;
     IDxcIncludeHandler *dxc_include_handler_ = nullptr;
@@ -1025,6 +1041,8 @@ class GfxInternal
         String vs_;
         String gs_;
         String ps_;
+        std::vector<uint8_t> cs_bytecode_;
+        std::vector<uint8_t> cs_reflection_;
         String file_name_;
         String file_path_;
         String shader_model_;
@@ -1102,6 +1120,7 @@ class GfxInternal
         ID3D12ShaderReflection *vs_reflection_ = nullptr;
         ID3D12ShaderReflection *gs_reflection_ = nullptr;
         ID3D12ShaderReflection *ps_reflection_ = nullptr;
+        IDxcBlob *cs_reflection_data_ = nullptr;
         ID3D12RootSignature *root_signature_ = nullptr;
         ID3D12PipelineState *pipeline_state_ = nullptr;
         Parameter *parameters_ = nullptr;
@@ -1418,6 +1437,24 @@ public:
            !SUCCEEDED(DxcCreateInstance(CLSID_DxcCompiler, IID_PPV_ARGS(&dxc_compiler_))) ||
            !SUCCEEDED(dxc_utils_->CreateDefaultIncludeHandler(&dxc_include_handler_)))
             return GFX_SET_ERROR(kGfxResult_InternalError, "Unable to create DXC compiler");
+        {
+            IDxcVersionInfo *version_info = nullptr;
+            IDxcVersionInfo2 *version_info2 = nullptr;
+            UINT32 major = 0, minor = 0, commit_count = 0;
+            char *commit_hash = nullptr;
+            if(SUCCEEDED(dxc_compiler_->QueryInterface(IID_PPV_ARGS(&version_info))))
+            {
+                version_info->GetVersion(&major, &minor);
+                version_info->Release();
+            }
+            if(SUCCEEDED(dxc_compiler_->QueryInterface(IID_PPV_ARGS(&version_info2))))
+            {
+                version_info2->GetCommitInfo(&commit_count, &commit_hash);
+                version_info2->Release();
+            }
+            GFX_SNPRINTF(dxc_version_, sizeof(dxc_version_), "%u.%u.%u-%s", major, minor, commit_count, commit_hash != nullptr ? commit_hash : "unknown");
+            if(commit_hash != nullptr) CoTaskMemFree(commit_hash);
+        }
 
         D3D12_INDIRECT_ARGUMENT_DESC dispatch_argument_desc = {};
         dispatch_argument_desc.Type = D3D12_INDIRECT_ARGUMENT_TYPE_DISPATCH;
@@ -1634,6 +1671,16 @@ public:
         return (dxr_device_ != nullptr ? true : false);
     }
 
+    inline bool isShaderDebuggingEnabled() const
+    {
+        return debug_shaders_;
+    }
+
+    inline char const *getShaderCompilerVersion() const
+    {
+        return dxc_version_;
+    }
+
     GfxBuffer createBuffer(uint64_t size, void const *data, GfxCpuAccess cpu_access, D3D12_RESOURCE_STATES resource_state = D3D12_RESOURCE_STATE_COMMON)
     {
         GfxBuffer buffer = {};
@@ -2389,6 +2436,11 @@ public:
         gfx_program.vs_ = program_desc.vs;
         gfx_program.gs_ = program_desc.gs;
         gfx_program.ps_ = program_desc.ps;
+        if(program_desc.cs_bytecode != nullptr && program_desc.cs_reflection != nullptr)
+        {
+            gfx_program.cs_bytecode_.assign((uint8_t const *)program_desc.cs_bytecode, (uint8_t const *)program_desc.cs_bytecode + program_desc.cs_bytecode_size);
+            gfx_program.cs_reflection_.assign((uint8_t const *)program_desc.cs_reflection, (uint8_t const *)program_desc.cs_reflection + program_desc.cs_reflection_size);
+        }
         return program;
     }
 
@@ -2576,6 +2628,12 @@ public:
         return kernels_[kernel].cs_bytecode_;
     }
 
+    IDxcBlob *gfxKernelGetComputeReflection(GfxKernel kernel) {
+        if (!kernel) return NULL;
+        if (!kernel_handles_.has_handle(kernel.handle)) return NULL;
+        return kernels_[kernel].cs_reflection_data_;
+    }
+
     GfxResult destroyKernel(GfxKernel const &kernel)
     {
         if(!kernel)
@@ -4568,6 +4626,7 @@ private:
         collect(kernel.vs_reflection_);
         collect(kernel.gs_reflection_);
         collect(kernel.ps_reflection_);
+        collect(kernel.cs_reflection_data_);
         collect(kernel.root_signature_);
         collect(kernel.pipeline_state_);
         for(uint32_t i = 0; i < kernel.parameter_count_; ++i)
@@ -7224,7 +7283,10 @@ private:
         if(kernel.isCompute())
         {
             kernel_type = "Compute";
-            compileShader(program, kernel, kShaderType_CS, kernel.cs_bytecode_, kernel.cs_reflection_);
+            if(!program.cs_bytecode_.empty())
+                loadShader(program.cs_bytecode_, program.cs_reflection_, kernel.cs_bytecode_, kernel.cs_reflection_, &kernel.cs_reflection_data_);
+            else
+                compileShader(program, kernel, kShaderType_CS, kernel.cs_bytecode_, kernel.cs_reflection_, &kernel.cs_reflection_data_);
             createRootSignature(kernel);
             createComputePipelineState(kernel);
             if(kernel.cs_reflection_ == nullptr)
@@ -7303,6 +7365,7 @@ private:
         if(kernel.vs_reflection_ != nullptr) { kernel.vs_reflection_->Release(); kernel.vs_reflection_ = nullptr; }
         if(kernel.gs_reflection_ != nullptr) { kernel.gs_reflection_->Release(); kernel.gs_reflection_ = nullptr; }
         if(kernel.ps_reflection_ != nullptr) { kernel.ps_reflection_->Release(); kernel.ps_reflection_ = nullptr; }
+        if(kernel.cs_reflection_data_ != nullptr) { kernel.cs_reflection_data_->Release(); kernel.cs_reflection_data_ = nullptr; }
         if(kernel.root_signature_ != nullptr) { collect(kernel.root_signature_); kernel.root_signature_ = nullptr; }
         if(kernel.pipeline_state_ != nullptr) { collect(kernel.pipeline_state_); kernel.pipeline_state_ = nullptr; }
         for(uint32_t i = 0; i < kernel.parameter_count_; ++i)
@@ -7320,7 +7383,30 @@ private:
         createKernel(program, kernel);
     }
 
-    void compileShader(Program const &program, Kernel const &kernel, ShaderType shader_type, IDxcBlob *&shader_bytecode, ID3D12ShaderReflection *&shader_reflection)
+    void loadShader(std::vector<uint8_t> const &bytecode, std::vector<uint8_t> const &reflection, IDxcBlob *&shader_bytecode, ID3D12ShaderReflection *&shader_reflection, IDxcBlob **reflection_data = nullptr)
+    {
+        IDxcBlobEncoding *dxc_bytecode = nullptr;
+        IDxcBlobEncoding *dxc_reflection = nullptr;
+        if(bytecode.empty() || reflection.empty()) return;
+        dxc_utils_->CreateBlob(bytecode.data(), (uint32_t)bytecode.size(), DXC_CP_ACP, &dxc_bytecode);
+        dxc_utils_->CreateBlob(reflection.data(), (uint32_t)reflection.size(), DXC_CP_ACP, &dxc_reflection);
+        if(!dxc_bytecode || !dxc_reflection)
+        {
+            if(dxc_bytecode) dxc_bytecode->Release();
+            if(dxc_reflection) dxc_reflection->Release();
+            return;
+        }
+        DxcBuffer reflection_buffer = {};
+        reflection_buffer.Size = dxc_reflection->GetBufferSize();
+        reflection_buffer.Ptr = dxc_reflection->GetBufferPointer();
+        dxc_utils_->CreateReflection(&reflection_buffer, IID_PPV_ARGS(&shader_reflection));
+        if(shader_reflection) shader_bytecode = dxc_bytecode;
+        if(!shader_reflection) dxc_bytecode->Release();
+        if(shader_reflection && reflection_data) *reflection_data = dxc_reflection;
+        else dxc_reflection->Release();
+    }
+
+    void compileShader(Program const &program, Kernel const &kernel, ShaderType shader_type, IDxcBlob *&shader_bytecode, ID3D12ShaderReflection *&shader_reflection, IDxcBlob **reflection_data = nullptr)
     {
         char shader_file[4096];
         DxcBuffer shader_source = {};
@@ -7498,7 +7584,8 @@ private:
         if(!shader_reflection) dxc_bytecode->Release();
         if(dxc_pdb_name) dxc_pdb_name->Release();
         if(dxc_pdb) dxc_pdb->Release();
-        dxc_reflection->Release();
+        if(shader_reflection && reflection_data) *reflection_data = dxc_reflection;
+        else dxc_reflection->Release();
     }
 
     GfxResult createResource(D3D12MA::ALLOCATION_DESC const &allocation_desc, D3D12_RESOURCE_DESC const &resource_desc,
@@ -7806,6 +7893,20 @@ bool gfxIsInteropContext(GfxContext context)
     return gfx->isInterop();
 }
 
+bool gfxIsShaderDebuggingEnabled(GfxContext context)
+{
+    GfxInternal *gfx = GfxInternal::GetGfx(context);
+    if(!gfx) return false;  // invalid context
+    return gfx->isShaderDebuggingEnabled();
+}
+
+char const *gfxGetShaderCompilerVersion(GfxContext context)
+{
+    GfxInternal *gfx = GfxInternal::GetGfx(context);
+    if(!gfx) return "";  // invalid context
+    return gfx->getShaderCompilerVersion();
+}
+
 GfxBuffer gfxCreateBuffer(GfxContext context, uint64_t size, void const *data, GfxCpuAccess cpu_access)
 {
     GfxBuffer const buffer = {};
@@ -8168,6 +8269,13 @@ void *gfxKernelGetComputeBytecode(GfxContext context, GfxKernel kernel)
     return gfx->gfxKernelGetComputeBytecode(kernel);
 }
 
+void *gfxKernelGetComputeReflection(GfxContext context, GfxKernel kernel)
+{
+    GfxInternal *gfx = GfxInternal::GetGfx(context);
+    if (!gfx) return NULL; // invalid context
+    return gfx->gfxKernelGetComputeReflection(kernel);
+}
+
 GfxKernel gfxCreateComputeKernel(GfxContext context, GfxProgram program, char const *entry_point, char const **defines, uint32_t define_count, char const **includes, uint32_t include_count)
 {
     GfxKernel const compute_kernel = {};
@@ -0,0 +1,273 @@
+// MIT License
+//
+// Copyright (c) 2023 Anton Schreiner
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined(BINDING_TABLE_HPP)
+#    define BINDING_TABLE_HPP
+
+#    include "common.h"
+#    include "sjit/3rdparty/robin-map/include/tsl/robin_map.h"
+
+#    include <cassert>
+#    include <chrono>
+#    include <cstring>
+#    include <string>
+#    include <vector>
+
+namespace GfxJit {
+
+// Values shared by every kernel, e.g. camera and scene buffers.
+// Names get a slot the first time they are seen and keep it for the lifetime of the table, every write bumps the slot's version.
+template <typename Slot>
+class GlobalBindings {
+private:
+    tsl::robin_map<std::string, u32> indices  = {};
+    std::vector<Slot>                values   = {};
+    std::vector<u32>                 versions = {};
+    std::vector<u8>                  is_set   = {};
+
+public:
+    static constexpr u32 INVALID_INDEX = u32(-1);
+
+    u32 GetIndex(char const *_name) {
+        auto it = indices.find(_name);
+        if (it != indices.end()) return it->second;
+        u32 idx        = u32(values.size());
+        indices[_name] = idx;
+        values.push_back({});
+        versions.push_back(u32(0));
+        is_set.push_back(u8(0));
+        return idx;
+    }
+    Slot &operator[](char const *_name) { return Get(GetIndex(_name)); }
+    // Meant to be written through, so the version is bumped right away
+    Slot &Get(u32 _idx) {
+        versions[_idx]++;
+        is_set[_idx] = u8(1);
+        return values[_idx];
+    }
+    Slot const &Peek(u32 _idx) const { return values[_idx]; }
+    bool        IsSet(u32 _idx) const { return _idx < u32(is_set.size()) && is_set[_idx]; }
+    u32         GetVersion(u32 _idx) const { return versions[_idx]; }
+    u32         GetNumSlots() const { return u32(values.size()); }
+    // Unsets everything, the slots are kept
+    void Clear() {
+        for (auto &s : is_set) s = u8(0);
+        for (auto &v : versions) v++;
+    }
+};
+
+struct BindingTableStats {
+    u64 num_applied = u64(0); // Parameter updates that reached the backend
+    u64 num_skipped = u64(0); // Bindings that matched what the backend already had
+};
+
+// Per-kernel bindings resolved to slot indices once, from the names reflected at compile time.
+// Values persist across dispatches and frames, Flush only hands the backend what changed since the last dispatch.
+// A slot that isn't set for a dispatch falls back to the global binding of the same name.
+template <typename Slot>
+class BindingTable {
+private:
+    struct Cached {
+        char const *name = NULL;
+        u32         slot = u32(0);
+    };
+
+    std::vector<std::string> names          = {};
+    std::vector<Slot>        applied        = {}; // What the backend has
+    std::vector<u8>          has_applied    = {};
+    std::vector<u32>         global_index   = {};
+    std::vector<u32>         global_version = {}; // Version of the global binding that was compared last
+    std::vector<u64>         dirty          = {}; // Set this dispatch and different from the backend
+    std::vector<u64>         set_locally    = {}; // Set this dispatch, cleared by ResetTable
+    std::vector<Cached>      name_cache     = {}; // Literal names hit this and skip hashing
+    BindingTableStats        stats          = {};
+
+    tsl::robin_map<std::string, u32> indices = {};
+
+    static bool TestBit(std::vector<u64> const &_bits, u32 _i) { return (_bits[_i / u32(64)] >> u64(_i % u32(64))) & u64(1); }
+    static void SetBit(std::vector<u64> &_bits, u32 _i) { _bits[_i / u32(64)] |= u64(1) << u64(_i % u32(64)); }
+
+public:
+    static constexpr u32 INVALID_SLOT = u32(-1);
+
+    template <typename Globals>
+    void Init(std::vector<std::string> const &_names, Globals &_globals) {
+        *this = {};
+        names = _names;
+        applied.resize(names.size());
+        has_applied.resize(names.size(), u8(0));
+        global_version.resize(names.size(), u32(0));
+        dirty.resize((names.size() + size_t(63)) / size_t(64), u64(0));
+        set_locally.resize(dirty.size(), u64(0));
+        name_cache.resize(size_t(64));
+        ifor(names.size()) {
+            indices[names[i]] = i;
+            global_index.push_back(_globals.GetIndex(names[i].c_str()));
+        }
+    }
+    u32 GetNumSlots() const { return u32(names.size()); }
+    // Pointer compare first, the string is only hashed the first time a name is seen at a given address
+    u32 Find(char const *_name) {
+        Cached &c = name_cache[(u64(_name) >> u64(3)) % u64(name_cache.size())];
+        if (c.name == _name && strcmp(names[c.slot].c_str(), _name) == 0) return c.slot;
+        auto it = indices.find(_name);
+        if (it == indices.end()) return INVALID_SLOT;
+        c.name = _name;
+        c.slot = it->second;
+        return it->second;
+    }
+    void Set(u32 _slot, Slot const &_value, bool _override = false) {
+        if (_slot == INVALID_SLOT) return; // Not used by the kernel
+        SetBit(set_locally, _slot);
+        global_version[_slot] = u32(-1);
+        if (!_override && has_applied[_slot] && applied[_slot] == _value) return;
+        applied[_slot]     = _value;
+        has_applied[_slot] = u8(1);
+        SetBit(dirty, _slot);
+    }
+    void Set(char const *_name, Slot const &_value, bool _override = false) { Set(Find(_name), _value, _override); }
+    // Calls _apply(slot, name, value) for every binding the backend doesn't have yet, returns false if something is bound neither locally nor globally
+    template <typename Globals, typename Fn>
+    bool Flush(Globals const &_globals, Fn &&_apply) {
+        bool complete = true;
+        ifor(names.size()) {
+            if (TestBit(set_locally, i)) {
+                if (TestBit(dirty, i)) {
+                    _apply(i, names[i], applied[i]);
+                    stats.num_applied++;
+                } else {
+                    stats.num_skipped++;
+                }
+                continue;
+            }
+            u32 gi = global_index[i];
+            if (!_globals.IsSet(gi)) {
+                complete = false;
+                continue;
+            }
+            if (global_version[i] == _globals.GetVersion(gi)) {
+                stats.num_skipped++;
+                continue;
+            }
+            global_version[i] = _globals.GetVersion(gi);
+            if (has_applied[i] && applied[i] == _globals.Peek(gi)) {
+                stats.num_skipped++;
+                continue;
+            }
+            applied[i]     = _globals.Peek(gi);
+            has_applied[i] = u8(1);
+            _apply(i, names[i], applied[i]);
+            stats.num_applied++;
+        }
+        for (auto &d : dirty) d = u64(0);
+        return complete;
+    }
+    // Forgets what was set for the dispatch, the backend state is kept
+    void ResetTable() {
+        for (auto &s : set_locally) s = u64(0);
+        for (auto &d : dirty) d = u64(0);
+    }
+    BindingTableStats GetStats() const { return stats; }
+};
+
+// Binding cost per dispatch against a stub backend: the slot table vs. the string keyed map that was cleared after every dispatch
+static void BenchBindingTable(u32 _num_frames = u32(256), u32 _num_kernels = u32(16), u32 _num_locals = u32(4), u32 _num_globals = u32(24)) {
+    struct StubSlot {
+        u64  value = u64(0);
+        bool operator==(StubSlot const &that) const { return value == that.value; }
+    };
+    std::vector<std::string> global_names = {};
+    std::vector<std::string> local_names  = {};
+    ifor(_num_globals) global_names.push_back("g_global_resource_" + std::to_string(i));
+    ifor(_num_locals) local_names.push_back("g_rw_local_resource_" + std::to_string(i));
+    std::vector<std::string> kernel_names = global_names;
+    kernel_names.insert(kernel_names.end(), local_names.begin(), local_names.end());
+
+    u64 backend_calls[2] = {};
+    f64 seconds[2]       = {};
+    u64 checksum[2]      = {};
+    // Globals are rewritten every frame, only the frame index actually changes. Locals ping-pong between two values.
+    auto global_value = [](u32 _frame, u32 _i) { return _i == u32(0) ? u64(_frame) : u64(1000) + u64(_i); };
+    auto local_value  = [](u32 _frame, u32 _kernel, u32 _i) { return u64(_kernel) * u64(100) + u64(_i) + u64(_frame & u32(1)) * u64(10000); };
+    {
+        GlobalBindings<StubSlot>            globals = {};
+        std::vector<BindingTable<StubSlot>> kernels = std::vector<BindingTable<StubSlot>>(_num_kernels);
+        for (auto &k : kernels) k.Init(kernel_names, globals);
+        auto start = std::chrono::high_resolution_clock::now();
+        ifor(_num_frames) {
+            globals.Clear();
+            jfor(_num_globals) globals[global_names[j].c_str()].value = global_value(i, j);
+            jfor(_num_kernels) {
+                auto &kernel = kernels[j];
+                kfor(_num_locals) kernel.Set(local_names[k].c_str(), {local_value(i, j, k)});
+                bool complete = kernel.Flush(globals, [&](u32 _slot, std::string const &_name, StubSlot const &_v) {
+                    backend_calls[0]++;
+                    checksum[0] += _v.value * u64(_slot + u32(1));
+                });
+                assert(complete);
+                kernel.ResetTable();
+            }
+        }
+        seconds[0] = std::chrono::duration<f64>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+    {
+        tsl::robin_map<std::string, StubSlot>              globals = {};
+        std::vector<tsl::robin_map<std::string, StubSlot>> kernels = std::vector<tsl::robin_map<std::string, StubSlot>>(_num_kernels);
+        tsl::robin_map<std::string, u32>                   slots   = {};
+        ifor(kernel_names.size()) slots[kernel_names[i]] = i;
+        auto start = std::chrono::high_resolution_clock::now();
+        ifor(_num_frames) {
+            globals = {};
+            jfor(_num_globals) globals[global_names[j]].value = global_value(i, j);
+            jfor(_num_kernels) {
+                auto &set_resources = kernels[j];
+                kfor(_num_locals) {
+                    StubSlot v  = {local_value(i, j, k)};
+                    auto     it = set_resources.find(local_names[k].c_str());
+                    if (it != set_resources.end() && it->second == v) continue;
+                    set_resources[local_names[k].c_str()] = v;
+                    backend_calls[1]++;
+                    checksum[1] += v.value * u64(slots[local_names[k]] + u32(1));
+                }
+                for (auto &name : kernel_names) {
+                    if (set_resources.find(name) != set_resources.end()) continue;
+                    auto it = globals.find(name);
+                    assert(it != globals.end());
+                    set_resources[name] = it->second;
+                    backend_calls[1]++;
+                    checksum[1] += it->second.value * u64(slots[name] + u32(1));
+                }
+                set_resources.clear();
+            }
+        }
+        seconds[1] = std::chrono::duration<f64>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+    (void)checksum;
+    f64 num_dispatches = f64(std::max(_num_frames * _num_kernels, u32(1)));
+    fprintf(stdout, "[BINDING TABLE] %i slots/kernel: %f -> %f us/dispatch, %f -> %f backend calls/dispatch\n", i32(kernel_names.size()),
+            seconds[1] / num_dispatches * f64(1.0e6), seconds[0] / num_dispatches * f64(1.0e6), f64(backend_calls[1]) / num_dispatches,
+            f64(backend_calls[0]) / num_dispatches);
+}
+
+} // namespace GfxJit
+
+#endif // BINDING_TABLE_HPP
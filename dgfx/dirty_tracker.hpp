@@ -0,0 +1,203 @@
+// MIT License
+//
+// Copyright (c) 2023 Anton Schreiner
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined(DIRTY_TRACKER_HPP)
+#    define DIRTY_TRACKER_HPP
+
+#    include "common.h"
+
+#    include <algorithm>
+#    include <cassert>
+#    include <vector>
+
+namespace GfxJit {
+
+// [begin, end) in elements
+struct DirtyRange {
+    u32 begin = u32(0);
+    u32 end   = u32(0);
+
+    u32  GetSize() const { return end - begin; }
+    bool operator==(DirtyRange const &that) const { return begin == that.begin && end == that.end; }
+};
+
+// Sorts and merges ranges that overlap, touch or leave a gap of at most _max_gap elements. Copying a few clean elements is cheaper than another copy command.
+static void CoalesceDirtyRanges(std::vector<DirtyRange> &_ranges, u32 _max_gap = u32(0)) {
+    _ranges.erase(std::remove_if(_ranges.begin(), _ranges.end(), [](DirtyRange const &r) { return r.begin >= r.end; }), _ranges.end());
+    if (_ranges.empty()) return;
+    std::sort(_ranges.begin(), _ranges.end(), [](DirtyRange const &a, DirtyRange const &b) { return a.begin < b.begin; });
+    size_t num_ranges = size_t(1);
+    for (size_t i = size_t(1); i < _ranges.size(); i++) {
+        DirtyRange &last = _ranges[num_ranges - size_t(1)];
+        if (u64(_ranges[i].begin) <= u64(last.end) + u64(_max_gap))
+            last.end = std::max(last.end, _ranges[i].end);
+        else
+            _ranges[num_ranges++] = _ranges[i];
+    }
+    _ranges.resize(num_ranges);
+}
+
+// Per element dirty bits plus the generation each element last changed in. Mark elements during a frame, turn the bits into copy ranges with GetRanges and start the
+// next frame with EndFrame. The bits of the previous frame are kept: double buffered data like the previous transforms has to be copied for one more frame after
+// an element stops changing.
+class DirtyTracker {
+private:
+    std::vector<u64> bits          = {};
+    std::vector<u64> previous_bits = {};
+    std::vector<u64> generations   = {};
+    u64              generation    = u64(1);
+    u32              num_elements  = u32(0);
+    u32              num_dirty     = u32(0);
+    u32              num_previous  = u32(0);
+
+    static u32 CountBits(std::vector<u64> const &_bits) {
+        u32 count = u32(0);
+        for (u64 w : _bits)
+            for (; w; w &= w - u64(1)) count++;
+        return count;
+    }
+
+public:
+    // New elements start clean with generation 0
+    void Resize(u32 _num_elements) {
+        num_elements = _num_elements;
+        u32 num_words = (_num_elements + u32(63)) / u32(64);
+        bits.resize(num_words, u64(0));
+        previous_bits.resize(num_words, u64(0));
+        generations.resize(_num_elements, u64(0));
+        // Drop the bits past the end when shrinking
+        if (num_words && (_num_elements & u32(63))) {
+            u64 mask = (u64(1) << u64(_num_elements & u32(63))) - u64(1);
+            bits.back() &= mask;
+            previous_bits.back() &= mask;
+        }
+        num_dirty    = CountBits(bits);
+        num_previous = CountBits(previous_bits);
+    }
+    void MarkDirty(u32 _idx) {
+        assert(_idx < num_elements);
+        u64 bit = u64(1) << u64(_idx & u32(63));
+        if ((bits[_idx >> u32(6)] & bit) == u64(0)) num_dirty++;
+        bits[_idx >> u32(6)] |= bit;
+        generations[_idx] = generation;
+    }
+    void MarkAllDirty() { ifor(num_elements) MarkDirty(i); }
+    bool IsDirty(u32 _idx) const { return (bits[_idx >> u32(6)] >> u64(_idx & u32(63))) & u64(1); }
+    u32  GetNumDirty() const { return num_dirty; }
+    u32  GetNumElements() const { return num_elements; }
+    // Whether there's anything to copy, _include_previous also counts what changed in the previous frame
+    bool HasChanges(bool _include_previous = false) const { return num_dirty || (_include_previous && num_previous); }
+    // Generation of the current frame, starts at 1
+    u64  GetGeneration() const { return generation; }
+    // Generation of the frame the element last changed in, 0 if it never did
+    u64  GetElementGeneration(u32 _idx) const { return generations[_idx]; }
+    bool ChangedSince(u32 _idx, u64 _generation) const { return generations[_idx] > _generation; }
+
+    // Runs of dirty elements merged with CoalesceDirtyRanges. Zero words are skipped so a mostly static scene costs a pass over the bitset.
+    void GetRanges(std::vector<DirtyRange> &_ranges, u32 _max_gap = u32(0), bool _include_previous = false) const {
+        _ranges.clear();
+        u32 run_begin = u32(-1);
+        ifor(u32(bits.size())) {
+            u64 w = bits[i] | (_include_previous ? previous_bits[i] : u64(0));
+            if (w == u64(0) && run_begin == u32(-1)) continue;
+            if (w == ~u64(0) && run_begin != u32(-1)) continue;
+            jfor(64) {
+                bool dirty = (w >> u64(j)) & u64(1);
+                u32  idx   = i * u32(64) + j;
+                if (dirty && run_begin == u32(-1)) run_begin = idx;
+                if (!dirty && run_begin != u32(-1)) {
+                    _ranges.push_back({run_begin, idx});
+                    run_begin = u32(-1);
+                }
+            }
+        }
+        if (run_begin != u32(-1)) _ranges.push_back({run_begin, num_elements});
+        CoalesceDirtyRanges(_ranges, _max_gap);
+    }
+    void EndFrame() {
+        std::swap(bits, previous_bits);
+        std::fill(bits.begin(), bits.end(), u64(0));
+        num_previous = num_dirty;
+        num_dirty    = u32(0);
+        generation++;
+    }
+
+    static void Test() {
+        // Merging: overlapping, touching, within the gap, out of order and empty ranges
+        std::vector<DirtyRange> ranges = {{10, 20}, {0, 4}, {18, 25}, {25, 30}, {33, 40}, {7, 7}, {100, 101}};
+        CoalesceDirtyRanges(ranges);
+        assert((ranges == std::vector<DirtyRange>{{0, 4}, {10, 30}, {33, 40}, {100, 101}}));
+        CoalesceDirtyRanges(ranges, u32(3));
+        assert((ranges == std::vector<DirtyRange>{{0, 4}, {10, 40}, {100, 101}}));
+        CoalesceDirtyRanges(ranges, u32(6));
+        assert((ranges == std::vector<DirtyRange>{{0, 40}, {100, 101}}));
+        ranges = {{u32(-2), u32(-1)}, {0, 1}};
+        CoalesceDirtyRanges(ranges, u32(-1));
+        assert((ranges == std::vector<DirtyRange>{{0, u32(-1)}}));
+
+        DirtyTracker tracker = {};
+        tracker.Resize(u32(200));
+        assert(!tracker.HasChanges(true));
+        tracker.GetRanges(ranges);
+        assert(ranges.empty());
+
+        // Runs across word boundaries and up to the last element
+        for (u32 idx : {u32(3), u32(62), u32(63), u32(64), u32(65), u32(130), u32(199)}) tracker.MarkDirty(idx);
+        tracker.MarkDirty(u32(63));
+        assert(tracker.GetNumDirty() == u32(7));
+        tracker.GetRanges(ranges);
+        assert((ranges == std::vector<DirtyRange>{{3, 4}, {62, 66}, {130, 131}, {199, 200}}));
+        tracker.GetRanges(ranges, u32(63));
+        assert((ranges == std::vector<DirtyRange>{{3, 66}, {130, 131}, {199, 200}}));
+        u64 first = tracker.GetGeneration();
+        assert(tracker.GetElementGeneration(u32(64)) == first && tracker.GetElementGeneration(u32(0)) == u64(0));
+
+        // The next frame only sees the previous bits when asked to
+        tracker.EndFrame();
+        assert(!tracker.HasChanges() && tracker.HasChanges(true));
+        tracker.MarkDirty(u32(5));
+        tracker.GetRanges(ranges);
+        assert((ranges == std::vector<DirtyRange>{{5, 6}}));
+        tracker.GetRanges(ranges, u32(0), true);
+        assert((ranges == std::vector<DirtyRange>{{3, 4}, {5, 6}, {62, 66}, {130, 131}, {199, 200}}));
+        assert(tracker.ChangedSince(u32(5), first) && !tracker.ChangedSince(u32(64), first));
+        tracker.EndFrame();
+        tracker.EndFrame();
+        assert(!tracker.HasChanges(true));
+
+        // Full words and shrinking
+        tracker.MarkAllDirty();
+        tracker.GetRanges(ranges);
+        assert((ranges == std::vector<DirtyRange>{{0, 200}}));
+        tracker.Resize(u32(70));
+        assert(tracker.GetNumDirty() == u32(70));
+        tracker.GetRanges(ranges);
+        assert((ranges == std::vector<DirtyRange>{{0, 70}}));
+        tracker.Resize(u32(128));
+        tracker.GetRanges(ranges);
+        assert((ranges == std::vector<DirtyRange>{{0, 70}}));
+    }
+};
+
+} // namespace GfxJit
+
+#endif // DIRTY_TRACKER_HPP
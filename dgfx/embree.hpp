@@ -179,7 +179,7 @@ public:
         arguments.createLeaf             = CreateLeaf;
         arguments.splitPrimitive         = SplitPrimitive;
         arguments.buildProgress          = nullptr;
-        arguments.user_ptr               = nullptr;
+        arguments.userPtr                = nullptr;
         BVHResult out                    = {};
         out.bvh                          = bvh;
         out.root                         = (Node *)rtcBuildBVH(&arguments);
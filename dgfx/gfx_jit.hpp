@@ -33,9 +33,23 @@
 #    include "file_io.hpp"
 #    include "gfx_utils.hpp"
 #    include "gizmo.hpp"
+#    include "binding_table.hpp"
+#    include "dirty_tracker.hpp"
+#    include "instance_bvh.hpp"
+#    include "kernel_cache.hpp"
+#    include "meshlet_builder.hpp"
+#    include "profiler.hpp"
+#    include "render_graph.hpp"
+#    include "scene_cache.hpp"
+#    include "texture_pool.hpp"
+#    include "texture_streaming.hpp"
+#    include "vertex_quantization.hpp"
 #    include "sjit/sjit.hpp"
+#    include "sjit/sjit_cpu.hpp"
+#    include "sjit/sjit_cpp.hpp"
 
 #    include <filesystem>
+#    include <thread>
 
 struct Mesh {
     uint32_t count;
@@ -64,15 +78,71 @@ struct Vertex {
 
 } // namespace
 
+// Shader vertex fetches go through a 16 byte CompactVertex stream. Read when kernels are built and when the scene is uploaded, so set it before either.
+static bool g_use_compact_vertices = false;
+// Skip drawing instances whose meshlets are all outside the camera frustum in the visibility pass
+static bool g_frustum_cull_instances = true;
+// Scene textures start at their mip tail and finer mips stream in from .scene_cache on feedback from the visibility pass. Read when the scene is uploaded.
+static bool g_stream_textures = false;
+
+// Streamed textures are recreated with only their resident mips, gfx defers destroying the old one until the GPU is done with it
+class GpuSceneTextureStreamDevice : public GfxJit::ITextureStreamDevice {
+public:
+    GfxContext                  gfx      = {};
+    std::vector<GfxTexture>    *textures = NULL; // GpuScene is passed around by value, set before every TextureStreamer call
+    GfxJit::TextureCache const *cache    = NULL;
+
+    void UploadTexture(u32 _texture_id, u32 _first_mip, u8 const *_data, u64 _size) override {
+        GfxJit::TextureCache::Entry const &e       = cache->GetEntry(_texture_id);
+        GfxTexture                         texture = gfxCreateTexture2D(gfx, GfxJit::GetTextureMipSize(e.width, _first_mip), GfxJit::GetTextureMipSize(e.height, _first_mip),
+                                                                        DXGI_FORMAT(e.format), e.num_mips - _first_mip);
+        GfxBuffer upload_texture_buffer = gfxCreateBuffer(gfx, _size, _data, kGfxCpuAccess_Write);
+        gfxCommandCopyBufferToTexture(gfx, texture, upload_texture_buffer);
+        gfxDestroyBuffer(gfx, upload_texture_buffer);
+        if ((*textures)[_texture_id]) gfxDestroyTexture(gfx, (*textures)[_texture_id]);
+        (*textures)[_texture_id] = texture;
+    }
+};
+
+struct GpuSceneTextureStreaming {
+    GfxJit::TextureCache                     cache;
+    GpuSceneTextureStreamDevice              device;
+    std::unique_ptr<GfxJit::TextureStreamer> streamer;
+    GfxBuffer                                feedback_readback_buffers[kGfxConstant_BackBufferCount];
+    u32                                      num_frames = u32(0); // The readback slots hold nothing before the first kGfxConstant_BackBufferCount frames
+};
+
+// 8 bit and f32 images with 1, 2 or 4 channels are streamed, anything else keeps the full resolution upload
+static GfxJit::TextureCacheSource GetTextureCacheSource(GfxImage const &_image) {
+    GfxJit::TextureCacheSource source = {};
+    source.data                       = _image.data.data();
+    source.width                      = _image.width;
+    source.height                     = _image.height;
+    source.channels                   = _image.channel_count;
+    source.format                     = u32(_image.format);
+    bool supported_channels           = _image.channel_count == 1 || _image.channel_count == 2 || _image.channel_count == 4;
+    if (!supported_channels || u64(_image.data.size()) < u64(_image.width) * u64(_image.height) * u64(_image.channel_count) * u64(_image.bytes_per_channel))
+        return source;
+    if (_image.bytes_per_channel == 1)
+        source.stream_format = _image.format == DXGI_FORMAT_R8G8B8A8_UNORM_SRGB || _image.format == DXGI_FORMAT_B8G8R8A8_UNORM_SRGB ? GfxJit::TEXTURE_STREAM_FORMAT_UNORM8_SRGB
+                                                                                                                                 : GfxJit::TEXTURE_STREAM_FORMAT_UNORM8;
+    else if (_image.bytes_per_channel == 4)
+        source.stream_format = GfxJit::TEXTURE_STREAM_FORMAT_F32;
+    return source;
+}
+
 struct GpuScene {
     GfxContext gfx;
 
-    GfxScene          scene;
-    std::vector<Mesh> meshes;
+    GfxScene            scene;
+    std::vector<Mesh>   meshes;
+    GfxJit::MeshletData meshlets; // Meshlet ranges are indexed by mesh id like meshes
 
     GfxBuffer mesh_buffer;
     GfxBuffer index_buffer;
     GfxBuffer vertex_buffer;
+    GfxBuffer compact_vertex_buffer;        // Only with g_use_compact_vertices
+    GfxBuffer compact_vertex_bounds_buffer; // Per mesh dequantization bounds
     GfxBuffer instance_buffer;
     GfxBuffer material_buffer;
     GfxBuffer transform_buffer;
@@ -83,7 +153,14 @@ struct GpuScene {
     f32x3 aabb_max = f32x3_splat(-1.0e6);
     f32   size     = f32(0.0);
 
-    std::vector<GfxTexture> textures;
+    std::vector<AABB>    mesh_bounds;       // Object space, indexed by mesh id
+    std::vector<AABB>    instance_bounds;   // World space, indexed by instance id. Moved instances are updated by UpdateGpuScene
+    GfxJit::InstanceBVH  instance_bvh;
+    GfxJit::DirtyTracker transform_tracker; // Instances whose transform changed this frame
+
+    std::vector<GfxTexture>   textures;
+    GfxBuffer                 texture_feedback_buffer;  // Per texture, written by pbr.frag
+    GpuSceneTextureStreaming *texture_streaming = NULL; // Only with g_stream_textures
 
     GfxSamplerState texture_sampler;
 
@@ -93,6 +170,7 @@ struct GpuScene {
     std::vector<Instance> instances;
     std::vector<f32x4x4>  transforms;
 
+    // Builds the BLASes and the TLAS once, _invalidate rebuilds all of them for geometry changes. Moved instances only need UpdateTLAS.
     void BuildTLAS(bool _invalidate = false) {
         bool create_tlas = gfxIsRaytracingSupported(gfx);
 
@@ -113,9 +191,9 @@ struct GpuScene {
         for (uint32_t i = 0; i < gfxSceneGetInstanceCount(scene); ++i) {
             GfxConstRef<GfxInstance> const instance_ref = gfxSceneGetInstanceHandle(scene, i);
 
-            Instance             instance = {};
-            GfxConstRef<GfxMesh> mesh_ref = gfxSceneGetMeshHandle(scene, i);
-            instance.mesh_id              = (uint32_t)mesh_ref; // instance_ref->mesh;
+            Instance                   instance = {};
+            GfxConstRef<GfxMesh> const mesh_ref = instance_ref->mesh;
+            instance.mesh_id                    = (uint32_t)mesh_ref;
 
             uint32_t const instance_id = (uint32_t)instance_ref;
 
@@ -138,7 +216,7 @@ struct GpuScene {
                                           //| kGfxBuildRaytracingPrimitiveFlag_Opaque //
             );
 
-            f32x4x4 transform = glm::transpose(transforms[i]);
+            f32x4x4 transform = glm::transpose(transforms[instance_id]);
 
             // gfxRaytracingPrimitiveSetInstanceID(gfx, instance_id);
             gfxRaytracingPrimitiveSetTransform(gfx, rt_mesh, &transform[0][0]);
@@ -146,145 +224,212 @@ struct GpuScene {
         }
         gfxAccelerationStructureUpdate(gfx, acceleration_structure);
     }
+    // Moves the primitives of the instances marked in transform_tracker and refits the TLAS, the BLASes are left alone
+    void UpdateTLAS() {
+        if (!acceleration_structure || !transform_tracker.HasChanges()) return;
+
+        std::vector<GfxJit::DirtyRange> ranges = {};
+        transform_tracker.GetRanges(ranges);
+        for (auto const &r : ranges) {
+            for (u32 instance_id = r.begin; instance_id < r.end; instance_id++) {
+                if (instance_id >= raytracing_primitives.size() || !raytracing_primitives[instance_id]) continue;
+                f32x4x4 transform = glm::transpose(transforms[instance_id]);
+                gfxRaytracingPrimitiveSetTransform(gfx, raytracing_primitives[instance_id], &transform[0][0]);
+            }
+        }
+        gfxAccelerationStructureUpdate(gfx, acceleration_structure);
+    }
 };
 
-static GpuScene UploadSceneToGpuMemory(GfxContext gfx, GfxScene scene);
-static void     ReleaseGpuScene(GfxContext gfx, GpuScene const &gpu_scene);
+static GpuScene UploadSceneToGpuMemory(GfxContext gfx, GfxScene scene, char const *_scene_path = NULL);
+static void     ReleaseGpuScene(GfxContext gfx, GpuScene &gpu_scene);
 
 static void UpdateGpuScene(GfxContext gfx, GfxScene scene, GpuScene &gpu_scene);
+static void UpdateTextureStreaming(GfxContext gfx, GpuScene &gpu_scene);
 static void BindGpuScene(GfxContext gfx, GfxProgram program, GpuScene const &gpu_scene);
 
-static GpuScene UploadSceneToGpuMemory(GfxContext gfx, GfxScene scene) {
+static GpuScene UploadSceneToGpuMemory(GfxContext gfx, GfxScene scene, char const *_scene_path) {
+    using namespace GfxJit;
+
     GpuScene gpu_scene = {};
 
     gpu_scene.scene = scene;
     gpu_scene.gfx   = gfx;
 
-    // Load our materials
-    std::vector<Material> materials;
-
-    for (uint32_t i = 0; i < gfxSceneGetMaterialCount(scene); ++i) {
-        GfxConstRef<GfxMaterial> material_ref = gfxSceneGetMaterialHandle(scene, i);
-
-        Material material              = {};
-        material.albedo                = f32x4(f32x3(material_ref->albedo), glm::uintBitsToFloat((uint32_t)material_ref->albedo_map));
-        material.metallicity_roughness = f32x4(material_ref->metallicity, glm::uintBitsToFloat((uint32_t)material_ref->metallicity_map), material_ref->roughness,
-                                               glm::uintBitsToFloat((uint32_t)material_ref->roughness_map));
-        material.ao_normal_emissivity  = f32x4(glm::uintBitsToFloat((uint32_t)material_ref->ao_map), glm::uintBitsToFloat((uint32_t)material_ref->normal_map),
-                                               glm::uintBitsToFloat((uint32_t)material_ref->emissivity_map), 0.0f);
-
-        uint32_t const material_id = (uint32_t)material_ref;
+    static_assert(sizeof(Vertex) == sizeof(SceneCacheVertex), "");
+    static_assert(sizeof(Mesh) == sizeof(SceneCacheMesh), "");
+    static_assert(sizeof(Material) == sizeof(SceneCacheMaterial), "");
+    static_assert(sizeof(Instance) == sizeof(SceneCacheInstance), "");
+
+    // Flattened geometry, materials and instances come straight from the mapped scene cache when it matches the imported files
+    SceneCache     cache      = {};
+    SceneCacheData data       = {};
+    std::string    cache_path = {};
+    u64            source_key = u64(0);
+    bool           cache_hit  = false;
+    if (_scene_path) {
+        std::error_code ec = {};
+        std::filesystem::create_directories(".scene_cache", ec);
+        source_key = SceneCache::GetSourceKey(_scene_path);
+        char buf[0x40];
+        snprintf(buf, sizeof(buf), ".scene_cache/%016llx.bin", (unsigned long long)source_key);
+        cache_path = buf;
+        cache_hit  = cache.Open(cache_path.c_str(), source_key, data);
+    }
+    if (!cache_hit) {
+        SceneCacheSource source = {};
+
+        // Load our materials
+        for (uint32_t i = 0; i < gfxSceneGetMaterialCount(scene); ++i) {
+            GfxConstRef<GfxMaterial> material_ref = gfxSceneGetMaterialHandle(scene, i);
+
+            SceneCacheMaterial material    = {};
+            material.albedo                = f32x4(f32x3(material_ref->albedo), glm::uintBitsToFloat((uint32_t)material_ref->albedo_map));
+            material.metallicity_roughness = f32x4(material_ref->metallicity, glm::uintBitsToFloat((uint32_t)material_ref->metallicity_map), material_ref->roughness,
+                                                   glm::uintBitsToFloat((uint32_t)material_ref->roughness_map));
+            material.ao_normal_emissivity  = f32x4(glm::uintBitsToFloat((uint32_t)material_ref->ao_map), glm::uintBitsToFloat((uint32_t)material_ref->normal_map),
+                                                   glm::uintBitsToFloat((uint32_t)material_ref->emissivity_map), 0.0f);
+
+            uint32_t const material_id = (uint32_t)material_ref;
+
+            if (material_id >= source.materials.size()) {
+                source.materials.resize(material_id + 1);
+            }
 
-        if (material_id >= materials.size()) {
-            materials.resize(material_id + 1);
+            source.materials[material_id] = material;
         }
 
-        materials[material_id] = material;
-    }
-
-    gpu_scene.material_buffer = gfxCreateBuffer<Material>(gfx, (uint32_t)materials.size(), materials.data());
-
-    // Load our meshes
-    uint32_t first_index = 0;
-    uint32_t base_vertex = 0;
-
-    for (uint32_t i = 0; i < gfxSceneGetMeshCount(scene); ++i) {
-        GfxConstRef<GfxMesh> mesh_ref = gfxSceneGetMeshHandle(scene, i);
-
-        Mesh mesh        = {};
-        mesh.count       = (uint32_t)mesh_ref->indices.size();
-        mesh.first_index = first_index;
-        mesh.base_vertex = base_vertex;
-        mesh.material    = (uint32_t)mesh_ref->material;
-        // mesh.num_vertices = (uint32_t)mesh_ref->vertices.size();
+        // Our meshes, the vertices are converted by BuildSceneCacheData
+        for (uint32_t i = 0; i < gfxSceneGetMeshCount(scene); ++i) {
+            GfxConstRef<GfxMesh> mesh_ref = gfxSceneGetMeshHandle(scene, i);
 
-        uint32_t const mesh_id = (uint32_t)mesh_ref;
+            SceneCacheMeshSource mesh = {};
+            mesh.indices              = mesh_ref->indices.data();
+            mesh.num_indices          = (uint32_t)mesh_ref->indices.size();
+            mesh.positions            = (u8 const *)mesh_ref->vertices.data() + offsetof(GfxVertex, position);
+            mesh.normals              = (u8 const *)mesh_ref->vertices.data() + offsetof(GfxVertex, normal);
+            mesh.uvs                  = (u8 const *)mesh_ref->vertices.data() + offsetof(GfxVertex, uv);
+            mesh.position_stride      = u32(sizeof(GfxVertex));
+            mesh.normal_stride        = u32(sizeof(GfxVertex));
+            mesh.uv_stride            = u32(sizeof(GfxVertex));
+            mesh.num_vertices         = (uint32_t)mesh_ref->vertices.size();
+            mesh.material_id          = (uint32_t)mesh_ref->material;
+
+            uint32_t const mesh_id = (uint32_t)mesh_ref;
+
+            if (mesh_id >= source.meshes.size()) {
+                source.meshes.resize(mesh_id + 1);
+            }
 
-        if (mesh_id >= gpu_scene.meshes.size()) {
-            gpu_scene.meshes.resize(mesh_id + 1);
+            source.meshes[mesh_id] = mesh;
         }
 
-        gpu_scene.meshes[mesh_id] = mesh;
-
-        first_index += (uint32_t)mesh_ref->indices.size();
-        base_vertex += (uint32_t)mesh_ref->vertices.size();
-    }
-
-    gpu_scene.mesh_buffer = gfxCreateBuffer<Mesh>(gfx, (uint32_t)gpu_scene.meshes.size(), gpu_scene.meshes.data());
+        // Load our instances
+        for (uint32_t i = 0; i < gfxSceneGetInstanceCount(scene); ++i) {
+            GfxConstRef<GfxInstance> const instance_ref = gfxSceneGetInstanceHandle(scene, i);
 
-    // Load our vertices
-    std::vector<uint32_t> indices;
-    std::vector<Vertex>   vertices;
+            SceneCacheInstance instance = {};
+            instance.mesh_id            = (uint32_t)instance_ref->mesh;
 
-    for (uint32_t i = 0; i < gfxSceneGetMeshCount(scene); ++i) {
-        GfxConstRef<GfxMesh> mesh_ref = gfxSceneGetMeshHandle(scene, i);
+            uint32_t const instance_id = (uint32_t)instance_ref;
 
-        std::vector<uint32_t> const &index_buffer = mesh_ref->indices;
+            if (instance_id >= source.instances.size()) {
+                source.instances.resize(instance_id + 1);
+                source.transforms.resize(instance_id + 1);
+            }
 
-        for (uint32_t index : index_buffer) {
-            indices.push_back(index);
+            source.instances[instance_id]  = instance;
+            source.transforms[instance_id] = instance_ref->transform;
         }
 
-        std::vector<GfxVertex> const &vertex_buffer = mesh_ref->vertices;
-
-        for (GfxVertex vertex : vertex_buffer) {
-            Vertex gpu_vertex = {};
-
-            gpu_vertex.position = f32x4(vertex.position, 1.0f);
-            gpu_vertex.normal   = f32x4(vertex.normal, 0.0f);
-            gpu_vertex.uv       = glm::vec2(vertex.uv);
-
-            vertices.push_back(gpu_vertex);
-        }
+        BuildSceneCacheData(source, data);
+        if (_scene_path && !SceneCache::Write(cache_path.c_str(), source_key, data)) fprintf(stdout, "[SCENE CACHE] Failed to write %s\n", cache_path.c_str());
     }
 
-    gpu_scene.index_buffer  = gfxCreateBuffer<uint32_t>(gfx, (uint32_t)indices.size(), indices.data());
-    gpu_scene.vertex_buffer = gfxCreateBuffer<Vertex>(gfx, (uint32_t)vertices.size(), vertices.data());
+    gpu_scene.meshes.resize(data.num_meshes);
+    if (data.num_meshes) memcpy(gpu_scene.meshes.data(), data.meshes, sizeof(Mesh) * data.num_meshes);
+    BuildMeshlets(data, gpu_scene.meshlets);
 
-    // Load our instances
-    std::vector<Instance> instances;
-    std::vector<f32x4x4>  transforms;
-
-    for (uint32_t i = 0; i < gfxSceneGetInstanceCount(scene); ++i) {
-        GfxConstRef<GfxInstance> const instance_ref = gfxSceneGetInstanceHandle(scene, i);
+    gpu_scene.material_buffer = gfxCreateBuffer<Material>(gfx, data.num_materials, data.materials);
+    gpu_scene.mesh_buffer     = gfxCreateBuffer<Mesh>(gfx, data.num_meshes, data.meshes);
+    gpu_scene.index_buffer    = gfxCreateBuffer<uint32_t>(gfx, data.num_indices, data.indices);
+    gpu_scene.vertex_buffer   = gfxCreateBuffer<Vertex>(gfx, data.num_vertices, data.vertices);
 
-        Instance             instance = {};
-        GfxConstRef<GfxMesh> mesh_ref = gfxSceneGetMeshHandle(scene, i);
-        instance.mesh_id              = (uint32_t)mesh_ref; // instance_ref->mesh;
+    // The full precision stream stays for the BLAS builds and the rasterizer's input layout
+    if (g_use_compact_vertices) {
+        std::vector<CompactVertex>       compact_vertices = {};
+        std::vector<CompactVertexBounds> compact_bounds   = {};
+        EncodeCompactVertices(data, compact_vertices, compact_bounds);
+        gpu_scene.compact_vertex_buffer        = gfxCreateBuffer<CompactVertex>(gfx, u32(compact_vertices.size()), compact_vertices.data());
+        gpu_scene.compact_vertex_bounds_buffer = gfxCreateBuffer<CompactVertexBounds>(gfx, u32(compact_bounds.size()), compact_bounds.data());
 
-        uint32_t const instance_id = (uint32_t)instance_ref;
+        CompactVertexStats stats = GetCompactVertexStats(data, compact_vertices, compact_bounds);
+        // Both streams are resident, the compact one only cuts what the shading passes read
+        fprintf(stdout, "[COMPACT VERTICES] %llu vertices: %f MB full + %f MB compact = %f MB resident, max error: position %f, normal %f rad, uv %f\n",
+                (unsigned long long)stats.num_vertices, f64(stats.full_bytes) / f64(1 << 20), f64(stats.compact_bytes) / f64(1 << 20),
+                f64(stats.full_bytes + stats.compact_bytes) / f64(1 << 20), stats.max_position_error, stats.max_normal_error, stats.max_uv_error);
+    }
 
-        if (instance_id >= instances.size()) {
-            instances.resize(instance_id + 1);
-            transforms.resize(instance_id + 1);
-            gpu_scene.raytracing_primitives.resize(instance_id + 1);
-        }
+    gpu_scene.raytracing_primitives.resize(data.num_instances);
 
-        instances[instance_id]  = instance;
-        transforms[instance_id] = instance_ref->transform;
+    // Cached data only carries the scene box, the per instance boxes are rebuilt from the vertices
+    AABB scene_bounds = {};
+    ComputeMeshBounds(data, gpu_scene.mesh_bounds);
+    ComputeInstanceBounds(data, gpu_scene.mesh_bounds, gpu_scene.instance_bounds, scene_bounds);
+    gpu_scene.instance_bvh.Build(gpu_scene.instance_bounds);
 
-        f32x3 aabb_min = mesh_ref->bounds_min;
-        f32x3 aabb_max = mesh_ref->bounds_max;
-        aabb_min       = mul(instance_ref->transform, aabb_min);
-        aabb_max       = mul(instance_ref->transform, aabb_max);
+    // CPU copies UpdateGpuScene compares against
+    gpu_scene.instances.resize(data.num_instances);
+    if (data.num_instances) memcpy(gpu_scene.instances.data(), data.instances, sizeof(Instance) * data.num_instances);
+    gpu_scene.transforms.assign(data.transforms, data.transforms + data.num_instances);
+    gpu_scene.transform_tracker.Resize(data.num_instances);
 
-        xfor(3) gpu_scene.aabb_min[x] = std::min(gpu_scene.aabb_min[x], aabb_min[x]);
-        xfor(3) gpu_scene.aabb_max[x] = std::max(gpu_scene.aabb_max[x], aabb_max[x]);
-    }
+    gpu_scene.aabb_min     = data.aabb_min;
+    gpu_scene.aabb_max     = data.aabb_max;
     gpu_scene.size         = f32(0.0);
     xfor(3) gpu_scene.size = std::max(gpu_scene.size, gpu_scene.aabb_max[x] - gpu_scene.aabb_min[x]);
 
-    gpu_scene.instance_buffer           = gfxCreateBuffer<Instance>(gfx, (uint32_t)instances.size(), instances.data());
-    gpu_scene.transform_buffer          = gfxCreateBuffer<f32x4x4>(gfx, (uint32_t)transforms.size(), transforms.data());
-    gpu_scene.previous_transform_buffer = gfxCreateBuffer<f32x4x4>(gfx, (uint32_t)transforms.size(), transforms.data());
+    gpu_scene.instance_buffer           = gfxCreateBuffer<Instance>(gfx, data.num_instances, data.instances);
+    gpu_scene.transform_buffer          = gfxCreateBuffer<f32x4x4>(gfx, data.num_instances, data.transforms);
+    gpu_scene.previous_transform_buffer = gfxCreateBuffer<f32x4x4>(gfx, data.num_instances, data.transforms);
 
     for (GfxBuffer &upload_transform_buffer : gpu_scene.upload_transform_buffers) {
-        upload_transform_buffer = gfxCreateBuffer<f32x4x4>(gfx, (uint32_t)transforms.size(), nullptr, kGfxCpuAccess_Write);
+        upload_transform_buffer = gfxCreateBuffer<f32x4x4>(gfx, data.num_instances, nullptr, kGfxCpuAccess_Write);
+    }
+
+    // Streamed textures get their offline mip chains from the texture cache, whatever it can't stream is uploaded below at full resolution
+    GpuSceneTextureStreaming *streaming = NULL;
+    if (g_stream_textures && _scene_path) {
+        streaming = new GpuSceneTextureStreaming();
+
+        u64  texture_key = TextureCache::GetSourceKey(_scene_path);
+        char buf[0x40];
+        snprintf(buf, sizeof(buf), ".scene_cache/%016llx.tex", (unsigned long long)texture_key);
+        if (!streaming->cache.Open(buf, texture_key)) {
+            std::vector<TextureCacheSource> sources = {};
+            for (uint32_t i = 0; i < gfxSceneGetImageCount(scene); ++i) {
+                GfxConstRef<GfxImage> const image_ref = gfxSceneGetImageHandle(scene, i);
+                uint32_t const              image_id  = (uint32_t)image_ref;
+                if (image_id >= sources.size()) sources.resize(image_id + 1);
+                sources[image_id] = GetTextureCacheSource(*image_ref);
+            }
+            if (TextureCache::Write(buf, texture_key, sources)) streaming->cache.Open(buf, texture_key);
+        }
     }
+    auto is_streamed = [&](GfxImage const &_image, uint32_t _image_id) {
+        if (!streaming || !streaming->cache.IsStreamable(_image_id)) return false;
+        TextureCache::Entry const &e = streaming->cache.GetEntry(_image_id);
+        return e.width == _image.width && e.height == _image.height && e.channels == _image.channel_count && e.format == u32(_image.format);
+    };
 
     for (uint32_t i = 0; i < gfxSceneGetImageCount(scene); ++i) {
         GfxConstRef<GfxImage> const image_ref = gfxSceneGetImageHandle(scene, i);
 
+        if (is_streamed(*image_ref, (uint32_t)image_ref)) {
+            if ((uint32_t)image_ref >= gpu_scene.textures.size()) gpu_scene.textures.resize((uint32_t)image_ref + 1);
+            continue;
+        }
+
         GfxTexture texture = gfxCreateTexture2D(gfx, image_ref->width, image_ref->height, image_ref->format, gfxCalculateMipCount(image_ref->width, image_ref->height));
 
         uint32_t const texture_size = image_ref->width * image_ref->height * image_ref->channel_count * image_ref->bytes_per_channel;
@@ -304,15 +449,30 @@ static GpuScene UploadSceneToGpuMemory(GfxContext gfx, GfxScene scene) {
         gpu_scene.textures[image_id] = texture;
     }
 
+    if (streaming) {
+        streaming->device.gfx      = gfx;
+        streaming->device.textures = &gpu_scene.textures;
+        streaming->device.cache    = &streaming->cache;
+        streaming->streamer.reset(new TextureStreamer(&streaming->cache, &streaming->device));
+        streaming->streamer->LoadMipTails();
+        for (GfxBuffer &feedback_readback_buffer : streaming->feedback_readback_buffers)
+            feedback_readback_buffer = gfxCreateBuffer<u32>(gfx, std::max(u32(1), u32(gpu_scene.textures.size())), nullptr, kGfxCpuAccess_Read);
+        gpu_scene.texture_streaming = streaming;
+    }
+    gpu_scene.texture_feedback_buffer = gfxCreateBuffer<u32>(gfx, std::max(u32(1), u32(gpu_scene.textures.size())));
+
     gpu_scene.texture_sampler = gfxCreateSamplerState(gfx, D3D12_FILTER_ANISOTROPIC, D3D12_TEXTURE_ADDRESS_MODE_WRAP, D3D12_TEXTURE_ADDRESS_MODE_WRAP);
 
     return gpu_scene;
 }
 
-static void ReleaseGpuScene(GfxContext gfx, GpuScene const &gpu_scene) {
+static void ReleaseGpuScene(GfxContext gfx, GpuScene &gpu_scene) {
+    gpu_scene.instance_bvh.Release();
     gfxDestroyBuffer(gfx, gpu_scene.mesh_buffer);
     gfxDestroyBuffer(gfx, gpu_scene.index_buffer);
     gfxDestroyBuffer(gfx, gpu_scene.vertex_buffer);
+    if (gpu_scene.compact_vertex_buffer) gfxDestroyBuffer(gfx, gpu_scene.compact_vertex_buffer);
+    if (gpu_scene.compact_vertex_bounds_buffer) gfxDestroyBuffer(gfx, gpu_scene.compact_vertex_bounds_buffer);
     gfxDestroyBuffer(gfx, gpu_scene.instance_buffer);
     gfxDestroyBuffer(gfx, gpu_scene.material_buffer);
     gfxDestroyBuffer(gfx, gpu_scene.transform_buffer);
@@ -322,6 +482,16 @@ static void ReleaseGpuScene(GfxContext gfx, GpuScene const &gpu_scene) {
         gfxDestroyBuffer(gfx, upload_transform_buffer);
     }
 
+    if (gpu_scene.texture_streaming) {
+        gpu_scene.texture_streaming->streamer.reset();
+        for (GfxBuffer feedback_readback_buffer : gpu_scene.texture_streaming->feedback_readback_buffers) {
+            gfxDestroyBuffer(gfx, feedback_readback_buffer);
+        }
+        delete gpu_scene.texture_streaming;
+        gpu_scene.texture_streaming = NULL;
+    }
+    gfxDestroyBuffer(gfx, gpu_scene.texture_feedback_buffer);
+
     for (GfxTexture texture : gpu_scene.textures) {
         gfxDestroyTexture(gfx, texture);
     }
@@ -329,7 +499,13 @@ static void ReleaseGpuScene(GfxContext gfx, GpuScene const &gpu_scene) {
     gfxDestroySamplerState(gfx, gpu_scene.texture_sampler);
 }
 
+// Only instances whose transform changed are uploaded, the previous transforms catch up one frame after an instance stops moving
 static void UpdateGpuScene(GfxContext gfx, GfxScene scene, GpuScene &gpu_scene) {
+    using namespace GfxJit;
+
+    // Clean instances inside a gap are copied along, the whole range is rewritten into the upload buffer for that
+    static constexpr u32 MAX_COPY_GAP = u32(16);
+
     GfxBuffer upload_transform_buffer = gpu_scene.upload_transform_buffers[gfxGetBackBufferIndex(gfx)];
 
     f32x4x4 *transforms = gfxBufferGetData<f32x4x4>(gfx, upload_transform_buffer);
@@ -341,14 +517,64 @@ static void UpdateGpuScene(GfxContext gfx, GfxScene scene, GpuScene &gpu_scene)
 
         uint32_t const instance_id = (uint32_t)instance_ref;
 
-        transforms[instance_id] = instance_ref->transform;
+        if (instance_id >= gpu_scene.transforms.size() || memcmp(&gpu_scene.transforms[instance_id], &instance_ref->transform, sizeof(f32x4x4)) == 0) continue;
+
+        gpu_scene.transforms[instance_id] = instance_ref->transform;
+        gpu_scene.transform_tracker.MarkDirty(instance_id);
     }
 
-    gfxCommandCopyBuffer(gfx, gpu_scene.previous_transform_buffer, gpu_scene.transform_buffer);
+    std::vector<DirtyRange> ranges = {};
+    gpu_scene.transform_tracker.GetRanges(ranges, MAX_COPY_GAP, /* include_previous */ true);
+    for (auto const &r : ranges)
+        gfxCommandCopyBuffer(gfx, gpu_scene.previous_transform_buffer, u64(r.begin) * sizeof(f32x4x4), gpu_scene.transform_buffer, u64(r.begin) * sizeof(f32x4x4),
+                             u64(r.GetSize()) * sizeof(f32x4x4));
 
-    gfxCommandCopyBuffer(gfx, gpu_scene.transform_buffer, upload_transform_buffer);
+    gpu_scene.transform_tracker.GetRanges(ranges, MAX_COPY_GAP);
+    for (auto const &r : ranges) {
+        memcpy(transforms + r.begin, gpu_scene.transforms.data() + r.begin, u64(r.GetSize()) * sizeof(f32x4x4));
+        gfxCommandCopyBuffer(gfx, gpu_scene.transform_buffer, u64(r.begin) * sizeof(f32x4x4), upload_transform_buffer, u64(r.begin) * sizeof(f32x4x4),
+                             u64(r.GetSize()) * sizeof(f32x4x4));
+    }
+
+    if (gpu_scene.transform_tracker.HasChanges()) {
+        for (auto const &r : ranges) {
+            for (u32 instance_id = r.begin; instance_id < r.end; instance_id++) {
+                u32 mesh_id = gpu_scene.instances[instance_id].mesh_id;
+                gpu_scene.instance_bounds[instance_id] = mesh_id < gpu_scene.mesh_bounds.size() && !IsAABBEmpty(gpu_scene.mesh_bounds[mesh_id])
+                                                             ? TransformAABB(gpu_scene.transforms[instance_id], gpu_scene.mesh_bounds[mesh_id])
+                                                             : GetEmptyAABB();
+            }
+        }
+        gpu_scene.instance_bvh.Build(gpu_scene.instance_bounds);
+    }
 
     gpu_scene.BuildTLAS();
+    gpu_scene.UpdateTLAS();
+
+    gpu_scene.transform_tracker.EndFrame();
+}
+
+// Turns the feedback of the frame that last used this back buffer into mip requests, uploads what the streaming workers finished and clears the feedback
+// for this frame. Call before the visibility pass and copy texture_feedback_buffer into the readback slot after it.
+static void UpdateTextureStreaming(GfxContext gfx, GpuScene &gpu_scene) {
+    using namespace GfxJit;
+
+    GpuSceneTextureStreaming *streaming = gpu_scene.texture_streaming;
+    if (streaming) {
+        if (streaming->num_frames >= kGfxConstant_BackBufferCount) {
+            u32 const          *feedback = gfxBufferGetData<u32>(gfx, streaming->feedback_readback_buffers[gfxGetBackBufferIndex(gfx)]);
+            TextureCache const &cache    = streaming->cache;
+            ifor(cache.GetNumTextures()) {
+                if (!cache.IsStreamable(i) || i >= gpu_scene.textures.size()) continue;
+                TextureCache::Entry const &e = cache.GetEntry(i);
+                streaming->streamer->Request(i, GetTextureFeedbackMip(feedback[i], e.width, e.height, e.num_mips));
+            }
+        }
+        streaming->num_frames++;
+        streaming->device.textures = &gpu_scene.textures;
+        streaming->streamer->Update();
+    }
+    gfxCommandClearBuffer(gfx, gpu_scene.texture_feedback_buffer, 0);
 }
 
 static void BindGpuScene(GfxContext gfx, GfxProgram program, GpuScene const &gpu_scene) {
@@ -361,6 +587,7 @@ static void BindGpuScene(GfxContext gfx, GfxProgram program, GpuScene const &gpu
     gfxProgramSetParameter(gfx, program, "g_PreviousTransformBuffer", gpu_scene.previous_transform_buffer);
     gfxProgramSetParameter(gfx, program, "g_Textures", gpu_scene.textures.data(), (uint32_t)gpu_scene.textures.size());
     gfxProgramSetParameter(gfx, program, "g_TextureSampler", gpu_scene.texture_sampler);
+    gfxProgramSetParameter(gfx, program, "g_TextureFeedback", gpu_scene.texture_feedback_buffer);
 }
 
 namespace GfxJit {
@@ -474,7 +701,23 @@ static SharedPtr<Type> Vertex_Ty = Type::Create("Vertex", {
                                                               {"uv", f32x2Ty},       //
                                                           });
 
-static HashMap<String, ResourceSlot> g_global_runtime_resource_registry = {};
+static SharedPtr<Type> CompactVertex_Ty = Type::Create("CompactVertex", {
+                                                                            {"position_xy", u32Ty}, //
+                                                                            {"position_z", u32Ty},  //
+                                                                            {"normal", u32Ty},      //
+                                                                            {"uv", u32Ty},          //
+                                                                        });
+
+static SharedPtr<Type> CompactVertexBounds_Ty = Type::Create("CompactVertexBounds", {
+                                                                                        {"bounds_min", f32x4Ty}, //
+                                                                                        {"bounds_max", f32x4Ty}, //
+                                                                                    });
+
+struct GlobalResourceRegistry : public GlobalBindings<ResourceSlot> {
+    using GlobalBindings<ResourceSlot>::operator[];
+    ResourceSlot &operator[](String const &_name) { return GlobalBindings<ResourceSlot>::operator[](_name.c_str()); }
+};
+static GlobalResourceRegistry g_global_runtime_resource_registry = {};
 template <typename T>
 void set_global_resource(var access, T val) {
     g_global_runtime_resource_registry[access->GetResource()->GetName()] = val;
@@ -515,9 +758,37 @@ struct SlotManager {
     }
 };
 
+class GfxTexturePoolDevice : public ITexturePoolDevice {
+private:
+    GfxContext              gfx      = {};
+    SlotManager<GfxTexture> textures = {};
+
+public:
+    GfxTexturePoolDevice(GfxContext _gfx) : gfx(_gfx) {}
+
+    TexturePoolHandle CreateTexture(TexturePoolKey const &_key) override {
+        GfxTexture t = {};
+        if (_key.depth == u32(1))
+            t = gfxCreateTexture2D(gfx, _key.width, _key.height, DXGI_FORMAT(_key.format), _key.mip_levels);
+        else
+            t = gfxCreateTexture3D(gfx, _key.width, _key.height, _key.depth, DXGI_FORMAT(_key.format), _key.mip_levels);
+        sjit_assert(t);
+        return TexturePoolHandle(textures.AddItem(t));
+    }
+    void DestroyTexture(TexturePoolHandle _texture) override {
+        gfxDestroyTexture(gfx, textures.items[u32(_texture)]);
+        textures.RemoveItem(u32(_texture));
+    }
+    GfxTexture GetTexture(TexturePoolHandle _texture) { return textures.items[u32(_texture)]; }
+};
+
+static bool g_report_texture_pool_stats = false; // Print the texture pool counters for every frame that had to allocate
+
 class GfxResourceRegistry {
     SlotManager<IGfxResourceRegistryItem *>     items                     = {};
     HashMap<String, IGfxResourceRegistryItem *> runtime_resource_registry = {};
+    std::unique_ptr<GfxTexturePoolDevice>       texture_device            = {};
+    std::unique_ptr<TexturePool>                texture_pool              = {};
 
     static GfxResourceRegistry &Get() {
         static GfxResourceRegistry o = {};
@@ -535,6 +806,13 @@ class GfxResourceRegistry {
                 items.items[i]->Update();
             }
         }
+        if (texture_pool) {
+            texture_pool->EndFrame();
+            TexturePoolStats const &stats = texture_pool->GetLastFrameStats();
+            if (g_report_texture_pool_stats && stats.num_allocations)
+                fprintf(stdout, "[TEXTURE POOL] %i allocations, %i evictions, hit rate %f (total %f), %i textures\n", i32(stats.num_allocations), i32(stats.num_evictions),
+                        stats.GetHitRate(), texture_pool->GetTotalStats().GetHitRate(), i32(texture_pool->GetNumTextures()));
+        }
     }
     void _release() {
         ifor(items.items.size()) {
@@ -543,12 +821,26 @@ class GfxResourceRegistry {
             }
         }
         items = {};
+        texture_pool.reset();
+        texture_device.reset();
+    }
+    TexturePool &_get_texture_pool(GfxContext _gfx) {
+        if (!texture_pool) {
+            texture_device.reset(new GfxTexturePoolDevice(_gfx));
+            texture_pool.reset(new TexturePool(texture_device.get()));
+        }
+        return *texture_pool;
     }
 
 public:
     static void                                         AddResource(IGfxResourceRegistryItem *_item) { Get()._add_resource(_item); }
     static void                                         Update() { Get()._update(); }
     static HashMap<String, IGfxResourceRegistryItem *> &GetResources() { return Get().runtime_resource_registry; }
+    // Transient textures, reused by key across frames and passes
+    static TexturePoolHandle AcquireTexture(GfxContext _gfx, TexturePoolKey const &_key) { return Get()._get_texture_pool(_gfx).Acquire(_key); }
+    static void              ReleaseTexture(TexturePoolHandle _texture) { Get().texture_pool->Release(_texture); }
+    static GfxTexture        GetTexture(TexturePoolHandle _texture) { return Get().texture_device->GetTexture(_texture); }
+    static TexturePoolStats  GetTexturePoolStats() { return Get().texture_pool ? Get().texture_pool->GetTotalStats() : TexturePoolStats{}; }
 };
 struct TimestampPool {
     static constexpr u32                    num_timesptams = u32(1 << 16);
@@ -562,6 +854,11 @@ struct TimestampPool {
     }
     void Release() {}
 };
+// Frame scopes, GPUKernel::Begin/End record into it and the frame loop closes frames
+static Profiler &GetProfiler() {
+    static Profiler profiler;
+    return profiler;
+}
 struct GPUKernel {
     String                               name             = {};
     u32x3                                group_size       = {u32(8), u32(8), u32(1)};
@@ -571,18 +868,23 @@ struct GPUKernel {
     std::string                          isa              = {};
     u32                                  reg_pressure     = u32(0);
     HashMap<String, SharedPtr<Resource>> resources        = {};
-    HashMap<String, ResourceSlot>        set_resources    = {};
+    BindingTable<ResourceSlot>           bindings         = {};
     GfxTimestampQuery                    timestamps[3][2] = {};
     u32                                  timestamp_idx    = u32(0);
+    u32x3                                dispatch_size    = {}; // Groups of the last Dispatch, reported to the profiler
     f64                                  duration         = f64(0.0);
     Array<u8>                            bytecode         = {};
+    u64                                  text_check       = u64(0); // HLSLModule::GetEmittedTextCheck of the module it was compiled from
 
-    void SetResource(char const *_name, ResourceSlot slot) {
-        auto it = set_resources.find(_name);
-        if (it != set_resources.end()) {
-            if (it->second == slot) return; // no need
-        }
-        set_resources[_name] = slot;
+    void InitBindings() {
+        std::vector<std::string> names = {};
+        for (auto &r : resources) names.push_back(r.first.c_str());
+        bindings.Init(names, g_global_runtime_resource_registry);
+    }
+    u32  GetSlot(char const *_name) { return bindings.Find(_name); }
+    void SetResource(u32 _slot, ResourceSlot const &slot, bool _override = false) { bindings.Set(_slot, slot, _override); }
+    void SetResource(char const *_name, ResourceSlot slot) { bindings.Set(_name, slot); }
+    void ApplyResource(char const *_name, ResourceSlot const &slot) {
         switch (slot.type) {
         case RESOURCE_TYPE_TEXTURE: {
             if (slot.textures.size())
@@ -645,46 +947,21 @@ struct GPUKernel {
     }
     template <typename T>
     void SetResource(ValueExpr res, T _v, bool _override = false) {
-        ResourceSlot slot = ResourceSlot(_v);
-        auto         it   = set_resources.find(res->GetResource()->GetName().c_str());
-        if (it != set_resources.end() && !_override) {
-            if (it->second == slot) return; // no need
-        }
-        set_resources[res->GetResource()->GetName().c_str()] = slot;
-        gfxProgramSetParameter(gfx, program, res->GetResource()->GetName().c_str(), _v);
+        bindings.Set(res->GetResource()->GetName().c_str(), ResourceSlot(_v), _override);
     }
     template <typename T>
     void SetResource(char const *_name, T _v, bool _override = false) {
-        ResourceSlot slot = ResourceSlot(_v);
-        auto         it   = set_resources.find(_name);
-        if (it != set_resources.end() && !_override) {
-            if (it->second == slot) return; // no need
-        }
-        set_resources[_name] = slot;
-        gfxProgramSetParameter(gfx, program, _name, _v);
+        bindings.Set(_name, ResourceSlot(_v), _override);
     }
     template <typename T>
     void SetResource(char const *_name, T _v, u32 _num, bool _override = false) {
-        ResourceSlot slot = ResourceSlot(_v, _num);
-        auto         it   = set_resources.find(_name);
-        if (it != set_resources.end() && !_override) {
-            if (it->second == slot) return; // no need
-        }
-        set_resources[_name] = slot;
-        gfxProgramSetParameter(gfx, program, _name, _v, _num);
+        bindings.Set(_name, ResourceSlot(_v, _num), _override);
     }
+    // Pushes the bindings that changed since the last dispatch, unset slots come from the global registry
     void CheckResources() {
-        for (auto &r : resources) {
-            // sjit_assert(set_resources.find(r.first) != set_resources.end());
-            if (set_resources.find(r.first) == set_resources.end()) {
-                auto it = g_global_runtime_resource_registry.find(r.first);
-                if (it != g_global_runtime_resource_registry.end()) {
-                    SetResource(it->first.c_str(), it->second);
-                } else {
-                    SJIT_TRAP;
-                }
-            }
-        }
+        bool complete = bindings.Flush(g_global_runtime_resource_registry,
+                                       [&](u32 _slot, std::string const &_name, ResourceSlot const &_value) { ApplyResource(_name.c_str(), _value); });
+        if (!complete) SJIT_TRAP;
     }
     void Begin() {
         ifor(3) jfor(2) {
@@ -693,6 +970,11 @@ struct GPUKernel {
 
         gfxCommandBeginEvent(gfx, name.c_str());
         gfxCommandBeginTimestampQuery(gfx, timestamps[timestamp_idx][0]);
+        GetProfiler().BeginGpuScope(name.c_str());
+    }
+    void Dispatch(u32 _x, u32 _y, u32 _z) {
+        dispatch_size = u32x3(_x, _y, _z);
+        gfxCommandDispatch(gfx, _x, _y, _z);
     }
     void End() {
         gfxCommandEndTimestampQuery(gfx, timestamps[timestamp_idx][0]);
@@ -700,9 +982,15 @@ struct GPUKernel {
 
         duration = (f64)gfxTimestampQueryGetDuration(gfx, timestamps[timestamp_idx][0]);
 
+        ProfileKernelInfo info = {};
+        info.group_size        = group_size;
+        info.dispatch_size     = dispatch_size;
+        info.reg_pressure      = reg_pressure;
+        GetProfiler().EndGpuScope(duration, &info);
+
         defer(timestamp_idx = (timestamp_idx + u32(1)) % u32(3));
     }
-    void ResetTable() { set_resources.clear(); }
+    void ResetTable() { bindings.ResetTable(); }
     void Destroy() {
         ifor(3) jfor(2) {
             if (timestamps[i][j]) gfxDestroyTimestampQuery(gfx, timestamps[i][j]);
@@ -714,9 +1002,132 @@ struct GPUKernel {
     bool IsValid() { return !!program && !!kernel; }
 };
 
-static HashMap<String, GPUKernel *> g_kernel_registry = {};
-static HashMap<String, double>      g_pass_durations  = {};
-static GPUKernel                    CompileGlobalModule(GfxContext gfx, String _name) {
+static HashMap<u64, Array<GPUKernel *>> g_kernel_cache   = {}; // Emitted text hash -> kernels, told apart by their text check
+static HashMap<String, double>          g_pass_durations = {};
+static bool g_format_hlsl_dumps = false; // Run clang-format on the .hlsl dumps in the background
+static bool g_compare_schedule  = false; // Also compile every kernel without SJIT scheduling and print both vgpr counts
+static bool g_report_type_stats = false; // Print Type::Create* calls vs interned type allocations and emission time per kernel
+// Same default gfx picks, passed explicitly so the key and the compile can't disagree
+static char const *GetKernelShaderModel(GfxContext gfx) { return gfxIsRaytracingSupported(gfx) ? "6_5" : "6_0"; }
+// Anything that changes the bytecode for the same text has to be part of the key: the arguments ThreadDxcCompiler hands DXC
+// (the ones compileShader in gfx.h uses, SJIT text has no includes or defines) and the DXC build.
+static std::string GetKernelCacheFlags(GfxContext gfx) {
+    std::string flags = std::string("-E main -T cs_") + GetKernelShaderModel(gfx) + " -HV 2021";
+    if (gfxIsShaderDebuggingEnabled(gfx)) flags += " -Zi -O0 -Zss";
+    flags += ";dxc ";
+    flags += gfxGetShaderCompilerVersion(gfx);
+    return flags;
+}
+// GfxContext isn't thread safe, everything that touches it from the build workers goes through this
+static std::mutex &GetGfxMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+static KernelCache &GetKernelCache() {
+    static KernelCache cache(".shader_cache");
+    return cache;
+}
+static Array<KernelCacheResource> ReflectModuleResources() {
+    using namespace SJIT;
+    Array<KernelCacheResource> resources = {};
+    for (auto &r : GetGlobalModule().GetResources()) resources.push_back({r.first.c_str(), r.second->GetType()->GetName().c_str(), r.second->GetArraySize()});
+    std::sort(resources.begin(), resources.end(), [](KernelCacheResource const &a, KernelCacheResource const &b) { return a.name < b.name; });
+    return resources;
+}
+static u32 ParseRegPressure(std::string const &_isa) {
+    if (_isa.size() == size_t(0)) return u32(0);
+    char const *p = strstr(_isa.c_str(), "vgpr_count(");
+    if (p == NULL) return u32(0);
+    p += strlen("vgpr_count(");
+    char buf[16] = {};
+    int  l       = 0;
+    while (l < int(sizeof(buf) - 1) && p[l] >= '0' && p[l] <= '9') {
+        buf[l] = p[l];
+        l++;
+    }
+    sjit_assert(l);
+    return u32(std::atoi(buf));
+}
+// DXC instances aren't shared between threads, every build worker compiles on its own so that compiles don't wait on the gfx lock.
+// The arguments are the ones gfx passes for a GfxProgramDesc::Compute program, GetKernelCacheFlags has to stay in sync with them.
+class ThreadDxcCompiler {
+private:
+    IDxcUtils     *utils    = NULL;
+    IDxcCompiler3 *compiler = NULL;
+
+public:
+    SJIT_DONT_MOVE(ThreadDxcCompiler);
+    ThreadDxcCompiler() {}
+    ~ThreadDxcCompiler() {
+        if (compiler) compiler->Release();
+        if (utils) utils->Release();
+    }
+    static ThreadDxcCompiler &Get() {
+        static thread_local ThreadDxcCompiler dxc;
+        return dxc;
+    }
+    // Fills the bytecode and the DXC_OUT_REFLECTION blob, the rest of the entry is left alone
+    bool Compile(char const *_text, char const *_shader_model, bool _debug, KernelCacheEntry &_entry) {
+        if (compiler == NULL) {
+            if (!SUCCEEDED(DxcCreateInstance(CLSID_DxcUtils, IID_PPV_ARGS(&utils))) || !SUCCEEDED(DxcCreateInstance(CLSID_DxcCompiler, IID_PPV_ARGS(&compiler))))
+                return false;
+        }
+        char  profile[16]  = {};
+        WCHAR wprofile[16] = {};
+        snprintf(profile, sizeof(profile), "cs_%s", _shader_model);
+        mbstowcs(wprofile, profile, SJIT_ARRAYSIZE(wprofile));
+        std::vector<LPCWSTR> args = {L"-E", L"main", L"-T", wprofile, L"-HV 2021"};
+        if (_debug) {
+            args.push_back(DXC_ARG_DEBUG);
+            args.push_back(DXC_ARG_OPTIMIZATION_LEVEL0);
+            args.push_back(DXC_ARG_DEBUG_NAME_FOR_SOURCE);
+        }
+        DxcBuffer source = {};
+        source.Ptr       = _text;
+        source.Size      = strlen(_text);
+        IDxcResult *result = NULL;
+        compiler->Compile(&source, args.data(), u32(args.size()), NULL, IID_PPV_ARGS(&result));
+        if (result == NULL) return false;
+        defer(result->Release());
+        HRESULT status = E_FAIL;
+        result->GetStatus(&status);
+        if (FAILED(status)) {
+            IDxcBlobEncoding *errors = NULL;
+            result->GetErrorBuffer(&errors);
+            if (errors) {
+                if (errors->GetBufferPointer()) fprintf(stdout, "%s\n", (char const *)errors->GetBufferPointer());
+                errors->Release();
+            }
+            return false;
+        }
+        IDxcBlob *bytecode   = NULL;
+        IDxcBlob *reflection = NULL;
+        result->GetResult(&bytecode);
+        result->GetOutput(DXC_OUT_REFLECTION, IID_PPV_ARGS(&reflection), NULL);
+        defer({
+            if (bytecode) bytecode->Release();
+            if (reflection) reflection->Release();
+        });
+        if (bytecode == NULL || reflection == NULL) return false;
+        _entry.bytecode.assign((u8 const *)bytecode->GetBufferPointer(), (u8 const *)bytecode->GetBufferPointer() + bytecode->GetBufferSize());
+        _entry.reflection.assign((u8 const *)reflection->GetBufferPointer(), (u8 const *)reflection->GetBufferPointer() + reflection->GetBufferSize());
+        return true;
+    }
+};
+// Only creating the gfx objects needs the gfx lock, DXC and the cache run on the calling thread
+static GfxKernel CreateKernelFromEntry(GfxContext gfx, KernelCacheEntry const &_entry, GfxProgram &_program, std::string &_isa, u32x3 &_group_size) {
+    std::lock_guard<std::mutex> gfx_lock(GetGfxMutex());
+
+    _program = gfxCreateProgram(gfx, GfxProgramDesc::ComputeBinary(_entry.bytecode.data(), u32(_entry.bytecode.size()), _entry.reflection.data(), u32(_entry.reflection.size())));
+    if (!_program) return GfxKernel{};
+    GfxKernel kernel = gfxCreateComputeKernel(gfx, _program, "main");
+    if (!kernel) return kernel;
+    u32 const *num_threads = gfxKernelGetNumThreads(gfx, kernel);
+    _group_size            = u32x3(num_threads[0], num_threads[1], num_threads[2]);
+    _isa                   = gfxKernelGetIsa(gfx, kernel);
+    return kernel;
+}
+static GPUKernel CompileGlobalModule(GfxContext gfx, String _name) {
     using namespace SJIT;
 
     namespace fs = std::filesystem;
@@ -724,100 +1135,289 @@ static GPUKernel                    CompileGlobalModule(GfxContext gfx, String _
         fs::create_directory(".shader_cache");
     }
 
-    auto program = gfxCreateProgram(gfx, GfxProgramDesc::Compute(GetGlobalModule().Finalize()));
-    if (!program) {
-        fprintf(stdout, "%s", GetGlobalModule().Finalize());
-        TRAP;
+    char const      *text      = GetGlobalModule().Finalize();
+    char const      *model     = GetKernelShaderModel(gfx);
+    bool             debug     = gfxIsShaderDebuggingEnabled(gfx);
+    KernelCacheKey   key       = KernelCache::ComputeKey(text, strlen(text), GetKernelCacheFlags(gfx).c_str());
+    KernelCacheEntry entry     = {};
+    bool             cache_hit = GetKernelCache().Load(key, entry);
+    if (cache_hit && entry.resources != ReflectModuleResources()) {
+        fprintf(stdout, "[KERNEL CACHE] %s: resource table mismatch, recompiling\n", _name.c_str());
+        cache_hit = false;
+    }
+    if (!cache_hit) {
+        entry = {};
+        if (!ThreadDxcCompiler::Get().Compile(text, model, debug, entry)) {
+            fprintf(stdout, "%s", text);
+            TRAP;
+        }
     }
-    auto kernel = gfxCreateComputeKernel(gfx, program, "main");
-    if (!kernel) {
-        fprintf(stdout, "%s", GetGlobalModule().Finalize());
+
+    GPUKernel k = {};
+    k.name      = _name;
+    k.gfx       = gfx;
+    k.kernel    = CreateKernelFromEntry(gfx, entry, k.program, k.isa, k.group_size);
+    if (!k.kernel) {
+        fprintf(stdout, "%s", text);
         TRAP;
     }
+    k.resources = GetGlobalModule().GetResources();
+    k.InitBindings();
+    sjit_assert(entry.bytecode.size() > size_t(0));
+    k.bytecode.assign(entry.bytecode.begin(), entry.bytecode.end());
+    k.reg_pressure = ParseRegPressure(k.isa);
 
-    GPUKernel k          = {};
-    k.name               = _name;
-    k.gfx                = gfx;
-    k.program            = program;
-    k.kernel             = kernel;
-    k.resources          = GetGlobalModule().GetResources();
-    k.isa                = gfxKernelGetIsa(gfx, k.kernel);
-    size_t bytecode_size = ((IDxcBlob *)gfxKernelGetComputeBytecode(gfx, k.kernel))->GetBufferSize();
-    sjit_assert(bytecode_size > size_t(0));
-    k.bytecode.resize(bytecode_size);
-    memcpy(&k.bytecode[0], ((IDxcBlob *)gfxKernelGetComputeBytecode(gfx, k.kernel))->GetBufferPointer(), bytecode_size);
+    if (cache_hit) {
+        if (k.reg_pressure == u32(0)) k.reg_pressure = u32(entry.reg_pressure);
+    } else {
+        entry.resources    = ReflectModuleResources();
+        entry.reg_pressure = i32(k.reg_pressure);
+        GetKernelCache().Store(key, entry);
 
-    {
         char buf[0x100];
-        {
-            sprintf(buf, ".shader_cache/%s.hlsl", _name.c_str());
-            std::ofstream file(buf);
-            if (file.is_open()) {
-                file << "// AUTOGENERATRED DO NOT EDIT\n";
-                file << GetGlobalModule().Finalize();
-                file.close();
-            }
-
-            // Launch clang-format.exe
-            {
-                char buf[0x100];
-                sprintf(buf, "clang-format.exe -i .shader_cache/%s.hlsl", _name.c_str());
-                system(buf);
-            }
+        sprintf(buf, ".shader_cache/%s.hlsl", _name.c_str());
+        std::ofstream file(buf);
+        if (file.is_open()) {
+            file << "// AUTOGENERATRED DO NOT EDIT\n";
+            file << text;
+            file.close();
+        }
+        if (g_format_hlsl_dumps) {
+            std::string cmd = std::string("clang-format.exe -i ") + buf;
+            std::thread([cmd] { system(cmd.c_str()); }).detach();
         }
-        /*{
-            sprintf(buf, ".shader_cache/%s_bytecode.h", _name.c_str());
-            std::ofstream file(buf);
-            if (file.is_open()) {
-                file << "static const uint8_t " << _name.c_str() << "_bytecode[] = {\n";
-                for (auto b : k.bytecode) file << u32(b) << ", ";
-                file << "};\n";
-                file.close();
-            }
-        }*/
     }
+    fprintf(stdout, "[REG PRESSURE] %s %i%s\n", _name.c_str(), k.reg_pressure, cache_hit ? " (cached)" : "");
+    if (g_compare_schedule && GetGlobalModule().IsScheduling()) {
+        ScheduleStats stats = GetGlobalModule().GetScheduleStats();
+        GetGlobalModule().SetSchedule(false);
+        defer({
+            GetGlobalModule().SetSchedule(true);
+            GetGlobalModule().Finalize();
+        });
+        KernelCacheEntry unscheduled       = {};
+        u32              unscheduled_vgprs = u32(0);
+        if (ThreadDxcCompiler::Get().Compile(GetGlobalModule().Finalize(), model, debug, unscheduled)) {
+            GfxProgram  unscheduled_program = {};
+            std::string unscheduled_isa     = {};
+            u32x3       unscheduled_group   = {};
+            GfxKernel   unscheduled_kernel  = CreateKernelFromEntry(gfx, unscheduled, unscheduled_program, unscheduled_isa, unscheduled_group);
+            unscheduled_vgprs               = ParseRegPressure(unscheduled_isa);
+            std::lock_guard<std::mutex> gfx_lock(GetGfxMutex());
+            if (unscheduled_kernel) gfxDestroyKernel(gfx, unscheduled_kernel);
+            if (unscheduled_program) gfxDestroyProgram(gfx, unscheduled_program);
+        }
+        fprintf(stdout, "[SCHEDULE] %s: vgpr %i -> %i, est. max live %i -> %i, %i sunk, %i rematerialized\n", _name.c_str(), unscheduled_vgprs, k.reg_pressure,
+                stats.max_live_before, stats.max_live_after, stats.num_sunk, stats.num_rematerialized);
+    }
+    return k;
+}
+
+// Shared by BuildKernel and the build queue workers
+static GPUKernel EmitAndCompileKernel(GfxContext gfx, String const &_name, std::function<void()> const &_emit) {
+    HLSL_MODULE_SCOPE;
+    TypeInternStats before = Type::GetThreadInternStats();
+    auto            start  = std::chrono::high_resolution_clock::now();
+    _emit();
+    auto            stop   = std::chrono::high_resolution_clock::now();
+    TypeInternStats after  = Type::GetThreadInternStats();
+    if (g_report_type_stats)
+        fprintf(stdout, "[TYPES] %s: %i types requested, %i allocated, emitted in %f us\n", _name.c_str(), i32(after.num_lookups - before.num_lookups),
+                i32(after.num_allocations - before.num_allocations), std::chrono::duration<f64>(stop - start).count() * f64(1.0e6));
+    return CompileGlobalModule(gfx, _name);
+}
+
+// Builds and compiles kernels on a pool of workers.
+// Add only records the job, everything runs on Flush so that the passes can finish their constructors first.
+class KernelBuildQueue {
+private:
+    struct Job {
+        String                name = {};
+        std::function<void()> emit = {};
+        GPUKernel            *dst  = NULL;
+    };
+    GfxContext        gfx         = {};
+    u32               num_threads = u32(0);
+    Array<Job>        jobs        = {};
+    KernelBuildQueue *prev_active = NULL;
+
+public:
+    SJIT_DONT_MOVE(KernelBuildQueue);
 
-    if (k.isa.size() != size_t(0)) {
-        char const *p = strstr(k.isa.c_str(), "vgpr_count(");
-        p += strlen("vgpr_count(");
-        if (p) {
-            char buf[16] = {};
-            int  l       = 0;
+    static KernelBuildQueue *&GetActive() {
+        static KernelBuildQueue *active = NULL;
+        return active;
+    }
+    // While the queue is alive BuildKernel defers to it
+    KernelBuildQueue(GfxContext _gfx, u32 _num_threads = u32(0)) {
+        gfx         = _gfx;
+        num_threads = _num_threads ? _num_threads : std::max(u32(1), u32(std::thread::hardware_concurrency()));
+        prev_active = GetActive();
+        GetActive() = this;
+    }
+    ~KernelBuildQueue() {
+        Flush();
+        GetActive() = prev_active;
+    }
+    void Add(String const &_name, std::function<void()> _emit, GPUKernel *_dst) { jobs.push_back({_name, _emit, _dst}); }
+    // Hands the recorded emitters to _func instead of compiling them, the destination kernels are left empty
+    void Drain(std::function<void(String const &, std::function<void()> const &)> _func) {
+        Array<Job> cur_jobs = std::move(jobs);
+        for (auto &job : cur_jobs) _func(job.name, job.emit);
+    }
+    void Flush() {
+        if (jobs.size() == size_t(0)) return;
+        Array<Job>       cur_jobs = std::move(jobs);
+        std::atomic<u32> next_job = {};
+        auto             worker   = [&] {
             while (true) {
-                if (p[l] >= '0' && p[l] <= '9') {
-                    buf[l] = p[l];
-                    l++;
-                } else {
-                    break;
-                }
+                u32 job_idx = next_job.fetch_add(u32(1));
+                if (job_idx >= u32(cur_jobs.size())) break;
+                Job &job = cur_jobs[job_idx];
+                *job.dst = EmitAndCompileKernel(gfx, job.name, job.emit);
             }
-            sjit_assert(l);
-            k.reg_pressure = std::atoi(buf);
-        }
+        };
+        Array<std::thread> threads = {};
+        ifor(std::min(num_threads, u32(cur_jobs.size()))) threads.push_back(std::thread(worker));
+        for (auto &t : threads) t.join();
     }
-    fprintf(stdout, "[REG PRESSURE] %s %i\n", _name.c_str(), k.reg_pressure);
-    return k;
+};
+// Emits and compiles a kernel right away or defers it to the active KernelBuildQueue
+static void BuildKernel(GfxContext gfx, GPUKernel *_dst, String const &_name, std::function<void()> _emit) {
+    if (KernelBuildQueue::GetActive()) {
+        KernelBuildQueue::GetActive()->Add(_name, _emit, _dst);
+        return;
+    }
+    *_dst = EmitAndCompileKernel(gfx, _name, _emit);
 }
 
 static void LaunchKernel(GfxContext gfx, u32x3 dispatch_size, std::function<void(void)> _func, bool _print = false) {
     HLSL_MODULE_SCOPE;
     _func();
-    String str = String(GetGlobalModule().Finalize());
-    if (g_kernel_registry.find(str) == g_kernel_registry.end()) {
-        GPUKernel *n                  = new GPUKernel;
-        *n                            = CompileGlobalModule(gfx, "anonymous");
-        g_kernel_registry[str.Copy()] = n;
-        if (_print) fprintf(stdout, "%s", str.c_str());
+    // Cache hits only need the hashes of the emitted text, it is finalized just for compilation
+    u64        key     = GetGlobalModule().GetEmittedTextHash();
+    u64        check   = GetGlobalModule().GetEmittedTextCheck();
+    auto      &kernels = g_kernel_cache[key];
+    GPUKernel *n       = NULL;
+    for (auto *k : kernels) {
+        if (k->text_check       == check) n = k;
+    }
+    if (n == NULL) {
+        if (kernels.size()) fprintf(stdout, "[KERNEL CACHE] emitted text hash collision on %016llx, compiling a separate kernel\n", (unsigned long long)key);
+        n                   = new GPUKernel;
+        *n                  = CompileGlobalModule(gfx, "anonymous");
+        n->text_check       = check;
+        kernels.push_back(n);
+        if (_print) fprintf(stdout, "%s", GetGlobalModule().Finalize());
         if (_print && n->isa.c_str()) fprintf(stdout, "%s", n->isa.c_str());
     }
-    GPUKernel *n = g_kernel_registry[str];
     n->CheckResources();
     gfxCommandBindKernel(gfx, n->kernel);
-    gfxCommandDispatch(gfx, dispatch_size.x, dispatch_size.y, dispatch_size.z);
+    n->Dispatch(dispatch_size.x, dispatch_size.y, dispatch_size.z);
 
     n->ResetTable();
 }
 
+// gfx has no placed resources and tracks resource states on its own, so transients share whole textures and the barrier batches are only counted
+class GfxRenderGraphBackend : public IRenderGraphBackend {
+private:
+    GfxContext              gfx      = {};
+    SlotManager<GfxTexture> textures = {};
+    Array<u32>              imported = {};
+
+public:
+    u32 num_barriers = u32(0);
+
+    GfxRenderGraphBackend(GfxContext _gfx) : gfx(_gfx) {}
+    ~GfxRenderGraphBackend() override { ReleaseImports(); }
+
+    bool              CanAliasMemory() override { return false; }
+    RenderGraphHandle CreateTexture(RenderGraphTextureDesc const &_desc, u64 _heap_offset) override {
+        GfxTexture t = {};
+        if (_desc.depth == u32(1))
+            t = gfxCreateTexture2D(gfx, _desc.width, _desc.height, DXGI_FORMAT(_desc.format), _desc.mip_levels);
+        else
+            t = gfxCreateTexture3D(gfx, _desc.width, _desc.height, _desc.depth, DXGI_FORMAT(_desc.format), _desc.mip_levels);
+        sjit_assert(t);
+        return RenderGraphHandle(textures.AddItem(t));
+    }
+    void DestroyTexture(RenderGraphHandle _texture) override {
+        gfxDestroyTexture(gfx, textures.items[u32(_texture)]);
+        textures.RemoveItem(u32(_texture));
+    }
+    void              Barriers(std::vector<RenderGraphBarrier> const &_batch) override { num_barriers += u32(_batch.size()); }
+    RenderGraphHandle Import(GfxTexture _texture) {
+        u32 id = textures.AddItem(_texture);
+        imported.push_back(id);
+        return RenderGraphHandle(id);
+    }
+    void ReleaseImports() {
+        for (u32 id : imported) textures.RemoveItem(id);
+        imported.clear();
+    }
+    GfxTexture GetTexture(RenderGraphHandle _texture) { return textures.items[u32(_texture)]; }
+};
+// Render graph over GPUKernel passes, rebuilt every frame between Reset and Execute
+class GfxRenderGraph {
+private:
+    GfxContext            gfx     = {};
+    GfxRenderGraphBackend backend;
+    RenderGraph           graph;
+
+public:
+    SJIT_DONT_MOVE(GfxRenderGraph);
+
+    GfxRenderGraph(GfxContext _gfx) : gfx(_gfx), backend(_gfx), graph(&backend) {}
+
+    RenderGraph       &GetGraph() { return graph; }
+    RenderGraphTexture Import(String const &_name, GfxTexture _texture) { return graph.Import(_name.c_str(), backend.Import(_texture)); }
+    RenderGraphTexture CreateTexture(String const &_name, u32 _width, u32 _height, DXGI_FORMAT _format, u32 _depth = u32(1), u32 _mip_levels = u32(1)) {
+        RenderGraphTextureDesc desc = {};
+        desc.width                  = _width;
+        desc.height                 = _height;
+        desc.depth                  = _depth;
+        desc.mip_levels             = _mip_levels;
+        desc.format                 = u32(_format);
+        desc.bytes_per_texel        = GetBytesPerPixel(_format);
+        return graph.CreateTexture(_name.c_str(), desc);
+    }
+    GfxTexture GetTexture(RenderGraphTexture _texture) { return backend.GetTexture(graph.GetTexture(_texture)); }
+    // Reads and writes come from the resources SJIT reflected for the kernel: RW textures are written, everything else is read.
+    // Bindings the kernel doesn't use are ignored, resources without a binding still go through the global registry.
+    RenderGraph::Pass &AddKernelPass(GPUKernel &_kernel, HashMap<String, RenderGraphTexture> const &_bindings, u32x3 _num_threads) {
+        GPUKernel *kernel = &_kernel;
+        auto      &pass   = graph.AddPass(_kernel.name.c_str(), [this, kernel, _bindings, _num_threads] {
+            for (auto &b : _bindings)
+                if (kernel->resources.find(b.first) != kernel->resources.end()) kernel->SetResource(b.first.c_str(), GetTexture(b.second));
+            kernel->CheckResources();
+            kernel->Begin();
+            {
+                u32 const *group_size = gfxKernelGetNumThreads(gfx, kernel->kernel);
+                gfxCommandBindKernel(gfx, kernel->kernel);
+                kernel->Dispatch((_num_threads.x + group_size[0] - 1) / group_size[0], (_num_threads.y + group_size[1] - 1) / group_size[1],
+                                 (_num_threads.z + group_size[2] - 1) / group_size[2]);
+            }
+            kernel->ResetTable();
+            kernel->End();
+            g_pass_durations[kernel->name] = kernel->duration;
+        });
+        for (auto &b : _bindings) {
+            auto it = _kernel.resources.find(b.first);
+            if (it == _kernel.resources.end()) continue;
+            if (it->second->GetType()->GetRWType() == RW_READ_WRITE)
+                pass.Write(b.second);
+            else
+                pass.Read(b.second);
+        }
+        return pass;
+    }
+    void Execute() { graph.Execute(); }
+    void Reset() {
+        graph.Reset();
+        backend.ReleaseImports();
+    }
+};
+
 class Sun {
 public:
     f32                     width = f32(4.0);
@@ -877,8 +1477,7 @@ public:
         proj[cur_cascade_idx][3][3] = f32(1.0);
         view[cur_cascade_idx]       = glm::lookAt(pos - dir * f32(final_width), pos, f32x3(0.0, 1.0, 0.0));
 
-        auto alloc = upload_buffer.Allocate(num_cascades * sizeof(f32x4x4));
-        upload_buffer.DeferFree(alloc);
+        auto alloc = upload_buffer.AllocateFrame(num_cascades * sizeof(f32x4x4));
         ifor(num_cascades) {
             f32x4x4 m = transpose(transpose(view[i]) * transpose(proj[i]));
             memcpy(&((f32x4x4 *)alloc.host_dst)[i], &m, sizeof(f32x4x4));
@@ -890,6 +1489,7 @@ public:
     f32x3        GetDir() { return dir; }
     f32          GetWidth() { return width; }
     void         SetWidth(f32 _width) { width = _width; }
+    void         SetPos(f32x3 _pos) { pos = _pos; }
     GfxProgram   GetProgram() { return shadow_program; }
     GfxKernel    GetKernel() { return shadow_kernels[cur_cascade_idx]; }
     GfxDrawState GetDrawState() { return draw_states[cur_cascade_idx]; }
@@ -905,6 +1505,8 @@ public:
 GFX_JIT_MAKE_GLOBAL_RESOURCE(g_MeshBuffer, Type::CreateStructuredBuffer(Mesh_Ty));
 GFX_JIT_MAKE_GLOBAL_RESOURCE(g_IndexBuffer, Type::CreateStructuredBuffer(u32Ty));
 GFX_JIT_MAKE_GLOBAL_RESOURCE(g_VertexBuffer, Type::CreateStructuredBuffer(Vertex_Ty));
+GFX_JIT_MAKE_GLOBAL_RESOURCE(g_CompactVertexBuffer, Type::CreateStructuredBuffer(CompactVertex_Ty));
+GFX_JIT_MAKE_GLOBAL_RESOURCE(g_CompactVertexBoundsBuffer, Type::CreateStructuredBuffer(CompactVertexBounds_Ty));
 GFX_JIT_MAKE_GLOBAL_RESOURCE(g_InstanceBuffer, Type::CreateStructuredBuffer(Instance_Ty));
 GFX_JIT_MAKE_GLOBAL_RESOURCE(g_MaterialBuffer, Type::CreateStructuredBuffer(Material_Ty));
 GFX_JIT_MAKE_GLOBAL_RESOURCE(g_TransformBuffer, Type::CreateStructuredBuffer(f32x4x4Ty));
@@ -943,6 +1545,23 @@ GFX_JIT_MAKE_GLOBAL_RESOURCE(g_edges, Texture2D_f32_Ty);
 GFX_JIT_MAKE_GLOBAL_RESOURCE(g_background, Texture2D_f32_Ty);
 GFX_JIT_MAKE_GLOBAL_RESOURCE(g_ao, Texture2D_f32x4_Ty);
 
+// Returns a Vertex_Ty value either way, decoded like VertexQuantization::Decode when the compact stream is used
+static var LoadSceneVertex(var mesh_id, var vertex_idx) {
+    if (!g_use_compact_vertices) return g_VertexBuffer.Load(vertex_idx);
+
+    var c          = g_CompactVertexBuffer.Load(vertex_idx);
+    var bounds     = g_CompactVertexBoundsBuffer.Load(mesh_id);
+    var bounds_min = bounds["bounds_min"]["xyz"];
+    var bounds_max = bounds["bounds_max"]["xyz"];
+    var q          = make_f32x3((c["position_xy"] & u32(0xffff)).ToF32(), (c["position_xy"] >> u32(16)).ToF32(), (c["position_z"] & u32(0xffff)).ToF32()) / f32(65535.0);
+    var on         = make_f32x2((c["normal"] & u32(0xffff)).ToF32(), (c["normal"] >> u32(16)).ToF32()) / f32(65535.0);
+    var v          = Zero(Vertex_Ty);
+    v["position"]  = make_f32x4(bounds_min + q * (bounds_max - bounds_min), f32(1.0));
+    v["normal"]    = make_f32x4(SJIT::Octahedral::Decode(on), f32(0.0));
+    v["uv"]        = make_f32x2((c["uv"] & u32(0xffff)).u32_to_f16().ToF32(), (c["uv"] >> u32(16)).u32_to_f16().ToF32());
+    return v;
+}
+
 template <typename T>
 using UniquePtr = std::unique_ptr<T>;
 
@@ -952,17 +1571,19 @@ using UniquePtr = std::unique_ptr<T>;
             _num_textures))
 
 struct GfxTextureResource : public IGfxResourceRegistryItem {
-    SharedPtr<Resource>          r_resource   = {};
-    SharedPtr<Resource>          rw_resource  = {};
-    String                       name         = {};
-    std::function<u32()>         width_fn     = {};
-    std::function<u32()>         height_fn    = {};
-    std::function<u32()>         depth_fn     = {};
-    std::function<u32()>         mip_fn       = {};
-    std::function<DXGI_FORMAT()> format_fn    = {};
-    u32                          num_textures = u32(1);
-    GfxContext                   gfx          = {};
-    std::vector<GfxTexture>      textures     = {};
+    SharedPtr<Resource>            r_resource   = {};
+    SharedPtr<Resource>            rw_resource  = {};
+    String                         name         = {};
+    std::function<u32()>           width_fn     = {};
+    std::function<u32()>           height_fn    = {};
+    std::function<u32()>           depth_fn     = {};
+    std::function<u32()>           mip_fn       = {};
+    std::function<DXGI_FORMAT()>   format_fn    = {};
+    u32                            num_textures = u32(1);
+    GfxContext                     gfx          = {};
+    std::vector<GfxTexture>        textures     = {};
+    std::vector<TexturePoolHandle> handles      = {};
+    TexturePoolKey                 key          = {};
 
     ~GfxTextureResource() override { ReleaseTextures(); }
 
@@ -981,20 +1602,20 @@ struct GfxTextureResource : public IGfxResourceRegistryItem {
         sjit_assert(_mip > u32(0));
         sjit_assert(num_textures > u32(0));
 
-        if (textures.size() != num_textures         //
-            || (textures[0].getWidth() == _width)   //
-            || (textures[0].getHeight() == _height) //
-            || (textures[0].getDepth() == _depth)   //
-            || (textures[0].getMipLevels() == _mip) //
-            || (textures[0].getFormat() == _format) //
-        ) {
+        TexturePoolKey _key = {};
+        _key.width          = _width;
+        _key.height         = _height;
+        _key.depth          = _depth;
+        _key.mip_levels     = _mip;
+        _key.format         = u32(_format);
 
+        // Only a real change in size or format goes back to the pool
+        if (textures.size() != num_textures || key != _key) {
             ReleaseTextures();
+            key = _key;
             ifor(num_textures) {
-                if (_depth == u32(1))
-                    textures.push_back(gfxCreateTexture2D(gfx, _width, _height, _format, _mip));
-                else
-                    textures.push_back(gfxCreateTexture3D(gfx, _width, _height, _depth, _format, _mip));
+                handles.push_back(GfxResourceRegistry::AcquireTexture(gfx, key));
+                textures.push_back(GfxResourceRegistry::GetTexture(handles.back()));
             }
             // GfxResourceRegistry::GetResources()[name] = ResourceSlot(&textures[0], u32(textures.size()));
 
@@ -1003,15 +1624,15 @@ struct GfxTextureResource : public IGfxResourceRegistryItem {
 
             if (num_textures == u32(1)) {
                 if (_depth == u32(1)) {
-                    SharedPtr<Type> r_ty  = texture_2d_type_table[basic_type][num_components];
-                    SharedPtr<Type> rw_ty = rw_texture_2d_type_table[basic_type][num_components];
+                    SharedPtr<Type> r_ty  = texture_2d_types.Get(basic_type, num_components);
+                    SharedPtr<Type> rw_ty = rw_texture_2d_types.Get(basic_type, num_components);
                     sjit_assert(r_ty);
                     sjit_assert(rw_ty);
                     r_resource  = Resource::Create(r_ty, name);
                     rw_resource = Resource::Create(rw_ty, name);
                 } else {
-                    SharedPtr<Type> r_ty  = texture_3d_type_table[basic_type][num_components];
-                    SharedPtr<Type> rw_ty = rw_texture_3d_type_table[basic_type][num_components];
+                    SharedPtr<Type> r_ty  = texture_3d_types.Get(basic_type, num_components);
+                    SharedPtr<Type> rw_ty = rw_texture_3d_types.Get(basic_type, num_components);
                     sjit_assert(r_ty);
                     sjit_assert(rw_ty);
                     r_resource  = Resource::Create(r_ty, name);
@@ -1019,15 +1640,15 @@ struct GfxTextureResource : public IGfxResourceRegistryItem {
                 }
             } else {
                 if (_depth == u32(1)) {
-                    SharedPtr<Type> r_ty  = texture_2d_type_table[basic_type][num_components];
-                    SharedPtr<Type> rw_ty = rw_texture_2d_type_table[basic_type][num_components];
+                    SharedPtr<Type> r_ty  = texture_2d_types.Get(basic_type, num_components);
+                    SharedPtr<Type> rw_ty = rw_texture_2d_types.Get(basic_type, num_components);
                     sjit_assert(r_ty);
                     sjit_assert(rw_ty);
                     r_resource  = Resource::CreateArray(Resource::Create(r_ty, name), name);
                     rw_resource = Resource::CreateArray(Resource::Create(rw_ty, name), name);
                 } else {
-                    SharedPtr<Type> r_ty  = texture_3d_type_table[basic_type][num_components];
-                    SharedPtr<Type> rw_ty = rw_texture_3d_type_table[basic_type][num_components];
+                    SharedPtr<Type> r_ty  = texture_3d_types.Get(basic_type, num_components);
+                    SharedPtr<Type> rw_ty = rw_texture_3d_types.Get(basic_type, num_components);
                     sjit_assert(r_ty);
                     sjit_assert(rw_ty);
                     r_resource  = Resource::CreateArray(Resource::Create(r_ty, name), name);
@@ -1044,7 +1665,8 @@ struct GfxTextureResource : public IGfxResourceRegistryItem {
     }
     void ReleaseTextures() {
         GfxResourceRegistry::GetResources().erase(name);
-        for (auto &t : textures) gfxDestroyTexture(gfx, t);
+        for (auto h : handles) GfxResourceRegistry::ReleaseTexture(h);
+        handles.clear();
         textures.clear();
     }
     static GfxTextureResource *Create(GfxContext _gfx, String const &_name) {
@@ -1107,6 +1729,65 @@ public:
     GfxTexture &GetWorldPosition() { return gbuffer_world_position[ping_pong.ping]; }
     GfxTexture &GetPrevNormals() { return gbuffer_world_normals[ping_pong.pong]; }
     GfxTexture &GetPrevWorldPosition() { return gbuffer_world_position[ping_pong.pong]; }
+
+    struct GraphTextures {
+        RenderGraphTexture normals             = {};
+        RenderGraphTexture world_position      = {};
+        RenderGraphTexture prev_normals        = {};
+        RenderGraphTexture prev_world_position = {};
+        RenderGraphTexture roughness           = {};
+    };
+    static void EmitKernel() {
+        GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
+
+        var tid                         = Input(IN_TYPE_DISPATCH_THREAD_ID)["xy"];
+        var g_rw_roughnes               = ResourceAccess(Resource::Create(RWTexture2D_f32_Ty, "g_rw_roughnes"));
+        var g_rw_gbuffer_world_normals  = ResourceAccess(Resource::Create(RWTexture2D_f32x4_Ty, "g_rw_gbuffer_world_normals"));
+        var g_rw_gbuffer_world_position = ResourceAccess(Resource::Create(RWTexture2D_f32x4_Ty, "g_rw_gbuffer_world_position"));
+        var dim                         = g_rw_gbuffer_world_normals.GetDimensions().Swizzle("xy");
+
+        EmitIfElse((tid < dim).All(), [&] {
+            var visibility = g_visibility_buffer.Read(tid);
+
+            EmitIfElse((visibility == u32x4_splat(0)).All(), [&] {
+                g_rw_gbuffer_world_normals.Store(tid, f32x4_splat(0.0));
+                g_rw_gbuffer_world_position.Store(tid, f32x4_splat(0.0));
+                EmitReturn();
+            });
+
+            var barys         = visibility.xy().AsF32();
+            var instance_idx  = visibility.z();
+            var primitive_idx = visibility.w();
+
+            var instance  = g_InstanceBuffer.Load(instance_idx);
+            var mesh      = g_MeshBuffer.Load(instance["mesh_id"]);
+            var transform = g_TransformBuffer.Load(instance_idx);
+
+            var i0  = g_IndexBuffer.Load(mesh["first_index"] + primitive_idx * u32(3) + u32(0)) + mesh["base_vertex"];
+            var i1  = g_IndexBuffer.Load(mesh["first_index"] + primitive_idx * u32(3) + u32(1)) + mesh["base_vertex"];
+            var i2  = g_IndexBuffer.Load(mesh["first_index"] + primitive_idx * u32(3) + u32(2)) + mesh["base_vertex"];
+            var v0  = LoadSceneVertex(instance["mesh_id"], i0);
+            var v1  = LoadSceneVertex(instance["mesh_id"], i1);
+            var v2  = LoadSceneVertex(instance["mesh_id"], i2);
+            var wv0 = mul(transform, make_f32x4(v0["position"]["xyz"], f32(1.0)))["xyz"];
+            var wv1 = mul(transform, make_f32x4(v1["position"]["xyz"], f32(1.0)))["xyz"];
+            var wv2 = mul(transform, make_f32x4(v2["position"]["xyz"], f32(1.0)))["xyz"];
+            var wn0 = normalize(mul(transform, make_f32x4(v0["normal"]["xyz"], f32(0.0)))["xyz"]);
+            var wn1 = normalize(mul(transform, make_f32x4(v1["normal"]["xyz"], f32(0.0)))["xyz"]);
+            var wn2 = normalize(mul(transform, make_f32x4(v2["normal"]["xyz"], f32(0.0)))["xyz"]);
+
+            var w = Interpolate(wv0, wv1, wv2, barys);
+            var n = normalize(Interpolate(wn0, wn1, wn2, barys));
+
+            g_rw_gbuffer_world_normals.Write(tid, make_f32x4(n, f32(1.0)));
+            g_rw_gbuffer_world_position.Write(tid, make_f32x4(w, f32(1.0)));
+
+            // var roughness = g_global_roughnes * (frac(f32(5.5453123) * length(sin(w * f32x3(4.5453, 7.7932, 5.3437583)))));
+            g_rw_roughnes.Write(tid, f32(0.0));
+        });
+
+        // fprintf(stdout, GetGlobalModule().Finalize());
+    }
     GBufferFromVisibility(GfxContext _gfx) {
         u32 _width  = gfxGetBackBufferWidth(_gfx);
         u32 _height = gfxGetBackBufferHeight(_gfx);
@@ -1118,61 +1799,7 @@ public:
             gbuffer_world_normals[i]  = gfxCreateTexture2D(gfx, width, height, DXGI_FORMAT_R32G32B32A32_FLOAT);
             gbuffer_world_position[i] = gfxCreateTexture2D(gfx, width, height, DXGI_FORMAT_R32G32B32A32_FLOAT);
         }
-        {
-            HLSL_MODULE_SCOPE;
-
-            GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
-
-            var tid                         = Input(IN_TYPE_DISPATCH_THREAD_ID)["xy"];
-            var g_rw_roughnes               = ResourceAccess(Resource::Create(RWTexture2D_f32_Ty, "g_rw_roughnes"));
-            var g_rw_gbuffer_world_normals  = ResourceAccess(Resource::Create(RWTexture2D_f32x4_Ty, "g_rw_gbuffer_world_normals"));
-            var g_rw_gbuffer_world_position = ResourceAccess(Resource::Create(RWTexture2D_f32x4_Ty, "g_rw_gbuffer_world_position"));
-            var dim                         = g_rw_gbuffer_world_normals.GetDimensions().Swizzle("xy");
-
-            EmitIfElse((tid < dim).All(), [&] {
-                var visibility = g_visibility_buffer.Read(tid);
-
-                EmitIfElse((visibility == u32x4_splat(0)).All(), [&] {
-                    g_rw_gbuffer_world_normals.Store(tid, f32x4_splat(0.0));
-                    g_rw_gbuffer_world_position.Store(tid, f32x4_splat(0.0));
-                    EmitReturn();
-                });
-
-                var barys         = visibility.xy().AsF32();
-                var instance_idx  = visibility.z();
-                var primitive_idx = visibility.w();
-
-                var instance  = g_InstanceBuffer.Load(instance_idx);
-                var mesh      = g_MeshBuffer.Load(instance["mesh_id"]);
-                var transform = g_TransformBuffer.Load(instance_idx);
-
-                var i0  = g_IndexBuffer.Load(mesh["first_index"] + primitive_idx * u32(3) + u32(0)) + mesh["base_vertex"];
-                var i1  = g_IndexBuffer.Load(mesh["first_index"] + primitive_idx * u32(3) + u32(1)) + mesh["base_vertex"];
-                var i2  = g_IndexBuffer.Load(mesh["first_index"] + primitive_idx * u32(3) + u32(2)) + mesh["base_vertex"];
-                var v0  = g_VertexBuffer.Load(i0);
-                var v1  = g_VertexBuffer.Load(i1);
-                var v2  = g_VertexBuffer.Load(i2);
-                var wv0 = mul(transform, make_f32x4(v0["position"]["xyz"], f32(1.0)))["xyz"];
-                var wv1 = mul(transform, make_f32x4(v1["position"]["xyz"], f32(1.0)))["xyz"];
-                var wv2 = mul(transform, make_f32x4(v2["position"]["xyz"], f32(1.0)))["xyz"];
-                var wn0 = normalize(mul(transform, make_f32x4(v0["normal"]["xyz"], f32(0.0)))["xyz"]);
-                var wn1 = normalize(mul(transform, make_f32x4(v1["normal"]["xyz"], f32(0.0)))["xyz"]);
-                var wn2 = normalize(mul(transform, make_f32x4(v2["normal"]["xyz"], f32(0.0)))["xyz"]);
-
-                var w = Interpolate(wv0, wv1, wv2, barys);
-                var n = normalize(Interpolate(wn0, wn1, wn2, barys));
-
-                g_rw_gbuffer_world_normals.Write(tid, make_f32x4(n, f32(1.0)));
-                g_rw_gbuffer_world_position.Write(tid, make_f32x4(w, f32(1.0)));
-
-                // var roughness = g_global_roughnes * (frac(f32(5.5453123) * length(sin(w * f32x3(4.5453, 7.7932, 5.3437583)))));
-                g_rw_roughnes.Write(tid, f32(0.0));
-            });
-
-            // fprintf(stdout, GetGlobalModule().Finalize());
-
-            kernel = CompileGlobalModule(gfx, "GBufferFromVisibility");
-        }
+        BuildKernel(gfx, &kernel, "GBufferFromVisibility", [] { EmitKernel(); });
     }
     void Execute() {
         ping_pong.Next();
@@ -1187,12 +1814,30 @@ public:
             u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
             gfxCommandBindKernel(gfx, kernel.kernel);
-            gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+            kernel.Dispatch(num_groups_x, num_groups_y, 1);
         }
         kernel.ResetTable();
         kernel.End();
         g_pass_durations[kernel.name] = kernel.duration;
     }
+    // Graph version of Execute, the returned handles are what the passes reading the gbuffer bind
+    GraphTextures AddToGraph(GfxRenderGraph &_graph) {
+        ping_pong.Next();
+        GraphTextures t       = {};
+        t.normals             = _graph.Import("g_gbuffer_world_normals", GetNormals());
+        t.world_position      = _graph.Import("g_gbuffer_world_position", GetWorldPosition());
+        t.prev_normals        = _graph.Import("g_prev_gbuffer_world_normals", GetPrevNormals());
+        t.prev_world_position = _graph.Import("g_prev_gbuffer_world_position", GetPrevWorldPosition());
+        t.roughness           = _graph.Import("g_roughness", GetRoughness());
+        _graph.AddKernelPass(kernel,
+                             {
+                                 {"g_rw_gbuffer_world_normals", t.normals},
+                                 {"g_rw_gbuffer_world_position", t.world_position},
+                                 {"g_rw_roughnes", t.roughness},
+                             },
+                             u32x3(width, height, u32(1)));
+        return t;
+    }
     template <typename T>
     void SetResource(char const *_name, T _v) {
         kernel.SetResource(_name, _v);
@@ -1218,7 +1863,7 @@ private:
     u32        width  = u32(0);
     u32        height = u32(0);
 
-    var g_rw_result = ResourceAccess(Resource::Create(RWTexture2D_f32x2_Ty, "g_rw_result"));
+    static constexpr char const *RESULT_NAME = "g_rw_result";
 
 public:
     u32         GetWidth() { return width; }
@@ -1230,6 +1875,37 @@ public:
         kernel.Destroy();
         gfxDestroyTexture(gfx, result);
     }
+    static void EmitKernel() {
+        GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
+
+        var tid         = Input(IN_TYPE_DISPATCH_THREAD_ID).xy();
+        var g_rw_result = ResourceAccess(Resource::Create(RWTexture2D_f32x2_Ty, RESULT_NAME));
+
+        var dim = g_rw_result.GetDimensions().xy();
+
+        EmitIfElse((tid < dim).All(), [&] {
+            var N                = g_gbuffer_world_normals.Load(tid);
+            var P                = g_gbuffer_world_position.Load(tid);
+            var nearest_velocity = Zero(f32x2Ty).Copy();
+            var nearest_pos      = Zero(f32x3Ty).Copy();
+            var nearest_normal   = Zero(f32x3Ty).Copy();
+            var nearest_depth    = var(f32(1.0e6)).Copy();
+
+            for (i32 y = i32(-1); y <= i32(1); y++) {
+                for (i32 x = i32(-1); x <= i32(1); x++) {
+                    var coord = tid + u32x2(x, y);
+                    var P     = g_gbuffer_world_position.Load(coord);
+                    var depth = length(P - g_camera_pos);
+                    EmitIfElse(depth < nearest_depth, [&] {
+                        nearest_depth    = depth;
+                        nearest_velocity = g_velocity[coord];
+                    });
+                }
+            }
+
+            g_rw_result.Store(tid, nearest_velocity);
+        });
+    }
     NearestVelocity(GfxContext _gfx) {
         u32 _width  = gfxGetBackBufferWidth(_gfx);
         u32 _height = gfxGetBackBufferHeight(_gfx);
@@ -1237,43 +1913,10 @@ public:
         width       = _width;
         height      = _height;
         result      = gfxCreateTexture2D(gfx, width, height, DXGI_FORMAT_R32G32_FLOAT);
-        {
-            HLSL_MODULE_SCOPE;
-
-            GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
-
-            var tid = Input(IN_TYPE_DISPATCH_THREAD_ID).xy();
-
-            var dim = g_rw_result.GetDimensions().xy();
-
-            EmitIfElse((tid < dim).All(), [&] {
-                var N                = g_gbuffer_world_normals.Load(tid);
-                var P                = g_gbuffer_world_position.Load(tid);
-                var nearest_velocity = Zero(f32x2Ty).Copy();
-                var nearest_pos      = Zero(f32x3Ty).Copy();
-                var nearest_normal   = Zero(f32x3Ty).Copy();
-                var nearest_depth    = var(f32(1.0e6)).Copy();
-
-                for (i32 y = i32(-1); y <= i32(1); y++) {
-                    for (i32 x = i32(-1); x <= i32(1); x++) {
-                        var coord = tid + u32x2(x, y);
-                        var P     = g_gbuffer_world_position.Load(coord);
-                        var depth = length(P - g_camera_pos);
-                        EmitIfElse(depth < nearest_depth, [&] {
-                            nearest_depth    = depth;
-                            nearest_velocity = g_velocity[coord];
-                        });
-                    }
-                }
-
-                g_rw_result.Store(tid, nearest_velocity);
-            });
-
-            kernel = CompileGlobalModule(gfx, "NearestVelocity");
-        }
+        BuildKernel(gfx, &kernel, "NearestVelocity", [] { EmitKernel(); });
     }
     void Execute() {
-        kernel.SetResource(g_rw_result, result);
+        kernel.SetResource(RESULT_NAME, result);
         kernel.CheckResources();
         kernel.Begin();
         {
@@ -1282,12 +1925,23 @@ public:
             u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
             gfxCommandBindKernel(gfx, kernel.kernel);
-            gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+            kernel.Dispatch(num_groups_x, num_groups_y, 1);
         }
         kernel.ResetTable();
         kernel.End();
         g_pass_durations[kernel.name] = kernel.duration;
     }
+    RenderGraphTexture AddToGraph(GfxRenderGraph &_graph, GBufferFromVisibility::GraphTextures const &_gbuffer) {
+        RenderGraphTexture t = _graph.Import("g_nearest_velocity", result);
+        _graph.AddKernelPass(kernel,
+                             {
+                                 {RESULT_NAME, t},
+                                 {"g_gbuffer_world_normals", _gbuffer.normals},
+                                 {"g_gbuffer_world_position", _gbuffer.world_position},
+                             },
+                             u32x3(width, height, u32(1)));
+        return t;
+    }
     template <typename T>
     void SetResource(char const *_name, T _v) {
         kernel.SetResource(_name, _v);
@@ -1319,6 +1973,36 @@ public:
         gfxDestroyTexture(gfx, background_mask);
         gfxDestroyTexture(gfx, gbuffer_encoded);
     }
+    static void EmitKernel() {
+        GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
+
+        var tid                      = Input(IN_TYPE_DISPATCH_THREAD_ID).xy();
+        var g_gbuffer_world_normals  = ResourceAccess(Resource::Create(RWTexture2D_f32x3_Ty, "g_gbuffer_world_normals"));
+        var g_gbuffer_world_position = ResourceAccess(Resource::Create(RWTexture2D_f32x3_Ty, "g_gbuffer_world_position"));
+        var g_rw_background          = ResourceAccess(Resource::Create(RWTexture2D_f32_Ty, "g_rw_background"));
+        var g_rw_result              = ResourceAccess(Resource::Create(RWTexture2D_u32_Ty, "g_rw_result"));
+        var dim                      = g_rw_result.GetDimensions().xy();
+
+        EmitIfElse((tid < dim).All(), [&] {
+            var N = g_gbuffer_world_normals.Load(tid);
+            var P = g_gbuffer_world_position.Load(tid);
+
+            EmitIfElse((N == f32x3_splat(0.0)).All(), [&] {
+                g_rw_result.Store(tid, u32(0));
+                g_rw_background.Store(tid, f32(1.0));
+                EmitReturn();
+            });
+
+            var xi = GetNoise(tid);
+
+            var pack = EncodeGBuffer32Bits(N, P, xi.x(), g_camera_pos);
+
+            g_rw_result.Store(tid, pack);
+            g_rw_background.Store(tid, f32(0.0));
+        });
+
+        // fprintf(stdout, GetGlobalModule().Finalize());
+    }
     EncodeGBuffer(GfxContext _gfx) {
         u32 _width      = gfxGetBackBufferWidth(_gfx);
         u32 _height     = gfxGetBackBufferHeight(_gfx);
@@ -1327,40 +2011,7 @@ public:
         height          = _height;
         gbuffer_encoded = gfxCreateTexture2D(gfx, width, height, DXGI_FORMAT_R32_UINT);
         background_mask = gfxCreateTexture2D(gfx, width, height, DXGI_FORMAT_R8_UNORM);
-        {
-            HLSL_MODULE_SCOPE;
-
-            GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
-
-            var tid                      = Input(IN_TYPE_DISPATCH_THREAD_ID).xy();
-            var g_gbuffer_world_normals  = ResourceAccess(Resource::Create(RWTexture2D_f32x3_Ty, "g_gbuffer_world_normals"));
-            var g_gbuffer_world_position = ResourceAccess(Resource::Create(RWTexture2D_f32x3_Ty, "g_gbuffer_world_position"));
-            var g_rw_background          = ResourceAccess(Resource::Create(RWTexture2D_f32_Ty, "g_rw_background"));
-            var g_rw_result              = ResourceAccess(Resource::Create(RWTexture2D_u32_Ty, "g_rw_result"));
-            var dim                      = g_rw_result.GetDimensions().xy();
-
-            EmitIfElse((tid < dim).All(), [&] {
-                var N = g_gbuffer_world_normals.Load(tid);
-                var P = g_gbuffer_world_position.Load(tid);
-
-                EmitIfElse((N == f32x3_splat(0.0)).All(), [&] {
-                    g_rw_result.Store(tid, u32(0));
-                    g_rw_background.Store(tid, f32(1.0));
-                    EmitReturn();
-                });
-
-                var xi = GetNoise(tid);
-
-                var pack = EncodeGBuffer32Bits(N, P, xi.x(), g_camera_pos);
-
-                g_rw_result.Store(tid, pack);
-                g_rw_background.Store(tid, f32(0.0));
-            });
-
-            // fprintf(stdout, GetGlobalModule().Finalize());
-
-            kernel = CompileGlobalModule(gfx, "EncodeGBuffer");
-        }
+        BuildKernel(gfx, &kernel, "EncodeGBuffer", [] { EmitKernel(); });
     }
     void Execute() {
         kernel.SetResource("g_rw_result", gbuffer_encoded);
@@ -1373,12 +2024,24 @@ public:
             u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
             gfxCommandBindKernel(gfx, kernel.kernel);
-            gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+            kernel.Dispatch(num_groups_x, num_groups_y, 1);
         }
         kernel.ResetTable();
         kernel.End();
         g_pass_durations[kernel.name] = kernel.duration;
     }
+    RenderGraphTexture AddToGraph(GfxRenderGraph &_graph, GBufferFromVisibility::GraphTextures const &_gbuffer) {
+        RenderGraphTexture t = _graph.Import("g_gbuffer_encoded", gbuffer_encoded);
+        _graph.AddKernelPass(kernel,
+                             {
+                                 {"g_rw_result", t},
+                                 {"g_rw_background", _graph.Import("g_background", background_mask)},
+                                 {"g_gbuffer_world_normals", _gbuffer.normals},
+                                 {"g_gbuffer_world_position", _gbuffer.world_position},
+                             },
+                             u32x3(width, height, u32(1)));
+        return t;
+    }
     template <typename T>
     void SetResource(char const *_name, T _v) {
         kernel.SetResource(_name, _v);
@@ -1410,50 +2073,47 @@ public:
         kernel.Destroy();
         gfxDestroyTexture(gfx, disocclusion);
     }
-    Discclusion(GfxContext _gfx) {
-        u32 _width   = gfxGetBackBufferWidth(_gfx);
-        u32 _height  = gfxGetBackBufferHeight(_gfx);
-        gfx          = _gfx;
-        width        = _width;
-        height       = _height;
-        disocclusion = gfxCreateTexture2D(gfx, width, height, DXGI_FORMAT_R8_UNORM);
-        {
-            HLSL_MODULE_SCOPE;
-
-            GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
+    static void EmitKernel() {
+        GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
 
-            var tid = Input(IN_TYPE_DISPATCH_THREAD_ID)["xy"];
+        var tid = Input(IN_TYPE_DISPATCH_THREAD_ID)["xy"];
 
-            var g_rw_disocclusion = ResourceAccess(Resource::Create(RWTexture2D_f32_Ty, "g_rw_disocclusion"));
-            var dim               = g_rw_disocclusion.GetDimensions().Swizzle("xy");
+        var g_rw_disocclusion = ResourceAccess(Resource::Create(RWTexture2D_f32_Ty, "g_rw_disocclusion"));
+        var dim               = g_rw_disocclusion.GetDimensions().Swizzle("xy");
 
-            EmitIfElse((tid < dim).All(), [&] {
-                var N = g_gbuffer_world_normals.Load(tid);
-                var P = g_gbuffer_world_position.Load(tid);
+        EmitIfElse((tid < dim).All(), [&] {
+            var N = g_gbuffer_world_normals.Load(tid);
+            var P = g_gbuffer_world_position.Load(tid);
 
-                var uv       = (tid.ToF32() + f32x2(0.5, 0.5)) / dim.ToF32();
-                var velocity = g_velocity.Load(tid);
+            var uv       = (tid.ToF32() + f32x2(0.5, 0.5)) / dim.ToF32();
+            var velocity = g_velocity.Load(tid);
 
-                var tracked_uv = uv - velocity;
+            var tracked_uv = uv - velocity;
 
-                EmitIfElse((tracked_uv < f32x2(0.0, 0.0)).Any() || (tracked_uv > f32x2(1.0, 1.0)).Any(), [&] {
-                    g_rw_disocclusion.Store(tid, f32(0.0));
-                    EmitReturn();
-                });
+            EmitIfElse((tracked_uv < f32x2(0.0, 0.0)).Any() || (tracked_uv > f32x2(1.0, 1.0)).Any(), [&] {
+                g_rw_disocclusion.Store(tid, f32(0.0));
+                EmitReturn();
+            });
 
-                var rN     = g_prev_gbuffer_world_normals.Sample(g_linear_sampler, tracked_uv);
-                var rP     = g_prev_gbuffer_world_position.Sample(g_linear_sampler, tracked_uv);
-                var d      = var(f32(1.0)).Copy();
-                var eps    = GetEps(P);
-                var weight = GetWeight(N, P, rN, rP, eps);
+            var rN     = g_prev_gbuffer_world_normals.Sample(g_linear_sampler, tracked_uv);
+            var rP     = g_prev_gbuffer_world_position.Sample(g_linear_sampler, tracked_uv);
+            var d      = var(f32(1.0)).Copy();
+            var eps    = GetEps(P);
+            var weight = GetWeight(N, P, rN, rP, eps);
 
-                EmitIfElse(weight < f32(0.9), [&] { d = f32(0.0); });
+            EmitIfElse(weight < f32(0.9), [&] { d = f32(0.0); });
 
-                g_rw_disocclusion.Store(tid, d);
-            });
-
-            kernel = CompileGlobalModule(gfx, "Discclusion");
-        }
+            g_rw_disocclusion.Store(tid, d);
+        });
+    }
+    Discclusion(GfxContext _gfx) {
+        u32 _width   = gfxGetBackBufferWidth(_gfx);
+        u32 _height  = gfxGetBackBufferHeight(_gfx);
+        gfx          = _gfx;
+        width        = _width;
+        height       = _height;
+        disocclusion = gfxCreateTexture2D(gfx, width, height, DXGI_FORMAT_R8_UNORM);
+        BuildKernel(gfx, &kernel, "Discclusion", [] { EmitKernel(); });
     }
     void Execute() {
         kernel.SetResource("g_rw_disocclusion", disocclusion);
@@ -1465,12 +2125,25 @@ public:
             u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
             gfxCommandBindKernel(gfx, kernel.kernel);
-            gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+            kernel.Dispatch(num_groups_x, num_groups_y, 1);
         }
         kernel.ResetTable();
         kernel.End();
         g_pass_durations[kernel.name] = kernel.duration;
     }
+    RenderGraphTexture AddToGraph(GfxRenderGraph &_graph, GBufferFromVisibility::GraphTextures const &_gbuffer) {
+        RenderGraphTexture t = _graph.Import("g_disocclusion", disocclusion);
+        _graph.AddKernelPass(kernel,
+                             {
+                                 {"g_rw_disocclusion", t},
+                                 {"g_gbuffer_world_normals", _gbuffer.normals},
+                                 {"g_gbuffer_world_position", _gbuffer.world_position},
+                                 {"g_prev_gbuffer_world_normals", _gbuffer.prev_normals},
+                                 {"g_prev_gbuffer_world_position", _gbuffer.prev_world_position},
+                             },
+                             u32x3(width, height, u32(1)));
+        return t;
+    }
     template <typename T>
     void SetResource(char const *_name, T _v) {
         kernel.SetResource(_name, _v);
@@ -1504,9 +2177,9 @@ static var             GetHit(var barys, var instance_idx, var primitive_idx) {
     var i0    = g_IndexBuffer.Load(mesh["first_index"] + primitive_idx * u32(3) + u32(0)) + mesh["base_vertex"];
     var i1    = g_IndexBuffer.Load(mesh["first_index"] + primitive_idx * u32(3) + u32(1)) + mesh["base_vertex"];
     var i2    = g_IndexBuffer.Load(mesh["first_index"] + primitive_idx * u32(3) + u32(2)) + mesh["base_vertex"];
-    var v0    = g_VertexBuffer.Load(i0);
-    var v1    = g_VertexBuffer.Load(i1);
-    var v2    = g_VertexBuffer.Load(i2);
+    var v0    = LoadSceneVertex(instance["mesh_id"], i0);
+    var v1    = LoadSceneVertex(instance["mesh_id"], i1);
+    var v2    = LoadSceneVertex(instance["mesh_id"], i2);
     var wv0   = mul(transform, make_f32x4(v0["position"]["xyz"], f32(1.0)))["xyz"];
     var wv1   = mul(transform, make_f32x4(v1["position"]["xyz"], f32(1.0)))["xyz"];
     var wv2   = mul(transform, make_f32x4(v2["position"]["xyz"], f32(1.0)))["xyz"];
@@ -1567,7 +2240,7 @@ private:
     u32        width  = u32(0);
     u32        height = u32(0);
 
-    var g_output = ResourceAccess(Resource::Create(RWTexture2D_f32x4_Ty, "g_output"));
+    static constexpr char const *OUTPUT_NAME = "g_output";
 
 public:
     u32         GetWidth() { return width; }
@@ -1579,20 +2252,13 @@ public:
         kernel.Destroy();
         gfxDestroyTexture(gfx, result);
     }
-    PrimaryRays(GfxContext _gfx) {
-        u32 _width  = gfxGetBackBufferWidth(_gfx);
-        u32 _height = gfxGetBackBufferHeight(_gfx);
-        gfx         = _gfx;
-        width       = _width;
-        height      = _height;
-        result      = gfxCreateTexture2D(gfx, width, height, DXGI_FORMAT_R16G16B16A16_FLOAT);
-        HLSL_MODULE_SCOPE;
-
+    static void EmitKernel(u32 _width, u32 _height) {
         GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
 
-        var dim = u32x2(width, height);
+        var dim = u32x2(_width, _height);
 
-        var tid = Input(IN_TYPE_DISPATCH_THREAD_ID)["xy"];
+        var tid      = Input(IN_TYPE_DISPATCH_THREAD_ID)["xy"];
+        var g_output = ResourceAccess(Resource::Create(RWTexture2D_f32x4_Ty, OUTPUT_NAME));
 
         EmitIfElse((tid < dim).All(), [&] {
             var uv                = (tid.ToF32() + f32x2(0.5, 0.5)) / dim.ToF32();
@@ -1616,13 +2282,20 @@ public:
                 },
                 [&] { g_output.Store(tid, f32x4_splat(0.0)); });
         });
-
-        kernel = CompileGlobalModule(gfx, "PrimaryRays");
+    }
+    PrimaryRays(GfxContext _gfx) {
+        u32 _width  = gfxGetBackBufferWidth(_gfx);
+        u32 _height = gfxGetBackBufferHeight(_gfx);
+        gfx         = _gfx;
+        width       = _width;
+        height      = _height;
+        result      = gfxCreateTexture2D(gfx, width, height, DXGI_FORMAT_R16G16B16A16_FLOAT);
+        BuildKernel(gfx, &kernel, "PrimaryRays", [_width, _height] { EmitKernel(_width, _height); });
 
         // fprintf(stdout, kernel.isa.c_str());
     }
     void Execute() {
-        kernel.SetResource(g_output->resource->GetName().c_str(), result);
+        kernel.SetResource(OUTPUT_NAME, result);
         kernel.CheckResources();
         kernel.Begin();
         {
@@ -1631,7 +2304,7 @@ public:
             u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
             gfxCommandBindKernel(gfx, kernel.kernel);
-            gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+            kernel.Dispatch(num_groups_x, num_groups_y, 1);
         }
         kernel.ResetTable();
         kernel.End();
@@ -1655,7 +2328,7 @@ private:
     u32 width  = u32(0);
     u32 height = u32(0);
 
-    var g_rw_result = ResourceAccess(Resource::Create(RWTexture2D_f32_Ty, "g_rw_result"));
+    static constexpr char const *RESULT_NAME = "g_rw_result";
 
 public:
     u32         GetWidth() { return width; }
@@ -1667,6 +2340,58 @@ public:
         kernel.Destroy();
         gfxDestroyTexture(gfx, result);
     }
+    static void EmitKernel(u32 _width, u32 _height) {
+        GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
+
+        var  tid         = Input(IN_TYPE_DISPATCH_THREAD_ID)["xy"];
+        var  gid         = Input(IN_TYPE_GROUP_THREAD_ID)["xy"];
+        var  g_rw_result = ResourceAccess(Resource::Create(RWTexture2D_f32_Ty, RESULT_NAME));
+        var  dim         = u32x2(_width, _height);
+        var  lds         = AllocateLDS(u32Ty, u32(16 * 16), "lds_values");
+        var  gid_center  = gid.xy() + u32x2(4, 4);
+        auto linear_idx  = [](var xy) { return (xy.x().ToI32() + xy.y().ToI32() * i32(16)).ToU32(); };
+        var  group_tid   = u32(8) * (tid / u32(8));
+
+        Init_LDS_16x16(lds, [&](var src_coord) {
+            var val         = Zero(u32Ty).Copy();
+            var gbuffer_val = g_gbuffer_encoded.Load(src_coord);
+            val.x()         = gbuffer_val;
+            return val;
+        });
+        EmitGroupSync();
+
+        var uv             = (tid.ToF32() + f32x2(0.5, 0.5)) / dim.ToF32();
+        var l              = lds.Load(linear_idx(gid_center));
+        var ray            = GenCameraRay(uv);
+        var xi             = GetNoise(tid);
+        var center_gbuffer = DecodeGBuffer32Bits(ray, l.x(), xi.x());
+        var is_bg          = g_background.Load(tid) > f32(0.5);
+        EmitIfElse(
+            is_bg, [&] { g_rw_result.Store(tid, f32(0.0)); },
+            [&] {
+                var eps = GetEps(center_gbuffer["P"]);
+
+                var acc = Make(f32Ty);
+
+                for (i32 y = i32(-1); y <= i32(1); y++) {
+                    for (i32 x = i32(-1); x <= i32(1); x++) {
+                        if (x == i32(0) && y == i32(0)) continue;
+                        i32x2 soffset = i32x2(x, y);
+                        var   l       = lds.Load(linear_idx(gid_center.ToI32() + soffset));
+                        var   uv      = (tid.ToF32() + f32x2(soffset) + f32x2(0.5, 0.5)) / dim.ToF32();
+                        var   ray     = GenCameraRay(uv);
+                        var   xi      = GetNoise(tid);
+                        var   gbuffer = DecodeGBuffer32Bits(ray, l.x(), xi.x());
+                        var   weight  = GetWeight(center_gbuffer["N"], center_gbuffer["P"], gbuffer["N"], gbuffer["P"], eps);
+                        acc += weight;
+                    }
+                }
+
+                acc = f32(1.0) - acc / f32(3 * 3 - 1);
+
+                g_rw_result.Store(tid, acc);
+            });
+    }
     EdgeDetect(GfxContext _gfx) {
         u32 _width  = gfxGetBackBufferWidth(_gfx);
         u32 _height = gfxGetBackBufferHeight(_gfx);
@@ -1674,63 +2399,10 @@ public:
         width       = _width;
         height      = _height;
         result      = gfxCreateTexture2D(gfx, width, height, DXGI_FORMAT_R8_UNORM);
-        {
-            HLSL_MODULE_SCOPE;
-
-            GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
-
-            var  tid        = Input(IN_TYPE_DISPATCH_THREAD_ID)["xy"];
-            var  gid        = Input(IN_TYPE_GROUP_THREAD_ID)["xy"];
-            var  dim        = u32x2(width, height);
-            var  lds        = AllocateLDS(u32Ty, u32(16 * 16), "lds_values");
-            var  gid_center = gid.xy() + u32x2(4, 4);
-            auto linear_idx = [](var xy) { return (xy.x().ToI32() + xy.y().ToI32() * i32(16)).ToU32(); };
-            var  group_tid  = u32(8) * (tid / u32(8));
-
-            Init_LDS_16x16(lds, [&](var src_coord) {
-                var val         = Zero(u32Ty).Copy();
-                var gbuffer_val = g_gbuffer_encoded.Load(src_coord);
-                val.x()         = gbuffer_val;
-                return val;
-            });
-            EmitGroupSync();
-
-            var uv             = (tid.ToF32() + f32x2(0.5, 0.5)) / dim.ToF32();
-            var l              = lds.Load(linear_idx(gid_center));
-            var ray            = GenCameraRay(uv);
-            var xi             = GetNoise(tid);
-            var center_gbuffer = DecodeGBuffer32Bits(ray, l.x(), xi.x());
-            var is_bg          = g_background.Load(tid) > f32(0.5);
-            EmitIfElse(
-                is_bg, [&] { g_rw_result.Store(tid, f32(0.0)); },
-                [&] {
-                    var eps = GetEps(center_gbuffer["P"]);
-
-                    var acc = Make(f32Ty);
-
-                    for (i32 y = i32(-1); y <= i32(1); y++) {
-                        for (i32 x = i32(-1); x <= i32(1); x++) {
-                            if (x == i32(0) && y == i32(0)) continue;
-                            i32x2 soffset = i32x2(x, y);
-                            var   l       = lds.Load(linear_idx(gid_center.ToI32() + soffset));
-                            var   uv      = (tid.ToF32() + f32x2(soffset) + f32x2(0.5, 0.5)) / dim.ToF32();
-                            var   ray     = GenCameraRay(uv);
-                            var   xi      = GetNoise(tid);
-                            var   gbuffer = DecodeGBuffer32Bits(ray, l.x(), xi.x());
-                            var   weight  = GetWeight(center_gbuffer["N"], center_gbuffer["P"], gbuffer["N"], gbuffer["P"], eps);
-                            acc += weight;
-                        }
-                    }
-
-                    acc = f32(1.0) - acc / f32(3 * 3 - 1);
-
-                    g_rw_result.Store(tid, acc);
-                });
-            kernel = CompileGlobalModule(gfx, "EdgeDetect");
-        }
+        BuildKernel(gfx, &kernel, "EdgeDetect", [_width, _height] { EmitKernel(_width, _height); });
     }
     void Execute() {
-        kernel.SetResource(g_rw_result, result);
+        kernel.SetResource(RESULT_NAME, result);
         kernel.CheckResources();
         kernel.Begin();
         {
@@ -1739,7 +2411,7 @@ public:
             u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
             gfxCommandBindKernel(gfx, kernel.kernel);
-            gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+            kernel.Dispatch(num_groups_x, num_groups_y, 1);
         }
         kernel.End();
         g_pass_durations[kernel.name] = kernel.duration;
@@ -1764,7 +2436,7 @@ protected:
     TEXTURE_LIST
 #    undef TEXTURE
 
-    var g_input = ResourceAccess(Resource::Create(RWTexture2D_f32x4_Ty, "g_input"));
+    static var g_input() { return ResourceAccess(Resource::Create(RWTexture2D_f32x4_Ty, "g_input")); }
 
 public:
 #    define TEXTURE(_name, _fmt, _ty, _width, _height, _depth, _mips)                                                                                                              \
@@ -1799,6 +2471,47 @@ public:
         TEXTURE_LIST
 #    undef TEXTURE
     }
+    static void EmitTonemapKernel() {
+        GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
+
+        var tid   = Input(IN_TYPE_DISPATCH_THREAD_ID)["xy"];
+        var input = g_input().Load(tid);
+        input     = pow(input, f32(1.0 / 2.2));
+        g_rw_Tonemapped().Store(tid, make_f32x4(input.xyz(), f32(1.0)));
+    }
+    static void EmitKernel(u32 _width, u32 _height) {
+        GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
+
+        var tid   = Input(IN_TYPE_DISPATCH_THREAD_ID)["xy"];
+        var dim   = u32x2(_width, _height);
+        var input = g_Tonemapped().Load(tid);
+
+        var acc          = Make(f32x3Ty);
+        var variance_acc = Make(f32x3Ty);
+        var weight_acc   = Make(f32Ty);
+
+        for (i32 y = i32(-1); y <= i32(1); y++) {
+            for (i32 x = i32(-1); x <= i32(1); x++) {
+                var val    = g_Tonemapped().Load(tid.ToI32() + i32x2(x, y)).xyz();
+                var weight = exp(-f32(x * x + y * y) * f32(0.5));
+                acc += val * weight;
+                variance_acc += val * val * weight;
+                weight_acc += weight;
+            }
+        }
+        variance_acc /= max(f32(1.0e-3), weight_acc);
+        acc /= max(f32(1.0e-3), weight_acc);
+
+        variance_acc = sqrt(abs(variance_acc - acc * acc));
+
+        var uv         = (tid.ToF32() + f32x2(0.5, 0.5)) / dim.ToF32();
+        var velocity   = g_velocity.Load(tid);
+        var tracked_uv = uv - velocity;
+        var prev       = g_PrevResult().Sample(g_linear_sampler, tracked_uv);
+        var clamped    = clamp(prev.xyz(), input.xyz() - variance_acc.xyz(), input.xyz() + variance_acc.xyz());
+        var mix        = lerp(input.xyz(), clamped.xyz(), f32(0.98));
+        g_rw_Result().Store(tid, make_f32x4(mix.xyz(), f32(1.0)));
+    }
     TAA(GfxContext _gfx) {
         u32 _width  = gfxGetBackBufferWidth(_gfx);
         u32 _height = gfxGetBackBufferHeight(_gfx);
@@ -1819,56 +2532,8 @@ public:
         }
         TEXTURE_LIST
 #    undef TEXTURE
-        {
-            HLSL_MODULE_SCOPE;
-
-            GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
-
-            var tid   = Input(IN_TYPE_DISPATCH_THREAD_ID)["xy"];
-            var dim   = u32x2(width, height);
-            var input = g_input.Load(tid);
-            input     = pow(input, f32(1.0 / 2.2));
-            g_rw_Tonemapped().Store(tid, make_f32x4(input.xyz(), f32(1.0)));
-
-            tonemap = CompileGlobalModule(gfx, "TAA/Tonemap");
-        }
-        {
-            HLSL_MODULE_SCOPE;
-
-            GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
-
-            var tid   = Input(IN_TYPE_DISPATCH_THREAD_ID)["xy"];
-            var dim   = u32x2(width, height);
-            var input = g_Tonemapped().Load(tid);
-
-            var acc          = Make(f32x3Ty);
-            var variance_acc = Make(f32x3Ty);
-            var weight_acc   = Make(f32Ty);
-
-            for (i32 y = i32(-1); y <= i32(1); y++) {
-                for (i32 x = i32(-1); x <= i32(1); x++) {
-                    var val    = g_Tonemapped().Load(tid.ToI32() + i32x2(x, y)).xyz();
-                    var weight = exp(-f32(x * x + y * y) * f32(0.5));
-                    acc += val * weight;
-                    variance_acc += val * val * weight;
-                    weight_acc += weight;
-                }
-            }
-            variance_acc /= max(f32(1.0e-3), weight_acc);
-            acc /= max(f32(1.0e-3), weight_acc);
-
-            variance_acc = sqrt(abs(variance_acc - acc * acc));
-
-            var uv         = (tid.ToF32() + f32x2(0.5, 0.5)) / dim.ToF32();
-            var velocity   = g_velocity.Load(tid);
-            var tracked_uv = uv - velocity;
-            var prev       = g_PrevResult().Sample(g_linear_sampler, tracked_uv);
-            var clamped    = clamp(prev.xyz(), input.xyz() - variance_acc.xyz(), input.xyz() + variance_acc.xyz());
-            var mix        = lerp(input.xyz(), clamped.xyz(), f32(0.98));
-            g_rw_Result().Store(tid, make_f32x4(mix.xyz(), f32(1.0)));
-
-            kernel = CompileGlobalModule(gfx, "TAA");
-        }
+        BuildKernel(gfx, &tonemap, "TAA/Tonemap", [] { EmitTonemapKernel(); });
+        BuildKernel(gfx, &kernel, "TAA", [_width, _height] { EmitKernel(_width, _height); });
     }
     void Execute(GfxTexture &input) {
         std::swap(Result, PrevResult);
@@ -1879,7 +2544,7 @@ public:
             TEXTURE_LIST
 #    undef TEXTURE
 
-            kernel.SetResource(g_input, input);
+            kernel.SetResource(g_input(), input);
             kernel.CheckResources();
             kernel.Begin();
             {
@@ -1888,7 +2553,7 @@ public:
                 u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
                 gfxCommandBindKernel(gfx, kernel.kernel);
-                gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+                kernel.Dispatch(num_groups_x, num_groups_y, 1);
             }
             kernel.End();
             g_pass_durations[kernel.name] = kernel.duration;
@@ -1899,7 +2564,7 @@ public:
             TEXTURE_LIST
 #    undef TEXTURE
 
-            kernel.SetResource(g_input, input);
+            kernel.SetResource(g_input(), input);
             kernel.CheckResources();
             kernel.Begin();
             {
@@ -1908,7 +2573,7 @@ public:
                 u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
                 gfxCommandBindKernel(gfx, kernel.kernel);
-                gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+                kernel.Dispatch(num_groups_x, num_groups_y, 1);
             }
             kernel.End();
             g_pass_durations[kernel.name] = kernel.duration;
@@ -1917,6 +2582,41 @@ public:
     }
 #    undef TEXTURE_LIST
 };
+// Emits the pass kernels on the CPU only, no device or compilation involved.
+static void BenchKernelEmission(u32 _num_iters = u32(16), u32 _width = u32(1920), u32 _height = u32(1080)) {
+    BenchExprNodes("GBufferFromVisibility", [] { GBufferFromVisibility::EmitKernel(); }, _num_iters);
+    BenchExprNodes("NearestVelocity", [] { NearestVelocity::EmitKernel(); }, _num_iters);
+    BenchExprNodes("EncodeGBuffer", [] { EncodeGBuffer::EmitKernel(); }, _num_iters);
+    BenchExprNodes("Discclusion", [] { Discclusion::EmitKernel(); }, _num_iters);
+    BenchExprNodes("PrimaryRays", [&] { PrimaryRays::EmitKernel(_width, _height); }, _num_iters);
+    BenchExprNodes("EdgeDetect", [&] { EdgeDetect::EmitKernel(_width, _height); }, _num_iters);
+    BenchExprNodes("TAA/Tonemap", [] { TAA::EmitTonemapKernel(); }, _num_iters);
+    BenchExprNodes("TAA", [&] { TAA::EmitKernel(_width, _height); }, _num_iters);
+}
+// Every pass emitted serially and on its own thread at the same time, no device involved
+static bool TestParallelKernelEmission(u32 _num_rounds = u32(4), u32 _width = u32(1920), u32 _height = u32(1080)) {
+    return TestParallelModuleBuild(
+        {
+            [] { GBufferFromVisibility::EmitKernel(); },
+            [] { NearestVelocity::EmitKernel(); },
+            [] { EncodeGBuffer::EmitKernel(); },
+            [] { Discclusion::EmitKernel(); },
+            [=] { PrimaryRays::EmitKernel(_width, _height); },
+            [=] { EdgeDetect::EmitKernel(_width, _height); },
+            [] { TAA::EmitTonemapKernel(); },
+            [=] { TAA::EmitKernel(_width, _height); },
+        },
+        _num_rounds);
+}
+static void BenchHLSLWriter(u32 _num_iters = u32(64), u32 _width = u32(1920), u32 _height = u32(1080)) {
+    BenchHLSLEmission("TAA", [&] { TAA::EmitKernel(_width, _height); }, _num_iters);
+    BenchHLSLEmission("EdgeDetect", [&] { EdgeDetect::EmitKernel(_width, _height); }, _num_iters);
+    BenchOptimizer("TAA", [&] { TAA::EmitKernel(_width, _height); }, _num_iters);
+    BenchOptimizer("EdgeDetect", [&] { EdgeDetect::EmitKernel(_width, _height); }, _num_iters);
+    BenchScheduler("TAA", [&] { TAA::EmitKernel(_width, _height); }, _num_iters);
+    BenchScheduler("EdgeDetect", [&] { EdgeDetect::EmitKernel(_width, _height); }, _num_iters);
+    BenchNestedScopes();
+}
 class ISceneTemplate {
 protected:
     Camera     g_camera         = {};
@@ -1993,7 +2693,7 @@ public:
 
         // Import the scene data
         gfxSceneImport(scene, _scene_path);
-        gpu_scene = UploadSceneToGpuMemory(gfx, scene);
+        gpu_scene = UploadSceneToGpuMemory(gfx, scene, _scene_path);
 
         sun.Init(gfx, _shader_path);
 
@@ -2034,7 +2734,8 @@ public:
         // auto       debug_trace_primary = gfxCreateComputeKernel(gfx, debug_rt_program, "trace_primary");
         back_buffer = gfxCreateTexture2D(gfx, DXGI_FORMAT_R32G32B32A32_FLOAT);
 
-        upload_buffer.Init(gfx);
+        // The usual 100 MiB for the sub-allocator plus a 32 MiB frame ring for the per frame constants and gizmos
+        upload_buffer.Init(gfx, u32(132 << 20), u32(32 << 20));
         download_buffer.Init(gfx);
 
         blue_noise_baker.Init(gfx, _shader_path);
@@ -2073,6 +2774,7 @@ public:
 
             UpdateChild();
 
+            sun.SetPos((gpu_scene.aabb_min + gpu_scene.aabb_max) * f32(0.5));
             sun.SetWidth(gpu_scene.size / f32(2.0));
             sun.Update(upload_buffer);
 
@@ -2095,6 +2797,7 @@ public:
 
             // Update our GPU scene and camera
             UpdateGpuScene(gfx, scene, gpu_scene);
+            UpdateTextureStreaming(gfx, gpu_scene);
 
             blue_noise_baker.Bake();
 
@@ -2123,6 +2826,12 @@ public:
                 gfxCommandBindVertexBuffer(gfx, gpu_scene.vertex_buffer, /* index */ u32(1), /* byte_offset */ u64(16));
                 gfxCommandBindVertexBuffer(gfx, gpu_scene.vertex_buffer, /* index */ u32(2), /* byte_offset */ u64(32));
 
+                // Backfaces are left to the rasterizer, the cones only matter once meshlets are drawn on their own
+                MeshletFrustum   frustum          = MeshletFrustum::Create(transpose(g_camera.view_proj), g_camera.pos);
+                MeshletCullStats cull_stats       = {};
+                std::vector<u8>  instance_visible = {};
+                if (g_frustum_cull_instances) gpu_scene.instance_bvh.Cull(frustum, instance_visible);
+
                 for (uint32_t i = 0; i < instance_count; ++i) {
                     GfxConstRef<GfxInstance> const instance_ref = gfxSceneGetInstanceHandle(scene, i);
 
@@ -2131,10 +2840,20 @@ public:
 
                     Mesh const mesh = gpu_scene.meshes[mesh_id];
 
+                    // The instance box first, then its meshlets
+                    if (g_frustum_cull_instances &&
+                        (instance_id >= instance_visible.size() || instance_visible[instance_id] == u8(0) ||
+                         CullMeshMeshlets(gpu_scene.meshlets, mesh_id, frustum, MeshletInstance::Create(instance_ref->transform, /* cone_culling */ false), cull_stats) == u32(0)))
+                        continue;
+
                     gfxProgramSetParameter(gfx, pbr_program, "g_InstanceId", instance_id);
 
                     gfxCommandDrawIndexed(gfx, mesh.count, 1, mesh.first_index, mesh.base_vertex);
                 }
+
+                // Read back by UpdateTextureStreaming once this back buffer comes around again
+                if (gpu_scene.texture_streaming)
+                    gfxCommandCopyBuffer(gfx, gpu_scene.texture_streaming->feedback_readback_buffers[gfxGetBackBufferIndex(gfx)], gpu_scene.texture_feedback_buffer);
             }
 
             // Render sun shadow
@@ -2173,7 +2892,7 @@ public:
 
             defer(frame_idx++);
 
-            g_global_runtime_resource_registry = {};
+            g_global_runtime_resource_registry.Clear();
             set_global_resource(g_frame_idx, frame_idx);
             set_global_resource(g_tlas, gpu_scene.acceleration_structure);
             set_global_resource(g_linear_sampler, linear_sampler);
@@ -2183,6 +2902,10 @@ public:
             set_global_resource(g_MeshBuffer, gpu_scene.mesh_buffer);
             set_global_resource(g_IndexBuffer, gpu_scene.index_buffer);
             set_global_resource(g_VertexBuffer, gpu_scene.vertex_buffer);
+            if (g_use_compact_vertices) {
+                set_global_resource(g_CompactVertexBuffer, gpu_scene.compact_vertex_buffer);
+                set_global_resource(g_CompactVertexBoundsBuffer, gpu_scene.compact_vertex_bounds_buffer);
+            }
             set_global_resource(g_InstanceBuffer, gpu_scene.instance_buffer);
             set_global_resource(g_MaterialBuffer, gpu_scene.material_buffer);
             set_global_resource(g_TransformBuffer, gpu_scene.transform_buffer);
@@ -2202,7 +2925,12 @@ public:
             set_global_resource(g_sun_shadow_maps, ResourceSlot(sun.GetTextures().data(), (uint32_t)sun.GetTextures().size()));
             set_global_resource(g_sun_dir, sun.GetDir());
 
-            Render();
+            GfxResourceRegistry::Update();
+
+            {
+                PROFILE_CPU_SCOPE(GetProfiler(), "Render");
+                Render();
+            }
 
             gizmo_manager.Render(upload_buffer, g_camera.view_proj);
 
@@ -2224,10 +2952,14 @@ public:
             if (ImGui::IsKeyPressed('R')) {
                 wiggle_camera = !wiggle_camera;
             }
+            if (ImGui::IsKeyPressed('P')) {
+                if (GetProfiler().ExportChromeTrace(".shader_cache/profile_trace.json")) fprintf(stdout, "[PROFILER] Wrote .shader_cache/profile_trace.json\n");
+            }
 
             // And submit the frame
             gfxImGuiRender();
             gfxFrame(gfx);
+            GetProfiler().EndFrame();
         }
     }
     void Release() {
@@ -194,12 +194,15 @@ static GfxTexture load_texture(GfxContext gfx, char const *asset_file) {
 //     return cpu_buffer;
 // }
 
+// Long lived allocations come from offset_allocator, frame allocations from a lock free ring at the end of the buffer that any thread can use. When the ring is
+// full frame allocations fall back to offset_allocator and a deferred free, behind a mutex.
 class GfxBufferSubAllocator {
 public:
     struct Allocation {
         u8       *host_dst      = {};
         u32       device_offset = {};
         u32       size          = {};
+        u32       metadata      = u32(-1); // OffsetAllocator node, needed by Free
         GfxBuffer buffer        = {};
         bool      IsValid() const { return host_dst != NULL; }
         template <typename T>
@@ -212,50 +215,89 @@ protected:
     u32                     size             = {};
     GfxBuffer               upload_buffer    = {};
     OffsetAllocator         offset_allocator = {};
+    FrameRingAllocator      ring             = {};
+    std::mutex              mutex            = {}; // offset_allocator and the deferred free queues
     u8                     *host_map         = {};
     std::vector<Allocation> deferred_free_queue[3];
     u32                     frame_idx = u32(0);
 
+    // The last _ring_size bytes, rounded down to the ring alignment, go to the frame ring
+    void InitAllocators(u32 _ring_size) {
+        u32 ring_size = std::min(_ring_size, size) & ~(FrameRingAllocator::MAX_ALIGNMENT - u32(1));
+        offset_allocator.Init(size - ring_size);
+        if (ring_size) ring.Init(size - ring_size, ring_size, u32(3));
+    }
+    Allocation MakeAllocation(u32 _offset, u32 _size, u32 _metadata) {
+        Allocation dev_a    = {};
+        dev_a.device_offset = _offset;
+        dev_a.host_dst      = host_map + _offset;
+        dev_a.size          = _size;
+        dev_a.metadata      = _metadata;
+        dev_a.buffer        = upload_buffer;
+        return dev_a;
+    }
+
 public:
     GfxBuffer  GetBuffer() { return upload_buffer; }
     Allocation Allocate(u64 needed_size, u32 alignment = u32(256)) {
+        std::lock_guard<std::mutex> lock(mutex);
         OffsetAllocator::Allocation a = offset_allocator.Allocate(u32(needed_size), alignment);
         if (a.IsValid() == false) return Allocation{NULL};
-        Allocation dev_a    = {};
-        dev_a.device_offset = a.offset;
-        dev_a.host_dst      = host_map + a.offset;
-        dev_a.size          = u32(needed_size);
-        dev_a.buffer        = upload_buffer;
-        return dev_a;
+        return MakeAllocation(a.offset, u32(needed_size), a.metadata);
+    }
+    // Valid until the frame it was made in is done on the GPU, no Free needed. Safe to call from worker threads as long as the commands using it are
+    // recorded in the same frame.
+    Allocation AllocateFrame(u64 needed_size, u32 alignment = u32(256)) {
+        FrameRingAllocator::Allocation a = ring.IsInitialized() ? ring.Allocate(u32(needed_size), alignment) : FrameRingAllocator::Allocation{};
+        if (a.IsValid()) return MakeAllocation(a.offset, a.size, u32(-1));
+        Allocation fallback = Allocate(needed_size, alignment);
+        if (fallback.IsValid()) DeferFree(fallback);
+        return fallback;
     }
     void FlushDeferredFreeQueue() {
+        std::lock_guard<std::mutex> lock(mutex);
         frame_idx++;
         for (auto &a : deferred_free_queue[frame_idx % 3]) {
-            Free(a);
+            offset_allocator.Free(OffsetAllocator::Allocation{a.device_offset, a.size, a.metadata});
         }
         deferred_free_queue[frame_idx % 3].clear();
+        ring.NextFrame();
+    }
+    void DeferFree(Allocation al) {
+        std::lock_guard<std::mutex> lock(mutex);
+        deferred_free_queue[frame_idx % 3].push_back(al);
+    }
+    bool CanAllocate(u64 needed_size, u32 alignment = u32(256)) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return offset_allocator.CanAllocate(u32(needed_size), alignment);
+    }
+    void Free(Allocation const &allocation) {
+        std::lock_guard<std::mutex> lock(mutex);
+        offset_allocator.Free(OffsetAllocator::Allocation{allocation.device_offset, allocation.size, allocation.metadata});
+    }
+    void Release(GfxContext gfx) {
+        ring.Release();
+        gfxDestroyBuffer(gfx, upload_buffer);
     }
-    void DeferFree(Allocation al) { deferred_free_queue[frame_idx % 3].push_back(al); }
-    bool CanAllocate(u64 needed_size, u32 alignment = u32(256)) { return offset_allocator.CanAllocate(u32(needed_size), alignment); }
-    void Free(Allocation const &allocation) { offset_allocator.Free(OffsetAllocator::Allocation{allocation.device_offset, allocation.size}); }
-    void Release(GfxContext gfx) { gfxDestroyBuffer(gfx, upload_buffer); }
 };
 
+// The frame ring is opt-in and comes out of _size, without it AllocateFrame falls back to Allocate and a deferred free
 class GfxUploadBuffer : public GfxBufferSubAllocator {
 public:
-    void Init(GfxContext gfx, u32 _size = u32(100 << 20)) {
+    void Init(GfxContext gfx, u32 _size = u32(100 << 20), u32 _ring_size = u32(0)) {
         size = _size;
-        offset_allocator.Init(size);
+        InitAllocators(_ring_size);
         upload_buffer = gfxCreateBuffer(gfx, size, NULL, kGfxCpuAccess_Write);
         host_map      = gfxBufferGetData<u8>(gfx, upload_buffer);
     }
 };
 
+// No frame ring by default, downloads are usually read back right when their frame retires
 class GfxDownloadBuffer : public GfxBufferSubAllocator {
 public:
-    void Init(GfxContext gfx, u32 _size = u32(100 << 20)) {
+    void Init(GfxContext gfx, u32 _size = u32(100 << 20), u32 _ring_size = u32(0)) {
         size = _size;
-        offset_allocator.Init(size);
+        InitAllocators(_ring_size);
         upload_buffer = gfxCreateBuffer(gfx, size, NULL, kGfxCpuAccess_Read);
         host_map      = gfxBufferGetData<u8>(gfx, upload_buffer);
     }
@@ -486,8 +486,7 @@ public:
 
         if (line_segments.size() != 0) {
 
-            GfxUploadBuffer::Allocation device_memory = upload_buffer.Allocate(line_segments.size() * sizeof(line_segments[0]));
-            upload_buffer.DeferFree(device_memory);
+            GfxUploadBuffer::Allocation device_memory = upload_buffer.AllocateFrame(line_segments.size() * sizeof(line_segments[0]));
             assert(device_memory.IsValid());
             device_memory.CopyIn(line_segments);
 
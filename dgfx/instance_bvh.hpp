@@ -0,0 +1,302 @@
+// MIT License
+//
+// Copyright (c) 2023 Anton Schreiner
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined(INSTANCE_BVH_HPP)
+#    define INSTANCE_BVH_HPP
+
+#    include "common.h"
+#    include "meshlet_builder.hpp"
+#    include "scene_cache.hpp"
+#    include <3rdparty/embree/include/embree3/rtcore.h>
+#    include <3rdparty/embree/include/embree3/rtcore_builder.h>
+
+#    include <algorithm>
+#    include <cassert>
+#    include <cstdio>
+#    include <functional>
+#    include <new>
+#    include <vector>
+
+#    include "embree.hpp"
+
+namespace GfxJit {
+
+// Positive vertex test against every plane, conservative for boxes near the frustum corners
+static bool IsAABBOutsideFrustum(AABB const &_aabb, MeshletFrustum const &_frustum) {
+    ifor(_frustum.num_planes) {
+        f32x4 plane = _frustum.planes[i];
+        f32x3 p     = f32x3(plane.x >= f32(0.0) ? _aabb.hi.x : _aabb.lo.x, plane.y >= f32(0.0) ? _aabb.hi.y : _aabb.lo.y, plane.z >= f32(0.0) ? _aabb.hi.z : _aabb.lo.z);
+        if (dot(f32x3(plane), p) + plane.w < f32(0.0)) return true;
+    }
+    return false;
+}
+
+// Leaf primitive indices go through _instance_ids, _visible is indexed by instance id
+static void CullInstanceNodes(cpubvh::Node *_node, MeshletFrustum const &_frustum, u32 const *_instance_ids, std::vector<u8> &_visible) {
+    if (IsAABBOutsideFrustum(_node->aabb, _frustum)) return;
+    if (_node->IsLeaf()) {
+        _visible[_instance_ids[((cpubvh::LeafNode *)_node)->primitive_idx]] = u8(1);
+        return;
+    }
+    ifor(_node->Getnum_children()) if (_node->GetChild(i)) CullInstanceNodes(_node->GetChild(i), _frustum, _instance_ids, _visible);
+}
+
+// Entry distance along the ray or a negative value for a miss. Flat boxes count, a ground plane has no thickness.
+static f32 GetRayAABBDistance(Ray const &_ray, AABB const &_aabb) {
+    f32x2 t = AABB::hit_aabb(_ray.o, f32(1.0) / _ray.d, _aabb.lo, _aabb.hi);
+    return t.x <= t.y && t.y > f32(0.0) ? t.x : f32(-1.0);
+}
+
+// Closest instance along the ray. _hit(instance_id, box_distance) refines a candidate and returns its distance or a negative value for a miss, without it the box
+// distance is used. Returns u32(-1) if nothing was hit.
+static u32 PickInstanceNodes(cpubvh::Node *_node, Ray const &_ray, u32 const *_instance_ids, f32 &_t, std::function<f32(u32, f32)> const &_hit) {
+    f32 t = GetRayAABBDistance(_ray, _node->aabb);
+    if (t < f32(0.0) || t >= _t) return u32(-1);
+    if (_node->IsLeaf()) {
+        u32 instance_id = _instance_ids[((cpubvh::LeafNode *)_node)->primitive_idx];
+        if (_hit) t = _hit(instance_id, t);
+        if (t < f32(0.0) || t >= _t) return u32(-1);
+        _t = t;
+        return instance_id;
+    }
+    // Near children first so the far ones are mostly rejected by their box distance. The builder makes at most 4.
+    std::pair<f32, cpubvh::Node *> children[8] = {};
+    u32                            num_children = u32(0);
+    ifor(_node->Getnum_children()) {
+        cpubvh::Node *child = _node->GetChild(i);
+        if (child == NULL) continue;
+        f32 child_t = GetRayAABBDistance(_ray, child->aabb);
+        if (child_t < f32(0.0) || child_t >= _t) continue;
+        assert(num_children < u32(8));
+        children[num_children++] = {child_t, child};
+    }
+    std::sort(children, children + num_children, [](std::pair<f32, cpubvh::Node *> const &a, std::pair<f32, cpubvh::Node *> const &b) { return a.first < b.first; });
+    u32 closest = u32(-1);
+    ifor(num_children) {
+        u32 instance_id = PickInstanceNodes(children[i].second, _ray, _instance_ids, _t, _hit);
+        if (instance_id != u32(-1)) closest = instance_id;
+    }
+    return closest;
+}
+
+// Top level BVH over the world space instance boxes built by the embree builder. Instances with an empty box are left out.
+class InstanceBVH {
+private:
+    cpubvh::BVH            builder       = {};
+    cpubvh::BVH::BVHResult result        = {};
+    std::vector<u32>       instance_ids  = {}; // Leaf primitive index -> instance id
+    u32                    num_instances = u32(0);
+    bool                   initialized   = false;
+
+public:
+    void Build(std::vector<AABB> const &_instance_bounds) {
+        result.Release();
+        instance_ids.clear();
+        num_instances           = u32(_instance_bounds.size());
+        std::vector<AABB> boxes = {};
+        ifor(num_instances) {
+            if (IsAABBEmpty(_instance_bounds[i])) continue;
+            boxes.push_back(_instance_bounds[i]);
+            instance_ids.push_back(i);
+        }
+        if (boxes.empty()) return;
+        if (!initialized) {
+            builder.Init();
+            initialized = true;
+        }
+        result = builder.Build(boxes.data(), u64(boxes.size()));
+    }
+    void Release() {
+        result.Release();
+        if (initialized) builder.Release();
+        initialized = false;
+        instance_ids.clear();
+        num_instances = u32(0);
+    }
+    bool          IsValid() const { return result.IsValid(); }
+    cpubvh::Node *GetRoot() const { return result.root; }
+    // _visible is indexed by instance id
+    void Cull(MeshletFrustum const &_frustum, std::vector<u8> &_visible) const {
+        _visible.assign(num_instances, u8(0));
+        if (result.root) CullInstanceNodes(result.root, _frustum, instance_ids.data(), _visible);
+    }
+    u32 Pick(Ray const &_ray, f32 &_t, std::function<f32(u32, f32)> const &_hit = {}) const {
+        _t = f32(1.0e30);
+        return result.root ? PickInstanceNodes(result.root, _ray, instance_ids.data(), _t, _hit) : u32(-1);
+    }
+};
+
+// Synthetic rotated, scaled and mirrored instances. Embree isn't needed, the traversal runs on a hand built two level tree.
+static void TestInstanceBVH() {
+    u32  state = u32(7);
+    auto rnd   = [&]() {
+        state = pcg(state);
+        return f32(state & u32(0xffffff)) / f32(0xffffff);
+    };
+    SceneCacheData data = {};
+    // An off center point cloud, an empty mesh
+    SceneCacheMesh cloud = {};
+    data.storage_meshes.push_back(cloud);
+    ifor(512) {
+        SceneCacheVertex v = {};
+        v.position         = f32x4(rnd() * f32(3.0) - f32(1.0), rnd() * f32(3.0), rnd() - f32(0.5), f32(1.0));
+        data.storage_vertices.push_back(v);
+    }
+    SceneCacheMesh empty = {};
+    empty.base_vertex    = u32(data.storage_vertices.size());
+    data.storage_meshes.push_back(empty);
+    u32 num_instances = u32(1000);
+    ifor(num_instances) {
+        SceneCacheInstance instance = {};
+        instance.mesh_id            = i == u32(7) ? u32(1) : i == u32(11) ? u32(5) : u32(0);
+        f32x3   axis                = normalize(f32x3(rnd(), rnd(), rnd()) * f32(2.0) - f32(1.0) + f32x3(f32(1.0e-3)));
+        f32x3   scale               = f32x3(rnd(), rnd(), rnd()) * f32(2.0) + f32(0.1);
+        f32x4x4 transform           = glm::translate(f32x4x4(f32(1.0)), (f32x3(rnd(), rnd(), rnd()) - f32(0.5)) * f32(100.0));
+        transform                   = glm::rotate(transform, rnd() * f32(6.283185), axis);
+        transform                   = glm::scale(transform, i % u32(5) == u32(0) ? -scale : scale);
+        data.storage_instances.push_back(instance);
+        data.storage_transforms.push_back(transform);
+    }
+    data.PointToStorage();
+
+    std::vector<AABB> mesh_bounds = {};
+    ComputeMeshBounds(data, mesh_bounds);
+    assert(!IsAABBEmpty(mesh_bounds[0]) && IsAABBEmpty(mesh_bounds[1]));
+    std::vector<AABB> instance_bounds = {}, serial_bounds = {};
+    AABB              scene_bounds = {}, serial_scene = {};
+    ComputeInstanceBounds(data, mesh_bounds, instance_bounds, scene_bounds, u32(4));
+    ComputeInstanceBounds(data, mesh_bounds, serial_bounds, serial_scene, u32(1));
+    assert(IsAABBEmpty(instance_bounds[7]) && IsAABBEmpty(instance_bounds[11]));
+
+    u32  num_two_corner_misses = u32(0);
+    AABB expected_scene        = GetEmptyAABB();
+    ifor(num_instances) {
+        AABB const &b = instance_bounds[i];
+        xfor(3) assert(b.lo[x] == serial_bounds[i].lo[x] && b.hi[x] == serial_bounds[i].hi[x]);
+        if (data.instances[i].mesh_id != u32(0)) continue;
+        f32x4x4 const &m   = data.transforms[i];
+        f32           eps  = f32(1.0e-3);
+        // Every transformed vertex is inside
+        bool two_corner_miss = false;
+        f32x3 two_lo = f32x3(m * f32x4(mesh_bounds[0].lo, f32(1.0))), two_hi = f32x3(m * f32x4(mesh_bounds[0].hi, f32(1.0)));
+        jfor(data.num_vertices) {
+            f32x3 p = f32x3(m * data.vertices[j].position);
+            xfor(3) {
+                assert(p[x] >= b.lo[x] - eps && p[x] <= b.hi[x] + eps);
+                if (p[x] < std::min(two_lo[x], two_hi[x]) || p[x] > std::max(two_lo[x], two_hi[x])) two_corner_miss = true;
+            }
+        }
+        // and the box is exactly that of the 8 transformed corners
+        AABB corners = GetEmptyAABB();
+        jfor(8) {
+            f32x3 c = f32x3(j & u32(1) ? mesh_bounds[0].hi.x : mesh_bounds[0].lo.x, j & u32(2) ? mesh_bounds[0].hi.y : mesh_bounds[0].lo.y,
+                            j & u32(4) ? mesh_bounds[0].hi.z : mesh_bounds[0].lo.z);
+            corners.expand(f32x3(m * f32x4(c, f32(1.0))));
+        }
+        xfor(3) assert(std::abs(corners.lo[x] - b.lo[x]) < eps && std::abs(corners.hi[x] - b.hi[x]) < eps);
+        if (two_corner_miss) num_two_corner_misses++;
+        expected_scene.expand(b);
+    }
+    // The two transformed corners alone miss vertices under rotation
+    assert(num_two_corner_misses > num_instances / u32(2));
+    xfor(3) assert(scene_bounds.lo[x] == expected_scene.lo[x] && scene_bounds.hi[x] == expected_scene.hi[x]);
+    xfor(3) assert(serial_scene.lo[x] == expected_scene.lo[x] && serial_scene.hi[x] == expected_scene.hi[x]);
+
+    // 4 wide like the embree build, leaf primitive indices are reversed through the id table
+    std::vector<u32>              ids    = {};
+    std::vector<cpubvh::LeafNode> leaves = {};
+    leaves.reserve(num_instances);
+    ifor(num_instances) {
+        if (IsAABBEmpty(instance_bounds[i])) continue;
+        leaves.emplace_back(u32(ids.size()), instance_bounds[i]);
+        ids.push_back(i);
+    }
+    std::reverse(ids.begin(), ids.end());
+    for (auto &leaf : leaves) leaf.primitive_idx = u32(ids.size()) - u32(1) - leaf.primitive_idx;
+    std::vector<cpubvh::InnerNode> inner    = {};
+    std::vector<cpubvh::Node *>    children = {};
+    std::vector<cpubvh::Node *>    level    = {};
+    inner.reserve(leaves.size());
+    children.reserve(leaves.size() * size_t(2));
+    for (auto &leaf : leaves) level.push_back(&leaf);
+    while (level.size() > size_t(1)) {
+        std::vector<cpubvh::Node *> next_level = {};
+        for (size_t i = size_t(0); i < level.size(); i += size_t(4)) {
+            u32    count = u32(std::min(size_t(4), level.size() - i));
+            size_t first = children.size();
+            AABB   aabb  = GetEmptyAABB();
+            jfor(count) {
+                children.push_back(level[i + j]);
+                aabb.expand(level[i + j]->aabb);
+            }
+            inner.emplace_back(&children[first], count);
+            inner.back().aabb = aabb;
+            next_level.push_back(&inner.back());
+        }
+        level = next_level;
+    }
+    cpubvh::Node *root = level[0];
+
+    f32x3          eye      = f32x3(f32(0.0), f32(10.0), f32(-80.0));
+    f32x4x4        proj     = glm::perspectiveZO(f32(1.0), f32(16.0 / 9.0), f32(0.1), f32(60.0));
+    f32x4x4        view     = glm::lookAt(eye, f32x3(f32(10.0), f32(0.0), f32(0.0)), f32x3(f32(0.0), f32(1.0), f32(0.0)));
+    MeshletFrustum frustum  = MeshletFrustum::Create(proj * view, eye);
+    std::vector<u8> visible = std::vector<u8>(num_instances, u8(0));
+    CullInstanceNodes(root, frustum, ids.data(), visible);
+    u32 num_visible = u32(0);
+    ifor(num_instances) {
+        bool expected = !IsAABBEmpty(instance_bounds[i]) && !IsAABBOutsideFrustum(instance_bounds[i], frustum);
+        assert(bool(visible[i]) == expected);
+        num_visible += u32(visible[i]);
+    }
+    assert(num_visible > u32(0) && num_visible < num_instances / u32(2));
+    (void)num_visible;
+
+    ifor(64) {
+        Ray ray = {};
+        ray.o   = eye;
+        ray.d   = normalize(f32x3(rnd(), rnd(), rnd()) * f32(2.0) - f32(1.0) + f32x3(f32(0.0), f32(-0.2), f32(1.0)));
+        ray.ird = f32(1.0) / ray.d;
+        f32 t = f32(1.0e30);
+        u32 picked = PickInstanceNodes(root, ray, ids.data(), t, {});
+        f32 best = f32(1.0e30);
+        u32 expected = u32(-1);
+        jfor(num_instances) {
+            if (IsAABBEmpty(instance_bounds[j])) continue;
+            f32 d = GetRayAABBDistance(ray, instance_bounds[j]);
+            if (d >= f32(0.0) && d < best) {
+                best     = d;
+                expected = j;
+            }
+        }
+        assert(picked == expected && (picked == u32(-1) || t == best));
+        // A refining callback that rejects everything but odd instances
+        t             = f32(1.0e30);
+        picked        = PickInstanceNodes(root, ray, ids.data(), t, [](u32 _instance_id, f32 _t) { return _instance_id & u32(1) ? _t : f32(-1.0); });
+        assert(picked == u32(-1) || (picked & u32(1)));
+        (void)picked;
+    }
+}
+
+} // namespace GfxJit
+
+#endif // INSTANCE_BVH_HPP
@@ -0,0 +1,546 @@
+// MIT License
+//
+// Copyright (c) 2023 Anton Schreiner
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined(KERNEL_CACHE_HPP)
+#    define KERNEL_CACHE_HPP
+
+#    include "common.h"
+
+#    include <algorithm>
+#    include <atomic>
+#    include <cassert>
+#    include <filesystem>
+#    include <functional>
+#    include <mutex>
+#    include <string>
+#    include <thread>
+#    include <vector>
+
+namespace GfxJit {
+
+struct KernelCacheResource {
+    std::string name       = {};
+    std::string type       = {};
+    u32         array_size = u32(0);
+
+    bool operator==(KernelCacheResource const &that) const { return name == that.name && type == that.type && array_size == that.array_size; }
+};
+
+// Everything needed to recreate a kernel without invoking the compiler
+struct KernelCacheEntry {
+    std::vector<u8>                  bytecode     = {};
+    std::vector<u8>                  reflection   = {};
+    std::vector<KernelCacheResource> resources    = {};
+    i32                              reg_pressure = i32(0);
+
+    bool operator==(KernelCacheEntry const &that) const {
+        return bytecode == that.bytecode && reflection == that.reflection && resources == that.resources && reg_pressure == that.reg_pressure;
+    }
+};
+
+// The hash names the file, the flags and text it was computed from are stored in the entry and compared on load
+struct KernelCacheKey {
+    u64         hash   = u64(0);
+    std::string source = {}; // Flags, a '\0' and the text
+};
+
+struct KernelCacheStats {
+    u64 num_hits       = u64(0);
+    u64 num_misses     = u64(0);
+    u64 num_stores     = u64(0);
+    u64 num_evictions  = u64(0);
+    u64 num_invalid    = u64(0);
+    u64 num_collisions = u64(0);
+};
+
+// Persistent kernel cache, one file per key in a flat directory.
+// Files are written to a temporary and renamed into place so readers only ever see complete entries.
+// Every entry carries a checksum of its payload, anything that doesn't validate is treated as a miss and removed.
+// Entries also keep the source they were compiled from, a different source under the same hash is a miss.
+// Access time is tracked through the file's write time and the directory is trimmed to max_size_bytes in LRU order,
+// once when the cache is opened and then every trim_interval stores.
+class KernelCache {
+private:
+    static constexpr u32 MAGIC   = u32(0x434b4a53); // 'SJKC'
+    static constexpr u32 VERSION = u32(2);
+
+    struct Header {
+        u32 magic        = MAGIC;
+        u32 version      = VERSION;
+        u64 key          = u64(0);
+        u64 payload_size = u64(0);
+        u64 payload_hash = u64(0);
+    };
+
+    std::filesystem::path dir            = {};
+    u64                   max_size_bytes = u64(0);
+    u32                   trim_interval  = u32(0);
+    std::mutex            evict_mutex    = {};
+    std::atomic<u64>      num_hits       = {};
+    std::atomic<u64>      num_misses     = {};
+    std::atomic<u64>      num_stores     = {};
+    std::atomic<u64>      num_evictions  = {};
+    std::atomic<u64>      num_invalid    = {};
+    std::atomic<u64>      num_collisions = {};
+    std::atomic<u32>      tmp_counter    = {};
+
+    static void WriteU32(std::vector<u8> &_dst, u32 _v) {
+        u8 const *p = (u8 const *)&_v;
+        _dst.insert(_dst.end(), p, p + sizeof(_v));
+    }
+    static void WriteBytes(std::vector<u8> &_dst, void const *_src, u64 _size) {
+        WriteU32(_dst, u32(_size));
+        _dst.insert(_dst.end(), (u8 const *)_src, (u8 const *)_src + _size);
+    }
+    static bool ReadU32(u8 const *&_cursor, u8 const *_end, u32 &_v) {
+        if (u64(_end - _cursor) < sizeof(_v)) return false;
+        memcpy(&_v, _cursor, sizeof(_v));
+        _cursor += sizeof(_v);
+        return true;
+    }
+    static bool ReadBytes(u8 const *&_cursor, u8 const *_end, std::vector<u8> &_dst) {
+        u32 size = u32(0);
+        if (!ReadU32(_cursor, _end, size) || u64(_end - _cursor) < u64(size)) return false;
+        _dst.assign(_cursor, _cursor + size);
+        _cursor += size;
+        return true;
+    }
+    static bool ReadString(u8 const *&_cursor, u8 const *_end, std::string &_dst) {
+        u32 size = u32(0);
+        if (!ReadU32(_cursor, _end, size) || u64(_end - _cursor) < u64(size)) return false;
+        _dst.assign((char const *)_cursor, size);
+        _cursor += size;
+        return true;
+    }
+    static std::vector<u8> Serialize(std::string const &_source, KernelCacheEntry const &_entry) {
+        std::vector<u8> payload = {};
+        WriteBytes(payload, _source.c_str(), _source.size());
+        WriteBytes(payload, _entry.bytecode.data(), _entry.bytecode.size());
+        WriteBytes(payload, _entry.reflection.data(), _entry.reflection.size());
+        WriteU32(payload, u32(_entry.resources.size()));
+        for (auto &r : _entry.resources) {
+            WriteBytes(payload, r.name.c_str(), r.name.size());
+            WriteBytes(payload, r.type.c_str(), r.type.size());
+            WriteU32(payload, r.array_size);
+        }
+        WriteU32(payload, u32(_entry.reg_pressure));
+        return payload;
+    }
+    static bool Deserialize(u8 const *_cursor, u8 const *_end, std::string &_source, KernelCacheEntry &_entry) {
+        u32 num_resources = u32(0);
+        if (!ReadString(_cursor, _end, _source) || !ReadBytes(_cursor, _end, _entry.bytecode) || !ReadBytes(_cursor, _end, _entry.reflection) || !ReadU32(_cursor, _end, num_resources)) return false;
+        _entry.resources.clear();
+        ifor(num_resources) {
+            KernelCacheResource r = {};
+            if (!ReadString(_cursor, _end, r.name) || !ReadString(_cursor, _end, r.type) || !ReadU32(_cursor, _end, r.array_size)) return false;
+            _entry.resources.push_back(r);
+        }
+        u32 reg_pressure = u32(0);
+        if (!ReadU32(_cursor, _end, reg_pressure)) return false;
+        _entry.reg_pressure = i32(reg_pressure);
+        return _cursor == _end && _entry.bytecode.size() != u64(0);
+    }
+    std::filesystem::path GetPath(u64 _key) const {
+        char buf[0x20];
+        snprintf(buf, sizeof(buf), "%016llx.kc", (unsigned long long)_key);
+        return dir / buf;
+    }
+    bool ReadFile(std::filesystem::path const &_path, std::vector<u8> &_dst) {
+        FILE *file = fopen(_path.string().c_str(), "rb");
+        if (file == NULL) return false;
+        defer(fclose(file));
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        if (size <= 0) return false;
+        _dst.resize(size_t(size));
+        return fread(_dst.data(), 1, _dst.size(), file) == _dst.size();
+    }
+    bool Validate(std::vector<u8> const &_data, u64 _key, std::string &_source, KernelCacheEntry &_entry) {
+        Header header = {};
+        if (_data.size() < sizeof(Header)) return false;
+        memcpy(&header, _data.data(), sizeof(Header));
+        if (header.magic != MAGIC || header.version != VERSION || header.key != _key) return false;
+        if (header.payload_size != u64(_data.size() - sizeof(Header))) return false;
+        u8 const *payload = _data.data() + sizeof(Header);
+        if (Hash(payload, header.payload_size) != header.payload_hash) return false;
+        return Deserialize(payload, payload + header.payload_size, _source, _entry);
+    }
+    static u64 HashSource(std::string const &_source) {
+        u64 h = Hash(_source.c_str(), _source.size());
+        return Hash(&VERSION, sizeof(VERSION), h);
+    }
+    void Discard(std::filesystem::path const &_path) {
+        std::error_code ec = {};
+        std::filesystem::remove(_path, ec);
+        num_invalid++;
+    }
+
+public:
+    KernelCache(std::filesystem::path const &_dir, u64 _max_size_bytes = u64(256) << u64(20), u32 _trim_interval = u32(64))
+        : dir(_dir), max_size_bytes(_max_size_bytes), trim_interval(std::max(_trim_interval, u32(1))) {
+        std::error_code ec = {};
+        std::filesystem::create_directories(dir, ec);
+        Trim();
+    }
+    KernelCache(KernelCache const &)            = delete;
+    KernelCache &operator=(KernelCache const &) = delete;
+
+    static u64 Hash(void const *_data, u64 _size, u64 _seed = u64(0xcbf29ce484222325)) {
+        u64       h = _seed;
+        u8 const *p = (u8 const *)_data;
+        ifor(_size) h = (h ^ u64(p[i])) * u64(0x100000001b3);
+        return h;
+    }
+    // The key covers the source and everything else that affects the bytecode
+    static KernelCacheKey ComputeKey(char const *_text, u64 _text_size, char const *_flags) {
+        KernelCacheKey key = {};
+        key.source.reserve(strlen(_flags) + u64(1) + _text_size);
+        key.source.append(_flags);
+        key.source.push_back('\0');
+        key.source.append(_text, _text_size);
+        key.hash = HashSource(key.source);
+        return key;
+    }
+
+    bool Load(KernelCacheKey const &_key, KernelCacheEntry &_entry) {
+        std::filesystem::path path   = GetPath(_key.hash);
+        std::vector<u8>       data   = {};
+        std::string           source = {};
+        if (!ReadFile(path, data)) {
+            num_misses++;
+            return false;
+        }
+        if (!Validate(data, _key.hash, source, _entry)) {
+            Discard(path);
+            num_misses++;
+            return false;
+        }
+        if (source != _key.source) { // Hash collision, the entry is fine but belongs to another kernel
+            num_collisions++;
+            num_misses++;
+            return false;
+        }
+        std::error_code ec = {};
+        std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec); // LRU touch
+        num_hits++;
+        return true;
+    }
+    bool Store(KernelCacheKey const &_key, KernelCacheEntry const &_entry) {
+        std::vector<u8> payload = Serialize(_key.source, _entry);
+        Header          header  = {};
+        header.key              = _key.hash;
+        header.payload_size     = u64(payload.size());
+        header.payload_hash     = Hash(payload.data(), payload.size());
+
+        char tmp_name[0x40];
+        snprintf(tmp_name, sizeof(tmp_name), "%016llx.%llx.%u.tmp", (unsigned long long)_key.hash, (unsigned long long)std::hash<std::thread::id>()(std::this_thread::get_id()),
+                 tmp_counter.fetch_add(u32(1)));
+        std::filesystem::path tmp_path = dir / tmp_name;
+        {
+            FILE *file = fopen(tmp_path.string().c_str(), "wb");
+            if (file == NULL) return false;
+            bool ok = fwrite(&header, sizeof(header), 1, file) == size_t(1);
+            ok      = ok && fwrite(payload.data(), 1, payload.size(), file) == payload.size();
+            ok      = (fclose(file) == 0) && ok;
+            if (!ok) {
+                std::error_code ec = {};
+                std::filesystem::remove(tmp_path, ec);
+                return false;
+            }
+        }
+        std::error_code ec = {};
+        std::filesystem::rename(tmp_path, GetPath(_key.hash), ec);
+        if (ec) {
+            std::filesystem::remove(tmp_path, ec);
+            return false;
+        }
+        // Trim walks the whole directory, doing that on every store made each compile O(entries)
+        if ((num_stores.fetch_add(u64(1)) + u64(1)) % u64(trim_interval) == u64(0)) Trim();
+        return true;
+    }
+    // Compiles and stores on a miss, returns true on a hit
+    bool GetOrCompile(KernelCacheKey const &_key, std::function<KernelCacheEntry()> _compile, KernelCacheEntry &_entry) {
+        if (Load(_key, _entry)) return true;
+        _entry = _compile();
+        Store(_key, _entry);
+        return false;
+    }
+    // Drops the least recently used entries until the directory fits into max_size_bytes
+    void Trim() {
+        std::lock_guard<std::mutex> lock(evict_mutex);
+        struct Item {
+            std::filesystem::file_time_type time = {};
+            u64                             size = u64(0);
+            std::filesystem::path           path = {};
+        };
+        std::vector<Item> items      = {};
+        u64               total_size = u64(0);
+        std::error_code   ec         = {};
+        for (auto &e : std::filesystem::directory_iterator(dir, ec)) {
+            if (e.path().extension() != ".kc") continue;
+            Item item = {};
+            item.time = e.last_write_time(ec);
+            if (ec) continue;
+            item.size = u64(e.file_size(ec));
+            if (ec) continue;
+            item.path = e.path();
+            total_size += item.size;
+            items.push_back(item);
+        }
+        if (total_size <= max_size_bytes) return;
+        std::sort(items.begin(), items.end(), [](Item const &a, Item const &b) { return a.time < b.time; });
+        for (auto &item : items) {
+            if (total_size <= max_size_bytes) break;
+            if (std::filesystem::remove(item.path, ec)) num_evictions++;
+            total_size -= item.size;
+        }
+    }
+    // Checks every entry on disk and removes the ones that fail validation or whose source doesn't hash to their name, returns the number of removed entries
+    u32 ValidateAll() {
+        std::vector<std::filesystem::path> paths = {};
+        std::error_code                    ec    = {};
+        for (auto &e : std::filesystem::directory_iterator(dir, ec)) {
+            if (e.path().extension() == ".kc") paths.push_back(e.path());
+        }
+        u32 num_removed = u32(0);
+        for (auto &path : paths) {
+            u64 key = u64(0);
+            if (sscanf(path.stem().string().c_str(), "%llx", (unsigned long long *)&key) != 1) continue;
+            std::vector<u8>  data   = {};
+            std::string      source = {};
+            KernelCacheEntry entry  = {};
+            if (ReadFile(path, data) && Validate(data, key, source, entry) && HashSource(source) == key) continue;
+            Discard(path);
+            num_removed++;
+        }
+        return num_removed;
+    }
+    u64 GetTotalSize() {
+        u64             total_size = u64(0);
+        std::error_code ec         = {};
+        for (auto &e : std::filesystem::directory_iterator(dir, ec)) {
+            if (e.path().extension() == ".kc") total_size += u64(e.file_size(ec));
+        }
+        return total_size;
+    }
+    KernelCacheStats GetStats() const {
+        KernelCacheStats s = {};
+        s.num_hits         = num_hits.load();
+        s.num_misses       = num_misses.load();
+        s.num_stores       = num_stores.load();
+        s.num_evictions    = num_evictions.load();
+        s.num_invalid      = num_invalid.load();
+        s.num_collisions   = num_collisions.load();
+        return s;
+    }
+
+    // Exercises the cache with a stub compiler, no device involved
+    static void Test(std::filesystem::path const &_dir) {
+        std::error_code ec = {};
+        std::filesystem::remove_all(_dir, ec);
+        defer(std::filesystem::remove_all(_dir, ec));
+
+        std::atomic<u32> num_compiles = {};
+        auto             stub_compile = [&](std::string const &_text) {
+            num_compiles++;
+            KernelCacheEntry e = {};
+            e.bytecode.assign(_text.rbegin(), _text.rend());
+            e.reflection.assign(_text.begin(), _text.end());
+            e.resources.push_back({"g_output", "RWTexture2D", u32(0)});
+            e.resources.push_back({_text, "StructuredBuffer", u32(_text.size())});
+            e.reg_pressure = i32(_text.size());
+            return e;
+        };
+        auto make_text = [](u32 _i) {
+            std::string text = "[numthreads(8, 8, 1)] void main() { /* kernel ";
+            text += std::to_string(_i);
+            text += " */ }";
+            return text;
+        };
+
+        // Miss, hit and a hit from a fresh instance, as after a restart
+        {
+            std::string    text = make_text(u32(0));
+            KernelCacheKey key  = ComputeKey(text.c_str(), text.size(), "cs_6_5");
+            {
+                KernelCache      cache(_dir);
+                KernelCacheEntry entry = {};
+                bool             miss  = !cache.GetOrCompile(key, [&] { return stub_compile(text); }, entry);
+                bool             hit   = cache.GetOrCompile(key, [&] { return stub_compile(text); }, entry);
+                assert(miss && hit && entry == stub_compile(text));
+                (void)miss;
+                (void)hit;
+            }
+            {
+                KernelCache      cache(_dir);
+                KernelCacheEntry entry = {};
+                bool             hit   = cache.Load(key, entry);
+                assert(hit && entry == stub_compile(text));
+                assert(cache.GetStats().num_hits == u64(1));
+                (void)hit;
+            }
+            // Flags are part of the key
+            assert(ComputeKey(text.c_str(), text.size(), "cs_6_5").hash != ComputeKey(text.c_str(), text.size(), "cs_6_0").hash);
+            // A different source that lands on the same hash misses and leaves the entry alone
+            {
+                KernelCache      cache(_dir);
+                KernelCacheKey   other = key;
+                KernelCacheEntry entry = {};
+                other.source += " ";
+                bool collided = !cache.Load(other, entry);
+                assert(collided && cache.GetStats().num_collisions == u64(1));
+                bool hit = cache.Load(key, entry);
+                assert(hit && entry == stub_compile(text));
+                (void)collided;
+                (void)hit;
+            }
+        }
+        // Corrupted and truncated entries are rejected and removed
+        {
+            KernelCache cache(_dir);
+            ifor(4) {
+                std::string text = make_text(u32(100) + i);
+                cache.Store(ComputeKey(text.c_str(), text.size(), "cs_6_5"), stub_compile(text));
+            }
+            std::string           text = make_text(u32(100));
+            KernelCacheKey        key  = ComputeKey(text.c_str(), text.size(), "cs_6_5");
+            std::vector<u8>       data = {};
+            std::filesystem::path path = cache.GetPath(key.hash);
+            bool                  read = cache.ReadFile(path, data);
+            assert(read && data.size() > u64(5));
+            (void)read;
+            data[data.size() - u64(5)] ^= u8(0xff);
+            {
+                FILE *file = fopen(path.string().c_str(), "wb");
+                fwrite(data.data(), 1, data.size(), file);
+                fclose(file);
+            }
+            KernelCacheEntry entry    = {};
+            bool             rejected = !cache.Load(key, entry);
+            assert(rejected && !std::filesystem::exists(path));
+            (void)rejected;
+
+            text = make_text(u32(101));
+            path = cache.GetPath(ComputeKey(text.c_str(), text.size(), "cs_6_5").hash);
+            std::filesystem::resize_file(path, u64(std::filesystem::file_size(path) / u64(2)));
+            {
+                FILE *file = fopen((_dir / "0123456789abcdef.kc").string().c_str(), "wb");
+                fputs("garbage", file);
+                fclose(file);
+            }
+            u32 num_removed = cache.ValidateAll();
+            assert(num_removed == u32(2));
+            (void)num_removed;
+        }
+        std::filesystem::remove_all(_dir, ec);
+        // LRU: entries that were touched recently survive the trim
+        {
+            u64         entry_size = u64(0);
+            KernelCache probe(_dir);
+            {
+                std::string text = make_text(u32(200));
+                probe.Store(ComputeKey(text.c_str(), text.size(), "cs_6_5"), stub_compile(text));
+                entry_size = probe.GetTotalSize();
+            }
+            KernelCache cache(_dir, entry_size * u64(4));
+            auto        key_of = [&](u32 _i) {
+                std::string text = make_text(u32(200) + _i);
+                return ComputeKey(text.c_str(), text.size(), "cs_6_5");
+            };
+            auto backdate = [&](u32 _i, u32 _seconds_ago) {
+                std::filesystem::last_write_time(cache.GetPath(key_of(_i).hash), std::filesystem::file_time_type::clock::now() - std::chrono::seconds(_seconds_ago), ec);
+            };
+            ifor(4) {
+                std::string text = make_text(u32(200) + i);
+                cache.Store(key_of(i), stub_compile(text));
+            }
+            ifor(4) backdate(i, u32(100) - i);
+            KernelCacheEntry entry = {};
+            bool             hit   = cache.Load(key_of(u32(0)), entry); // 0 becomes the most recent
+            assert(hit);
+            (void)hit;
+            {
+                std::string text = make_text(u32(204));
+                cache.Store(key_of(u32(4)), stub_compile(text));
+            }
+            // Stores don't walk the directory until the trim interval is up
+            assert(cache.GetTotalSize() > entry_size * u64(4));
+            cache.Trim();
+            assert(cache.GetTotalSize() <= entry_size * u64(4));
+            assert(std::filesystem::exists(cache.GetPath(key_of(u32(0)).hash)));
+            assert(!std::filesystem::exists(cache.GetPath(key_of(u32(1)).hash)));
+            assert(cache.GetStats().num_evictions == u64(1));
+            // Opening trims to the new limit, every trim_interval stores trims as well
+            {
+                KernelCache small(_dir, entry_size * u64(2));
+                assert(small.GetTotalSize() <= entry_size * u64(2));
+                assert(small.GetStats().num_evictions == u64(2));
+            }
+            {
+                KernelCache every_other(_dir, entry_size * u64(2), u32(2));
+                ifor(3) {
+                    std::string text = make_text(u32(210) + i);
+                    every_other.Store(ComputeKey(text.c_str(), text.size(), "cs_6_5"), stub_compile(text));
+                }
+                assert(every_other.GetStats().num_evictions == u64(2)); // Trimmed on the second store only
+                assert(every_other.GetTotalSize() == entry_size * u64(3));
+            }
+        }
+        std::filesystem::remove_all(_dir, ec);
+        // Concurrent readers and writers with eviction running under them, every result has to match the compiler
+        {
+            u32         num_keys = u32(32);
+            KernelCache cache(_dir, u64(8) << u64(10), u32(4));
+            num_compiles             = u32(0);
+            std::atomic<u32> num_bad = {};
+            auto             worker  = [&](u32 _seed) {
+                u32 state = _seed * u32(0x9e3779b9) + u32(1);
+                ifor(256) {
+                    state ^= state << u32(13);
+                    state ^= state >> u32(17);
+                    state ^= state << u32(5);
+                    std::string      text  = make_text(state % num_keys);
+                    KernelCacheEntry entry = {};
+                    cache.GetOrCompile(ComputeKey(text.c_str(), text.size(), "cs_6_5"), [&] { return stub_compile(text); }, entry);
+                    if (!(entry == stub_compile(text))) num_bad++;
+                }
+            };
+            std::vector<std::thread> threads = {};
+            ifor(8) threads.push_back(std::thread(worker, i));
+            for (auto &t : threads) t.join();
+            assert(num_bad.load() == u32(0));
+            cache.Trim();
+            assert(cache.GetTotalSize() <= u64(8) << u64(10));
+            u32 num_removed = cache.ValidateAll();
+            assert(num_removed == u32(0));
+            (void)num_removed;
+            KernelCacheStats stats = cache.GetStats();
+            fprintf(stdout, "[KERNEL CACHE TEST] hits %i misses %i stores %i evictions %i invalid %i collisions %i\n", i32(stats.num_hits), i32(stats.num_misses),
+                    i32(stats.num_stores), i32(stats.num_evictions), i32(stats.num_invalid), i32(stats.num_collisions));
+        }
+    }
+};
+
+} // namespace GfxJit
+
+#endif // KERNEL_CACHE_HPP
@@ -0,0 +1,487 @@
+// MIT License
+//
+// Copyright (c) 2023 Anton Schreiner
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined(MESHLET_BUILDER_HPP)
+#    define MESHLET_BUILDER_HPP
+
+#    include "common.h"
+#    include "scene_cache.hpp"
+#    include <glm/gtc/matrix_transform.hpp>
+
+#    include <algorithm>
+#    include <array>
+#    include <atomic>
+#    include <cassert>
+#    include <thread>
+#    include <vector>
+
+namespace GfxJit {
+
+static constexpr u32 MESHLET_MAX_VERTICES  = u32(64);
+static constexpr u32 MESHLET_MAX_TRIANGLES = u32(124);
+
+struct Meshlet {
+    u32 vertex_offset   = u32(0); // Into MeshletData::vertices
+    u32 triangle_offset = u32(0); // Into MeshletData::triangles
+    u32 vertex_count    = u32(0);
+    u32 triangle_count  = u32(0);
+};
+// Object space
+struct MeshletBounds {
+    f32x4 sphere = {}; // Center, radius
+    f32x4 cone   = {}; // Axis, cos of the half angle. Negative when the normals spread over more than a hemisphere, those never get backface culled.
+};
+struct MeshletMeshRange {
+    u32 first_meshlet = u32(0);
+    u32 num_meshlets  = u32(0);
+};
+
+struct MeshletData {
+    std::vector<Meshlet>          meshlets  = {};
+    std::vector<MeshletBounds>    bounds    = {}; // Per meshlet
+    std::vector<u32>              vertices  = {}; // Mesh relative, base_vertex still has to be added
+    std::vector<u32>              triangles = {}; // Three meshlet local u8 indices per triangle
+    std::vector<MeshletMeshRange> meshes    = {}; // Indexed by mesh id
+
+    u32 GetNumTriangles() const {
+        u32 num_triangles = u32(0);
+        for (auto &m : meshlets) num_triangles += m.triangle_count;
+        return num_triangles;
+    }
+};
+
+// CCW triangles face their right handed normal, same as glTF
+static f32x3 GetMeshletTriangleNormal(f32x3 _p0, f32x3 _p1, f32x3 _p2) { return cross(_p1 - _p0, _p2 - _p0); }
+
+static MeshletBounds ComputeMeshletBounds(Meshlet const &_meshlet, u32 const *_meshlet_vertices, u32 const *_meshlet_triangles, SceneCacheVertex const *_vertices) {
+    MeshletBounds bounds = {};
+    f32x3         lo     = f32x3(f32(1.0e30));
+    f32x3         hi     = f32x3(f32(-1.0e30));
+    ifor(_meshlet.vertex_count) {
+        f32x3 p = f32x3(_vertices[_meshlet_vertices[_meshlet.vertex_offset + i]].position);
+        lo      = glm::min(lo, p);
+        hi      = glm::max(hi, p);
+    }
+    f32x3 center = (lo + hi) * f32(0.5);
+    f32   radius = f32(0.0);
+    ifor(_meshlet.vertex_count) radius = std::max(radius, length(f32x3(_vertices[_meshlet_vertices[_meshlet.vertex_offset + i]].position) - center));
+    bounds.sphere = f32x4(center, radius);
+
+    f32x3 normals[MESHLET_MAX_TRIANGLES] = {};
+    u32   num_normals                    = u32(0);
+    f32x3 axis                           = f32x3(f32(0.0));
+    ifor(_meshlet.triangle_count) {
+        u32   t  = _meshlet_triangles[_meshlet.triangle_offset + i];
+        f32x3 p0 = f32x3(_vertices[_meshlet_vertices[_meshlet.vertex_offset + (t & u32(0xff))]].position);
+        f32x3 p1 = f32x3(_vertices[_meshlet_vertices[_meshlet.vertex_offset + ((t >> u32(8)) & u32(0xff))]].position);
+        f32x3 p2 = f32x3(_vertices[_meshlet_vertices[_meshlet.vertex_offset + ((t >> u32(16)) & u32(0xff))]].position);
+        f32x3 n  = GetMeshletTriangleNormal(p0, p1, p2);
+        f32   l  = length(n);
+        if (!(l > f32(1.0e-20))) continue; // Degenerate, never rasterized
+        normals[num_normals++] = n / l;
+        axis += n / l;
+    }
+    bounds.cone = f32x4(f32(0.0), f32(0.0), f32(1.0), f32(-1.0));
+    if (num_normals == u32(0) || length(axis) < f32(1.0e-6)) return bounds;
+    axis        = normalize(axis);
+    f32 min_cos = f32(1.0);
+    ifor(num_normals) min_cos = std::min(min_cos, dot(normals[i], axis));
+    // A little slack so the rounding of the normals can't make the cone too tight
+    bounds.cone = f32x4(axis, min_cos - f32(1.0e-4));
+    return bounds;
+}
+
+// Greedy clustering: keep adding the triangle that brings the fewest new vertices among those sharing a vertex with the meshlet,
+// start over at the first triangle left in index order when nothing is connected.
+static void BuildMeshletsForMesh(u32 const *_indices, u32 _num_indices, SceneCacheVertex const *_vertices, u32 _num_vertices, MeshletData &_out) {
+    u32 num_triangles = _num_indices / u32(3);
+    if (num_triangles == u32(0)) return;
+
+    std::vector<u32> adjacency_offsets = std::vector<u32>(_num_vertices + u32(1), u32(0));
+    std::vector<u32> adjacency         = std::vector<u32>(num_triangles * u32(3));
+    ifor(num_triangles * u32(3)) {
+        assert(_indices[i] < _num_vertices);
+        adjacency_offsets[_indices[i] + u32(1)]++;
+    }
+    ifor(_num_vertices) adjacency_offsets[i + u32(1)] += adjacency_offsets[i];
+    {
+        std::vector<u32> cursor = std::vector<u32>(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+        ifor(num_triangles * u32(3)) adjacency[cursor[_indices[i]]++] = i / u32(3);
+    }
+
+    static constexpr u8 NOT_IN_MESHLET = u8(0xff);
+
+    std::vector<u8>  emitted      = std::vector<u8>(num_triangles, u8(0));
+    std::vector<u8>  is_candidate = std::vector<u8>(num_triangles, u8(0));
+    std::vector<u32> candidates   = {}; // Triangles sharing a vertex with the meshlet
+    std::vector<u8>  local        = std::vector<u8>(_num_vertices, NOT_IN_MESHLET);
+    Meshlet          current      = {};
+    current.vertex_offset   = u32(_out.vertices.size());
+    current.triangle_offset = u32(_out.triangles.size());
+
+    auto count_new = [&](u32 _t) {
+        u32 const *tri = _indices + _t * u32(3);
+        return u32(local[tri[0]] == NOT_IN_MESHLET) + u32(local[tri[1]] == NOT_IN_MESHLET && tri[1] != tri[0]) +
+               u32(local[tri[2]] == NOT_IN_MESHLET && tri[2] != tri[0] && tri[2] != tri[1]);
+    };
+    auto flush = [&]() {
+        if (current.triangle_count == u32(0)) return;
+        ifor(current.vertex_count) local[_out.vertices[current.vertex_offset + i]] = NOT_IN_MESHLET;
+        for (u32 t : candidates) is_candidate[t] = u8(0);
+        candidates.clear();
+        _out.bounds.push_back(ComputeMeshletBounds(current, _out.vertices.data(), _out.triangles.data(), _vertices));
+        _out.meshlets.push_back(current);
+        current                 = {};
+        current.vertex_offset   = u32(_out.vertices.size());
+        current.triangle_offset = u32(_out.triangles.size());
+    };
+
+    u32 next_in_order = u32(0);
+    while (true) {
+        u32 best     = u32(-1);
+        u32 best_new = u32(4);
+        for (u32 i = u32(0); i < u32(candidates.size());) {
+            u32 t = candidates[i];
+            if (emitted[t]) {
+                is_candidate[t] = u8(0);
+                candidates[i]   = candidates.back();
+                candidates.pop_back();
+                continue;
+            }
+            u32 num_new = count_new(t);
+            if (num_new < best_new || (num_new == best_new && t < best)) {
+                best     = t;
+                best_new = num_new;
+            }
+            i++;
+        }
+        if (best == u32(-1)) {
+            while (next_in_order < num_triangles && emitted[next_in_order]) next_in_order++;
+            if (next_in_order == num_triangles) break;
+            best     = next_in_order;
+            best_new = count_new(best);
+        }
+        if (current.vertex_count + best_new > MESHLET_MAX_VERTICES || current.triangle_count == MESHLET_MAX_TRIANGLES) {
+            flush();
+            best_new = count_new(best);
+        }
+        u32 packed = u32(0);
+        ifor(3) {
+            u32 v = _indices[best * u32(3) + i];
+            if (local[v] == NOT_IN_MESHLET) {
+                local[v] = u8(current.vertex_count++);
+                _out.vertices.push_back(v);
+                for (u32 a = adjacency_offsets[v]; a < adjacency_offsets[v + u32(1)]; a++) {
+                    u32 t = adjacency[a];
+                    if (emitted[t] || is_candidate[t]) continue;
+                    is_candidate[t] = u8(1);
+                    candidates.push_back(t);
+                }
+            }
+            packed |= u32(local[v]) << (u32(8) * i);
+        }
+        _out.triangles.push_back(packed);
+        current.triangle_count++;
+        emitted[best] = u8(1);
+    }
+    flush();
+}
+
+// Meshes are clustered in parallel into per-worker outputs, then concatenated in mesh order
+static void BuildMeshlets(SceneCacheData const &_data, MeshletData &_out, u32 _num_threads = u32(0)) {
+    _out = {};
+
+    u32                      num_meshes = _data.num_meshes;
+    std::vector<MeshletData> per_mesh   = std::vector<MeshletData>(num_meshes);
+    std::atomic<u32>         next       = {u32(0)};
+    auto                     worker     = [&] {
+        while (true) {
+            u32 mesh_id = next.fetch_add(u32(1));
+            if (mesh_id >= num_meshes) break;
+            SceneCacheMesh const &mesh = _data.meshes[mesh_id];
+            BuildMeshletsForMesh(_data.indices + mesh.first_index, mesh.count, _data.vertices + mesh.base_vertex, _data.GetNumMeshVertices(mesh_id), per_mesh[mesh_id]);
+        }
+    };
+    if (_num_threads == u32(0)) _num_threads = std::max(u32(1), u32(std::thread::hardware_concurrency()));
+    _num_threads = std::min(_num_threads, std::max(num_meshes, u32(1)));
+    std::vector<std::thread> threads = {};
+    ifor(_num_threads - u32(1)) threads.emplace_back(worker);
+    worker();
+    for (auto &t : threads) t.join();
+
+    size_t num_meshlets = size_t(0), num_vertices = size_t(0), num_triangles = size_t(0);
+    for (auto &m : per_mesh) {
+        num_meshlets += m.meshlets.size();
+        num_vertices += m.vertices.size();
+        num_triangles += m.triangles.size();
+    }
+    _out.meshlets.reserve(num_meshlets);
+    _out.bounds.reserve(num_meshlets);
+    _out.vertices.reserve(num_vertices);
+    _out.triangles.reserve(num_triangles);
+    _out.meshes.resize(num_meshes);
+    ifor(num_meshes) {
+        MeshletData &m               = per_mesh[i];
+        _out.meshes[i].first_meshlet = u32(_out.meshlets.size());
+        _out.meshes[i].num_meshlets  = u32(m.meshlets.size());
+        u32 vertex_offset            = u32(_out.vertices.size());
+        u32 triangle_offset          = u32(_out.triangles.size());
+        for (Meshlet meshlet : m.meshlets) {
+            meshlet.vertex_offset += vertex_offset;
+            meshlet.triangle_offset += triangle_offset;
+            _out.meshlets.push_back(meshlet);
+        }
+        _out.bounds.insert(_out.bounds.end(), m.bounds.begin(), m.bounds.end());
+        _out.vertices.insert(_out.vertices.end(), m.vertices.begin(), m.vertices.end());
+        _out.triangles.insert(_out.triangles.end(), m.triangles.begin(), m.triangles.end());
+    }
+}
+
+// World space planes, a point is inside when dot(plane.xyz, p) + plane.w >= 0
+struct MeshletFrustum {
+    f32x4 planes[6]  = {};
+    u32   num_planes = u32(0);
+    f32x3 camera_pos = {};
+
+    // _clip_from_world takes column vectors, for Camera that's transpose(view_proj). D3D clip space, 0 <= z <= w. Planes at infinity are dropped.
+    static MeshletFrustum Create(f32x4x4 const &_clip_from_world, f32x3 _camera_pos) {
+        MeshletFrustum frustum = {};
+        frustum.camera_pos     = _camera_pos;
+        f32x4 rows[4]          = {};
+        ifor(4) rows[i]        = f32x4(_clip_from_world[0][i], _clip_from_world[1][i], _clip_from_world[2][i], _clip_from_world[3][i]);
+        f32x4 planes[6]        = {rows[3] + rows[0], rows[3] - rows[0], rows[3] + rows[1], rows[3] - rows[1], rows[2], rows[3] - rows[2]};
+        for (f32x4 plane : planes) {
+            f32 l = length(f32x3(plane));
+            if (l < f32(1.0e-12)) continue;
+            frustum.planes[frustum.num_planes++] = plane / l;
+        }
+        return frustum;
+    }
+};
+
+enum MeshletCullResult : u32 {
+    MESHLET_VISIBLE = u32(0),
+    MESHLET_CULLED_FRUSTUM,
+    MESHLET_CULLED_BACKFACE,
+};
+
+struct MeshletCullStats {
+    u64 num_meshlets         = u64(0);
+    u64 num_frustum_culled   = u64(0);
+    u64 num_backface_culled  = u64(0);
+    u64 num_triangles        = u64(0);
+    u64 num_culled_triangles = u64(0);
+
+    f64 GetCulledFraction() const { return num_meshlets ? f64(num_frustum_culled + num_backface_culled) / f64(num_meshlets) : f64(0.0); }
+    f64 GetCulledTriangleFraction() const { return num_triangles ? f64(num_culled_triangles) / f64(num_triangles) : f64(0.0); }
+};
+
+// Per instance part of the culling, computed once for all the meshlets of the instance
+struct MeshletInstance {
+    f32x4x4 transform    = f32x4x4(f32(1.0));
+    f32     max_scale    = f32(1.0);
+    f32     winding      = f32(1.0); // -1 when the transform mirrors, that flips which side the triangles face
+    bool    cone_culling = true;     // Cones survive rotation, uniform scale and mirroring only
+
+    static MeshletInstance Create(f32x4x4 const &_transform, bool _cone_culling = true) {
+        MeshletInstance instance = {};
+        instance.transform       = _transform;
+        f32x3x3 m                = f32x3x3(_transform);
+        f32     scales[3]        = {length(m[0]), length(m[1]), length(m[2])};
+        instance.max_scale       = std::max(scales[0], std::max(scales[1], scales[2]));
+        f32 min_scale            = std::min(scales[0], std::min(scales[1], scales[2]));
+        instance.winding         = glm::determinant(m) < f32(0.0) ? f32(-1.0) : f32(1.0);
+        instance.cone_culling    = _cone_culling && instance.max_scale > f32(0.0) && (instance.max_scale - min_scale) <= instance.max_scale * f32(1.0e-3) &&
+                                std::abs(dot(m[0], m[1])) <= instance.max_scale * instance.max_scale * f32(1.0e-3) &&
+                                std::abs(dot(m[0], m[2])) <= instance.max_scale * instance.max_scale * f32(1.0e-3) &&
+                                std::abs(dot(m[1], m[2])) <= instance.max_scale * instance.max_scale * f32(1.0e-3);
+        return instance;
+    }
+};
+
+// Conservative: a culled meshlet has every point outside one plane, or every triangle facing away from the camera
+static MeshletCullResult CullMeshlet(MeshletFrustum const &_frustum, MeshletInstance const &_instance, MeshletBounds const &_bounds) {
+    f32x3 center = f32x3(_instance.transform * f32x4(f32x3(_bounds.sphere), f32(1.0)));
+    f32   radius = _bounds.sphere.w * _instance.max_scale * f32(1.0001);
+    ifor(_frustum.num_planes) {
+        if (dot(f32x3(_frustum.planes[i]), center) + _frustum.planes[i].w < -radius) return MESHLET_CULLED_FRUSTUM;
+    }
+    f32 cos_alpha = _bounds.cone.w;
+    if (!_instance.cone_culling || cos_alpha < f32(0.0)) return MESHLET_VISIBLE;
+    // Every normal is within alpha of the axis and the view direction to any point of the sphere is within theta of the direction to the center,
+    // so the meshlet faces away when the distance along the worst case normal still clears the radius: L * cos(theta + alpha) >= r.
+    f32x3 axis = normalize(f32x3x3(_instance.transform) * f32x3(_bounds.cone)) * _instance.winding;
+    f32x3 d    = center - _frustum.camera_pos;
+    f32   l    = length(d);
+    if (l <= radius) return MESHLET_VISIBLE;
+    f32 cos_theta = dot(d, axis) / l;
+    f32 sin_theta = std::sqrt(std::max(f32(0.0), f32(1.0) - cos_theta * cos_theta));
+    f32 sin_alpha = std::sqrt(std::max(f32(0.0), f32(1.0) - cos_alpha * cos_alpha));
+    if (l * (cos_theta * cos_alpha - sin_theta * sin_alpha) >= radius) return MESHLET_CULLED_BACKFACE;
+    return MESHLET_VISIBLE;
+}
+
+// Returns the number of visible meshlets of the mesh, _visible gets a flag per meshlet when given
+static u32 CullMeshMeshlets(MeshletData const &_meshlets, u32 _mesh_id, MeshletFrustum const &_frustum, MeshletInstance const &_instance, MeshletCullStats &_stats,
+                            u8 *_visible = NULL) {
+    MeshletMeshRange range       = _meshlets.meshes[_mesh_id];
+    u32              num_visible = u32(0);
+    ifor(range.num_meshlets) {
+        u32               idx    = range.first_meshlet + i;
+        MeshletCullResult result = CullMeshlet(_frustum, _instance, _meshlets.bounds[idx]);
+        _stats.num_meshlets++;
+        _stats.num_triangles += u64(_meshlets.meshlets[idx].triangle_count);
+        if (result == MESHLET_CULLED_FRUSTUM) _stats.num_frustum_culled++;
+        if (result == MESHLET_CULLED_BACKFACE) _stats.num_backface_culled++;
+        if (result != MESHLET_VISIBLE) _stats.num_culled_triangles += u64(_meshlets.meshlets[idx].triangle_count);
+        if (_visible) _visible[i] = u8(result == MESHLET_VISIBLE);
+        num_visible += u32(result == MESHLET_VISIBLE);
+    }
+    return num_visible;
+}
+
+// Checks the meshlet data against the mesh and the culling against every triangle of every culled meshlet
+static bool ValidateMeshlets(SceneCacheData const &_data, MeshletData const &_meshlets, MeshletFrustum const *_frustum = NULL, MeshletInstance const *_instance = NULL) {
+    ifor(_data.num_meshes) {
+        SceneCacheMesh const &mesh  = _data.meshes[i];
+        MeshletMeshRange      range = _meshlets.meshes[i];
+        // Every triangle of the mesh exactly once
+        std::vector<std::array<u32, 3>> expected = {}, got = {};
+        auto                            key      = [](u32 a, u32 b, u32 c) {
+            u32 m = std::min(a, std::min(b, c));
+            // Rotate so the smallest index goes first, winding is kept
+            while (a != m) {
+                u32 t = a;
+                a     = b;
+                b     = c;
+                c     = t;
+            }
+            return std::array<u32, 3>{a, b, c};
+        };
+        for (u32 t = u32(0); t + u32(3) <= mesh.count; t += u32(3))
+            expected.push_back(key(_data.indices[mesh.first_index + t], _data.indices[mesh.first_index + t + u32(1)], _data.indices[mesh.first_index + t + u32(2)]));
+        jfor(range.num_meshlets) {
+            Meshlet const &m = _meshlets.meshlets[range.first_meshlet + j];
+            if (m.vertex_count > MESHLET_MAX_VERTICES || m.triangle_count > MESHLET_MAX_TRIANGLES || m.triangle_count == u32(0)) return false;
+            MeshletCullResult result = MESHLET_VISIBLE;
+            if (_frustum && _instance) result = CullMeshlet(*_frustum, *_instance, _meshlets.bounds[range.first_meshlet + j]);
+            kfor(m.triangle_count) {
+                u32 t     = _meshlets.triangles[m.triangle_offset + k];
+                u32 ids[] = {t & u32(0xff), (t >> u32(8)) & u32(0xff), (t >> u32(16)) & u32(0xff)};
+                for (u32 id : ids)
+                    if (id >= m.vertex_count) return false;
+                u32 v[3] = {};
+                xfor(3) v[x] = _meshlets.vertices[m.vertex_offset + ids[x]];
+                got.push_back(key(v[0], v[1], v[2]));
+
+                f32x3 p[3]   = {};
+                xfor(3) p[x] = f32x3(_instance ? _instance->transform * _data.vertices[mesh.base_vertex + v[x]].position : _data.vertices[mesh.base_vertex + v[x]].position);
+                // Bounds hold every vertex
+                xfor(3) {
+                    f32x3 local = f32x3(_data.vertices[mesh.base_vertex + v[x]].position);
+                    if (length(local - f32x3(_meshlets.bounds[range.first_meshlet + j].sphere)) > _meshlets.bounds[range.first_meshlet + j].sphere.w * f32(1.0001) + f32(1.0e-6))
+                        return false;
+                }
+                if (result == MESHLET_CULLED_FRUSTUM) {
+                    bool outside = false;
+                    yfor(_frustum->num_planes) {
+                        bool all_out = true;
+                        xfor(3) all_out &= dot(f32x3(_frustum->planes[y]), p[x]) + _frustum->planes[y].w < f32(0.0);
+                        outside |= all_out;
+                    }
+                    if (!outside) return false;
+                }
+                if (result == MESHLET_CULLED_BACKFACE) {
+                    f32x3 n = GetMeshletTriangleNormal(p[0], p[1], p[2]);
+                    if (dot(n, n) > f32(1.0e-20) && dot(p[0] - _frustum->camera_pos, n) < f32(0.0)) return false;
+                }
+            }
+        }
+        std::sort(expected.begin(), expected.end());
+        std::sort(got.begin(), got.end());
+        if (expected != got) return false;
+    }
+    return true;
+}
+
+static void TestMeshletBuilder() {
+    // A UV sphere with outward CCW triangles plus a mesh without triangles
+    SceneCacheData data      = {};
+    u32            num_rings = u32(48);
+    u32            num_segs  = u32(96);
+    f32            pi        = f32(3.14159265358979);
+    ifor(num_rings + u32(1)) {
+        jfor(num_segs + u32(1)) {
+            f32              theta = pi * f32(i) / f32(num_rings);
+            f32              phi   = f32(2.0) * pi * f32(j) / f32(num_segs);
+            SceneCacheVertex v     = {};
+            v.position             = f32x4(std::sin(theta) * std::cos(phi), std::cos(theta), -std::sin(theta) * std::sin(phi), f32(1.0));
+            v.normal               = f32x4(f32x3(v.position), f32(0.0));
+            data.storage_vertices.push_back(v);
+        }
+    }
+    ifor(num_rings) {
+        jfor(num_segs) {
+            u32 a = i * (num_segs + u32(1)) + j, b = a + num_segs + u32(1);
+            for (u32 idx : {a, b, a + u32(1), a + u32(1), b, b + u32(1)}) data.storage_indices.push_back(idx);
+        }
+    }
+    SceneCacheMesh sphere = {};
+    sphere.count          = u32(data.storage_indices.size());
+    data.storage_meshes.push_back(sphere);
+    SceneCacheMesh empty = {};
+    empty.first_index    = u32(data.storage_indices.size());
+    empty.base_vertex    = u32(data.storage_vertices.size());
+    data.storage_meshes.push_back(empty);
+    data.PointToStorage();
+
+    MeshletData meshlets = {};
+    BuildMeshlets(data, meshlets, u32(2));
+    assert(meshlets.meshes.size() == size_t(2) && meshlets.meshes[1].num_meshlets == u32(0));
+    assert(meshlets.GetNumTriangles() == sphere.count / u32(3));
+    // Shared vertices get reused: well under 3 vertices per triangle
+    assert(meshlets.vertices.size() * size_t(2) < size_t(meshlets.GetNumTriangles()) * size_t(3));
+    assert(ValidateMeshlets(data, meshlets));
+
+    // Camera outside the sphere looking at it, then turned away. Plain and mirrored, the mirrored sphere faces inwards.
+    f32x3   eye      = f32x3(f32(0.0), f32(0.0), f32(4.0));
+    f32x4x4 proj     = glm::perspectiveZO(f32(1.0), f32(1.0), f32(0.1), f32(100.0));
+    f32x4x4 views[2] = {glm::lookAt(eye, f32x3(f32(0.0)), f32x3(f32(0.0), f32(1.0), f32(0.0))),
+                        glm::lookAt(eye, eye + f32x3(f32(0.0), f32(0.0), f32(1.0)), f32x3(f32(0.0), f32(1.0), f32(0.0)))};
+    f32x4x4 transforms[2] = {f32x4x4(f32(1.0)), glm::scale(f32x4x4(f32(1.0)), f32x3(f32(0.5), f32(0.5), f32(-0.5)))};
+    ifor(2) {
+        jfor(2) {
+            MeshletFrustum   frustum  = MeshletFrustum::Create(proj * views[i], eye);
+            MeshletInstance  instance = MeshletInstance::Create(transforms[j]);
+            MeshletCullStats stats    = {};
+            CullMeshMeshlets(meshlets, u32(0), frustum, instance, stats);
+            assert(ValidateMeshlets(data, meshlets, &frustum, &instance));
+            if (i == u32(0)) assert(stats.num_frustum_culled == u64(0) && stats.num_backface_culled > u64(0));
+            if (i == u32(1)) assert(stats.num_frustum_culled == stats.num_meshlets);
+            (void)stats;
+        }
+    }
+}
+
+} // namespace GfxJit
+
+#endif // MESHLET_BUILDER_HPP
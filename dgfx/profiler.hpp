@@ -0,0 +1,424 @@
+// MIT License
+//
+// Copyright (c) 2023 Anton Schreiner
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined(PROFILER_HPP)
+#    define PROFILER_HPP
+
+#    include "common.h"
+
+#    include <algorithm>
+#    include <atomic>
+#    include <cassert>
+#    include <chrono>
+#    include <cstring>
+#    include <fstream>
+#    include <memory>
+#    include <string>
+#    include <thread>
+#    include <unordered_map>
+#    include <vector>
+
+namespace GfxJit {
+
+enum ProfileTrack : u32 {
+    PROFILE_TRACK_CPU = u32(0),
+    PROFILE_TRACK_GPU = u32(1),
+    PROFILE_TRACK_COUNT,
+};
+
+// Attached to GPU samples recorded by kernels
+struct ProfileKernelInfo {
+    u32x3 group_size    = {};
+    u32x3 dispatch_size = {}; // In groups
+    u32   reg_pressure  = u32(0);
+};
+
+struct ProfileSample {
+    static constexpr u32 MAX_NAME_LENGTH = u32(48);
+
+    char              name[MAX_NAME_LENGTH] = {}; // Copied, kernels can go away before the frame is exported
+    ProfileTrack      track                 = PROFILE_TRACK_CPU;
+    u32               thread_idx            = u32(0);
+    u32               depth                 = u32(0);
+    bool              has_kernel_info       = false;
+    ProfileKernelInfo kernel_info           = {};
+    f64               begin_us              = f64(0.0);
+    f64               end_us                = f64(0.0);
+
+    void SetName(char const *_name) { snprintf(name, sizeof(name), "%s", _name ? _name : ""); }
+};
+
+// Sample storage for the last NUM_FRAMES frames. Any thread can push, a slot is reserved with one atomic add and a full frame drops the sample.
+// A frame's storage is only recycled by CloseFrame NUM_FRAMES - 1 frames after it was closed, so a writer that raced with CloseFrame still lands in valid memory.
+class ProfileFrameRing {
+public:
+    static constexpr u32 NUM_FRAMES = u32(4);
+
+private:
+    struct Frame {
+        std::unique_ptr<ProfileSample[]> samples       = {};
+        std::atomic<u32>                 num_reserved  = {u32(0)};
+        std::atomic<u32>                 num_committed = {u32(0)};
+        f64                              begin_us      = f64(0.0);
+        f64                              end_us        = f64(0.0);
+    };
+
+    Frame            frames[NUM_FRAMES] = {};
+    u32              capacity           = u32(0);
+    std::atomic<u64> current            = {u64(0)};
+    std::atomic<u64> num_dropped        = {u64(0)};
+
+public:
+    explicit ProfileFrameRing(u32 _capacity_per_frame) : capacity(_capacity_per_frame) {
+        for (auto &f : frames) f.samples.reset(new ProfileSample[capacity]);
+    }
+    ProfileFrameRing(ProfileFrameRing const &)            = delete;
+    ProfileFrameRing &operator=(ProfileFrameRing const &) = delete;
+
+    bool Push(ProfileSample const &_sample) {
+        Frame &f   = frames[current.load(std::memory_order_acquire) % u64(NUM_FRAMES)];
+        u32    idx = f.num_reserved.fetch_add(u32(1), std::memory_order_relaxed);
+        if (idx >= capacity) {
+            num_dropped.fetch_add(u64(1), std::memory_order_relaxed);
+            return false;
+        }
+        f.samples[idx] = _sample;
+        f.num_committed.fetch_add(u32(1), std::memory_order_release);
+        return true;
+    }
+    // Only called from the thread that owns the frame loop
+    void CloseFrame(f64 _now_us) {
+        u64 cur = current.load(std::memory_order_relaxed);
+        frames[cur % u64(NUM_FRAMES)].end_us = _now_us;
+        Frame &next                          = frames[(cur + u64(1)) % u64(NUM_FRAMES)];
+        next.num_reserved.store(u32(0), std::memory_order_relaxed);
+        next.num_committed.store(u32(0), std::memory_order_relaxed);
+        next.begin_us = _now_us;
+        next.end_us   = _now_us;
+        current.store(cur + u64(1), std::memory_order_release);
+    }
+    u64  GetCurrentFrame() const { return current.load(std::memory_order_acquire); }
+    u64  GetNumDropped() const { return num_dropped.load(std::memory_order_relaxed); }
+    bool IsAvailable(u64 _frame) const {
+        u64 cur = GetCurrentFrame();
+        return _frame < cur && cur - _frame < u64(NUM_FRAMES);
+    }
+    f64 GetBegin(u64 _frame) const { return frames[_frame % u64(NUM_FRAMES)].begin_us; }
+    f64 GetEnd(u64 _frame) const { return frames[_frame % u64(NUM_FRAMES)].end_us; }
+    // _fn(ProfileSample const &) for every sample of a closed frame, waits for writers that reserved a slot but haven't finished copying
+    template <typename Fn>
+    bool Visit(u64 _frame, Fn &&_fn) const {
+        if (!IsAvailable(_frame)) return false;
+        Frame const &f   = frames[_frame % u64(NUM_FRAMES)];
+        u32          num = std::min(f.num_reserved.load(std::memory_order_acquire), capacity);
+        while (f.num_committed.load(std::memory_order_acquire) < num) std::this_thread::yield();
+        ifor(num) _fn(f.samples[i]);
+        return true;
+    }
+};
+
+struct ProfileStats {
+    f64 min        = f64(0.0);
+    f64 avg        = f64(0.0);
+    f64 p99        = f64(0.0);
+    f64 last       = f64(0.0);
+    u32 num_frames = u32(0);
+};
+
+// Hierarchical CPU and GPU scopes collected per frame.
+// CPU scopes come from any thread, nesting is tracked per thread. GPU scopes are recorded on the submitting thread with the duration the timestamp query
+// reported, there is no GPU clock to correlate with so they are laid out back to back from the start of the frame.
+// EndFrame folds the closed frame into a rolling window per (track, name), durations of a name that shows up several times in a frame are summed.
+class Profiler {
+public:
+    static constexpr u32 HISTORY_SIZE = u32(128);
+
+private:
+    struct History {
+        f64               values[HISTORY_SIZE] = {};
+        u32               head                 = u32(0);
+        u32               count                = u32(0);
+        bool              has_kernel_info      = false;
+        ProfileKernelInfo kernel_info          = {};
+    };
+    struct GpuScope {
+        ProfileSample sample    = {};
+        f64           cursor_us = f64(0.0); // Where the children ended
+    };
+
+    ProfileFrameRing                                   ring;
+    std::chrono::high_resolution_clock::time_point     origin                       = std::chrono::high_resolution_clock::now();
+    std::unordered_map<std::string, History>           history[PROFILE_TRACK_COUNT] = {};
+    std::vector<GpuScope>                              gpu_stack                    = {};
+    f64                                                gpu_cursor_us                = f64(0.0);
+    std::unordered_map<std::string, f64>               frame_sums                   = {};
+    std::unordered_map<std::string, ProfileKernelInfo> frame_infos                  = {};
+
+    static u32 &GetThreadDepth() {
+        thread_local u32 depth = u32(0);
+        return depth;
+    }
+
+public:
+    explicit Profiler(u32 _capacity_per_frame = u32(1 << 14)) : ring(_capacity_per_frame) {}
+    Profiler(Profiler const &)            = delete;
+    Profiler &operator=(Profiler const &) = delete;
+
+    f64 NowUs() const { return std::chrono::duration<f64, std::micro>(std::chrono::high_resolution_clock::now() - origin).count(); }
+    static u32 GetThreadIndex() {
+        static std::atomic<u32> counter = {u32(0)};
+        thread_local u32        idx     = counter.fetch_add(u32(1));
+        return idx;
+    }
+
+    class CpuScope {
+    private:
+        Profiler   *profiler = NULL;
+        char const *name     = NULL;
+        f64         begin_us = f64(0.0);
+        u32         depth    = u32(0);
+
+    public:
+        CpuScope(Profiler &_profiler, char const *_name) : profiler(&_profiler), name(_name) {
+            depth    = GetThreadDepth()++;
+            begin_us = profiler->NowUs();
+        }
+        ~CpuScope() {
+            ProfileSample s = {};
+            s.SetName(name);
+            s.track      = PROFILE_TRACK_CPU;
+            s.thread_idx = GetThreadIndex();
+            s.depth      = depth;
+            s.begin_us   = begin_us;
+            s.end_us     = profiler->NowUs();
+            profiler->ring.Push(s);
+            GetThreadDepth()--;
+        }
+        CpuScope(CpuScope const &)            = delete;
+        CpuScope &operator=(CpuScope const &) = delete;
+    };
+
+    void BeginGpuScope(char const *_name) {
+        if (gpu_stack.empty()) gpu_cursor_us = std::max(gpu_cursor_us, ring.GetBegin(ring.GetCurrentFrame()));
+        GpuScope scope = {};
+        scope.sample.SetName(_name);
+        scope.sample.track      = PROFILE_TRACK_GPU;
+        scope.sample.thread_idx = u32(0);
+        scope.sample.depth      = u32(gpu_stack.size());
+        scope.sample.begin_us   = gpu_cursor_us;
+        scope.cursor_us         = gpu_cursor_us;
+        gpu_stack.push_back(scope);
+    }
+    void EndGpuScope(f64 _duration_ms, ProfileKernelInfo const *_info = NULL) {
+        assert(!gpu_stack.empty());
+        GpuScope scope = gpu_stack.back();
+        gpu_stack.pop_back();
+        scope.sample.end_us = std::max(scope.sample.begin_us + _duration_ms * f64(1000.0), scope.cursor_us);
+        if (_info) {
+            scope.sample.has_kernel_info = true;
+            scope.sample.kernel_info     = *_info;
+        }
+        gpu_cursor_us = scope.sample.end_us;
+        if (!gpu_stack.empty()) gpu_stack.back().cursor_us = gpu_cursor_us;
+        ring.Push(scope.sample);
+    }
+    // Closes the current frame and updates the rolling stats with it
+    void EndFrame() {
+        assert(gpu_stack.empty());
+        u64 frame = ring.GetCurrentFrame();
+        ring.CloseFrame(NowUs());
+        ifor(PROFILE_TRACK_COUNT) {
+            frame_sums.clear();
+            frame_infos.clear();
+            ring.Visit(frame, [&](ProfileSample const &_s) {
+                if (_s.track != ProfileTrack(i)) return;
+                frame_sums[_s.name] += (_s.end_us - _s.begin_us) / f64(1000.0);
+                if (_s.has_kernel_info) frame_infos[_s.name] = _s.kernel_info;
+            });
+            for (auto &s : frame_sums) {
+                History &h                       = history[i][s.first];
+                h.values[h.head % HISTORY_SIZE] = s.second;
+                h.head                           = (h.head + u32(1)) % HISTORY_SIZE;
+                h.count                          = std::min(h.count + u32(1), HISTORY_SIZE);
+                auto it                          = frame_infos.find(s.first);
+                if (it != frame_infos.end()) {
+                    h.has_kernel_info = true;
+                    h.kernel_info     = it->second;
+                }
+            }
+        }
+    }
+    // Durations in ms over the last HISTORY_SIZE frames the scope was seen in
+    bool GetStats(ProfileTrack _track, char const *_name, ProfileStats &_stats) const {
+        auto it = history[_track].find(_name);
+        if (it == history[_track].end() || it->second.count == u32(0)) return false;
+        History const   &h      = it->second;
+        std::vector<f64> sorted = std::vector<f64>(h.values, h.values + h.count);
+        std::sort(sorted.begin(), sorted.end());
+        f64 sum = f64(0.0);
+        for (auto v : sorted) sum += v;
+        _stats            = {};
+        _stats.num_frames = h.count;
+        _stats.min        = sorted.front();
+        _stats.avg        = sum / f64(h.count);
+        _stats.p99        = sorted[std::min(u32(f64(h.count) * f64(0.99)), h.count - u32(1))];
+        _stats.last       = h.values[(h.head + HISTORY_SIZE - u32(1)) % HISTORY_SIZE];
+        return true;
+    }
+    bool GetKernelInfo(char const *_name, ProfileKernelInfo &_info) const {
+        auto it = history[PROFILE_TRACK_GPU].find(_name);
+        if (it == history[PROFILE_TRACK_GPU].end() || !it->second.has_kernel_info) return false;
+        _info = it->second.kernel_info;
+        return true;
+    }
+    // _fn(ProfileTrack, std::string const &name, ProfileStats const &)
+    template <typename Fn>
+    void ForEachStats(Fn &&_fn) const {
+        ifor(PROFILE_TRACK_COUNT) for (auto &h : history[i]) {
+            ProfileStats stats = {};
+            if (GetStats(ProfileTrack(i), h.first.c_str(), stats)) _fn(ProfileTrack(i), h.first, stats);
+        }
+    }
+    u64 GetNumDropped() const { return ring.GetNumDropped(); }
+    // Chrome trace event format, every closed frame still in the ring. CPU threads are pid 0, the GPU timeline is pid 1.
+    std::string WriteChromeTrace() const {
+        auto escape = [](char const *_str) {
+            std::string out = {};
+            for (char const *c = _str; *c; c++) {
+                if (*c == '"' || *c == '\\') out += '\\';
+                if (u8(*c) < u8(0x20)) continue;
+                out += *c;
+            }
+            return out;
+        };
+        std::string out = "{\"traceEvents\":[\n"
+                          "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"CPU\"}},\n"
+                          "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"GPU\"}}";
+        char buf[0x200];
+        u64  cur = ring.GetCurrentFrame();
+        for (u64 frame = cur > u64(ProfileFrameRing::NUM_FRAMES) ? cur - u64(ProfileFrameRing::NUM_FRAMES) + u64(1) : u64(0); frame < cur; frame++) {
+            snprintf(buf, sizeof(buf), ",\n{\"name\":\"frame %llu\",\"cat\":\"frame\",\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f}",
+                     (unsigned long long)frame, ring.GetBegin(frame), ring.GetEnd(frame) - ring.GetBegin(frame));
+            out += buf;
+            ring.Visit(frame, [&](ProfileSample const &_s) {
+                bool gpu = _s.track == PROFILE_TRACK_GPU;
+                snprintf(buf, sizeof(buf), ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%i,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%llu,\"depth\":%u",
+                         escape(_s.name).c_str(), gpu ? "gpu" : "cpu", gpu ? 1 : 0, _s.thread_idx, _s.begin_us, _s.end_us - _s.begin_us, (unsigned long long)frame,
+                         _s.depth);
+                out += buf;
+                if (_s.has_kernel_info) {
+                    ProfileKernelInfo const &k = _s.kernel_info;
+                    snprintf(buf, sizeof(buf), ",\"group_size\":[%u,%u,%u],\"dispatch_size\":[%u,%u,%u],\"reg_pressure\":%u", k.group_size.x, k.group_size.y,
+                             k.group_size.z, k.dispatch_size.x, k.dispatch_size.y, k.dispatch_size.z, k.reg_pressure);
+                    out += buf;
+                }
+                out += "}}";
+            });
+        }
+        out += "\n]}\n";
+        return out;
+    }
+    bool ExportChromeTrace(char const *_path) const {
+        std::ofstream file(_path, std::ios::binary);
+        if (!file.is_open()) return false;
+        file << WriteChromeTrace();
+        return !!file;
+    }
+
+    static void Test() {
+        Profiler          profiler = Profiler(u32(64));
+        ProfileKernelInfo info     = {};
+        info.group_size            = u32x3(8, 8, 1);
+        info.dispatch_size         = u32x3(240, 135, 1);
+        info.reg_pressure          = u32(42);
+        ifor(4) {
+            {
+                CpuScope frame_scope(profiler, "frame");
+                {
+                    CpuScope child_scope(profiler, "child");
+                    std::vector<std::thread> threads = {};
+                    jfor(4) threads.emplace_back([&profiler] { kfor(8) CpuScope worker_scope(profiler, "worker"); });
+                    for (auto &t : threads) t.join();
+                }
+                profiler.BeginGpuScope("pass_a");
+                profiler.EndGpuScope(f64(1.0) + f64(i), &info);
+                profiler.BeginGpuScope("outer");
+                profiler.BeginGpuScope("inner");
+                profiler.EndGpuScope(f64(0.5));
+                profiler.BeginGpuScope("inner");
+                profiler.EndGpuScope(f64(0.5));
+                profiler.EndGpuScope(f64(0.25)); // Shorter than its children, gets stretched
+            }
+            profiler.EndFrame();
+        }
+        ProfileStats stats = {};
+        assert(profiler.GetStats(PROFILE_TRACK_GPU, "pass_a", stats));
+        assert(stats.num_frames == u32(4) && stats.min == f64(1.0) && stats.avg == f64(2.5) && stats.p99 == f64(4.0) && stats.last == f64(4.0));
+        assert(profiler.GetStats(PROFILE_TRACK_GPU, "inner", stats) && stats.avg == f64(1.0));
+        assert(profiler.GetStats(PROFILE_TRACK_GPU, "outer", stats) && stats.avg >= f64(1.0));
+        assert(profiler.GetStats(PROFILE_TRACK_CPU, "frame", stats) && stats.num_frames == u32(4));
+        assert(!profiler.GetStats(PROFILE_TRACK_CPU, "pass_a", stats));
+        ProfileKernelInfo stored = {};
+        assert(profiler.GetKernelInfo("pass_a", stored) && stored.reg_pressure == u32(42) && stored.dispatch_size == info.dispatch_size);
+        assert(profiler.GetNumDropped() == u64(0));
+
+        // Nesting and layout of the last frame
+        u64  last       = profiler.ring.GetCurrentFrame() - u64(1);
+        u32  num_worker = u32(0);
+        f64  outer_end  = f64(0.0);
+        u32  max_depth  = u32(0);
+        bool visited    = profiler.ring.Visit(last, [&](ProfileSample const &_s) {
+            if (strcmp(_s.name, "worker") == 0) {
+                num_worker++;
+                assert(_s.depth == u32(0));
+            }
+            if (strcmp(_s.name, "child") == 0) assert(_s.depth == u32(1));
+            if (strcmp(_s.name, "outer") == 0) outer_end = _s.end_us;
+            if (_s.track == PROFILE_TRACK_GPU) max_depth = std::max(max_depth, _s.depth);
+        });
+        assert(visited && num_worker == u32(32) && max_depth == u32(1));
+        profiler.ring.Visit(last, [&](ProfileSample const &_s) {
+            if (strcmp(_s.name, "inner") == 0) assert(_s.end_us <= outer_end);
+        });
+
+        std::string trace = profiler.WriteChromeTrace();
+        assert(trace.find("\"traceEvents\"") != std::string::npos);
+        assert(trace.find("\"pass_a\"") != std::string::npos);
+        assert(trace.find("\"reg_pressure\":42") != std::string::npos);
+        assert(trace.find("\"dispatch_size\":[240,135,1]") != std::string::npos);
+
+        // A full frame drops instead of blocking
+        ifor(100) CpuScope scope(profiler, "spam");
+        profiler.EndFrame();
+        assert(profiler.GetNumDropped() == u64(100 - 64));
+        assert(profiler.GetStats(PROFILE_TRACK_CPU, "spam", stats) && stats.num_frames == u32(1));
+        (void)visited;
+    }
+};
+
+#    define PROFILER_CONCAT_2(a, b) a##b
+#    define PROFILER_CONCAT(a, b) PROFILER_CONCAT_2(a, b)
+#    define PROFILE_CPU_SCOPE(profiler, name) Profiler::CpuScope PROFILER_CONCAT(_profile_scope_, __LINE__)(profiler, name)
+
+} // namespace GfxJit
+
+#endif // PROFILER_HPP
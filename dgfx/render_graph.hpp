@@ -0,0 +1,654 @@
+// MIT License
+//
+// Copyright (c) 2023 Anton Schreiner
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined(RENDER_GRAPH_HPP)
+#    define RENDER_GRAPH_HPP
+
+#    include "common.h"
+
+#    include <algorithm>
+#    include <cassert>
+#    include <functional>
+#    include <string>
+#    include <vector>
+
+namespace GfxJit {
+
+// Backend object, 0 is null
+using RenderGraphHandle = u64;
+
+struct RenderGraphTextureDesc {
+    u32 width           = u32(1);
+    u32 height          = u32(1);
+    u32 depth           = u32(1);
+    u32 mip_levels      = u32(1);
+    u32 format          = u32(0); // Opaque to the graph, DXGI_FORMAT for the gfx backend
+    u32 bytes_per_texel = u32(4);
+
+    bool operator==(RenderGraphTextureDesc const &that) const {
+        return width == that.width && height == that.height && depth == that.depth && mip_levels == that.mip_levels && format == that.format &&
+               bytes_per_texel == that.bytes_per_texel;
+    }
+    u64 GetSizeInBytes() const {
+        u64 size = u64(0);
+        ifor(mip_levels) size += u64(std::max(width >> i, u32(1))) * u64(std::max(height >> i, u32(1))) * u64(std::max(depth >> i, u32(1))) * u64(bytes_per_texel);
+        return size;
+    }
+};
+
+enum RenderGraphState {
+    RG_STATE_UNDEFINED = 0,
+    RG_STATE_SHADER_READ,
+    RG_STATE_UNORDERED_ACCESS,
+};
+
+struct RenderGraphBarrier {
+    u32              resource = u32(0);
+    RenderGraphState before   = RG_STATE_UNDEFINED;
+    RenderGraphState after    = RG_STATE_UNDEFINED;
+    bool             aliasing = false; // First use of memory that belonged to another transient this frame
+};
+
+struct RenderGraphStats {
+    u32 num_passes             = u32(0);
+    u32 num_levels             = u32(0);
+    u32 num_barriers           = u32(0);
+    u32 num_barrier_batches    = u32(0);
+    u32 num_transients         = u32(0);
+    u32 num_physical           = u32(0);
+    u32 num_created            = u32(0); // Backend textures created by the last Compile, 0 when the previous frame's layout was reused
+    u64 transient_bytes        = u64(0); // Every transient in its own allocation
+    u64 transient_bytes_shared = u64(0); // After aliasing
+};
+
+class IRenderGraphBackend {
+public:
+    // Placed resources in one heap, otherwise only transients with identical descriptions share a texture
+    virtual bool              CanAliasMemory()                                                     = 0;
+    virtual RenderGraphHandle CreateTexture(RenderGraphTextureDesc const &_desc, u64 _heap_offset) = 0;
+    virtual void              DestroyTexture(RenderGraphHandle _texture)                           = 0;
+    virtual void              Barriers(std::vector<RenderGraphBarrier> const &_batch)              = 0;
+    virtual ~IRenderGraphBackend() {}
+};
+
+struct RenderGraphTexture {
+    u32 id = u32(-1);
+
+    bool IsValid() const { return id != u32(-1); }
+};
+
+// Passes are declared in submission order with the textures they read and write.
+// Compile schedules them into dependency levels, every level gets one batch of barriers and transients whose level ranges don't overlap share memory.
+// The graph is rebuilt every frame, the backend textures are kept while the layout stays the same.
+class RenderGraph {
+public:
+    static constexpr u64 PLACEMENT_ALIGNMENT = u64(64 << 10);
+
+    class Pass {
+    private:
+        friend class RenderGraph;
+
+        std::string                     name    = {};
+        std::function<void()>           execute = {};
+        std::vector<RenderGraphTexture> reads   = {};
+        std::vector<RenderGraphTexture> writes  = {};
+        u32                             level   = u32(0);
+
+    public:
+        Pass &Read(RenderGraphTexture _texture) {
+            reads.push_back(_texture);
+            return *this;
+        }
+        Pass &Write(RenderGraphTexture _texture) {
+            writes.push_back(_texture);
+            return *this;
+        }
+        std::string const &GetName() const { return name; }
+        u32                GetLevel() const { return level; }
+    };
+
+private:
+    struct Resource {
+        std::string            name        = {};
+        RenderGraphTextureDesc desc        = {};
+        bool                   imported    = false;
+        RenderGraphHandle      handle      = RenderGraphHandle(0);
+        RenderGraphState       state       = RG_STATE_UNDEFINED;
+        u32                    first_level = u32(-1);
+        u32                    last_level  = u32(0);
+        u32                    physical    = u32(-1);
+        bool                   aliased     = false; // Memory was used by an earlier transient this frame
+    };
+    struct Physical {
+        RenderGraphTextureDesc desc        = {};
+        u64                    heap_offset = u64(0);
+        RenderGraphHandle      handle      = RenderGraphHandle(0);
+    };
+
+    IRenderGraphBackend                          *backend   = NULL;
+    std::vector<Pass>                             passes    = {};
+    std::vector<Resource>                         resources = {};
+    std::vector<Physical>                         physical  = {}; // Survives Reset
+    std::vector<u32>                              schedule  = {}; // Pass indices sorted by level
+    std::vector<std::vector<RenderGraphBarrier>> barriers  = {}; // One batch per level
+    std::vector<u32>                              level_end = {}; // Exclusive end of each level in schedule
+    RenderGraphStats                              stats     = {};
+    bool                                          compiled  = false;
+
+    static u64  AlignUp(u64 _v, u64 _alignment) { return (_v + _alignment - u64(1)) / _alignment * _alignment; }
+    static bool Overlaps(Resource const &_a, Resource const &_b) { return _a.first_level <= _b.last_level && _b.first_level <= _a.last_level; }
+
+    // Every transient gets an offset in one heap, biggest first, lowest offset that doesn't collide with anything alive at the same time
+    void PlaceInHeap(std::vector<u32> const &_transients, std::vector<Physical> &_layout) {
+        std::vector<u32> order = _transients;
+        std::sort(order.begin(), order.end(), [&](u32 a, u32 b) {
+            u64 sa = resources[a].desc.GetSizeInBytes();
+            u64 sb = resources[b].desc.GetSizeInBytes();
+            return sa != sb ? sa > sb : a < b;
+        });
+        std::vector<u32> placed = {};
+        for (u32 r : order) {
+            u64              size  = AlignUp(resources[r].desc.GetSizeInBytes(), PLACEMENT_ALIGNMENT);
+            std::vector<u32> taken = {};
+            for (u32 p : placed)
+                if (Overlaps(resources[r], resources[p])) taken.push_back(p);
+            std::sort(taken.begin(), taken.end(), [&](u32 a, u32 b) { return _layout[resources[a].physical].heap_offset < _layout[resources[b].physical].heap_offset; });
+            u64 offset = u64(0);
+            for (u32 p : taken) {
+                Physical const &o     = _layout[resources[p].physical];
+                u64             o_end = o.heap_offset + AlignUp(o.desc.GetSizeInBytes(), PLACEMENT_ALIGNMENT);
+                if (offset + size <= o.heap_offset) break;
+                offset = std::max(offset, o_end);
+            }
+            resources[r].physical = u32(_layout.size());
+            _layout.push_back({resources[r].desc, offset, RenderGraphHandle(0)});
+            placed.push_back(r);
+        }
+    }
+    // Transients with identical descriptions take turns on one texture
+    void ShareTextures(std::vector<u32> const &_transients, std::vector<Physical> &_layout) {
+        std::vector<u32> order = _transients;
+        std::sort(order.begin(), order.end(), [&](u32 a, u32 b) { return resources[a].first_level != resources[b].first_level ? resources[a].first_level < resources[b].first_level : a < b; });
+        std::vector<u32> slot_last_level = {};
+        for (u32 r : order) {
+            u32 slot = u32(-1);
+            ifor(_layout.size()) {
+                if (_layout[i].desc == resources[r].desc && slot_last_level[i] < resources[r].first_level) {
+                    slot = i;
+                    break;
+                }
+            }
+            if (slot == u32(-1)) {
+                slot = u32(_layout.size());
+                _layout.push_back({resources[r].desc, u64(0), RenderGraphHandle(0)});
+                slot_last_level.push_back(u32(0));
+            }
+            slot_last_level[slot] = resources[r].last_level;
+            resources[r].physical = slot;
+        }
+    }
+    bool SharesMemory(Resource const &_a, Resource const &_b) {
+        if (!backend->CanAliasMemory()) return _a.physical == _b.physical;
+        Physical const &a = physical[_a.physical];
+        Physical const &b = physical[_b.physical];
+        return a.heap_offset < b.heap_offset + b.desc.GetSizeInBytes() && b.heap_offset < a.heap_offset + a.desc.GetSizeInBytes();
+    }
+    u64 GetLayoutSize(std::vector<Physical> const &_layout) {
+        u64 size = u64(0);
+        for (auto &p : _layout) {
+            u64 end = AlignUp(p.desc.GetSizeInBytes(), PLACEMENT_ALIGNMENT);
+            size    = backend->CanAliasMemory() ? std::max(size, p.heap_offset + end) : size + end;
+        }
+        return size;
+    }
+
+public:
+    RenderGraph(RenderGraph const &)                    = delete;
+    RenderGraph(RenderGraph &&)                         = delete;
+    RenderGraph const &operator=(RenderGraph const &) = delete;
+    RenderGraph const &operator=(RenderGraph &&)      = delete;
+
+    RenderGraph(IRenderGraphBackend *_backend) : backend(_backend) {}
+    ~RenderGraph() { Release(); }
+
+    RenderGraphTexture CreateTexture(std::string const &_name, RenderGraphTextureDesc const &_desc) {
+        compiled   = false;
+        Resource r = {};
+        r.name     = _name;
+        r.desc     = _desc;
+        resources.push_back(r);
+        return {u32(resources.size() - size_t(1))};
+    }
+    // Persistent texture owned by somebody else, tracked for barriers but never aliased
+    RenderGraphTexture Import(std::string const &_name, RenderGraphHandle _texture, RenderGraphState _state = RG_STATE_UNDEFINED) {
+        compiled   = false;
+        Resource r = {};
+        r.name     = _name;
+        r.imported = true;
+        r.handle   = _texture;
+        r.state    = _state;
+        resources.push_back(r);
+        return {u32(resources.size() - size_t(1))};
+    }
+    // The reference is only valid until the next AddPass
+    Pass &AddPass(std::string const &_name, std::function<void()> _execute) {
+        compiled  = false;
+        Pass p    = {};
+        p.name    = _name;
+        p.execute = _execute;
+        passes.push_back(p);
+        return passes.back();
+    }
+    RenderGraphHandle GetTexture(RenderGraphTexture _texture) {
+        assert(compiled && _texture.id < u32(resources.size()));
+        return resources[_texture.id].handle;
+    }
+    std::string const &GetName(RenderGraphTexture _texture) { return resources[_texture.id].name; }
+    RenderGraphStats   GetStats() { return stats; }
+    u32                GetNumLevels() { return u32(level_end.size()); }
+    Pass const        &GetScheduledPass(u32 _idx) { return passes[schedule[_idx]]; }
+    std::vector<RenderGraphBarrier> const &GetBarriers(u32 _level) { return barriers[_level]; }
+
+    void Compile() {
+        stats            = {};
+        stats.num_passes = u32(passes.size());
+        schedule.clear();
+        barriers.clear();
+        level_end.clear();
+
+        // Dependencies follow declaration order: read after write, write after read and write after write
+        {
+            std::vector<u32>              last_writer = std::vector<u32>(resources.size(), u32(-1));
+            std::vector<std::vector<u32>> readers     = std::vector<std::vector<u32>>(resources.size());
+            ifor(passes.size()) {
+                Pass &p = passes[i];
+                p.level = u32(0);
+                auto after = [&](u32 _pred) {
+                    if (_pred != u32(-1) && _pred != i) p.level = std::max(p.level, passes[_pred].level + u32(1));
+                };
+                for (auto &t : p.reads) after(last_writer[t.id]);
+                for (auto &t : p.writes) {
+                    after(last_writer[t.id]);
+                    for (u32 r : readers[t.id]) after(r);
+                }
+                for (auto &t : p.reads) readers[t.id].push_back(i);
+                for (auto &t : p.writes) {
+                    last_writer[t.id] = i;
+                    readers[t.id].clear();
+                }
+            }
+        }
+        ifor(passes.size()) schedule.push_back(i);
+        std::stable_sort(schedule.begin(), schedule.end(), [&](u32 a, u32 b) { return passes[a].level < passes[b].level; });
+        for (u32 s = u32(0); s < u32(schedule.size()); s++) {
+            u32 level = passes[schedule[s]].level;
+            if (level_end.size() <= size_t(level)) level_end.resize(size_t(level) + size_t(1), u32(0));
+            level_end[level] = s + u32(1);
+        }
+        stats.num_levels = u32(level_end.size());
+
+        // Lifetimes in levels
+        for (auto &r : resources) {
+            r.first_level = u32(-1);
+            r.last_level  = u32(0);
+            r.physical    = u32(-1);
+        }
+        for (auto &p : passes) {
+            auto touch = [&](RenderGraphTexture _t) {
+                Resource &r   = resources[_t.id];
+                r.first_level = std::min(r.first_level, p.level);
+                r.last_level  = std::max(r.last_level, p.level);
+            };
+            for (auto &t : p.reads) touch(t);
+            for (auto &t : p.writes) touch(t);
+        }
+        std::vector<u32> transients = {};
+        ifor(resources.size()) {
+            if (resources[i].imported || resources[i].first_level == u32(-1)) continue;
+            transients.push_back(i);
+            stats.transient_bytes += AlignUp(resources[i].desc.GetSizeInBytes(), PLACEMENT_ALIGNMENT);
+        }
+        stats.num_transients = u32(transients.size());
+
+        // Aliasing, backend textures are kept when the layout matches the previous frame
+        std::vector<Physical> layout = {};
+        if (backend->CanAliasMemory())
+            PlaceInHeap(transients, layout);
+        else
+            ShareTextures(transients, layout);
+        std::vector<bool> reused = std::vector<bool>(physical.size(), false);
+        for (auto &n : layout) {
+            ifor(physical.size()) {
+                if (!reused[i] && physical[i].desc == n.desc && physical[i].heap_offset == n.heap_offset) {
+                    reused[i] = true;
+                    n.handle  = physical[i].handle;
+                    break;
+                }
+            }
+        }
+        ifor(physical.size()) if (!reused[i]) backend->DestroyTexture(physical[i].handle);
+        for (auto &n : layout) {
+            if (n.handle) continue;
+            n.handle = backend->CreateTexture(n.desc, n.heap_offset);
+            stats.num_created++;
+        }
+        physical                     = std::move(layout);
+        stats.num_physical           = u32(physical.size());
+        stats.transient_bytes_shared = GetLayoutSize(physical);
+        for (u32 r : transients) {
+            resources[r].handle  = physical[resources[r].physical].handle;
+            resources[r].state   = RG_STATE_UNDEFINED;
+            resources[r].aliased = false;
+            for (u32 o : transients)
+                if (o != r && resources[o].last_level < resources[r].first_level && SharesMemory(resources[r], resources[o])) resources[r].aliased = true;
+        }
+
+        // One batch per level, passes inside a level don't depend on each other so their transitions can go together
+        std::vector<bool> written = std::vector<bool>(resources.size(), false);
+        barriers.resize(level_end.size());
+        u32 begin = u32(0);
+        ifor(level_end.size()) {
+            auto &batch = barriers[i];
+            for (u32 s = begin; s < level_end[i]; s++) {
+                Pass &p      = passes[schedule[s]];
+                auto  access = [&](RenderGraphTexture _t, RenderGraphState _state) {
+                    Resource &r = resources[_t.id];
+                    for (auto &b : batch)
+                        if (b.resource == _t.id) return; // Already transitioned for this level
+                    if (r.state != _state) {
+                        batch.push_back({_t.id, r.state, _state, r.aliased && r.state == RG_STATE_UNDEFINED});
+                    } else if (_state == RG_STATE_UNORDERED_ACCESS && written[_t.id]) {
+                        batch.push_back({_t.id, _state, _state, false}); // UAV barrier between two writers
+                    }
+                    r.state = _state;
+                };
+                for (auto &t : p.writes) access(t, RG_STATE_UNORDERED_ACCESS);
+                for (auto &t : p.reads) {
+                    bool also_written = false;
+                    for (auto &w : p.writes) also_written |= w.id == t.id;
+                    if (!also_written) access(t, RG_STATE_SHADER_READ);
+                }
+            }
+            for (u32 s = begin; s < level_end[i]; s++)
+                for (auto &t : passes[schedule[s]].writes) written[t.id] = true;
+            stats.num_barriers += u32(batch.size());
+            if (batch.size()) stats.num_barrier_batches++;
+            begin = level_end[i];
+        }
+        compiled = true;
+    }
+    void Execute() {
+        if (!compiled) Compile();
+        u32 begin = u32(0);
+        ifor(level_end.size()) {
+            if (barriers[i].size()) backend->Barriers(barriers[i]);
+            for (u32 s = begin; s < level_end[i]; s++)
+                if (passes[schedule[s]].execute) passes[schedule[s]].execute();
+            begin = level_end[i];
+        }
+    }
+    // Drops the passes and resources of the frame, backend textures stay for the next Compile
+    void Reset() {
+        passes.clear();
+        resources.clear();
+        schedule.clear();
+        barriers.clear();
+        level_end.clear();
+        compiled = false;
+    }
+    void Release() {
+        for (auto &p : physical) backend->DestroyTexture(p.handle);
+        physical.clear();
+        Reset();
+    }
+    void PrintStats(char const *_name) {
+        fprintf(stdout, "[RENDER GRAPH] %s: %i passes in %i levels, %i barriers in %i batches, %i transients on %i %s, peak transient memory %f MB -> %f MB\n", _name,
+                stats.num_passes, stats.num_levels, stats.num_barriers, stats.num_barrier_batches, stats.num_transients, stats.num_physical,
+                backend->CanAliasMemory() ? "placements" : "textures", f64(stats.transient_bytes) / f64(1 << 20), f64(stats.transient_bytes_shared) / f64(1 << 20));
+    }
+
+    static void Test();
+};
+
+// Records everything and checks that aliasing never hands out memory that is still alive.
+// Every pass is expected to call OnWrite/OnRead for what it declared.
+class NullRenderGraphBackend : public IRenderGraphBackend {
+private:
+    struct Texture {
+        RenderGraphTextureDesc desc        = {};
+        u64                    heap_offset = u64(0);
+        bool                   alive       = false;
+    };
+    bool                 alias_memory = true;
+    std::vector<Texture> textures     = {};
+    std::vector<u32>     page_owner   = {}; // Last resource written to each heap page, or to each texture when not aliasing memory
+
+public:
+    u32 num_created       = u32(0);
+    u32 num_destroyed     = u32(0);
+    u32 num_barriers      = u32(0);
+    u32 num_barrier_calls = u32(0);
+    u32 num_stale_reads   = u32(0);
+    u64 peak_heap_size    = u64(0);
+
+    NullRenderGraphBackend(bool _alias_memory) : alias_memory(_alias_memory) {}
+
+    bool              CanAliasMemory() override { return alias_memory; }
+    RenderGraphHandle CreateTexture(RenderGraphTextureDesc const &_desc, u64 _heap_offset) override {
+        num_created++;
+        textures.push_back({_desc, _heap_offset, true});
+        peak_heap_size = std::max(peak_heap_size, _heap_offset + _desc.GetSizeInBytes());
+        return RenderGraphHandle(textures.size());
+    }
+    void DestroyTexture(RenderGraphHandle _texture) override {
+        assert(_texture && textures[_texture - u64(1)].alive);
+        textures[_texture - u64(1)].alive = false;
+        num_destroyed++;
+    }
+    void Barriers(std::vector<RenderGraphBarrier> const &_batch) override {
+        num_barrier_calls++;
+        num_barriers += u32(_batch.size());
+    }
+    // Pages of a placed texture, or its index when textures are only shared whole
+    void GetPages(RenderGraphHandle _texture, u64 &_begin, u64 &_end) {
+        Texture &t = textures[_texture - u64(1)];
+        assert(t.alive);
+        if (alias_memory) {
+            _begin = t.heap_offset / RenderGraph::PLACEMENT_ALIGNMENT;
+            _end   = (t.heap_offset + t.desc.GetSizeInBytes() + RenderGraph::PLACEMENT_ALIGNMENT - u64(1)) / RenderGraph::PLACEMENT_ALIGNMENT;
+        } else {
+            _begin = _texture;
+            _end   = _texture + u64(1);
+        }
+        if (page_owner.size() < _end) page_owner.resize(_end, u32(-1));
+    }
+    void OnWrite(RenderGraphHandle _texture, u32 _resource) {
+        u64 begin, end;
+        GetPages(_texture, begin, end);
+        for (u64 p = begin; p < end; p++) page_owner[p] = _resource;
+    }
+    void OnRead(RenderGraphHandle _texture, u32 _resource) {
+        u64 begin, end;
+        GetPages(_texture, begin, end);
+        for (u64 p = begin; p < end; p++)
+            if (page_owner[p] != _resource) {
+                num_stale_reads++;
+                return;
+            }
+    }
+};
+
+inline void RenderGraph::Test() {
+    // Builds a frame where every pass reports its accesses to the null backend, imported textures are treated as written up front
+    struct FramePass {
+        char const      *name   = NULL;
+        std::vector<u32> reads  = {};
+        std::vector<u32> writes = {};
+    };
+    struct FrameTexture {
+        char const            *name     = NULL;
+        RenderGraphTextureDesc desc     = {};
+        bool                   imported = false;
+    };
+    auto run = [](char const *_name, NullRenderGraphBackend &_backend, RenderGraph &_graph, std::vector<FrameTexture> const &_textures, std::vector<FramePass> const &_passes) {
+        _graph.Reset();
+        std::vector<RenderGraphTexture> handles = {};
+        ifor(_textures.size()) {
+            if (_textures[i].imported)
+                handles.push_back(_graph.Import(_textures[i].name, RenderGraphHandle(0)));
+            else
+                handles.push_back(_graph.CreateTexture(_textures[i].name, _textures[i].desc));
+        }
+        for (auto &fp : _passes) {
+            FramePass const *p    = &fp;
+            auto            &pass = _graph.AddPass(fp.name, [p, &_backend, &_graph, &handles] {
+                for (u32 r : p->reads)
+                    if (_graph.GetTexture(handles[r])) _backend.OnRead(_graph.GetTexture(handles[r]), r);
+                for (u32 w : p->writes)
+                    if (_graph.GetTexture(handles[w])) _backend.OnWrite(_graph.GetTexture(handles[w]), w);
+            });
+            for (u32 r : fp.reads) pass.Read(handles[r]);
+            for (u32 w : fp.writes) pass.Write(handles[w]);
+        }
+        _graph.Compile();
+        _graph.Execute();
+        if (_name) _graph.PrintStats(_name);
+    };
+    auto tex2d = [](char const *_name, u32 _bytes_per_texel) {
+        FrameTexture t         = {};
+        t.name                 = _name;
+        t.desc.width           = u32(1920);
+        t.desc.height          = u32(1080);
+        t.desc.format          = _bytes_per_texel;
+        t.desc.bytes_per_texel = _bytes_per_texel;
+        return t;
+    };
+    auto imported = [](char const *_name) {
+        FrameTexture t = {};
+        t.name         = _name;
+        t.imported     = true;
+        return t;
+    };
+
+    // A chain with two independent branches: levels, batching and reuse of the first textures by the last ones
+    {
+        std::vector<FrameTexture> textures = {tex2d("a", 8), tex2d("b", 8), tex2d("c", 8), tex2d("d", 8), tex2d("e", 8), imported("out")};
+        std::vector<FramePass>    frame    = {
+            {"A", {}, {0}},        //
+            {"B", {0}, {1}},       //
+            {"C", {0}, {2}},       // independent of B
+            {"D", {1, 2}, {3}},    //
+            {"E", {3}, {4}},       //
+            {"F", {4}, {5}},       //
+        };
+        ifor(2) {
+            NullRenderGraphBackend backend(i == 0);
+            {
+                RenderGraph graph(&backend);
+                run(NULL, backend, graph, textures, frame);
+                RenderGraphStats stats = graph.GetStats();
+                assert(stats.num_levels == u32(5));
+                assert(graph.GetScheduledPass(1).GetLevel() == graph.GetScheduledPass(2).GetLevel());
+                assert(stats.num_barrier_batches == stats.num_levels);
+                assert(stats.num_transients == u32(5));
+                assert(backend.CanAliasMemory() || stats.num_physical == u32(3));
+                assert(stats.transient_bytes_shared < stats.transient_bytes);
+                assert(backend.num_stale_reads == u32(0));
+                // B and C read a in the same level, it's transitioned once
+                u32 num_a = u32(0);
+                for (auto &b : graph.GetBarriers(u32(1))) num_a += b.resource == u32(0) ? u32(1) : u32(0);
+                assert(num_a == u32(1));
+                // Same frame again reuses every backend texture
+                u32 num_created = backend.num_created;
+                run(NULL, backend, graph, textures, frame);
+                assert(backend.num_created == num_created && graph.GetStats().num_created == u32(0));
+            }
+            assert(backend.num_created == backend.num_destroyed);
+        }
+    }
+    // Writers of the same texture are serialized and get a UAV barrier between them
+    {
+        std::vector<FrameTexture> textures = {tex2d("acc", 16)};
+        std::vector<FramePass>    frame    = {{"Clear", {}, {0}}, {"Accumulate0", {0}, {0}}, {"Accumulate1", {0}, {0}}, {"Resolve", {0}, {}}};
+        NullRenderGraphBackend    backend(true);
+        RenderGraph               graph(&backend);
+        run(NULL, backend, graph, textures, frame);
+        assert(graph.GetStats().num_levels == u32(4));
+        assert(graph.GetBarriers(u32(1)).size() == size_t(1) && graph.GetBarriers(u32(1))[0].before == RG_STATE_UNORDERED_ACCESS);
+        assert(backend.num_stale_reads == u32(0));
+    }
+    // Roughly the per-frame chain of experiments/ddgi_experiment.cpp at 1080p, history textures are imported
+    {
+        std::vector<FrameTexture> textures = {
+            imported("visibility"),            // 0
+            imported("gbuffer_normals"),       // 1
+            imported("gbuffer_position"),      // 2
+            tex2d("gbuffer_roughness", 1),     // 3
+            tex2d("gbuffer_encoded", 4),       // 4
+            tex2d("background", 4),            // 5
+            tex2d("disocclusion", 4),          // 6
+            tex2d("nearest_velocity", 8),      // 7
+            tex2d("raw_gi", 8),                // 8
+            tex2d("primary_rays", 8),          // 9
+            tex2d("reflections", 8),           // 10
+            imported("reflections_history"),   // 11
+            tex2d("ao", 8),                    // 12
+            tex2d("prefiltered_ao", 8),        // 13
+            imported("temporal_ao"),           // 14
+            tex2d("spatial_ao", 8),            // 15
+            imported("spatial_ao_large"),      // 16
+            imported("final_ao"),              // 17
+            imported("ddgi_atlas"),            // 18
+            tex2d("diffuse_gi", 8),            // 19
+            imported("color"),                 // 20
+        };
+        std::vector<FramePass> frame = {
+            {"GBufferFromVisibility", {0}, {1, 2, 3}},             //
+            {"EncodeGBuffer", {1, 2, 3}, {4, 5}},                  //
+            {"Discclusion", {1, 2}, {6}},                          //
+            {"NearestVelocity", {0}, {7}},                         //
+            {"Raw_PerPixelGI", {4, 18}, {8}},                      //
+            {"PrimaryRays", {4}, {9}},                             //
+            {"Raw_GGX_Reflections", {4, 6}, {10}},                 //
+            {"ReflectionsReproject", {10, 7, 6}, {11}},            //
+            {"AOPass", {4}, {12}},                                 //
+            {"PreFilterAO", {12, 4}, {13}},                        //
+            {"TemporalFilter", {13, 16, 7, 6}, {14}},              //
+            {"SpatialFilter", {14, 4}, {15}},                      //
+            {"SpatialFilterLarge", {15, 4}, {16}},                 //
+            {"TemporalFilterFinal", {16, 7, 6}, {17}},             //
+            {"DDGI", {8, 18}, {18, 19}},                           //
+            {"Shade", {4, 5, 9, 11, 17, 19}, {20}},                //
+        };
+        ifor(2) {
+            NullRenderGraphBackend backend(i == 0);
+            RenderGraph            graph(&backend);
+            run(i == 0 ? "ddgi, placed" : "ddgi, shared textures", backend, graph, textures, frame);
+            assert(backend.num_stale_reads == u32(0));
+            assert(graph.GetStats().transient_bytes_shared <= graph.GetStats().transient_bytes);
+        }
+    }
+}
+
+} // namespace GfxJit
+
+#endif // RENDER_GRAPH_HPP
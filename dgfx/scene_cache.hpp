@@ -0,0 +1,483 @@
+// MIT License
+//
+// Copyright (c) 2023 Anton Schreiner
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined(SCENE_CACHE_HPP)
+#    define SCENE_CACHE_HPP
+
+#    include "common.h"
+
+#    include <algorithm>
+#    include <atomic>
+#    include <cassert>
+#    include <cstring>
+#    include <filesystem>
+#    include <fstream>
+#    include <string>
+#    include <thread>
+#    include <vector>
+
+#    if defined(_WIN32)
+#        if !defined(WIN32_LEAN_AND_MEAN)
+#            define WIN32_LEAN_AND_MEAN
+#        endif
+#        include <windows.h>
+#    else
+#        include <fcntl.h>
+#        include <sys/mman.h>
+#        include <sys/stat.h>
+#        include <unistd.h>
+#    endif
+
+namespace GfxJit {
+
+// Layouts match Vertex/Mesh/Material/Instance on the GPU side, the arrays are uploaded as is
+struct SceneCacheVertex {
+    f32x4 position = {};
+    f32x4 normal   = {};
+    f32x2 uv       = {};
+};
+struct SceneCacheMesh {
+    u32 count       = u32(0);
+    u32 first_index = u32(0);
+    u32 base_vertex = u32(0);
+    u32 material_id = u32(0);
+};
+struct SceneCacheMaterial {
+    f32x4 albedo                = {};
+    f32x4 metallicity_roughness = {};
+    f32x4 ao_normal_emissivity  = {};
+};
+struct SceneCacheInstance {
+    u32 mesh_id = u32(0);
+};
+
+// One mesh of the imported scene. Vertex attributes are strided so both GfxVertex arrays and glTF accessors can feed it without a copy.
+struct SceneCacheMeshSource {
+    u32 const *indices         = NULL;
+    u32        num_indices     = u32(0);
+    u8 const  *positions       = NULL; // f32x3
+    u8 const  *normals         = NULL; // f32x3, optional
+    u8 const  *uvs             = NULL; // f32x2, optional
+    u32        position_stride = u32(0);
+    u32        normal_stride   = u32(0);
+    u32        uv_stride       = u32(0);
+    u32        num_vertices    = u32(0);
+    u32        material_id     = u32(0);
+};
+struct SceneCacheSource {
+    std::vector<SceneCacheMeshSource> meshes     = {}; // Indexed by mesh id
+    std::vector<SceneCacheMaterial>   materials  = {};
+    std::vector<SceneCacheInstance>   instances  = {};
+    std::vector<f32x4x4>              transforms = {}; // Per instance
+};
+
+// Flattened arrays, either built from a source or pointing into a mapped cache file
+struct SceneCacheData {
+    std::vector<u32>                storage_indices    = {};
+    std::vector<SceneCacheVertex>   storage_vertices   = {};
+    std::vector<SceneCacheMesh>     storage_meshes     = {};
+    std::vector<SceneCacheMaterial> storage_materials  = {};
+    std::vector<SceneCacheInstance> storage_instances  = {};
+    std::vector<f32x4x4>            storage_transforms = {};
+
+    u32 const                *indices       = NULL;
+    SceneCacheVertex const   *vertices      = NULL;
+    SceneCacheMesh const     *meshes        = NULL;
+    SceneCacheMaterial const *materials     = NULL;
+    SceneCacheInstance const *instances     = NULL;
+    f32x4x4 const            *transforms    = NULL;
+    u32                       num_indices   = u32(0);
+    u32                       num_vertices  = u32(0);
+    u32                       num_meshes    = u32(0);
+    u32                       num_materials = u32(0);
+    u32                       num_instances = u32(0);
+    f32x3                     aabb_min      = f32x3(f32(1.0e6));
+    f32x3                     aabb_max      = f32x3(f32(-1.0e6));
+
+    void PointToStorage() {
+        indices       = storage_indices.data();
+        vertices      = storage_vertices.data();
+        meshes        = storage_meshes.data();
+        materials     = storage_materials.data();
+        instances     = storage_instances.data();
+        transforms    = storage_transforms.data();
+        num_indices   = u32(storage_indices.size());
+        num_vertices  = u32(storage_vertices.size());
+        num_meshes    = u32(storage_meshes.size());
+        num_materials = u32(storage_materials.size());
+        num_instances = u32(storage_instances.size());
+    }
+    // Meshes own [base_vertex, base_vertex of the next mesh), the way BuildSceneCacheData lays them out
+    u32 GetNumMeshVertices(u32 _mesh_id) const { return (_mesh_id + u32(1) < num_meshes ? meshes[_mesh_id + u32(1)].base_vertex : num_vertices) - meshes[_mesh_id].base_vertex; }
+};
+
+static AABB GetEmptyAABB() { return AABB{f32x3(f32(1.0e30)), f32x3(f32(-1.0e30))}; }
+static bool IsAABBEmpty(AABB const &_aabb) { return _aabb.lo.x > _aabb.hi.x || _aabb.lo.y > _aabb.hi.y || _aabb.lo.z > _aabb.hi.z; }
+
+// Arvo's transformed box. Same as the bounds of all 8 transformed corners, _transform is affine and takes column vectors.
+static AABB TransformAABB(f32x4x4 const &_transform, AABB const &_aabb) {
+    AABB out = {f32x3(_transform[3]), f32x3(_transform[3])};
+    xfor(3) yfor(3) {
+        f32 a = _transform[x][y] * _aabb.lo[x];
+        f32 b = _transform[x][y] * _aabb.hi[x];
+        out.lo[y] += std::min(a, b);
+        out.hi[y] += std::max(a, b);
+    }
+    return out;
+}
+
+// Object space bounds per mesh id, empty meshes get an empty box
+static void ComputeMeshBounds(SceneCacheData const &_data, std::vector<AABB> &_mesh_bounds, u32 _num_threads = u32(0)) {
+    _mesh_bounds.assign(_data.num_meshes, GetEmptyAABB());
+    std::atomic<u32> next   = {u32(0)};
+    auto             worker = [&] {
+        while (true) {
+            u32 mesh_id = next.fetch_add(u32(1));
+            if (mesh_id >= _data.num_meshes) break;
+            u32  begin = _data.meshes[mesh_id].base_vertex;
+            u32  end   = begin + _data.GetNumMeshVertices(mesh_id);
+            AABB aabb  = GetEmptyAABB();
+            for (u32 v = begin; v < end; v++) aabb.expand(f32x3(_data.vertices[v].position));
+            _mesh_bounds[mesh_id] = aabb;
+        }
+    };
+    if (_num_threads == u32(0)) _num_threads = std::max(u32(1), u32(std::thread::hardware_concurrency()));
+    _num_threads = std::min(_num_threads, std::max(_data.num_meshes, u32(1)));
+    std::vector<std::thread> threads = {};
+    ifor(_num_threads - u32(1)) threads.emplace_back(worker);
+    worker();
+    for (auto &t : threads) t.join();
+}
+
+// World space bounds per instance id and their union. Instances of an empty or missing mesh get an empty box and don't grow the scene box.
+// Instances are handed out in chunks, every worker keeps its own scene box and they're merged at the end.
+static void ComputeInstanceBounds(SceneCacheData const &_data, std::vector<AABB> const &_mesh_bounds, std::vector<AABB> &_instance_bounds, AABB &_scene_bounds,
+                                  u32 _num_threads = u32(0)) {
+    static constexpr u32 CHUNK_SIZE = u32(256);
+
+    _instance_bounds.resize(_data.num_instances);
+    u32 num_chunks = (_data.num_instances + CHUNK_SIZE - u32(1)) / CHUNK_SIZE;
+    if (_num_threads == u32(0)) _num_threads = std::max(u32(1), u32(std::thread::hardware_concurrency()));
+    _num_threads                    = std::min(_num_threads, std::max(num_chunks, u32(1)));
+    std::vector<AABB> thread_bounds = std::vector<AABB>(_num_threads, GetEmptyAABB());
+    std::atomic<u32>  next          = {u32(0)};
+    auto              worker        = [&](u32 _thread_idx) {
+        AABB scene = GetEmptyAABB();
+        while (true) {
+            u32 chunk = next.fetch_add(u32(1));
+            if (chunk >= num_chunks) break;
+            u32 end = std::min(_data.num_instances, (chunk + u32(1)) * CHUNK_SIZE);
+            for (u32 i = chunk * CHUNK_SIZE; i < end; i++) {
+                u32 mesh_id = _data.instances[i].mesh_id;
+                if (mesh_id >= u32(_mesh_bounds.size()) || IsAABBEmpty(_mesh_bounds[mesh_id])) {
+                    _instance_bounds[i] = GetEmptyAABB();
+                    continue;
+                }
+                _instance_bounds[i] = TransformAABB(_data.transforms[i], _mesh_bounds[mesh_id]);
+                scene.expand(_instance_bounds[i]);
+            }
+        }
+        thread_bounds[_thread_idx] = scene;
+    };
+    std::vector<std::thread> threads = {};
+    ifor(_num_threads - u32(1)) threads.emplace_back(worker, i + u32(1));
+    worker(u32(0));
+    for (auto &t : threads) t.join();
+    _scene_bounds = GetEmptyAABB();
+    for (AABB const &b : thread_bounds) _scene_bounds.expand(b);
+}
+
+// Flattens the source. Offsets are assigned up front so the output arrays are sized once and every mesh is converted by whichever worker picks it up.
+static void BuildSceneCacheData(SceneCacheSource const &_source, SceneCacheData &_data, u32 _num_threads = u32(0)) {
+    _data = {};
+    u32 num_meshes = u32(_source.meshes.size());
+    _data.storage_meshes.resize(num_meshes);
+    u64 num_indices  = u64(0);
+    u64 num_vertices = u64(0);
+    ifor(num_meshes) {
+        SceneCacheMesh &mesh = _data.storage_meshes[i];
+        mesh.count           = _source.meshes[i].num_indices;
+        mesh.first_index     = u32(num_indices);
+        mesh.base_vertex     = u32(num_vertices);
+        mesh.material_id     = _source.meshes[i].material_id;
+        num_indices += u64(_source.meshes[i].num_indices);
+        num_vertices += u64(_source.meshes[i].num_vertices);
+    }
+    assert(num_indices < u64(u32(-1)) && num_vertices < u64(u32(-1)));
+    _data.storage_indices.resize(num_indices);
+    _data.storage_vertices.resize(num_vertices);
+
+    std::vector<AABB> mesh_bounds = std::vector<AABB>(num_meshes, GetEmptyAABB());
+    std::atomic<u32>  next        = {u32(0)};
+    auto              worker      = [&] {
+        while (true) {
+            u32 mesh_id = next.fetch_add(u32(1));
+            if (mesh_id >= num_meshes) break;
+            SceneCacheMeshSource const &src = _source.meshes[mesh_id];
+            SceneCacheMesh const       &dst = _data.storage_meshes[mesh_id];
+            if (src.num_indices) memcpy(&_data.storage_indices[dst.first_index], src.indices, sizeof(u32) * src.num_indices);
+            SceneCacheVertex *vertices = _data.storage_vertices.data() + dst.base_vertex;
+            AABB              aabb     = GetEmptyAABB();
+            ifor(src.num_vertices) {
+                f32x3 p = {}, n = {};
+                f32x2 uv = {};
+                memcpy(&p, src.positions + u64(src.position_stride) * i, sizeof(f32x3));
+                if (src.normals) memcpy(&n, src.normals + u64(src.normal_stride) * i, sizeof(f32x3));
+                if (src.uvs) memcpy(&uv, src.uvs + u64(src.uv_stride) * i, sizeof(f32x2));
+                vertices[i].position = f32x4(p, f32(1.0));
+                vertices[i].normal   = f32x4(n, f32(0.0));
+                vertices[i].uv       = uv;
+                aabb.expand(p);
+            }
+            mesh_bounds[mesh_id] = aabb;
+        }
+    };
+    if (_num_threads == u32(0)) _num_threads = std::max(u32(1), u32(std::thread::hardware_concurrency()));
+    _num_threads = std::min(_num_threads, std::max(num_meshes, u32(1)));
+    std::vector<std::thread> threads = {};
+    ifor(_num_threads - u32(1)) threads.emplace_back(worker);
+    worker();
+    for (auto &t : threads) t.join();
+
+    _data.storage_materials  = _source.materials;
+    _data.storage_instances  = _source.instances;
+    _data.storage_transforms = _source.transforms;
+    _data.PointToStorage();
+
+    std::vector<AABB> instance_bounds = {};
+    AABB              scene_bounds    = {};
+    ComputeInstanceBounds(_data, mesh_bounds, instance_bounds, scene_bounds, _num_threads);
+    if (!IsAABBEmpty(scene_bounds)) {
+        _data.aabb_min = scene_bounds.lo;
+        _data.aabb_max = scene_bounds.hi;
+    }
+}
+
+// Read only file mapping
+class SceneCacheMappedFile {
+private:
+    u8 const *data = NULL;
+    u64       size = u64(0);
+#    if defined(_WIN32)
+    HANDLE file    = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#    endif
+
+public:
+    SceneCacheMappedFile() = default;
+    ~SceneCacheMappedFile() { Close(); }
+    SceneCacheMappedFile(SceneCacheMappedFile const &)            = delete;
+    SceneCacheMappedFile &operator=(SceneCacheMappedFile const &) = delete;
+
+    bool Open(char const *_path) {
+        Close();
+#    if defined(_WIN32)
+        file = CreateFileA(_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER file_size = {};
+        if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+            Close();
+            return false;
+        }
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!mapping) {
+            Close();
+            return false;
+        }
+        data = (u8 const *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        size = u64(file_size.QuadPart);
+#    else
+        int fd = open(_path, O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st = {};
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            return false;
+        }
+        void *ptr = mmap(NULL, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (ptr == MAP_FAILED) return false;
+        data = (u8 const *)ptr;
+        size = u64(st.st_size);
+#    endif
+        if (!data) {
+            Close();
+            return false;
+        }
+        return true;
+    }
+    void Close() {
+#    if defined(_WIN32)
+        if (data) UnmapViewOfFile(data);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = NULL;
+        file    = INVALID_HANDLE_VALUE;
+#    else
+        if (data) munmap((void *)data, size_t(size));
+#    endif
+        data = NULL;
+        size = u64(0);
+    }
+    u8 const *GetData() const { return data; }
+    u64       GetSize() const { return size; }
+};
+
+// Versioned binary cache of SceneCacheData.
+// The file is a header followed by 64 byte aligned sections, a valid file is mapped and the arrays are used in place.
+// source_key identifies the imported files, anything with a different key, version or inconsistent section table is treated as a miss.
+class SceneCache {
+private:
+    static constexpr u32 MAGIC        = u32(0x43435353); // 'SSCC'
+    static constexpr u32 VERSION      = u32(2);
+    static constexpr u64 ALIGNMENT    = u64(64);
+    static constexpr u32 NUM_SECTIONS = u32(6);
+
+    struct Section {
+        u64 offset = u64(0);
+        u64 count  = u64(0);
+        u32 stride = u32(0);
+        u32 pad    = u32(0);
+    };
+    struct Header {
+        u32     magic                  = MAGIC;
+        u32     version                = VERSION;
+        u64     source_key             = u64(0);
+        f32     aabb_min[3]            = {};
+        f32     aabb_max[3]            = {};
+        Section sections[NUM_SECTIONS] = {};
+    };
+
+    SceneCacheMappedFile file = {};
+
+    static u64 AlignUp(u64 _v) { return (_v + ALIGNMENT - u64(1)) & ~(ALIGNMENT - u64(1)); }
+
+public:
+    // Path, size and write time of the scene file and every .bin next to it
+    static u64 GetSourceKey(char const *_path) {
+        auto mix = [](u64 _h, u64 _v) { return (_h ^ _v) * u64(0x100000001b3); };
+        u64  h   = mix(u64(0xcbf29ce484222325), u64(VERSION));
+        for (char const *c = _path; *c; c++) h = mix(h, u64(u8(*c)));
+        std::error_code       ec   = {};
+        std::filesystem::path path = std::filesystem::path(_path);
+        auto                  add  = [&](std::filesystem::path const &_p) {
+            h = mix(h, u64(std::filesystem::file_size(_p, ec)));
+            h = mix(h, u64(std::filesystem::last_write_time(_p, ec).time_since_epoch().count()));
+        };
+        add(path);
+        std::vector<std::filesystem::path> bins = {};
+        for (auto &e : std::filesystem::directory_iterator(path.parent_path().empty() ? std::filesystem::path(".") : path.parent_path(), ec))
+            if (e.path().extension() == ".bin") bins.push_back(e.path());
+        std::sort(bins.begin(), bins.end());
+        for (auto &b : bins) add(b);
+        return h;
+    }
+    // Written to a temporary and renamed so a reader never maps a partial file
+    static bool Write(char const *_path, u64 _source_key, SceneCacheData const &_data) {
+        Header header     = {};
+        header.source_key = _source_key;
+        xfor(3) {
+            header.aabb_min[x] = _data.aabb_min[x];
+            header.aabb_max[x] = _data.aabb_max[x];
+        }
+        void const *ptrs[NUM_SECTIONS]    = {_data.indices, _data.vertices, _data.meshes, _data.materials, _data.instances, _data.transforms};
+        u64         counts[NUM_SECTIONS]  = {_data.num_indices, _data.num_vertices, _data.num_meshes, _data.num_materials, _data.num_instances, _data.num_instances};
+        u32         strides[NUM_SECTIONS] = {u32(sizeof(u32)), u32(sizeof(SceneCacheVertex)), u32(sizeof(SceneCacheMesh)), u32(sizeof(SceneCacheMaterial)),
+                                             u32(sizeof(SceneCacheInstance)), u32(sizeof(f32x4x4))};
+        u64 offset = AlignUp(sizeof(Header));
+        ifor(NUM_SECTIONS) {
+            header.sections[i].offset = offset;
+            header.sections[i].count  = counts[i];
+            header.sections[i].stride = strides[i];
+            offset                    = AlignUp(offset + counts[i] * u64(strides[i]));
+        }
+
+        std::error_code ec  = {};
+        std::string     tmp = std::string(_path) + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            if (!out.is_open()) return false;
+            static u8 const zeros[ALIGNMENT] = {};
+            u64             pos              = u64(0);
+            auto            put              = [&](void const *_ptr, u64 _size) {
+                out.write((char const *)_ptr, std::streamsize(_size));
+                pos += _size;
+            };
+            put(&header, sizeof(header));
+            ifor(NUM_SECTIONS) {
+                put(zeros, header.sections[i].offset - pos);
+                if (counts[i]) put(ptrs[i], counts[i] * u64(strides[i]));
+            }
+            if (!out) {
+                out.close();
+                std::filesystem::remove(tmp, ec);
+                return false;
+            }
+        }
+        std::filesystem::rename(tmp, _path, ec);
+        if (ec) std::filesystem::remove(tmp, ec);
+        return !ec;
+    }
+    // Maps the file, _data points into the mapping until Close or the next Open
+    bool Open(char const *_path, u64 _source_key, SceneCacheData &_data) {
+        _data = {};
+        if (!file.Open(_path)) return false;
+        Header header = {};
+        if (file.GetSize() < sizeof(Header)) return Fail();
+        memcpy(&header, file.GetData(), sizeof(Header));
+        if (header.magic != MAGIC || header.version != VERSION || header.source_key != _source_key) return Fail();
+        u32 strides[NUM_SECTIONS] = {u32(sizeof(u32)), u32(sizeof(SceneCacheVertex)), u32(sizeof(SceneCacheMesh)), u32(sizeof(SceneCacheMaterial)),
+                                     u32(sizeof(SceneCacheInstance)), u32(sizeof(f32x4x4))};
+        ifor(NUM_SECTIONS) {
+            Section const &s = header.sections[i];
+            if (s.stride != strides[i] || s.offset % ALIGNMENT != u64(0) || s.count >= u64(u32(-1))) return Fail();
+            if (s.offset > file.GetSize() || s.count * u64(s.stride) > file.GetSize() - s.offset) return Fail();
+        }
+        if (header.sections[4].count != header.sections[5].count) return Fail();
+        u8 const *base      = file.GetData();
+        _data.indices       = (u32 const *)(base + header.sections[0].offset);
+        _data.vertices      = (SceneCacheVertex const *)(base + header.sections[1].offset);
+        _data.meshes        = (SceneCacheMesh const *)(base + header.sections[2].offset);
+        _data.materials     = (SceneCacheMaterial const *)(base + header.sections[3].offset);
+        _data.instances     = (SceneCacheInstance const *)(base + header.sections[4].offset);
+        _data.transforms    = (f32x4x4 const *)(base + header.sections[5].offset);
+        _data.num_indices   = u32(header.sections[0].count);
+        _data.num_vertices  = u32(header.sections[1].count);
+        _data.num_meshes    = u32(header.sections[2].count);
+        _data.num_materials = u32(header.sections[3].count);
+        _data.num_instances = u32(header.sections[4].count);
+        _data.aabb_min      = f32x3(header.aabb_min[0], header.aabb_min[1], header.aabb_min[2]);
+        _data.aabb_max      = f32x3(header.aabb_max[0], header.aabb_max[1], header.aabb_max[2]);
+        return true;
+    }
+    void Close() { file.Close(); }
+
+private:
+    bool Fail() {
+        file.Close();
+        return false;
+    }
+};
+
+} // namespace GfxJit
+
+#endif // SCENE_CACHE_HPP
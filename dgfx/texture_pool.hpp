@@ -0,0 +1,256 @@
+// MIT License
+//
+// Copyright (c) 2023 Anton Schreiner
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined(TEXTURE_POOL_HPP)
+#    define TEXTURE_POOL_HPP
+
+#    include "common.h"
+
+#    include <cassert>
+#    include <unordered_map>
+#    include <vector>
+
+namespace GfxJit {
+
+using TexturePoolHandle = u64;
+
+enum TexturePoolUsage : u32 {
+    TEXTURE_POOL_USAGE_SAMPLED       = u32(1) << u32(0),
+    TEXTURE_POOL_USAGE_STORAGE       = u32(1) << u32(1),
+    TEXTURE_POOL_USAGE_RENDER_TARGET = u32(1) << u32(2),
+};
+
+struct TexturePoolKey {
+    u32 width      = u32(1);
+    u32 height     = u32(1);
+    u32 depth      = u32(1);
+    u32 mip_levels = u32(1);
+    u32 format     = u32(0); // DXGI_FORMAT on the gfx backend
+    u32 usage      = TEXTURE_POOL_USAGE_SAMPLED | TEXTURE_POOL_USAGE_STORAGE;
+
+    bool operator==(TexturePoolKey const &that) const {
+        return width == that.width && height == that.height && depth == that.depth && mip_levels == that.mip_levels && format == that.format && usage == that.usage;
+    }
+    bool operator!=(TexturePoolKey const &that) const { return !(*this == that); }
+
+    struct Hasher {
+        size_t operator()(TexturePoolKey const &_key) const {
+            u64 h = u64(0xcbf29ce484222325);
+            for (u32 v : {_key.width, _key.height, _key.depth, _key.mip_levels, _key.format, _key.usage}) h = (h ^ u64(v)) * u64(0x100000001b3);
+            return size_t(h);
+        }
+    };
+};
+
+class ITexturePoolDevice {
+public:
+    virtual TexturePoolHandle CreateTexture(TexturePoolKey const &_key) = 0;
+    virtual void              DestroyTexture(TexturePoolHandle _texture) = 0;
+    virtual ~ITexturePoolDevice() {}
+};
+
+struct TexturePoolStats {
+    u64 num_requests    = u64(0);
+    u64 num_hits        = u64(0);
+    u64 num_allocations = u64(0);
+    u64 num_evictions   = u64(0);
+
+    f64 GetHitRate() const { return num_requests ? f64(num_hits) / f64(num_requests) : f64(0.0); }
+};
+
+// Textures keyed by (dims, format, mips, usage). A released texture goes back to the free list of its key and is handed out again to the next request with the same
+// key, in the same frame or a later one. Free textures that weren't reused for max_idle_frames frames are destroyed by EndFrame.
+class TexturePool {
+private:
+    struct Entry {
+        TexturePoolKey    key             = {};
+        TexturePoolHandle handle          = TexturePoolHandle(0);
+        u64               last_used_frame = u64(0);
+        bool              in_use          = false;
+    };
+
+    ITexturePoolDevice                                                          *device          = NULL;
+    std::vector<Entry>                                                           entries         = {};
+    std::vector<u32>                                                             free_entries    = {};
+    std::unordered_map<TexturePoolKey, std::vector<u32>, TexturePoolKey::Hasher> free_lists      = {};
+    std::unordered_map<TexturePoolHandle, u32>                                   entry_of        = {};
+    u64                                                                          frame_idx       = u64(0);
+    u32                                                                          max_idle_frames = u32(0);
+    TexturePoolStats                                                             frame_stats     = {};
+    TexturePoolStats                                                             last_frame      = {};
+    TexturePoolStats                                                             total           = {};
+
+    void Destroy(u32 _entry) {
+        device->DestroyTexture(entries[_entry].handle);
+        entry_of.erase(entries[_entry].handle);
+        entries[_entry] = {};
+        free_entries.push_back(_entry);
+    }
+
+public:
+    TexturePool(ITexturePoolDevice *_device, u32 _max_idle_frames = u32(8)) : device(_device), max_idle_frames(_max_idle_frames) {}
+    ~TexturePool() { Release(); }
+    TexturePool(TexturePool const &)            = delete;
+    TexturePool &operator=(TexturePool const &) = delete;
+
+    TexturePoolHandle Acquire(TexturePoolKey const &_key) {
+        frame_stats.num_requests++;
+        u32  idx = u32(-1);
+        auto it  = free_lists.find(_key);
+        if (it != free_lists.end() && it->second.size()) {
+            frame_stats.num_hits++;
+            idx = it->second.back();
+            it->second.pop_back();
+        } else {
+            frame_stats.num_allocations++;
+            if (free_entries.size()) {
+                idx = free_entries.back();
+                free_entries.pop_back();
+            } else {
+                idx = u32(entries.size());
+                entries.push_back({});
+            }
+            entries[idx].key              = _key;
+            entries[idx].handle           = device->CreateTexture(_key);
+            entry_of[entries[idx].handle] = idx;
+        }
+        entries[idx].in_use          = true;
+        entries[idx].last_used_frame = frame_idx;
+        return entries[idx].handle;
+    }
+    void Release(TexturePoolHandle _texture) {
+        auto it = entry_of.find(_texture);
+        assert(it != entry_of.end());
+        Entry &e = entries[it->second];
+        assert(e.in_use);
+        e.in_use          = false;
+        e.last_used_frame = frame_idx;
+        free_lists[e.key].push_back(it->second);
+    }
+    // Evicts textures that sat in the free lists for longer than max_idle_frames
+    void EndFrame() {
+        for (auto &l : free_lists) {
+            auto &list = l.second;
+            for (size_t i = size_t(0); i < list.size();) {
+                if (frame_idx - entries[list[i]].last_used_frame >= u64(max_idle_frames)) {
+                    Destroy(list[i]);
+                    list[i] = list.back();
+                    list.pop_back();
+                    frame_stats.num_evictions++;
+                } else {
+                    i++;
+                }
+            }
+        }
+        total.num_requests += frame_stats.num_requests;
+        total.num_hits += frame_stats.num_hits;
+        total.num_allocations += frame_stats.num_allocations;
+        total.num_evictions += frame_stats.num_evictions;
+        last_frame  = frame_stats;
+        frame_stats = {};
+        frame_idx++;
+    }
+    // Destroys everything, textures still in use included
+    void Release() {
+        for (auto &e : entries)
+            if (e.handle) device->DestroyTexture(e.handle);
+        entries.clear();
+        free_entries.clear();
+        free_lists.clear();
+        entry_of.clear();
+    }
+    TexturePoolStats const &GetLastFrameStats() const { return last_frame; }
+    TexturePoolStats const &GetTotalStats() const { return total; }
+    u32                     GetNumTextures() const { return u32(entry_of.size()); }
+
+    static void Test() {
+        struct FakeDevice : public ITexturePoolDevice {
+            u64 num_created = u64(0);
+            u64 num_alive   = u64(0);
+
+            TexturePoolHandle CreateTexture(TexturePoolKey const &_key) override {
+                num_alive++;
+                return TexturePoolHandle(++num_created);
+            }
+            void DestroyTexture(TexturePoolHandle _texture) override {
+                assert(num_alive > u64(0));
+                num_alive--;
+            }
+        };
+        FakeDevice device = {};
+        {
+            TexturePool    pool = TexturePool(&device, u32(3));
+            TexturePoolKey hd   = {};
+            hd.width            = u32(1920);
+            hd.height           = u32(1080);
+            hd.format           = u32(10);
+            TexturePoolKey half = hd;
+            half.width /= u32(2);
+            half.height /= u32(2);
+
+            // Steady state: a persistent texture plus two transients that are released mid frame and reused by later passes
+            TexturePoolHandle persistent = TexturePoolHandle(0);
+            ifor(16) {
+                if (persistent) pool.Release(persistent);
+                persistent          = pool.Acquire(hd);
+                TexturePoolHandle a = pool.Acquire(half);
+                pool.Release(a);
+                TexturePoolHandle b = pool.Acquire(half);
+                assert(a == b);
+                pool.Release(b);
+                pool.EndFrame();
+                if (i > u32(0)) {
+                    assert(pool.GetLastFrameStats().num_allocations == u64(0));
+                    assert(pool.GetLastFrameStats().GetHitRate() == f64(1.0));
+                }
+            }
+            assert(device.num_created == u64(2));
+
+            // Resize: the old size goes idle and is evicted after max_idle_frames
+            TexturePoolKey resized = hd;
+            resized.width          = u32(2560);
+            resized.height         = u32(1440);
+            pool.Release(persistent);
+            persistent = pool.Acquire(resized);
+            pool.EndFrame();
+            assert(pool.GetLastFrameStats().num_allocations == u64(1));
+            ifor(4) pool.EndFrame();
+            assert(pool.GetNumTextures() == u32(1));
+            assert(device.num_alive == u64(1));
+
+            // Different usage doesn't alias
+            TexturePoolKey rt = resized;
+            rt.usage          = TEXTURE_POOL_USAGE_RENDER_TARGET;
+            pool.Release(persistent);
+            TexturePoolHandle t = pool.Acquire(rt);
+            assert(t != persistent);
+            pool.Release(t);
+            pool.EndFrame();
+            assert(pool.GetTotalStats().num_hits > pool.GetTotalStats().num_allocations);
+        }
+        assert(device.num_alive == u64(0));
+    }
+};
+
+} // namespace GfxJit
+
+#endif // TEXTURE_POOL_HPP
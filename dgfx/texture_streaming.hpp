@@ -0,0 +1,786 @@
+// MIT License
+//
+// Copyright (c) 2023 Anton Schreiner
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined(TEXTURE_STREAMING_HPP)
+#    define TEXTURE_STREAMING_HPP
+
+#    include "common.h"
+#    include "scene_cache.hpp"
+
+#    include <algorithm>
+#    include <array>
+#    include <atomic>
+#    include <cassert>
+#    include <cmath>
+#    include <condition_variable>
+#    include <cstring>
+#    include <filesystem>
+#    include <fstream>
+#    include <mutex>
+#    include <queue>
+#    include <string>
+#    include <thread>
+#    include <vector>
+
+namespace GfxJit {
+
+enum TextureStreamFormat : u32 {
+    TEXTURE_STREAM_FORMAT_UNSUPPORTED = u32(0),
+    TEXTURE_STREAM_FORMAT_UNORM8,
+    TEXTURE_STREAM_FORMAT_UNORM8_SRGB, // Filtered in linear space, alpha stays linear
+    TEXTURE_STREAM_FORMAT_F32,
+};
+
+enum TextureMipFilter : u32 {
+    TEXTURE_MIP_FILTER_BOX = u32(0),
+    TEXTURE_MIP_FILTER_KAISER,
+};
+
+static u32 GetTextureMipCount(u32 _width, u32 _height) {
+    u32 num_mips = u32(1);
+    while ((std::max(_width, _height) >> num_mips) != u32(0)) num_mips++;
+    return num_mips;
+}
+static u32 GetTextureMipSize(u32 _size, u32 _mip) { return std::max(u32(1), _size >> _mip); }
+static u32 GetTextureStreamBytesPerChannel(u32 _stream_format) {
+    switch (_stream_format) {
+    case TEXTURE_STREAM_FORMAT_UNORM8:
+    case TEXTURE_STREAM_FORMAT_UNORM8_SRGB: return u32(1);
+    case TEXTURE_STREAM_FORMAT_F32: return u32(4);
+    default: return u32(0);
+    }
+}
+// Bytes of _first_mip and every smaller mip, tightly packed
+static u64 GetTextureMipChainSize(u32 _width, u32 _height, u32 _bytes_per_pixel, u32 _first_mip) {
+    u64 size = u64(0);
+    for (u32 mip = _first_mip; mip < GetTextureMipCount(_width, _height); mip++) size += u64(GetTextureMipSize(_width, mip)) * u64(GetTextureMipSize(_height, mip)) * u64(_bytes_per_pixel);
+    return size;
+}
+
+// pbr.frag writes 1 + TEXTURE_FEEDBACK_SCALE * -log2(uv footprint of a pixel), maxed over the pixels that sample a texture. 0 means nothing sampled it.
+static constexpr u32 TEXTURE_FEEDBACK_SCALE = u32(16);
+
+// Finest mip the feedback asks for, u32(-1) if the texture wasn't sampled
+static u32 GetTextureFeedbackMip(u32 _feedback, u32 _width, u32 _height, u32 _num_mips) {
+    if (_feedback == u32(0) || _num_mips == u32(0)) return u32(-1);
+    f32 lod = std::log2(f32(std::max(_width, _height))) - f32(_feedback - u32(1)) / f32(TEXTURE_FEEDBACK_SCALE);
+    return u32(glm::clamp(std::floor(lod), f32(0.0), f32(_num_mips - u32(1))));
+}
+
+static f32 SRGBToLinear(f32 _v) { return _v <= f32(0.04045) ? _v / f32(12.92) : std::pow((_v + f32(0.055)) / f32(1.055), f32(2.4)); }
+static f32 LinearToSRGB(f32 _v) { return _v <= f32(0.0031308) ? _v * f32(12.92) : f32(1.055) * std::pow(_v, f32(1.0 / 2.4)) - f32(0.055); }
+
+static void DecodeTexturePixels(u8 const *_src, u64 _num_pixels, u32 _channels, u32 _stream_format, f32 *_dst) {
+    static std::array<f32, 256> const srgb_to_linear = [] {
+        std::array<f32, 256> lut = {};
+        ifor(256) lut[i] = SRGBToLinear(f32(i) / f32(255.0));
+        return lut;
+    }();
+    u64 num_values = _num_pixels * u64(_channels);
+    if (_stream_format == TEXTURE_STREAM_FORMAT_F32) {
+        memcpy(_dst, _src, num_values * sizeof(f32));
+    } else if (_stream_format == TEXTURE_STREAM_FORMAT_UNORM8_SRGB) {
+        for (u64 i = u64(0); i < num_values; i++) _dst[i] = (_channels == u32(4) && (i & u64(3)) == u64(3)) ? f32(_src[i]) / f32(255.0) : srgb_to_linear[_src[i]];
+    } else {
+        for (u64 i = u64(0); i < num_values; i++) _dst[i] = f32(_src[i]) / f32(255.0);
+    }
+}
+static void EncodeTexturePixels(f32 const *_src, u64 _num_pixels, u32 _channels, u32 _stream_format, u8 *_dst) {
+    u64 num_values = _num_pixels * u64(_channels);
+    if (_stream_format == TEXTURE_STREAM_FORMAT_F32) {
+        memcpy(_dst, _src, num_values * sizeof(f32));
+        return;
+    }
+    bool srgb = _stream_format == TEXTURE_STREAM_FORMAT_UNORM8_SRGB;
+    for (u64 i = u64(0); i < num_values; i++) {
+        f32 v = glm::clamp(_src[i], f32(0.0), f32(1.0));
+        if (srgb && !(_channels == u32(4) && (i & u64(3)) == u64(3))) v = LinearToSRGB(v);
+        _dst[i] = u8(std::round(v * f32(255.0)));
+    }
+}
+
+// Weights of one axis for every destination pixel, clamped to the edge
+struct TextureMipTaps {
+    std::vector<u32> first   = {};
+    std::vector<u32> count   = {};
+    std::vector<u32> offset  = {}; // Into weights
+    std::vector<f32> weights = {};
+};
+
+static f64 GetBesselI0(f64 _x) {
+    f64 sum = f64(1.0), term = f64(1.0);
+    for (u32 k = u32(1); k < u32(32); k++) {
+        term *= (_x / (f64(2.0) * f64(k))) * (_x / (f64(2.0) * f64(k)));
+        sum += term;
+    }
+    return sum;
+}
+
+// Box: exact area coverage, also for odd sizes. Kaiser: windowed sinc over 3 destination pixels each side, alpha 4.
+static void GetTextureMipTaps(u32 _src, u32 _dst, TextureMipFilter _filter, TextureMipTaps &_taps) {
+    static constexpr f64 KAISER_RADIUS = f64(3.0);
+    static constexpr f64 KAISER_ALPHA  = f64(4.0);
+    static constexpr f64 PI            = f64(3.14159265358979323846);
+
+    _taps         = {};
+    f64 scale     = f64(_src) / f64(_dst);
+    f64 i0_alpha  = GetBesselI0(KAISER_ALPHA);
+    auto clamp_px = [&](i64 _i) { return u32(std::min(std::max(_i, i64(0)), i64(_src) - i64(1))); };
+    ifor(_dst) {
+        f64 lo = f64(i) * scale, hi = f64(i + u32(1)) * scale, center = (f64(i) + f64(0.5)) * scale;
+        i64 begin = i64(0), end = i64(0);
+        if (_filter == TEXTURE_MIP_FILTER_BOX) {
+            begin = i64(std::floor(lo));
+            end   = i64(std::ceil(hi));
+        } else {
+            begin = i64(std::floor(center - KAISER_RADIUS * scale));
+            end   = i64(std::ceil(center + KAISER_RADIUS * scale));
+        }
+        u32 first = clamp_px(begin);
+        u32 count = clamp_px(end - i64(1)) - first + u32(1);
+        u32 base  = u32(_taps.weights.size());
+        _taps.first.push_back(first);
+        _taps.count.push_back(count);
+        _taps.offset.push_back(base);
+        _taps.weights.resize(base + count, f32(0.0));
+        f64 sum = f64(0.0);
+        for (i64 s = begin; s < end; s++) {
+            f64 w = f64(0.0);
+            if (_filter == TEXTURE_MIP_FILTER_BOX) {
+                w = std::max(f64(0.0), std::min(hi, f64(s + 1)) - std::max(lo, f64(s)));
+            } else {
+                f64 t = (f64(s) + f64(0.5) - center) / scale;
+                if (std::abs(t) >= KAISER_RADIUS) continue;
+                f64 sinc   = t == f64(0.0) ? f64(1.0) : std::sin(PI * t) / (PI * t);
+                f64 x      = t / KAISER_RADIUS;
+                f64 window = GetBesselI0(KAISER_ALPHA * std::sqrt(std::max(f64(0.0), f64(1.0) - x * x))) / i0_alpha;
+                w          = sinc * window;
+            }
+            _taps.weights[base + clamp_px(s) - first] += f32(w);
+            sum += w;
+        }
+        if (sum != f64(0.0))
+            jfor(count) _taps.weights[base + j] = f32(f64(_taps.weights[base + j]) / sum);
+    }
+}
+
+// Interleaved f32 with _channels channels. Separable: rows are filtered first, then every destination row is a weighted sum of whole rows. Both inner loops run
+// over contiguous floats so the compiler vectorizes them.
+static void DownsampleTextureMip(f32 const *_src, u32 _src_width, u32 _src_height, u32 _channels, f32 *_dst, u32 _dst_width, u32 _dst_height,
+                                 TextureMipFilter _filter) {
+    TextureMipTaps tx = {}, ty = {};
+    GetTextureMipTaps(_src_width, _dst_width, _filter, tx);
+    GetTextureMipTaps(_src_height, _dst_height, _filter, ty);
+    u64              dst_pitch = u64(_dst_width) * u64(_channels);
+    std::vector<f32> rows      = std::vector<f32>(dst_pitch * u64(_src_height), f32(0.0));
+    yfor(_src_height) {
+        f32 const *src_row = _src + u64(y) * u64(_src_width) * u64(_channels);
+        f32       *out_row = rows.data() + u64(y) * dst_pitch;
+        xfor(_dst_width) {
+            f32 *out = out_row + u64(x) * u64(_channels);
+            jfor(tx.count[x]) {
+                f32        w  = tx.weights[tx.offset[x] + j];
+                f32 const *in = src_row + u64(tx.first[x] + j) * u64(_channels);
+                for (u32 c = u32(0); c < _channels; c++) out[c] += w * in[c];
+            }
+        }
+    }
+    yfor(_dst_height) {
+        f32 *out = _dst + u64(y) * dst_pitch;
+        for (u64 i = u64(0); i < dst_pitch; i++) out[i] = f32(0.0);
+        jfor(ty.count[y]) {
+            f32        w  = ty.weights[ty.offset[y] + j];
+            f32 const *in = rows.data() + u64(ty.first[y] + j) * dst_pitch;
+            for (u64 i = u64(0); i < dst_pitch; i++) out[i] += w * in[i];
+        }
+    }
+}
+
+struct TextureCacheSource {
+    u8 const *data          = NULL; // Mip 0, tightly packed
+    u32       width         = u32(0);
+    u32       height        = u32(0);
+    u32       channels      = u32(0);
+    u32       format        = u32(0); // DXGI_FORMAT on the gfx backend, passed through
+    u32       stream_format = TEXTURE_STREAM_FORMAT_UNSUPPORTED;
+};
+
+// Mip 0 followed by every smaller mip, tightly packed the way gfxCommandCopyBufferToTexture reads them. Each mip is filtered from the previous one in f32.
+static void GenerateTextureMipChain(TextureCacheSource const &_src, TextureMipFilter _filter, std::vector<u8> &_out) {
+    u32 bpp = GetTextureStreamBytesPerChannel(_src.stream_format) * _src.channels;
+    assert(bpp != u32(0) && _src.width && _src.height);
+    _out.resize(GetTextureMipChainSize(_src.width, _src.height, bpp, u32(0)));
+    u64 mip0_size = u64(_src.width) * u64(_src.height) * u64(bpp);
+    memcpy(_out.data(), _src.data, mip0_size);
+    std::vector<f32> level = std::vector<f32>(u64(_src.width) * u64(_src.height) * u64(_src.channels));
+    DecodeTexturePixels(_src.data, u64(_src.width) * u64(_src.height), _src.channels, _src.stream_format, level.data());
+    u64              offset = mip0_size;
+    std::vector<f32> next   = {};
+    for (u32 mip = u32(1); mip < GetTextureMipCount(_src.width, _src.height); mip++) {
+        u32 src_width = GetTextureMipSize(_src.width, mip - u32(1)), src_height = GetTextureMipSize(_src.height, mip - u32(1));
+        u32 width = GetTextureMipSize(_src.width, mip), height = GetTextureMipSize(_src.height, mip);
+        next.resize(u64(width) * u64(height) * u64(_src.channels));
+        DownsampleTextureMip(level.data(), src_width, src_height, _src.channels, next.data(), width, height, _filter);
+        EncodeTexturePixels(next.data(), u64(width) * u64(height), _src.channels, _src.stream_format, _out.data() + offset);
+        offset += u64(width) * u64(height) * u64(bpp);
+        std::swap(level, next);
+    }
+    assert(offset == u64(_out.size()));
+}
+
+// Offline mip chains of every scene texture in one file. A header, an entry per texture in scene image order and 64 byte aligned chains; the chain of a texture
+// from any mip down is one contiguous range, which is what gets uploaded when that mip becomes resident.
+class TextureCache {
+public:
+    struct Entry {
+        u32 width         = u32(0);
+        u32 height        = u32(0);
+        u32 channels      = u32(0);
+        u32 format        = u32(0);
+        u32 stream_format = TEXTURE_STREAM_FORMAT_UNSUPPORTED;
+        u32 num_mips      = u32(0); // 0 for unsupported formats, those are uploaded the old way
+        u64 offset        = u64(0);
+        u64 size          = u64(0);
+
+        u32 GetBytesPerPixel() const { return GetTextureStreamBytesPerChannel(stream_format) * channels; }
+    };
+
+private:
+    static constexpr u32 MAGIC     = u32(0x43585453); // 'STXC'
+    static constexpr u32 VERSION   = u32(1);
+    static constexpr u64 ALIGNMENT = u64(64);
+
+    struct Header {
+        u32 magic        = MAGIC;
+        u32 version      = VERSION;
+        u64 source_key   = u64(0);
+        u32 num_textures = u32(0);
+        u32 filter       = u32(0);
+    };
+
+    SceneCacheMappedFile file         = {};
+    Entry const         *entries      = NULL;
+    u32                  num_textures = u32(0);
+
+    static u64 AlignUp(u64 _v) { return (_v + ALIGNMENT - u64(1)) & ~(ALIGNMENT - u64(1)); }
+    bool       Fail() {
+        Close();
+        return false;
+    }
+
+public:
+    // The scene key plus every image file under the scene's directory
+    static u64 GetSourceKey(char const *_scene_path) {
+        auto mix = [](u64 _h, u64 _v) { return (_h ^ _v) * u64(0x100000001b3); };
+        u64  h   = mix(SceneCache::GetSourceKey(_scene_path), u64(VERSION));
+        std::error_code                    ec     = {};
+        std::filesystem::path              path   = std::filesystem::path(_scene_path);
+        std::vector<std::filesystem::path> images = {};
+        for (auto &e : std::filesystem::recursive_directory_iterator(path.parent_path().empty() ? std::filesystem::path(".") : path.parent_path(), ec)) {
+            std::string ext = e.path().extension().string();
+            std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return char(std::tolower(u8(c))); });
+            if (ext == ".png" || ext == ".jpg" || ext == ".jpeg" || ext == ".tga" || ext == ".bmp" || ext == ".hdr" || ext == ".ktx" || ext == ".dds")
+                images.push_back(e.path());
+        }
+        std::sort(images.begin(), images.end());
+        for (auto &image : images) {
+            for (char c : image.string()) h = mix(h, u64(u8(c)));
+            h = mix(h, u64(std::filesystem::file_size(image, ec)));
+            h = mix(h, u64(std::filesystem::last_write_time(image, ec).time_since_epoch().count()));
+        }
+        return h;
+    }
+    // Mip chains are generated in parallel, one texture per worker at a time. Written to a temporary and renamed like SceneCache.
+    static bool Write(char const *_path, u64 _source_key, std::vector<TextureCacheSource> const &_sources, TextureMipFilter _filter = TEXTURE_MIP_FILTER_KAISER,
+                      u32 _num_threads = u32(0)) {
+        u32                          num_sources = u32(_sources.size());
+        std::vector<std::vector<u8>> chains      = std::vector<std::vector<u8>>(num_sources);
+        std::atomic<u32>             next        = {u32(0)};
+        auto                         worker      = [&] {
+            while (true) {
+                u32 i = next.fetch_add(u32(1));
+                if (i >= num_sources) break;
+                TextureCacheSource const &src = _sources[i];
+                if (GetTextureStreamBytesPerChannel(src.stream_format) && src.channels && src.width && src.height && src.data) GenerateTextureMipChain(src, _filter, chains[i]);
+            }
+        };
+        if (_num_threads == u32(0)) _num_threads = std::max(u32(1), u32(std::thread::hardware_concurrency()));
+        _num_threads = std::min(_num_threads, std::max(num_sources, u32(1)));
+        std::vector<std::thread> threads = {};
+        ifor(_num_threads - u32(1)) threads.emplace_back(worker);
+        worker();
+        for (auto &t : threads) t.join();
+
+        Header header       = {};
+        header.source_key   = _source_key;
+        header.num_textures = num_sources;
+        header.filter       = u32(_filter);
+        std::vector<Entry> out_entries = std::vector<Entry>(num_sources);
+        u64                offset      = AlignUp(sizeof(Header) + sizeof(Entry) * u64(num_sources));
+        ifor(num_sources) {
+            Entry &e        = out_entries[i];
+            e.width         = _sources[i].width;
+            e.height        = _sources[i].height;
+            e.channels      = _sources[i].channels;
+            e.format        = _sources[i].format;
+            e.stream_format = chains[i].size() ? _sources[i].stream_format : u32(TEXTURE_STREAM_FORMAT_UNSUPPORTED);
+            e.num_mips      = chains[i].size() ? GetTextureMipCount(e.width, e.height) : u32(0);
+            e.offset        = offset;
+            e.size          = u64(chains[i].size());
+            offset          = AlignUp(offset + e.size);
+        }
+
+        std::error_code ec  = {};
+        std::string     tmp = std::string(_path) + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            if (!out.is_open()) return false;
+            static u8 const zeros[ALIGNMENT] = {};
+            u64             pos              = u64(0);
+            auto            put              = [&](void const *_ptr, u64 _size) {
+                out.write((char const *)_ptr, std::streamsize(_size));
+                pos += _size;
+            };
+            put(&header, sizeof(header));
+            if (num_sources) put(out_entries.data(), sizeof(Entry) * u64(num_sources));
+            ifor(num_sources) {
+                put(zeros, out_entries[i].offset - pos);
+                if (chains[i].size()) put(chains[i].data(), u64(chains[i].size()));
+            }
+            if (!out) {
+                out.close();
+                std::filesystem::remove(tmp, ec);
+                return false;
+            }
+        }
+        std::filesystem::rename(tmp, _path, ec);
+        if (ec) std::filesystem::remove(tmp, ec);
+        return !ec;
+    }
+    bool Open(char const *_path, u64 _source_key) {
+        Close();
+        if (!file.Open(_path)) return false;
+        Header header = {};
+        if (file.GetSize() < sizeof(Header)) return Fail();
+        memcpy(&header, file.GetData(), sizeof(Header));
+        if (header.magic != MAGIC || header.version != VERSION || header.source_key != _source_key) return Fail();
+        if (u64(header.num_textures) * sizeof(Entry) > file.GetSize() - sizeof(Header)) return Fail();
+        Entry const *e = (Entry const *)(file.GetData() + sizeof(Header));
+        ifor(header.num_textures) {
+            if (e[i].num_mips == u32(0)) continue;
+            if (e[i].offset % ALIGNMENT != u64(0) || e[i].offset > file.GetSize() || e[i].size > file.GetSize() - e[i].offset) return Fail();
+            if (e[i].num_mips != GetTextureMipCount(e[i].width, e[i].height) || e[i].size != GetTextureMipChainSize(e[i].width, e[i].height, e[i].GetBytesPerPixel(), u32(0)))
+                return Fail();
+        }
+        entries      = e;
+        num_textures = header.num_textures;
+        return true;
+    }
+    void Close() {
+        file.Close();
+        entries      = NULL;
+        num_textures = u32(0);
+    }
+    bool         IsOpen() const { return entries != NULL; }
+    u32          GetNumTextures() const { return num_textures; }
+    Entry const &GetEntry(u32 _texture_id) const { return entries[_texture_id]; }
+    bool         IsStreamable(u32 _texture_id) const { return _texture_id < num_textures && entries[_texture_id].num_mips != u32(0); }
+    u64          GetMipChainSize(u32 _texture_id, u32 _first_mip) const {
+        Entry const &e = entries[_texture_id];
+        return GetTextureMipChainSize(e.width, e.height, e.GetBytesPerPixel(), _first_mip);
+    }
+    u8 const *GetMipData(u32 _texture_id, u32 _mip) const {
+        Entry const &e = entries[_texture_id];
+        return file.GetData() + e.offset + (e.size - GetMipChainSize(_texture_id, _mip));
+    }
+    // First mip whose larger side fits in _mip_tail_size
+    u32 GetMipTail(u32 _texture_id, u32 _mip_tail_size) const {
+        Entry const &e   = entries[_texture_id];
+        u32          mip = u32(0);
+        while (mip + u32(1) < e.num_mips && std::max(GetTextureMipSize(e.width, mip), GetTextureMipSize(e.height, mip)) > _mip_tail_size) mip++;
+        return mip;
+    }
+};
+
+class ITextureStreamDevice {
+public:
+    // Replaces the texture with one whose top is _first_mip, _data holds that mip and every smaller one tightly packed
+    virtual void UploadTexture(u32 _texture_id, u32 _first_mip, u8 const *_data, u64 _size) = 0;
+    virtual ~ITextureStreamDevice() {}
+};
+
+struct TextureStreamerStats {
+    u64 num_jobs       = u64(0);
+    u64 num_uploads    = u64(0);
+    u64 num_downgrades = u64(0);
+    u64 uploaded_bytes = u64(0);
+    u64 resident_bytes = u64(0);
+};
+
+// Every streamable texture of a TextureCache starts at its mip tail. Feedback for a finer mip queues a job, a worker reads the chain from that mip down out of
+// the mapped cache and Update hands finished chains to the device on the calling thread. A texture that didn't need its resident top mip for max_idle_frames
+// frames drops back to what it's asked for, or to the mip tail. Jobs with the largest mip deficit go first.
+// With _num_threads == 0 jobs are read inside Update.
+class TextureStreamer {
+private:
+    struct State {
+        u32 mip_tail      = u32(0);
+        u32 resident_mip  = u32(-1); // u32(-1) until LoadMipTails and for textures the cache can't stream
+        u32 requested_mip = u32(-1); // Finest mip asked for this frame
+        u32 pending_mip   = u32(-1); // Queued or being read
+        u64 last_needed   = u64(0);  // Last frame that asked for the resident top mip or a finer one
+    };
+    struct Job {
+        u32 texture_id = u32(0);
+        u32 first_mip  = u32(0);
+        u64 priority   = u64(0);
+
+        bool operator<(Job const &that) const { return priority < that.priority; }
+    };
+    struct Result {
+        u32             texture_id = u32(0);
+        u32             first_mip  = u32(0);
+        std::vector<u8> data       = {};
+    };
+
+    TextureCache const      *cache           = NULL;
+    ITextureStreamDevice    *device          = NULL;
+    u32                      mip_tail_size   = u32(0);
+    u32                      max_idle_frames = u32(0);
+    std::vector<State>       states          = {};
+    std::mutex               mutex           = {};
+    std::condition_variable  job_cv          = {};
+    std::condition_variable  idle_cv         = {};
+    std::priority_queue<Job> jobs            = {};
+    std::vector<Result>      results         = {};
+    u32                      num_in_flight   = u32(0);
+    bool                     quit            = false;
+    std::vector<std::thread> workers         = {};
+    u64                      frame_idx       = u64(1);
+    TextureStreamerStats     stats           = {};
+
+    Result Read(Job const &_job) const {
+        Result result     = {};
+        result.texture_id = _job.texture_id;
+        result.first_mip  = _job.first_mip;
+        result.data.resize(cache->GetMipChainSize(_job.texture_id, _job.first_mip));
+        if (result.data.size()) memcpy(result.data.data(), cache->GetMipData(_job.texture_id, _job.first_mip), result.data.size());
+        return result;
+    }
+    void WorkerLoop() {
+        while (true) {
+            Job job = {};
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                job_cv.wait(lock, [&] { return quit || !jobs.empty(); });
+                if (quit) return;
+                job = jobs.top();
+                jobs.pop();
+                num_in_flight++;
+            }
+            Result result = Read(job);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                results.push_back(std::move(result));
+                num_in_flight--;
+            }
+            idle_cv.notify_all();
+        }
+    }
+    void Queue(u32 _texture_id, u32 _first_mip, u64 _priority) {
+        State &s      = states[_texture_id];
+        s.pending_mip = _first_mip;
+        Job job       = {};
+        job.texture_id = _texture_id;
+        job.first_mip  = _first_mip;
+        job.priority   = _priority;
+        jobs.push(job);
+        stats.num_jobs++;
+    }
+    void Upload(u32 _texture_id, u32 _first_mip, u8 const *_data, u64 _size) {
+        State &s = states[_texture_id];
+        if (s.resident_mip != u32(-1)) stats.resident_bytes -= cache->GetMipChainSize(_texture_id, s.resident_mip);
+        device->UploadTexture(_texture_id, _first_mip, _data, _size);
+        s.resident_mip = _first_mip;
+        stats.resident_bytes += _size;
+        stats.uploaded_bytes += _size;
+        stats.num_uploads++;
+    }
+
+public:
+    TextureStreamer(TextureCache const *_cache, ITextureStreamDevice *_device, u32 _num_threads = u32(2), u32 _mip_tail_size = u32(128), u32 _max_idle_frames = u32(120))
+        : cache(_cache), device(_device), mip_tail_size(_mip_tail_size), max_idle_frames(_max_idle_frames) {
+        states.resize(cache->GetNumTextures());
+        ifor(cache->GetNumTextures()) if (cache->IsStreamable(i)) states[i].mip_tail = cache->GetMipTail(i, mip_tail_size);
+        ifor(_num_threads) workers.emplace_back([this] { WorkerLoop(); });
+    }
+    ~TextureStreamer() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        job_cv.notify_all();
+        for (auto &t : workers) t.join();
+    }
+    TextureStreamer(TextureStreamer const &)            = delete;
+    TextureStreamer &operator=(TextureStreamer const &) = delete;
+
+    // Uploads the mip tail of every streamable texture on the calling thread
+    void LoadMipTails() {
+        ifor(u32(states.size())) {
+            if (!cache->IsStreamable(i)) continue;
+            u32 tail = states[i].mip_tail;
+            Upload(i, tail, cache->GetMipData(i, tail), cache->GetMipChainSize(i, tail));
+            states[i].last_needed = frame_idx;
+        }
+    }
+    // Feedback for the current frame, the finest mip wins
+    void Request(u32 _texture_id, u32 _mip) {
+        if (_texture_id >= u32(states.size()) || _mip == u32(-1)) return;
+        State &s = states[_texture_id];
+        if (s.resident_mip == u32(-1)) return;
+        s.requested_mip = std::min(std::min(s.requested_mip, _mip), cache->GetEntry(_texture_id).num_mips - u32(1));
+    }
+    // Queues jobs for this frame's feedback and hands up to _max_uploads finished chains to the device
+    void Update(u32 _max_uploads = u32(4)) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ifor(u32(states.size())) {
+                State &s = states[i];
+                if (s.resident_mip == u32(-1)) continue;
+                if (s.requested_mip <= s.resident_mip) s.last_needed = frame_idx;
+                if (s.pending_mip == u32(-1)) {
+                    if (s.requested_mip < s.resident_mip) {
+                        u64 deficit = u64(s.resident_mip - s.requested_mip);
+                        // Smaller chains first among equal deficits, they're quicker to show
+                        u64 size = std::min(cache->GetMipChainSize(i, s.requested_mip) >> u64(10), u64(0xffffffff));
+                        Queue(i, s.requested_mip, (deficit << u64(32)) | (u64(0xffffffff) - size));
+                    } else if (frame_idx - s.last_needed > u64(max_idle_frames)) {
+                        u32 target = std::min(s.requested_mip, s.mip_tail);
+                        if (target > s.resident_mip) Queue(i, target, u64(0));
+                    }
+                }
+                s.requested_mip = u32(-1);
+            }
+        }
+        if (workers.empty()) {
+            while (!jobs.empty()) {
+                results.push_back(Read(jobs.top()));
+                jobs.pop();
+            }
+        } else {
+            job_cv.notify_all();
+        }
+
+        std::vector<Result> ready = {};
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            u32 num_ready = std::min(_max_uploads, u32(results.size()));
+            // Workers pop jobs by priority, so completion order follows it closely enough
+            ifor(num_ready) ready.push_back(std::move(results[i]));
+            results.erase(results.begin(), results.begin() + num_ready);
+        }
+        for (Result &r : ready) {
+            State &s = states[r.texture_id];
+            if (r.first_mip > s.resident_mip) stats.num_downgrades++;
+            Upload(r.texture_id, r.first_mip, r.data.data(), u64(r.data.size()));
+            s.pending_mip = u32(-1);
+            s.last_needed = frame_idx;
+        }
+        frame_idx++;
+    }
+    // Blocks until every queued job is read, the results are uploaded by the following Updates
+    void Flush() {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle_cv.wait(lock, [&] { return workers.empty() || (jobs.empty() && num_in_flight == u32(0)); });
+    }
+    u32                         GetResidentMip(u32 _texture_id) const { return states[_texture_id].resident_mip; }
+    u32                         GetMipTail(u32 _texture_id) const { return states[_texture_id].mip_tail; }
+    TextureStreamerStats const &GetStats() const { return stats; }
+
+    static void Test() {
+        struct FakeDevice : public ITextureStreamDevice {
+            std::vector<u32> uploads  = {}; // texture_id << 16 | first_mip
+            std::vector<u8>  last     = {};
+            u32              resident = u32(0);
+
+            void UploadTexture(u32 _texture_id, u32 _first_mip, u8 const *_data, u64 _size) override {
+                uploads.push_back((_texture_id << u32(16)) | _first_mip);
+                last.assign(_data, _data + _size);
+            }
+        };
+
+        // Filters: constants stay constant, a 2x2 checker averages, odd sizes cover every source pixel, sRGB averages in linear space
+        ifor(2) {
+            TextureMipFilter filter = TextureMipFilter(i);
+            std::vector<u8>  flat   = std::vector<u8>(u64(37) * u64(20) * u64(4), u8(77));
+            TextureCacheSource src  = {};
+            src.data               = flat.data();
+            src.width              = u32(37);
+            src.height             = u32(20);
+            src.channels           = u32(4);
+            src.stream_format      = TEXTURE_STREAM_FORMAT_UNORM8;
+            std::vector<u8> chain  = {};
+            GenerateTextureMipChain(src, filter, chain);
+            assert(chain.size() == GetTextureMipChainSize(u32(37), u32(20), u32(4), u32(0)));
+            for (u8 v : chain) assert(v == u8(77));
+        }
+        {
+            u8                 checker[4] = {u8(0), u8(255), u8(255), u8(0)};
+            TextureCacheSource src        = {};
+            src.data                      = checker;
+            src.width                     = u32(2);
+            src.height                    = u32(2);
+            src.channels                  = u32(1);
+            src.stream_format             = TEXTURE_STREAM_FORMAT_UNORM8;
+            std::vector<u8> chain         = {};
+            GenerateTextureMipChain(src, TEXTURE_MIP_FILTER_BOX, chain);
+            assert(chain.size() == size_t(5) && chain[4] == u8(128));
+            src.stream_format = TEXTURE_STREAM_FORMAT_UNORM8_SRGB;
+            GenerateTextureMipChain(src, TEXTURE_MIP_FILTER_BOX, chain);
+            assert(chain[4] == u8(std::round(LinearToSRGB(f32(0.5)) * f32(255.0))));
+        }
+        {
+            f32 values[9] = {f32(1.0), f32(2.0), f32(3.0), f32(4.0), f32(5.0), f32(6.0), f32(7.0), f32(8.0), f32(30.0)};
+            TextureCacheSource src = {};
+            src.data               = (u8 const *)values;
+            src.width              = u32(3);
+            src.height             = u32(3);
+            src.channels           = u32(1);
+            src.stream_format      = TEXTURE_STREAM_FORMAT_F32;
+            std::vector<u8> chain  = {};
+            GenerateTextureMipChain(src, TEXTURE_MIP_FILTER_BOX, chain);
+            f32 mip1 = f32(0.0);
+            memcpy(&mip1, chain.data() + sizeof(values), sizeof(f32));
+            assert(std::abs(mip1 - f32(66.0 / 9.0)) < f32(1.0e-5));
+        }
+        {
+            // Kaiser keeps a smooth ramp close to the box result and sums to one everywhere
+            TextureMipTaps taps = {};
+            GetTextureMipTaps(u32(64), u32(32), TEXTURE_MIP_FILTER_KAISER, taps);
+            ifor(32) {
+                f32 sum = f32(0.0);
+                jfor(taps.count[i]) sum += taps.weights[taps.offset[i] + j];
+                assert(std::abs(sum - f32(1.0)) < f32(1.0e-5));
+            }
+            std::vector<f32> ramp = std::vector<f32>(64 * 64), box = std::vector<f32>(32 * 32), kaiser = std::vector<f32>(32 * 32);
+            yfor(64) xfor(64) ramp[y * 64 + x] = f32(x + y) / f32(128.0);
+            DownsampleTextureMip(ramp.data(), u32(64), u32(64), u32(1), box.data(), u32(32), u32(32), TEXTURE_MIP_FILTER_BOX);
+            DownsampleTextureMip(ramp.data(), u32(64), u32(64), u32(1), kaiser.data(), u32(32), u32(32), TEXTURE_MIP_FILTER_KAISER);
+            // Away from the clamped edges a linear ramp is reproduced exactly by both
+            for (u32 y = u32(4); y < u32(28); y++)
+                for (u32 x = u32(4); x < u32(28); x++) assert(std::abs(box[y * 32 + x] - kaiser[y * 32 + x]) < f32(1.0e-4));
+        }
+        assert(GetTextureMipCount(u32(1), u32(1)) == u32(1) && GetTextureMipCount(u32(256), u32(64)) == u32(9) && GetTextureMipCount(u32(5), u32(3)) == u32(3));
+        assert(GetTextureFeedbackMip(u32(0), u32(1024), u32(1024), u32(11)) == u32(-1));
+        // A 1/256 uv footprint on a 1024 texture needs mip 2
+        assert(GetTextureFeedbackMip(u32(1) + u32(8) * TEXTURE_FEEDBACK_SCALE, u32(1024), u32(512), u32(11)) == u32(2));
+        assert(GetTextureFeedbackMip(u32(1) + u32(20) * TEXTURE_FEEDBACK_SCALE, u32(1024), u32(512), u32(11)) == u32(0));
+        assert(GetTextureFeedbackMip(u32(1), u32(1024), u32(512), u32(11)) == u32(10));
+
+        // Cache file: two streamable textures and one that isn't
+        std::error_code       ec   = {};
+        std::filesystem::path path = std::filesystem::temp_directory_path(ec) / "dgfx_texture_cache_test.bin";
+        std::vector<u8>       big  = std::vector<u8>(u64(1024) * u64(512) * u64(4));
+        std::vector<u8>       rgb  = std::vector<u8>(u64(300) * u64(200) * u64(3));
+        u32                   seed = u32(1);
+        for (u8 &v : big) v = u8((seed = pcg(seed)) >> u32(24));
+        for (u8 &v : rgb) v = u8((seed = pcg(seed)) >> u32(24));
+        std::vector<TextureCacheSource> sources = std::vector<TextureCacheSource>(3);
+        sources[0].data                         = big.data();
+        sources[0].width                        = u32(1024);
+        sources[0].height                       = u32(512);
+        sources[0].channels                     = u32(4);
+        sources[0].format                       = u32(29);
+        sources[0].stream_format                = TEXTURE_STREAM_FORMAT_UNORM8_SRGB;
+        sources[1]                              = sources[0];
+        sources[1].stream_format                = TEXTURE_STREAM_FORMAT_UNSUPPORTED;
+        sources[2].data                         = rgb.data();
+        sources[2].width                        = u32(300);
+        sources[2].height                       = u32(200);
+        sources[2].channels                     = u32(3);
+        sources[2].stream_format                = TEXTURE_STREAM_FORMAT_UNORM8;
+        bool written                            = TextureCache::Write(path.string().c_str(), u64(42), sources, TEXTURE_MIP_FILTER_KAISER, u32(2));
+        assert(written);
+        (void)written;
+        {
+            TextureCache cache = {};
+            assert(!cache.Open(path.string().c_str(), u64(43)));
+            bool open = cache.Open(path.string().c_str(), u64(42));
+            assert(open && cache.GetNumTextures() == u32(3));
+            (void)open;
+            assert(cache.IsStreamable(u32(0)) && !cache.IsStreamable(u32(1)) && cache.IsStreamable(u32(2)));
+            std::vector<u8> chain = {};
+            GenerateTextureMipChain(sources[2], TEXTURE_MIP_FILTER_KAISER, chain);
+            assert(memcmp(cache.GetMipData(u32(2), u32(0)), chain.data(), chain.size()) == 0);
+            assert(memcmp(cache.GetMipData(u32(0), u32(0)), big.data(), big.size()) == 0);
+            assert(cache.GetMipData(u32(2), u32(1)) == cache.GetMipData(u32(2), u32(0)) + u64(300) * u64(200) * u64(3));
+            assert(cache.GetMipTail(u32(0), u32(128)) == u32(3) && cache.GetMipTail(u32(2), u32(128)) == u32(2));
+
+            // Synchronous: startup uploads only the tails, the largest deficit streams first
+            FakeDevice device = {};
+            {
+                TextureStreamer streamer = TextureStreamer(&cache, &device, u32(0), u32(128), u32(4));
+                streamer.LoadMipTails();
+                assert((device.uploads == std::vector<u32>{u32(3), (u32(2) << u32(16)) | u32(2)}));
+                assert(streamer.GetStats().resident_bytes == cache.GetMipChainSize(u32(0), u32(3)) + cache.GetMipChainSize(u32(2), u32(2)));
+                device.uploads.clear();
+                streamer.Request(u32(2), u32(1));
+                streamer.Request(u32(0), u32(1));
+                streamer.Request(u32(0), u32(0));
+                streamer.Request(u32(1), u32(0));
+                streamer.Update(u32(1));
+                assert((device.uploads == std::vector<u32>{u32(0)}));
+                assert(device.last.size() == cache.GetMipChainSize(u32(0), u32(0)) && memcmp(device.last.data(), big.data(), big.size()) == 0);
+                streamer.Update(u32(1));
+                assert((device.uploads == std::vector<u32>{u32(0), (u32(2) << u32(16)) | u32(1)}));
+                assert(streamer.GetResidentMip(u32(0)) == u32(0) && streamer.GetResidentMip(u32(1)) == u32(-1));
+                // Texture 0 is still needed, texture 2 isn't and goes back to its tail after the idle frames
+                ifor(8) {
+                    streamer.Request(u32(0), u32(0));
+                    streamer.Update();
+                }
+                assert(streamer.GetResidentMip(u32(0)) == u32(0) && streamer.GetResidentMip(u32(2)) == u32(2));
+                assert(streamer.GetStats().num_downgrades == u64(1));
+                assert(streamer.GetStats().resident_bytes == cache.GetMipChainSize(u32(0), u32(0)) + cache.GetMipChainSize(u32(2), u32(2)));
+            }
+            // Worker threads
+            device.uploads.clear();
+            {
+                TextureStreamer streamer = TextureStreamer(&cache, &device, u32(2));
+                streamer.LoadMipTails();
+                streamer.Request(u32(0), u32(1));
+                streamer.Request(u32(2), u32(0));
+                streamer.Update();
+                streamer.Flush();
+                streamer.Update();
+                assert(streamer.GetResidentMip(u32(0)) == u32(1) && streamer.GetResidentMip(u32(2)) == u32(0));
+                assert(device.uploads.size() == size_t(4));
+            }
+        }
+        std::filesystem::remove(path, ec);
+    }
+};
+
+} // namespace GfxJit
+
+#endif // TEXTURE_STREAMING_HPP
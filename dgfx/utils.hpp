@@ -24,12 +24,31 @@
 #    define UTILS_HPP
 
 #    include "common.h"
+#    include "sjit/string_hash.hpp"
 
+#    if defined(_MSC_VER)
+#        include <intrin.h>
+#    endif
+
+#    include <atomic>
+#    include <chrono>
 #    include <map>
+#    include <mutex>
 #    include <string>
+#    include <thread>
 #    include <unordered_map>
 #    include <vector>
 
+#    if defined(_WIN32)
+#        if !defined(WIN32_LEAN_AND_MEAN)
+#            define WIN32_LEAN_AND_MEAN
+#        endif
+#        include <windows.h>
+#    elif __linux__
+#        include <sys/mman.h>
+#        include <unistd.h>
+#    endif
+
 //#    undef min
 //#    undef max
 
@@ -72,19 +91,18 @@ static void restore_fpe(u32 new_mask) {
     assert(result == 0);
 }
 
-class OffsetAllocator {
+// First fit over a std::map of free ranges. Replaced by OffsetAllocator, kept as the reference OffsetAllocator::Test checks and times against.
+class MapOffsetAllocator {
 public:
     struct Allocation {
-        u32 offset;
-        u32 size;
+        u32 offset = u32(-1);
+        u32 size   = u32(0);
 
         bool IsValid() const { return offset != u32(-1); }
-        bool operator<(Allocation const &that) const { return this->offset < that.offset; }
     };
 
 private:
-    u32 size = u32(0);
-    // u32                     cursor      = u32(0);
+    u32                size        = u32(0);
     std::map<u32, u32> free_ranges = {};
     u32                free_space  = u32(0);
 
@@ -98,32 +116,7 @@ public:
         alignment = std::max(u32(1), alignment);
         assert((alignment & (alignment - u32(1))) == u32(0));
         assert(needed_size);
-        /* {
-             u32 aligned_cursor = ((cursor + alignment) & (~(alignment - u32(1))));
-             if (size - aligned_cursor >= needed_size) {
-                 if (aligned_cursor > cursor) {
-                     free_ranges.push_back({cursor, aligned_cursor - cursor});
-                 }
-                 free_space -= needed_size;
-                 cursor = aligned_cursor += needed_size;
-                 return Allocation{aligned_cursor, needed_size};
-             }
-         }*/
-        /*ifor(free_ranges.size()) {
-            u32 aligned_offset = ((free_ranges[i].offset + alignment) & (~(alignment - u32(1))));
-            u32 end            = free_ranges[i].offset + free_ranges[i].size;
-            if (end > aligned_offset) {
-                u32 resulting_size = end - aligned_offset;
-                if (resulting_size >= needed_size) {
-                    free_ranges[i].size = aligned_offset - free_ranges[i].offset;
-                    if (resulting_size > needed_size) {
-                        free_ranges.push_back({aligned_offset + needed_size, resulting_size - needed_size});
-                    }
-                    return Allocation{aligned_offset, needed_size};
-                }
-            }
-        }*/
-        if (free_ranges.size() == 0) return Allocation{u32(-1)};
+        if (free_ranges.size() == 0) return Allocation{};
         i32 offset = -1;
         for (auto iter = free_ranges.begin(); iter != free_ranges.end(); iter++) {
             i32 end            = iter->first + iter->second;
@@ -151,50 +144,13 @@ public:
         }
         return Allocation{u32(offset), needed_size};
     }
-    bool CanAllocate(u32 needed_size, u32 alignment = u32(1)) {
-        alignment = std::max(u32(1), alignment);
-        assert((alignment & (alignment - u32(1))) == u32(0));
-        assert(needed_size);
-        if (free_ranges.size() == 0) return false;
-        for (auto iter = free_ranges.begin(); iter != free_ranges.end(); iter++) {
-            u64 end            = iter->first + iter->second;
-            u64 aligned_offset = (iter->first + alignment - 1) & (~(alignment - 1));
-            if (aligned_offset >= end) continue;
-            u64 usable_space = end - aligned_offset;
-            if (usable_space >= needed_size) {
-                return true;
-            }
-        }
-        return false;
-    }
-    u32 GetSpaceLeft() const { return free_space; }
-    /*void Defrag() {
-        if (free_ranges.size() == u64(0)) return;
-        std::sort(free_ranges.begin(), free_ranges.end());
-        std::vector<Allocation> new_free_ranges = {};
-        Allocation              cur             = {u32(-1)};
-        ifor(free_ranges.size()) {
-            if (cur.offset == u32(-1)) {
-                cur = free_ranges[i];
-            } else if (cur.offset + cur.size == free_ranges[i].offset) {
-                cur.size += free_ranges[i].size;
-            } else {
-                new_free_ranges.push_back(cur);
-                cur = free_ranges[i];
-            }
-        }
-        if (cur.offset != u32(-1)) {
-            new_free_ranges.push_back(cur);
-        }
-        free_ranges = new_free_ranges;
-    }*/
+    u32  GetSpaceLeft() const { return free_space; }
     void Free(Allocation const &allocation) {
         assert(contains(free_ranges, allocation.offset) == false);
         free_space += allocation.size;
-        // free_ranges.push_back(allocation);
 
         if (free_ranges.size() == u64(0)) {
-            free_ranges[allocation.offset] = size;
+            free_ranges[allocation.offset] = allocation.size;
             return;
         }
         u32 new_offset = allocation.offset;
@@ -202,7 +158,7 @@ public:
 
         {
             auto iter = free_ranges.upper_bound(new_offset);
-            if (iter != free_ranges.end() && iter != free_ranges.begin()) {
+            if (iter != free_ranges.begin()) {
                 iter--;
                 if ((u32)iter->first + (u32)iter->second == new_offset) {
                     new_offset = iter->first;
@@ -223,11 +179,247 @@ public:
 
         free_ranges[new_offset] = new_size;
     }
+};
+
+// Two level segregated fit over [0, size). Free blocks sit in 256 bins, 32 power of two levels with 8 linear steps each, and two bit scans find the first non
+// empty bin that fits, so Allocate and Free are O(1). Searching from the bin the size rounds up to wastes at most 1/8 of a block on bin granularity; the rest
+// of the block goes back as a free block, so sizes are never rounded. Freed blocks merge with their free neighbours right away.
+// Nodes come from a pool sized by Init, Allocate and Free don't touch the heap. Free needs the metadata Allocate returned.
+class OffsetAllocator {
+public:
+    struct Allocation {
+        u32 offset   = u32(-1);
+        u32 size     = u32(0);
+        u32 metadata = u32(-1); // Node index
+
+        bool IsValid() const { return offset != u32(-1); }
+        bool operator<(Allocation const &that) const { return this->offset < that.offset; }
+    };
+
+private:
+    static constexpr u32 NUM_TOP_BINS   = u32(32);
+    static constexpr u32 BINS_PER_LEAF  = u32(8);
+    static constexpr u32 TOP_BINS_SHIFT = u32(3);
+    static constexpr u32 LEAF_BINS_MASK = u32(7);
+    static constexpr u32 NUM_LEAF_BINS  = NUM_TOP_BINS * BINS_PER_LEAF;
+    static constexpr u32 MANTISSA_BITS  = u32(3);
+    static constexpr u32 MANTISSA_VALUE = u32(1) << MANTISSA_BITS;
+    static constexpr u32 MANTISSA_MASK  = MANTISSA_VALUE - u32(1);
+    static constexpr u32 NONE           = u32(-1);
+
+    struct Node {
+        u32  offset        = u32(0);
+        u32  size          = u32(0);
+        u32  bin_prev      = NONE;
+        u32  bin_next      = NONE;
+        u32  neighbor_prev = NONE;
+        u32  neighbor_next = NONE;
+        bool used          = false;
+    };
+
+    u32               size                     = u32(0);
+    u32               free_space               = u32(0);
+    u32               max_nodes                = u32(0);
+    u32               used_bins_top            = u32(0);
+    u8                used_bins[NUM_TOP_BINS]  = {};
+    u32               bin_heads[NUM_LEAF_BINS] = {};
+    std::vector<Node> nodes                    = {};
+    std::vector<u32>  free_nodes               = {}; // Stack of unused node indices
+    u32               num_free_nodes           = u32(0);
+
+    static u32 CountTrailingZeros(u32 _v) {
+        assert(_v);
+#    if defined(_MSC_VER)
+        unsigned long idx = 0;
+        _BitScanForward(&idx, _v);
+        return u32(idx);
+#    else
+        return u32(__builtin_ctz(_v));
+#    endif
+    }
+    static u32 GetHighestBit(u32 _v) {
+        assert(_v);
+#    if defined(_MSC_VER)
+        unsigned long idx = 0;
+        _BitScanReverse(&idx, _v);
+        return u32(idx);
+#    else
+        return u32(31 - __builtin_clz(_v));
+#    endif
+    }
+
+public:
+    // Sizes as a float with 3 mantissa bits, exact below 8. Rounding up gives the first bin whose every block fits, rounding down the bin a block goes in.
+    static u32 SizeToBinRoundUp(u32 _size) {
+        if (_size < MANTISSA_VALUE) return _size;
+        u32 mantissa_start = GetHighestBit(_size) - MANTISSA_BITS;
+        u32 bin            = ((mantissa_start + u32(1)) << MANTISSA_BITS) + ((_size >> mantissa_start) & MANTISSA_MASK);
+        // A carry out of the mantissa moves to the next exponent, which is what we want
+        if (_size & ((u32(1) << mantissa_start) - u32(1))) bin++;
+        return bin;
+    }
+    static u32 SizeToBinRoundDown(u32 _size) {
+        if (_size < MANTISSA_VALUE) return _size;
+        u32 mantissa_start = GetHighestBit(_size) - MANTISSA_BITS;
+        return ((mantissa_start + u32(1)) << MANTISSA_BITS) + ((_size >> mantissa_start) & MANTISSA_MASK);
+    }
+    static u64 BinToSize(u32 _bin) {
+        u32 exp      = _bin >> MANTISSA_BITS;
+        u32 mantissa = _bin & MANTISSA_MASK;
+        return exp == u32(0) ? u64(mantissa) : u64(mantissa | MANTISSA_VALUE) << u64(exp - u32(1));
+    }
+
+private:
+    u32 FindFreeBin(u32 _min_bin) const {
+        u32 top  = _min_bin >> TOP_BINS_SHIFT;
+        u32 leaf = _min_bin & LEAF_BINS_MASK;
+        if (top >= NUM_TOP_BINS) return NONE;
+        if (used_bins_top & (u32(1) << top)) {
+            u32 leaf_mask = u32(used_bins[top]) & (~u32(0) << leaf);
+            if (leaf_mask) return (top << TOP_BINS_SHIFT) | CountTrailingZeros(leaf_mask);
+        }
+        u32 top_mask = top + u32(1) < NUM_TOP_BINS ? used_bins_top & (~u32(0) << (top + u32(1))) : u32(0);
+        if (top_mask == u32(0)) return NONE;
+        top = CountTrailingZeros(top_mask);
+        return (top << TOP_BINS_SHIFT) | CountTrailingZeros(u32(used_bins[top]));
+    }
+    // Head of the first bin that is guaranteed to hold a block with _needed_size bytes at _alignment, NONE if there's none
+    u32 FindFreeNode(u32 _needed_size, u32 _alignment) const {
+        u32 bin = FindFreeBin(SizeToBinRoundUp(_needed_size));
+        if (bin == NONE) return NONE;
+        Node const &node    = nodes[bin_heads[bin]];
+        u64         aligned = (u64(node.offset) + u64(_alignment) - u64(1)) & ~(u64(_alignment) - u64(1));
+        if (aligned + u64(_needed_size) <= u64(node.offset) + u64(node.size)) return bin_heads[bin];
+        // The head is misaligned, a block with room for any alignment padding always fits
+        u64 padded_size = u64(_needed_size) + u64(_alignment) - u64(1);
+        if (padded_size > u64(u32(-1))) return NONE;
+        bin = FindFreeBin(SizeToBinRoundUp(u32(padded_size)));
+        return bin == NONE ? NONE : bin_heads[bin];
+    }
+    u32 InsertFreeNode(u32 _offset, u32 _size, u32 _neighbor_prev, u32 _neighbor_next) {
+        assert(num_free_nodes);
+        u32   node_idx     = free_nodes[--num_free_nodes];
+        Node &node         = nodes[node_idx];
+        node               = {};
+        node.offset        = _offset;
+        node.size          = _size;
+        node.neighbor_prev = _neighbor_prev;
+        node.neighbor_next = _neighbor_next;
+        if (_neighbor_prev != NONE) nodes[_neighbor_prev].neighbor_next = node_idx;
+        if (_neighbor_next != NONE) nodes[_neighbor_next].neighbor_prev = node_idx;
+        AddToBin(node_idx);
+        return node_idx;
+    }
+    void AddToBin(u32 _node_idx) {
+        Node &node = nodes[_node_idx];
+        u32   bin  = SizeToBinRoundDown(node.size);
+        u32   top  = bin >> TOP_BINS_SHIFT;
+        u32   leaf = bin & LEAF_BINS_MASK;
+        if (bin_heads[bin] == NONE) {
+            used_bins[top] |= u8(u32(1) << leaf);
+            used_bins_top |= u32(1) << top;
+        } else {
+            nodes[bin_heads[bin]].bin_prev = _node_idx;
+        }
+        node.used      = false;
+        node.bin_prev  = NONE;
+        node.bin_next  = bin_heads[bin];
+        bin_heads[bin] = _node_idx;
+    }
+    void RemoveFromBin(u32 _node_idx) {
+        Node &node = nodes[_node_idx];
+        if (node.bin_prev != NONE) {
+            nodes[node.bin_prev].bin_next = node.bin_next;
+        } else {
+            u32 bin        = SizeToBinRoundDown(node.size);
+            bin_heads[bin] = node.bin_next;
+            if (bin_heads[bin] == NONE) {
+                u32 top = bin >> TOP_BINS_SHIFT;
+                used_bins[top] &= u8(~(u32(1) << (bin & LEAF_BINS_MASK)));
+                if (used_bins[top] == u8(0)) used_bins_top &= ~(u32(1) << top);
+            }
+        }
+        if (node.bin_next != NONE) nodes[node.bin_next].bin_prev = node.bin_prev;
+        node.bin_prev = NONE;
+        node.bin_next = NONE;
+    }
+    void ReleaseNode(u32 _node_idx) { free_nodes[num_free_nodes++] = _node_idx; }
+
+public:
+    // _max_nodes bounds live allocations plus free blocks, every allocation can split off up to two free blocks
+    void Init(u32 _size, u32 _max_nodes = u32(1) << u32(16)) {
+        size      = _size;
+        max_nodes = std::max(u32(4), _max_nodes);
+        nodes.resize(max_nodes);
+        free_nodes.resize(max_nodes);
+        Flush();
+    }
+    Allocation Allocate(u32 needed_size, u32 alignment = u32(1)) {
+        alignment = std::max(u32(1), alignment);
+        assert((alignment & (alignment - u32(1))) == u32(0));
+        assert(needed_size);
+        if (needed_size == u32(0) || num_free_nodes < u32(2)) return Allocation{};
+        u32 node_idx = FindFreeNode(needed_size, alignment);
+        if (node_idx == NONE) return Allocation{};
+
+        RemoveFromBin(node_idx);
+        Node &node    = nodes[node_idx];
+        u32   aligned = u32((u64(node.offset) + u64(alignment) - u64(1)) & ~(u64(alignment) - u64(1)));
+        u32   end     = node.offset + node.size;
+        assert(u64(aligned) + u64(needed_size) <= u64(end));
+        // Alignment padding in front and what's left behind go back as free blocks. The neighbours of a free block are never free.
+        if (aligned != node.offset) InsertFreeNode(node.offset, aligned - node.offset, nodes[node_idx].neighbor_prev, node_idx);
+        if (aligned + needed_size != end) InsertFreeNode(aligned + needed_size, end - (aligned + needed_size), node_idx, nodes[node_idx].neighbor_next);
+        Node &used  = nodes[node_idx];
+        used.offset = aligned;
+        used.size   = needed_size;
+        used.used   = true;
+        free_space -= needed_size;
+        return Allocation{aligned, needed_size, node_idx};
+    }
+    bool CanAllocate(u32 needed_size, u32 alignment = u32(1)) const {
+        alignment = std::max(u32(1), alignment);
+        assert((alignment & (alignment - u32(1))) == u32(0));
+        assert(needed_size);
+        return needed_size && num_free_nodes >= u32(2) && FindFreeNode(needed_size, alignment) != NONE;
+    }
+    u32  GetSpaceLeft() const { return free_space; }
+    void Free(Allocation const &allocation) {
+        u32 node_idx = allocation.metadata;
+        assert(node_idx < max_nodes && nodes[node_idx].used && nodes[node_idx].offset == allocation.offset);
+        if (node_idx >= max_nodes || !nodes[node_idx].used) return;
+        free_space += nodes[node_idx].size;
+
+        Node &node = nodes[node_idx];
+        u32   prev = node.neighbor_prev;
+        if (prev != NONE && !nodes[prev].used) {
+            RemoveFromBin(prev);
+            node.offset        = nodes[prev].offset;
+            node.size          = node.size + nodes[prev].size;
+            node.neighbor_prev = nodes[prev].neighbor_prev;
+            if (node.neighbor_prev != NONE) nodes[node.neighbor_prev].neighbor_next = node_idx;
+            ReleaseNode(prev);
+        }
+        u32 next = node.neighbor_next;
+        if (next != NONE && !nodes[next].used) {
+            RemoveFromBin(next);
+            node.size          = node.size + nodes[next].size;
+            node.neighbor_next = nodes[next].neighbor_next;
+            if (node.neighbor_next != NONE) nodes[node.neighbor_next].neighbor_prev = node_idx;
+            ReleaseNode(next);
+        }
+        AddToBin(node_idx);
+    }
+    // Frees everything
     void Flush() {
-        // cursor = u32(0);
-        free_ranges.clear();
-        free_space     = size;
-        free_ranges[0] = size;
+        used_bins_top = u32(0);
+        for (u8 &b : used_bins) b = u8(0);
+        for (u32 &h : bin_heads) h = NONE;
+        num_free_nodes = max_nodes;
+        // Popped from the back, so node 0 goes first
+        ifor(max_nodes) free_nodes[i] = max_nodes - u32(1) - i;
+        free_space = size;
+        if (size) InsertFreeNode(u32(0), size, NONE, NONE);
     }
     void Release() { *this = {}; }
 
@@ -258,6 +450,301 @@ public:
 
             assert(offset_allocator.GetSpaceLeft() == u32(128 << 20));
         }
+
+        // Bins: every block in the round up bin fits, a block never sits in a bin above its size
+        {
+            u32 seed = u32(1);
+            ifor(1 << 16) {
+                u32 v = i < u32(1 << 12) ? i + u32(1) : (seed = pcg(seed)) >> ((seed >> u32(8)) & u32(31));
+                if (v == u32(0)) continue;
+                assert(BinToSize(SizeToBinRoundUp(v)) >= u64(v));
+                assert(BinToSize(SizeToBinRoundDown(v)) <= u64(v));
+                assert(SizeToBinRoundUp(v) < NUM_LEAF_BINS);
+                if (v < MANTISSA_VALUE) assert(BinToSize(SizeToBinRoundUp(v)) == u64(v));
+            }
+            assert(SizeToBinRoundUp(u32(-1)) < NUM_LEAF_BINS);
+        }
+
+        // Random sizes and alignments against a shadow map of live allocations: aligned, in bounds, no overlaps and exact space accounting
+        {
+            u32 const                 heap_size = u32(64 << 20);
+            OffsetAllocator           a         = {};
+            std::map<u32, Allocation> live      = {};
+            u64                       used      = u64(0);
+            u32                       seed      = u32(7);
+            a.Init(heap_size, u32(1) << u32(14));
+            auto check = [&](Allocation const &_a, u32 _alignment) {
+                assert(_a.offset % _alignment == u32(0));
+                assert(u64(_a.offset) + u64(_a.size) <= u64(heap_size));
+                auto next = live.lower_bound(_a.offset);
+                if (next != live.end()) assert(u64(_a.offset) + u64(_a.size) <= u64(next->first));
+                if (next != live.begin()) {
+                    auto prev = std::prev(next);
+                    assert(u64(prev->first) + u64(prev->second.size) <= u64(_a.offset));
+                }
+            };
+            ifor(1 << 17) {
+                seed = pcg(seed);
+                if (live.size() && (seed & u32(1) || live.size() > size_t(4000))) {
+                    auto it = live.lower_bound((seed = pcg(seed)) % heap_size);
+                    if (it == live.end()) it = live.begin();
+                    used -= it->second.size;
+                    a.Free(it->second);
+                    live.erase(it);
+                } else {
+                    u32        alignment = u32(1) << (((seed = pcg(seed)) >> u32(4)) % u32(13));
+                    u32        size      = u32(1) + ((seed = pcg(seed)) >> (u32(12) + (seed & u32(7))));
+                    bool       can       = a.CanAllocate(size, alignment);
+                    Allocation al        = a.Allocate(size, alignment);
+                    assert(can == al.IsValid());
+                    if (al.IsValid()) {
+                        assert(al.size == size);
+                        check(al, alignment);
+                        live[al.offset] = al;
+                        used += size;
+                    }
+                }
+                assert(u64(a.GetSpaceLeft()) == u64(heap_size) - used);
+            }
+            for (auto &it : live) a.Free(it.second);
+            assert(a.GetSpaceLeft() == heap_size);
+            // Everything merged back into one block
+            Allocation all = a.Allocate(heap_size);
+            assert(all.IsValid() && all.offset == u32(0));
+            a.Free(all);
+            // Running out of nodes fails cleanly. The trailing free block holds one node and Allocate keeps two spare for its splits.
+            OffsetAllocator small = {};
+            small.Init(u32(1 << 20), u32(8));
+            std::vector<Allocation> small_allocations = {};
+            while (true) {
+                Allocation al = small.Allocate(u32(16));
+                if (!al.IsValid()) break;
+                small_allocations.push_back(al);
+            }
+            assert(small_allocations.size() == size_t(6));
+            for (auto &al : small_allocations) small.Free(al);
+            assert(small.GetSpaceLeft() == u32(1 << 20) && small.Allocate(u32(1 << 20)).IsValid());
+        }
+
+        // Same sequence on the old map allocator: a fragmented 100 MiB upload heap with thousands of live allocations
+        {
+            u32 const heap_size  = u32(100 << 20);
+            u32 const num_ops    = u32(1) << u32(16);
+            u32 const num_live   = u32(4096);
+            f64       seconds[2] = {};
+            u64       failed[2]  = {};
+            auto      run        = [&](auto &_allocator, u32 _idx) {
+                using AllocationT              = typename std::remove_reference<decltype(_allocator)>::type::Allocation;
+                std::vector<AllocationT> live  = std::vector<AllocationT>(num_live, AllocationT{});
+                u32                      seed  = u32(3);
+                auto                     start = std::chrono::high_resolution_clock::now();
+                ifor(num_ops) {
+                    seed    = pcg(seed);
+                    u32 idx = (seed >> u32(8)) % num_live;
+                    if (live[idx].IsValid()) _allocator.Free(live[idx]);
+                    u32 size  = u32(256) + ((seed = pcg(seed)) >> u32(17));
+                    live[idx] = _allocator.Allocate(size, u32(256));
+                    if (!live[idx].IsValid()) failed[_idx]++;
+                }
+                for (auto &al : live)
+                    if (al.IsValid()) _allocator.Free(al);
+                seconds[_idx] = std::chrono::duration<f64>(std::chrono::high_resolution_clock::now() - start).count();
+                assert(_allocator.GetSpaceLeft() == heap_size);
+            };
+            {
+                OffsetAllocator allocator = {};
+                allocator.Init(heap_size);
+                run(allocator, u32(0));
+            }
+            {
+                MapOffsetAllocator allocator = {};
+                allocator.Init(heap_size);
+                run(allocator, u32(1));
+            }
+            fprintf(stdout, "[OFFSET ALLOCATOR TEST] %i alloc/free pairs: tlsf %f ms, map %f ms, failed %i/%i\n", i32(num_ops), seconds[0] * 1000.0, seconds[1] * 1000.0,
+                    i32(failed[0]), i32(failed[1]));
+        }
+    }
+};
+
+// Linear sub-allocation of [base, base + size) for data that lives until the frame that wrote it is done on the GPU. Allocate is lock free and can be called
+// from any thread: a compare exchange on a monotonic 64 bit cursor, so an allocation that doesn't fit never moves it. NextFrame, on the main thread once per
+// frame, retires everything allocated num_frames frames ago. Allocations have to be consumed by commands of the frame they were made in.
+class FrameRingAllocator {
+public:
+    // Offsets in the ring keep alignments up to this, base and size have to be multiples of it
+    static constexpr u32 MAX_ALIGNMENT = u32(1) << u32(16);
+    static constexpr u32 MAX_FRAMES    = u32(8);
+
+    struct Allocation {
+        u32 offset = u32(-1);
+        u32 size   = u32(0);
+
+        bool IsValid() const { return offset != u32(-1); }
+    };
+
+private:
+    u32              base                   = u32(0);
+    u32              size                   = u32(0);
+    u32              num_frames             = u32(0);
+    u32              frame_idx              = u32(0);
+    u64              frame_ends[MAX_FRAMES] = {}; // Cursor at the end of each frame in flight
+    std::atomic<u64> head                   = {u64(0)};
+    std::atomic<u64> tail                   = {u64(0)};
+
+public:
+    void Init(u32 _base, u32 _size, u32 _num_frames = u32(3)) {
+        assert(_base % MAX_ALIGNMENT == u32(0) && _size % MAX_ALIGNMENT == u32(0));
+        assert(_num_frames && _num_frames <= MAX_FRAMES);
+        base       = _base;
+        size       = _size;
+        num_frames = std::min(std::max(u32(1), _num_frames), MAX_FRAMES);
+        frame_idx  = u32(0);
+        for (u64 &e : frame_ends) e = u64(0);
+        head.store(u64(0));
+        tail.store(u64(0));
+    }
+    bool       IsInitialized() const { return size != u32(0); }
+    Allocation Allocate(u32 needed_size, u32 alignment = u32(256)) {
+        alignment = std::max(u32(1), alignment);
+        assert((alignment & (alignment - u32(1))) == u32(0) && alignment <= MAX_ALIGNMENT);
+        if (needed_size == u32(0) || needed_size > size) return Allocation{};
+        u64 cur = head.load(std::memory_order_relaxed);
+        while (true) {
+            u64 pos     = (cur + u64(alignment) - u64(1)) & ~(u64(alignment) - u64(1));
+            u64 in_ring = pos % u64(size);
+            // Never split across the end, skip to the start of the ring
+            if (in_ring + u64(needed_size) > u64(size)) pos += u64(size) - in_ring;
+            u64 end = pos + u64(needed_size);
+            if (end - tail.load(std::memory_order_acquire) > u64(size)) return Allocation{};
+            if (head.compare_exchange_weak(cur, end, std::memory_order_acq_rel, std::memory_order_relaxed))
+                return Allocation{base + u32(pos % u64(size)), needed_size};
+        }
+    }
+    // Closes the current frame and frees what the frame num_frames ago allocated
+    void NextFrame() {
+        if (!IsInitialized()) return;
+        frame_ends[frame_idx % num_frames] = head.load(std::memory_order_acquire);
+        frame_idx++;
+        tail.store(frame_ends[frame_idx % num_frames], std::memory_order_release);
+    }
+    // Bytes not yet retired, including what wrapping skipped
+    u64  GetBytesInFlight() const { return head.load() - tail.load(); }
+    u32  GetBase() const { return base; }
+    u32  GetSize() const { return size; }
+    void Release() {
+        base       = u32(0);
+        size       = u32(0);
+        num_frames = u32(0);
+        frame_idx  = u32(0);
+        head.store(u64(0));
+        tail.store(u64(0));
+    }
+
+    // _host stands in for the mapped buffer, every allocation is filled with a tag and checked while its frame is in flight
+    static void Test() {
+        u32 const        num_threads = std::max(u32(2), std::min(u32(8), u32(std::thread::hardware_concurrency())));
+        u32 const        ring_size   = u32(4) * MAX_ALIGNMENT;
+        u32 const        ring_base   = MAX_ALIGNMENT;
+        std::vector<u32> host        = std::vector<u32>((ring_base + ring_size) / sizeof(u32), u32(0));
+        struct Tagged {
+            Allocation a   = {};
+            u32        tag = u32(0);
+        };
+        FrameRingAllocator ring = {};
+        ring.Init(ring_base, ring_size, u32(3));
+
+        // Wrapping and running full
+        {
+            Allocation a = ring.Allocate(ring_size - u32(256));
+            Allocation b = ring.Allocate(u32(512));
+            assert(a.IsValid() && a.offset == ring_base && !b.IsValid());
+            ring.NextFrame();
+            ring.NextFrame();
+            assert(!ring.Allocate(u32(512)).IsValid());
+            ring.NextFrame();
+            // The first frame retired, 256 bytes are left at the end so this wraps to the start
+            b = ring.Allocate(u32(512));
+            assert(b.IsValid() && b.offset == ring_base);
+            Allocation c = ring.Allocate(u32(100), MAX_ALIGNMENT);
+            assert(c.IsValid() && c.offset % MAX_ALIGNMENT == u32(0));
+            ifor(3) ring.NextFrame();
+            assert(ring.GetBytesInFlight() == u64(0));
+        }
+
+        // Threads allocate and tag concurrently, frames in flight must stay disjoint and intact
+        std::vector<Tagged> in_flight[3] = {};
+        u64                 num_failed   = u64(0);
+        u32                 num_frames   = u32(200);
+        ifor(num_frames) {
+            u32                              frame = i;
+            std::vector<std::vector<Tagged>> per_thread(num_threads);
+            auto                             worker = [&](u32 _thread) {
+                u32 seed = pcg(frame * u32(977) + _thread);
+                jfor(64) {
+                    seed          = pcg(seed);
+                    u32 alignment = u32(4) << (seed % u32(8));
+                    u32 bytes     = (u32(4) + ((seed >> u32(8)) % u32(2048))) & ~u32(3);
+                    Allocation a  = ring.Allocate(bytes, alignment);
+                    if (!a.IsValid()) continue;
+                    assert(a.offset % alignment == u32(0) && a.offset >= ring_base && a.offset + a.size <= ring_base + ring_size);
+                    u32 tag = (frame << u32(16)) | (_thread << u32(8)) | (j & u32(0xff));
+                    for (u32 w = a.offset / u32(4); w < (a.offset + a.size) / u32(4); w++) host[w] = tag;
+                    per_thread[_thread].push_back({a, tag});
+                }
+            };
+            std::vector<std::thread> threads = {};
+            for (u32 t = u32(1); t < num_threads; t++) threads.emplace_back(worker, t);
+            worker(u32(0));
+            for (auto &t : threads) t.join();
+
+            std::vector<Tagged> &slot = in_flight[frame % 3];
+            slot.clear();
+            for (auto &v : per_thread) slot.insert(slot.end(), v.begin(), v.end());
+            if (slot.size() < size_t(num_threads) * size_t(64)) num_failed += u64(num_threads) * u64(64) - u64(slot.size());
+            for (auto const &frame_allocations : in_flight)
+                for (auto const &t : frame_allocations)
+                    for (u32 w = t.a.offset / u32(4); w < (t.a.offset + t.a.size) / u32(4); w++) assert(host[w] == t.tag);
+            ring.NextFrame();
+        }
+        // Allocations at ~2 KiB * 64 * threads per frame overflow a 256 KiB ring with 3 frames in flight, those have to fail rather than overlap
+        assert(num_failed > u64(0) || num_threads * u32(64) * u32(1024) * u32(3) < ring_size);
+
+        // Throughput: small frame allocations from every thread, against a mutex around the general allocator
+        {
+            u32 const num_allocations = u32(1) << u32(20);
+            f64       seconds[2]      = {};
+            ring.Release();
+            ring.Init(u32(0), u32(1024) * MAX_ALIGNMENT);
+            OffsetAllocator general = {};
+            general.Init(u32(1024) * MAX_ALIGNMENT, u32(1) << u32(21));
+            std::mutex mutex = {};
+            ifor(2) {
+                u32                      mode    = i;
+                std::atomic<u64>         checksum = {u64(0)};
+                auto                     start    = std::chrono::high_resolution_clock::now();
+                std::vector<std::thread> threads  = {};
+                auto                     worker   = [&] {
+                    u64 sum = u64(0);
+                    jfor(num_allocations / num_threads) {
+                        if (mode == u32(0)) {
+                            Allocation a = ring.Allocate(u32(64), u32(16));
+                            sum += u64(a.offset);
+                        } else {
+                            std::lock_guard<std::mutex> lock(mutex);
+                            sum += u64(general.Allocate(u32(64), u32(16)).offset);
+                        }
+                    }
+                    checksum += sum;
+                };
+                for (u32 t = u32(1); t < num_threads; t++) threads.emplace_back(worker);
+                worker();
+                for (auto &t : threads) t.join();
+                seconds[mode] = std::chrono::duration<f64>(std::chrono::high_resolution_clock::now() - start).count();
+            }
+            fprintf(stdout, "[FRAME RING TEST] %i threads, %i allocations: ring %f ms, locked offset allocator %f ms, %i failed in the stress test\n", i32(num_threads),
+                    i32(num_allocations), seconds[0] * 1000.0, seconds[1] * 1000.0, i32(num_failed));
+        }
     }
 };
 
@@ -313,6 +800,13 @@ static inline double time() { return ((double)clock()) / CLOCKS_PER_SEC; }
 #    define ASSERT_PANIC(x) ASSERT_ALWAYS(x)
 #    define NOTNULL(x) ASSERT_ALWAYS((x) != NULL)
 
+// Keeps a rarely taken slow path from being inlined into the caller's loop, where it costs registers on every iteration
+#    if defined(_MSC_VER)
+#        define UTILS_NOINLINE __declspec(noinline)
+#    else
+#        define UTILS_NOINLINE __attribute__((noinline))
+#    endif
+
 template <typename T = u8>
 struct Pool {
     u8 *ptr            = NULL;
@@ -440,18 +934,307 @@ struct Pool {
     bool has_space(size_t size) { return cursor + size <= capacity; }
 };
 
+// Per thread scratch memory. A large address range is reserved up front and committed in COMMIT_GRANULARITY steps as the cursor grows; the last page is never
+// committed, so running off the end faults instead of corrupting whatever comes next. Scopes nest without limit: each scope record is allocated in the arena right
+// below the memory it covers and links to the enclosing one. Allocations are aligned exactly, the padding is the only waste.
+// The cursor only moves back on scope exit and Reset, so scope peaks are folded in there. Allocation aligns the offset, bumps it and compares against the
+// committed size; Commit stays out of line.
+class ScratchArena {
+public:
+    static constexpr u64 DEFAULT_RESERVE    = u64(1) << u64(34); // Address space only
+    static constexpr u64 COMMIT_GRANULARITY = u64(1) << u64(20);
+    static constexpr u64 BASE_ALIGNMENT     = u64(4096); // Smallest page size, up to here aligning the offset aligns the pointer
+
+    struct Stats {
+        u64 reserved        = u64(0);
+        u64 committed       = u64(0);
+        u64 high_water      = u64(0); // Largest cursor so far
+        u64 last_scope_peak = u64(0); // Peak bytes of the last scope that exited, nested scopes included
+        u64 max_scope_peak  = u64(0);
+        u64 num_scopes      = u64(0);
+        u32 max_depth       = u32(0);
+    };
+
+private:
+    struct Scope {
+        Scope *prev       = NULL;
+        u64    cursor     = u64(0); // Before the scope record
+        u64    outer_peak = u64(0);
+    };
+
+    u8   *base      = NULL;
+    u64   reserved  = u64(0);
+    u64   committed = u64(0);
+    u64   cursor    = u64(0);
+    u64   peak      = u64(0); // Largest cursor since the innermost scope was entered, not counting the current one
+    Scope *top      = NULL;
+    u32   depth     = u32(0);
+    Stats stats     = {};
+
+    UTILS_NOINLINE void Commit(u64 _end) {
+        u64 limit = reserved - get_page_size(); // Guard page
+        ASSERT_ALWAYS(_end <= limit);
+        u64 new_committed = std::min(limit, (_end + COMMIT_GRANULARITY - u64(1)) & ~(COMMIT_GRANULARITY - u64(1)));
+#    if defined(_WIN32)
+        void *ptr = VirtualAlloc(base + committed, size_t(new_committed - committed), MEM_COMMIT, PAGE_READWRITE);
+        ASSERT_ALWAYS(ptr != NULL);
+#    elif __linux__
+        int err = mprotect(base + committed, size_t(new_committed - committed), PROT_READ | PROT_WRITE);
+        ASSERT_ALWAYS(err == 0);
+#    endif
+        committed = new_committed;
+    }
+
+public:
+    void Init(u64 _reserve = DEFAULT_RESERVE) {
+        Release();
+        reserved = (u64(page_align_up(size_t(_reserve))) & ~(COMMIT_GRANULARITY - u64(1))) + COMMIT_GRANULARITY;
+#    if defined(_WIN32)
+        base = (u8 *)VirtualAlloc(NULL, size_t(reserved), MEM_RESERVE, PAGE_NOACCESS);
+        NOTNULL(base);
+#    elif __linux__
+        void *ptr = mmap(NULL, size_t(reserved), PROT_NONE, MAP_ANON | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+        ASSERT_ALWAYS(ptr != MAP_FAILED);
+        base = (u8 *)ptr;
+#    else
+        // No virtual memory API, everything is committed
+        base = (u8 *)aligned_alloc(size_t(BASE_ALIGNMENT), size_t(reserved));
+        NOTNULL(base);
+        committed = reserved - get_page_size();
+#    endif
+        stats.reserved = reserved;
+    }
+    void Release() {
+        if (base) {
+#    if defined(_WIN32)
+            VirtualFree(base, 0, MEM_RELEASE);
+#    elif __linux__
+            munmap(base, size_t(reserved));
+#    else
+            free(base);
+#    endif
+        }
+        *this = {};
+    }
+    bool IsInitialized() const { return base != NULL; }
+
+    void *alloc(u64 _size, u64 _alignment = u64(16)) {
+        assert(_alignment && (_alignment & (_alignment - u64(1))) == u64(0));
+        u64 begin = (cursor + _alignment - u64(1)) & ~(_alignment - u64(1));
+        if (_alignment > BASE_ALIGNMENT) {
+            u64 address = u64(size_t(base)) + cursor;
+            begin       = cursor + (((address + _alignment - u64(1)) & ~(_alignment - u64(1))) - address);
+        }
+        u64 end = begin + _size;
+        if (end > committed) Commit(end);
+        cursor = end;
+        return base + begin;
+    }
+    void *alloc_zero(u64 _size, u64 _alignment = u64(16)) {
+        void *ptr = alloc(_size, _alignment);
+        memset(ptr, 0, size_t(_size));
+        return ptr;
+    }
+    void enter_scope() {
+        u64    scope_cursor = cursor;
+        Scope *scope        = (Scope *)alloc(sizeof(Scope), alignof(Scope));
+        scope->prev         = top;
+        scope->cursor       = scope_cursor;
+        scope->outer_peak   = std::max(peak, cursor);
+        peak                = cursor;
+        top                 = scope;
+        depth++;
+        stats.num_scopes++;
+        stats.max_depth = std::max(stats.max_depth, depth);
+    }
+    void exit_scope() {
+        ASSERT_ALWAYS(top != NULL);
+        Scope *scope          = top;
+        u64    scope_peak     = std::max(peak, cursor);
+        stats.last_scope_peak = scope_peak - scope->cursor;
+        stats.max_scope_peak  = std::max(stats.max_scope_peak, stats.last_scope_peak);
+        peak                  = std::max(scope_peak, scope->outer_peak);
+        cursor                = scope->cursor;
+        top                   = scope->prev;
+        depth--;
+    }
+    void Reset() {
+        stats.high_water = std::max(stats.high_water, std::max(peak, cursor));
+        cursor           = u64(0);
+        peak             = u64(0);
+        top              = NULL;
+        depth            = u32(0);
+    }
+    // Gives back committed memory past the cursor, keeping _keep bytes of slack
+    void Trim(u64 _keep = COMMIT_GRANULARITY) {
+        u64 new_committed = std::min(committed, (cursor + _keep + COMMIT_GRANULARITY - u64(1)) & ~(COMMIT_GRANULARITY - u64(1)));
+        if (new_committed >= committed) return;
+#    if defined(_WIN32)
+        VirtualFree(base + new_committed, size_t(committed - new_committed), MEM_DECOMMIT);
+#    elif __linux__
+        madvise(base + new_committed, size_t(committed - new_committed), MADV_DONTNEED);
+        mprotect(base + new_committed, size_t(committed - new_committed), PROT_NONE);
+#    else
+        return;
+#    endif
+        committed = new_committed;
+    }
+    u64   GetCursor() const { return cursor; }
+    u32   GetDepth() const { return depth; }
+    Stats GetStats() const {
+        Stats out      = stats;
+        out.committed  = committed;
+        out.high_water = std::max(stats.high_water, std::max(peak, cursor));
+        return out;
+    }
+
+    static void Test() {
+        ScratchArena arena = {};
+        arena.Init(u64(1) << u64(30));
+        defer(arena.Release());
+
+        // Exact alignment, scopes restore the cursor
+        u8 *a = (u8 *)arena.alloc(u64(3), u64(1));
+        u8 *b = (u8 *)arena.alloc(u64(8), u64(8));
+        assert(u64(b - a) == u64(8) && (u64(size_t(b)) & u64(7)) == u64(0));
+        u8 *c = (u8 *)arena.alloc(u64(1), u64(4096));
+        assert((u64(size_t(c)) & u64(4095)) == u64(0));
+        u8 *d = (u8 *)arena.alloc(u64(1), u64(1) << u64(16));
+        assert((u64(size_t(d)) & ((u64(1) << u64(16)) - u64(1))) == u64(0));
+        u64 before = arena.GetCursor();
+        arena.enter_scope();
+        arena.alloc(u64(1000));
+        arena.enter_scope();
+        arena.alloc(u64(5000));
+        arena.exit_scope();
+        u64 inner_peak = arena.GetStats().last_scope_peak;
+        assert(inner_peak >= u64(5000) && inner_peak < u64(5000) + u64(64));
+        arena.exit_scope();
+        assert(arena.GetCursor() == before);
+        assert(arena.GetStats().last_scope_peak >= u64(6000) && arena.GetStats().max_depth == u32(2));
+
+        // Deep nesting, far past the 32 scopes Pool allows, and growth past the first commit
+        ifor(100000) {
+            arena.enter_scope();
+            *(u32 *)arena.alloc(sizeof(u32), alignof(u32)) = i;
+        }
+        assert(arena.GetDepth() == u32(100000));
+        ifor(100000) arena.exit_scope();
+        assert(arena.GetCursor() == before && arena.GetDepth() == u32(0));
+        arena.enter_scope();
+        u8 *big = (u8 *)arena.alloc(u64(64) << u64(20));
+        memset(big, 0xab, size_t(64) << 20);
+        arena.exit_scope();
+        assert(arena.GetStats().committed >= (u64(64) << u64(20)) && arena.GetStats().high_water >= (u64(64) << u64(20)));
+        arena.Trim();
+        assert(arena.GetStats().committed <= COMMIT_GRANULARITY * u64(2));
+        // Trimmed memory comes back
+        memset(arena.alloc(u64(8) << u64(20)), 0, size_t(8) << 20);
+        arena.Reset();
+
+        // Parse shaped workload: s-expression text into child/next nodes, one scope per form, on Pool and on the arena
+        std::string text = {};
+        {
+            u32 seed = u32(5);
+            ifor(4096) {
+                text += "(form";
+                u32 nesting = u32(0);
+                jfor(64) {
+                    seed = pcg(seed);
+                    if ((seed & u32(7)) == u32(0) && nesting < u32(40)) {
+                        text += " (";
+                        nesting++;
+                    } else if ((seed & u32(7)) == u32(1) && nesting) {
+                        text += ")";
+                        nesting--;
+                    }
+                    text += " sym" + std::to_string(seed >> u32(20));
+                }
+                while (nesting--) text += ")";
+                text += ")\n";
+            }
+        }
+        struct Node {
+            char const *ptr   = NULL;
+            u32         len   = u32(0);
+            Node       *child = NULL;
+            Node       *next  = NULL;
+        };
+        auto parse = [&](auto &_storage, auto _alloc) {
+            u64 checksum = u64(0);
+            u64 i        = u64(0);
+            while (i < u64(text.size())) {
+                _storage.enter_scope();
+                Node **stack        = (Node **)_alloc(sizeof(Node *) * 64, alignof(Node *));
+                u32    stack_cursor = u32(0);
+                Node  *cur          = NULL;
+                do {
+                    char ch = text[size_t(i)];
+                    if (ch == '(' || ch == ')' || ch == ' ' || ch == '\n') {
+                        if (ch == ')') cur = stack[--stack_cursor];
+                        if (ch == '(') {
+                            Node *node = new (_alloc(sizeof(Node), alignof(Node))) Node();
+                            if (cur) cur->next = node;
+                            stack[stack_cursor++] = node;
+                            cur                   = node;
+                            node->child           = new (_alloc(sizeof(Node), alignof(Node))) Node();
+                            cur                   = node->child;
+                        }
+                        i++;
+                        continue;
+                    }
+                    Node *node = new (_alloc(sizeof(Node), alignof(Node))) Node();
+                    node->ptr  = text.c_str() + i;
+                    while (i < u64(text.size()) && text[size_t(i)] > ' ' && text[size_t(i)] != '(' && text[size_t(i)] != ')') i++;
+                    node->len = u32(text.c_str() + i - node->ptr);
+                    checksum += node->len;
+                    cur->next = node;
+                    cur       = node;
+                } while (stack_cursor && i < u64(text.size()));
+                _storage.exit_scope();
+            }
+            return checksum;
+        };
+        // Rounds alternate between the two and the best round counts, a single timing is mostly noise from whatever else the machine is doing
+        u32 const num_rounds  = u32(8);
+        u32 const num_runs    = u32(4);
+        f64       seconds[2]  = {1.0e9, 1.0e9};
+        u64       checksum[2] = {};
+        Pool<u8>  pool        = Pool<u8>::create(size_t(64) << 20);
+        defer(pool.Release());
+        ScratchArena parse_arena = {};
+        parse_arena.Init();
+        defer(parse_arena.Release());
+        ifor(num_rounds) {
+            {
+                auto start = std::chrono::high_resolution_clock::now();
+                jfor(num_runs) checksum[0] += parse(pool, [&](u64 _size, u64 _alignment) { return (void *)pool.alloc_align(size_t(_size), size_t(_alignment)); });
+                seconds[0] = std::min(seconds[0], std::chrono::duration<f64>(std::chrono::high_resolution_clock::now() - start).count());
+            }
+            {
+                auto start = std::chrono::high_resolution_clock::now();
+                jfor(num_runs) checksum[1] += parse(parse_arena, [&](u64 _size, u64 _alignment) { return parse_arena.alloc(_size, _alignment); });
+                seconds[1] = std::min(seconds[1], std::chrono::duration<f64>(std::chrono::high_resolution_clock::now() - start).count());
+            }
+        }
+        assert(checksum[0] == checksum[1]);
+        fprintf(stdout, "[SCRATCH ARENA TEST] %i parses of %i KiB, best of %i rounds: pool %f ms, arena %f ms, largest form scope %i bytes\n", i32(num_runs),
+                i32(text.size() >> 10), i32(num_rounds), seconds[0] * 1000.0, seconds[1] * 1000.0, i32(parse_arena.GetStats().max_scope_peak));
+    }
+};
+
 template <typename T = u8>
 using Temporary_Storage = Pool<T>;
 
 #    include <string.h>
 
 #    ifndef UTILS_TL_TMP_SIZE
-#        define UTILS_TL_TMP_SIZE 1 << 26
+// Address space reserved per thread, memory is committed as it's used
+#        define UTILS_TL_TMP_SIZE (u64(1) << u64(34))
 #    endif
 
 struct Thread_Local {
-    Temporary_Storage<> temporary_storage;
-    bool                initialized = false;
+    ScratchArena temporary_storage;
     ~Thread_Local() { temporary_storage.Release(); }
 #    ifdef UTILS_TL_IMPL_DEBUG
     i64 allocated = 0;
@@ -460,22 +1243,20 @@ struct Thread_Local {
     static Thread_Local *get_tl() {
         // TODO(aschrein): Change to __thread?
         static thread_local Thread_Local g_tl{};
-        if (g_tl.initialized == false) {
-            g_tl.initialized       = true;
-            g_tl.temporary_storage = Temporary_Storage<>::create(UTILS_TL_TMP_SIZE);
-        }
+        if (!g_tl.temporary_storage.IsInitialized()) g_tl.temporary_storage.Init(UTILS_TL_TMP_SIZE);
         return &g_tl;
     }
 };
+// Untyped byte allocations get the malloc alignment, callers cast them to structs
 template <typename T = u8>
 T *tl_alloc_tmp(u64 num = u64(1)) {
     assert(num > u64(0));
-    return (T *)Thread_Local::get_tl()->temporary_storage.alloc(num * sizeof(T));
+    return (T *)Thread_Local::get_tl()->temporary_storage.alloc(num * sizeof(T), std::max(alignof(T), alignof(std::max_align_t)));
 }
 template <typename T = u8>
 T *tl_alloc_tmp_init(u64 num = u64(1)) {
     assert(num > u64(0));
-    T *obj = (T *)Thread_Local::get_tl()->temporary_storage.alloc(num * sizeof(T));
+    T *obj = (T *)Thread_Local::get_tl()->temporary_storage.alloc(num * sizeof(T), std::max(alignof(T), alignof(std::max_align_t)));
     ifor(num) { new (&obj[i]) T(); }
     return obj;
 }
@@ -519,8 +1300,8 @@ static inline void *_tl_realloc(void *ptr, size_t oldsize, size_t newsize) {
 #    ifdef UTILS_TL_IMPL_DEBUG
 static inline void assert_tl_alloc_zero() {
     ASSERT_ALWAYS(Thread_Local::get_tl()->allocated == 0);
-    ASSERT_ALWAYS(Thread_Local::get_tl()->temporary_storage.cursor == 0);
-    ASSERT_ALWAYS(Thread_Local::get_tl()->temporary_storage.stack_cursor == 0);
+    ASSERT_ALWAYS(Thread_Local::get_tl()->temporary_storage.GetCursor() == 0);
+    ASSERT_ALWAYS(Thread_Local::get_tl()->temporary_storage.GetDepth() == 0);
 }
 #    endif
 
@@ -754,15 +1535,7 @@ static inline uint64_t hash_of(u64 u) {
 namespace std {
 template <>
 struct hash<StringRef> {
-    u64 operator()(StringRef const &item) const {
-        u64 hash = u64(5381);
-        if (item.len == 0) return 0;
-        ifor(item.len) {
-            u64 v = u64(item.ptr[i]) * u64(3935559000370003845) + u64(2691343689449507681);
-            hash  = hash ^ v;
-        }
-        return hash;
-    }
+    u64 operator()(StringRef const &item) const { return SJIT::HashBytes(item.ptr, item.len); }
 };
 }; // namespace std
 
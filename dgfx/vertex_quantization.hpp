@@ -0,0 +1,194 @@
+// MIT License
+//
+// Copyright (c) 2023 Anton Schreiner
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined(VERTEX_QUANTIZATION_HPP)
+#    define VERTEX_QUANTIZATION_HPP
+
+#    include "common.h"
+#    include "scene_cache.hpp"
+
+#    include <cassert>
+#    include <cstring>
+#    include <vector>
+
+namespace GfxJit {
+
+// 16 bytes instead of the 40 of SceneCacheVertex
+struct CompactVertex {
+    u32 position_xy = u32(0); // 16 bit unorm each, relative to the bounds of the mesh
+    u32 position_z  = u32(0); // 16 bit unorm, the upper half is unused
+    u32 normal      = u32(0); // Octahedral, 16 bit unorm each
+    u32 uv          = u32(0); // f16x2
+};
+// Per mesh, indexed by mesh id
+struct CompactVertexBounds {
+    f32x4 bounds_min = {};
+    f32x4 bounds_max = {};
+};
+
+struct CompactVertexStats {
+    u64 num_vertices       = u64(0);
+    u64 full_bytes         = u64(0); // SceneCacheVertex stream
+    u64 compact_bytes      = u64(0); // CompactVertex stream plus the bounds
+    f32 max_position_error = f32(0.0); // Object space units
+    f32 max_normal_error   = f32(0.0); // Radians
+    f32 max_uv_error       = f32(0.0);
+};
+
+struct VertexQuantization {
+    static constexpr f32 UNORM16_MAX = f32(65535.0);
+
+    static u32 ToUnorm16(f32 _v) { return u32(std::round(glm::clamp(_v, f32(0.0), f32(1.0)) * UNORM16_MAX)); }
+    static f32 FromUnorm16(u32 _v) { return f32(_v & u32(0xffff)) / UNORM16_MAX; }
+    // Straight from and to the bits, same as INTRINSIC_F32TOF16/INTRINSIC_F16TOF32 in sjit_cpu.hpp
+    static u32 ToHalf(f32 _v) { return u32(half_float::detail::float2half<std::round_to_nearest>(_v)); }
+    static f32 FromHalf(u32 _v) { return half_float::detail::half2float<f32>(half_float::detail::uint16(_v & u32(0xffff))); }
+
+    static CompactVertex Encode(SceneCacheVertex const &_v, CompactVertexBounds const &_bounds) {
+        f32x3         extent = f32x3(_bounds.bounds_max) - f32x3(_bounds.bounds_min);
+        f32x3         p      = f32x3(_v.position) - f32x3(_bounds.bounds_min);
+        CompactVertex out    = {};
+        u32           q[3]   = {};
+        xfor(3) q[x]         = extent[x] > f32(0.0) ? ToUnorm16(p[x] / extent[x]) : u32(0);
+        out.position_xy      = q[0] | (q[1] << u32(16));
+        out.position_z       = q[2];
+        f32x3 n              = f32x3(_v.normal);
+        f32x2 on             = dot(n, n) > f32(0.0) ? ::Octahedral::Encode(n) : f32x2(f32(0.5), f32(0.5));
+        out.normal           = ToUnorm16(on.x) | (ToUnorm16(on.y) << u32(16));
+        out.uv               = ToHalf(_v.uv.x) | (ToHalf(_v.uv.y) << u32(16));
+        return out;
+    }
+    // Same math as the SJIT decode in gfx_jit.hpp
+    static SceneCacheVertex Decode(CompactVertex const &_v, CompactVertexBounds const &_bounds) {
+        f32x3            q   = f32x3(FromUnorm16(_v.position_xy), FromUnorm16(_v.position_xy >> u32(16)), FromUnorm16(_v.position_z));
+        SceneCacheVertex out = {};
+        out.position         = f32x4(f32x3(_bounds.bounds_min) + q * (f32x3(_bounds.bounds_max) - f32x3(_bounds.bounds_min)), f32(1.0));
+        out.normal           = f32x4(::Octahedral::Decode(f32x2(FromUnorm16(_v.normal), FromUnorm16(_v.normal >> u32(16)))), f32(0.0));
+        out.uv               = f32x2(FromHalf(_v.uv), FromHalf(_v.uv >> u32(16)));
+        return out;
+    }
+
+    // Half a quantization step per axis
+    static f32 GetMaxPositionError(CompactVertexBounds const &_bounds) {
+        f32x3 extent = f32x3(_bounds.bounds_max) - f32x3(_bounds.bounds_min);
+        return length(extent) * f32(0.5) / UNORM16_MAX;
+    }
+    // Half a step moves the octahedral coordinates by at most 1/65535 per axis in [-1, 1]. That moves the unnormalized decode by at most sqrt(6) of that,
+    // and the unnormalized decode is at least 1/sqrt(3) long.
+    static f32 GetMaxNormalError() { return std::sqrt(f32(18.0)) / UNORM16_MAX; }
+    // Round to nearest f16: half an ulp, or half the smallest subnormal near zero
+    static f32 GetMaxUVError(f32 _uv) { return std::max(std::abs(_uv) * f32(1.0 / 2048.0), f32(1.0 / 33554432.0)); }
+    // acos loses too much near 1.0 in f32
+    static f32 GetAngle(f32x3 _a, f32x3 _b) { return std::atan2(length(cross(_a, _b)), dot(_a, _b)); }
+};
+
+static void EncodeCompactVertices(SceneCacheData const &_data, std::vector<CompactVertex> &_vertices, std::vector<CompactVertexBounds> &_bounds) {
+    _vertices.resize(_data.num_vertices);
+    _bounds.resize(_data.num_meshes);
+    ifor(_data.num_meshes) {
+        u32                  begin  = _data.meshes[i].base_vertex;
+        u32                  end    = begin + _data.GetNumMeshVertices(i);
+        CompactVertexBounds &bounds = _bounds[i];
+        f32x3                lo     = f32x3(f32(1.0e30));
+        f32x3                hi     = f32x3(f32(-1.0e30));
+        for (u32 v = begin; v < end; v++) {
+            lo = min(lo, f32x3(_data.vertices[v].position));
+            hi = max(hi, f32x3(_data.vertices[v].position));
+        }
+        if (begin == end) lo = hi = f32x3(f32(0.0));
+        bounds.bounds_min = f32x4(lo, f32(0.0));
+        bounds.bounds_max = f32x4(hi, f32(0.0));
+        for (u32 v = begin; v < end; v++) _vertices[v] = VertexQuantization::Encode(_data.vertices[v], bounds);
+    }
+}
+
+// Decodes everything again and measures the error against the source vertices
+static CompactVertexStats GetCompactVertexStats(SceneCacheData const &_data, std::vector<CompactVertex> const &_vertices, std::vector<CompactVertexBounds> const &_bounds) {
+    CompactVertexStats stats = {};
+    stats.num_vertices       = u64(_data.num_vertices);
+    stats.full_bytes         = u64(_data.num_vertices) * sizeof(SceneCacheVertex);
+    stats.compact_bytes      = u64(_vertices.size()) * sizeof(CompactVertex) + u64(_bounds.size()) * sizeof(CompactVertexBounds);
+    ifor(_data.num_meshes) {
+        u32 begin = _data.meshes[i].base_vertex;
+        u32 end   = begin + _data.GetNumMeshVertices(i);
+        for (u32 v = begin; v < end; v++) {
+            SceneCacheVertex const &src = _data.vertices[v];
+            SceneCacheVertex        dst = VertexQuantization::Decode(_vertices[v], _bounds[i]);
+            stats.max_position_error    = std::max(stats.max_position_error, length(f32x3(src.position) - f32x3(dst.position)));
+            f32x3 n                     = f32x3(src.normal);
+            if (dot(n, n) > f32(0.0)) stats.max_normal_error = std::max(stats.max_normal_error, VertexQuantization::GetAngle(normalize(n), f32x3(dst.normal)));
+            stats.max_uv_error = std::max(stats.max_uv_error, std::max(std::abs(src.uv.x - dst.uv.x), std::abs(src.uv.y - dst.uv.y)));
+        }
+    }
+    return stats;
+}
+
+static void TestVertexQuantization() {
+    u32 state = u32(1);
+    auto rnd  = [&]() {
+        state = pcg(state);
+        return f32(state & u32(0xffffff)) / f32(0xffffff);
+    };
+    SceneCacheData data = {};
+    // A unit-ish mesh, a large one and an empty one
+    f32 scales[] = {f32(1.0), f32(1000.0), f32(0.0)};
+    u32 counts[] = {u32(4096), u32(4096), u32(0)};
+    ifor(3) {
+        SceneCacheMesh mesh = {};
+        mesh.base_vertex    = u32(data.storage_vertices.size());
+        data.storage_meshes.push_back(mesh);
+        jfor(counts[i]) {
+            SceneCacheVertex v = {};
+            v.position         = f32x4(rnd() * scales[i], -rnd() * scales[i] * f32(0.5), rnd() * f32(3.0) - f32(1.0), f32(1.0));
+            f32x3 n            = f32x3(rnd(), rnd(), rnd()) * f32(2.0) - f32(1.0);
+            if (j == u32(0)) n = f32x3(f32(0.0), f32(0.0), f32(-1.0)); // The folded corner of the octahedron
+            v.normal           = f32x4(dot(n, n) > f32(1.0e-6) ? normalize(n) : f32x3(f32(0.0), f32(1.0), f32(0.0)), f32(0.0));
+            v.uv               = f32x2(rnd() * f32(4.0) - f32(2.0), rnd());
+            data.storage_vertices.push_back(v);
+        }
+    }
+    data.PointToStorage();
+
+    std::vector<CompactVertex>       vertices = {};
+    std::vector<CompactVertexBounds> bounds   = {};
+    EncodeCompactVertices(data, vertices, bounds);
+    static_assert(sizeof(CompactVertex) == size_t(16), "");
+    ifor(data.num_meshes) {
+        u32 begin = data.meshes[i].base_vertex;
+        u32 end   = begin + data.GetNumMeshVertices(i);
+        for (u32 v = begin; v < end; v++) {
+            SceneCacheVertex const &src = data.vertices[v];
+            SceneCacheVertex        dst = VertexQuantization::Decode(vertices[v], bounds[i]);
+            // A few ulps of slack for the float math on both sides
+            assert(length(f32x3(src.position) - f32x3(dst.position)) <= VertexQuantization::GetMaxPositionError(bounds[i]) * f32(1.01) + scales[i] * f32(1.0e-6));
+            assert(VertexQuantization::GetAngle(f32x3(src.normal), f32x3(dst.normal)) <= VertexQuantization::GetMaxNormalError() + f32(1.0e-6));
+            xfor(2) assert(std::abs(src.uv[x] - dst.uv[x]) <= VertexQuantization::GetMaxUVError(src.uv[x]));
+        }
+    }
+    CompactVertexStats stats = GetCompactVertexStats(data, vertices, bounds);
+    assert(stats.compact_bytes * u64(2) < stats.full_bytes);
+    (void)stats;
+}
+
+} // namespace GfxJit
+
+#endif // VERTEX_QUANTIZATION_HPP
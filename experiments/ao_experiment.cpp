@@ -139,7 +139,7 @@ public:
             u32        num_groups_x = (hash_table_size + num_threads[0] - 1) / num_threads[0];
 
             gfxCommandBindKernel(gfx, kernel.kernel);
-            gfxCommandDispatch(gfx, num_groups_x, 1, 1);
+            kernel.Dispatch(num_groups_x, 1, 1);
         }
         kernel.ResetTable();
         kernel.End();
@@ -251,7 +251,7 @@ public:
             u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
             gfxCommandBindKernel(gfx, kernel.kernel);
-            gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+            kernel.Dispatch(num_groups_x, num_groups_y, 1);
         }
         kernel.ResetTable();
         kernel.End();
@@ -365,7 +365,7 @@ public:
             u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
             gfxCommandBindKernel(gfx, kernel.kernel);
-            gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+            kernel.Dispatch(num_groups_x, num_groups_y, 1);
         }
         kernel.ResetTable();
         kernel.End();
@@ -430,7 +430,7 @@ protected:
         defer(frame_idx++);
         ping_pong.Next();
 
-        g_global_runtime_resource_registry = {};
+        g_global_runtime_resource_registry.Clear();
 
         set_global_resource(g_hash_grid_size, hash_grid_size);
         set_global_resource(g_hash_table_size, hash_table_size);
@@ -487,9 +487,10 @@ protected:
             ImVec2 wsize = GetImGuiSize();
             wsize.y      = wsize.x;
 
-            for (auto &i : g_pass_durations) {
-                ImGui::Text("%s %f", i.first.c_str(), i.second);
-            }
+            GetProfiler().ForEachStats([](ProfileTrack _track, std::string const &_name, ProfileStats const &_stats) {
+                if (_track != PROFILE_TRACK_GPU) return;
+                ImGui::Text("%s %f (min %f avg %f p99 %f)", _name.c_str(), _stats.last, _stats.min, _stats.avg, _stats.p99);
+            });
 
             ImGui::SliderFloat("hash_grid_size", &hash_grid_size, f32(1.0e-2), f32(1.0));
 
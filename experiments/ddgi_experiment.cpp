@@ -184,9 +184,7 @@ public:
         width           = _width;
         height          = _height;
 
-        {
-            HLSL_MODULE_SCOPE;
-
+        BuildKernel(gfx, &kernel, "DDGI/Trace", [=] {
             GetGlobalModule().SetGroupSize({u32(4), u32(4), u32(4)});
 
             u32x3 num_probes = u32x3(num_probes_x, num_probes_y, num_probes_z);
@@ -245,12 +243,8 @@ public:
             });
 
             // fprintf(stdout, GetGlobalModule().Finalize());
-
-            kernel = CompileGlobalModule(gfx, "DDGI/Trace");
-        }
-        {
-            HLSL_MODULE_SCOPE;
-
+        });
+        BuildKernel(gfx, &dup_border_kernel, "DDGI/Clone8", [=] {
             u32 group_size = u32(32);
 
             GetGlobalModule().SetGroupSize({group_size, u32(1), u32(1)});
@@ -369,12 +363,8 @@ public:
             g_radiance_probes.Store(make_u32x3(dst_coord, g_slice_idx), val);
 
             // fprintf(stdout, GetGlobalModule().Finalize());
-
-            dup_border_kernel = CompileGlobalModule(gfx, "DDGI/Clone8");
-        }
-        {
-            HLSL_MODULE_SCOPE;
-
+        });
+        BuildKernel(gfx, &dup_border_dist_kernel, "DDGI/Clone16", [=] {
             u32 group_size = u32(64);
 
             GetGlobalModule().SetGroupSize({group_size, u32(1), u32(1)});
@@ -546,12 +536,8 @@ public:
             g_distance_probes.Store(make_u32x3(dst_coord, g_slice_idx), val);
 
             // fprintf(stdout, GetGlobalModule().Finalize());
-
-            dup_border_dist_kernel = CompileGlobalModule(gfx, "DDGI/Clone16");
-        }
-        {
-            HLSL_MODULE_SCOPE;
-
+        });
+        BuildKernel(gfx, &apply_kernel, "DDGI/Apply", [=] {
             GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
 
             var dim = u32x2(_width, _height);
@@ -575,9 +561,7 @@ public:
                 var c             = random_albedo(instance_idx.ToF32());
                 g_output.Store(tid, make_f32x4(ao.x() * gi, f32(1.0)));
             });
-
-            apply_kernel = CompileGlobalModule(gfx, "DDGI/Apply");
-        }
+        });
     }
     void Execute() {
         defer(frame_idx++);
@@ -592,7 +576,7 @@ public:
                 u32        num_groups_z = (num_probes_y + num_threads[1] - 1) / num_threads[1];
 
                 gfxCommandBindKernel(gfx, kernel.kernel);
-                gfxCommandDispatch(gfx, num_groups_x, num_groups_y, num_groups_z);
+                kernel.Dispatch(num_groups_x, num_groups_y, num_groups_z);
             }
             kernel.ResetTable();
         }
@@ -602,7 +586,7 @@ public:
             dup_border_kernel.SetResource(g_slice_idx->GetResource()->GetName().c_str(), slice_idx);
             dup_border_kernel.CheckResources();
             gfxCommandBindKernel(gfx, dup_border_kernel.kernel);
-            gfxCommandDispatch(gfx, num_probes_x, num_probes_z, u32(1));
+            dup_border_kernel.Dispatch(num_probes_x, num_probes_z, u32(1));
 
             dup_border_kernel.ResetTable();
         }
@@ -612,7 +596,7 @@ public:
             dup_border_dist_kernel.SetResource(g_slice_idx->GetResource()->GetName().c_str(), slice_idx);
             dup_border_dist_kernel.CheckResources();
             gfxCommandBindKernel(gfx, dup_border_dist_kernel.kernel);
-            gfxCommandDispatch(gfx, num_probes_x, num_probes_z, u32(1));
+            dup_border_dist_kernel.Dispatch(num_probes_x, num_probes_z, u32(1));
 
             dup_border_dist_kernel.ResetTable();
         }
@@ -625,7 +609,7 @@ public:
                 u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
                 gfxCommandBindKernel(gfx, apply_kernel.kernel);
-                gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+                apply_kernel.Dispatch(num_groups_x, num_groups_y, 1);
             }
             kernel.ResetTable();
         }
@@ -661,9 +645,7 @@ public:
         height = _height;
         // u32 num_components = GetNumComponents(_format);
         result = gfxCreateTexture2D(gfx, width, height, DXGI_FORMAT_R16G16B16A16_FLOAT);
-        {
-            HLSL_MODULE_SCOPE;
-
+        BuildKernel(gfx, &kernel, "PreFilterAO", [=] {
             GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
 
             var tid = Input(IN_TYPE_DISPATCH_THREAD_ID)["xy"];
@@ -718,9 +700,7 @@ public:
             value_acc /= weigth_acc;
 
             g_rw_result.Store(tid, make_f32x4(value_acc["xxx"], f32(1.0)));
-
-            kernel = CompileGlobalModule(gfx, "PreFilterAO");
-        }
+        });
     }
     void Execute(GfxTexture input) {
         ping_pong.Next();
@@ -733,7 +713,7 @@ public:
             u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
             gfxCommandBindKernel(gfx, kernel.kernel);
-            gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+            kernel.Dispatch(num_groups_x, num_groups_y, 1);
         }
         kernel.ResetTable();
     }
@@ -769,9 +749,7 @@ public:
         height = _height;
         // u32 num_components = GetNumComponents(_format);
         ifor(2) results[i] = gfxCreateTexture2D(gfx, width, height, DXGI_FORMAT_R16G16B16A16_FLOAT);
-        {
-            HLSL_MODULE_SCOPE;
-
+        BuildKernel(gfx, &kernel, "TemporalFilter", [=] {
             GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
 
             var tid = Input(IN_TYPE_DISPATCH_THREAD_ID)["xy"];
@@ -836,9 +814,7 @@ public:
                         });
                 },
                 [&] { g_rw_result.Store(tid, make_f32x4(cur.xyz(), f32(1.0))); });
-
-            kernel = CompileGlobalModule(gfx, "TemporalFilter");
-        }
+        });
     }
     void Execute(GfxTexture input, GfxTexture prev) {
         ping_pong.Next();
@@ -852,7 +828,7 @@ public:
             u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
             gfxCommandBindKernel(gfx, kernel.kernel);
-            gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+            kernel.Dispatch(num_groups_x, num_groups_y, 1);
         }
         kernel.ResetTable();
     }
@@ -886,9 +862,7 @@ public:
         width              = _width;
         height             = _height;
         ifor(2) results[i] = gfxCreateTexture2D(gfx, width, height, DXGI_FORMAT_R16G16B16A16_FLOAT);
-        {
-            HLSL_MODULE_SCOPE;
-
+        BuildKernel(gfx, &kernel, "SpatialFilter", [=] {
             GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
 
             var tid = Input(IN_TYPE_DISPATCH_THREAD_ID)["xy"];
@@ -965,9 +939,7 @@ public:
             // g_rw_result.Store(tid, make_f32x4(l.y().AsF32()["xxx"], value_acc["y"]));
 
             // fprintf(stdout, GetGlobalModule().Finalize());
-
-            kernel = CompileGlobalModule(gfx, "SpatialFilter");
-        }
+        });
     }
     void Execute(GfxTexture input) {
         ping_pong.Next();
@@ -980,7 +952,7 @@ public:
             u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
             gfxCommandBindKernel(gfx, kernel.kernel);
-            gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+            kernel.Dispatch(num_groups_x, num_groups_y, 1);
         }
         kernel.ResetTable();
     }
@@ -1017,50 +989,52 @@ public:
             u32x2(0, 1), //
         };
         ifor(2) {
-            HLSL_MODULE_SCOPE;
+            // One name per direction, the .hlsl dumps and [REG PRESSURE] lines are keyed on it
+            char name[64] = {};
+            snprintf(name, sizeof(name), "SpatialFilterLarge_%i", i32(i));
+            BuildKernel(gfx, &kernels[i], (char const *)name, [=] {
+                GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
+
+                var tid            = Input(IN_TYPE_DISPATCH_THREAD_ID)["xy"];
+                var gid            = Input(IN_TYPE_GROUP_THREAD_ID)["xy"];
+                var g_rw_result    = ResourceAccess(Resource::Create(RWTexture2D_f32x4_Ty, "g_rw_result"));
+                var g_input        = ResourceAccess(Resource::Create(RWTexture2D_f32x4_Ty, "g_input"));
+                var dim            = u32x2(width, height);
+                var input          = g_input.Load(tid);
+                var uv             = (tid.ToF32() + f32x2(0.5, 0.5)) / dim.ToF32();
+                var xi             = GetNoise(tid);
+                var ray            = GenCameraRay(uv);
+                var center_gbuffer = DecodeGBuffer32Bits(ray, g_gbuffer_encoded.Load(tid), xi.x());
+                var eps            = GetEps(center_gbuffer["P"]);
+                var num_samples    = u32(2);
+                var fstride        = lerp(f32(16.0), f32(0.0), saturate(input.w() / f32(16.0)));
+                var stride         = fstride.ToU32();
+                EmitIfElse(
+                    stride == u32(0), [&] { g_rw_result.Store(tid, input); },
+                    [&] {
+                        var value_acc  = input;
+                        var weigth_acc = input.w().Copy();
+                        value_acc *= input.w();
+                        EmitForLoop(u32(0), num_samples * u32(2) + u32(1), [&](var iter) {
+                            var j       = stride.ToI32() * (iter.ToI32() - num_samples.ToI32()).ToI32();
+                            var soffset = var(dirs[i]).ToI32() * j;
+                            var src_pos = soffset + tid.ToI32();
+                            var uv      = (src_pos.ToF32() + f32x2(0.5, 0.5)) / dim.ToF32();
+                            var ray     = GenCameraRay(uv);
+                            var gbuffer = DecodeGBuffer32Bits(ray, g_gbuffer_encoded.Load(src_pos), xi.x());
+                            var weight  = GetWeight(center_gbuffer["N"], center_gbuffer["P"], gbuffer["N"], gbuffer["P"], eps);
+                            // weight *= Gaussian(length(soffset.ToF32()));
+                            var value = g_input.Load(src_pos);
+                            weight *= value.w();
+                            value_acc += weight * value;
+                            weigth_acc += weight;
+                        });
 
-            GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
+                        value_acc /= max(f32(1.0e-3), weigth_acc);
 
-            var tid            = Input(IN_TYPE_DISPATCH_THREAD_ID)["xy"];
-            var gid            = Input(IN_TYPE_GROUP_THREAD_ID)["xy"];
-            var g_rw_result    = ResourceAccess(Resource::Create(RWTexture2D_f32x4_Ty, "g_rw_result"));
-            var g_input        = ResourceAccess(Resource::Create(RWTexture2D_f32x4_Ty, "g_input"));
-            var dim            = u32x2(width, height);
-            var input          = g_input.Load(tid);
-            var uv             = (tid.ToF32() + f32x2(0.5, 0.5)) / dim.ToF32();
-            var xi             = GetNoise(tid);
-            var ray            = GenCameraRay(uv);
-            var center_gbuffer = DecodeGBuffer32Bits(ray, g_gbuffer_encoded.Load(tid), xi.x());
-            var eps            = GetEps(center_gbuffer["P"]);
-            var num_samples    = u32(2);
-            var fstride        = lerp(f32(16.0), f32(0.0), saturate(input.w() / f32(16.0)));
-            var stride         = fstride.ToU32();
-            EmitIfElse(
-                stride == u32(0), [&] { g_rw_result.Store(tid, input); },
-                [&] {
-                    var value_acc  = input;
-                    var weigth_acc = input.w().Copy();
-                    value_acc *= input.w();
-                    EmitForLoop(u32(0), num_samples * u32(2) + u32(1), [&](var iter) {
-                        var j       = stride.ToI32() * (iter.ToI32() - num_samples.ToI32()).ToI32();
-                        var soffset = var(dirs[i]).ToI32() * j;
-                        var src_pos = soffset + tid.ToI32();
-                        var uv      = (src_pos.ToF32() + f32x2(0.5, 0.5)) / dim.ToF32();
-                        var ray     = GenCameraRay(uv);
-                        var gbuffer = DecodeGBuffer32Bits(ray, g_gbuffer_encoded.Load(src_pos), xi.x());
-                        var weight  = GetWeight(center_gbuffer["N"], center_gbuffer["P"], gbuffer["N"], gbuffer["P"], eps);
-                        // weight *= Gaussian(length(soffset.ToF32()));
-                        var value = g_input.Load(src_pos);
-                        weight *= value.w();
-                        value_acc += weight * value;
-                        weigth_acc += weight;
+                        g_rw_result.Store(tid, value_acc);
                     });
-
-                    value_acc /= max(f32(1.0e-3), weigth_acc);
-
-                    g_rw_result.Store(tid, value_acc);
-                });
-            kernels[i] = CompileGlobalModule(gfx, "SpatialFilterLarge");
+            });
         }
     }
     void Execute(GfxTexture input) {
@@ -1074,7 +1048,7 @@ public:
                 u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
                 gfxCommandBindKernel(gfx, kernels[0].kernel);
-                gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+                kernels[0].Dispatch(num_groups_x, num_groups_y, 1);
             }
             kernels[0].ResetTable();
         }
@@ -1088,7 +1062,7 @@ public:
                 u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
                 gfxCommandBindKernel(gfx, kernels[1].kernel);
-                gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+                kernels[1].Dispatch(num_groups_x, num_groups_y, 1);
             }
             kernels[1].ResetTable();
         }
@@ -1125,9 +1099,7 @@ public:
         height = _height;
         // u32 num_components = GetNumComponents(_format);
         ifor(2) results[i] = gfxCreateTexture2D(gfx, width, height, DXGI_FORMAT_R16G16B16A16_FLOAT);
-        {
-            HLSL_MODULE_SCOPE;
-
+        BuildKernel(gfx, &kernel, "TemporalFilter", [=] {
             GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
 
             var tid = Input(IN_TYPE_DISPATCH_THREAD_ID)["xy"];
@@ -1217,9 +1189,7 @@ public:
                                });
                        },
                        [&] { g_rw_result.Store(tid, make_f32x4(cur.xyz(), f32(1.0))); });
-
-            kernel = CompileGlobalModule(gfx, "TemporalFilter");
-        }
+        });
     }
     void Execute(GfxTexture input) {
         ping_pong.Next();
@@ -1233,7 +1203,7 @@ public:
             u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
             gfxCommandBindKernel(gfx, kernel.kernel);
-            gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+            kernel.Dispatch(num_groups_x, num_groups_y, 1);
         }
         kernel.ResetTable();
     }
@@ -1275,49 +1245,47 @@ public:
         radiance    = gfxCreateTexture2D(gfx, width, height, DXGI_FORMAT_R11G11B10_FLOAT);
         ray_length  = gfxCreateTexture2D(gfx, width, height, DXGI_FORMAT_R16_FLOAT);
         confidence  = gfxCreateTexture2D(gfx, width, height, DXGI_FORMAT_R8_UNORM);
-        HLSL_MODULE_SCOPE;
-
-        GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
-
-        var dim = u32x2(width, height);
-
-        var tid = Input(IN_TYPE_DISPATCH_THREAD_ID)["xy"];
-        EmitIfElse((tid < dim).All(), [&] {
-            var xi = GetNoise(tid);
-            var N  = g_gbuffer_world_normals.Load(tid);
-            var P  = g_gbuffer_world_position.Load(tid);
+        BuildKernel(gfx, &kernel, "Raw_GGX_ReflectionsPass", [=] {
+            GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
 
-            EmitIfElse((N == f32x3_splat(0.0)).All(), [&] {
-                g_rw_radiance.Store(tid, f32x3_splat(0.0));
-                g_rw_confidence.Store(tid, f32(0.0));
-                g_rw_ray_length.Store(tid, f32(0.0));
-                EmitReturn();
-            });
+            var dim = u32x2(width, height);
 
-            var ray_query = TraceGGX(N, P, f32(0.1), xi);
+            var tid = Input(IN_TYPE_DISPATCH_THREAD_ID)["xy"];
+            EmitIfElse((tid < dim).All(), [&] {
+                var xi = GetNoise(tid);
+                var N  = g_gbuffer_world_normals.Load(tid);
+                var P  = g_gbuffer_world_position.Load(tid);
 
-            EmitIfElse(
-                ray_query["hit"],
-                [&] {
-                    var hit        = GetHit(ray_query);
-                    var w          = hit["W"];
-                    var ray_length = length(w - P);
-                    var n          = hit["N"];
-                    var l          = GetSunShadow(w, n);
-                    var gi         = SampleDDGIProbe(w, n);
-                    var c          = random_albedo(ray_query["instance_id"].ToF32());
-                    g_rw_radiance.Store(tid, (gi + l["xxx"]) * c);
-                    g_rw_confidence.Store(tid, ray_length);
-                    g_rw_ray_length.Store(tid, f32(1.0));
-                },
-                [&] {
+                EmitIfElse((N == f32x3_splat(0.0)).All(), [&] {
                     g_rw_radiance.Store(tid, f32x3_splat(0.0));
                     g_rw_confidence.Store(tid, f32(0.0));
                     g_rw_ray_length.Store(tid, f32(0.0));
+                    EmitReturn();
                 });
-        });
 
-        kernel = CompileGlobalModule(gfx, "Raw_GGX_ReflectionsPass");
+                var ray_query = TraceGGX(N, P, f32(0.1), xi);
+
+                EmitIfElse(
+                    ray_query["hit"],
+                    [&] {
+                        var hit        = GetHit(ray_query);
+                        var w          = hit["W"];
+                        var ray_length = length(w - P);
+                        var n          = hit["N"];
+                        var l          = GetSunShadow(w, n);
+                        var gi         = SampleDDGIProbe(w, n);
+                        var c          = random_albedo(ray_query["instance_id"].ToF32());
+                        g_rw_radiance.Store(tid, (gi + l["xxx"]) * c);
+                        g_rw_confidence.Store(tid, ray_length);
+                        g_rw_ray_length.Store(tid, f32(1.0));
+                    },
+                    [&] {
+                        g_rw_radiance.Store(tid, f32x3_splat(0.0));
+                        g_rw_confidence.Store(tid, f32(0.0));
+                        g_rw_ray_length.Store(tid, f32(0.0));
+                    });
+            });
+        });
     }
     void Execute() {
         kernel.SetResource(g_rw_radiance->resource->GetName().c_str(), radiance);
@@ -1330,7 +1298,7 @@ public:
             u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
             gfxCommandBindKernel(gfx, kernel.kernel);
-            gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+            kernel.Dispatch(num_groups_x, num_groups_y, 1);
         }
         kernel.ResetTable();
     }
@@ -1371,55 +1339,53 @@ public:
         radiance    = gfxCreateTexture2D(gfx, width, height, DXGI_FORMAT_R11G11B10_FLOAT);
         ray_length  = gfxCreateTexture2D(gfx, width, height, DXGI_FORMAT_R16_FLOAT);
         confidence  = gfxCreateTexture2D(gfx, width, height, DXGI_FORMAT_R8_UNORM);
-        HLSL_MODULE_SCOPE;
-
-        GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
-
-        var dim = u32x2(width, height);
+        BuildKernel(gfx, &kernel, "Raw_PerPixelGI", [=] {
+            GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
 
-        var tid = Input(IN_TYPE_DISPATCH_THREAD_ID)["xy"];
-        EmitIfElse((tid < dim).All(), [&] {
-            var xi = GetNoise(tid);
-            var N  = g_gbuffer_world_normals.Load(tid);
-            var P  = g_gbuffer_world_position.Load(tid);
+            var dim = u32x2(width, height);
 
-            EmitIfElse((N == f32x3_splat(0.0)).All(), [&] {
-                g_rw_radiance.Store(tid, f32x3_splat(0.0));
-                g_rw_confidence.Store(tid, f32(0.0));
-                g_rw_ray_length.Store(tid, f32(0.0));
-                EmitReturn();
-            });
-
-            var diffuse_ray       = GenDiffuseRay(P, N, xi);
-            var ray_desc          = Zero(RayDesc_Ty);
-            ray_desc["Direction"] = diffuse_ray["d"];
-            ray_desc["Origin"]    = diffuse_ray["o"];
-            ray_desc["TMin"]      = f32(1.0e-3);
-            ray_desc["TMax"]      = g_ray_length;
-            var ray_query         = RayQuery(g_tlas, ray_desc);
+            var tid = Input(IN_TYPE_DISPATCH_THREAD_ID)["xy"];
+            EmitIfElse((tid < dim).All(), [&] {
+                var xi = GetNoise(tid);
+                var N  = g_gbuffer_world_normals.Load(tid);
+                var P  = g_gbuffer_world_position.Load(tid);
 
-            EmitIfElse(
-                ray_query["hit"],
-                [&] {
-                    var hit        = GetHit(ray_query);
-                    var w          = hit["W"];
-                    var ray_length = length(w - P);
-                    var n          = hit["N"];
-                    var l          = GetSunShadow(w, n);
-                    var gi         = SampleDDGIProbe(w, n);
-                    var c          = random_albedo(ray_query["instance_id"].ToF32());
-                    g_rw_radiance.Store(tid, (gi + l["xxx"]) * c);
-                    g_rw_confidence.Store(tid, ray_length);
-                    g_rw_ray_length.Store(tid, f32(1.0));
-                },
-                [&] {
+                EmitIfElse((N == f32x3_splat(0.0)).All(), [&] {
                     g_rw_radiance.Store(tid, f32x3_splat(0.0));
                     g_rw_confidence.Store(tid, f32(0.0));
                     g_rw_ray_length.Store(tid, f32(0.0));
+                    EmitReturn();
                 });
-        });
 
-        kernel = CompileGlobalModule(gfx, "Raw_PerPixelGI");
+                var diffuse_ray       = GenDiffuseRay(P, N, xi);
+                var ray_desc          = Zero(RayDesc_Ty);
+                ray_desc["Direction"] = diffuse_ray["d"];
+                ray_desc["Origin"]    = diffuse_ray["o"];
+                ray_desc["TMin"]      = f32(1.0e-3);
+                ray_desc["TMax"]      = g_ray_length;
+                var ray_query         = RayQuery(g_tlas, ray_desc);
+
+                EmitIfElse(
+                    ray_query["hit"],
+                    [&] {
+                        var hit        = GetHit(ray_query);
+                        var w          = hit["W"];
+                        var ray_length = length(w - P);
+                        var n          = hit["N"];
+                        var l          = GetSunShadow(w, n);
+                        var gi         = SampleDDGIProbe(w, n);
+                        var c          = random_albedo(ray_query["instance_id"].ToF32());
+                        g_rw_radiance.Store(tid, (gi + l["xxx"]) * c);
+                        g_rw_confidence.Store(tid, ray_length);
+                        g_rw_ray_length.Store(tid, f32(1.0));
+                    },
+                    [&] {
+                        g_rw_radiance.Store(tid, f32x3_splat(0.0));
+                        g_rw_confidence.Store(tid, f32(0.0));
+                        g_rw_ray_length.Store(tid, f32(0.0));
+                    });
+            });
+        });
     }
     void Execute(f32 _ray_length) {
         kernel.SetResource(g_ray_length->resource->GetName().c_str(), _ray_length);
@@ -1433,7 +1399,7 @@ public:
             u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
             gfxCommandBindKernel(gfx, kernel.kernel);
-            gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+            kernel.Dispatch(num_groups_x, num_groups_y, 1);
         }
         kernel.ResetTable();
     }
@@ -1468,9 +1434,7 @@ public:
         width              = _width;
         height             = _height;
         ifor(2) results[i] = gfxCreateTexture2D(gfx, width, height, DXGI_FORMAT_R16G16B16A16_FLOAT);
-        {
-            HLSL_MODULE_SCOPE;
-
+        BuildKernel(gfx, &kernel, "ReflectionsReprojectPass", [=] {
             GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
 
             var  tid        = Input(IN_TYPE_DISPATCH_THREAD_ID)["xy"];
@@ -1526,9 +1490,7 @@ public:
                     g_rw_result.Store(tid, make_f32x4(mix.xyz(), new_num_samples));
                 },
                 [&] { g_rw_result.Store(tid, make_f32x4(cur.xyz(), f32(1.0))); });
-
-            kernel = CompileGlobalModule(gfx, "ReflectionsReprojectPass");
-        }
+        });
     }
     void Execute(GfxTexture input) {
         ping_pong.Next();
@@ -1542,7 +1504,7 @@ public:
             u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
             gfxCommandBindKernel(gfx, kernel.kernel);
-            gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+            kernel.Dispatch(num_groups_x, num_groups_y, 1);
         }
         kernel.ResetTable();
     }
@@ -1575,37 +1537,35 @@ public:
         width       = _width;
         height      = _height;
         result      = gfxCreateTexture2D(gfx, width, height, DXGI_FORMAT_R16G16B16A16_FLOAT);
-        HLSL_MODULE_SCOPE;
+        BuildKernel(gfx, &kernel, "AOPass", [=] {
+            GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
+
+            var dim = u32x2(width, height);
 
-        GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
+            var tid = Input(IN_TYPE_DISPATCH_THREAD_ID)["xy"];
+            EmitIfElse((tid < dim).All(), [&] {
+                var xi = GetNoise(tid);
+                var N  = g_gbuffer_world_normals.Load(tid);
+                var P  = g_gbuffer_world_position.Load(tid);
 
-        var dim = u32x2(width, height);
+                EmitIfElse((N == f32x3_splat(0.0)).All(), [&] {
+                    g_output.Store(tid, f32x4_splat(0.0));
+                    EmitReturn();
+                });
 
-        var tid = Input(IN_TYPE_DISPATCH_THREAD_ID)["xy"];
-        EmitIfElse((tid < dim).All(), [&] {
-            var xi = GetNoise(tid);
-            var N  = g_gbuffer_world_normals.Load(tid);
-            var P  = g_gbuffer_world_position.Load(tid);
+                var diffuse_ray = GenDiffuseRay(P, N, xi);
 
-            EmitIfElse((N == f32x3_splat(0.0)).All(), [&] {
-                g_output.Store(tid, f32x4_splat(0.0));
-                EmitReturn();
+                var ray_desc          = Zero(RayDesc_Ty);
+                ray_desc["Direction"] = diffuse_ray["d"];
+                ray_desc["Origin"]    = diffuse_ray["o"];
+                ray_desc["TMin"]      = f32(1.0e-3);
+                ray_desc["TMax"]      = g_ray_length;
+                var anyhit            = RayTest(g_tlas, ray_desc);
+                g_output.Store(tid, MakeIfElse(anyhit, f32x4_splat(0.0), f32x4_splat(1.0)));
             });
 
-            var diffuse_ray = GenDiffuseRay(P, N, xi);
-
-            var ray_desc          = Zero(RayDesc_Ty);
-            ray_desc["Direction"] = diffuse_ray["d"];
-            ray_desc["Origin"]    = diffuse_ray["o"];
-            ray_desc["TMin"]      = f32(1.0e-3);
-            ray_desc["TMax"]      = g_ray_length;
-            var anyhit            = RayTest(g_tlas, ray_desc);
-            g_output.Store(tid, MakeIfElse(anyhit, f32x4_splat(0.0), f32x4_splat(1.0)));
+            // fprintf(stdout, GetGlobalModule().Finalize());
         });
-
-        // fprintf(stdout, GetGlobalModule().Finalize());
-
-        kernel = CompileGlobalModule(gfx, "AOPass");
     }
     void Execute(f32 ray_length) {
         kernel.SetResource(g_ray_length->resource->GetName().c_str(), ray_length);
@@ -1617,7 +1577,7 @@ public:
             u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
             gfxCommandBindKernel(gfx, kernel.kernel);
-            gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+            kernel.Dispatch(num_groups_x, num_groups_y, 1);
         }
         kernel.ResetTable();
     }
@@ -1645,38 +1605,36 @@ public:
         gfx         = _gfx;
         width       = _width;
         height      = _height;
-        HLSL_MODULE_SCOPE;
-
-        GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
+        BuildKernel(gfx, &kernel, "Shade", [=] {
+            GetGlobalModule().SetGroupSize({u32(8), u32(8), u32(1)});
 
-        var dim = u32x2(width, height);
+            var dim = u32x2(width, height);
 
-        var tid = Input(IN_TYPE_DISPATCH_THREAD_ID)["xy"];
+            var tid = Input(IN_TYPE_DISPATCH_THREAD_ID)["xy"];
 
-        EmitIfElse((tid < dim).All(), [&] {
-            var N = g_gbuffer_world_normals.Load(tid);
-            var P = g_gbuffer_world_position.Load(tid);
-            EmitIfElse((N == f32x3_splat(0.0)).All(), [&] {
-                g_output.Store(tid, f32x4_splat(0.01));
-                EmitReturn();
+            EmitIfElse((tid < dim).All(), [&] {
+                var N = g_gbuffer_world_normals.Load(tid);
+                var P = g_gbuffer_world_position.Load(tid);
+                EmitIfElse((N == f32x3_splat(0.0)).All(), [&] {
+                    g_output.Store(tid, f32x4_splat(0.01));
+                    EmitReturn();
+                });
+                var ao                  = g_ao.Load(tid);
+                var visibility          = g_visibility_buffer.Load(tid);
+                var barys               = visibility.xy().AsF32();
+                var instance_idx        = visibility.z();
+                var primitive_idx       = visibility.w();
+                var l                   = GetSunShadow(P, N);
+                var indirect_irradiance = g_diffuse_gi.Load(tid);
+                var c                   = random_albedo(instance_idx.ToF32());
+                var irradiance          = l["xxx"] + indirect_irradiance;
+                var color               = c * irradiance;
+                color                   = pow(color, f32(1.0) / f32(2.2));
+                g_output.Store(tid, make_f32x4(color, f32(1.0)));
+                // g_output.Store(tid, make_f32x4(pow(gi, f32(1.0) / f32(2.2)), f32(1.0)));
             });
-            var ao                  = g_ao.Load(tid);
-            var visibility          = g_visibility_buffer.Load(tid);
-            var barys               = visibility.xy().AsF32();
-            var instance_idx        = visibility.z();
-            var primitive_idx       = visibility.w();
-            var l                   = GetSunShadow(P, N);
-            var indirect_irradiance = g_diffuse_gi.Load(tid);
-            var c                   = random_albedo(instance_idx.ToF32());
-            var irradiance          = l["xxx"] + indirect_irradiance;
-            var color               = c * irradiance;
-            color                   = pow(color, f32(1.0) / f32(2.2));
-            g_output.Store(tid, make_f32x4(color, f32(1.0)));
-            // g_output.Store(tid, make_f32x4(pow(gi, f32(1.0) / f32(2.2)), f32(1.0)));
         });
 
-        kernel = CompileGlobalModule(gfx, "Shade");
-
         // fprintf(stdout, kernel.isa.c_str());
     }
     void Execute(GfxTexture result) {
@@ -1688,7 +1646,7 @@ public:
             u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
             gfxCommandBindKernel(gfx, kernel.kernel);
-            gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+            kernel.Dispatch(num_groups_x, num_groups_y, 1);
         }
         kernel.ResetTable();
     }
@@ -1718,6 +1676,7 @@ protected:
 #define PASS(t, n) UniquePtr<t> n = {};
     PASS_LIST
 #undef PASS
+    UniquePtr<GfxRenderGraph> visibility_graph = {};
 
     u32  frame_idx    = u32(0);
     bool render_gizmo = false;
@@ -1728,12 +1687,25 @@ protected:
     GfxKernel    ddgi_probe_kernel     = {};
 
     void InitChild() override {}
+    // Type::Create* calls, canonical types allocated and module build time for every kernel of every pass, nothing is compiled
+    void BenchPassTypeInterning(u32 _num_iters = u32(16)) {
+        KernelBuildQueue build_queue(gfx);
+#define PASS(t, n) UniquePtr<t> bench_##n = UniquePtr<t>(new t(gfx));
+        PASS_LIST
+#undef PASS
+        build_queue.Drain([&](String const &_name, std::function<void()> const &_emit) { BenchTypeInterning(_name.c_str(), _emit, _num_iters); });
+    }
     void ResizeChild() override {
         ReleaseChild();
 
+        {
+            // Passes only record their kernels here, the whole list is emitted and compiled in parallel when the queue goes out of scope
+            KernelBuildQueue build_queue(gfx);
 #define PASS(t, n) n.reset(new t(gfx));
-        PASS_LIST
+            PASS_LIST
 #undef PASS
+        }
+        visibility_graph.reset(new GfxRenderGraph(gfx));
 
         gfxDrawStateSetColorTarget(ddgi_probe_draw_state, 0, color_buffer);
         gfxDrawStateSetDepthStencilTarget(ddgi_probe_draw_state, depth_buffer);
@@ -1748,7 +1720,7 @@ protected:
     void Render() override {
         defer(frame_idx++);
 
-        g_global_runtime_resource_registry                                                   = {};
+        g_global_runtime_resource_registry.Clear();
         g_global_runtime_resource_registry[g_frame_idx->GetResource()->GetName()]            = frame_idx;
         g_global_runtime_resource_registry[g_ddgi_radiance_probes->GetResource()->GetName()] = ddgi->GetRadianceProbeAtlas(); // Texture3D_f32x4_Ty);
         g_global_runtime_resource_registry[g_ddgi_distance_probes->GetResource()->GetName()] = ddgi->GetDistanceProbeAtlas(); // Texture3D_f32x4_Ty);
@@ -1782,16 +1754,19 @@ protected:
         g_global_runtime_resource_registry[g_sun_shadow_maps->GetResource()->GetName()]     = ResourceSlot(sun.GetTextures().data(), (uint32_t)sun.GetTextures().size());
         g_global_runtime_resource_registry[g_sun_dir->GetResource()->GetName()]             = sun.GetDir();
 
-        gbuffer_from_vis->Execute();
+        // The visibility chain runs through the render graph, the passes after it still pick its results up from the registry
+        visibility_graph->Reset();
+        auto gbuffer = gbuffer_from_vis->AddToGraph(*visibility_graph);
+        encode_gbuffer->AddToGraph(*visibility_graph, gbuffer);
+        disocclusion->AddToGraph(*visibility_graph, gbuffer);
+        nearest_velocity->AddToGraph(*visibility_graph, gbuffer);
+        visibility_graph->Execute();
+
         g_global_runtime_resource_registry[g_gbuffer_world_normals->GetResource()->GetName()]       = gbuffer_from_vis->GetNormals();
         g_global_runtime_resource_registry[g_gbuffer_world_position->GetResource()->GetName()]      = gbuffer_from_vis->GetWorldPosition();
         g_global_runtime_resource_registry[g_prev_gbuffer_world_normals->GetResource()->GetName()]  = gbuffer_from_vis->GetPrevNormals();
         g_global_runtime_resource_registry[g_prev_gbuffer_world_position->GetResource()->GetName()] = gbuffer_from_vis->GetPrevWorldPosition();
 
-        encode_gbuffer->Execute();
-        disocclusion->Execute();
-        nearest_velocity->Execute();
-
         raw_per_pixel_gi->Execute(ddgi->GetSpacing());
         primary_rays->Execute();
 
@@ -1955,6 +1930,7 @@ protected:
     GfxTexture &GetResult() override { return color_buffer; }
     // GfxTexture GetResult() override { return temporal_filter_final->GetResult(); }
     void ReleaseChild() override {
+        visibility_graph.reset();
 #define PASS(t, n) n.reset();
         PASS_LIST
 #undef PASS
@@ -140,7 +140,7 @@ public:
             u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
             gfxCommandBindKernel(gfx, kernel.kernel);
-            gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+            kernel.Dispatch(num_groups_x, num_groups_y, 1);
         }
         kernel.End();
         g_pass_durations[kernel.name] = kernel.duration;
@@ -262,7 +262,7 @@ public:
             u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
             gfxCommandBindKernel(gfx, kernel.kernel);
-            gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+            kernel.Dispatch(num_groups_x, num_groups_y, 1);
         }
         kernel.End();
         g_pass_durations[kernel.name] = kernel.duration;
@@ -423,7 +423,7 @@ public:
             u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
             gfxCommandBindKernel(gfx, kernel.kernel);
-            gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+            kernel.Dispatch(num_groups_x, num_groups_y, 1);
         }
         kernel.End();
         g_pass_durations[kernel.name] = kernel.duration;
@@ -531,7 +531,7 @@ public:
             u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
             gfxCommandBindKernel(gfx, kernel.kernel);
-            gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+            kernel.Dispatch(num_groups_x, num_groups_y, 1);
         }
         kernel.End();
         g_pass_durations[kernel.name] = kernel.duration;
@@ -803,7 +803,7 @@ public:
             u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
             gfxCommandBindKernel(gfx, kernel.kernel);
-            gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+            kernel.Dispatch(num_groups_x, num_groups_y, 1);
         }
         kernel.End();
         g_pass_durations[kernel.name] = kernel.duration;
@@ -996,7 +996,7 @@ public:
             u32        num_groups_y = (height / 2 + num_threads[1] - 1) / num_threads[1];
 
             gfxCommandBindKernel(gfx, kernel.kernel);
-            gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+            kernel.Dispatch(num_groups_x, num_groups_y, 1);
         }
         kernel.End();
         g_pass_durations[kernel.name] = kernel.duration;
@@ -1120,7 +1120,7 @@ public:
             u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
             gfxCommandBindKernel(gfx, kernel.kernel);
-            gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+            kernel.Dispatch(num_groups_x, num_groups_y, 1);
         }
         kernel.End();
         g_pass_durations[kernel.name] = kernel.duration;
@@ -1222,7 +1222,7 @@ public:
                 u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
                 gfxCommandBindKernel(gfx, kernels[0].kernel);
-                gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+                kernels[0].Dispatch(num_groups_x, num_groups_y, 1);
             }
             kernels[0].ResetTable();
         }
@@ -1238,7 +1238,7 @@ public:
                 u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
                 gfxCommandBindKernel(gfx, kernels[1].kernel);
-                gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+                kernels[1].Dispatch(num_groups_x, num_groups_y, 1);
             }
             kernels[1].ResetTable();
         }
@@ -1485,7 +1485,7 @@ public:
                 u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
                 gfxCommandBindKernel(gfx, kernel.kernel);
-                gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+                kernel.Dispatch(num_groups_x, num_groups_y, 1);
             }
             kernel.End();
             g_pass_durations[kernel.name] = kernel.duration;
@@ -1505,7 +1505,7 @@ public:
                 u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
                 gfxCommandBindKernel(gfx, kernel.kernel);
-                gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+                kernel.Dispatch(num_groups_x, num_groups_y, 1);
             }
             kernel.End();
             g_pass_durations[kernel.name] = kernel.duration;
@@ -1596,7 +1596,7 @@ public:
             u32        num_groups_y = (height + num_threads[1] - 1) / num_threads[1];
 
             gfxCommandBindKernel(gfx, kernel.kernel);
-            gfxCommandDispatch(gfx, num_groups_x, num_groups_y, 1);
+            kernel.Dispatch(num_groups_x, num_groups_y, 1);
         }
         kernel.ResetTable();
     }
@@ -1761,10 +1761,11 @@ protected:
             ImGui::Checkbox("taa", &enable_taa);
             ImGui::Checkbox("taa jitter", &enable_taa_jitter);
             // ImGui::Text("Specular GI Total %f ms", duration);
-            for (auto &i : g_pass_durations) {
-                ImGui::Text("%s %f ms", i.first.c_str(), i.second);
-                // ImGui::Text("--- %s %f ns per pixel", i.first.c_str(), f64(1000000.0) * i.second / (width * height));
-            }
+            GetProfiler().ForEachStats([](ProfileTrack _track, std::string const &_name, ProfileStats const &_stats) {
+                if (_track != PROFILE_TRACK_GPU) return;
+                ImGui::Text("%s %f ms (min %f avg %f p99 %f)", _name.c_str(), _stats.last, _stats.min, _stats.avg, _stats.p99);
+                // ImGui::Text("--- %s %f ns per pixel", _name.c_str(), f64(1000000.0) * _stats.last / (width * height));
+            });
             ImGui::Checkbox("Slow down", &slow_down);
             ImGui::Checkbox("Render Gizmo", &render_gizmo);
             ImGui::Checkbox("Debug Probe", &debug_probe);
@@ -32,6 +32,9 @@ TextureCube g_EnvironmentBuffer;
 
 SamplerState g_LinearSampler;
 
+// Finest uv footprint each texture was sampled with, read back for texture streaming. 0 means not sampled.
+RWStructuredBuffer<uint> g_TextureFeedback;
+
 struct Params {
     float4 position : SV_Position;
     float3 normal : NORMAL;
@@ -49,6 +52,13 @@ struct Result {
 // https://seblagarde.wordpress.com/2011/08/17/hello-world/
 float3 FresnelSchlickRoughness(in float n_dot_v, in float3 F0, in float roughness) { return F0 + (max(F0, 1.0f - roughness) - F0) * pow(1.0f - n_dot_v, 5.0f); }
 
+// 1 + 16 * -log2(footprint), see GetTextureFeedbackMip. Map ids come from the material of the draw, so they're the same for the whole wave.
+void WriteTextureFeedback(in uint texture_map, in uint feedback) {
+    if (texture_map == uint(-1)) return;
+    feedback = WaveActiveMax(feedback);
+    if (WaveIsFirstLane()) InterlockedMax(g_TextureFeedback[texture_map], feedback);
+}
+
 // Calculates motion vectors in UV-space (i.e., normalized [0, 1] coordinates)
 float2 CalculateVelocity(in Params params) {
     float2 ndc_velocity = params.current.xy / params.current.w - params.previous.xy / params.previous.w;
@@ -72,6 +82,15 @@ Result main(in Params params, uint primitiveID : SV_PrimitiveID, float3 baryWeig
     uint normal_map      = asuint(material.ao_normal_emissivity.y);
     uint ao_map          = asuint(material.ao_normal_emissivity.x);
 
+    // Before the discard, and outside of any branch for the derivatives
+    float2 duv      = float2(length(ddx(params.uv)), length(ddy(params.uv)));
+    uint   feedback = uint(clamp(-log2(max(max(duv.x, duv.y), 1.0e-9f)), 0.0f, 31.0f) * 16.0f) + 1;
+    WriteTextureFeedback(albedo_map, feedback);
+    WriteTextureFeedback(roughness_map, feedback);
+    WriteTextureFeedback(metallicity_map, feedback);
+    WriteTextureFeedback(normal_map, feedback);
+    WriteTextureFeedback(ao_map, feedback);
+
     if (albedo_map != uint(-1)) {
         material.albedo.xyzw *= g_Textures[albedo_map].Sample(g_TextureSampler, params.uv).xyzw;
     }
@@ -36,8 +36,16 @@
 #    include "3rdparty/half.hpp"
 #    include "3rdparty/robin-map/include/tsl/robin_map.h"
 #    include "3rdparty/robin-map/include/tsl/robin_set.h"
+#    include "string_hash.hpp"
+#    include <algorithm>
+#    include <atomic>
+#    include <chrono>
 #    include <dxgiformat.h>
+#    include <functional>
+#    include <mutex>
 #    include <stdarg.h>
+#    include <string>
+#    include <thread>
 
 #    if !defined(ifor)
 #        define ifor(N) for (u32 i = u32(0); i < ((u32)(N)); ++i)
@@ -263,27 +271,13 @@ public:
     ~SharedPtr() { Release(); }
     operator bool() const { return ptr != NULL; }
 };
-template <int N>
-static constexpr u64 compute_hash(char const _c_str[N]) {
-    u64 _hash = u64(5381);
-    ifor(N) {
-        char c = _c_str[i];
-        u64  v = u64(c) * u64(3935559000370003845) + u64(2691343689449507681);
-        _hash  = _hash ^ v;
-    }
-    return _hash;
-}
-static u64 compute_hash(char const *_c_str) {
-    u64 _hash = u64(5381);
-    if (_c_str == NULL) return u64(0);
-    u64 cursor = u64(0);
-    while (true) {
-        char c = _c_str[cursor++];
-        if (c == '\0') break;
-        u64 v = u64(c) * u64(3935559000370003845) + u64(2691343689449507681);
-        _hash = _hash ^ v;
-    }
-    return _hash;
+template <typename T, typename std::enable_if<std::is_same<T, char const *>::value || std::is_same<T, char *>::value, int>::type = 0>
+static u64 compute_hash(T const &_c_str) {
+    return HashString(_c_str);
+}
+template <size_t N>
+static constexpr u64 compute_hash(char const (&_c_str)[N]) {
+    return HashString(_c_str);
 }
 struct c_str {
     char const *data;
@@ -348,9 +342,14 @@ private:
     }
 
 public:
-    template <int N>
-    constexpr String(char const c_str[N]) : data(c_str), hash(u32(compute_hash(c_str) & u32(0xffffffff))), own(0) {}
-    String(char const *c_str = NULL) { Init(c_str); }
+    // Literals hash at compile time, see HashString for why pointers go through a template
+    template <size_t N>
+    constexpr String(char const (&c_str)[N]) : data(c_str), hash(u32(compute_hash(c_str) & u32(0xffffffff))), own(0) {}
+    template <typename T, typename std::enable_if<std::is_same<T, char const *>::value || std::is_same<T, char *>::value, int>::type = 0>
+    String(T const &c_str) {
+        Init(c_str);
+    }
+    String() = default;
     u32    GetHash() const { return hash; }
     String Copy() const {
         String o = {};
@@ -556,6 +555,10 @@ enum InType {
     IN_TYPE_GROUP_THREAD_ID,
     IN_TYPE_CUSTOM,
 };
+struct TypeInternStats {
+    u64 num_lookups     = u64(0); // Type::Create* calls, each used to allocate a fresh Type
+    u64 num_allocations = u64(0); // Canonical types actually allocated
+};
 class Type;
 class HLSLModule;
 static void EmitType(Type *ty, HLSLModule &hlsl_module);
@@ -575,23 +578,104 @@ private:
     bool                                      builtin       = true;
     u32                                       num_elems     = u32(1);
 
+    static u64 Mix(u64 h, u64 v) { return (h ^ v) * u64(0x100000001b3); }
+    // Children are interned already so they hash and compare by address
+    u64 StructuralHash() const {
+        u64 h = u64(0xcbf29ce484222325);
+        h     = Mix(h, u64(name.GetHash()));
+        h     = Mix(h, u64(basic_type) | (u64(vector_size) << u64(8)) | (u64(col_size) << u64(16)) | (u64(res_type) << u64(24)) | (u64(dim_type) << u64(32)) |
+                           (u64(rw_type) << u64(40)) | (u64(builtin) << u64(48)));
+        h     = Mix(h, u64(numeric_value) | (u64(num_elems) << u64(32)));
+        h     = Mix(h, u64(template_type.get()));
+        h     = Mix(h, u64(elem_type.get()));
+        for (auto &f : fields) {
+            h = Mix(h, u64(f.first.GetHash()));
+            h = Mix(h, u64(f.second.get()));
+        }
+        return h;
+    }
+    bool IsSame(Type const &that) const {
+        if (basic_type != that.basic_type || vector_size != that.vector_size || col_size != that.col_size || res_type != that.res_type || dim_type != that.dim_type ||
+            rw_type != that.rw_type || numeric_value != that.numeric_value || builtin != that.builtin || num_elems != that.num_elems)
+            return false;
+        if (template_type.get() != that.template_type.get() || elem_type.get() != that.elem_type.get()) return false;
+        if (!(name == that.name)) return false;
+        if (fields.size() != that.fields.size()) return false;
+        ifor(fields.size()) {
+            if (fields[i].second.get() != that.fields[i].second.get()) return false;
+            if (!(fields[i].first == that.fields[i].first)) return false;
+        }
+        return true;
+    }
+    static std::atomic<u64> &GetNumLookups() {
+        static std::atomic<u64> v = {u64(0)};
+        return v;
+    }
+    static std::atomic<u64> &GetNumAllocations() {
+        static std::atomic<u64> v = {u64(0)};
+        return v;
+    }
+    static TypeInternStats &GetThreadStats() {
+        static thread_local TypeInternStats v = {};
+        return v;
+    }
+    // Canonical types live for the lifetime of the process.
+    static SharedPtr<Type> Intern(Type const &key) {
+        static std::mutex                             mutex = {};
+        static HashMap<u64, Array<SharedPtr<Type>>> table = {};
+
+        GetNumLookups()++;
+        GetThreadStats().num_lookups++;
+
+        u64                         hash = key.StructuralHash();
+        std::lock_guard<std::mutex> lock(mutex);
+        auto                       &bucket = table[hash];
+        for (auto &t : bucket)
+            if (t->IsSame(key)) return t;
+
+        GetNumAllocations()++;
+        GetThreadStats().num_allocations++;
+
+        SharedPtr<Type> o(new Type);
+        o->name          = key.name.Copy(); // Names may come from stack buffers
+        o->basic_type    = key.basic_type;
+        o->vector_size   = key.vector_size;
+        o->col_size      = key.col_size;
+        o->template_type = key.template_type;
+        o->elem_type     = key.elem_type;
+        o->res_type      = key.res_type;
+        o->dim_type      = key.dim_type;
+        o->rw_type       = key.rw_type;
+        o->numeric_value = key.numeric_value;
+        o->builtin       = key.builtin;
+        o->num_elems     = key.num_elems;
+        for (auto &f : key.fields) o->fields.push_back({f.first.Copy(), f.second});
+        bucket.push_back(o);
+        return o;
+    }
+
 public:
-    bool                                      IsBuiltin() { return builtin; }
-    u32                                       GetNumElems() { return num_elems; }
-    String                                    GetName() { return name; }
-    BasicType                                 GetBasicTy() { return basic_type; }
-    SharedPtr<Type>                           GetElemType() { return elem_type; }
-    SharedPtr<Type>                           GetTemplateType() { return template_type; }
-    ResType                                   GetResType() { return res_type; }
-    DimType                                   GetDimType() { return dim_type; }
-    u32                                       GetVectorSize() { return vector_size; }
-    u32                                       GetColSize() { return col_size; }
-    u32                                       GetNumericValue() { return numeric_value; }
-    RWType                                    GetRWType() { return rw_type; }
-    Array<std::pair<String, SharedPtr<Type>>> GetFields() { return fields; }
+    bool                                             IsBuiltin() { return builtin; }
+    u32                                              GetNumElems() { return num_elems; }
+    String                                           GetName() { return name; }
+    BasicType                                        GetBasicTy() { return basic_type; }
+    SharedPtr<Type>                                  GetElemType() { return elem_type; }
+    SharedPtr<Type>                                  GetTemplateType() { return template_type; }
+    ResType                                          GetResType() { return res_type; }
+    DimType                                          GetDimType() { return dim_type; }
+    u32                                              GetVectorSize() { return vector_size; }
+    u32                                              GetColSize() { return col_size; }
+    u32                                              GetNumericValue() { return numeric_value; }
+    RWType                                           GetRWType() { return rw_type; }
+    Array<std::pair<String, SharedPtr<Type>>> const &GetFields() { return fields; }
 
     SJIT_REFERENCE_COUNTER_IMPL;
 
+    // Types are interned by structure, so two types are equal iff their pointers are
+    static TypeInternStats GetInternStats() { return {GetNumLookups().load(), GetNumAllocations().load()}; }
+    // Counters of the calling thread, kernels are built on a single thread so deltas of these are per kernel
+    static TypeInternStats GetThreadInternStats() { return GetThreadStats(); }
+
     bool            IsArray() { return basic_type == BASIC_TYPE_ARRAY; }
     bool            IsStruct() { return basic_type == BASIC_TYPE_STRUCTURE; }
     bool            IsVector() { return IsBasicTypeScalar(basic_type) && vector_size >= u32(1) && vector_size <= u32(4) && col_size == u32(1); }
@@ -602,64 +686,50 @@ public:
         return {};
     }
     static SharedPtr<Type> CreateArray(String _name, SharedPtr<Type> _elem_type, u32 _num_elems) {
-        SharedPtr<Type> o(new Type);
-        o->name       = _name;
-        o->basic_type = BASIC_TYPE_ARRAY;
-        o->elem_type  = _elem_type;
-        o->num_elems  = _num_elems;
-        return o;
+        Type o       = {};
+        o.name       = _name;
+        o.basic_type = BASIC_TYPE_ARRAY;
+        o.elem_type  = _elem_type;
+        o.num_elems  = _num_elems;
+        return Intern(o);
     }
     static SharedPtr<Type> Create(String _name, BasicType ty, u32 _vector_size = u32(1), u32 _col_size = u32(1)) {
-        SharedPtr<Type> o(new Type);
-        o->name        = _name;
-        o->basic_type  = ty;
-        o->vector_size = _vector_size;
-        o->col_size    = _col_size;
-        return o;
+        Type o        = {};
+        o.name        = _name;
+        o.basic_type  = ty;
+        o.vector_size = _vector_size;
+        o.col_size    = _col_size;
+        return Intern(o);
     }
     static SharedPtr<Type> Create(u32 num) {
-        SharedPtr<Type> o(new Type);
-        o->basic_type    = BASIC_TYPE_NUMBER;
-        o->numeric_value = num;
-        return o;
+        Type o          = {};
+        o.basic_type    = BASIC_TYPE_NUMBER;
+        o.numeric_value = num;
+        return Intern(o);
     }
     static SharedPtr<Type> Create(String _name, BasicType ty, SharedPtr<Type> _template_type, ResType _res_type, DimType _dim_type, RWType _rw_type) {
-        SharedPtr<Type> o(new Type);
-        o->name          = _name;
-        o->basic_type    = ty;
-        o->template_type = _template_type;
-        o->res_type      = _res_type;
-        o->dim_type      = _dim_type;
-        o->rw_type       = _rw_type;
-        return o;
+        Type o          = {};
+        o.name          = _name;
+        o.basic_type    = ty;
+        o.template_type = _template_type;
+        o.res_type      = _res_type;
+        o.dim_type      = _dim_type;
+        o.rw_type       = _rw_type;
+        return Intern(o);
     }
     static SharedPtr<Type> CreateStructuredBuffer(SharedPtr<Type> _template_type) {
-        SharedPtr<Type> o(new Type);
-        o->name          = "StructuredBuffer";
-        o->basic_type    = BASIC_TYPE_RESOURCE;
-        o->template_type = _template_type;
-        o->res_type      = RES_BUFFER;
-        o->dim_type      = DIM_UNKNOWN;
-        o->rw_type       = RW_READ;
-        return o;
+        return Create("StructuredBuffer", BASIC_TYPE_RESOURCE, _template_type, RES_BUFFER, DIM_UNKNOWN, RW_READ);
     }
     static SharedPtr<Type> CreateRWStructuredBuffer(SharedPtr<Type> _template_type) {
-        SharedPtr<Type> o(new Type);
-        o->name          = "RWStructuredBuffer";
-        o->basic_type    = BASIC_TYPE_RESOURCE;
-        o->template_type = _template_type;
-        o->res_type      = RES_BUFFER;
-        o->dim_type      = DIM_UNKNOWN;
-        o->rw_type       = RW_READ_WRITE;
-        return o;
+        return Create("RWStructuredBuffer", BASIC_TYPE_RESOURCE, _template_type, RES_BUFFER, DIM_UNKNOWN, RW_READ_WRITE);
     }
     static SharedPtr<Type> Create(String _name, Array<std::pair<String, SharedPtr<Type>>> _fields, bool _builtin = false) {
-        SharedPtr<Type> o(new Type);
-        o->basic_type = BASIC_TYPE_STRUCTURE;
-        o->name       = _name;
-        o->fields     = _fields;
-        o->builtin    = _builtin;
-        return o;
+        Type o       = {};
+        o.basic_type = BASIC_TYPE_STRUCTURE;
+        o.name       = _name;
+        o.fields     = std::move(_fields);
+        o.builtin    = _builtin;
+        return Intern(o);
     }
     void EmitHLSL(HLSLModule &hlsl_module) { EmitType(this, hlsl_module); }
 };
@@ -927,6 +997,32 @@ static HashMap<BasicType, HashMap<u32, SharedPtr<Type>>> vector_type_table = {
          {u32(4), u1x4Ty}, //
      }},
 };
+// Flat [basic_type][vector_size] views of the tables above, built once at startup so that type inference is an array load and never inserts into a shared map
+static constexpr u32 NUM_BASIC_TYPES = u32(BASIC_TYPE_ARRAY) + u32(1);
+class FlatTypeTable {
+private:
+    SharedPtr<Type> types[NUM_BASIC_TYPES][5] = {};
+
+public:
+    FlatTypeTable(HashMap<BasicType, HashMap<u32, SharedPtr<Type>>> const &_table) {
+        for (auto &bt : _table)
+            for (auto &vt : bt.second) {
+                sjit_assert(u32(bt.first) < NUM_BASIC_TYPES && vt.first < u32(5));
+                types[u32(bt.first)][vt.first] = vt.second;
+            }
+    }
+    SharedPtr<Type> const &Get(BasicType _basic_type, u32 _vector_size) const {
+        static SharedPtr<Type> null_ty = {};
+        if (u32(_basic_type) >= NUM_BASIC_TYPES || _vector_size >= u32(5)) return null_ty;
+        return types[u32(_basic_type)][_vector_size];
+    }
+};
+static FlatTypeTable const vector_types        = FlatTypeTable(vector_type_table);
+static FlatTypeTable const texture_2d_types    = FlatTypeTable(texture_2d_type_table);
+static FlatTypeTable const rw_texture_2d_types = FlatTypeTable(rw_texture_2d_type_table);
+static FlatTypeTable const texture_3d_types    = FlatTypeTable(texture_3d_type_table);
+static FlatTypeTable const rw_texture_3d_types = FlatTypeTable(rw_texture_3d_type_table);
+static SharedPtr<Type> const &GetVectorTy(BasicType _basic_type, u32 _vector_size) { return vector_types.Get(_basic_type, _vector_size); }
 
 class Resource;
 class Module {
@@ -1000,33 +1096,241 @@ class HLSLModule;
         class_name const &operator=(class_name const &) = delete;                                                                                                                  \
         class_name const &operator=(class_name &&) = delete;
 
+// Interned strings live for the lifetime of the process.
+static char const *InternString(char const *_str) {
+    static std::mutex      mutex = {};
+    static HashSet<String> table = {};
+    std::lock_guard<std::mutex> lock(mutex);
+
+    String key = String(_str);
+    auto   it  = table.find(key);
+    if (it != table.end()) return it->c_str();
+    String copy = key.Copy();
+    char const *result = copy.c_str();
+    table.insert(std::move(copy));
+    return result;
+}
+
+struct ExprNodeStats {
+    u64 num_nodes  = u64(0);
+    u64 node_bytes = u64(0);
+};
+// Number of nodes the optimizer got rid of in a module
+struct OptimizerStats {
+    u32 num_cse_hits           = u32(0);
+    u32 num_folded_constants   = u32(0);
+    u32 num_simplified         = u32(0);
+    u32 num_collapsed_swizzles = u32(0);
+    u32 num_dead_temporaries   = u32(0);
+};
+// Default for new modules, see HLSLModule::SetOptimize
+static bool g_optimize_modules = true;
+// Estimated 32 bit registers live at once in the text given to the scheduler and in what it produced, see HLSLModule::EstimateMaxLive
+struct ScheduleStats {
+    u32 max_live_before    = u32(0);
+    u32 max_live_after     = u32(0);
+    u32 num_sunk           = u32(0);
+    u32 num_rematerialized = u32(0);
+};
+// Default for new modules, see HLSLModule::SetSchedule
+static bool g_schedule_modules = true;
+
+// Shared by all threads, ids only need to be unique. The text doesn't depend on them, see HLSLModule::RenumberTemporaries.
+static std::atomic<u32> &GetExprIdCounter() {
+    static std::atomic<u32> counter = {};
+    return counter;
+}
+
+// Running hash of the HLSL text a module emits, fed by its writers as the text is written.
+// A cache lookup doesn't need the finalized text, but a hit has still paid for the emission.
+// Expr ids are global, tmp_%i names are folded into the order of their first appearance so that two builds of the same kernel hash the same.
+class EmittedTextHasher {
+private:
+    u64  hash               = u64(0xcbf29ce484222325);
+    u64  check              = u64(0x2545f4914f6cdd1d); // Second hash of the same stream with an unrelated function, see GetCheck
+    u32  num_matched        = u32(0);
+    bool in_number          = false;
+    u64  number             = u64(0);
+    u32  num_ordinals       = u32(0);
+    u64  declarations       = u64(0);
+    u64  declarations_check = u64(0);
+
+    HashMap<u64, u32> ordinals = {}; // id -> 1 + order of first appearance
+
+    static u64 Mix(u64 h, u64 v) {
+        h ^= v + u64(0x9e3779b97f4a7c15) + (h << u64(6)) + (h >> u64(2));
+        return h * u64(0x100000001b3);
+    }
+    static u64 MixCheck(u64 h, u64 v) {
+        h = (h + v + u64(1)) * u64(0xff51afd7ed558ccd);
+        return h ^ (h >> u64(29));
+    }
+    u64 FoldNumber() const {
+        auto it = ordinals.find(number);
+        if (it != ordinals.end()) return u64(it->second);
+        return u64(num_ordinals + u32(1));
+    }
+    void FlushNumber() {
+        if (!in_number) return;
+        in_number = false;
+        if (ordinals.find(number) == ordinals.end()) ordinals[number] = ++num_ordinals;
+        Mix(FoldNumber());
+    }
+
+public:
+    static u64 Hash(char const *_str) {
+        u64 h = u64(0xcbf29ce484222325);
+        if (_str)
+            while (*_str) h = (h ^ u64(u8(*_str++))) * u64(0x100000001b3);
+        return h;
+    }
+    void Mix(u64 v) {
+        hash  = Mix(hash, v);
+        check = MixCheck(check, v);
+    }
+    // Types, resources and LDS live in hash maps so their order of appearance doesn't matter
+    void AddDeclaration(std::initializer_list<u64> _items) {
+        u64 h = u64(0);
+        u64 c = u64(0);
+        for (u64 v : _items) {
+            h = Mix(h, v);
+            c = MixCheck(c, v);
+        }
+        declarations += h;
+        declarations_check ^= c;
+    }
+    void Feed(char const *_data, u64 _len) {
+        static constexpr char tmp_prefix[] = "tmp_";
+        ifor(_len) {
+            char c = _data[i];
+            if (in_number) {
+                if (c >= '0' && c <= '9') {
+                    number = number * u64(10) + u64(c - '0');
+                    continue;
+                }
+                FlushNumber();
+            }
+            hash  = (hash ^ u64(u8(c))) * u64(0x100000001b3);
+            check = MixCheck(check, u64(u8(c)));
+            if (c == tmp_prefix[num_matched]) {
+                num_matched++;
+                if (num_matched == u32(4)) {
+                    num_matched = u32(0);
+                    in_number   = true;
+                    number      = u64(0);
+                }
+            } else {
+                num_matched = c == 't' ? u32(1) : u32(0);
+            }
+        }
+    }
+    u64 Get(u64 _extra = u64(0)) const { return Mix(Mix(in_number ? Mix(hash, FoldNumber()) : hash, declarations), _extra); }
+    // Independent of Get, a cache keyed on Get compares this on a hit so a 64 bit collision doesn't hand out the wrong kernel
+    u64 GetCheck(u64 _extra = u64(0)) const { return MixCheck(MixCheck(in_number ? MixCheck(check, FoldNumber()) : check, declarations_check), _extra); }
+};
+
 class SimpleWriter {
 private:
-    char *buf        = NULL;
-    u64   buf_cursor = u64(0);
+    static constexpr u64 min_capacity = u64(1 << 12);
+
+    char             *buf        = NULL;
+    u64               buf_cursor = u64(0);
+    u64               capacity   = u64(0);
+    EmittedTextHasher *hasher     = NULL;
+
+    void Commit(u64 _start) {
+        if (hasher) hasher->Feed(buf + _start, buf_cursor - _start);
+    }
+
+    // Makes room for _size more chars and the terminator
+    void Reserve(u64 _size) {
+        u64 required = buf_cursor + _size + u64(1);
+        if (required <= capacity) return;
+        u64 new_capacity = std::max(min_capacity, capacity * u64(2));
+        while (new_capacity < required) new_capacity *= u64(2);
+        char *new_buf = new char[new_capacity];
+        if (buf_cursor) memcpy(new_buf, buf, buf_cursor);
+        delete[] buf;
+        buf      = new_buf;
+        capacity = new_capacity;
+    }
 
 public:
     SJIT_DONT_MOVE(SimpleWriter);
 
-    SimpleWriter() { buf = new char[1 << 20]; }
+    SimpleWriter() = default;
     ~SimpleWriter() { delete[] buf; }
 
+    u64  GetSize() const { return buf_cursor; }
+    u64  GetCapacity() const { return capacity; }
+    void SetHasher(EmittedTextHasher *_hasher) { hasher = _hasher; }
+
     void EmitF(char const *fmt, ...) {
         va_list args;
+        va_list args_copy;
         va_start(args, fmt);
-#    define _CRT_SECURE_NO_WARNINGS
-        buf_cursor += vsprintf(buf + buf_cursor, fmt, args);
-#    undef _CRT_SECURE_NO_WARNINGS
+        va_copy(args_copy, args);
+        u64 remaining = capacity - buf_cursor;
+        i32 len       = vsnprintf(buf ? buf + buf_cursor : NULL, remaining, fmt, args);
+        sjit_assert(len >= i32(0));
+        if (u64(len) >= remaining) {
+            Reserve(u64(len));
+            vsnprintf(buf + buf_cursor, capacity - buf_cursor, fmt, args_copy);
+        }
+        buf_cursor += u64(len);
+        Commit(buf_cursor - u64(len));
+        va_end(args_copy);
         va_end(args);
     }
     void Reset() { buf_cursor = u64(0); }
-    void Write(char const *str) {
-        u64 len = strlen(str);
+    void Write(char const *str, u64 len) {
+        Reserve(len);
         memcpy(buf + buf_cursor, str, len);
         buf_cursor += len;
+        Commit(buf_cursor - len);
+    }
+    void Write(char const *str) { Write(str, strlen(str)); }
+    void Putc(char const c) {
+        Reserve(u64(1));
+        buf[buf_cursor++] = c;
+        Commit(buf_cursor - u64(1));
+    }
+    void WriteU64(u64 v) {
+        char digits[20];
+        u32  num_digits = u32(0);
+        do {
+            digits[num_digits++] = char('0' + v % u64(10));
+            v /= u64(10);
+        } while (v);
+        Reserve(num_digits);
+        u64 start = buf_cursor;
+        while (num_digits) buf[buf_cursor++] = digits[--num_digits];
+        Commit(start);
+    }
+    void WriteI32(i32 v) {
+        if (v < i32(0)) Putc('-');
+        WriteU64(v < i32(0) ? u64(-int64_t(v)) : u64(v));
+    }
+    // Same digits as "%f": f32 * 1e6 is exact in f64, so a single rounding to integer matches printf.
+    void WriteF32(f32 v) {
+        f64 scaled = f64(v) * f64(1.0e6);
+        if (!(std::abs(scaled) < f64(1.0e18))) {
+            EmitF("%f", v);
+            return;
+        }
+        if (std::signbit(v)) Putc('-');
+        u64 fixed = u64(std::nearbyint(std::abs(scaled)));
+        WriteU64(fixed / u64(1000000));
+        u64  frac      = fixed % u64(1000000);
+        char digits[7] = {'.'};
+        for (u32 i = u32(6); i >= u32(1); i--) {
+            digits[i] = char('0' + frac % u64(10));
+            frac /= u64(10);
+        }
+        Write(digits, u64(7));
     }
-    void        Putc(char const c) { buf[buf_cursor++] = c; }
     char const *Finalize() {
+        Reserve(u64(0));
         buf[buf_cursor] = '\0';
         return buf;
     }
@@ -1035,66 +1339,448 @@ public:
         return *this;
     }
     SimpleWriter &operator<<(f32 v) {
-        EmitF("f32(%f)", v);
+        Write("f32(");
+        WriteF32(v);
+        Putc(')');
         return *this;
     }
     SimpleWriter &operator<<(f32x2 v) {
-        EmitF("f32x2(%f, %f)", v.x, v.y);
+        Write("f32x2(");
+        ifor(2) {
+            if (i) Write(", ");
+            WriteF32(v[i]);
+        }
+        Putc(')');
         return *this;
     }
     SimpleWriter &operator<<(f32x3 v) {
-        EmitF("f32x3(%f, %f, %f)", v.x, v.y, v.z);
+        Write("f32x3(");
+        ifor(3) {
+            if (i) Write(", ");
+            WriteF32(v[i]);
+        }
+        Putc(')');
         return *this;
     }
     SimpleWriter &operator<<(f32x4 v) {
-        EmitF("f32x4(%f, %f, %f, %f)", v.x, v.y, v.z, v.w);
+        Write("f32x4(");
+        ifor(4) {
+            if (i) Write(", ");
+            WriteF32(v[i]);
+        }
+        Putc(')');
         return *this;
     }
+    // u32 values are printed through %i historically, keep the signed form
     SimpleWriter &operator<<(u32 v) {
-        EmitF("u32(%i)", v);
+        Write("u32(");
+        WriteI32(i32(v));
+        Putc(')');
         return *this;
     }
     SimpleWriter &operator<<(u32x2 v) {
-        EmitF("u32x2(%i, %i)", v.x, v.y);
+        Write("u32x2(");
+        ifor(2) {
+            if (i) Write(", ");
+            WriteI32(i32(v[i]));
+        }
+        Putc(')');
         return *this;
-        ;
     }
     SimpleWriter &operator<<(u32x4 v) {
-        EmitF("u32x4(%i, %i, %i, %i)", v.x, v.y, v.z, v.w);
+        Write("u32x4(");
+        ifor(4) {
+            if (i) Write(", ");
+            WriteI32(i32(v[i]));
+        }
+        Putc(')');
         return *this;
     }
     SimpleWriter &operator<<(i32 v) {
-        EmitF("i32(%i)", v);
+        Write("i32(");
+        WriteI32(v);
+        Putc(')');
         return *this;
     }
     SimpleWriter &operator<<(i32x2 v) {
-        EmitF("i32x2(%i, %i)", v.x, v.y);
+        Write("i32x2(");
+        ifor(2) {
+            if (i) Write(", ");
+            WriteI32(v[i]);
+        }
+        Putc(')');
         return *this;
     }
     SimpleWriter &operator<<(i32x3 v) {
-        EmitF("i32x3(%i, %i, %i)", v.x, v.y, v.z);
+        Write("i32x3(");
+        ifor(3) {
+            if (i) Write(", ");
+            WriteI32(v[i]);
+        }
+        Putc(')');
         return *this;
     }
     SimpleWriter &operator<<(i32x4 v) {
-        EmitF("i32x4(%i, %i, %i, %i)", v.x, v.y, v.z, v.w);
+        Write("i32x4(");
+        ifor(4) {
+            if (i) Write(", ");
+            WriteI32(v[i]);
+        }
+        Putc(')');
         return *this;
     }
 };
+// Set of expression ids with nested scopes, for what's been emitted so far. Ids from the module's own range live in a bitset, each insert is logged and a scope
+// remembers the log size at entry, so entering a scope is O(1) and leaving it undoes only what the scope inserted.
+// Ids are global and other threads take them too, the bitset starts at the first id the module can see. The few older ones go to a hash set.
+class ScopedIdSet {
+private:
+    u32          base      = u32(0);
+    Array<u64>   bits      = {};
+    HashSet<u32> older_ids = {};
+    Array<u32>   log       = {};
+    Array<u32>   scopes    = {}; // Log size at entry
+
+public:
+    void Init(u32 _base) {
+        base = _base;
+        bits.clear();
+        older_ids.clear();
+        log.clear();
+        scopes.clear();
+    }
+    bool Contains(u32 _id) const {
+        if (_id < base) return older_ids.find(_id) != older_ids.end();
+        u32 idx = _id - base;
+        return u64(idx >> u32(6)) < bits.size() && ((bits[idx >> u32(6)] >> u64(idx & u32(63))) & u64(1)) != u64(0);
+    }
+    // Returns false if it's there already
+    bool Insert(u32 _id) {
+        if (_id < base) {
+            if (!older_ids.insert(_id).second) return false;
+        } else {
+            u32 idx  = _id - base;
+            u64 word = u64(idx >> u32(6));
+            if (word >= bits.size()) bits.resize(size_t(std::max(word + u64(1), u64(bits.size()) * u64(2))), u64(0));
+            u64 bit = u64(1) << u64(idx & u32(63));
+            if (bits[word] & bit) return false;
+            bits[word] |= bit;
+        }
+        log.push_back(_id);
+        return true;
+    }
+    void EnterScope() { scopes.push_back(u32(log.size())); }
+    void ExitScope() {
+        sjit_assert(scopes.size());
+        u32 mark = scopes.back();
+        scopes.pop_back();
+        while (u32(log.size()) > mark) {
+            u32 id = log.back();
+            log.pop_back();
+            if (id < base) {
+                older_ids.erase(id);
+            } else {
+                u32 idx = id - base;
+                bits[idx >> u32(6)] &= ~(u64(1) << u64(idx & u32(63)));
+            }
+        }
+    }
+    u32 GetDepth() const { return u32(scopes.size()); }
+    u32 GetSize() const { return u32(log.size()); }
+
+    static void Test() {
+        ScopedIdSet set = {};
+        set.Init(u32(1000));
+        sjit_assert(set.Insert(u32(1000)) && set.Insert(u32(5)) && set.Insert(u32(1000 + 200)));
+        sjit_assert(!set.Insert(u32(5)) && !set.Insert(u32(1000)));
+        set.EnterScope();
+        sjit_assert(set.Contains(u32(1200)) && set.Contains(u32(5)));
+        sjit_assert(set.Insert(u32(7)) && set.Insert(u32(1000 + 4096)) && !set.Insert(u32(1200)));
+        set.EnterScope();
+        sjit_assert(set.Insert(u32(1001)));
+        set.ExitScope();
+        sjit_assert(!set.Contains(u32(1001)) && set.Contains(u32(7)) && set.Contains(u32(5096)));
+        set.ExitScope();
+        sjit_assert(!set.Contains(u32(7)) && !set.Contains(u32(5096)) && set.Contains(u32(1200)) && set.Contains(u32(5)));
+        sjit_assert(set.GetSize() == u32(3) && set.GetDepth() == u32(0));
+
+        // Against the copy per scope it replaces
+        set.Init(u32(1000));
+        Array<HashSet<u32>> reference = {{}};
+        u32                 seed      = u32(1);
+        ifor(1 << 14) {
+            seed   = seed * u32(747796405) + u32(2891336453);
+            u32 op = seed >> u32(28);
+            if (op < u32(2)) {
+                set.EnterScope();
+                reference.push_back(reference.back());
+            } else if (op < u32(4) && set.GetDepth()) {
+                set.ExitScope();
+                reference.pop_back();
+            } else {
+                u32 id = u32(900) + ((seed >> u32(8)) & u32(1023));
+                sjit_assert(set.Insert(id) == reference.back().insert(id).second);
+            }
+            u32 probe = u32(900) + (seed & u32(1023));
+            sjit_assert(set.Contains(probe) == (reference.back().find(probe) != reference.back().end()));
+        }
+    }
+};
 class HLSLModule {
 private:
     HashMap<String, SharedPtr<Resource>> resources = {};
     HashMap<String, SharedPtr<Type>>     types     = {};
 
     SimpleWriter header        = {};
-    SimpleWriter function_body = {};
-    SimpleWriter body          = {};
-    SimpleWriter final_text    = {};
+    SimpleWriter function_body  = {};
+    SimpleWriter body           = {};
+    SimpleWriter final_text     = {};
+    SimpleWriter pruned_text    = {};
+    SimpleWriter scheduled_text = {};
+    SimpleWriter renamed_text   = {};
 
     bool is_finalized = false;
 
     u32x3 group_size = {u32(8), u32(8), u32(1)};
 
-    Array<HashSet<u32>> emitted = {};
+    EmittedTextHasher hasher = {};
+
+    ScopedIdSet emitted = {};
+
+    // Pure expressions seen so far, looked up by OptimizeExpr. Scopes follow emitted, lookups don't go past a loop or a function.
+    // All scopes share one table, an entry shadowed by an inner scope goes to the log and comes back when the scope exits.
+    struct CSEEntry {
+        SharedPtr<Expr> expr  = {};
+        u32             scope = u32(0);
+    };
+    struct CSEUndo {
+        u64      key          = u64(0);
+        CSEEntry previous     = {};
+        bool     had_previous = false;
+    };
+    struct CSEScope {
+        u32 log_size = u32(0);
+        u32 barrier  = u32(-1); // Innermost barrier scope, this one included
+        u32 first_id = u32(0);  // Of the barrier, nodes made before it may be written later in the loop body
+    };
+    bool                                               optimize        = g_optimize_modules;
+    HashMap<u64, CSEEntry>                             cse_table       = {};
+    Array<CSEUndo>                                     cse_log         = {};
+    Array<CSEScope>                                    cse_scopes      = {};
+    HashSet<u32>                                       removable_temps = {}; // Definitions without side effects
+    Array<std::pair<SharedPtr<Expr>, SharedPtr<Expr>>> aliases         = {}; // Copies made by the optimizer and the values they stand for
+    OptimizerStats                                     optimizer_stats = {};
+    bool                                               schedule        = g_schedule_modules;
+    ScheduleStats                                      schedule_stats  = {};
+
+    template <typename T>
+    static Array<typename HashMap<String, T>::value_type const *> SortByName(HashMap<String, T> const &_map) {
+        Array<typename HashMap<String, T>::value_type const *> items = {};
+        for (auto &item : _map) items.push_back(&item);
+        std::sort(items.begin(), items.end(), [](auto const *a, auto const *b) { return strcmp(a->first.c_str(), b->first.c_str()) < 0; });
+        return items;
+    }
+    static bool IsIdentifierChar(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_'; }
+    // Matches a whole tmp_%i token at _i, _end is one past the last digit
+    static bool ParseTemporary(char const *_text, u64 _size, u64 _i, u64 &_id, u64 &_end) {
+        if (_i + u64(4) >= _size || memcmp(_text + _i, "tmp_", 4) != 0 || (_i != u64(0) && IsIdentifierChar(_text[_i - u64(1)])) ||
+            !(_text[_i + u64(4)] >= '0' && _text[_i + u64(4)] <= '9'))
+            return false;
+        _end = _i + u64(4);
+        _id  = u64(0);
+        while (_end < _size && _text[_end] >= '0' && _text[_end] <= '9') _id = _id * u64(10) + u64(_text[_end++] - '0');
+        return !(_end < _size && IsIdentifierChar(_text[_end]));
+    }
+    // The passes over the final text go line by line: SJIT writes at most one statement per line and blocks open and close at the line ends.
+    enum TextLineKind {
+        TEXT_LINE_OTHER = 0,
+        TEXT_LINE_DEF,          // T tmp_N = ...;
+        TEXT_LINE_STORE,        // tmp_N[.field|[i]] op= ...;
+        TEXT_LINE_MEMORY_STORE, // g_buffer[i] op= ...; only reads temporaries
+        TEXT_LINE_CONTROL,      // if, else, switch, case, break, continue, return; only reads temporaries
+    };
+    struct TextToken {
+        u64 id    = u64(0);
+        u64 begin = u64(0);
+    };
+    struct TextLine {
+        u64          begin        = u64(0);
+        u64          end          = u64(0); // Past the new line
+        TextLineKind kind         = TEXT_LINE_OTHER;
+        u64          target       = u64(-1); // tmp_N defined or written by the line
+        u64          target_begin = u64(-1);
+        u64          rhs_begin    = u64(0);
+        u64          stmt_end     = u64(0); // At the ;
+        u32          tokens_begin = u32(0); // Every tmp_N on the line
+        u32          tokens_end   = u32(0);
+        u32          block        = u32(0);
+        u32          anchor       = u32(0); // Where to insert in front of the line, `} else {` points at the start of its if chain
+    };
+    struct TextBlock {
+        u32  parent    = u32(-1);
+        u32  anchor    = u32(0); // The line that opened the block, or the start of its if chain
+        u32  last_line = u32(0); // The line that closed it
+        bool is_loop   = false;
+        bool is_switch = false;
+    };
+    static void ParseText(char const *_text, u64 _size, Array<TextLine> &_lines, Array<TextToken> &_tokens, Array<TextBlock> &_blocks) {
+        auto skip_ws = [&](u64 i, u64 end) {
+            while (i < end && (_text[i] == ' ' || _text[i] == '\t')) i++;
+            return i;
+        };
+        auto skip_ident = [&](u64 i, u64 end) {
+            while (i < end && IsIdentifierChar(_text[i])) i++;
+            return i;
+        };
+        auto starts_with = [&](u64 i, u64 end, char const *_prefix) {
+            u64 len = strlen(_prefix);
+            return i + len <= end && memcmp(_text + i, _prefix, len) == 0;
+        };
+        // .field and [i] accessors
+        auto skip_path = [&](u64 j, u64 end) {
+            while (j < end) {
+                if (_text[j] == '.')
+                    j = skip_ident(j + u64(1), end);
+                else if (_text[j] == '[') {
+                    char const *close = (char const *)memchr(_text + j, ']', end - j);
+                    if (close == NULL) break;
+                    j = u64(close - _text) + u64(1);
+                } else
+                    break;
+            }
+            return j;
+        };
+        // ` = `, ` += ` etc.
+        auto is_assignment = [&](u64 i, u64 end) {
+            if (i + u64(3) <= end && memcmp(_text + i, " = ", 3) == 0) return true;
+            if (i + u64(4) > end || _text[i] != ' ' || _text[i + u64(2)] != '=' || _text[i + u64(3)] != ' ') return false;
+            return strchr("+-*/|&^", _text[i + u64(1)]) != NULL;
+        };
+        _lines.clear();
+        _tokens.clear();
+        _blocks.clear();
+        _blocks.push_back({});
+        u32 cur    = u32(0);
+        u64 cursor = u64(0);
+        while (cursor < _size) {
+            char const *nl       = (char const *)memchr(_text + cursor, '\n', _size - cursor);
+            u32         line_idx = u32(_lines.size());
+            TextLine    line     = {};
+            line.begin           = cursor;
+            line.end             = nl ? u64(nl - _text) + u64(1) : _size;
+            line.anchor          = line_idx;
+            cursor               = line.end;
+
+            u64 stmt_end = line.end;
+            while (stmt_end > line.begin && (_text[stmt_end - u64(1)] == '\n' || _text[stmt_end - u64(1)] == '\r' || _text[stmt_end - u64(1)] == ' ')) stmt_end--;
+            // Leading braces close blocks, the rest of the line belongs to the outer one
+            u64 i      = skip_ws(line.begin, stmt_end);
+            u32 closed = u32(-1);
+            while (i < stmt_end && _text[i] == '}') {
+                if (cur != u32(0)) {
+                    _blocks[cur].last_line = line_idx;
+                    closed                 = cur;
+                    cur                    = _blocks[cur].parent;
+                }
+                i = skip_ws(i + u64(1), stmt_end);
+            }
+            line.block = cur;
+            if (closed != u32(-1)) line.anchor = _blocks[closed].anchor;
+            bool has_braces = memchr(_text + i, '{', stmt_end - i) != NULL || memchr(_text + i, '}', stmt_end - i) != NULL;
+            if (closed == u32(-1) && !has_braces && i < stmt_end && _text[stmt_end - u64(1)] == ';') {
+                u64 id = u64(0);
+                u64 e  = u64(0);
+                u64 j  = skip_ident(i, stmt_end);
+                if (ParseTemporary(_text, stmt_end, i, id, e)) { // tmp_N.xy = ...;
+                    u64 k = skip_path(e, stmt_end);
+                    if (is_assignment(k, stmt_end)) {
+                        line.kind         = TEXT_LINE_STORE;
+                        line.target       = id;
+                        line.target_begin = i;
+                        line.rhs_begin    = k + u64(_text[k + u64(1)] == '=' ? 3 : 4);
+                    }
+                } else if (j != i && j < stmt_end && _text[j] == ' ' && ParseTemporary(_text, stmt_end, j + u64(1), id, e) && e + u64(3) <= stmt_end &&
+                           memcmp(_text + e, " = ", 3) == 0) { // T tmp_N = ...;
+                    line.kind         = TEXT_LINE_DEF;
+                    line.target       = id;
+                    line.target_begin = j + u64(1);
+                    line.rhs_begin    = e + u64(3);
+                } else if (j != i && !(_text[i] >= '0' && _text[i] <= '9') && is_assignment(skip_path(j, stmt_end), stmt_end)) {
+                    line.kind = TEXT_LINE_MEMORY_STORE;
+                }
+                line.stmt_end = stmt_end - u64(1);
+            }
+            if (line.kind == TEXT_LINE_OTHER) {
+                if (i == stmt_end || starts_with(i, stmt_end, "if (") || starts_with(i, stmt_end, "else") || starts_with(i, stmt_end, "switch (") ||
+                    starts_with(i, stmt_end, "case ") || starts_with(i, stmt_end, "break;") || starts_with(i, stmt_end, "continue;") || starts_with(i, stmt_end, "return"))
+                    line.kind = TEXT_LINE_CONTROL;
+            }
+            line.tokens_begin = u32(_tokens.size());
+            u64 k             = line.begin;
+            while (k < line.end) {
+                char const *p = (char const *)memchr(_text + k, 't', line.end - k);
+                if (p == NULL) break;
+                k       = u64(p - _text);
+                u64 id  = u64(0);
+                u64 end = u64(0);
+                if (!ParseTemporary(_text, line.end, k, id, end)) {
+                    k = std::max(end, k + u64(1));
+                    continue;
+                }
+                _tokens.push_back({id, k});
+                k = end;
+            }
+            line.tokens_end = u32(_tokens.size());
+            for (u64 c = i; c < stmt_end; c++) {
+                if (_text[c] == '{') {
+                    TextBlock block = {};
+                    block.parent    = cur;
+                    block.anchor    = closed != u32(-1) ? _blocks[closed].anchor : line_idx;
+                    block.is_loop   = starts_with(i, stmt_end, "for ") || starts_with(i, stmt_end, "for(") || starts_with(i, stmt_end, "while");
+                    block.is_switch = starts_with(i, stmt_end, "switch");
+                    closed          = u32(-1);
+                    cur             = u32(_blocks.size());
+                    _blocks.push_back(block);
+                } else if (_text[c] == '}' && cur != u32(0)) {
+                    _blocks[cur].last_line = line_idx;
+                    cur                    = _blocks[cur].parent;
+                }
+            }
+            _lines.push_back(line);
+        }
+    }
+    // Expr ids are process wide and depend on whatever was built before and on other threads.
+    // tmp_%i are renumbered in the order of their first appearance so that the same kernel always produces the same text.
+    char const *RenumberTemporaries(char const *_text, u64 _size) {
+        HashMap<u64, u32> ordinals = {};
+        renamed_text.Reset();
+        u64 cursor = u64(0);
+        u64 i      = u64(0);
+        while (i + u64(4) < _size) {
+            char const *p = (char const *)memchr(_text + i, 't', _size - i);
+            if (p == NULL) break;
+            i       = u64(p - _text);
+            u64 id  = u64(0);
+            u64 end = u64(0);
+            if (!ParseTemporary(_text, _size, i, id, end)) {
+                i = std::max(end, i + u64(1));
+                continue;
+            }
+            auto it = ordinals.find(id);
+            if (it == ordinals.end()) it = ordinals.insert({id, u32(ordinals.size())}).first;
+            renamed_text.Write(_text + cursor, i - cursor);
+            renamed_text.Write("tmp_", u64(4));
+            renamed_text.WriteU64(u64(it->second));
+            cursor = i = end;
+        }
+        renamed_text.Write(_text + cursor, _size - cursor);
+        return renamed_text.Finalize();
+    }
+    // Dead store elimination on the final text, see the definition below Expr
+    char const *EliminateDeadTemporaries(char const *_text, u64 _size);
+    // Moves definitions next to their uses and recomputes cheap ones instead of keeping them live, see the definition below Expr
+    char const *ScheduleTemporaries(char const *_text, u64 _size);
+    static bool IsMovableExpression(char const *_text, u64 _begin, u64 _end);
 
     Array<SimpleWriter *>  function_stack    = {};
     Array<SharedPtr<Expr>> wave32_mask_stack = {};
@@ -1117,32 +1803,109 @@ public:
         return wave32_mask_stack.back();
     }
     HashMap<String, SharedPtr<Type>> const &GetLDS() { return lds; }
-    void                                    AddLDS(String const &_name, SharedPtr<Type> _type) { lds[_name] = _type; }
+    void                                    AddLDS(String const &_name, SharedPtr<Type> _type) {
+        if (lds.find(_name) == lds.end())
+            hasher.AddDeclaration({EmittedTextHasher::Hash(_name.c_str()), EmittedTextHasher::Hash(_type->GetElemType()->GetName().c_str()), u64(_type->GetNumElems())});
+        lds[_name] = _type;
+    }
 
-    bool IsEmitted(u32 id) { return emitted.back().find(id) != emitted.back().end(); }
-    void MarkEmitted(u32 id) { emitted.back().insert(id); }
+    bool IsEmitted(u32 id) { return emitted.Contains(id); }
+    void MarkEmitted(u32 id) { emitted.Insert(id); }
 
     Array<SharedPtr<Expr>> const &GetConditionStack() { return condition_stack; }
 
     void EnterSwitchScope() { in_switch = true; }
     void ExitSwitchScope() { in_switch = false; }
     bool IsInSwitch() { return in_switch; }
+    void PushCSEScope(bool _barrier) {
+        CSEScope scope = {};
+        scope.log_size = u32(cse_log.size());
+        if (_barrier) {
+            scope.barrier  = u32(cse_scopes.size());
+            scope.first_id = GetExprIdCounter().load(std::memory_order_relaxed);
+        } else if (cse_scopes.size()) {
+            scope.barrier  = cse_scopes.back().barrier;
+            scope.first_id = cse_scopes.back().first_id;
+        }
+        cse_scopes.push_back(scope);
+    }
+    void PopCSEScope() {
+        u32 log_size = cse_scopes.back().log_size;
+        cse_scopes.pop_back();
+        while (u32(cse_log.size()) > log_size) {
+            CSEUndo &undo = cse_log.back();
+            if (undo.had_previous)
+                cse_table[undo.key] = undo.previous;
+            else
+                cse_table.erase(undo.key);
+            cse_log.pop_back();
+        }
+    }
     void EnterScope(SharedPtr<Expr> _cond = {}) {
         condition_stack.push_back(_cond);
-        emitted.push_back(emitted.back());
+        emitted.EnterScope();
+        PushCSEScope(/* barrier */ false);
+    }
+    // Values from before the loop may be stale on the next iteration, so the body doesn't reuse them
+    void EnterLoopScope(SharedPtr<Expr> _cond = {}) {
+        condition_stack.push_back(_cond);
+        emitted.EnterScope();
+        PushCSEScope(/* barrier */ true);
     }
     void ExitScope() {
         condition_stack.pop_back();
-        emitted.pop_back();
-        sjit_assert(emitted.size());
+        emitted.ExitScope();
+        PopCSEScope();
+    }
+    void EnterFunction() {
+        function_stack.push_back(new SimpleWriter);
+        function_stack.back()->SetHasher(&hasher);
+        PushCSEScope(/* barrier */ true);
     }
-    void EnterFunction() { function_stack.push_back(new SimpleWriter); }
     void ExitFunction() {
-        function_body.EmitF(function_stack.back()->Finalize());
+        function_body.Write(function_stack.back()->Finalize(), function_stack.back()->GetSize());
         delete function_stack.back();
         function_stack.pop_back();
-    }
-    void AddType(SharedPtr<Type> o) {
+        PopCSEScope();
+    }
+
+    bool                  IsScheduling() { return schedule; }
+    void                  SetSchedule(bool _schedule = true) { schedule = _schedule; }
+    ScheduleStats        &GetScheduleStats() { return schedule_stats; }
+    static u32            EstimateMaxLive(char const *_text, u64 _size);
+    bool                  IsOptimizing() { return optimize; }
+    void                  SetOptimize(bool _optimize = true) { optimize = _optimize; }
+    OptimizerStats       &GetOptimizerStats() { return optimizer_stats; }
+    void                  MarkRemovable(u32 id) { removable_temps.insert(id); }
+    // The table holds the innermost entry for a key, it's visible unless it comes from outside of the current loop or function
+    SharedPtr<Expr> FindCSE(u64 _key) {
+        auto it = cse_table.find(_key);
+        if (it == cse_table.end()) return {};
+        u32 barrier = cse_scopes.back().barrier;
+        if (barrier != u32(-1) && it->second.scope < barrier) return {};
+        return it->second.expr;
+    }
+    void AddCSE(u64 _key, SharedPtr<Expr> _expr) {
+        CSEUndo undo = {};
+        undo.key     = _key;
+        auto it      = cse_table.find(_key);
+        if (it != cse_table.end()) {
+            undo.previous     = it->second;
+            undo.had_previous = true;
+        }
+        cse_log.push_back(undo);
+        cse_table[_key] = {_expr, u32(cse_scopes.size() - size_t(1))};
+    }
+    // Whether a node can be reasoned about across the current loop body, i.e. it was made inside of it
+    bool IsLoopStable(u32 _id) {
+        u32 barrier = cse_scopes.back().barrier;
+        return barrier == u32(-1) || _id >= cse_scopes.back().first_id;
+    }
+    void AddAlias(SharedPtr<Expr> _alias, SharedPtr<Expr> _value) { aliases.push_back({_alias, _value}); }
+    void AddType(SharedPtr<Type> const &o) {
+        auto it = types.find(o->GetName());
+        if (it != types.end() && it->second.get() == o.get()) return; // Interned, so the whole subtree is already there
+        if (it == types.end()) hasher.AddDeclaration({EmittedTextHasher::Hash(o->GetName().c_str())});
         types[o->GetName()] = o;
         if (o->IsStruct()) {
             for (auto &f : o->GetFields()) {
@@ -1152,7 +1915,11 @@ public:
             AddType(o->GetTemplateType());
         }
     }
-    void                                        AddResource(String const &name, SharedPtr<Resource> o) { resources[name] = o; }
+    void AddResource(String const &name, SharedPtr<Resource> o) {
+        if (resources.find(name) == resources.end())
+            hasher.AddDeclaration({EmittedTextHasher::Hash(name.c_str()), EmittedTextHasher::Hash(o->GetType()->GetName().c_str()), u64(o->GetArraySize())});
+        resources[name] = o;
+    }
     HashMap<String, SharedPtr<Resource>> const &GetResources() { return resources; }
     HashMap<String, SharedPtr<Type>> const     &GetTypes() { return types; }
 
@@ -1160,7 +1927,12 @@ public:
     HLSLModule(HLSLModule &&)      = delete;
     HLSLModule const &operator=(HLSLModule const &) = delete;
     HLSLModule const &operator=(HLSLModule &&) = delete;
-    HLSLModule() { emitted.push_back({}); }
+    HLSLModule() {
+        emitted.Init(GetExprIdCounter().load(std::memory_order_relaxed));
+        PushCSEScope(/* barrier */ false);
+        header.SetHasher(&hasher);
+        body.SetHasher(&hasher);
+    }
     ~HLSLModule() { sjit_assert(function_stack.size() == u64(0)); }
     u32x3 GetGroupSize() { return group_size; }
     void  SetGroupSize(u32x3 const &_group_size) {
@@ -1168,6 +1940,14 @@ public:
         sjit_assert(group_size.x > u32(0) && group_size.y > u32(0) && group_size.z > u32(0));
         sjit_assert(((group_size.x * group_size.y * group_size.z) % u32(32)) == u32(0));
     }
+    // Identifies the text emitted so far without finalizing it
+    u64 GetEmittedTextHash() {
+        return hasher.Get(u64(group_size.x) | (u64(group_size.y) << u64(21)) | (u64(group_size.z) << u64(42)));
+    }
+    // Second hash of the emitted text computed with a different function, see EmittedTextHasher::GetCheck
+    u64 GetEmittedTextCheck() {
+        return hasher.GetCheck(u64(group_size.x) | (u64(group_size.y) << u64(21)) | (u64(group_size.z) << u64(42)));
+    }
     SimpleWriter &GetHeader() { return header; }
     SimpleWriter &GetBody() {
         if (function_stack.size()) return *function_stack.back();
@@ -1285,17 +2065,23 @@ f32x3x3 __get_tbn(f32x3 N) {
 }
 )");
 
-        for (auto &t : GetTypes()) {
-            if (t.second->IsStruct() && t.second->IsBuiltin() == false) {
-                SharedPtr<Type> ty = t.second;
+        {
+            // Nested structs go first
+            HashSet<String>                       emitted_structs = {};
+            std::function<void(SharedPtr<Type>)> emit_struct     = [&](SharedPtr<Type> ty) {
+                if (!ty->IsStruct() || ty->IsBuiltin() || emitted_structs.find(ty->GetName()) != emitted_structs.end()) return;
+                emitted_structs.insert(ty->GetName());
+                for (auto &f : ty->GetFields()) emit_struct(f.second);
                 final_text.EmitF("struct %s {\n", ty->GetName().c_str());
                 for (auto &f : ty->GetFields()) {
                     final_text.EmitF("%s %s;\n", f.second->GetName().c_str(), f.first.c_str());
                 }
-                final_text.EmitF("};\n");
-            }
+                final_text.Write("};\n");
+            };
+            for (auto &t : SortByName(GetTypes())) emit_struct(t->second);
         }
-        for (auto &l : GetLDS()) {
+        for (auto &l_ptr : SortByName(GetLDS())) {
+            auto &l = *l_ptr;
             if (l.second->IsArray()) {
                 final_text.EmitF("groupshared %s %s[%i];\n", l.second->GetElemType()->GetName().c_str(), l.first.c_str(), l.second->GetNumElems());
             } else {
@@ -1304,7 +2090,8 @@ f32x3x3 __get_tbn(f32x3 N) {
         }
         if (_emit_resources) {
             u32 array_space = u32(99);
-            for (auto &r : GetResources()) {
+            for (auto &r_ptr : SortByName(GetResources())) {
+                auto &r = *r_ptr;
                 if (r.second->GetType()->GetBasicTy() == BASIC_TYPE_ARRAY) {
                     if (r.second->GetType()->GetElemType()->GetResType() == RES_TEXTURE) {
                         if (r.second->IsArray()) {
@@ -1315,18 +2102,18 @@ f32x3x3 __get_tbn(f32x3 N) {
                             else {
                                 final_text.EmitF("%s[%i] ", r.first.c_str(), r.second->GetArraySize());
                                 if (r.second->GetSpace() != u32(-1) || (r.second->GetDXReg() != u32(-1) && r.second->GetLetter() != char(0))) {
-                                    final_text.EmitF("register(");
+                                    final_text.Write("register(");
                                     bool has_letter = false;
                                     if (r.second->GetDXReg() != u32(-1) && r.second->GetLetter() != char(0)) {
                                         final_text.EmitF("%c%i", r.second->GetLetter(), r.second->GetSpace());
                                         has_letter = true;
                                     }
                                     if (r.second->GetSpace() != u32(-1)) {
-                                        if (has_letter) final_text.EmitF(", ");
+                                        if (has_letter) final_text.Write(", ");
                                         final_text.EmitF("space%i", r.second->GetSpace());
                                     }
                                 }
-                                final_text.EmitF("\n");
+                                final_text.Write("\n");
                             }
                             array_space++;
                         } else {
@@ -1370,18 +2157,28 @@ f32x3x3 __get_tbn(f32x3 N) {
                 }
             }
         } else {
-            final_text.EmitF("RESOURCE_STAB\n");
+            final_text.Write("RESOURCE_STAB\n");
         }
-        final_text.Write(header.Finalize());
-        final_text.Write(function_body.Finalize());
+        final_text.Write(header.Finalize(), header.GetSize());
+        final_text.Write(function_body.Finalize(), function_body.GetSize());
         final_text.EmitF("[numthreads(%i, %i, %i)] void main(u32x3 __tid : SV_DispatchThreadID, u32x3 __gid : SV_GroupThreadID, u32x3 __group_id : SV_GroupID) \n", group_size.x,
                          group_size.y, group_size.z);
         final_text.Write("{\n");
-        final_text.Write(body.Finalize());
+        final_text.Write(body.Finalize(), body.GetSize());
         final_text.Write("}\n");
 
         is_finalized = true;
-        return final_text.Finalize();
+        char const *text = final_text.Finalize();
+        u64         size = final_text.GetSize();
+        if (optimize) {
+            text = EliminateDeadTemporaries(text, size);
+            size = pruned_text.GetSize();
+        }
+        if (schedule) {
+            text = ScheduleTemporaries(text, size);
+            size = scheduled_text.GetSize();
+        }
+        return RenumberTemporaries(text, size);
     }
     template <typename T, typename... V>
     void Emit(T first, V... rest) {
@@ -1413,11 +2210,14 @@ private:
     std::function<SharedPtr<Type>(Array<SharedPtr<Type>> const &)>    ret_type_infer_fn = {};
     std::function<void(HLSLModule &, Array<SharedPtr<Expr>> const &)> emit_fn           = {};
     bool                                                              non_scalar        = false;
+    bool                                                              pure              = false; // Only reads its arguments
 
 public:
     SJIT_REFERENCE_COUNTER_IMPL;
 
     bool            IsNonScalar() { return non_scalar; }
+    bool            IsPure() { return pure; }
+    void            SetPure(bool _pure = true) { pure = _pure; }
     String          GetName() { return name; }
     SharedPtr<Type> GetReturnTy(Array<SharedPtr<Type>> const &argv) {
         if (ret_type_infer_fn) return ret_type_infer_fn(argv);
@@ -1481,9 +2281,9 @@ public:
     void                                AddEmittalbe(SharedPtr<IEmittable> e) { list.push_back(e); }
     Array<SharedPtr<IEmittable>> const &GetList() { return list; }
     void                                EmitHLSL(HLSLModule &hlsl_module) override {
-        hlsl_module.GetBody().EmitF("{\n");
+        hlsl_module.GetBody().Write("{\n");
         for (auto &l : list) l->EmitHLSL(hlsl_module);
-        hlsl_module.GetBody().EmitF("}\n");
+        hlsl_module.GetBody().Write("}\n");
     }
 };
 
@@ -1554,16 +2354,86 @@ public:
 
     bool ref = false; // Emit an expression directly instead of a tmp variable
 
+    u32  version  = u32(0); // Bumped on every write through this node, the optimizer doesn't merge values across writes
+    bool is_alias = false;  // Copy made by the optimizer, rhs holds the value it stands for
+
     char swizzle[5]   = {'\0', '\0', '\0', '\0', '\0'};
     u32  swizzle_size = u32(0);
 
-    char name[0x100]       = {};
-    char field_name[0x100] = {};
-    char input_name[0x100] = {};
+    char        name_storage[24] = {}; // Short names (tmp_%i, __tid) are stored inline
+    char const *name             = name_storage;
+    char const *field_name       = "";
+    char const *input_name       = "";
 
     ScalarMode scalar_mode = SCALAR_MODE_UNKNOWN;
 
 public:
+    void AssignName(char const *_name);
+    void SetNameF(char const *fmt, ...) {
+        char    buf[0x100];
+        va_list args;
+        va_start(args, fmt);
+        vsnprintf(buf, sizeof(buf), fmt, args);
+        va_end(args);
+        AssignName(buf);
+    }
+    // Literals, resources and inputs get their name, type and scalar mode once when they're made, they're shared between modules built on different threads
+    void AssignLiteralName() {
+        if (lit_type == f32Ty) {
+            SetNameF("f32(%f)", lit.f);
+        } else if (lit_type == f32x2Ty) {
+            SetNameF("f32x2(%f, %f)", lit.fx2.x, lit.fx2.y);
+        } else if (lit_type == f32x3Ty) {
+            SetNameF("f32x3(%f, %f, %f)", lit.fx3.x, lit.fx3.y, lit.fx3.z);
+        } else if (lit_type == f32x4Ty) {
+            SetNameF("f32x4(%f, %f, %f, %f)", lit.fx4.x, lit.fx4.y, lit.fx4.z, lit.fx4.w);
+        } else if (lit_type == f16Ty) {
+            SetNameF("f16(%f)", f32(lit.h));
+        } else if (lit_type == f16x2Ty) {
+            SetNameF("f16x2(%f, %f)", f32(lit.hx2.x), f32(lit.hx2.y));
+        } else if (lit_type == f16x3Ty) {
+            SetNameF("f16x3(%f, %f, %f)", f32(lit.hx3.x), f32(lit.hx3.y), f32(lit.hx3.z));
+        } else if (lit_type == f16x4Ty) {
+            SetNameF("f16x4(%f, %f, %f, %f)", f32(lit.hx4.x), f32(lit.hx4.y), f32(lit.hx4.z), f32(lit.hx4.w));
+        } else if (lit_type == i32Ty) {
+            SetNameF("i32(%i)", lit.i);
+        } else if (lit_type == i32x2Ty) {
+            SetNameF("i32x2(%i, %i)", lit.ix2.x, lit.ix2.y);
+        } else if (lit_type == i32x3Ty) {
+            SetNameF("i32x3(%i, %i, %i)", lit.ix3.x, lit.ix3.y, lit.ix3.z);
+        } else if (lit_type == i32x4Ty) {
+            SetNameF("i32x4(%i, %i, %i, %i)", lit.ix4.x, lit.ix4.y, lit.ix4.z, lit.ix4.w);
+        } else if (lit_type == u32Ty) {
+            SetNameF("u32(%i)", lit.i);
+        } else if (lit_type == u32x2Ty) {
+            SetNameF("u32x2(%i, %i)", lit.ix2.x, lit.ix2.y);
+        } else if (lit_type == u32x3Ty) {
+            SetNameF("u32x3(%i, %i, %i)", lit.ix3.x, lit.ix3.y, lit.ix3.z);
+        } else if (lit_type == u32x4Ty) {
+            SetNameF("u32x4(%i, %i, %i, %i)", lit.ix4.x, lit.ix4.y, lit.ix4.z, lit.ix4.w);
+        } else {
+            SJIT_UNIMPLEMENTED;
+        }
+    }
+    static char const *GetInputName(InType _in_type) {
+        switch (_in_type) {
+        case IN_TYPE_GROUP_THREAD_ID: return "__gid";
+        case IN_TYPE_DISPATCH_GROUP_ID: return "__group_id";
+        case IN_TYPE_DISPATCH_THREAD_ID: return "__tid";
+        default: SJIT_UNIMPLEMENTED;
+        }
+        return "";
+    }
+    // Fields and indices are named at creation too, emission renames them only when an operand got a different name since
+    void AssignAccessName() {
+        if (type == EXPRESSION_TYPE_FIELD)
+            SetNameF("%s.%s", lhs->name, field_name);
+        else if (index)
+            SetNameF("%s[%s]", lhs->name, index->name);
+        else
+            SetNameF("%s[%i]", lhs->name, index_literal);
+    }
+
     SharedPtr<Resource> GetResource() { return resource; }
     SharedPtr<Expr>     GetLHS() { return lhs; }
     SharedPtr<Expr>     GetRHS() { return rhs; }
@@ -1589,7 +2459,19 @@ public:
         o->inferred_type = Type::CreateArray(o->name, _elem_type, _array_size);
         return o;
     }
+    static bool IsAssignOp(OpType _op) {
+        return _op == OP_ASSIGN || _op == OP_PLUS_ASSIGN || _op == OP_MINUS_ASSIGN || _op == OP_MUL_ASSIGN || _op == OP_DIV_ASSIGN || _op == OP_BIT_OR_ASSIGN ||
+               _op == OP_BIT_XOR_ASSIGN || _op == OP_BIT_AND_ASSIGN;
+    }
+    // Bumps the version of the variable a write through a swizzle, field or index ends up in.
+    // Resources are never merged and the global ones are shared between threads, so they're left alone.
+    void MarkWritten() {
+        Expr *e = this;
+        while ((e->type == EXPRESSION_TYPE_SWIZZLE || e->type == EXPRESSION_TYPE_FIELD || e->type == EXPRESSION_TYPE_INDEX) && e->lhs) e = e->lhs.get();
+        if (e->type != EXPRESSION_TYPE_RESOURCE) e->version++;
+    }
     static SharedPtr<Expr> MakeOp(SharedPtr<Expr> _lhs, SharedPtr<Expr> _rhs, OpType _op) {
+        if (_lhs && IsAssignOp(_op)) _lhs->MarkWritten();
         SharedPtr<Expr> o = Create();
         o->lhs            = _lhs;
         o->rhs            = _rhs;
@@ -1602,14 +2484,16 @@ public:
         SharedPtr<Expr> o = Create();
         o->type           = EXPRESSION_TYPE_INPUT;
         o->in_type        = _in_type;
+        o->AssignName(GetInputName(_in_type));
         o->InferType();
+        o->GetScalarMode();
         return o;
     }
     static SharedPtr<Expr> MakeInput(char const *_name, SharedPtr<Type> _type) {
         SharedPtr<Expr> o = Create();
         o->type           = EXPRESSION_TYPE_INPUT;
         o->in_type        = IN_TYPE_CUSTOM;
-        sprintf_s(o->input_name, _name);
+        o->input_name     = InternString(_name);
         o->inferred_type = _type;
         return o;
     }
@@ -1618,6 +2502,9 @@ public:
         expr->type           = EXPRESSION_TYPE_LITERAL;
         expr->lit_type       = i32Ty;
         expr->lit.i          = v;
+        expr->AssignLiteralName();
+        expr->InferType();
+        expr->GetScalarMode();
         return expr;
     }
     static SharedPtr<Expr> MakeLiteral(i32x2 v) {
@@ -1625,6 +2512,9 @@ public:
         expr->type           = EXPRESSION_TYPE_LITERAL;
         expr->lit_type       = i32x2Ty;
         expr->lit.ix2        = v;
+        expr->AssignLiteralName();
+        expr->InferType();
+        expr->GetScalarMode();
         return expr;
     }
     static SharedPtr<Expr> MakeLiteral(i32x3 v) {
@@ -1632,6 +2522,9 @@ public:
         expr->type           = EXPRESSION_TYPE_LITERAL;
         expr->lit_type       = i32x3Ty;
         expr->lit.ix3        = v;
+        expr->AssignLiteralName();
+        expr->InferType();
+        expr->GetScalarMode();
         return expr;
     }
     static SharedPtr<Expr> MakeLiteral(i32x4 v) {
@@ -1639,6 +2532,9 @@ public:
         expr->type           = EXPRESSION_TYPE_LITERAL;
         expr->lit_type       = i32x4Ty;
         expr->lit.ix4        = v;
+        expr->AssignLiteralName();
+        expr->InferType();
+        expr->GetScalarMode();
         return expr;
     }
     static SharedPtr<Expr> MakeLiteral(u32 v) {
@@ -1646,6 +2542,9 @@ public:
         expr->type           = EXPRESSION_TYPE_LITERAL;
         expr->lit_type       = u32Ty;
         expr->lit.u          = v;
+        expr->AssignLiteralName();
+        expr->InferType();
+        expr->GetScalarMode();
         return expr;
     }
     static SharedPtr<Expr> MakeLiteral(u32x2 v) {
@@ -1653,6 +2552,9 @@ public:
         expr->type           = EXPRESSION_TYPE_LITERAL;
         expr->lit_type       = u32x2Ty;
         expr->lit.ux2        = v;
+        expr->AssignLiteralName();
+        expr->InferType();
+        expr->GetScalarMode();
         return expr;
     }
     static SharedPtr<Expr> MakeLiteral(u32x3 v) {
@@ -1660,6 +2562,9 @@ public:
         expr->type           = EXPRESSION_TYPE_LITERAL;
         expr->lit_type       = u32x3Ty;
         expr->lit.ux3        = v;
+        expr->AssignLiteralName();
+        expr->InferType();
+        expr->GetScalarMode();
         return expr;
     }
     static SharedPtr<Expr> MakeLiteral(u32x4 v) {
@@ -1667,6 +2572,9 @@ public:
         expr->type           = EXPRESSION_TYPE_LITERAL;
         expr->lit_type       = u32x4Ty;
         expr->lit.ux4        = v;
+        expr->AssignLiteralName();
+        expr->InferType();
+        expr->GetScalarMode();
         return expr;
     }
     static SharedPtr<Expr> MakeLiteral(f32 v) {
@@ -1674,6 +2582,9 @@ public:
         expr->type           = EXPRESSION_TYPE_LITERAL;
         expr->lit_type       = f32Ty;
         expr->lit.f          = v;
+        expr->AssignLiteralName();
+        expr->InferType();
+        expr->GetScalarMode();
         return expr;
     }
     static SharedPtr<Expr> MakeLiteral(f32x2 v) {
@@ -1681,6 +2592,9 @@ public:
         expr->type           = EXPRESSION_TYPE_LITERAL;
         expr->lit_type       = f32x2Ty;
         expr->lit.fx2        = v;
+        expr->AssignLiteralName();
+        expr->InferType();
+        expr->GetScalarMode();
         return expr;
     }
     static SharedPtr<Expr> MakeLiteral(f32x3 v) {
@@ -1688,6 +2602,9 @@ public:
         expr->type           = EXPRESSION_TYPE_LITERAL;
         expr->lit_type       = f32x3Ty;
         expr->lit.fx3        = v;
+        expr->AssignLiteralName();
+        expr->InferType();
+        expr->GetScalarMode();
         return expr;
     }
     static SharedPtr<Expr> MakeLiteral(f32x4 v) {
@@ -1695,6 +2612,9 @@ public:
         expr->type           = EXPRESSION_TYPE_LITERAL;
         expr->lit_type       = f32x4Ty;
         expr->lit.fx4        = v;
+        expr->AssignLiteralName();
+        expr->InferType();
+        expr->GetScalarMode();
         return expr;
     }
     static SharedPtr<Expr> MakeLiteral(f16 v) {
@@ -1702,6 +2622,9 @@ public:
         expr->type           = EXPRESSION_TYPE_LITERAL;
         expr->lit_type       = f16Ty;
         expr->lit.h          = v;
+        expr->AssignLiteralName();
+        expr->InferType();
+        expr->GetScalarMode();
         return expr;
     }
     static SharedPtr<Expr> MakeLiteral(f16x2 v) {
@@ -1709,6 +2632,9 @@ public:
         expr->type           = EXPRESSION_TYPE_LITERAL;
         expr->lit_type       = f16x2Ty;
         expr->lit.hx2        = v;
+        expr->AssignLiteralName();
+        expr->InferType();
+        expr->GetScalarMode();
         return expr;
     }
     static SharedPtr<Expr> MakeLiteral(f16x3 v) {
@@ -1716,6 +2642,9 @@ public:
         expr->type           = EXPRESSION_TYPE_LITERAL;
         expr->lit_type       = f16x3Ty;
         expr->lit.hx3        = v;
+        expr->AssignLiteralName();
+        expr->InferType();
+        expr->GetScalarMode();
         return expr;
     }
     static SharedPtr<Expr> MakeLiteral(f16x4 v) {
@@ -1723,6 +2652,9 @@ public:
         expr->type           = EXPRESSION_TYPE_LITERAL;
         expr->lit_type       = f16x4Ty;
         expr->lit.hx4        = v;
+        expr->AssignLiteralName();
+        expr->InferType();
+        expr->GetScalarMode();
         return expr;
     }
     static SharedPtr<Expr> MakeIfElse(SharedPtr<Expr> _cond, SharedPtr<Expr> _lhs, SharedPtr<Expr> _rhs) {
@@ -1743,11 +2675,24 @@ public:
 #    endif // 0
 
     static SharedPtr<Expr> Create(EXPRESSION_TYPE _ty = EXPRESSION_TYPE_UNKNOWN) {
-        static u32      counter = u32(0);
-        SharedPtr<Expr> e       = SharedPtr<Expr>(new Expr);
-        e->type                 = _ty;
-        e->id                   = counter++;
-        sprintf_s(e->name, "tmp_%i", e->id);
+        SharedPtr<Expr> e = SharedPtr<Expr>(new Expr);
+        e->type           = _ty;
+        e->id             = GetExprIdCounter().fetch_add(u32(1), std::memory_order_relaxed);
+        // tmp_%i without going through printf
+        char  digits[16] = {};
+        u32   num_digits = u32(0);
+        u32   v          = e->id;
+        char *dst        = e->name_storage;
+        do {
+            digits[num_digits++] = char('0' + v % u32(10));
+            v /= u32(10);
+        } while (v);
+        *dst++ = 't';
+        *dst++ = 'm';
+        *dst++ = 'p';
+        *dst++ = '_';
+        while (num_digits) *dst++ = digits[--num_digits];
+        *dst = '\0';
         // sjit_assert(g_current_block);
         // g_current_block->AddEmittalbe(e);
 
@@ -1757,14 +2702,16 @@ public:
         SharedPtr<Expr> expr = Create();
         expr->type           = EXPRESSION_TYPE_REF;
         expr->inferred_type  = _type;
-        sprintf_s(expr->name, _name.c_str());
+        expr->AssignName(_name.c_str());
         return expr;
     }
     static SharedPtr<Expr> MakeResource(SharedPtr<Resource> _resource) {
         SharedPtr<Expr> expr = Create();
         expr->type           = EXPRESSION_TYPE_RESOURCE;
         expr->resource       = _resource;
-
+        expr->AssignName(_resource->GetName().c_str());
+        expr->InferType();
+        expr->GetScalarMode();
         return expr;
     }
     static SharedPtr<Expr> MakeIndex(SharedPtr<Expr> src_expr, u32 index) {
@@ -1781,6 +2728,7 @@ public:
                 expr->resource      = src_expr->GetResource()->GetElemType();
                 expr->inferred_type = expr->resource->GetType();
                 expr->ref           = true;
+                expr->AssignName(expr->resource->GetName().c_str());
             } else {
                 expr->ref           = false;
                 expr->inferred_type = src_expr->InferType()->GetTemplateType();
@@ -1788,13 +2736,13 @@ public:
         } else if (src_expr->InferType()->IsArray())
             expr->inferred_type = src_expr->InferType()->GetElemType();
         else if (src_expr->InferType()->IsVector())
-            expr->inferred_type = vector_type_table[src_expr->InferType()->GetBasicTy()][u32(1)];
+            expr->inferred_type = GetVectorTy(src_expr->InferType()->GetBasicTy(), u32(1));
         else if (src_expr->InferType()->IsMatrix())
-            expr->inferred_type = vector_type_table[src_expr->InferType()->GetBasicTy()][src_expr->InferType()->GetVectorSize()];
+            expr->inferred_type = GetVectorTy(src_expr->InferType()->GetBasicTy(), src_expr->InferType()->GetVectorSize());
         else {
             SJIT_UNIMPLEMENTED;
         }
-
+        if (expr->type == EXPRESSION_TYPE_INDEX) expr->AssignAccessName();
         return expr;
     }
     static SharedPtr<Expr> MakeIndex(SharedPtr<Expr> src_expr, SharedPtr<Expr> index) {
@@ -1804,9 +2752,11 @@ public:
         expr->lhs            = src_expr;
         if (src_expr->InferType()->GetBasicTy() == BASIC_TYPE_RESOURCE) {
             if (src_expr->GetResource()->IsArray()) {
-                expr->type     = EXPRESSION_TYPE_RESOURCE;
-                expr->resource = src_expr->GetResource()->GetElemType();
-                expr->ref      = true;
+                expr->type          = EXPRESSION_TYPE_RESOURCE;
+                expr->resource      = src_expr->GetResource()->GetElemType();
+                expr->inferred_type = expr->resource->GetType();
+                expr->ref           = true;
+                expr->AssignName(expr->resource->GetName().c_str());
             } else {
                 expr->ref           = false;
                 expr->inferred_type = src_expr->InferType()->GetTemplateType();
@@ -1816,6 +2766,7 @@ public:
             expr->inferred_type = src_expr->InferType()->GetElemType();
         }
         expr->index = index;
+        if (expr->type == EXPRESSION_TYPE_INDEX) expr->AssignAccessName();
         return expr;
     }
     static SharedPtr<Expr> MakeField(SharedPtr<Expr> src_expr, char const *_field) {
@@ -1826,7 +2777,8 @@ public:
         expr->type           = EXPRESSION_TYPE_FIELD;
         expr->lhs            = src_expr;
         expr->inferred_type  = field_ty;
-        sprintf_s(expr->field_name, _field);
+        expr->field_name     = InternString(_field);
+        expr->AssignAccessName();
         return expr;
     }
     static SharedPtr<Expr> MakeSwizzle(SharedPtr<Expr> _expr, char const *_swizzle) {
@@ -1852,7 +2804,7 @@ public:
             expr->swizzle_size++;
         }
         sjit_assert(max_component < _expr->InferType()->GetVectorSize());
-        sprintf_s(expr->name, "%s.%s", expr->lhs->name, expr->swizzle);
+        expr->SetNameF("%s.%s", expr->lhs->name, expr->swizzle);
         expr->InferType();
         return expr;
     }
@@ -1865,16 +2817,19 @@ public:
         }
         expr->type         = EXPRESSION_TYPE_FUNCTION;
         expr->fn_prototype = _fn_prototype;
+        ifor(std::min(_argv_num, u32(_fn_prototype->GetArgv().size()))) {
+            if (_fn_prototype->GetArgv()[i].inout == FN_ARG_INOUT) _argv[i]->MarkWritten();
+        }
         expr->InferType();
         return expr;
     }
     Expr *SetName(char const *_name) {
-        sprintf_s(name, _name);
+        AssignName(_name);
         return this;
     }
     void EmitHLSLName(HLSLModule &hlsl_module) {
         if (type == EXPRESSION_TYPE_LITERAL) {
-            hlsl_module.GetBody().EmitF("%s %s = ", InferType()->GetName().c_str(), name);
+            hlsl_module.GetBody() << InferType()->GetName().c_str() << " " << name << " = ";
             if (lit_type == f32Ty) {
                 hlsl_module.GetBody().EmitF("f32(%f)", lit.f);
             } else if (lit_type == f32x2Ty) {
@@ -1903,7 +2858,7 @@ public:
                 SJIT_UNIMPLEMENTED;
             }
         } else {
-            hlsl_module.GetBody().EmitF("%s", name);
+            hlsl_module.GetBody().Write(name);
         }
     }
     void EmitHLSL(HLSLModule &hlsl_module) override {
@@ -1921,99 +2876,66 @@ public:
         if (type == EXPRESSION_TYPE_OP) {
 
             if (op_type == OP_PLUS_ASSIGN) {
-                hlsl.EmitF("%s += %s;\n", lhs->name, rhs->name);
-                sprintf_s(name, lhs->name);
+                hlsl << lhs->name << " += " << rhs->name << ";\n";
+                AssignName(lhs->name);
             } else if (op_type == OP_MINUS_ASSIGN) {
-                hlsl.EmitF("%s -= %s;\n", lhs->name, rhs->name);
-                sprintf_s(name, lhs->name);
+                hlsl << lhs->name << " -= " << rhs->name << ";\n";
+                AssignName(lhs->name);
             } else if (op_type == OP_BIT_OR_ASSIGN) {
-                hlsl.EmitF("%s |= %s;\n", lhs->name, rhs->name);
-                sprintf_s(name, lhs->name);
+                hlsl << lhs->name << " |= " << rhs->name << ";\n";
+                AssignName(lhs->name);
             } else if (op_type == OP_BIT_XOR_ASSIGN) {
-                hlsl.EmitF("%s ^= %s;\n", lhs->name, rhs->name);
-                sprintf_s(name, lhs->name);
+                hlsl << lhs->name << " ^= " << rhs->name << ";\n";
+                AssignName(lhs->name);
             } else if (op_type == OP_BIT_AND_ASSIGN) {
-                hlsl.EmitF("%s &= %s;\n", lhs->name, rhs->name);
-                sprintf_s(name, lhs->name);
+                hlsl << lhs->name << " &= " << rhs->name << ";\n";
+                AssignName(lhs->name);
             } else if (op_type == OP_MUL_ASSIGN) {
-                hlsl.EmitF("%s *= %s;\n", lhs->name, rhs->name);
-                sprintf_s(name, lhs->name);
+                hlsl << lhs->name << " *= " << rhs->name << ";\n";
+                AssignName(lhs->name);
             } else if (op_type == OP_DIV_ASSIGN) {
-                hlsl.EmitF("%s /= %s;\n", lhs->name, rhs->name);
-                sprintf_s(name, lhs->name);
+                hlsl << lhs->name << " /= " << rhs->name << ";\n";
+                AssignName(lhs->name);
             } else if (op_type == OP_ASSIGN) {
                 if (lhs) {
-                    hlsl.EmitF("%s = %s;\n", lhs->name, rhs->name);
-                    sprintf_s(name, lhs->name);
+                    hlsl << lhs->name << " = " << rhs->name << ";\n";
+                    AssignName(lhs->name);
                 } else {
-                    hlsl.EmitF("%s %s = %s;\n", InferType()->GetName().c_str(), name, rhs->name);
+                    hlsl << InferType()->GetName().c_str() << " " << name << " = " << rhs->name << ";\n";
+                    hlsl_module.MarkRemovable(id);
                 }
             } else {
-
-                hlsl.EmitF("%s %s = ", InferType()->GetName().c_str(), name);
-                if (lhs) hlsl.EmitF("%s", lhs->name);
+                hlsl_module.MarkRemovable(id);
+                hlsl << InferType()->GetName().c_str() << " " << name << " = ";
+                if (lhs) hlsl.Write(lhs->name);
                 switch (op_type) {
-                case OP_DIV: hlsl.EmitF("/"); break;
-                case OP_MUL: hlsl.EmitF("*"); break;
-                case OP_PLUS: hlsl.EmitF("+"); break;
-                case OP_MINUS: hlsl.EmitF("-"); break;
-                case OP_LESS: hlsl.EmitF("<"); break;
-                case OP_LESS_OR_EQUAL: hlsl.EmitF("<="); break;
-                case OP_GREATER: hlsl.EmitF(">"); break;
-                case OP_LOGICAL_AND: hlsl.EmitF("&&"); break;
-                case OP_BIT_AND: hlsl.EmitF("&"); break;
-                case OP_BIT_OR: hlsl.EmitF("|"); break;
-                case OP_BIT_XOR: hlsl.EmitF("^"); break;
-                case OP_BIT_NEG: hlsl.EmitF("~"); break;
-                case OP_SHIFT_LEFT: hlsl.EmitF("<<"); break;
-                case OP_SHIFT_RIGHT: hlsl.EmitF(">>"); break;
-                case OP_LOGICAL_OR: hlsl.EmitF("||"); break;
-                case OP_LOGICAL_NOT: hlsl.EmitF("!"); break;
-                case OP_GREATER_OR_EQUAL: hlsl.EmitF(">="); break;
-                case OP_EQUAL: hlsl.EmitF("=="); break;
+                case OP_DIV: hlsl.Write("/"); break;
+                case OP_MUL: hlsl.Write("*"); break;
+                case OP_PLUS: hlsl.Write("+"); break;
+                case OP_MINUS: hlsl.Write("-"); break;
+                case OP_LESS: hlsl.Write("<"); break;
+                case OP_LESS_OR_EQUAL: hlsl.Write("<="); break;
+                case OP_GREATER: hlsl.Write(">"); break;
+                case OP_LOGICAL_AND: hlsl.Write("&&"); break;
+                case OP_BIT_AND: hlsl.Write("&"); break;
+                case OP_BIT_OR: hlsl.Write("|"); break;
+                case OP_BIT_XOR: hlsl.Write("^"); break;
+                case OP_BIT_NEG: hlsl.Write("~"); break;
+                case OP_SHIFT_LEFT: hlsl.Write("<<"); break;
+                case OP_SHIFT_RIGHT: hlsl.Write(">>"); break;
+                case OP_LOGICAL_OR: hlsl.Write("||"); break;
+                case OP_LOGICAL_NOT: hlsl.Write("!"); break;
+                case OP_GREATER_OR_EQUAL: hlsl.Write(">="); break;
+                case OP_EQUAL: hlsl.Write("=="); break;
                 case OP_MODULO: hlsl.Putc('%'); break;
-                case OP_NOT_EQUAL: hlsl.EmitF("!="); break;
+                case OP_NOT_EQUAL: hlsl.Write("!="); break;
                 default: SJIT_UNIMPLEMENTED;
                 }
-                if (rhs) hlsl.EmitF("%s", rhs->name);
-                hlsl.EmitF(";\n");
+                if (rhs) hlsl.Write(rhs->name);
+                hlsl.Write(";\n");
             }
         } else if (type == EXPRESSION_TYPE_LITERAL) {
-            if (lit_type == f32Ty) {
-                sprintf_s(name, "f32(%f)", lit.f);
-            } else if (lit_type == f32x2Ty) {
-                sprintf_s(name, "f32x2(%f, %f)", lit.fx2.x, lit.fx2.y);
-            } else if (lit_type == f32x3Ty) {
-                sprintf_s(name, "f32x3(%f, %f, %f)", lit.fx3.x, lit.fx3.y, lit.fx3.z);
-            } else if (lit_type == f32x4Ty) {
-                sprintf_s(name, "f32x4(%f, %f, %f, %f)", lit.fx4.x, lit.fx4.y, lit.fx4.z, lit.fx4.w);
-            } else if (lit_type == f16Ty) {
-                sprintf_s(name, "f16(%f)", f32(lit.h));
-            } else if (lit_type == f16x2Ty) {
-                sprintf_s(name, "f16x2(%f, %f)", f32(lit.hx2.x), f32(lit.hx2.y));
-            } else if (lit_type == f16x3Ty) {
-                sprintf_s(name, "f16x3(%f, %f, %f)", f32(lit.hx3.x), f32(lit.hx3.y), f32(lit.hx3.z));
-            } else if (lit_type == f16x4Ty) {
-                sprintf_s(name, "f16x4(%f, %f, %f, %f)", f32(lit.hx4.x), f32(lit.hx4.y), f32(lit.hx4.z), f32(lit.hx4.w));
-            } else if (lit_type == i32Ty) {
-                sprintf_s(name, "i32(%i)", lit.i);
-            } else if (lit_type == i32x2Ty) {
-                sprintf_s(name, "i32x2(%i, %i)", lit.ix2.x, lit.ix2.y);
-            } else if (lit_type == i32x3Ty) {
-                sprintf_s(name, "i32x3(%i, %i, %i)", lit.ix3.x, lit.ix3.y, lit.ix3.z);
-            } else if (lit_type == i32x4Ty) {
-                sprintf_s(name, "i32x4(%i, %i, %i, %i)", lit.ix4.x, lit.ix4.y, lit.ix4.z, lit.ix4.w);
-            } else if (lit_type == u32Ty) {
-                sprintf_s(name, "u32(%i)", lit.i);
-            } else if (lit_type == u32x2Ty) {
-                sprintf_s(name, "u32x2(%i, %i)", lit.ix2.x, lit.ix2.y);
-            } else if (lit_type == u32x3Ty) {
-                sprintf_s(name, "u32x3(%i, %i, %i)", lit.ix3.x, lit.ix3.y, lit.ix3.z);
-            } else if (lit_type == u32x4Ty) {
-                sprintf_s(name, "u32x4(%i, %i, %i, %i)", lit.ix4.x, lit.ix4.y, lit.ix4.z, lit.ix4.w);
-            } else {
-                SJIT_UNIMPLEMENTED;
-            }
+            // Named in MakeLiteral
 
 #    if 0
 				hlsl.EmitF("%s %s = ", InferType()->GetName().c_str(), name);
@@ -2048,19 +2970,18 @@ public:
 #    endif // 0
 
         } else if (type == EXPRESSION_TYPE_FUNCTION) {
-            if (InferType() != VoidTy) hlsl.EmitF("%s %s = ", InferType()->GetName().c_str(), name);
+            if (InferType() != VoidTy) hlsl << InferType()->GetName().c_str() << " " << name << " = ";
+            if (InferType() != VoidTy && fn_prototype->IsPure()) hlsl_module.MarkRemovable(id);
             fn_prototype->EmitCall(hlsl_module, argv);
-            hlsl.EmitF(";\n");
+            hlsl.Write(";\n");
         } else if (type == EXPRESSION_TYPE_RESOURCE) {
             hlsl_module.AddResource(resource->GetName(), resource);
             hlsl_module.AddType(resource->GetType());
-            sprintf_s(name, "%s", resource->GetName().c_str());
         } else if (type == EXPRESSION_TYPE_INPUT) {
-            switch (in_type) {
-            case IN_TYPE_GROUP_THREAD_ID: sprintf_s(name, "__gid"); break;
-            case IN_TYPE_DISPATCH_GROUP_ID: sprintf_s(name, "__group_id"); break;
+            switch (in_type) { // Named in MakeInput
+            case IN_TYPE_GROUP_THREAD_ID:
+            case IN_TYPE_DISPATCH_GROUP_ID:
             case IN_TYPE_DISPATCH_THREAD_ID:
-                sprintf_s(name, "__tid");
                 /* hlsl.EmitF("%s %s = ", InferType()->GetName().c_str(), name);
                  hlsl.EmitF("__tid");*/
                 break;
@@ -2071,7 +2992,7 @@ public:
                 break;
             default: SJIT_UNIMPLEMENTED;
             }
-            hlsl.EmitF(";\n");
+            hlsl.Write(";\n");
         } else if (type == EXPRESSION_TYPE_SWIZZLE) {
 
             // ifor(swizzle_size) hlsl.Putc(swizzle[i]);
@@ -2080,16 +3001,8 @@ public:
             hlsl.EmitF("%s %s = %s.", InferType()->GetName().c_str(), name, lhs->name);
             ifor(swizzle_size) hlsl.Putc(swizzle[i]);
             hlsl.EmitF(";\n");*/
-        } else if (type == EXPRESSION_TYPE_FIELD) {
-
-            sprintf_s(name, "%s.%s", lhs->name, field_name);
-        } else if (type == EXPRESSION_TYPE_INDEX) {
-
-            if (index)
-                sprintf_s(name, "%s[%s]", lhs->name, index->name);
-            else
-                sprintf_s(name, "%s[%i]", lhs->name, index_literal);
-
+        } else if (type == EXPRESSION_TYPE_FIELD || type == EXPRESSION_TYPE_INDEX) {
+            AssignAccessName();
         } else if (type == EXPRESSION_TYPE_REF) {
         } else if (type == EXPRESSION_TYPE_IF_ELSE) {
             sjit_assert(bool(lhs) && bool(rhs) && bool(cond));
@@ -2100,12 +3013,12 @@ public:
             lhs->EmitHLSL(hlsl_module);
             hlsl_module.ExitScope();
             hlsl.EmitF("%s = %s;\n", name, lhs->name);
-            hlsl.EmitF("} else {\n");
+            hlsl.Write("} else {\n");
             hlsl_module.EnterScope();
             rhs->EmitHLSL(hlsl_module);
             hlsl_module.ExitScope();
             hlsl.EmitF("%s = %s;\n", name, rhs->name);
-            hlsl.EmitF("}\n");
+            hlsl.Write("}\n");
         }
 
 #    if 0
@@ -2267,7 +3180,7 @@ public:
                 sjit_assert(bool(lhs_ty) && bool(rhs_ty));
                 sjit_assert(bool(lhs_ty) == bool(rhs_ty));
 
-                inferred_type = vector_type_table[BASIC_TYPE_U1][lhs_ty->GetVectorSize()];
+                inferred_type = GetVectorTy(BASIC_TYPE_U1, lhs_ty->GetVectorSize());
             } else {
                 if ((!lhs_ty && rhs_ty) || (lhs_ty && !rhs_ty)) {
                     if (lhs_ty) inferred_type = lhs_ty;
@@ -2324,7 +3237,7 @@ public:
             auto lhs_ty = lhs->InferType();
             u32  size   = swizzle_size;
 
-            auto ty = vector_type_table[lhs_ty->GetBasicTy()][size];
+            auto ty = GetVectorTy(lhs_ty->GetBasicTy(), size);
 
             sjit_assert(ty);
 
@@ -2361,11 +3274,11 @@ static void EmitFunctionCall(FnPrototype *fn, HLSLModule &hlsl_module, Array<Sha
     hlsl_module.GetBody().EmitF("%s(", fn->GetName().c_str());
     ifor(argv.size()) {
         if (u64(i) == argv.size() - u64(1))
-            hlsl_module.GetBody().EmitF("%s", argv[i]->name);
+            hlsl_module.GetBody().Write(argv[i]->name);
         else
-            hlsl_module.GetBody().EmitF("%s, ", argv[i]->name);
+            hlsl_module.GetBody() << argv[i]->name << ", ";
     }
-    hlsl_module.GetBody().EmitF(")");
+    hlsl_module.GetBody().Write(")");
 }
 static void EmitFunctionDefinition(FnPrototype *fn, HLSLModule &hlsl_module, Array<SharedPtr<Type>> const &argv) {
     hlsl_module.GetBody().EmitF("%s %s(", fn->GetReturnTy(argv)->GetName().c_str(), fn->GetName().c_str());
@@ -2377,7 +3290,7 @@ static void EmitFunctionDefinition(FnPrototype *fn, HLSLModule &hlsl_module, Arr
             hlsl_module.GetBody().EmitF("%s %s %s, ", (fn->GetArgv()[i].inout == FN_ARG_INOUT ? "inout" : "in"), fn->GetArgv()[i].type->GetName().c_str(),
                                         fn->GetArgv()[i].name.c_str());
     }
-    hlsl_module.GetBody().EmitF(")");
+    hlsl_module.GetBody().Write(")");
 }
 static void EmitType(Type *ty, HLSLModule &hlsl_module) {
     if (ty->GetBasicTy() == BASIC_TYPE_STRUCTURE) {
@@ -2385,9 +3298,9 @@ static void EmitType(Type *ty, HLSLModule &hlsl_module) {
         for (auto &f : ty->GetFields()) {
             hlsl_module.GetBody().EmitF("%s %s;\n", f.second->GetName().c_str(), f.first.c_str());
         }
-        hlsl_module.GetBody().EmitF("};\n");
+        hlsl_module.GetBody().Write("};\n");
     } else {
-        hlsl_module.GetBody().EmitF("%s", ty->GetName().c_str());
+        hlsl_module.GetBody().Write(ty->GetName().c_str());
     }
 }
 
@@ -2413,26 +3326,26 @@ static SharedPtr<FnPrototype> PowTy           = FnPrototype::Create("pow", Wildc
 static SharedPtr<FnPrototype> ExpTy           = FnPrototype::Create("exp", WildcardTy_0, {{"a", WildcardTy_0}}, [](Array<SharedPtr<Type>> const &argv) { return argv[0]; });
 static SharedPtr<FnPrototype> DotTy           = FnPrototype::Create("dot", WildcardTy_1, {{"a", WildcardTy_0}, {"b", WildcardTy_0}}, [](Array<SharedPtr<Type>> const &argv) {
     sjit_assert(argv[1] == argv[0]);
-    return vector_type_table[argv[0]->GetBasicTy()][1];
+    return GetVectorTy(argv[0]->GetBasicTy(), 1);
           });
 static SharedPtr<FnPrototype> GetDimensionsTy = FnPrototype::Create(
     "GetDimensions", WildcardTy_1, {{"texture", WildcardTy_0}},
-    [](Array<SharedPtr<Type>> const &argv) { return vector_type_table[BASIC_TYPE_U32][GetNumDims(argv[0]->GetDimType())]; },
+    [](Array<SharedPtr<Type>> const &argv) { return GetVectorTy(BASIC_TYPE_U32, GetNumDims(argv[0]->GetDimType())); },
     [](HLSLModule &hlsl_module, Array<SharedPtr<Expr>> const &argv) { hlsl_module.GetBody().EmitF("__get_dimensions(%s)", argv[0]->name); });
 static SharedPtr<FnPrototype> ConvertToF32Ty = FnPrototype::Create(
-    "ConvertToF32", WildcardTy_0, {{"a", WildcardTy_1}}, [](Array<SharedPtr<Type>> const &argv) { return vector_type_table[BASIC_TYPE_F32][argv[0]->GetVectorSize()]; },
+    "ConvertToF32", WildcardTy_0, {{"a", WildcardTy_1}}, [](Array<SharedPtr<Type>> const &argv) { return GetVectorTy(BASIC_TYPE_F32, argv[0]->GetVectorSize()); },
     [](HLSLModule &hlsl_module, Array<SharedPtr<Expr>> const &argv) {
-        auto ty = vector_type_table[BASIC_TYPE_F32][argv[0]->InferType()->GetVectorSize()];
+        auto ty = GetVectorTy(BASIC_TYPE_F32, argv[0]->InferType()->GetVectorSize());
         hlsl_module.GetBody().EmitF("%s(%s)", ty->GetName().c_str(), argv[0]->name);
     });
 static SharedPtr<FnPrototype> ConvertToF16Ty = FnPrototype::Create(
-    "ConvertToF32", WildcardTy_0, {{"a", WildcardTy_1}}, [](Array<SharedPtr<Type>> const &argv) { return vector_type_table[BASIC_TYPE_F16][argv[0]->GetVectorSize()]; },
+    "ConvertToF32", WildcardTy_0, {{"a", WildcardTy_1}}, [](Array<SharedPtr<Type>> const &argv) { return GetVectorTy(BASIC_TYPE_F16, argv[0]->GetVectorSize()); },
     [](HLSLModule &hlsl_module, Array<SharedPtr<Expr>> const &argv) {
-        auto ty = vector_type_table[BASIC_TYPE_F16][argv[0]->InferType()->GetVectorSize()];
+        auto ty = GetVectorTy(BASIC_TYPE_F16, argv[0]->InferType()->GetVectorSize());
         hlsl_module.GetBody().EmitF("%s(%s)", ty->GetName().c_str(), argv[0]->name);
     });
 static SharedPtr<FnPrototype> BitcastToF32Ty = FnPrototype::Create(
-    "BitcastToF32", WildcardTy_0, {{"a", WildcardTy_1}}, [](Array<SharedPtr<Type>> const &argv) { return vector_type_table[BASIC_TYPE_F32][argv[0]->GetVectorSize()]; },
+    "BitcastToF32", WildcardTy_0, {{"a", WildcardTy_1}}, [](Array<SharedPtr<Type>> const &argv) { return GetVectorTy(BASIC_TYPE_F32, argv[0]->GetVectorSize()); },
     [](HLSLModule &hlsl_module, Array<SharedPtr<Expr>> const &argv) { hlsl_module.GetBody().EmitF("asf32(%s)", argv[0]->name); });
 static SharedPtr<FnPrototype> u32_to_f16_FnTy = FnPrototype::Create("u32_to_f16_FnTy", f16Ty, {{"a", u32Ty}}, {}, [](HLSLModule &hlsl_module, Array<SharedPtr<Expr>> const &argv) {
     hlsl_module.GetBody().EmitF("f16(f16tof32(%s))", argv[0]->name);
@@ -2441,22 +3354,22 @@ static SharedPtr<FnPrototype> f16_to_u32_FnTy = FnPrototype::Create("f16_to_u32_
     hlsl_module.GetBody().EmitF("u32(f32tof16(%s))", argv[0]->name);
 });
 static SharedPtr<FnPrototype> ConvertToU32Ty  = FnPrototype::Create(
-     "ConvertToU32", WildcardTy_0, {{"a", WildcardTy_1}}, [](Array<SharedPtr<Type>> const &argv) { return vector_type_table[BASIC_TYPE_U32][argv[0]->GetVectorSize()]; },
+     "ConvertToU32", WildcardTy_0, {{"a", WildcardTy_1}}, [](Array<SharedPtr<Type>> const &argv) { return GetVectorTy(BASIC_TYPE_U32, argv[0]->GetVectorSize()); },
      [](HLSLModule &hlsl_module, Array<SharedPtr<Expr>> const &argv) {
-        auto ty = vector_type_table[BASIC_TYPE_U32][argv[0]->InferType()->GetVectorSize()];
+        auto ty = GetVectorTy(BASIC_TYPE_U32, argv[0]->InferType()->GetVectorSize());
         hlsl_module.GetBody().EmitF("%s(%s)", ty->GetName().c_str(), argv[0]->name);
      });
 static SharedPtr<FnPrototype> BitcastToU32Ty = FnPrototype::Create(
-    "BitcastToU32", WildcardTy_0, {{"a", WildcardTy_1}}, [](Array<SharedPtr<Type>> const &argv) { return vector_type_table[BASIC_TYPE_U32][argv[0]->GetVectorSize()]; },
+    "BitcastToU32", WildcardTy_0, {{"a", WildcardTy_1}}, [](Array<SharedPtr<Type>> const &argv) { return GetVectorTy(BASIC_TYPE_U32, argv[0]->GetVectorSize()); },
     [](HLSLModule &hlsl_module, Array<SharedPtr<Expr>> const &argv) { hlsl_module.GetBody().EmitF("asu32(%s)", argv[0]->name); });
 static SharedPtr<FnPrototype> ConvertToI32Ty = FnPrototype::Create(
-    "ConvertToI32", WildcardTy_0, {{"a", WildcardTy_1}}, [](Array<SharedPtr<Type>> const &argv) { return vector_type_table[BASIC_TYPE_I32][argv[0]->GetVectorSize()]; },
+    "ConvertToI32", WildcardTy_0, {{"a", WildcardTy_1}}, [](Array<SharedPtr<Type>> const &argv) { return GetVectorTy(BASIC_TYPE_I32, argv[0]->GetVectorSize()); },
     [](HLSLModule &hlsl_module, Array<SharedPtr<Expr>> const &argv) {
-        auto ty = vector_type_table[BASIC_TYPE_I32][argv[0]->InferType()->GetVectorSize()];
+        auto ty = GetVectorTy(BASIC_TYPE_I32, argv[0]->InferType()->GetVectorSize());
         hlsl_module.GetBody().EmitF("%s(%s)", ty->GetName().c_str(), argv[0]->name);
     });
 static SharedPtr<FnPrototype> BitcastToI32Ty = FnPrototype::Create(
-    "BitcastToI32", WildcardTy_0, {{"a", WildcardTy_1}}, [](Array<SharedPtr<Type>> const &argv) { return vector_type_table[BASIC_TYPE_I32][argv[0]->GetVectorSize()]; },
+    "BitcastToI32", WildcardTy_0, {{"a", WildcardTy_1}}, [](Array<SharedPtr<Type>> const &argv) { return GetVectorTy(BASIC_TYPE_I32, argv[0]->GetVectorSize()); },
     [](HLSLModule &hlsl_module, Array<SharedPtr<Expr>> const &argv) { hlsl_module.GetBody().EmitF("asi32(%s)", argv[0]->name); });
 static SharedPtr<FnPrototype> WriteFnTy = FnPrototype::Create(
     "Write", VoidTy, {{"index", WildcardTy_0}, {"value", WildcardTy_1}}, //
@@ -2468,21 +3381,21 @@ static SharedPtr<FnPrototype> ReadFnTy = FnPrototype::Create(
     [](HLSLModule &hlsl_module, Array<SharedPtr<Expr>> const &argv) { hlsl_module.GetBody().EmitF("%s[%s]", argv[0]->name, argv[1]->name); });
 static SharedPtr<FnPrototype> Splat2FnTy = FnPrototype::Create(
     "Splat", WildcardTy_0, {{"a", WildcardTy_1}},                                                   //
-    [](Array<SharedPtr<Type>> const &argv) { return vector_type_table[argv[0]->GetBasicTy()][2]; }, //
+    [](Array<SharedPtr<Type>> const &argv) { return GetVectorTy(argv[0]->GetBasicTy(), 2); }, //
     [](HLSLModule &hlsl_module, Array<SharedPtr<Expr>> const &argv) {
-        hlsl_module.GetBody().EmitF("%s_splat(%s)", vector_type_table[argv[0]->InferType()->GetBasicTy()][2]->GetName().c_str(), argv[0]->name);
+        hlsl_module.GetBody().EmitF("%s_splat(%s)", GetVectorTy(argv[0]->InferType()->GetBasicTy(), 2)->GetName().c_str(), argv[0]->name);
     });
 static SharedPtr<FnPrototype> Splat3FnTy = FnPrototype::Create(
     "Splat", WildcardTy_0, {{"a", WildcardTy_1}},                                                   //
-    [](Array<SharedPtr<Type>> const &argv) { return vector_type_table[argv[0]->GetBasicTy()][2]; }, //
+    [](Array<SharedPtr<Type>> const &argv) { return GetVectorTy(argv[0]->GetBasicTy(), 2); }, //
     [](HLSLModule &hlsl_module, Array<SharedPtr<Expr>> const &argv) {
-        hlsl_module.GetBody().EmitF("%s_splat(%s)", vector_type_table[argv[0]->InferType()->GetBasicTy()][2]->GetName().c_str(), argv[0]->name);
+        hlsl_module.GetBody().EmitF("%s_splat(%s)", GetVectorTy(argv[0]->InferType()->GetBasicTy(), 2)->GetName().c_str(), argv[0]->name);
     });
 static SharedPtr<FnPrototype> Splat4FnTy = FnPrototype::Create(
     "Splat", WildcardTy_0, {{"a", WildcardTy_1}},                                                   //
-    [](Array<SharedPtr<Type>> const &argv) { return vector_type_table[argv[0]->GetBasicTy()][2]; }, //
+    [](Array<SharedPtr<Type>> const &argv) { return GetVectorTy(argv[0]->GetBasicTy(), 2); }, //
     [](HLSLModule &hlsl_module, Array<SharedPtr<Expr>> const &argv) {
-        hlsl_module.GetBody().EmitF("%s_splat(%s)", vector_type_table[argv[0]->InferType()->GetBasicTy()][2]->GetName().c_str(), argv[0]->name);
+        hlsl_module.GetBody().EmitF("%s_splat(%s)", GetVectorTy(argv[0]->InferType()->GetBasicTy(), 2)->GetName().c_str(), argv[0]->name);
     });
 static SharedPtr<FnPrototype> AllFnTy = FnPrototype::Create(
     "all", u1Ty, {{"a", WildcardTy_1}},
@@ -2520,9 +3433,9 @@ static SharedPtr<FnPrototype> TransposeTy    = FnPrototype::Create("transpose",
    });
 static SharedPtr<FnPrototype> NonUniformFnTy = FnPrototype::Create("NonUniformResourceIndex", u32Ty, {{"a", u32Ty}});
 static SharedPtr<FnPrototype> IsNanFnTy      = FnPrototype::Create("isnan", WildcardTy_0, {{"a", WildcardTy_1}},
-                                                                   [](Array<SharedPtr<Type>> const &argv) { return vector_type_table[BASIC_TYPE_U1][argv[0]->GetVectorSize()]; });
+                                                                   [](Array<SharedPtr<Type>> const &argv) { return GetVectorTy(BASIC_TYPE_U1, argv[0]->GetVectorSize()); });
 static SharedPtr<FnPrototype> IsInfFnTy      = FnPrototype::Create("isinf", WildcardTy_0, {{"a", WildcardTy_1}},
-                                                                   [](Array<SharedPtr<Type>> const &argv) { return vector_type_table[BASIC_TYPE_U1][argv[0]->GetVectorSize()]; });
+                                                                   [](Array<SharedPtr<Type>> const &argv) { return GetVectorTy(BASIC_TYPE_U1, argv[0]->GetVectorSize()); });
 static SharedPtr<FnPrototype> CrossTy        = FnPrototype::Create("cross", f32x3Ty, {{"a", f32x3Ty}, {"b", f32x3Ty}});
 static SharedPtr<FnPrototype> ReflectTy      = FnPrototype::Create("reflect", f32x3Ty, {{"a", f32x3Ty}, {"b", f32x3Ty}});
 static SharedPtr<FnPrototype> TanFnTy        = FnPrototype::Create("tan", WildcardTy_0, {{"a", WildcardTy_0}}, [](Array<SharedPtr<Type>> const &argv) { return argv[0]; });
@@ -2580,6 +3493,753 @@ static Array<SharedPtr<FnPrototype>> splat_table = {
     Splat4FnTy, //
 };
 
+// Math and conversions only read their arguments, so the optimizer may merge, fold and drop them.
+// Sampling and loads read memory: they are never merged, only dropped when nothing uses the result.
+static bool g_pure_functions_registered = [] {
+    for (auto &fn : {PowTy,          ExpTy,          DotTy,          ConvertToF32Ty,     ConvertToF16Ty,     BitcastToF32Ty,       u32_to_f16_FnTy,      f16_to_u32_FnTy,
+                     ConvertToU32Ty, BitcastToU32Ty, ConvertToI32Ty, BitcastToI32Ty,     Splat2FnTy,         Splat3FnTy,           Splat4FnTy,           AllFnTy,
+                     AnyFnTy,        PopCntFnTy,     NormalizeFnTy,  TransposeTy,        NonUniformFnTy,     IsNanFnTy,            IsInfFnTy,            CrossTy,
+                     ReflectTy,      TanFnTy,        FracFnTy,       SaturateFnTy,       LogFnTy,            FloorFnTy,            SinFnTy,              CosFnTy,
+                     SqrtFnTy,       RsqrtFnTy,      AbsFnTy,        MaxFnTy,            MinFnTy,            LerpFnTy,             ClampFnTy,            LengthFnTy,
+                     MulFnTy,        GetTBNFnTy,     InterpolateFnTy, MakeF32X2_1_1_FnTy, MakeF32X4_1_1_FnTy, MakeF32X3_1_1_1_FnTy, MakeF32X3_1_1_FnTy,   MakeU32X3_1_1_1_FnTy,
+                     MakeU32X3_1_1_FnTy, MakeF32X4_1_1_1_FnTy, MakeF32X4_1_1_1_1_FnTy, //
+                     SampleTy, GetDimensionsTy, ReadFnTy, GetLaneIdxFnTy, GetLaneBitFnTy})
+        fn->SetPure();
+    return true;
+}();
+
+static u64 MixOptimizerKey(u64 h, u64 v) {
+    h ^= v + u64(0x9e3779b97f4a7c15) + (h << u64(6)) + (h >> u64(2));
+    return h * u64(0x100000001b3);
+}
+// Follows the copies made by the optimizer as long as neither side has been written since.
+// A copy made before the current loop may be written further down the body, so it stands for itself.
+static Expr *GetCanonicalExpr(HLSLModule &m, Expr *e) {
+    while (e->is_alias && e->version == u32(0) && e->rhs->version == u32(0) && m.IsLoopStable(e->id)) e = e->rhs.get();
+    return e;
+}
+// Lanes of a 32 bit scalar or vector literal the way the HLSL compiler sees them: floats go through the same %f the emitter uses
+static bool GetLiteralLanes(HLSLModule &m, Expr *e, BasicType &_basic_ty, u32 &_num_lanes, u32 _lanes[4]) {
+    e = GetCanonicalExpr(m, e);
+    if (e->type != EXPRESSION_TYPE_LITERAL || !e->lit_type->IsVector()) return false;
+    _basic_ty  = e->lit_type->GetBasicTy();
+    _num_lanes = e->lit_type->GetVectorSize();
+    if (_basic_ty != BASIC_TYPE_F32 && _basic_ty != BASIC_TYPE_I32 && _basic_ty != BASIC_TYPE_U32) return false;
+    memcpy(_lanes, &e->lit, sizeof(u32) * _num_lanes);
+    if (_basic_ty == BASIC_TYPE_F32) {
+        ifor(_num_lanes) {
+            f32 v = f32(0.0);
+            memcpy(&v, &_lanes[i], sizeof(f32));
+            char buf[0x40];
+            snprintf(buf, sizeof(buf), "%f", v);
+            v = strtof(buf, NULL);
+            memcpy(&_lanes[i], &v, sizeof(f32));
+        }
+    }
+    return true;
+}
+static bool IsExactF32Literal(f32 v) {
+    if (!std::isfinite(v)) return false;
+    char buf[0x40];
+    snprintf(buf, sizeof(buf), "%f", v);
+    f32 parsed = strtof(buf, NULL);
+    return memcmp(&parsed, &v, sizeof(f32)) == 0;
+}
+static bool IsLiteralOf(HLSLModule &m, Expr *e, i32 _value) {
+    BasicType basic_ty  = BASIC_TYPE_UNKNOWN;
+    u32       num_lanes = u32(0);
+    u32       lanes[4]  = {};
+    if (!GetLiteralLanes(m, e, basic_ty, num_lanes, lanes)) return false;
+    ifor(num_lanes) {
+        if (basic_ty == BASIC_TYPE_F32) {
+            f32 v = f32(0.0);
+            memcpy(&v, &lanes[i], sizeof(f32));
+            if (v != f32(_value)) return false;
+        } else if (lanes[i] != u32(_value))
+            return false;
+    }
+    return true;
+}
+static SharedPtr<Expr> MakeLiteralFromLanes(SharedPtr<Type> _ty, u32 const *_lanes) {
+    SharedPtr<Expr> o = Expr::Create(EXPRESSION_TYPE_LITERAL);
+    o->lit_type       = _ty;
+    memcpy(&o->lit, _lanes, sizeof(u32) * _ty->GetVectorSize());
+    o->AssignLiteralName();
+    o->InferType();
+    o->GetScalarMode();
+    return o;
+}
+// Identity of a value for hash consing: literals by value, swizzles, fields and indices by path, everything else by node and number of writes.
+// 0 means the value lives in memory and can't be merged.
+static u64 GetValueKey(HLSLModule &m, Expr *e) {
+    e = GetCanonicalExpr(m, e);
+    switch (e->type) {
+    case EXPRESSION_TYPE_LITERAL: {
+        BasicType basic_ty  = BASIC_TYPE_UNKNOWN;
+        u32       num_lanes = u32(0);
+        u32       lanes[4]  = {};
+        if (!GetLiteralLanes(m, e, basic_ty, num_lanes, lanes)) break;
+        u64 h = MixOptimizerKey(u64(EXPRESSION_TYPE_LITERAL), u64(uintptr_t(e->lit_type.get())));
+        ifor(num_lanes) h = MixOptimizerKey(h, u64(lanes[i]));
+        return h;
+    }
+    case EXPRESSION_TYPE_SWIZZLE:
+    case EXPRESSION_TYPE_FIELD:
+    case EXPRESSION_TYPE_INDEX: {
+        BasicType base_ty = e->lhs->InferType()->GetBasicTy();
+        if (base_ty == BASIC_TYPE_RESOURCE || base_ty == BASIC_TYPE_ARRAY) return u64(0);
+        u64 base = GetValueKey(m, e->lhs.get());
+        if (base == u64(0)) return u64(0);
+        u64 h = MixOptimizerKey(MixOptimizerKey(u64(e->type), base), EmittedTextHasher::Hash(e->swizzle));
+        h     = MixOptimizerKey(h, u64(uintptr_t(e->field_name)));
+        if (e->index) {
+            u64 index = GetValueKey(m, e->index.get());
+            if (index == u64(0)) return u64(0);
+            h = MixOptimizerKey(h, index);
+        }
+        return MixOptimizerKey(h, u64(e->index_literal));
+    }
+    case EXPRESSION_TYPE_RESOURCE:
+    case EXPRESSION_TYPE_ARRAY: return u64(0);
+    case EXPRESSION_TYPE_INPUT:
+        if (e->in_type == IN_TYPE_CUSTOM) return u64(0);
+        return MixOptimizerKey(u64(EXPRESSION_TYPE_INPUT), u64(e->in_type));
+    default: break;
+    }
+    return MixOptimizerKey(MixOptimizerKey(u64(0xde5d), u64(e->id)), u64(e->version));
+}
+static bool IsSameValue(HLSLModule &m, Expr *a, Expr *b) {
+    a = GetCanonicalExpr(m, a);
+    b = GetCanonicalExpr(m, b);
+    if (a == b) return true;
+    if (a->type != b->type || GetValueKey(m, a) == u64(0) || GetValueKey(m, a) != GetValueKey(m, b)) return false;
+    switch (a->type) {
+    case EXPRESSION_TYPE_LITERAL: return a->lit_type == b->lit_type; // Same key, same lanes
+    case EXPRESSION_TYPE_SWIZZLE: return strcmp(a->swizzle, b->swizzle) == 0 && IsSameValue(m, a->lhs.get(), b->lhs.get());
+    case EXPRESSION_TYPE_FIELD: return a->field_name == b->field_name && IsSameValue(m, a->lhs.get(), b->lhs.get());
+    case EXPRESSION_TYPE_INDEX:
+        return a->index_literal == b->index_literal && bool(a->index) == bool(b->index) && (!a->index || IsSameValue(m, a->index.get(), b->index.get())) &&
+               IsSameValue(m, a->lhs.get(), b->lhs.get());
+    case EXPRESSION_TYPE_INPUT: return a->in_type == b->in_type;
+    default: return false;
+    }
+}
+static void GetOperands(Expr *e, Array<Expr *> &_operands) {
+    _operands.clear();
+    if (e->lhs) _operands.push_back(e->lhs.get());
+    if (e->rhs) _operands.push_back(e->rhs.get());
+    for (auto &a : e->argv) _operands.push_back(a.get());
+}
+// 0 if e can't take part in CSE
+static u64 GetExprKey(HLSLModule &m, Expr *e) {
+    u64 h = MixOptimizerKey(u64(e->type), u64(e->op_type));
+    if (e->type == EXPRESSION_TYPE_OP) {
+        if (Expr::IsAssignOp(e->op_type)) return u64(0);
+        h = MixOptimizerKey(h, u64(bool(e->lhs)));
+    } else if (e->type == EXPRESSION_TYPE_FUNCTION) {
+        if (!e->fn_prototype->IsPure() || e->fn_prototype->IsNonScalar() || e->InferType() == VoidTy) return u64(0);
+        h = MixOptimizerKey(h, u64(uintptr_t(e->fn_prototype.get())));
+    } else
+        return u64(0);
+    Array<Expr *> operands = {};
+    GetOperands(e, operands);
+    for (Expr *o : operands) {
+        u64 k = GetValueKey(m, o);
+        if (k == u64(0)) return u64(0);
+        h = MixOptimizerKey(h, k);
+    }
+    return h == u64(0) ? u64(1) : h;
+}
+static bool IsSameExpr(HLSLModule &m, Expr *a, Expr *b) {
+    if (a->type != b->type || a->op_type != b->op_type || a->fn_prototype.get() != b->fn_prototype.get() || bool(a->lhs) != bool(b->lhs) ||
+        bool(a->rhs) != bool(b->rhs) || a->argv.size() != b->argv.size())
+        return false;
+    Array<Expr *> a_operands = {};
+    Array<Expr *> b_operands = {};
+    GetOperands(a, a_operands);
+    GetOperands(b, b_operands);
+    ifor(a_operands.size()) {
+        if (!IsSameValue(m, a_operands[i], b_operands[i])) return false;
+    }
+    return true;
+}
+// Arithmetic on literals. Only folds when the result prints back exactly, %f would change the value otherwise.
+static SharedPtr<Expr> FoldConstants(HLSLModule &m, Expr *e) {
+    if (e->type != EXPRESSION_TYPE_OP || !e->rhs) return {};
+    bool      unary     = !e->lhs;
+    BasicType lhs_ty    = BASIC_TYPE_UNKNOWN;
+    BasicType rhs_ty    = BASIC_TYPE_UNKNOWN;
+    u32       lhs_lanes = u32(0);
+    u32       rhs_lanes = u32(0);
+    u32       a[4]      = {};
+    u32       b[4]      = {};
+    if (!GetLiteralLanes(m, e->rhs.get(), rhs_ty, rhs_lanes, b)) return {};
+    if (!unary && (!GetLiteralLanes(m, e->lhs.get(), lhs_ty, lhs_lanes, a) || lhs_ty != rhs_ty)) return {};
+    if (unary && e->op_type != OP_PLUS && e->op_type != OP_MINUS) return {};
+    SharedPtr<Type> ty = e->InferType();
+    if (!ty->IsVector() || ty->GetBasicTy() != rhs_ty) return {};
+    u32 r[4] = {};
+    ifor(ty->GetVectorSize()) {
+        u32 x = unary ? u32(0) : a[lhs_lanes == u32(1) ? u32(0) : i];
+        u32 y = b[rhs_lanes == u32(1) ? u32(0) : i];
+        if (rhs_ty == BASIC_TYPE_F32) {
+            f32 fx = f32(0.0);
+            f32 fy = f32(0.0);
+            f32 fr = f32(0.0);
+            memcpy(&fx, &x, sizeof(f32));
+            memcpy(&fy, &y, sizeof(f32));
+            switch (e->op_type) {
+            case OP_PLUS: fr = unary ? fy : fx + fy; break;
+            case OP_MINUS: fr = unary ? -fy : fx - fy; break;
+            case OP_MUL: fr = fx * fy; break;
+            case OP_DIV: fr = fx / fy; break;
+            default: return {};
+            }
+            if (!IsExactF32Literal(fr)) return {};
+            memcpy(&r[i], &fr, sizeof(f32));
+        } else {
+            bool is_signed = rhs_ty == BASIC_TYPE_I32;
+            switch (e->op_type) {
+            case OP_PLUS: r[i] = unary ? y : x + y; break;
+            case OP_MINUS: r[i] = unary ? u32(0) - y : x - y; break;
+            case OP_MUL: r[i] = x * y; break;
+            case OP_DIV:
+            case OP_MODULO:
+                if (y == u32(0) || (is_signed && i32(x) == INT32_MIN && i32(y) == i32(-1))) return {};
+                if (is_signed)
+                    r[i] = e->op_type == OP_DIV ? u32(i32(x) / i32(y)) : u32(i32(x) % i32(y));
+                else
+                    r[i] = e->op_type == OP_DIV ? x / y : x % y;
+                break;
+            case OP_BIT_AND: r[i] = x & y; break;
+            case OP_BIT_OR: r[i] = x | y; break;
+            case OP_BIT_XOR: r[i] = x ^ y; break;
+            case OP_SHIFT_LEFT:
+            case OP_SHIFT_RIGHT:
+                if (y >= u32(32)) return {};
+                r[i] = e->op_type == OP_SHIFT_LEFT ? x << y : x >> y;
+                break;
+            default: return {};
+            }
+        }
+    }
+    return MakeLiteralFromLanes(ty, r);
+}
+static u32 GetSwizzleLane(char c) { return c == 'x' ? u32(0) : c == 'y' ? u32(1) : c == 'z' ? u32(2) : u32(3); }
+// x*1, 1*x, x/1, x+0, 0+x, x-0, +x, -(-x), x|0, x^0, x<<0, x>>0, f(f(x)) for idempotent f, min(x, x), max(x, x) and conversions to the same type
+static SharedPtr<Expr> Simplify(HLSLModule &m, Expr *e) {
+    auto same_ty = [&](SharedPtr<Expr> const &x) { return x->InferType() == e->InferType(); };
+    if (e->type == EXPRESSION_TYPE_OP) {
+        SharedPtr<Expr> const &l = e->lhs;
+        SharedPtr<Expr> const &r = e->rhs;
+        if (!r) return {};
+        switch (e->op_type) {
+        case OP_MUL:
+            if (l && IsLiteralOf(m, r.get(), 1) && same_ty(l)) return l;
+            if (l && IsLiteralOf(m, l.get(), 1) && same_ty(r)) return r;
+            break;
+        case OP_DIV:
+            if (l && IsLiteralOf(m, r.get(), 1) && same_ty(l)) return l;
+            break;
+        case OP_PLUS:
+        case OP_BIT_OR:
+        case OP_BIT_XOR:
+            if (!l && e->op_type == OP_PLUS) return r;
+            if (l && IsLiteralOf(m, r.get(), 0) && same_ty(l)) return l;
+            if (l && IsLiteralOf(m, l.get(), 0) && same_ty(r)) return r;
+            break;
+        case OP_MINUS:
+            if (l && IsLiteralOf(m, r.get(), 0) && same_ty(l)) return l;
+            // The inner operand has to be the same value it was when -x was built
+            if (!l && r->type == EXPRESSION_TYPE_OP && r->op_type == OP_MINUS && !r->lhs && r->version == u32(0) && r->rhs->version == u32(0) && m.IsLoopStable(r->id))
+                return r->rhs;
+            break;
+        case OP_SHIFT_LEFT:
+        case OP_SHIFT_RIGHT:
+            if (l && IsLiteralOf(m, r.get(), 0)) return l;
+            break;
+        default: break;
+        }
+    } else if (e->type == EXPRESSION_TYPE_FUNCTION && e->fn_prototype->IsPure()) {
+        FnPrototype *fn = e->fn_prototype.get();
+        if (e->argv.size() == size_t(1)) {
+            SharedPtr<Expr> const &x = e->argv[0];
+            bool idempotent = fn == SaturateFnTy.get() || fn == AbsFnTy.get() || fn == FloorFnTy.get() || fn == FracFnTy.get() || fn == NormalizeFnTy.get();
+            if (idempotent && x->type == EXPRESSION_TYPE_FUNCTION && x->fn_prototype.get() == fn && x->version == u32(0)) return x;
+            bool conversion = fn == ConvertToF32Ty.get() || fn == ConvertToU32Ty.get() || fn == ConvertToI32Ty.get() || fn == BitcastToF32Ty.get() ||
+                              fn == BitcastToU32Ty.get() || fn == BitcastToI32Ty.get();
+            if (conversion && same_ty(x)) return x;
+        } else if (e->argv.size() == size_t(2) && (fn == MinFnTy.get() || fn == MaxFnTy.get())) {
+            if (IsSameValue(m, e->argv[0].get(), e->argv[1].get()) && same_ty(e->argv[0])) return e->argv[0];
+        }
+    }
+    return {};
+}
+// A copy stands in for an existing value, writes through the new var must not leak into the old one
+// Folded constants get one as well, they may be assigned to later, the dead store pass puts the literal back otherwise.
+static SharedPtr<Expr> MakeOptimizerAlias(HLSLModule &m, SharedPtr<Expr> _value) {
+    while (_value->is_alias && _value->version == u32(0) && _value->rhs->version == u32(0) && m.IsLoopStable(_value->id)) _value = _value->rhs;
+    SharedPtr<Expr> alias = Expr::MakeOp(NULL, _value, OP_ASSIGN);
+    alias->is_alias       = true;
+    m.AddAlias(alias, _value);
+    return alias;
+}
+// Runs on every node a ValueExpr is made of, right before it's emitted: swizzle collapsing, constant folding, algebraic simplification and CSE.
+static SharedPtr<Expr> OptimizeExpr(HLSLModule &m, SharedPtr<Expr> e) {
+    if (!e || e->ref || e->version != u32(0) || m.IsEmitted(e->id)) return e;
+    OptimizerStats &stats = m.GetOptimizerStats();
+    if (e->type == EXPRESSION_TYPE_SWIZZLE) {
+        SharedPtr<Expr> const &base = e->lhs;
+        if (base->type == EXPRESSION_TYPE_SWIZZLE) { // a.xzy.yx -> a.zx
+            char composed[5] = {};
+            ifor(e->swizzle_size) composed[i] = base->swizzle[GetSwizzleLane(e->swizzle[i])];
+            stats.num_collapsed_swizzles++;
+            return OptimizeExpr(m, Expr::MakeSwizzle(base->lhs, composed));
+        }
+        BasicType basic_ty  = BASIC_TYPE_UNKNOWN;
+        u32       num_lanes = u32(0);
+        u32       lanes[4]  = {};
+        if (GetLiteralLanes(m, base.get(), basic_ty, num_lanes, lanes)) {
+            u32 r[4] = {};
+            ifor(e->swizzle_size) r[i] = lanes[GetSwizzleLane(e->swizzle[i])];
+            stats.num_folded_constants++;
+            return MakeOptimizerAlias(m, MakeLiteralFromLanes(e->InferType(), r));
+        }
+        // .xyz of a 3 component vector is the vector itself, both are references to the same variable
+        if (base->InferType()->IsVector() && e->swizzle_size == base->InferType()->GetVectorSize() && strncmp(e->swizzle, "xyzw", e->swizzle_size) == 0) {
+            stats.num_collapsed_swizzles++;
+            return base;
+        }
+        return e;
+    }
+    if (e->type != EXPRESSION_TYPE_OP && e->type != EXPRESSION_TYPE_FUNCTION) return e;
+    if (SharedPtr<Expr> folded = FoldConstants(m, e.get())) {
+        stats.num_folded_constants++;
+        return MakeOptimizerAlias(m, folded);
+    }
+    if (SharedPtr<Expr> simplified = Simplify(m, e.get())) {
+        stats.num_simplified++;
+        return MakeOptimizerAlias(m, simplified);
+    }
+    u64 key = GetExprKey(m, e.get());
+    if (key == u64(0)) return e;
+    SharedPtr<Expr> hit = m.FindCSE(key);
+    if (hit && hit->version == u32(0) && IsSameExpr(m, hit.get(), e.get())) {
+        stats.num_cse_hits++;
+        return MakeOptimizerAlias(m, hit);
+    }
+    m.AddCSE(key, e);
+    return e;
+}
+
+// Dead store elimination on the final text.
+// A removable temporary that is never read loses its definitions and every `tmp_N[.field|[i]] op= ...;` write to it,
+// which may leave more temporaries unread, so it runs to a fixed point.
+inline char const *HLSLModule::EliminateDeadTemporaries(char const *_text, u64 _size) {
+    Array<TextLine>  text_lines = {};
+    Array<TextToken> tokens     = {};
+    Array<TextBlock> blocks     = {};
+    ParseText(_text, _size, text_lines, tokens, blocks);
+
+    struct Line {
+        u64  target      = u64(-1); // Removable tmp_N defined or written by the line
+        u32  reads_begin = u32(0);
+        u32  reads_end   = u32(0);
+        bool alive       = true;
+    };
+    Array<Line>              lines     = Array<Line>(text_lines.size());
+    Array<u64>               reads     = {};
+    HashMap<u64, u32>        num_reads = {};
+    HashMap<u64, Array<u32>> writes    = {};
+    optimizer_stats.num_dead_temporaries = u32(0);
+    ifor(text_lines.size()) {
+        TextLine const &text_line = text_lines[i];
+        Line           &line      = lines[i];
+        bool            is_write  = text_line.kind == TEXT_LINE_STORE || text_line.kind == TEXT_LINE_DEF;
+        if (is_write) line.target = text_line.target;
+        line.reads_begin = u32(reads.size());
+        for (u32 t = text_line.tokens_begin; t < text_line.tokens_end; t++) {
+            if (is_write && tokens[t].begin == text_line.target_begin) continue;
+            reads.push_back(tokens[t].id);
+            num_reads[tokens[t].id]++;
+        }
+        line.reads_end = u32(reads.size());
+        if (is_write) writes[line.target].push_back(u32(i));
+    }
+
+    // Copies made by the optimizer are forwarded: `T tmp_A = tmp_H;` goes away and reads of tmp_A become reads of tmp_H,
+    // valid as long as neither was written after the copy. Copies of folded constants get the literal back.
+    HashMap<u64, Expr *> forward = {};
+    for (auto &a : aliases) {
+        Expr *alias      = a.first.get();
+        Expr *value      = a.second.get();
+        bool  is_literal = value->type == EXPRESSION_TYPE_LITERAL;
+        if (alias->version != u32(0) || value->version != u32(0)) continue;
+        if (!is_literal && (value->type == EXPRESSION_TYPE_OP ? Expr::IsAssignOp(value->op_type) : value->type != EXPRESSION_TYPE_FUNCTION)) continue;
+        auto it = writes.find(u64(alias->id));
+        if (it == writes.end() || it->second.size() != size_t(1)) continue;
+        Line &def = lines[it->second[0]];
+        if (is_literal ? def.reads_end != def.reads_begin : def.reads_end - def.reads_begin != u32(1) || reads[def.reads_begin] != u64(value->id)) continue;
+        def.alive = false;
+        if (!is_literal) {
+            num_reads[u64(value->id)] += num_reads[u64(alias->id)] - u32(1);
+            num_reads[u64(alias->id)] = u32(0);
+        }
+        forward[u64(alias->id)] = value;
+        writes.erase(it);
+    }
+    if (forward.size()) {
+        for (auto &r : reads) {
+            auto it = forward.find(r);
+            if (it != forward.end() && it->second->type != EXPRESSION_TYPE_LITERAL) r = u64(it->second->id);
+        }
+    }
+
+    Array<u64> worklist = {};
+    for (auto &w : writes) {
+        if (removable_temps.find(u32(w.first)) != removable_temps.end() && num_reads[w.first] == u32(0)) worklist.push_back(w.first);
+    }
+    while (worklist.size()) {
+        u64 id = worklist.back();
+        worklist.pop_back();
+        auto it = writes.find(id);
+        if (it == writes.end()) continue;
+        for (u32 line_idx : it->second) {
+            Line &line = lines[line_idx];
+            if (!line.alive) continue;
+            line.alive = false;
+            for (u32 r = line.reads_begin; r < line.reads_end; r++) {
+                u64 read_id = reads[r];
+                if (--num_reads[read_id] == u32(0) && removable_temps.find(u32(read_id)) != removable_temps.end()) worklist.push_back(read_id);
+            }
+        }
+        writes.erase(it);
+        optimizer_stats.num_dead_temporaries++;
+    }
+
+    pruned_text.Reset();
+    ifor(lines.size()) {
+        if (!lines[i].alive) continue;
+        TextLine const &text_line = text_lines[i];
+        u64             copied    = text_line.begin;
+        if (forward.size()) {
+            for (u32 t = text_line.tokens_begin; t < text_line.tokens_end; t++) {
+                auto it = forward.find(tokens[t].id);
+                if (it == forward.end()) continue;
+                pruned_text.Write(_text + copied, tokens[t].begin - copied);
+                pruned_text.Write(it->second->name);
+                copied = tokens[t].begin + u64(4);
+                while (_text[copied] >= '0' && _text[copied] <= '9') copied++;
+            }
+        }
+        pruned_text.Write(_text + copied, text_line.end - copied);
+    }
+    return pruned_text.Finalize();
+}
+
+// Product of the vector and matrix sizes in a type name, f32x3 is 3 and f32x4x4 16. Structs count as one.
+static u32 GetTypeLanes(char const *_name, u64 _size) {
+    u64 i = u64(0);
+    while (i < _size && ((_name[i] >= 'a' && _name[i] <= 'z') || (_name[i] >= 'A' && _name[i] <= 'Z') || _name[i] == '_')) i++;
+    while (i < _size && _name[i] >= '0' && _name[i] <= '9') i++;
+    u32 lanes = u32(1);
+    while (i + u64(1) < _size && _name[i] == 'x' && _name[i + u64(1)] >= '1' && _name[i + u64(1)] <= '4') {
+        lanes *= u32(_name[i + u64(1)] - '0');
+        i += u64(2);
+    }
+    return i == _size ? lanes : u32(1);
+}
+// Every temporary is live from its first to its last mention, to the end of a loop if it's mentioned in one that started after it.
+// Local arrays are left out, they mostly end up in memory.
+inline u32 HLSLModule::EstimateMaxLive(char const *_text, u64 _size) {
+    Array<TextLine>  lines  = {};
+    Array<TextToken> tokens = {};
+    Array<TextBlock> blocks = {};
+    ParseText(_text, _size, lines, tokens, blocks);
+    struct Range {
+        u32 first = u32(0);
+        u32 last  = u32(0);
+        u32 lanes = u32(0);
+    };
+    HashMap<u64, Range> ranges = {};
+    // Innermost loop around each block, the block itself included, so the walk below only visits loops
+    Array<u32> loops = Array<u32>(blocks.size(), u32(-1));
+    ifor(blocks.size()) loops[i] = blocks[i].is_loop ? i : blocks[i].parent != u32(-1) ? loops[blocks[i].parent] : u32(-1);
+    ifor(lines.size()) {
+        TextLine const &line = lines[i];
+        for (u32 t = line.tokens_begin; t < line.tokens_end; t++) {
+            if (ranges.find(tokens[t].id) == ranges.end()) { // T tmp_N = ...; or T tmp_N;
+                Range range = {u32(i), u32(i), u32(1)};
+                u64   e     = tokens[t].begin;
+                if (e > line.begin && _text[e - u64(1)] == ' ') {
+                    u64 b = e - u64(1);
+                    while (b > line.begin && IsIdentifierChar(_text[b - u64(1)])) b--;
+                    if (b < e - u64(1)) range.lanes = GetTypeLanes(_text + b, e - u64(1) - b);
+                }
+                e += u64(4);
+                while (_text[e] >= '0' && _text[e] <= '9') e++;
+                if (line.kind != TEXT_LINE_DEF && _text[e] == '[') range.lanes = u32(0);
+                ranges[tokens[t].id] = range;
+            }
+            Range &range = ranges[tokens[t].id];
+            range.last   = u32(i);
+            for (u32 b = loops[line.block]; b != u32(-1); b = blocks[b].parent != u32(-1) ? loops[blocks[b].parent] : u32(-1)) {
+                if (blocks[b].anchor > range.first) range.last = std::max(range.last, blocks[b].last_line);
+            }
+        }
+    }
+    Array<i32> delta = Array<i32>(lines.size() + size_t(1));
+    for (auto &r : ranges) {
+        delta[r.second.first] += i32(r.second.lanes);
+        delta[r.second.last] -= i32(r.second.lanes);
+    }
+    i32 live     = i32(0);
+    i32 max_live = i32(0);
+    for (i32 d : delta) {
+        live += d;
+        max_live = std::max(max_live, live);
+    }
+    return u32(max_live);
+}
+// Only temporaries, thread ids and literals: nothing that lives in memory or could change under a moved definition other than temporaries
+inline bool HLSLModule::IsMovableExpression(char const *_text, u64 _begin, u64 _end) {
+    for (u64 i = _begin; i < _end;) {
+        char c = _text[i];
+        if (c == '[') return false;
+        if (!IsIdentifierChar(c)) {
+            i++;
+            continue;
+        }
+        u64 j = i;
+        while (j < _end && IsIdentifierChar(_text[j])) j++;
+        u64  id        = u64(0);
+        u64  end       = u64(0);
+        bool is_number = c >= '0' && c <= '9';
+        bool is_member = i > _begin && _text[i - u64(1)] == '.';
+        bool is_call   = j < _end && _text[j] == '(';
+        bool is_input  = (j - i == u64(5) && (memcmp(_text + i, "__tid", 5) == 0 || memcmp(_text + i, "__gid", 5) == 0 || memcmp(_text + i, "false", 5) == 0)) ||
+                        (j - i == u64(10) && memcmp(_text + i, "__group_id", 10) == 0) || (j - i == u64(4) && memcmp(_text + i, "true", 4) == 0);
+        if (!is_number && !is_member && !is_call && !is_input && !ParseTemporary(_text, _end, i, id, end)) return false;
+        i = j;
+    }
+    return true;
+}
+// Register pressure aware scheduling of the final text, definitions are emitted in the order the graph was built:
+//   * A side effect free definition sinks to right in front of the statement that first needs it, in the same block,
+//     as long as nothing in between writes to its operands.
+//   * A cheap definition (a copy, swizzle, conversion or splat of a single temporary that's live anyway) is recomputed in front of its later uses,
+//     so only the operand is kept around.
+// Literals, swizzles and fields are emitted in place by SJIT already.
+inline char const *HLSLModule::ScheduleTemporaries(char const *_text, u64 _size) {
+    Array<TextLine>  lines  = {};
+    Array<TextToken> tokens = {};
+    Array<TextBlock> blocks = {};
+    ParseText(_text, _size, lines, tokens, blocks);
+    schedule_stats                 = {};
+    schedule_stats.max_live_before = EstimateMaxLive(_text, _size);
+
+    u32                      num_lines   = u32(lines.size());
+    u64                      next_id     = u64(0);
+    HashMap<u64, Array<u32>> mentions    = {};
+    HashSet<u64>             clone_ids   = {};
+    Array<std::string>       clone_texts = {}; // Text of the lines past num_lines
+    ifor(num_lines) {
+        for (u32 t = lines[i].tokens_begin; t < lines[i].tokens_end; t++) {
+            Array<u32> &m = mentions[tokens[t].id];
+            if (m.size() == size_t(0) || m.back() != u32(i)) m.push_back(u32(i));
+            next_id = std::max(next_id, tokens[t].id + u64(1));
+        }
+    }
+    auto is_pure_def = [&](u32 l) {
+        return lines[l].kind == TEXT_LINE_DEF && (removable_temps.find(u32(lines[l].target)) != removable_temps.end() || clone_ids.find(lines[l].target) != clone_ids.end());
+    };
+    auto get_operands = [&](u32 l, Array<u64> &_operands) {
+        _operands.clear();
+        for (u32 t = lines[l].tokens_begin; t < lines[l].tokens_end; t++) {
+            if (tokens[t].begin != lines[l].target_begin && std::find(_operands.begin(), _operands.end(), tokens[t].id) == _operands.end()) _operands.push_back(tokens[t].id);
+        }
+    };
+    // Whether a line may change one of the operands of a moved definition
+    auto clobbers = [&](u32 l, Array<u64> const &_operands) {
+        TextLine const &line = lines[l];
+        bool            is_write = line.kind == TEXT_LINE_DEF || line.kind == TEXT_LINE_STORE;
+        if (is_write && std::find(_operands.begin(), _operands.end(), line.target) != _operands.end()) return true;
+        if (line.kind == TEXT_LINE_STORE || line.kind == TEXT_LINE_MEMORY_STORE || line.kind == TEXT_LINE_CONTROL || is_pure_def(l)) return false;
+        // Calls with inout arguments, for loop headers, anything else that isn't understood
+        for (u32 t = line.tokens_begin; t < line.tokens_end; t++) {
+            if (std::find(_operands.begin(), _operands.end(), tokens[t].id) != _operands.end()) return true;
+        }
+        return false;
+    };
+    // The line in _block that contains line _l, either _l itself or the header of the nested block it's in
+    auto get_ancestor = [&](u32 _l, u32 _block) {
+        u32 b = lines[_l].block;
+        u32 l = _l;
+        while (b != _block) {
+            if (b == u32(0)) return u32(-1);
+            l = blocks[b].anchor;
+            b = blocks[b].parent;
+        }
+        return lines[l].anchor;
+    };
+
+    // The current order is a linked list, pos keeps it comparable
+    Array<u32> prev = Array<u32>(num_lines);
+    Array<u32> next = Array<u32>(num_lines);
+    Array<u64> pos  = Array<u64>(num_lines);
+    ifor(num_lines) {
+        prev[i] = u32(i) - u32(1);
+        next[i] = u32(i) + u32(1) == num_lines ? u32(-1) : u32(i) + u32(1);
+        pos[i]  = u64(i) << u64(20);
+    }
+    u32  head      = num_lines ? u32(0) : u32(-1);
+    auto renumber  = [&] {
+        u64 p = u64(0);
+        for (u32 l = head; l != u32(-1); l = next[l]) pos[l] = (p++) << u64(20);
+    };
+    auto unlink    = [&](u32 l) {
+        if (prev[l] != u32(-1))
+            next[prev[l]] = next[l];
+        else
+            head = next[l];
+        if (next[l] != u32(-1)) prev[next[l]] = prev[l];
+    };
+    auto insert_before = [&](u32 l, u32 _before) {
+        prev[l] = prev[_before];
+        next[l] = _before;
+        if (prev[_before] != u32(-1))
+            next[prev[_before]] = l;
+        else
+            head = l;
+        prev[_before] = l;
+        u64 lo        = prev[l] != u32(-1) ? pos[prev[l]] : u64(0);
+        if (pos[_before] - lo < u64(2)) renumber();
+        lo     = prev[l] != u32(-1) ? pos[prev[l]] : u64(0);
+        pos[l] = lo + (pos[_before] - lo) / u64(2);
+    };
+
+    Array<u64> operands = {};
+    for (u32 a = num_lines; a-- > u32(0);) {
+        TextLine const &def = lines[a];
+        if (!is_pure_def(a) || blocks[def.block].is_switch || !IsMovableExpression(_text, def.rhs_begin, def.stmt_end)) continue;
+        u32 first = u32(-1);
+        for (u32 m : mentions[def.target]) {
+            if (m != a && (first == u32(-1) || pos[m] < pos[first])) first = m;
+        }
+        if (first == u32(-1)) continue;
+        u32 target = get_ancestor(first, def.block);
+        if (target == u32(-1) || pos[target] < pos[a]) continue;
+        get_operands(a, operands);
+        for (u32 l = next[a]; l != target; l = next[l]) {
+            if (clobbers(l, operands)) {
+                target = get_ancestor(l, def.block);
+                break;
+            }
+        }
+        if (target == u32(-1) || target == next[a] || pos[target] < pos[a]) continue;
+        unlink(a);
+        insert_before(a, target);
+        schedule_stats.num_sunk++;
+    }
+
+    // line, tmp_N it reads and tmp_M it should read instead
+    Array<std::tuple<u32, u64, u64>> renames = {};
+    for (u32 a = u32(0); a < num_lines; a++) {
+        TextLine const &def = lines[a];
+        if (!is_pure_def(a) || !IsMovableExpression(_text, def.rhs_begin, def.stmt_end)) continue;
+        get_operands(a, operands);
+        if (operands.size() != size_t(1)) continue;
+        // Copies, swizzles, fields, conversions and splats
+        bool is_cheap  = true;
+        u32  num_calls = u32(0);
+        for (u64 i = def.rhs_begin; i < def.stmt_end; i++) {
+            if (_text[i] == '(') {
+                u64 b = i;
+                while (b > def.rhs_begin && IsIdentifierChar(_text[b - u64(1)])) b--;
+                bool is_type = i - b >= u64(3) && strchr("fiu", _text[b]) != NULL && (memcmp(_text + b + u64(1), "32", 2) == 0 || memcmp(_text + b + u64(1), "16", 2) == 0);
+                is_cheap &= is_type && ++num_calls == u32(1);
+            } else if (!IsIdentifierChar(_text[i]) && strchr(".), ", _text[i]) == NULL)
+                is_cheap = false;
+        }
+        if (!is_cheap) continue;
+        Array<u32> uses = mentions[def.target];
+        uses.erase(std::remove(uses.begin(), uses.end(), a), uses.end());
+        bool is_written = false;
+        for (u32 u : uses) is_written |= lines[u].target == def.target;
+        if (is_written || uses.size() < size_t(2)) continue;
+        std::sort(uses.begin(), uses.end(), [&](u32 x, u32 y) { return pos[x] < pos[y]; });
+        // From the last use backwards, the value only gets shorter lived if the later uses don't need it either
+        for (u64 k = uses.size() - u64(1); k > u64(0); k--) {
+            u32             u   = uses[k];
+            TextLine const &use = lines[u];
+            u64             c0  = use.begin;
+            while (_text[c0] == ' ' || _text[c0] == '\t') c0++;
+            // Not in front of `} else {`, `else`, case labels, loop headers or calls that may write to their arguments
+            if (use.anchor != u || use.kind == TEXT_LINE_OTHER || blocks[use.block].is_switch || memcmp(_text + c0, "else", 4) == 0 || memcmp(_text + c0, "case", 4) == 0) break;
+            bool operand_live = false;
+            for (u32 m : mentions[operands[0]]) operand_live |= pos[m] > pos[u];
+            if (!operand_live) break;
+            // A loop around the use that isn't around the definition runs the clone again after the operand may have changed
+            u32 last = u;
+            for (u32 b = use.block; b != u32(-1) && b != def.block; b = blocks[b].parent) {
+                if (blocks[b].is_loop && pos[blocks[b].last_line] > pos[last]) last = blocks[b].last_line;
+            }
+            bool is_clobbered = false;
+            for (u32 l = next[a]; l != u32(-1) && !is_clobbered; l = next[l]) {
+                is_clobbered = clobbers(l, operands);
+                if (l == last) break;
+            }
+            if (is_clobbered) break;
+
+            u64         id   = next_id++;
+            u64         d0   = def.begin;
+            while (_text[d0] == ' ' || _text[d0] == '\t') d0++;
+            std::string line = std::string(_text + use.begin, c0 - use.begin) + std::string(_text + d0, def.target_begin - d0) + "tmp_" + std::to_string(id) +
+                               std::string(_text + def.rhs_begin - u64(3), def.end - (def.rhs_begin - u64(3)));
+            TextLine clone   = def;
+            clone.begin      = u64(0);
+            clone.end        = u64(line.size());
+            clone.target     = id;
+            clone.anchor     = u32(lines.size());
+            clone.block      = use.block;
+            clone_ids.insert(id);
+            clone_texts.push_back(line);
+            u32 c = u32(lines.size());
+            lines.push_back(clone);
+            prev.push_back(u32(-1));
+            next.push_back(u32(-1));
+            pos.push_back(u64(0));
+            insert_before(c, u);
+            mentions[operands[0]].push_back(c);
+            renames.push_back({u, def.target, id});
+            schedule_stats.num_rematerialized++;
+        }
+    }
+
+    scheduled_text.Reset();
+    for (u32 l = head; l != u32(-1); l = next[l]) {
+        if (l >= num_lines) {
+            scheduled_text.Write(clone_texts[l - num_lines].c_str(), u64(clone_texts[l - num_lines].size()));
+            continue;
+        }
+        TextLine const &line   = lines[l];
+        u64             copied = line.begin;
+        for (u32 t = line.tokens_begin; t < line.tokens_end; t++) {
+            auto r = std::find_if(renames.begin(), renames.end(), [&](std::tuple<u32, u64, u64> const &_r) { return std::get<0>(_r) == l && std::get<1>(_r) == tokens[t].id; });
+            if (r == renames.end()) continue;
+            scheduled_text.Write(_text + copied, tokens[t].begin - copied);
+            scheduled_text.Write("tmp_", u64(4));
+            scheduled_text.WriteU64(std::get<2>(*r));
+            copied = tokens[t].begin + u64(4);
+            while (_text[copied] >= '0' && _text[copied] <= '9') copied++;
+        }
+        scheduled_text.Write(_text + copied, line.end - copied);
+    }
+    char const *result            = scheduled_text.Finalize();
+    schedule_stats.max_live_after = EstimateMaxLive(result, scheduled_text.GetSize());
+    return result;
+}
+
 static Array<HLSLModule *> &GetGlobalModuleStack() {
     static thread_local Array<HLSLModule *> module_stack = {};
     return module_stack;
@@ -2591,6 +4251,196 @@ static void        PopModule() {
     GetGlobalModuleStack().pop_back();
 }
 static void PushModule() { GetGlobalModuleStack().push_back(new HLSLModule); }
+
+// Long names are interned, nodes that escaped their module (globals, pass members) can be renamed from another module on another thread.
+// Shared nodes get their final name at creation, so emitting them again only compares and never writes.
+inline void Expr::AssignName(char const *_name) {
+    if (name == _name || strcmp(name, _name) == 0) return;
+    u64 len = strlen(_name) + u64(1);
+    if (len <= sizeof(name_storage)) {
+        memmove(name_storage, _name, len);
+        name = name_storage;
+        return;
+    }
+    name = InternString(_name);
+}
+
+// Builds a module _num_iters times and reports the node footprint and the graph build rate.
+// Nodes are counted through the id counter, names that don't fit inline are interned and not included.
+static ExprNodeStats BenchExprNodes(char const *_name, std::function<void()> _emit, u32 _num_iters = u32(16)) {
+    ExprNodeStats stats         = {};
+    f64           total_seconds = f64(0.0);
+    ifor(_num_iters) {
+        PushModule();
+        u32  first_id = GetExprIdCounter().load(std::memory_order_relaxed);
+        auto start    = std::chrono::high_resolution_clock::now();
+        _emit();
+        auto stop       = std::chrono::high_resolution_clock::now();
+        stats.num_nodes = u64(GetExprIdCounter().load(std::memory_order_relaxed) - first_id);
+        PopModule();
+        total_seconds += std::chrono::duration<f64>(stop - start).count();
+    }
+    stats.node_bytes = stats.num_nodes * u64(sizeof(Expr));
+    fprintf(stdout, "[EXPR NODES] %s: %i nodes, %i bytes/node, %f KB of nodes, %f Mnodes/s\n", //
+            _name,                                                                         //
+            i32(stats.num_nodes),                                                          //
+            i32(sizeof(Expr)),                                                             //
+            f64(stats.node_bytes) / f64(1024.0),                                           //
+            f64(stats.num_nodes) * f64(_num_iters) / std::max(total_seconds, f64(1.0e-9)) / f64(1.0e6));
+    return stats;
+}
+// Builds and finalizes a module _num_iters times and reports the HLSL throughput.
+static f64 BenchHLSLEmission(char const *_name, std::function<void()> _emit, u32 _num_iters = u32(16)) {
+    u64 total_bytes   = u64(0);
+    f64 total_seconds = f64(0.0);
+    ifor(_num_iters) {
+        auto start = std::chrono::high_resolution_clock::now();
+        PushModule();
+        _emit();
+        char const *text = GetGlobalModule().Finalize();
+        total_bytes += strlen(text);
+        PopModule();
+        auto stop = std::chrono::high_resolution_clock::now();
+        total_seconds += std::chrono::duration<f64>(stop - start).count();
+    }
+    f64 mb_per_second = f64(total_bytes) / std::max(total_seconds, f64(1.0e-9)) / f64(1 << 20);
+    fprintf(stdout, "[HLSL EMISSION] %s: %i bytes, %f MB/s\n", _name, i32(total_bytes / u64(std::max(_num_iters, u32(1)))), mb_per_second);
+    return mb_per_second;
+}
+// Cache hit cost of a kernel on the CPU: emitted text hash lookup vs. finalizing the text and hashing that.
+static f64 BenchKernelCacheHit(char const *_name, std::function<void()> _emit, u32 _num_iters = u32(64)) {
+    HashMap<u64, u64>    hash_cache    = {};
+    HashMap<String, u32> text_cache    = {};
+    f64                  emit_seconds  = f64(0.0);
+    f64                  hash_seconds  = f64(0.0);
+    f64                  text_seconds  = f64(0.0);
+    u32                  num_hash_hits = u32(0);
+    u32                  num_text_hits = u32(0);
+    ifor(_num_iters) {
+        PushModule();
+        auto start = std::chrono::high_resolution_clock::now();
+        _emit();
+        auto emitted = std::chrono::high_resolution_clock::now();
+        u64  key     = GetGlobalModule().GetEmittedTextHash();
+        u64  check   = GetGlobalModule().GetEmittedTextCheck();
+        auto it      = hash_cache.find(key);
+        if (it != hash_cache.end() && it->second == check)
+            num_hash_hits++;
+        else
+            hash_cache[key] = check;
+        auto hashed = std::chrono::high_resolution_clock::now();
+        String str  = String(GetGlobalModule().Finalize());
+        if (text_cache.find(str) != text_cache.end())
+            num_text_hits++;
+        else
+            text_cache[str.Copy()] = i;
+        auto finalized = std::chrono::high_resolution_clock::now();
+        PopModule();
+        emit_seconds += std::chrono::duration<f64>(emitted - start).count();
+        hash_seconds += std::chrono::duration<f64>(hashed - emitted).count();
+        text_seconds += std::chrono::duration<f64>(finalized - hashed).count();
+    }
+    f64 n = f64(std::max(_num_iters, u32(1)));
+    fprintf(stdout, "[KERNEL CACHE] %s: emit %f us, hash lookup %f us (%i/%i hits), text lookup %f us (%i/%i hits)\n", _name, emit_seconds / n * f64(1.0e6),
+            hash_seconds / n * f64(1.0e6), num_hash_hits, _num_iters, text_seconds / n * f64(1.0e6), num_text_hits, _num_iters);
+    return hash_seconds / n;
+}
+// Type::Create* calls vs canonical types allocated while building and finalizing a module
+static TypeInternStats BenchTypeInterning(char const *_name, std::function<void()> _emit, u32 _num_iters = u32(16)) {
+    TypeInternStats before        = Type::GetThreadInternStats();
+    f64             total_seconds = f64(0.0);
+    ifor(_num_iters) {
+        auto start = std::chrono::high_resolution_clock::now();
+        PushModule();
+        _emit();
+        GetGlobalModule().Finalize();
+        PopModule();
+        auto stop = std::chrono::high_resolution_clock::now();
+        total_seconds += std::chrono::duration<f64>(stop - start).count();
+    }
+    TypeInternStats after = Type::GetThreadInternStats();
+    TypeInternStats stats = {after.num_lookups - before.num_lookups, after.num_allocations - before.num_allocations};
+    f64             n     = f64(std::max(_num_iters, u32(1)));
+    fprintf(stdout, "[TYPES] %s: %f types requested/build, %f allocated/build, %f us/build\n", _name, f64(stats.num_lookups) / n, f64(stats.num_allocations) / n,
+            total_seconds / n * f64(1.0e6));
+    return stats;
+}
+// Same kernel with and without the optimizer: emitted text, statement count and emission time
+static OptimizerStats BenchOptimizer(char const *_name, std::function<void()> _emit, u32 _num_iters = u32(16)) {
+    OptimizerStats stats           = {};
+    u64            size[2]         = {};
+    u32            num_lines[2]    = {};
+    f64            emit_seconds[2] = {};
+    ifor(2) {
+        bool optimize = i == 1;
+        jfor(_num_iters) {
+            PushModule();
+            GetGlobalModule().SetOptimize(optimize);
+            auto start = std::chrono::high_resolution_clock::now();
+            _emit();
+            char const *text = GetGlobalModule().Finalize();
+            auto        end  = std::chrono::high_resolution_clock::now();
+            emit_seconds[i] += std::chrono::duration<f64>(end - start).count();
+            if (j == u32(0)) {
+                size[i] = strlen(text);
+                for (char const *c = text; *c; c++) num_lines[i] += *c == '\n' ? u32(1) : u32(0);
+                if (optimize) stats = GetGlobalModule().GetOptimizerStats();
+            }
+            PopModule();
+        }
+    }
+    f64 n = f64(std::max(_num_iters, u32(1)));
+    fprintf(stdout, "[OPTIMIZER] %s: %i -> %i lines, %i -> %i bytes, %f -> %f us; %i cse hits, %i folded, %i simplified, %i swizzles, %i dead\n", _name, num_lines[0],
+            num_lines[1], i32(size[0]), i32(size[1]), emit_seconds[0] / n * f64(1.0e6), emit_seconds[1] / n * f64(1.0e6), stats.num_cse_hits, stats.num_folded_constants,
+            stats.num_simplified, stats.num_collapsed_swizzles, stats.num_dead_temporaries);
+    return stats;
+}
+// Same kernel with and without the scheduler: estimated registers live at once and emission time
+static ScheduleStats BenchScheduler(char const *_name, std::function<void()> _emit, u32 _num_iters = u32(16)) {
+    ScheduleStats stats           = {};
+    f64           emit_seconds[2] = {};
+    ifor(2) {
+        bool schedule = i == 1;
+        jfor(_num_iters) {
+            PushModule();
+            GetGlobalModule().SetSchedule(schedule);
+            auto start = std::chrono::high_resolution_clock::now();
+            _emit();
+            GetGlobalModule().Finalize();
+            auto end = std::chrono::high_resolution_clock::now();
+            emit_seconds[i] += std::chrono::duration<f64>(end - start).count();
+            if (schedule && j == u32(0)) stats = GetGlobalModule().GetScheduleStats();
+            PopModule();
+        }
+    }
+    f64 n = f64(std::max(_num_iters, u32(1)));
+    fprintf(stdout, "[SCHEDULER] %s: est. max live %i -> %i, %f -> %f us; %i sunk, %i rematerialized\n", _name, stats.max_live_before, stats.max_live_after,
+            emit_seconds[0] / n * f64(1.0e6), emit_seconds[1] / n * f64(1.0e6), stats.num_sunk, stats.num_rematerialized);
+    return stats;
+}
+// Builds every kernel serially, then all of them at once on their own threads, the text has to match byte for byte.
+static bool TestParallelModuleBuild(Array<std::function<void()>> const &_emitters, u32 _num_rounds = u32(4)) {
+    auto build = [](std::function<void()> const &_emit) {
+        PushModule();
+        defer(PopModule());
+        _emit();
+        return std::string(GetGlobalModule().Finalize());
+    };
+    Array<std::string> serial = {};
+    for (auto &e : _emitters) serial.push_back(build(e));
+    u32 num_mismatches = u32(0);
+    ifor(_num_rounds) {
+        Array<std::string> parallel = Array<std::string>(_emitters.size());
+        Array<std::thread> threads  = {};
+        jfor(_emitters.size()) threads.push_back(std::thread([&, j] { parallel[j] = build(_emitters[j]); }));
+        for (auto &t : threads) t.join();
+        jfor(_emitters.size()) {
+            if (parallel[j] != serial[j]) num_mismatches++;
+        }
+    }
+    fprintf(stdout, "[PARALLEL MODULE BUILD] %i modules x %i rounds: %i mismatches\n", i32(_emitters.size()), i32(_num_rounds), i32(num_mismatches));
+    return num_mismatches == u32(0);
+}
 static bool IsInScalarBlock() {
     if (HasGlobalModule()) { // Figure out if we're in a non-scalar condition block, then we're non-scalar also
         for (auto &s : GetGlobalModule().GetConditionStack()) {
@@ -2618,7 +4468,10 @@ public:
         if (!IsInScalarBlock()) expr->scalar_mode = SCALAR_MODE_NON_SCALAR;
     }
 
-    ValueExpr(SharedPtr<Expr> e) : expr(e) { EmitGlobalHLSL(); }
+    ValueExpr(SharedPtr<Expr> e) : expr(e) {
+        if (HasGlobalModule() && GetGlobalModule().IsOptimizing()) expr = OptimizeExpr(GetGlobalModule(), expr);
+        EmitGlobalHLSL();
+    }
     template <typename T>
     ValueExpr(T v) {
         expr = Expr::MakeLiteral(v);
@@ -3116,20 +4969,21 @@ static void EmitForLoop(ValueExpr _begin, ValueExpr _end, std::function<void(Val
     auto     &body = GetGlobalModule().GetBody();
     ValueExpr iter = Zero(_begin->InferType()).Copy();
     body.EmitF("for (%s = %s; %s <= %s; %s++) {\n", iter->name, _begin->name, iter->name, _end->name, iter->name);
+    iter->MarkWritten(); // The header writes it behind the optimizer's back
     // using var = ValueExpr;
-    GetGlobalModule().EnterScope(Expr::MakeOp(iter.expr, _end.expr, OP_LESS_OR_EQUAL));
+    GetGlobalModule().EnterLoopScope(Expr::MakeOp(iter.expr, _end.expr, OP_LESS_OR_EQUAL));
     _body(iter);
     GetGlobalModule().ExitScope();
-    body.EmitF("}\n");
+    body.Write("}\n");
 }
 static void EmitWhileLoop(std::function<void()> _body) {
     auto &body = GetGlobalModule().GetBody();
-    body.EmitF("while (true) {\n");
+    body.Write("while (true) {\n");
     // using var = ValueExpr;
-    GetGlobalModule().EnterScope();
+    GetGlobalModule().EnterLoopScope();
     _body();
     GetGlobalModule().ExitScope();
-    body.EmitF("}\n");
+    body.Write("}\n");
 }
 static ValueExpr RayQueryTransparent(ValueExpr tlas, ValueExpr ray_desc, std::function<ValueExpr(ValueExpr)> _break) {
     auto     &body = GetGlobalModule().GetBody();
@@ -3139,7 +4993,7 @@ static ValueExpr RayQueryTransparent(ValueExpr tlas, ValueExpr ray_desc, std::fu
     body << "RayQuery<RAY_FLAG_NONE> ray_query;\n";
     body << "ray_query.TraceRayInline(" << tlas->name << ", RAY_FLAG_NONE, 0xffu, " << ray_desc->name << ");\n";
     body << "while (ray_query.Proceed()) {\n";
-    GetGlobalModule().EnterScope();
+    GetGlobalModule().EnterLoopScope();
     {
         body << "if (ray_query.CandidateType() == CANDIDATE_NON_OPAQUE_TRIANGLE) {\n";
         GetGlobalModule().EnterScope();
@@ -3172,15 +5026,15 @@ static ValueExpr RayQueryTransparent(ValueExpr tlas, ValueExpr ray_desc, std::fu
 static void EmitBreak() {
     sjit_assert(GetGlobalModule().IsInSwitch() == false && "That's just bad");
     auto &body = GetGlobalModule().GetBody();
-    body.EmitF("break;\n");
+    body.Write("break;\n");
 }
 static void EmitContinue() {
     auto &body = GetGlobalModule().GetBody();
-    body.EmitF("continue;\n");
+    body.Write("continue;\n");
 }
 static void EmitReturn() {
     auto &body = GetGlobalModule().GetBody();
-    body.EmitF("return;\n");
+    body.Write("return;\n");
 }
 static void EmitReturn(ValueExpr e) {
     auto &body = GetGlobalModule().GetBody();
@@ -3200,13 +5054,13 @@ static void EmitWhileLoop(std::function<void()> _body) {
     auto &body = GetGlobalModule().GetBody();
 
     using var = ValueExpr;
-    GetGlobalModule().EnterScope();
+    GetGlobalModule().EnterLoopScope();
     sjit_debug_assert(GetGlobalModule().IsWave32MaskMode());
     var cur_mask = GetWave32Mask().Copy();
     GetGlobalModule().PushWave32Mask(cur_mask.expr);
-    body.EmitF("while (true) {\n");
+    body.Write("while (true) {\n");
     _body();
-    body.EmitF("}\n");
+    body.Write("}\n");
     GetGlobalModule().PopWave32Mask();
     GetGlobalModule().ExitScope();
 }
@@ -3226,7 +5080,7 @@ static void EmitIfLaneActive(std::function<void()> _if) {
 
     _if();
 
-    body.EmitF("}\n");
+    body.Write("}\n");
 
     GetGlobalModule().ExitScope();
 }
@@ -3234,9 +5088,11 @@ static void EmitIfElse(ValueExpr _cond, std::function<void()> _if, std::function
     using var  = ValueExpr;
     auto &body = GetGlobalModule().GetBody();
 
-    var if_mask   = var(u32(0));
-    var else_mask = var(u32(0));
+    var if_mask   = var(u32(0)).Copy();
+    var else_mask = var(u32(0)).Copy();
     var cur_mask  = GetWave32Mask().Copy();
+    if_mask->MarkWritten(); // The ballots below write them behind the optimizer's back
+    else_mask->MarkWritten();
 
     // sjit_assert(_cond->IsScalar());
 
@@ -3259,7 +5115,7 @@ static void EmitIfElse(ValueExpr _cond, std::function<void()> _if, std::function
         _else();
     }
 
-    body.EmitF("}\n");
+    body.Write("}\n");
     GetGlobalModule().ExitScope();
     GetGlobalModule().PopWave32Mask();
 }
@@ -3275,11 +5131,11 @@ static void EmitIfElse(ValueExpr _cond, std::function<void()> _if, std::function
     if (_else) {
         GetGlobalModule().ExitScope();
         GetGlobalModule().EnterScope();
-        body.EmitF("} else {\n");
+        body.Write("} else {\n");
         _else();
     }
 
-    body.EmitF("}\n");
+    body.Write("}\n");
     GetGlobalModule().ExitScope();
 }
 static void EmitSwitchCase(ValueExpr _val, Array<std::pair<u32, std::function<void()>>> const &_cases) {
@@ -3295,10 +5151,10 @@ static void EmitSwitchCase(ValueExpr _val, Array<std::pair<u32, std::function<vo
         GetGlobalModule().EnterScope();
         _case.second();
         GetGlobalModule().ExitScope();
-        body.EmitF("break; }\n");
+        body.Write("break; }\n");
     }
 
-    body.EmitF("}\n");
+    body.Write("}\n");
     GetGlobalModule().ExitSwitchScope();
     GetGlobalModule().ExitScope();
 }
@@ -3937,6 +5793,196 @@ static void               Init_LDS_16x16(var &lds, std::function<var(var)> init_
     }
 }
 static var Gaussian(var x) { return exp(-x * x * f32(0.5)); }
+// Small kernels whose optimized text is checked on the CPU, nothing here needs a device
+static void TestOptimizer() {
+    auto build = [](bool _optimize, std::function<void()> _emit) {
+        PushModule();
+        defer(PopModule());
+        GetGlobalModule().SetOptimize(_optimize);
+        _emit();
+        std::string text = GetGlobalModule().Finalize();
+        return text.substr(text.find(" void main(")); // Skip the prelude
+    };
+    auto count = [](std::string const &_text, char const *_pattern) {
+        u32 num = u32(0);
+        for (size_t pos = _text.find(_pattern); pos != std::string::npos; pos = _text.find(_pattern, pos + size_t(1))) num++;
+        return num;
+    };
+    auto sink = [](var v) { GetGlobalModule().GetBody().EmitF("g_sink += %s;\n", v->name); };
+
+    { // Common subexpressions, the copy is forwarded
+        std::string text = build(true, [&] {
+            var x = Input(IN_TYPE_DISPATCH_THREAD_ID)["x"].ToF32();
+            var a = x * x;
+            var b = x * x;
+            sink(a + b);
+        });
+        sjit_assert(count(text, "*") == u32(1));
+        sjit_assert(count(build(false, [&] {
+                              var x = Input(IN_TYPE_DISPATCH_THREAD_ID)["x"].ToF32();
+                              sink(x * x + x * x);
+                          }),
+                          "*") == u32(2));
+    }
+    { // Constant folding, algebraic identities and dead temporaries
+        std::string text = build(true, [&] {
+            var x    = Input(IN_TYPE_DISPATCH_THREAD_ID)["x"].ToF32();
+            var c    = var(f32(2.0)) * f32(3.0) + f32(1.0);
+            var dead = x * f32(5.0);
+            var d2   = dead + x;
+            sink(saturate(saturate(x * c * f32(1.0) + f32(0.0))));
+        });
+        sjit_assert(count(text, "f32(7.000000)") == u32(1));
+        sjit_assert(count(text, "f32(1.000000)") == u32(0));
+        sjit_assert(count(text, "f32(5.000000)") == u32(0));
+        sjit_assert(count(text, "saturate(") == u32(1));
+        // 1/3 doesn't print back exactly, so it's left to the HLSL compiler
+        sjit_assert(count(build(true, [&] { sink(var(f32(1.0)) / f32(3.0)); }), "/") == u32(1));
+    }
+    { // Swizzle chains
+        std::string text = build(true, [&] { sink(Input(IN_TYPE_DISPATCH_THREAD_ID)["zyx"]["yx"].ToF32()); });
+        sjit_assert(count(text, "__tid.yz") == u32(1));
+    }
+    { // A folded constant that's assigned to stays a variable
+        std::string text = build(true, [&] {
+            var c = var(u32(2)) + u32(3);
+            c += u32(1);
+            sink(c);
+        });
+        sjit_assert(count(text, "= u32(5);") == u32(1));
+        sjit_assert(count(text, "+= u32(1);") == u32(1));
+    }
+    { // Values written in a loop body aren't reused across iterations
+        std::string text = build(true, [&] {
+            var acc = Input(IN_TYPE_DISPATCH_THREAD_ID)["x"].ToF32().Copy();
+            sink(acc * f32(2.0));
+            EmitForLoop(u32(0), u32(3), [&](var i) {
+                sink(acc * f32(2.0));
+                acc += f32(1.0);
+            });
+        });
+        sjit_assert(count(text, "*f32(2.000000)") == u32(2));
+    }
+}
+// Same idea for the scheduler, the estimate is checked along with the text
+static void TestScheduler() {
+    ScheduleStats stats = {};
+    auto          build = [&](bool _schedule, std::function<void()> _emit) {
+        PushModule();
+        defer(PopModule());
+        GetGlobalModule().SetSchedule(_schedule);
+        _emit();
+        std::string text = GetGlobalModule().Finalize();
+        stats            = GetGlobalModule().GetScheduleStats();
+        return text.substr(text.find(" void main("));
+    };
+    auto count = [](std::string const &_text, char const *_pattern) {
+        u32 num = u32(0);
+        for (size_t pos = _text.find(_pattern); pos != std::string::npos; pos = _text.find(_pattern, pos + size_t(1))) num++;
+        return num;
+    };
+    auto sink = [](var v) { GetGlobalModule().GetBody().EmitF("g_sink += %s;\n", v->name); };
+
+    { // Definitions used in reverse order move next to their uses
+        std::string text = build(true, [&] {
+            var x = Input(IN_TYPE_DISPATCH_THREAD_ID)["x"].ToF32();
+            var a = x * f32(2.0);
+            var b = x * f32(3.0);
+            var c = x * f32(4.0);
+            sink(c);
+            sink(b);
+            sink(a);
+        });
+        sjit_assert(stats.num_sunk == u32(2));
+        sjit_assert(stats.max_live_after < stats.max_live_before);
+        sjit_assert(text.find("*f32(2.000000)") > text.find("*f32(3.000000)"));
+    }
+    { // A splat of a value that's live anyway is recomputed for its last use
+        auto emit = [&] {
+            var x = Input(IN_TYPE_DISPATCH_THREAD_ID)["x"].ToF32() * f32(2.0);
+            var v = x.Splat(3);
+            sink(v);
+            var y = Input(IN_TYPE_DISPATCH_THREAD_ID)["y"].ToF32() * f32(3.0);
+            sink(y);
+            sink(v * f32(4.0));
+            sink(x);
+        };
+        sjit_assert(count(build(false, emit), "_splat(") == u32(1));
+        sjit_assert(count(build(true, emit), "_splat(") == u32(2));
+        sjit_assert(stats.num_rematerialized == u32(1));
+    }
+    { // Nothing moves across a write to an operand or into a loop
+        std::string text = build(true, [&] {
+            var acc = Input(IN_TYPE_DISPATCH_THREAD_ID)["x"].ToF32().Copy();
+            var a   = acc * f32(2.0);
+            acc += f32(1.0);
+            EmitForLoop(u32(0), u32(3), [&](var i) { sink(a); });
+            sink(acc);
+        });
+        sjit_assert(text.find("*f32(2.000000)") < text.find("+= f32(1.000000)"));
+        sjit_assert(text.find("*f32(2.000000)") < text.find("for ("));
+    }
+}
+// Synthetic kernel of _depth nested if/else blocks with _width statements at each level
+static void EmitNestedScopesKernel(u32 _depth, u32 _width = u32(8)) {
+    using var = ValueExpr;
+
+    var                      x    = Input(IN_TYPE_DISPATCH_THREAD_ID)["x"].ToF32();
+    var                      acc  = x.Copy();
+    std::function<void(u32)> nest = [&](u32 _level) {
+        ifor(_width) acc += x * f32(_level * _width + i);
+        if (_level == u32(0)) return;
+        EmitIfElse(acc > var(f32(_level)), [&] { nest(_level - u32(1)); }, [&] { acc += f32(-1.0); });
+    };
+    nest(_depth);
+    GetGlobalModule().GetBody().EmitF("g_sink += %s;\n", acc->name);
+}
+// Module build time against nesting depth, it should grow linearly with the number of statements
+static void BenchNestedScopes(u32 _max_depth = u32(512), u32 _num_iters = u32(4)) {
+    for (u32 depth = u32(32); depth <= _max_depth; depth *= u32(2)) {
+        f64 total_seconds = f64(0.0);
+        ifor(_num_iters) {
+            auto start = std::chrono::high_resolution_clock::now();
+            PushModule();
+            EmitNestedScopesKernel(depth);
+            GetGlobalModule().Finalize();
+            PopModule();
+            total_seconds += std::chrono::duration<f64>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+        f64 n = f64(std::max(_num_iters, u32(1)));
+        fprintf(stdout, "[NESTED SCOPES] depth %i: %f ms/build, %f us/level\n", i32(depth), total_seconds / n * f64(1.0e3), total_seconds / n / f64(depth) * f64(1.0e6));
+    }
+}
+// Kernels built on their own threads all read the same global resources, like the GFX_JIT_MAKE_GLOBAL_RESOURCE ones in gfx_jit.
+// Emitting a shared node has to leave it untouched, build with -fsanitize=thread to check.
+static bool TestParallelSharedResources(u32 _num_modules = u32(8), u32 _num_rounds = u32(50)) {
+    using var = ValueExpr;
+
+    GFX_JIT_MAKE_GLOBAL_RESOURCE(g_shared_structured_buffer_with_a_long_name, Type::CreateStructuredBuffer(f32x4Ty));
+    GFX_JIT_MAKE_GLOBAL_RESOURCE_ARRAY(g_shared_textures, Texture2D_f32x4_Ty);
+    GFX_JIT_MAKE_GLOBAL_RESOURCE(g_shared_sampler, SamplerState_Ty);
+    GFX_JIT_MAKE_GLOBAL_RESOURCE(g_shared_scale, f32Ty);
+    static var g_shared_tid  = Input(IN_TYPE_DISPATCH_THREAD_ID);
+    static var g_shared_bias = var(f32x2(0.25, 0.25));
+    // First created inside a module, the node outlives it
+    static var g_shared_from_module = [] {
+        PushModule();
+        defer(PopModule());
+        return ResourceAccess(Resource::Create(RWTexture2D_f32x4_Ty, "g_shared_resource_from_a_module"));
+    }();
+
+    Array<std::function<void()>> emitters = {};
+    ifor(_num_modules) {
+        emitters.push_back([i] {
+            var tid = g_shared_tid["xy"];
+            var uv  = tid.ToF32() * g_shared_scale + g_shared_bias;
+            var val = g_shared_textures[i % u32(4)].Sample(g_shared_sampler, uv);
+            val     = val + g_shared_structured_buffer_with_a_long_name.Load(tid.x());
+            GetGlobalModule().GetBody().EmitF("%s[%s] = %s;\n", g_shared_from_module->name, tid->name, val->name);
+        });
+    }
+    return TestParallelModuleBuild(emitters, _num_rounds);
+}
 } // namespace SJIT
 
 #endif // JIT_HPP
\ No newline at end of file
@@ -0,0 +1,1353 @@
+// MIT License
+//
+// Copyright (c) 2023 Anton Schreiner
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined(SJIT_CPP_HPP)
+#    define SJIT_CPP_HPP
+
+#    if defined(_WIN32)
+#        if !defined(NOMINMAX)
+#            define NOMINMAX
+#        endif
+#        include <windows.h>
+#    else
+#        include <dlfcn.h>
+#    endif
+
+#    include "sjit_cpu.hpp"
+
+#    include <filesystem>
+
+namespace SJIT {
+
+// Format for the host compiler, gets the source path and then the library path twice
+#    if defined(_WIN32)
+static char const *g_cpp_compile_command = "cl /nologo /std:c++17 /O2 /arch:AVX2 /fp:precise /LD \"%s\" /Fe\"%s\" /Fo\"%s.obj\"";
+static char const *g_cpp_library_ext     = ".dll";
+#    else
+static char const *g_cpp_compile_command = "c++ -std=c++17 -O2 -march=native -ffp-contract=off -fno-math-errno -shared -fPIC \"%s\" -o \"%s\"";
+static char const *g_cpp_library_ext     = ".so";
+#    endif
+
+// SJIT kernels as a self-contained C++ translation unit, for CPU machines without a GPU.
+// The finalized text goes through the CPUKernel front end and its statements are lowered to C++ instead of being interpreted.
+// Every slot is W words laid out lane after lane (SoA) and every node is a loop over the lanes with constant slot offsets, so the
+// host compiler vectorizes them. Lane wise nodes of a statement share one loop, literals are inlined. Control flow is the same
+// lane mask scheme as the interpreter, thread groups are spread across threads inside the generated sjit_dispatch.
+// Build() compiles the unit with the system compiler and loads it, results match the interpreter.
+class CPPKernel {
+public:
+    // What sjit_dispatch gets for every resource, in declaration order
+    struct ResourceBinding {
+        u32 *data    = NULL;
+        u32  size[3] = {u32(0), u32(0), u32(0)};
+    };
+
+private:
+    typedef void (*DispatchFn)(ResourceBinding const *, u32, u32, u32, u32);
+
+    using Node  = CPUKernel::Node;
+    using Place = CPUKernel::Place;
+    using Stmt  = CPUKernel::Stmt;
+
+    static constexpr u32 invalid = CPUKernel::invalid;
+
+    CPUKernel              front         = {};
+    SimpleWriter           out           = {};
+    std::string            source        = {};
+    std::string            error         = {};
+    Array<ResourceBinding> bindings      = {};
+    HashMap<u32, u32>      constant_bits = {}; // Slot of every constant word
+    Array<std::string>     brk_stack     = {};
+    Array<std::string>     cont_stack    = {};
+    u32                    num_lanes     = u32(8);
+    u32                    num_threads   = u32(0);
+    u32                    depth         = u32(0);
+    u32                    num_names     = u32(0);
+    bool                   in_lane_loop  = false;
+    void                  *library       = NULL;
+    DispatchFn             dispatch_fn   = NULL;
+
+    static std::string Fmt(char const *_fmt, ...) {
+        char    buf[0x200];
+        va_list args;
+        va_start(args, _fmt);
+        i32 len = vsnprintf(buf, sizeof(buf), _fmt, args);
+        va_end(args);
+        sjit_assert(len >= i32(0) && len < i32(sizeof(buf)));
+        return std::string(buf, size_t(len));
+    }
+    void Line(std::string const &_line) {
+        ifor(depth) out.Write("    ");
+        out.Write(_line.c_str(), u64(_line.size()));
+        out.Putc('\n');
+    }
+    std::string NewName(char const *_prefix) { return Fmt("%s%i", _prefix, num_names++); }
+
+    ////////////////////////////////////////////
+    // Operands
+    ////////////////////////////////////////////
+    static std::string Literal(u32 _bits, char _view) {
+        if (_view == 'u') return Fmt("0x%08xu", _bits);
+        if (_view == 'i') return Fmt("i32(0x%08xu)", _bits);
+        f32 f = CPUKernel::AsF(_bits);
+        if (!std::isfinite(f)) return Fmt("AsF(0x%08xu)", _bits);
+        return Fmt("(%af)", f64(f)); // Hex floats are exact
+    }
+    // Lane _lane of a word as .u, .i or .f
+    std::string Word(u32 _slot, char _view, char const *_lane = "j") const {
+        auto it = constant_bits.find(_slot);
+        if (it != constant_bits.end()) return Literal(it->second, _view);
+        return Fmt("w[%i][%s].%c", _slot, _lane, _view);
+    }
+    // Component of a node, scalars broadcast
+    std::string Src(u32 _node, u32 _comp, char _view, char const *_lane = "j") const {
+        Node const &n = front.nodes[_node];
+        return Word(n.slot + (front.GetWords(n.type) == u32(1) ? u32(0) : _comp), _view, _lane);
+    }
+    std::string Dst(u32 _node, u32 _comp, char _view) const { return Fmt("w[%i][j].%c", front.nodes[_node].slot + _comp, _view); }
+    static char View(CPUKernel::ValueKind _kind) { return _kind == CPUKernel::VALUE_F32 ? 'f' : _kind == CPUKernel::VALUE_I32 ? 'i' : 'u'; }
+
+    ////////////////////////////////////////////
+    // Nodes
+    ////////////////////////////////////////////
+    void OpenLaneLoop() {
+        if (in_lane_loop) return;
+        Line("for (u32 j = 0; j < W; j++) {");
+        depth++;
+        in_lane_loop = true;
+    }
+    void CloseLaneLoop() {
+        if (!in_lane_loop) return;
+        depth--;
+        Line("}");
+        in_lane_loop = false;
+    }
+    // Nodes that only need their own lane go into the shared loop, wave ops and calls don't
+    bool IsLaneWise(u32 _node) const {
+        Node const &n = front.nodes[_node];
+        if (n.kind == CPUKernel::NODE_CALL) return false;
+        if (n.kind != CPUKernel::NODE_INTRINSIC) return true;
+        switch (CPUKernel::Intrinsic(n.op)) {
+        case CPUKernel::INTRINSIC_BALLOT:
+        case CPUKernel::INTRINSIC_ACTIVE_COUNT_BITS:
+        case CPUKernel::INTRINSIC_ACTIVE_ANY_TRUE:
+        case CPUKernel::INTRINSIC_ACTIVE_ALL_TRUE:
+        case CPUKernel::INTRINSIC_PREFIX_COUNT_BITS:
+        case CPUKernel::INTRINSIC_READ_LANE_FIRST:
+        case CPUKernel::INTRINSIC_ACTIVE_SUM:
+        case CPUKernel::INTRINSIC_ACTIVE_MIN:
+        case CPUKernel::INTRINSIC_ACTIVE_MAX:
+        case CPUKernel::INTRINSIC_PREFIX_SUM: return false;
+        default: return true;
+        }
+    }
+    // Declares a (word address) and ok (lane is active and inside the resource) for lane j, same rules as GetAddresses
+    void EmitAddress(Place const &_place, std::string const &_mask) {
+        std::string addr = Fmt("%iu", _place.offset);
+        for (auto &step : _place.steps) addr += Fmt(" + std::min(%s, %iu) * %iu", Word(front.nodes[step.node].slot, 'u').c_str(), step.bound - u32(1), step.stride);
+        Line("u32 a = " + addr + ";");
+        if (!_place.is_resource) {
+            Line(Fmt("bool ok = (%s >> j) & 1u;", _mask.c_str()));
+            return;
+        }
+        CPUKernel::ResourceInfo const &res = front.resources[_place.root];
+        Line(Fmt("u32 *rd = res[%i].data;", _place.root));
+        Line(Fmt("bool ok = rd != NULL && ((%s >> j) & 1u);", _mask.c_str()));
+        if (_place.coord == invalid) return;
+        Line("u64 e = 0;");
+        for (u32 d = res.num_dims; d-- > u32(0);) {
+            Line(Fmt("u32 c%i = %s;", d, Src(_place.coord, d, 'u').c_str()));
+            Line(Fmt("ok = ok && c%i < res[%i].size[%i];", d, _place.root, d));
+            Line(Fmt("e = e * u64(res[%i].size[%i]) + u64(c%i);", _place.root, d, d));
+        }
+        Line(Fmt("a += ok ? u32(e * u64(%iu)) : 0u;", res.elem_words));
+    }
+    std::string PlaceWord(Place const &_place, u32 _comp) const {
+        if (_place.is_resource) return Fmt("rd[a + %iu]", _place.comps[_comp]);
+        if (_place.steps.size() == size_t(0)) return Fmt("w[%i][j].u", _place.root + _place.offset + _place.comps[_comp]);
+        return Fmt("w[%i + a][j].u", _place.root + _place.comps[_comp]);
+    }
+    // Stores go through per lane temporaries so op= reads every old component first, like the interpreter's scratch copy
+    void EmitStore(u32 _place, OpType _op, std::function<std::string(u32)> _value, std::string const &_mask) {
+        Place const &p = front.places[_place];
+        OpenLaneLoop();
+        Line("{");
+        depth++;
+        EmitAddress(p, _mask);
+        switch (_op) {
+        case OP_PLUS_ASSIGN: _op = OP_PLUS; break;
+        case OP_MINUS_ASSIGN: _op = OP_MINUS; break;
+        case OP_MUL_ASSIGN: _op = OP_MUL; break;
+        case OP_DIV_ASSIGN: _op = OP_DIV; break;
+        case OP_BIT_OR_ASSIGN: _op = OP_BIT_OR; break;
+        case OP_BIT_AND_ASSIGN: _op = OP_BIT_AND; break;
+        case OP_BIT_XOR_ASSIGN: _op = OP_BIT_XOR; break;
+        default: break;
+        }
+        ifor(p.comps.size()) {
+            std::string value = _value(i);
+            if (_op != OP_ASSIGN) {
+                std::string old = p.is_resource ? Fmt("(ok ? %s : 0u)", PlaceWord(p, i).c_str()) : PlaceWord(p, i);
+                value           = Fmt("BinaryOp(%i, %i, %s, %s)", i32(_op), i32(p.type.kind), old.c_str(), value.c_str());
+            }
+            Line(Fmt("u32 v%i = %s;", i, value.c_str()));
+        }
+        Line("if (ok) {");
+        depth++;
+        ifor(p.comps.size()) Line(Fmt("%s = v%i;", PlaceWord(p, i).c_str(), i));
+        depth--;
+        Line("}");
+        depth--;
+        Line("}");
+        CloseLaneLoop();
+    }
+    void EmitLoad(u32 _node, std::string const &_mask) {
+        Node const  &n = front.nodes[_node];
+        Place const &p = front.places[n.place];
+        Line("{");
+        depth++;
+        if (p.is_resource) {
+            EmitAddress(p, _mask);
+            ifor(p.comps.size()) Line(Fmt("%s = ok ? %s : 0u;", Dst(_node, i, 'u').c_str(), PlaceWord(p, i).c_str()));
+        } else {
+            std::string addr = Fmt("%iu", p.offset);
+            for (auto &step : p.steps) addr += Fmt(" + std::min(%s, %iu) * %iu", Word(front.nodes[step.node].slot, 'u').c_str(), step.bound - u32(1), step.stride);
+            Line("u32 a = " + addr + ";");
+            ifor(p.comps.size()) Line(Fmt("%s = w[%i + a][j].u;", Dst(_node, i, 'u').c_str(), p.root + p.comps[i]));
+        }
+        depth--;
+        Line("}");
+    }
+    void EmitBinary(u32 _node) {
+        Node const               &n    = front.nodes[_node];
+        CPUKernel::ValueKind      kind = front.nodes[n.args[0]].type.kind;
+        OpType                    op   = OpType(n.op);
+        u32                       num  = n.type.GetNumComps();
+        bool                      is_f = kind == CPUKernel::VALUE_F32;
+        bool                      is_i = kind == CPUKernel::VALUE_I32;
+        auto a = [&](u32 _i, char _v) { return Src(n.args[0], _i, _v); };
+        auto b = [&](u32 _i, char _v) { return Src(n.args[1], _i, _v); };
+        ifor(num) {
+            std::string dst = Dst(_node, i, is_f && (op == OP_PLUS || op == OP_MINUS || op == OP_MUL || op == OP_DIV) ? 'f' : 'u');
+            char const *sym = NULL;
+            switch (op) {
+            case OP_PLUS: sym = "+"; break;
+            case OP_MINUS: sym = "-"; break;
+            case OP_MUL: sym = "*"; break;
+            case OP_DIV: sym = is_f ? "/" : NULL; break;
+            case OP_BIT_AND: sym = "&"; break;
+            case OP_BIT_OR: sym = "|"; break;
+            case OP_BIT_XOR: sym = "^"; break;
+            default: break;
+            }
+            char const *cmp = NULL;
+            switch (op) {
+            case OP_LESS: cmp = "<"; break;
+            case OP_LESS_OR_EQUAL: cmp = "<="; break;
+            case OP_GREATER: cmp = ">"; break;
+            case OP_GREATER_OR_EQUAL: cmp = ">="; break;
+            case OP_EQUAL: cmp = "=="; break;
+            case OP_NOT_EQUAL: cmp = "!="; break;
+            case OP_LOGICAL_AND: cmp = "&&"; break;
+            case OP_LOGICAL_OR: cmp = "||"; break;
+            default: break;
+            }
+            if (sym && (is_f ? (op == OP_PLUS || op == OP_MINUS || op == OP_MUL || op == OP_DIV) : true)) {
+                char v = is_f ? 'f' : 'u';
+                Line(Fmt("%s = %s %s %s;", dst.c_str(), a(i, v).c_str(), sym, b(i, v).c_str()));
+            } else if (cmp) {
+                char v = is_f ? 'f' : is_i && op != OP_EQUAL && op != OP_NOT_EQUAL ? 'i' : 'u';
+                Line(Fmt("%s = u32(%s %s %s);", dst.c_str(), a(i, v).c_str(), cmp, b(i, v).c_str()));
+            } else if (op == OP_SHIFT_LEFT) {
+                Line(Fmt("%s = %s << (%s & 31u);", dst.c_str(), a(i, 'u').c_str(), b(i, 'u').c_str()));
+            } else if (op == OP_SHIFT_RIGHT) {
+                if (is_i)
+                    Line(Fmt("%s = u32(%s >> i32(%s & 31u));", dst.c_str(), a(i, 'i').c_str(), b(i, 'u').c_str()));
+                else
+                    Line(Fmt("%s = %s >> (%s & 31u);", dst.c_str(), a(i, 'u').c_str(), b(i, 'u').c_str()));
+            } else if (is_f && op == OP_MODULO) {
+                Line(Fmt("w[%i][j].f = std::fmod(%s, %s);", n.slot + i, a(i, 'f').c_str(), b(i, 'f').c_str()));
+            } else {
+                Line(Fmt("%s = BinaryOp(%i, %i, %s, %s);", Dst(_node, i, 'u').c_str(), i32(op), i32(kind), a(i, 'u').c_str(), b(i, 'u').c_str()));
+            }
+        }
+    }
+    // Component wise float intrinsics, $a $b $c are the arguments
+    static char const *GetFloatIntrinsic(CPUKernel::Intrinsic _intrinsic) {
+        switch (_intrinsic) {
+        case CPUKernel::INTRINSIC_SIN: return "std::sin($a)";
+        case CPUKernel::INTRINSIC_COS: return "std::cos($a)";
+        case CPUKernel::INTRINSIC_TAN: return "std::tan($a)";
+        case CPUKernel::INTRINSIC_ASIN: return "std::asin($a)";
+        case CPUKernel::INTRINSIC_ACOS: return "std::acos($a)";
+        case CPUKernel::INTRINSIC_ATAN: return "std::atan($a)";
+        case CPUKernel::INTRINSIC_EXP: return "std::exp($a)";
+        case CPUKernel::INTRINSIC_EXP2: return "std::exp2($a)";
+        case CPUKernel::INTRINSIC_LOG: return "std::log($a)";
+        case CPUKernel::INTRINSIC_LOG2: return "std::log2($a)";
+        case CPUKernel::INTRINSIC_SQRT: return "std::sqrt($a)";
+        case CPUKernel::INTRINSIC_RSQRT: return "1.0f / std::sqrt($a)";
+        case CPUKernel::INTRINSIC_RCP: return "1.0f / $a";
+        case CPUKernel::INTRINSIC_FRAC: return "$a - std::floor($a)";
+        case CPUKernel::INTRINSIC_FLOOR: return "std::floor($a)";
+        case CPUKernel::INTRINSIC_CEIL: return "std::ceil($a)";
+        case CPUKernel::INTRINSIC_ROUND: return "std::nearbyint($a)";
+        case CPUKernel::INTRINSIC_TRUNC: return "std::trunc($a)";
+        case CPUKernel::INTRINSIC_SATURATE: return "std::min(std::max($a, 0.0f), 1.0f)";
+        case CPUKernel::INTRINSIC_POW: return "std::pow($a, $b)";
+        case CPUKernel::INTRINSIC_ATAN2: return "std::atan2($a, $b)";
+        case CPUKernel::INTRINSIC_FMOD: return "std::fmod($a, $b)";
+        case CPUKernel::INTRINSIC_STEP: return "$b >= $a ? 1.0f : 0.0f";
+        case CPUKernel::INTRINSIC_LERP: return "$a + ($b - $a) * $c";
+        case CPUKernel::INTRINSIC_SMOOTHSTEP: return "Smoothstep($a, $b, $c)";
+        default: return NULL;
+        }
+    }
+    static std::string Substitute(char const *_fmt, std::string const *_args) {
+        std::string r = {};
+        for (char const *c = _fmt; *c; c++) {
+            if (c[0] == '$' && c[1] >= 'a' && c[1] <= 'c') {
+                r += _args[c[1] - 'a'];
+                c++;
+            } else
+                r += *c;
+        }
+        return r;
+    }
+    void EmitIntrinsic(u32 _node, std::string const &_mask) {
+        Node const                 &n         = front.nodes[_node];
+        CPUKernel::Intrinsic        intrinsic = CPUKernel::Intrinsic(n.op);
+        u32                         num       = n.type.GetNumComps();
+        u32                         an        = n.args.size() ? front.nodes[n.args[0]].type.GetNumComps() : u32(0);
+        CPUKernel::ValueKind        kind      = n.args.size() ? front.nodes[n.args[0]].type.kind : CPUKernel::VALUE_VOID;
+        auto                        arg       = [&](u32 _arg, u32 _i, char _v) { return Src(n.args[_arg], _i, _v); };
+        if (char const *fmt = GetFloatIntrinsic(intrinsic)) {
+            ifor(num) {
+                std::string args[3] = {};
+                jfor(n.args.size()) args[j] = arg(j, i, 'f');
+                Line(Fmt("%s = ", Dst(_node, i, 'f').c_str()) + Substitute(fmt, args) + ";");
+            }
+            return;
+        }
+        auto each = [&](char const *_fmt, char _dst_view, char _src_view) {
+            ifor(num) {
+                std::string args[3] = {};
+                jfor(n.args.size()) args[j] = arg(j, i, _src_view);
+                Line(Fmt("%s = ", Dst(_node, i, _dst_view).c_str()) + Substitute(_fmt, args) + ";");
+            }
+        };
+        switch (intrinsic) {
+        case CPUKernel::INTRINSIC_ABS:
+            if (kind == CPUKernel::VALUE_F32)
+                each("$a & 0x7fffffffu", 'u', 'u');
+            else if (kind == CPUKernel::VALUE_I32)
+                each("$a < 0 ? u32(0) - u32($a) : u32($a)", 'u', 'i');
+            else
+                each("$a", 'u', 'u');
+            break;
+        case CPUKernel::INTRINSIC_SIGN:
+            if (kind == CPUKernel::VALUE_F32)
+                each("$a > 0.0f ? 1u : $a < 0.0f ? u32(-1) : 0u", 'u', 'f');
+            else if (kind == CPUKernel::VALUE_I32)
+                each("$a > 0 ? 1u : $a < 0 ? u32(-1) : 0u", 'u', 'i');
+            else
+                each("$a ? 1u : 0u", 'u', 'u');
+            break;
+        case CPUKernel::INTRINSIC_MIN: each(Fmt("MinMax(%i, $a, $b, true)", i32(kind)).c_str(), 'u', 'u'); break;
+        case CPUKernel::INTRINSIC_MAX: each(Fmt("MinMax(%i, $a, $b, false)", i32(kind)).c_str(), 'u', 'u'); break;
+        case CPUKernel::INTRINSIC_CLAMP: each(Fmt("Clamp(%i, $a, $b, $c)", i32(kind)).c_str(), 'u', 'u'); break;
+        case CPUKernel::INTRINSIC_MAD:
+            if (kind == CPUKernel::VALUE_F32)
+                each("$a * $b + $c", 'f', 'f');
+            else
+                each("$a * $b + $c", 'u', 'u');
+            break;
+        case CPUKernel::INTRINSIC_ISNAN: each("u32($a != $a)", 'u', 'f'); break;
+        case CPUKernel::INTRINSIC_ISINF: each("u32(($a & 0x7fffffffu) == 0x7f800000u)", 'u', 'u'); break;
+        case CPUKernel::INTRINSIC_DOT:
+        case CPUKernel::INTRINSIC_LENGTH:
+        case CPUKernel::INTRINSIC_DISTANCE:
+        case CPUKernel::INTRINSIC_NORMALIZE: {
+            Line("{");
+            depth++;
+            Line("f32 sum = 0.0f;");
+            ifor(an) {
+                if (intrinsic == CPUKernel::INTRINSIC_DOT)
+                    Line(Fmt("sum += %s * %s;", arg(0, i, 'f').c_str(), arg(1, i, 'f').c_str()));
+                else if (intrinsic == CPUKernel::INTRINSIC_DISTANCE)
+                    Line(Fmt("{ f32 d = %s - %s; sum += d * d; }", arg(0, i, 'f').c_str(), arg(1, i, 'f').c_str()));
+                else
+                    Line(Fmt("sum += %s * %s;", arg(0, i, 'f').c_str(), arg(0, i, 'f').c_str()));
+            }
+            if (intrinsic == CPUKernel::INTRINSIC_DOT)
+                Line(Fmt("%s = sum;", Dst(_node, 0, 'f').c_str()));
+            else if (intrinsic == CPUKernel::INTRINSIC_NORMALIZE) {
+                Line("f32 inv = 1.0f / std::sqrt(sum);");
+                ifor(num) Line(Fmt("%s = %s * inv;", Dst(_node, i, 'f').c_str(), arg(0, i, 'f').c_str()));
+            } else
+                Line(Fmt("%s = std::sqrt(sum);", Dst(_node, 0, 'f').c_str()));
+            depth--;
+            Line("}");
+            break;
+        }
+        case CPUKernel::INTRINSIC_CROSS:
+            ifor(3) {
+                u32 i1 = (i + u32(1)) % u32(3);
+                u32 i2 = (i + u32(2)) % u32(3);
+                Line(Fmt("%s = %s * %s - %s * %s;", Dst(_node, i, 'f').c_str(), arg(0, i1, 'f').c_str(), arg(1, i2, 'f').c_str(), arg(0, i2, 'f').c_str(), arg(1, i1, 'f').c_str()));
+            }
+            break;
+        case CPUKernel::INTRINSIC_REFLECT: {
+            Line("{");
+            depth++;
+            Line("f32 d = 0.0f;");
+            ifor(num) Line(Fmt("d += %s * %s;", arg(0, i, 'f').c_str(), arg(1, i, 'f').c_str()));
+            ifor(num) Line(Fmt("%s = %s - 2.0f * d * %s;", Dst(_node, i, 'f').c_str(), arg(0, i, 'f').c_str(), arg(1, i, 'f').c_str()));
+            depth--;
+            Line("}");
+            break;
+        }
+        case CPUKernel::INTRINSIC_ANY:
+        case CPUKernel::INTRINSIC_ALL: {
+            std::string expr = {};
+            ifor(an) expr += Fmt("%s(%s != 0u)", i ? (intrinsic == CPUKernel::INTRINSIC_ANY ? " || " : " && ") : "", arg(0, i, 'u').c_str());
+            Line(Fmt("%s = u32(%s);", Dst(_node, 0, 'u').c_str(), expr.c_str()));
+            break;
+        }
+        case CPUKernel::INTRINSIC_COUNTBITS: each("CountBits($a)", 'u', 'u'); break;
+        case CPUKernel::INTRINSIC_FIRSTBITHIGH: each("FirstBitHigh($a)", 'u', 'u'); break;
+        case CPUKernel::INTRINSIC_FIRSTBITLOW: each("FirstBitLow($a)", 'u', 'u'); break;
+        case CPUKernel::INTRINSIC_REVERSEBITS: each("ReverseBits($a)", 'u', 'u'); break;
+        case CPUKernel::INTRINSIC_F32TOF16: each("F32ToF16($a)", 'u', 'f'); break;
+        case CPUKernel::INTRINSIC_F16TOF32: each("F16ToF32($a)", 'f', 'u'); break;
+        case CPUKernel::INTRINSIC_ASF32:
+        case CPUKernel::INTRINSIC_ASU32:
+        case CPUKernel::INTRINSIC_ASI32:
+        case CPUKernel::INTRINSIC_IDENTITY: ifor(front.GetWords(n.type)) Line(Fmt("%s = %s;", Dst(_node, i, 'u').c_str(), arg(0, i, 'u').c_str())); break;
+        case CPUKernel::INTRINSIC_MUL: {
+            CPUKernel::ValueType const &ta = front.nodes[n.args[0]].type;
+            CPUKernel::ValueType const &tb = front.nodes[n.args[1]].type;
+            u32                         rr = ta.IsMatrix() ? ta.rows : u32(1);
+            u32                         rc = tb.IsMatrix() ? tb.cols : u32(1);
+            bool                        is_f = ta.kind == CPUKernel::VALUE_F32;
+            for (u32 i = u32(0); i < rr; i++)
+                for (u32 o = u32(0); o < rc; o++) {
+                    std::string acc = is_f ? "0.0f" : "0u";
+                    for (u32 t = u32(0); t < ta.cols; t++)
+                        acc = Fmt("(%s + %s * %s)", acc.c_str(), arg(0, i * ta.cols + t, is_f ? 'f' : 'u').c_str(), arg(1, tb.IsMatrix() ? t * tb.cols + o : t, is_f ? 'f' : 'u').c_str());
+                    Line(Fmt("%s = %s;", Dst(_node, i * rc + o, is_f ? 'f' : 'u').c_str(), acc.c_str()));
+                }
+            break;
+        }
+        case CPUKernel::INTRINSIC_TRANSPOSE: {
+            CPUKernel::ValueType const &ta = front.nodes[n.args[0]].type;
+            for (u32 i = u32(0); i < ta.rows; i++)
+                for (u32 o = u32(0); o < ta.cols; o++) Line(Fmt("%s = %s;", Dst(_node, o * ta.rows + i, 'u').c_str(), arg(0, i * ta.cols + o, 'u').c_str()));
+            break;
+        }
+        case CPUKernel::INTRINSIC_LANE_INDEX: Line(Fmt("%s = j;", Dst(_node, 0, 'u').c_str())); break;
+        case CPUKernel::INTRINSIC_LANE_COUNT: Line(Fmt("%s = W;", Dst(_node, 0, 'u').c_str())); break;
+        case CPUKernel::INTRINSIC_LANE_BIT: Line(Fmt("%s = 1u << j;", Dst(_node, 0, 'u').c_str())); break;
+        case CPUKernel::INTRINSIC_IS_FIRST_LANE: Line(Fmt("%s = u32(j == FirstBitLow(%s));", Dst(_node, 0, 'u').c_str(), _mask.c_str())); break;
+        default: EmitWaveIntrinsic(_node, _mask); break;
+        }
+    }
+    // Cross lane, each of these is a few loops of its own
+    void EmitWaveIntrinsic(u32 _node, std::string const &_mask) {
+        Node const          &n         = front.nodes[_node];
+        CPUKernel::Intrinsic intrinsic = CPUKernel::Intrinsic(n.op);
+        CPUKernel::ValueKind kind      = front.nodes[n.args[0]].type.kind;
+        Line("{");
+        depth++;
+        switch (intrinsic) {
+        case CPUKernel::INTRINSIC_BALLOT:
+        case CPUKernel::INTRINSIC_ACTIVE_COUNT_BITS:
+        case CPUKernel::INTRINSIC_ACTIVE_ANY_TRUE:
+        case CPUKernel::INTRINSIC_ACTIVE_ALL_TRUE:
+        case CPUKernel::INTRINSIC_PREFIX_COUNT_BITS: {
+            Line("u32 bits = 0u;");
+            Line(Fmt("for (u32 j = 0; j < W; j++) bits |= %s ? (1u << j) : 0u;", Src(n.args[0], 0, 'u').c_str()));
+            Line(Fmt("bits &= %s;", _mask.c_str()));
+            Line("for (u32 j = 0; j < W; j++) {");
+            depth++;
+            if (intrinsic == CPUKernel::INTRINSIC_BALLOT) {
+                Line(Fmt("%s = bits;", Dst(_node, 0, 'u').c_str()));
+                for (u32 i = u32(1); i < u32(4); i++) Line(Fmt("%s = 0u;", Dst(_node, i, 'u').c_str()));
+            } else if (intrinsic == CPUKernel::INTRINSIC_ACTIVE_COUNT_BITS)
+                Line(Fmt("%s = CountBits(bits);", Dst(_node, 0, 'u').c_str()));
+            else if (intrinsic == CPUKernel::INTRINSIC_ACTIVE_ANY_TRUE)
+                Line(Fmt("%s = u32(bits != 0u);", Dst(_node, 0, 'u').c_str()));
+            else if (intrinsic == CPUKernel::INTRINSIC_ACTIVE_ALL_TRUE)
+                Line(Fmt("%s = u32(bits == %s);", Dst(_node, 0, 'u').c_str(), _mask.c_str()));
+            else
+                Line(Fmt("%s = CountBits(bits & ((1u << j) - 1u));", Dst(_node, 0, 'u').c_str()));
+            depth--;
+            Line("}");
+            break;
+        }
+        case CPUKernel::INTRINSIC_READ_LANE_FIRST:
+            Line(Fmt("u32 first = %s ? FirstBitLow(%s) : 0u;", _mask.c_str(), _mask.c_str()));
+            Line("for (u32 j = 0; j < W; j++) {");
+            depth++;
+            ifor(front.GetWords(n.type)) Line(Fmt("%s = %s;", Dst(_node, i, 'u').c_str(), Src(n.args[0], i, 'u', "first").c_str()));
+            depth--;
+            Line("}");
+            break;
+        case CPUKernel::INTRINSIC_ACTIVE_SUM:
+        case CPUKernel::INTRINSIC_ACTIVE_MIN:
+        case CPUKernel::INTRINSIC_ACTIVE_MAX:
+        case CPUKernel::INTRINSIC_PREFIX_SUM: {
+            bool is_sum = intrinsic == CPUKernel::INTRINSIC_ACTIVE_SUM || intrinsic == CPUKernel::INTRINSIC_PREFIX_SUM;
+            ifor(n.type.GetNumComps()) {
+                Line("{");
+                depth++;
+                Line(Fmt("u32 acc = %s;", kind == CPUKernel::VALUE_F32 ? "0x00000000u" : "0u"));
+                Line(Fmt("bool has_acc = %s;", is_sum ? "true" : "false"));
+                Line("u32 prefix[W];");
+                Line("for (u32 j = 0; j < W; j++) {");
+                depth++;
+                Line("prefix[j] = acc;");
+                Line(Fmt("if (!((%s >> j) & 1u)) continue;", _mask.c_str()));
+                Line(Fmt("u32 x = %s;", Src(n.args[0], i, 'u').c_str()));
+                if (is_sum)
+                    Line(Fmt("acc = BinaryOp(%i, %i, acc, x);", i32(OP_PLUS), i32(kind)));
+                else
+                    Line(Fmt("if (!has_acc || (BinaryOp(%i, %i, x, acc) != 0u) == %s) acc = x;", i32(OP_LESS), i32(kind),
+                             intrinsic == CPUKernel::INTRINSIC_ACTIVE_MIN ? "true" : "false"));
+                Line("has_acc = true;");
+                depth--;
+                Line("}");
+                Line(Fmt("for (u32 j = 0; j < W; j++) %s = %s;", Dst(_node, i, 'u').c_str(), intrinsic == CPUKernel::INTRINSIC_PREFIX_SUM ? "prefix[j]" : "acc"));
+                depth--;
+                Line("}");
+            }
+            break;
+        }
+        default: SJIT_UNIMPLEMENTED;
+        }
+        depth--;
+        Line("}");
+    }
+    void EmitNode(u32 _node, std::string const &_mask) {
+        Node const &n = front.nodes[_node];
+        switch (n.kind) {
+        case CPUKernel::NODE_LOAD: EmitLoad(_node, _mask); break;
+        case CPUKernel::NODE_SWIZZLE: ifor(n.comps.size()) Line(Fmt("%s = %s;", Dst(_node, i, 'u').c_str(), Src(n.args[0], n.comps[i], 'u').c_str())); break;
+        case CPUKernel::NODE_CONVERT: {
+            CPUKernel::ValueKind from = CPUKernel::ValueKind(n.op);
+            CPUKernel::ValueKind to   = n.type.kind;
+            ifor(n.type.GetNumComps()) {
+                if (from == CPUKernel::VALUE_I32 && to == CPUKernel::VALUE_F32)
+                    Line(Fmt("%s = f32(%s);", Dst(_node, i, 'f').c_str(), Src(n.args[0], i, 'i').c_str()));
+                else if (from == CPUKernel::VALUE_U32 && to == CPUKernel::VALUE_F32)
+                    Line(Fmt("%s = f32(%s);", Dst(_node, i, 'f').c_str(), Src(n.args[0], i, 'u').c_str()));
+                else
+                    Line(Fmt("%s = ConvertWord(%s, %i, %i);", Dst(_node, i, 'u').c_str(), Src(n.args[0], i, 'u').c_str(), i32(from), i32(to)));
+            }
+            break;
+        }
+        case CPUKernel::NODE_UNARY:
+            ifor(n.type.GetNumComps()) {
+                std::string a = Src(n.args[0], i, 'u');
+                std::string r = OpType(n.op) == OP_MINUS         ? (n.type.kind == CPUKernel::VALUE_F32 ? a + " ^ 0x80000000u" : "0u - " + a)
+                              : OpType(n.op) == OP_LOGICAL_NOT ? "u32(" + a + " == 0u)"
+                                                               : "~" + a;
+                Line(Fmt("%s = %s;", Dst(_node, i, 'u').c_str(), r.c_str()));
+            }
+            break;
+        case CPUKernel::NODE_BINARY: EmitBinary(_node); break;
+        case CPUKernel::NODE_SELECT:
+            ifor(front.GetWords(n.type)) {
+                Line(Fmt("%s = %s ? %s : %s;", Dst(_node, i, 'u').c_str(), Src(n.args[0], i, 'u').c_str(), Src(n.args[1], i, 'u').c_str(), Src(n.args[2], i, 'u').c_str()));
+            }
+            break;
+        case CPUKernel::NODE_CONSTRUCT: {
+            u32 offset = u32(0);
+            for (u32 a : n.args) {
+                ifor(front.nodes[a].type.GetNumComps()) Line(Fmt("%s = %s;", Dst(_node, offset + i, 'u').c_str(), Src(a, i, 'u').c_str()));
+                offset += front.nodes[a].type.GetNumComps();
+            }
+            break;
+        }
+        case CPUKernel::NODE_INTRINSIC: EmitIntrinsic(_node, _mask); break;
+        case CPUKernel::NODE_CALL: {
+            CPUKernel::Call const &call = front.calls[n.op];
+            Line("for (u32 j = 0; j < W; j++) {");
+            depth++;
+            Line(Fmt("if (!((%s >> j) & 1u)) continue;", _mask.c_str()));
+            ifor(call.params.size()) jfor(front.GetWords(front.nodes[n.args[i]].type)) Line(Fmt("w[%i][j].u = %s;", call.params[i] + j, Src(n.args[i], j, 'u').c_str()));
+            depth--;
+            Line("}");
+            std::string m = NewName("m");
+            Line(Fmt("u32 %s = %s;", m.c_str(), _mask.c_str()));
+            EmitBlock(call.body, m);
+            ifor(call.params.size()) {
+                if (call.out_places[i] == invalid) continue;
+                u32 param = call.params[i];
+                EmitStore(call.out_places[i], OP_ASSIGN, [&](u32 _comp) { return Fmt("w[%i][j].u", param + _comp); }, _mask);
+            }
+            break;
+        }
+        case CPUKernel::NODE_DIMENSIONS: ifor(front.resources[n.op].num_dims) Line(Fmt("%s = res[%i].size[%i];", Dst(_node, i, 'u').c_str(), n.op, i)); break;
+        case CPUKernel::NODE_SAMPLE:
+            Line("{");
+            depth++;
+            Line("f32 s[16];");
+            Line(Fmt("Sample(res[%i], %iu, %iu, %s, %s, s);", n.op, front.resources[n.op].elem_words, n.type.GetNumComps(), Src(n.args[0], 0, 'f').c_str(),
+                     Src(n.args[0], 1, 'f').c_str()));
+            ifor(n.type.GetNumComps()) Line(Fmt("%s = s[%i];", Dst(_node, i, 'f').c_str(), i));
+            depth--;
+            Line("}");
+            break;
+        default: break;
+        }
+    }
+    void EmitCode(Array<u32> const &_code, std::string const &_mask) {
+        for (u32 n : _code) {
+            if (IsLaneWise(n)) {
+                OpenLaneLoop();
+            } else
+                CloseLaneLoop();
+            EmitNode(n, _mask);
+        }
+        CloseLaneLoop();
+    }
+    // Lanes of a bool node that are set, as a new mask
+    std::string EmitCondition(u32 _node) {
+        std::string c = NewName("c");
+        Line(Fmt("u32 %s = 0u;", c.c_str()));
+        Line(Fmt("for (u32 j = 0; j < W; j++) %s |= %s ? (1u << j) : 0u;", c.c_str(), Src(_node, 0, 'u').c_str()));
+        return c;
+    }
+
+    ////////////////////////////////////////////
+    // Statements
+    ////////////////////////////////////////////
+    // _mask is updated in place with the lanes that get to the next statement
+    void EmitStmt(u32 _stmt, std::string const &_mask) {
+        Stmt const &stmt = front.stmts[_stmt];
+        char const *m    = _mask.c_str();
+        switch (stmt.kind) {
+        case CPUKernel::STMT_CODE: EmitCode(stmt.code, _mask); break;
+        case CPUKernel::STMT_STORE: {
+            EmitCode(stmt.code, _mask);
+            u32 value = stmt.value;
+            EmitStore(stmt.place, stmt.op, [&](u32 _comp) { return Src(value, _comp, 'u'); }, _mask);
+            break;
+        }
+        case CPUKernel::STMT_BLOCK: EmitBlock(stmt.body, _mask); break;
+        case CPUKernel::STMT_IF: {
+            EmitCode(stmt.code, _mask);
+            std::string c    = EmitCondition(stmt.value);
+            std::string then = NewName("m");
+            std::string els  = NewName("m");
+            Line(Fmt("u32 %s = %s & %s;", then.c_str(), m, c.c_str()));
+            Line(Fmt("u32 %s = %s & ~%s;", els.c_str(), m, c.c_str()));
+            Line(Fmt("%s = 0u;", m));
+            Line(Fmt("if (%s) {", then.c_str()));
+            depth++;
+            EmitBlock(stmt.body, then);
+            Line(Fmt("%s |= %s;", m, then.c_str()));
+            depth--;
+            Line("}");
+            if (stmt.else_body != invalid) {
+                Line(Fmt("if (%s) {", els.c_str()));
+                depth++;
+                EmitBlock(stmt.else_body, els);
+                depth--;
+                Line("}");
+            }
+            Line(Fmt("%s |= %s;", m, els.c_str()));
+            break;
+        }
+        case CPUKernel::STMT_LOOP: {
+            std::string brk    = NewName("brk");
+            std::string cont   = NewName("cont");
+            std::string active = NewName("m");
+            std::string exited = NewName("exited");
+            Line(Fmt("u32 %s = 0u, %s = 0u, %s = %s, %s = 0u;", brk.c_str(), cont.c_str(), active.c_str(), m, exited.c_str()));
+            Line("for (;;) {");
+            depth++;
+            EmitCode(stmt.code, active);
+            std::string c = EmitCondition(stmt.value);
+            Line(Fmt("%s |= %s & ~%s;", exited.c_str(), active.c_str(), c.c_str()));
+            Line(Fmt("%s &= %s;", active.c_str(), c.c_str()));
+            Line(Fmt("if (!%s) break;", active.c_str()));
+            Line(Fmt("%s = 0u;", cont.c_str()));
+            brk_stack.push_back(brk);
+            cont_stack.push_back(cont);
+            EmitBlock(stmt.body, active);
+            Line(Fmt("%s |= %s;", active.c_str(), cont.c_str()));
+            Line(Fmt("if (!%s) break;", active.c_str()));
+            if (stmt.step != invalid) EmitBlock(stmt.step, active);
+            brk_stack.pop_back();
+            cont_stack.pop_back();
+            depth--;
+            Line("}");
+            Line(Fmt("%s = %s | %s;", m, exited.c_str(), brk.c_str()));
+            break;
+        }
+        case CPUKernel::STMT_SWITCH: {
+            EmitCode(stmt.code, _mask);
+            std::string brk         = NewName("brk");
+            std::string matched     = NewName("matched");
+            std::string running     = NewName("m");
+            bool        has_default = false;
+            Line(Fmt("u32 %s = 0u, %s = 0u, %s = 0u;", brk.c_str(), matched.c_str(), running.c_str()));
+            Array<std::string> case_masks = {};
+            for (auto &c : stmt.cases) {
+                case_masks.push_back(NewName("case"));
+                if (c.is_default) {
+                    has_default = true;
+                    continue;
+                }
+                Line(Fmt("u32 %s = 0u;", case_masks.back().c_str()));
+                Line(Fmt("for (u32 j = 0; j < W; j++) %s |= %s == 0x%08xu ? (1u << j) : 0u;", case_masks.back().c_str(), Src(stmt.value, 0, 'u').c_str(), u32(c.label)));
+                Line(Fmt("%s &= %s & ~%s;", case_masks.back().c_str(), m, matched.c_str()));
+                Line(Fmt("%s |= %s;", matched.c_str(), case_masks.back().c_str()));
+            }
+            ifor(stmt.cases.size()) if (stmt.cases[i].is_default) Line(Fmt("u32 %s = %s & ~%s;", case_masks[i].c_str(), m, matched.c_str()));
+            // Case positions only grow, lanes join at their label and lanes that broke out drop off
+            brk_stack.push_back(brk);
+            Array<u32> const &body = front.blocks[stmt.body];
+            u32               next = u32(0);
+            for (u32 pos = u32(0); pos <= u32(body.size()); pos++) {
+                while (next < u32(stmt.cases.size()) && stmt.cases[next].position == pos) Line(Fmt("%s |= %s;", running.c_str(), case_masks[next++].c_str()));
+                if (pos == u32(body.size())) break;
+                Line(Fmt("if (%s) {", running.c_str()));
+                depth++;
+                EmitStmt(body[pos], running);
+                depth--;
+                Line("}");
+            }
+            brk_stack.pop_back();
+            if (has_default)
+                Line(Fmt("%s = %s | %s;", m, running.c_str(), brk.c_str()));
+            else
+                Line(Fmt("%s = %s | %s | (%s & ~%s);", m, running.c_str(), brk.c_str(), m, matched.c_str()));
+            break;
+        }
+        case CPUKernel::STMT_BREAK:
+            Line(Fmt("%s |= %s;", brk_stack.back().c_str(), m));
+            Line(Fmt("%s = 0u;", m));
+            break;
+        case CPUKernel::STMT_CONTINUE:
+            Line(Fmt("%s |= %s;", cont_stack.back().c_str(), m));
+            Line(Fmt("%s = 0u;", m));
+            break;
+        case CPUKernel::STMT_RETURN:
+            if (stmt.value != invalid) {
+                EmitCode(stmt.code, _mask);
+                Line("for (u32 j = 0; j < W; j++) {");
+                depth++;
+                Line(Fmt("if (!((%s >> j) & 1u)) continue;", m));
+                ifor(front.GetWords(front.nodes[stmt.value].type)) Line(Fmt("w[%i][j].u = %s;", stmt.ret_slot + i, Src(stmt.value, i, 'u').c_str()));
+                depth--;
+                Line("}");
+            }
+            Line(Fmt("%s = 0u;", m));
+            break;
+        default: SJIT_UNIMPLEMENTED;
+        }
+    }
+    void EmitBlock(u32 _block, std::string const &_mask) {
+        for (u32 stmt : front.blocks[_block]) {
+            Line(Fmt("if (%s) {", _mask.c_str()));
+            depth++;
+            EmitStmt(stmt, _mask);
+            depth--;
+            Line("}");
+        }
+    }
+
+    ////////////////////////////////////////////
+    // Translation unit
+    ////////////////////////////////////////////
+    void EmitPrelude() {
+        out.Write("// Generated by SJIT from an HLSLModule, see sjit/sjit_cpp.hpp\n");
+        out.Write(R"(#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#    define SJIT_EXPORT extern "C" __declspec(dllexport)
+#else
+#    define SJIT_EXPORT extern "C" __attribute__((visibility("default")))
+#endif
+
+namespace {
+
+typedef uint32_t u32;
+typedef int32_t  i32;
+typedef uint64_t u64;
+typedef float    f32;
+
+union Word {
+    u32 u;
+    i32 i;
+    f32 f;
+};
+struct Resource {
+    u32 *data;
+    u32  size[3];
+};
+
+)");
+        out.EmitF("static constexpr u32 W = %iu;\n", num_lanes);
+        out.EmitF("enum { KIND_BOOL = %i, KIND_I32 = %i, KIND_U32 = %i, KIND_F32 = %i };\n", i32(CPUKernel::VALUE_BOOL), i32(CPUKernel::VALUE_I32), i32(CPUKernel::VALUE_U32),
+                  i32(CPUKernel::VALUE_F32));
+        out.EmitF("enum { OP_PLUS = %i, OP_MINUS = %i, OP_MUL = %i, OP_DIV = %i, OP_MODULO = %i, OP_LESS = %i, OP_LESS_OR_EQUAL = %i, OP_GREATER = %i, ", i32(OP_PLUS),
+                  i32(OP_MINUS), i32(OP_MUL), i32(OP_DIV), i32(OP_MODULO), i32(OP_LESS), i32(OP_LESS_OR_EQUAL), i32(OP_GREATER));
+        out.EmitF("OP_GREATER_OR_EQUAL = %i, OP_EQUAL = %i, OP_NOT_EQUAL = %i, OP_BIT_AND = %i, OP_BIT_OR = %i, OP_BIT_XOR = %i, ", i32(OP_GREATER_OR_EQUAL), i32(OP_EQUAL),
+                  i32(OP_NOT_EQUAL), i32(OP_BIT_AND), i32(OP_BIT_OR), i32(OP_BIT_XOR));
+        out.EmitF("OP_LOGICAL_AND = %i, OP_LOGICAL_OR = %i, OP_SHIFT_LEFT = %i, OP_SHIFT_RIGHT = %i };\n", i32(OP_LOGICAL_AND), i32(OP_LOGICAL_OR), i32(OP_SHIFT_LEFT),
+                  i32(OP_SHIFT_RIGHT));
+        // Scalar helpers, the same semantics as the interpreter
+        out.Write(R"(
+inline f32 AsF(u32 b) {
+    f32 f;
+    memcpy(&f, &b, 4);
+    return f;
+}
+inline u32 AsU(f32 f) {
+    u32 u;
+    memcpy(&u, &f, 4);
+    return u;
+}
+inline u32 CountBits(u32 v) {
+    v = v - ((v >> 1u) & 0x55555555u);
+    v = (v & 0x33333333u) + ((v >> 2u) & 0x33333333u);
+    return (((v + (v >> 4u)) & 0xf0f0f0fu) * 0x1010101u) >> 24u;
+}
+inline u32 FirstBitLow(u32 v) {
+    if (v == 0u) return u32(-1);
+    u32 i = 0u;
+    while (!(v & (1u << i))) i++;
+    return i;
+}
+inline u32 FirstBitHigh(u32 v) {
+    if (v == 0u) return u32(-1);
+    u32 i = 31u;
+    while (!(v & (1u << i))) i--;
+    return i;
+}
+inline u32 ReverseBits(u32 x) {
+    u32 y = 0u;
+    for (u32 i = 0u; i < 32u; i++) y |= ((x >> i) & 1u) << (31u - i);
+    return y;
+}
+inline u32 ConvertWord(u32 bits, int from, int to) {
+    if (from == to) return bits;
+    switch (to) {
+    case KIND_BOOL: return from == KIND_F32 ? u32(AsF(bits) != 0.0f) : u32(bits != 0u);
+    case KIND_F32: return from == KIND_I32 ? AsU(f32(i32(bits))) : AsU(f32(bits));
+    case KIND_I32:
+    case KIND_U32:
+        if (from == KIND_F32) {
+            f32 f = AsF(bits);
+            if (!(f == f)) return 0u;
+            if (to == KIND_I32) return u32(i32(std::max(-2147483648.0f, std::min(f, 2147483520.0f))));
+            return u32(std::max(0.0f, std::min(f, 4294967040.0f)));
+        }
+        return bits;
+    default: return bits;
+    }
+}
+inline u32 BinaryOp(int op, int kind, u32 a, u32 b) {
+    if (kind == KIND_F32) {
+        f32 x = AsF(a);
+        f32 y = AsF(b);
+        switch (op) {
+        case OP_PLUS: return AsU(x + y);
+        case OP_MINUS: return AsU(x - y);
+        case OP_MUL: return AsU(x * y);
+        case OP_DIV: return AsU(x / y);
+        case OP_MODULO: return AsU(std::fmod(x, y));
+        case OP_LESS: return u32(x < y);
+        case OP_LESS_OR_EQUAL: return u32(x <= y);
+        case OP_GREATER: return u32(x > y);
+        case OP_GREATER_OR_EQUAL: return u32(x >= y);
+        case OP_EQUAL: return u32(x == y);
+        case OP_NOT_EQUAL: return u32(x != y);
+        default: return 0u;
+        }
+    }
+    bool is_signed = kind == KIND_I32;
+    switch (op) {
+    case OP_PLUS: return a + b;
+    case OP_MINUS: return a - b;
+    case OP_MUL: return a * b;
+    case OP_DIV: return b == 0u ? u32(-1) : is_signed ? (i32(b) == -1 ? 0u - a : u32(i32(a) / i32(b))) : a / b;
+    case OP_MODULO: return b == 0u ? u32(-1) : is_signed ? (i32(b) == -1 ? 0u : u32(i32(a) % i32(b))) : a % b;
+    case OP_LESS: return is_signed ? u32(i32(a) < i32(b)) : u32(a < b);
+    case OP_LESS_OR_EQUAL: return is_signed ? u32(i32(a) <= i32(b)) : u32(a <= b);
+    case OP_GREATER: return is_signed ? u32(i32(a) > i32(b)) : u32(a > b);
+    case OP_GREATER_OR_EQUAL: return is_signed ? u32(i32(a) >= i32(b)) : u32(a >= b);
+    case OP_EQUAL: return u32(a == b);
+    case OP_NOT_EQUAL: return u32(a != b);
+    case OP_BIT_AND: return a & b;
+    case OP_BIT_OR: return a | b;
+    case OP_BIT_XOR: return a ^ b;
+    case OP_LOGICAL_AND: return u32(a && b);
+    case OP_LOGICAL_OR: return u32(a || b);
+    case OP_SHIFT_LEFT: return a << (b & 31u);
+    case OP_SHIFT_RIGHT: return is_signed ? u32(i32(a) >> i32(b & 31u)) : a >> (b & 31u);
+    default: return 0u;
+    }
+}
+inline u32 MinMax(int kind, u32 x, u32 y, bool is_min) {
+    bool less = BinaryOp(OP_LESS, kind, x, y) != 0u;
+    if (kind == KIND_F32 && AsF(x) != AsF(x)) return y; // NaN loses
+    if (kind == KIND_F32 && AsF(y) != AsF(y)) return x;
+    return less == is_min ? x : y;
+}
+inline u32 Clamp(int kind, u32 x, u32 lo, u32 hi) {
+    if (BinaryOp(OP_LESS, kind, x, lo)) x = lo;
+    if (BinaryOp(OP_GREATER, kind, x, hi)) x = hi;
+    return x;
+}
+inline f32 Smoothstep(f32 e0, f32 e1, f32 x) {
+    f32 t = std::min(std::max((x - e0) / (e1 - e0), 0.0f), 1.0f);
+    return t * t * (3.0f - 2.0f * t);
+}
+// Round to nearest with ties away from zero like half.hpp
+inline u32 F32ToF16(f32 f) {
+    u32 x    = AsU(f);
+    u32 sign = (x >> 16u) & 0x8000u;
+    u32 e    = (x >> 23u) & 0xffu;
+    u32 m    = x & 0x7fffffu;
+    if (e == 0xffu) return sign | 0x7c00u | (m >> 13u);
+    i32 exp = i32(e) - 127 + 15;
+    if (exp >= 31) return sign | 0x7c00u;
+    u32 shift = 13u;
+    if (exp <= 0) {
+        if (exp < -10) return sign;
+        m |= 0x800000u;
+        shift = u32(14 - exp);
+        exp   = 0;
+    }
+    u32 h    = (u32(exp) << 10u) + (m >> shift);
+    u32 rem  = m & ((1u << shift) - 1u);
+    u32 half = 1u << (shift - 1u);
+    if (rem >= half) h++;
+    return sign | h;
+}
+inline f32 F16ToF32(u32 h) {
+    u32 sign = (h & 0x8000u) << 16u;
+    u32 e    = (h >> 10u) & 0x1fu;
+    u32 m    = h & 0x3ffu;
+    if (e == 0u) return AsF(sign | AsU(f32(m) * 5.9604644775390625e-8f));
+    if (e == 31u) return AsF(sign | 0x7f800000u | (m << 13u));
+    return AsF(sign | ((e + 112u) << 23u) | (m << 13u));
+}
+// Bilinear from mip 0 with clamped coordinates
+inline void Sample(Resource const &r, u32 elem_words, u32 num, f32 u, f32 v, f32 *out) {
+    if (r.data == NULL || r.size[0] == 0u || r.size[1] == 0u) {
+        for (u32 i = 0u; i < num; i++) out[i] = 0.0f;
+        return;
+    }
+    f32  x     = u * f32(r.size[0]) - 0.5f;
+    f32  y     = v * f32(r.size[1]) - 0.5f;
+    f32  fx    = std::floor(x);
+    f32  fy    = std::floor(y);
+    f32  tx    = x - fx;
+    f32  ty    = y - fy;
+    auto texel = [&](f32 _x, f32 _y, u32 _c) {
+        i32 ix = std::min(std::max(i32(_x), 0), i32(r.size[0]) - 1);
+        i32 iy = std::min(std::max(i32(_y), 0), i32(r.size[1]) - 1);
+        return AsF(r.data[(u32(iy) * r.size[0] + u32(ix)) * elem_words + _c]);
+    };
+    for (u32 i = 0u; i < num; i++) {
+        f32 top    = texel(fx, fy, i) * (1.0f - tx) + texel(fx + 1.0f, fy, i) * tx;
+        f32 bottom = texel(fx, fy + 1.0f, i) * (1.0f - tx) + texel(fx + 1.0f, fy + 1.0f, i) * tx;
+        out[i]     = top * (1.0f - ty) + bottom * ty;
+    }
+}
+)");
+    }
+    void EmitDispatch() {
+        u32x3 gs = front.group_size;
+        out.Write("\n} // namespace\n\n");
+        out.Write("SJIT_EXPORT void sjit_dispatch(Resource const *res, u32 gx, u32 gy, u32 gz, u32 num_threads) {\n");
+        out.EmitF("    static constexpr u32 num_words = %iu;\n", front.num_words);
+        out.EmitF("    static constexpr u32 gs[3] = {%iu, %iu, %iu};\n", gs.x, gs.y, gs.z);
+        out.EmitF("    static u32 const constants[][2] = {\n");
+        for (auto &c : front.constants) ifor(c.second.size()) out.EmitF("        {%iu, 0x%08xu},\n", c.first + i, c.second[i]);
+        out.Write("        {0u, 0u},\n    };\n");
+        out.EmitF("    static constexpr u32 num_constants = u32(sizeof(constants) / sizeof(constants[0])) - 1u;\n");
+        out.Write(R"(    u32              total       = gx * gy * gz;
+    u32              group_count = gs[0] * gs[1] * gs[2];
+    std::atomic<u32> next        = {0u};
+    auto             worker      = [&] {
+        std::vector<Word> storage = std::vector<Word>(size_t(num_words) * W);
+        Word (*w)[W]              = reinterpret_cast<Word (*)[W]>(storage.data());
+        for (u32 i = 0u; i < num_constants; i++)
+            for (u32 j = 0u; j < W; j++) w[constants[i][0]][j].u = constants[i][1];
+)");
+        out.EmitF("        for (u32 j = 0u; j < W; j++) w[%i][j].u = j;\n", front.lane_index_slot);
+        out.Write(R"(        for (;;) {
+            u32 g = next.fetch_add(1u);
+            if (g >= total) break;
+            u32 group_id[3] = {g % gx, (g / gx) % gy, g / (gx * gy)};
+            for (u32 first = 0u; first < group_count; first += W) {
+                u32 mask = 0u;
+                for (u32 j = 0u; j < W; j++) {
+                    u32 flat     = std::min(first + j, group_count - 1u);
+                    u32 local[3] = {flat % gs[0], (flat / gs[0]) % gs[1], flat / (gs[0] * gs[1])};
+                    for (u32 i = 0u; i < 3u; i++) {
+)");
+        out.EmitF("                        w[%i + i][j].u = local[i];\n", front.gid_slot);
+        out.EmitF("                        w[%i + i][j].u = group_id[i];\n", front.group_id_slot);
+        out.EmitF("                        w[%i + i][j].u = group_id[i] * gs[i] + local[i];\n", front.tid_slot);
+        out.Write("                    }\n");
+        out.EmitF("                    w[%i][j].u = flat;\n", front.group_index_slot);
+        out.Write(R"(                    if (first + j < group_count) mask |= 1u << j;
+                }
+                Run(w, res, mask);
+            }
+        }
+    };
+    u32 num_workers = num_threads ? num_threads : std::max(u32(std::thread::hardware_concurrency()), 1u);
+    num_workers     = std::min(num_workers, total);
+    std::vector<std::thread> threads;
+    for (u32 i = 1u; i < num_workers; i++) threads.push_back(std::thread(worker));
+    worker();
+    for (auto &t : threads) t.join();
+}
+)");
+    }
+    void Unload() {
+        if (library == NULL) return;
+#    if defined(_WIN32)
+        FreeLibrary((HMODULE)library);
+#    else
+        dlclose(library);
+#    endif
+        library     = NULL;
+        dispatch_fn = NULL;
+    }
+
+public:
+    CPPKernel() = default;
+    ~CPPKernel() { Unload(); }
+    SJIT_DONT_MOVE(CPPKernel);
+
+    // Text from HLSLModule::Finalize, false with GetError() set if the kernel uses something the CPU backends can't run
+    bool Emit(char const *_text) {
+        Unload();
+        source = {};
+        error  = {};
+        if (!front.Compile(_text)) {
+            error = front.GetError();
+            return false;
+        }
+        out.Reset();
+        constant_bits = {};
+        for (auto &c : front.constants) ifor(c.second.size()) constant_bits[c.first + i] = c.second[i];
+        depth        = u32(0);
+        num_names    = u32(0);
+        in_lane_loop = false;
+        brk_stack    = {};
+        cont_stack   = {};
+        bindings     = Array<ResourceBinding>(front.resources.size());
+        EmitPrelude();
+        out.Write("\nvoid Run(Word (*w)[W], Resource const *res, u32 m) {\n");
+        depth = u32(1);
+        EmitBlock(front.main_body, "m");
+        depth = u32(0);
+        out.Write("}\n");
+        EmitDispatch();
+        source = out.Finalize();
+        return true;
+    }
+    bool Emit(HLSLModule &_module) { return Emit(_module.Finalize()); }
+    // Writes the source to _dir, compiles it with g_cpp_compile_command and loads it. Units are named by the hash of their source,
+    // a library that's already there is loaded without compiling.
+    bool Build(char const *_dir = ".sjit_cpp") {
+        Unload();
+        if (source.size() == size_t(0)) {
+            error = "nothing to build, call Emit first";
+            return false;
+        }
+        std::error_code ec = {};
+        std::filesystem::create_directories(_dir, ec);
+        char name[0x20];
+        snprintf(name, sizeof(name), "sjit_%016llx", (unsigned long long)EmittedTextHasher::Hash(source.c_str()));
+        std::string base    = (std::filesystem::path(_dir) / name).string();
+        std::string src     = base + ".cpp";
+        std::string lib     = base + g_cpp_library_ext;
+        std::string log     = base + ".log";
+        if (!std::filesystem::exists(lib, ec)) {
+            FILE *file = fopen(src.c_str(), "wb");
+            if (file == NULL) {
+                error = "can't write " + src;
+                return false;
+            }
+            fwrite(source.c_str(), 1, source.size(), file);
+            fclose(file);
+            std::string tmp     = lib + ".tmp";
+            char        cmd[0x800];
+            snprintf(cmd, sizeof(cmd), g_cpp_compile_command, src.c_str(), tmp.c_str(), tmp.c_str());
+            std::string full = std::string(cmd) + " > \"" + log + "\" 2>&1";
+            if (system(full.c_str()) != 0) {
+                error = "compilation failed: " + std::string(cmd);
+                if (FILE *f = fopen(log.c_str(), "rb")) {
+                    char buf[0x400] = {};
+                    size_t len      = fread(buf, 1, sizeof(buf) - size_t(1), f);
+                    fclose(f);
+                    error += "\n" + std::string(buf, len);
+                }
+                return false;
+            }
+            std::filesystem::rename(tmp, lib, ec); // Other processes only ever see complete libraries
+            if (ec) {
+                error = "can't rename " + tmp;
+                return false;
+            }
+        }
+#    if defined(_WIN32)
+        library = (void *)LoadLibraryA(lib.c_str());
+        if (library) dispatch_fn = (DispatchFn)GetProcAddress((HMODULE)library, "sjit_dispatch");
+#    else
+        library = dlopen(std::filesystem::absolute(lib).string().c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (library) dispatch_fn = (DispatchFn)dlsym(library, "sjit_dispatch");
+#    endif
+        if (dispatch_fn == NULL) {
+            error = "can't load " + lib;
+            Unload();
+            return false;
+        }
+        return true;
+    }
+    bool        Compile(HLSLModule &_module, char const *_dir = ".sjit_cpp") { return Emit(_module) && Build(_dir); }
+    char const *GetSource() { return source.c_str(); }
+    char const *GetError() { return error.c_str(); }
+    u32x3       GetGroupSize() { return front.group_size; }
+    // Has to be set before Emit, the lane count is baked into the source
+    void SetNumLanes(u32 _num_lanes) {
+        sjit_assert(_num_lanes == u32(4) || _num_lanes == u32(8) || _num_lanes == u32(16));
+        num_lanes = _num_lanes;
+    }
+    void SetNumThreads(u32 _num_threads) { num_threads = _num_threads; }
+    // Same rules as CPUKernel::Bind
+    bool Bind(char const *_name, void *_data, u32 _width = u32(1), u32 _height = u32(1), u32 _depth = u32(1)) {
+        ifor(front.resources.size()) {
+            if (front.resources[i].name != _name) continue;
+            bindings[i].data    = (u32 *)_data;
+            bindings[i].size[0] = _width;
+            bindings[i].size[1] = _height;
+            bindings[i].size[2] = _depth;
+            return true;
+        }
+        return false;
+    }
+    void Dispatch(u32x3 _num_groups) {
+        sjit_assert(dispatch_fn != NULL);
+        if (_num_groups.x * _num_groups.y * _num_groups.z == u32(0)) return;
+        dispatch_fn(bindings.data(), _num_groups.x, _num_groups.y, _num_groups.z, num_threads);
+    }
+};
+
+// Runs the same kernels on the interpreter and on the compiled C++ and compares the buffers, integers exactly and floats up to _tolerance.
+// Returns false with a message when there's no working compiler, nothing here needs a device.
+static bool TestCPPBackend(char const *_dir = ".sjit_cpp", f32 _tolerance = f32(1.0e-4)) {
+    struct Buffer {
+        char const *name   = NULL;
+        Array<u32>  data   = {};
+        u32         width  = u32(1);
+        u32         height = u32(1);
+        bool        is_f32 = false;
+    };
+    auto check = [&](char const *_test, std::function<void()> _emit, Array<Buffer> const &_buffers, u32x3 _num_threads) {
+        CPUKernel interpreter = {};
+        CPPKernel compiled    = {};
+        {
+            PushModule();
+            defer(PopModule());
+            _emit();
+            char const *text = GetGlobalModule().Finalize();
+            if (!interpreter.Compile(text)) {
+                fprintf(stderr, "[CPP BACKEND] %s: %s\n", _test, interpreter.GetError());
+                return false;
+            }
+            compiled.SetNumLanes(u32(8));
+            if (!compiled.Emit(text) || !compiled.Build(_dir)) {
+                fprintf(stderr, "[CPP BACKEND] %s: %s\n", _test, compiled.GetError());
+                return false;
+            }
+        }
+        Array<Buffer> expected = _buffers;
+        Array<Buffer> got      = _buffers;
+        ifor(_buffers.size()) {
+            sjit_assert(interpreter.Bind(expected[i].name, expected[i].data.data(), expected[i].width, expected[i].height));
+            sjit_assert(compiled.Bind(got[i].name, got[i].data.data(), got[i].width, got[i].height));
+        }
+        u32x3 group_size = interpreter.GetGroupSize();
+        u32x3 num_groups = (_num_threads + group_size - u32x3(1, 1, 1)) / group_size;
+        interpreter.SetNumLanes(u32(8)); // Same waves on both sides
+        interpreter.Dispatch(num_groups);
+        compiled.SetNumThreads(u32(3));
+        compiled.Dispatch(num_groups);
+        ifor(_buffers.size()) jfor(expected[i].data.size()) {
+            u32  a    = expected[i].data[j];
+            u32  b    = got[i].data[j];
+            bool same = a == b;
+            if (!same && expected[i].is_f32) {
+                f32 x = f32(0.0);
+                f32 y = f32(0.0);
+                memcpy(&x, &a, sizeof(f32));
+                memcpy(&y, &b, sizeof(f32));
+                same = (x != x && y != y) || std::abs(x - y) <= _tolerance * std::max(f32(1.0), std::abs(x));
+            }
+            if (!same) {
+                fprintf(stderr, "[CPP BACKEND] %s: %s[%i] is 0x%08x, the interpreter has 0x%08x\n", _test, expected[i].name, j, b, a);
+                return false;
+            }
+        }
+        return true;
+    };
+    bool ok = true;
+    { // The register machine
+        GFX_JIT_MAKE_GLOBAL_RESOURCE(g_cpp_test_cmd_list, Type::CreateStructuredBuffer(u32x4Ty));
+        GFX_JIT_MAKE_GLOBAL_RESOURCE(g_cpp_test_output, RWTexture2D_f32x4_Ty);
+        Array<RegisterMachine::InsrTy> program = RegisterMachine::GetDemoProgram();
+        Buffer                         cmd     = {"g_cpp_test_cmd_list", Array<u32>(program.size() * size_t(4)), u32(program.size())};
+        memcpy(cmd.data.data(), program.data(), cmd.data.size() * sizeof(u32));
+        Buffer output = {"g_cpp_test_output", Array<u32>(size_t(40 * 24 * 4)), u32(40), u32(24), true};
+        ok &= check("register machine", [&] { RegisterMachine::Emit(g_cpp_test_cmd_list, g_cpp_test_output); }, {cmd, output}, u32x3(40, 24, 1));
+    }
+    { // Divergent control flow, dynamic indexing and a structured buffer
+        GFX_JIT_MAKE_GLOBAL_RESOURCE(g_cpp_test_buffer, Type::CreateRWStructuredBuffer(u32Ty));
+        ok &= check(
+            "control flow",
+            [&] {
+                var tid = Input(IN_TYPE_DISPATCH_THREAD_ID)["x"];
+                var acc = var(u32(0)).Copy();
+                EmitIfElse(tid % u32(3) == u32(0), [&] { acc += u32(100); }, [&] { acc += u32(7); });
+                var n = var(u32(0)).Copy();
+                EmitWhileLoop([&] {
+                    EmitIfElse(n >= tid % u32(5), [&] { EmitBreak(); });
+                    acc += n;
+                    n += u32(1);
+                });
+                EmitSwitchCase(tid % u32(4), {
+                                                 {0, [&] { acc += acc; }},
+                                                 {2, [&] { acc += u32(1000); }},
+                                             });
+                var table = EmitArray(u32Ty, u32(8));
+                EmitForLoop(u32(0), u32(7), [&](var i) {
+                    EmitIfElse(i == tid % u32(6), [&] { EmitContinue(); });
+                    table[i] = i * tid;
+                });
+                acc += table[tid % u32(8)];
+                EmitIfElse(tid < var(u32(100)), [&] { g_cpp_test_buffer.Store(tid, acc); });
+            },
+            {{"g_cpp_test_buffer", Array<u32>(size_t(100)), u32(100)}}, u32x3(100, 1, 1));
+    }
+    { // Intrinsics, conversions and integer edge cases
+        GFX_JIT_MAKE_GLOBAL_RESOURCE(g_cpp_test_f32x4, Type::CreateRWStructuredBuffer(f32x4Ty));
+        GFX_JIT_MAKE_GLOBAL_RESOURCE(g_cpp_test_u32, Type::CreateRWStructuredBuffer(u32Ty));
+        ok &= check(
+            "intrinsics",
+            [&] {
+                var tid = Input(IN_TYPE_DISPATCH_THREAD_ID)["x"];
+                var x   = (tid.ToF32() * var(f32(0.37)) - var(f32(11.0))).Copy();
+                var v   = make_f32x3(sin(x), cos(x), frac(x)).Copy();
+                var n   = normalize(cross(v, make_f32x3(var(f32(0.5)), var(f32(1.0)), x)));
+                var t   = saturate(x * var(f32(0.1)));
+                g_cpp_test_f32x4.Store(tid, make_f32x4(dot(n, v), length(v), clamp(x, var(f32(-2.0)), var(f32(3.0))), lerp(sqrt(abs(x)), pow(abs(x), var(f32(0.3))), t)));
+                var h = (tid * var(u32(2654435761)) ^ (tid >> var(u32(3)))).Copy();
+                var s = (tid.ToI32() - var(i32(50))) / var(i32(3)) + x.ToI32();
+                g_cpp_test_u32.Store(tid, h / (tid % u32(7)) + s.AsU32() + min(h, tid << var(u32(9))) + max(floor(x), var(f32(-3.5))).ToU32());
+            },
+            {{"g_cpp_test_f32x4", Array<u32>(size_t(96 * 4)), u32(96), u32(1), true}, {"g_cpp_test_u32", Array<u32>(size_t(96)), u32(96)}}, u32x3(96, 1, 1));
+    }
+    { // wave32 masks
+        GFX_JIT_MAKE_GLOBAL_RESOURCE(g_cpp_test_wave_buffer, Type::CreateRWStructuredBuffer(u32Ty));
+        ok &= check(
+            "wave32",
+            [&] {
+                wave32::EnableWave32MaskMode();
+                var tid = Input(IN_TYPE_DISPATCH_THREAD_ID)["x"];
+                var acc = var(u32(0)).Copy();
+                wave32::EmitIfElse(tid % u32(3) == u32(0), [&] { wave32::EmitIfLaneActive([&] { acc += u32(1); }); });
+                wave32::EmitIfElse(tid % u32(3) != u32(0), [&] { wave32::EmitIfLaneActive([&] { acc += LaneIdx(); }); });
+                g_cpp_test_wave_buffer.Store(tid, acc);
+            },
+            {{"g_cpp_test_wave_buffer", Array<u32>(size_t(64)), u32(64)}}, u32x3(64, 1, 1));
+    }
+    return ok;
+}
+// Throughput of the register machine, compiled against interpreted
+static f64 BenchCPPBackend(u32 _width = u32(512), u32 _height = u32(512), u32 _num_iters = u32(4), char const *_dir = ".sjit_cpp") {
+    GFX_JIT_MAKE_GLOBAL_RESOURCE(g_cpp_bench_cmd_list, Type::CreateStructuredBuffer(u32x4Ty));
+    GFX_JIT_MAKE_GLOBAL_RESOURCE(g_cpp_bench_output, RWTexture2D_f32x4_Ty);
+    Array<RegisterMachine::InsrTy> program     = RegisterMachine::GetDemoProgram();
+    Array<f32x4>                   output      = Array<f32x4>(_width * _height);
+    CPUKernel                      interpreter = {};
+    CPPKernel                      compiled    = {};
+    {
+        PushModule();
+        defer(PopModule());
+        RegisterMachine::Emit(g_cpp_bench_cmd_list, g_cpp_bench_output);
+        char const *text = GetGlobalModule().Finalize();
+        if (!interpreter.Compile(text)) {
+            fprintf(stderr, "[CPP BACKEND] %s\n", interpreter.GetError());
+            return f64(0.0);
+        }
+        auto start = std::chrono::high_resolution_clock::now();
+        if (!compiled.Emit(text) || !compiled.Build(_dir)) {
+            fprintf(stderr, "[CPP BACKEND] %s\n", compiled.GetError());
+            return f64(0.0);
+        }
+        fprintf(stdout, "[CPP BACKEND] register machine built in %f ms\n", std::chrono::duration<f64>(std::chrono::high_resolution_clock::now() - start).count() * f64(1.0e3));
+    }
+    interpreter.Bind("g_cpp_bench_cmd_list", &program[0], u32(program.size()));
+    interpreter.Bind("g_cpp_bench_output", &output[0], _width, _height);
+    compiled.Bind("g_cpp_bench_cmd_list", &program[0], u32(program.size()));
+    compiled.Bind("g_cpp_bench_output", &output[0], _width, _height);
+    u32x3 group_size = interpreter.GetGroupSize();
+    u32x3 num_groups = u32x3((_width + group_size.x - u32(1)) / group_size.x, (_height + group_size.y - u32(1)) / group_size.y, u32(1));
+    f64   seconds[2] = {};
+    ifor(2) {
+        auto start = std::chrono::high_resolution_clock::now();
+        jfor(_num_iters) {
+            if (i == 0)
+                interpreter.Dispatch(num_groups);
+            else
+                compiled.Dispatch(num_groups);
+        }
+        seconds[i] = std::chrono::duration<f64>(std::chrono::high_resolution_clock::now() - start).count() / f64(std::max(_num_iters, u32(1)));
+    }
+    f64 pixels = f64(_width) * f64(_height);
+    fprintf(stdout, "[CPP BACKEND] register machine %ix%i: %f ms (%f Mpix/s) interpreted, %f ms (%f Mpix/s) compiled\n", _width, _height, seconds[0] * f64(1.0e3),
+            pixels / seconds[0] * f64(1.0e-6), seconds[1] * f64(1.0e3), pixels / seconds[1] * f64(1.0e-6));
+    return seconds[1];
+}
+
+} // namespace SJIT
+
+#endif // SJIT_CPP_HPP
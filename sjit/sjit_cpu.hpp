@@ -0,0 +1,3036 @@
+// MIT License
+//
+// Copyright (c) 2023 Anton Schreiner
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined(SJIT_CPU_HPP)
+#    define SJIT_CPU_HPP
+
+#    include "sjit.hpp"
+
+#    include <cmath>
+#    include <cstring>
+
+namespace SJIT {
+
+// CPU execution of SJIT compute kernels, no device needed.
+// Nodes emit their HLSL as they're built and control flow only ever exists as text, so the backend compiles the finalized text
+// (the subset SJIT emits plus its prelude functions) into statements over typed slots.
+// A batch of 8 or 16 threads of a group runs at once: every slot holds one word per lane and divergence is tracked with lane masks.
+// The lanes of a batch are the wave, WaveActiveBallot etc. work on them. Thread groups are spread across worker threads.
+// Not supported: groupshared memory and barriers, ray queries, atomics. Compile fails with a message for those.
+class CPUKernel {
+    friend class CPPKernel; // Lowers the same statements to C++ source
+
+public:
+    static constexpr u32 max_lanes = u32(16);
+
+    enum ValueKind : u8 {
+        VALUE_VOID = 0,
+        VALUE_BOOL,
+        VALUE_I32,
+        VALUE_U32,
+        VALUE_F32, // f16 too
+        VALUE_STRUCT,
+    };
+    struct ValueType {
+        ValueKind kind      = VALUE_VOID;
+        u32       rows      = u32(1);  // Matrix rows, 1 for scalars and vectors
+        u32       cols      = u32(1);  // Vector size or matrix columns
+        u32       num_elems = u32(0);  // Local arrays, 0 otherwise
+        u32       structure = u32(-1); // VALUE_STRUCT
+
+        bool operator==(ValueType const &that) const {
+            return kind == that.kind && rows == that.rows && cols == that.cols && num_elems == that.num_elems && structure == that.structure;
+        }
+        bool operator!=(ValueType const &that) const { return !(*this == that); }
+        bool IsNumeric() const { return kind != VALUE_VOID && kind != VALUE_STRUCT && num_elems == u32(0); }
+        bool IsMatrix() const { return IsNumeric() && rows > u32(1); }
+        u32  GetNumComps() const { return rows * cols; }
+    };
+
+private:
+    enum TokenKind : u8 {
+        TOKEN_EOF = 0,
+        TOKEN_IDENT,
+        TOKEN_INT,
+        TOKEN_FLOAT,
+        TOKEN_PUNCT,
+    };
+    struct Token {
+        TokenKind kind  = TOKEN_EOF;
+        u32       begin = u32(0);
+        u32       end   = u32(0);
+        u32       line  = u32(0);
+    };
+    struct StructInfo {
+        std::string                                        name      = {};
+        Array<std::tuple<std::string, ValueType, u32>>     fields    = {}; // name, type, word offset
+        u32                                                num_words = u32(0);
+    };
+    enum ResourceKind : u8 {
+        RESOURCE_BUFFER = 0,
+        RESOURCE_TEXTURE,
+        RESOURCE_CONSTANT,
+        RESOURCE_UNSUPPORTED, // Samplers, acceleration structures, resource arrays
+    };
+    struct ResourceInfo {
+        std::string  name       = {};
+        ResourceKind kind       = RESOURCE_UNSUPPORTED;
+        u32          num_dims   = u32(1);
+        bool         writable   = false;
+        ValueType    elem       = {};
+        u32          elem_words = u32(0);
+        u32         *data       = NULL;
+        u32          size[3]    = {u32(0), u32(0), u32(0)};
+    };
+    struct FunctionDef {
+        std::string name         = {};
+        u32         ret_type     = u32(0); // Token indices
+        u32         params_begin = u32(0);
+        u32         params_end   = u32(0);
+        u32         body_begin   = u32(0); // At the {
+    };
+    struct Variable {
+        u32       slot = u32(0);
+        ValueType type = {};
+    };
+    // Where a value lives: a variable or a resource element, plus field/index steps and the components read or written
+    struct Step {
+        u32 node   = u32(0); // Index, converted to u32
+        u32 stride = u32(0);
+        u32 bound  = u32(0);
+    };
+    struct Place {
+        u32         root        = u32(0); // Slot of a variable or index of a resource
+        bool        is_resource = false;
+        u32         coord       = u32(-1); // Node with the element or texel coordinate of a resource
+        u32         offset      = u32(0);
+        Array<Step> steps       = {};
+        Array<u32>  comps       = {}; // Word offsets of every component
+        ValueType   type        = {};
+        bool        is_swizzled = false;
+    };
+    enum NodeKind : u8 {
+        NODE_ALIAS = 0, // Reads a variable, a constant or a part of another node in place, nothing to run
+        NODE_RESOURCE,  // Names a resource without an element, only an argument
+        NODE_LOAD,      // Gathers a place
+        NODE_SWIZZLE,   // Copies components of a node
+        NODE_CONVERT,
+        NODE_UNARY,
+        NODE_BINARY,
+        NODE_SELECT,
+        NODE_CONSTRUCT,
+        NODE_INTRINSIC,
+        NODE_CALL,
+        NODE_DIMENSIONS,
+        NODE_SAMPLE,
+    };
+    enum Intrinsic : u8 {
+        INTRINSIC_SIN = 0,
+        INTRINSIC_COS,
+        INTRINSIC_TAN,
+        INTRINSIC_ASIN,
+        INTRINSIC_ACOS,
+        INTRINSIC_ATAN,
+        INTRINSIC_EXP,
+        INTRINSIC_EXP2,
+        INTRINSIC_LOG,
+        INTRINSIC_LOG2,
+        INTRINSIC_SQRT,
+        INTRINSIC_RSQRT,
+        INTRINSIC_RCP,
+        INTRINSIC_FRAC,
+        INTRINSIC_FLOOR,
+        INTRINSIC_CEIL,
+        INTRINSIC_ROUND,
+        INTRINSIC_TRUNC,
+        INTRINSIC_SATURATE,
+        INTRINSIC_POW,
+        INTRINSIC_ATAN2,
+        INTRINSIC_FMOD,
+        INTRINSIC_STEP,
+        INTRINSIC_LERP,
+        INTRINSIC_SMOOTHSTEP,
+        INTRINSIC_ABS,
+        INTRINSIC_SIGN,
+        INTRINSIC_MIN,
+        INTRINSIC_MAX,
+        INTRINSIC_CLAMP,
+        INTRINSIC_MAD,
+        INTRINSIC_ISNAN,
+        INTRINSIC_ISINF,
+        INTRINSIC_DOT,
+        INTRINSIC_LENGTH,
+        INTRINSIC_DISTANCE,
+        INTRINSIC_NORMALIZE,
+        INTRINSIC_CROSS,
+        INTRINSIC_REFLECT,
+        INTRINSIC_ANY,
+        INTRINSIC_ALL,
+        INTRINSIC_COUNTBITS,
+        INTRINSIC_FIRSTBITHIGH,
+        INTRINSIC_FIRSTBITLOW,
+        INTRINSIC_REVERSEBITS,
+        INTRINSIC_ASF32,
+        INTRINSIC_ASU32,
+        INTRINSIC_ASI32,
+        INTRINSIC_F32TOF16,
+        INTRINSIC_F16TOF32,
+        INTRINSIC_MUL,
+        INTRINSIC_TRANSPOSE,
+        INTRINSIC_LANE_INDEX,
+        INTRINSIC_LANE_COUNT,
+        INTRINSIC_LANE_BIT,
+        INTRINSIC_IS_FIRST_LANE,
+        INTRINSIC_BALLOT,
+        INTRINSIC_ACTIVE_COUNT_BITS,
+        INTRINSIC_ACTIVE_ANY_TRUE,
+        INTRINSIC_ACTIVE_ALL_TRUE,
+        INTRINSIC_READ_LANE_FIRST,
+        INTRINSIC_ACTIVE_SUM,
+        INTRINSIC_ACTIVE_MIN,
+        INTRINSIC_ACTIVE_MAX,
+        INTRINSIC_PREFIX_SUM,
+        INTRINSIC_PREFIX_COUNT_BITS,
+        INTRINSIC_IDENTITY,
+    };
+    struct Node {
+        NodeKind   kind    = NODE_ALIAS;
+        ValueType  type    = {};
+        u32        slot    = u32(0);
+        u32        op      = u32(0); // OpType, Intrinsic, ValueKind of the operands, index of the call or of the resource
+        u32        place   = u32(-1);
+        Array<u32> args    = {};
+        Array<u32> comps   = {}; // NODE_SWIZZLE
+    };
+    // Inlined copy of a function at one call site
+    struct Call {
+        Array<u32> params     = {}; // Slots
+        Array<u32> out_places = {}; // inout arguments, u32(-1) for the rest
+        u32        body       = u32(0);
+        u32        ret_slot   = u32(0);
+    };
+    enum StmtKind : u8 {
+        STMT_CODE = 0,
+        STMT_STORE,
+        STMT_IF,
+        STMT_LOOP,
+        STMT_SWITCH,
+        STMT_BREAK,
+        STMT_CONTINUE,
+        STMT_RETURN,
+        STMT_BLOCK,
+    };
+    struct Case {
+        i64  label      = i64(0);
+        bool is_default = false;
+        u32  position   = u32(0); // First statement of the case in the switch body
+    };
+    struct Stmt {
+        StmtKind   kind      = STMT_CODE;
+        Array<u32> code      = {}; // Nodes to run first
+        u32        place     = u32(-1);
+        u32        value     = u32(-1); // Stored, condition, switch value or returned value
+        OpType     op        = OP_ASSIGN;
+        u32        body      = u32(-1); // Blocks
+        u32        else_body = u32(-1);
+        u32        step      = u32(-1);
+        u32        ret_slot  = u32(-1);
+        Array<Case> cases    = {};
+    };
+    struct Scope {
+        HashMap<std::string, Variable> vars = {};
+    };
+    template <u32 W>
+    struct State {
+        u32 *words = NULL;
+        u32  brk   = u32(0); // Lanes that left the innermost loop or switch
+        u32  cont  = u32(0);
+        u32  ret   = u32(0);
+    };
+
+    static constexpr u32 invalid = u32(-1);
+
+    std::string  error       = {};
+    char const  *text        = NULL;
+    Array<Token> tokens      = {};
+    u32          cursor      = u32(0);
+    u32          call_depth  = u32(0);
+    u32x3        group_size  = u32x3(1, 1, 1);
+    u32          num_lanes   = u32(8);
+    u32          num_threads = u32(0); // 0 is one per core
+
+    Array<StructInfo>                    structs          = {};
+    Array<ResourceInfo>                  resources        = {};
+    HashMap<std::string, Array<FunctionDef>> functions    = {};
+    Array<Scope>                         scopes           = {};
+    Array<std::pair<u32, ValueType>>     fn_stack         = {}; // Return slot and type of the functions being inlined
+    Array<Node>                          nodes            = {};
+    Array<Place>                         places           = {};
+    Array<Call>                          calls            = {};
+    Array<Stmt>                          stmts            = {};
+    Array<Array<u32>>                    blocks           = {};
+    Array<std::pair<u32, Array<u32>>>    constants        = {}; // Slot and words, the same for every lane
+    u32                                  num_words        = u32(0);
+    u32                                  main_body        = invalid;
+    u32                                  tid_slot         = u32(0);
+    u32                                  gid_slot         = u32(0);
+    u32                                  group_id_slot    = u32(0);
+    u32                                  group_index_slot = u32(0);
+    u32                                  lane_index_slot  = u32(0);
+
+    static f32 AsF(u32 _bits) {
+        f32 f;
+        memcpy(&f, &_bits, 4);
+        return f;
+    }
+    static u32 AsU(f32 _f) {
+        u32 u;
+        memcpy(&u, &_f, 4);
+        return u;
+    }
+    static u32 CountBits(u32 v) {
+        v = v - ((v >> u32(1)) & u32(0x55555555));
+        v = (v & u32(0x33333333)) + ((v >> u32(2)) & u32(0x33333333));
+        return (((v + (v >> u32(4))) & u32(0xf0f0f0f)) * u32(0x1010101)) >> u32(24);
+    }
+    static u32 FirstBitLow(u32 v) {
+        if (v == u32(0)) return u32(-1);
+        u32 i = u32(0);
+        while (!(v & (u32(1) << i))) i++;
+        return i;
+    }
+    static u32 FirstBitHigh(u32 v) {
+        if (v == u32(0)) return u32(-1);
+        u32 i = u32(31);
+        while (!(v & (u32(1) << i))) i--;
+        return i;
+    }
+    static u32 ConvertWord(u32 _bits, ValueKind _from, ValueKind _to) {
+        if (_from == _to) return _bits;
+        switch (_to) {
+        case VALUE_BOOL: return _from == VALUE_F32 ? u32(AsF(_bits) != f32(0.0)) : u32(_bits != u32(0));
+        case VALUE_F32:
+            if (_from == VALUE_I32) return AsU(f32(i32(_bits)));
+            return AsU(f32(_bits));
+        case VALUE_I32:
+        case VALUE_U32:
+            if (_from == VALUE_F32) {
+                f32 f = AsF(_bits);
+                if (!(f == f)) return u32(0);
+                if (_to == VALUE_I32) return u32(i32(std::max(f32(-2147483648.0), std::min(f, f32(2147483520.0)))));
+                return u32(std::max(f32(0.0), std::min(f, f32(4294967040.0))));
+            }
+            return _bits;
+        default: return _bits;
+        }
+    }
+
+    ////////////////////////////////////////////
+    // Types
+    ////////////////////////////////////////////
+    u32 GetElemWords(ValueType const &_type) const {
+        if (_type.kind == VALUE_VOID) return u32(0);
+        if (_type.kind == VALUE_STRUCT) return structs[_type.structure].num_words;
+        return _type.rows * _type.cols;
+    }
+    u32 GetWords(ValueType const &_type) const { return GetElemWords(_type) * std::max(_type.num_elems, u32(1)); }
+    static ValueType MakeType(ValueKind _kind, u32 _cols = u32(1), u32 _rows = u32(1)) {
+        ValueType t = {};
+        t.kind      = _kind;
+        t.rows      = _rows;
+        t.cols      = _cols;
+        return t;
+    }
+    // f32, f32x3, f32x4x4, float3, uint2, half, bool and structs from the text
+    bool ParseTypeName(char const *_name, u32 _len, ValueType &_type) const {
+        static struct {
+            char const *prefix;
+            ValueKind   kind;
+        } const prefixes[] = {
+            {"f32", VALUE_F32}, {"f16", VALUE_F32}, {"u32", VALUE_U32}, {"i32", VALUE_I32}, {"u16", VALUE_U32}, {"i16", VALUE_I32},
+            {"bool", VALUE_BOOL}, {"float", VALUE_F32}, {"half", VALUE_F32}, {"uint", VALUE_U32}, {"int", VALUE_I32},
+        };
+        for (auto &p : prefixes) {
+            u32 plen = u32(strlen(p.prefix));
+            if (_len < plen || memcmp(_name, p.prefix, plen) != 0) continue;
+            u32 i    = plen;
+            u32 n[2] = {u32(0), u32(0)};
+            u32 num  = u32(0);
+            while (i < _len && num < u32(2)) {
+                if (_name[i] == 'x' && i + u32(1) < _len && _name[i + u32(1)] >= '1' && _name[i + u32(1)] <= '4') {
+                    n[num++] = u32(_name[i + u32(1)] - '0');
+                    i += u32(2);
+                } else if (num == u32(0) && _name[i] >= '1' && _name[i] <= '4' && plen > u32(3)) { // float3
+                    n[num++] = u32(_name[i] - '0');
+                    i += u32(1);
+                } else
+                    break;
+            }
+            if (i != _len) continue;
+            _type = num == u32(2) ? MakeType(p.kind, n[1], n[0]) : MakeType(p.kind, num ? n[0] : u32(1));
+            return true;
+        }
+        ifor(structs.size()) {
+            if (structs[i].name.size() == size_t(_len) && memcmp(structs[i].name.c_str(), _name, _len) == 0) {
+                _type           = MakeType(VALUE_STRUCT);
+                _type.structure = u32(i);
+                return true;
+            }
+        }
+        return false;
+    }
+    static ValueKind Promote(ValueKind _a, ValueKind _b) {
+        if (_a == VALUE_F32 || _b == VALUE_F32) return VALUE_F32;
+        if (_a == VALUE_U32 || _b == VALUE_U32) return VALUE_U32;
+        return VALUE_I32;
+    }
+
+    ////////////////////////////////////////////
+    // Tokens
+    ////////////////////////////////////////////
+    bool Tokenize() {
+        static char const *puncts[] = {"<<=", ">>=", "++", "--", "+=", "-=", "*=", "/=", "%=", "&=", "|=", "^=", "==", "!=", "<=", ">=", "&&", "||", "<<", ">>", "::"};
+        u32 line = u32(1);
+        u32 i    = u32(0);
+        u32 size = u32(strlen(text));
+        while (i < size) {
+            char c = text[i];
+            if (c == '\n') {
+                line++;
+                i++;
+                continue;
+            }
+            if (c == ' ' || c == '\t' || c == '\r') {
+                i++;
+                continue;
+            }
+            if (c == '/' && i + u32(1) < size && text[i + u32(1)] == '/') {
+                while (i < size && text[i] != '\n') i++;
+                continue;
+            }
+            if (c == '/' && i + u32(1) < size && text[i + u32(1)] == '*') {
+                char const *end = strstr(text + i + 2, "*/");
+                u32         e   = end ? u32(end - text) + u32(2) : size;
+                for (; i < e; i++) line += text[i] == '\n' ? u32(1) : u32(0);
+                continue;
+            }
+            bool line_start = true;
+            for (u32 j = i; j-- > u32(0) && text[j] != '\n';) line_start &= text[j] == ' ' || text[j] == '\t';
+            if (c == '#' && line_start) { // Preprocessor, with line continuations
+                while (i < size && text[i] != '\n') {
+                    if (text[i] == '\\' && i + u32(1) < size && text[i + u32(1)] == '\n') {
+                        line++;
+                        i++;
+                    } else if (text[i] == '\\' && i + u32(2) < size && text[i + u32(1)] == '\r' && text[i + u32(2)] == '\n') {
+                        line++;
+                        i += u32(2);
+                    }
+                    i++;
+                }
+                continue;
+            }
+            Token t = {};
+            t.begin = i;
+            t.line  = line;
+            if (IsIdentifierStart(c)) {
+                t.kind = TOKEN_IDENT;
+                while (i < size && (IsIdentifierStart(text[i]) || (text[i] >= '0' && text[i] <= '9'))) i++;
+            } else if ((c >= '0' && c <= '9') || (c == '.' && i + u32(1) < size && text[i + u32(1)] >= '0' && text[i + u32(1)] <= '9')) {
+                t.kind      = TOKEN_INT;
+                bool is_hex = c == '0' && i + u32(1) < size && (text[i + u32(1)] == 'x' || text[i + u32(1)] == 'X');
+                if (is_hex) i += u32(2);
+                while (i < size) {
+                    char d = text[i];
+                    if ((d >= '0' && d <= '9') || (is_hex && ((d >= 'a' && d <= 'f') || (d >= 'A' && d <= 'F')))) {
+                        i++;
+                    } else if (!is_hex && d == '.') {
+                        t.kind = TOKEN_FLOAT;
+                        i++;
+                    } else if (!is_hex && (d == 'e' || d == 'E')) {
+                        t.kind = TOKEN_FLOAT;
+                        i++;
+                        if (i < size && (text[i] == '+' || text[i] == '-')) i++;
+                    } else
+                        break;
+                }
+                while (i < size && strchr("uUlLfFhH", text[i]) != NULL) {
+                    if (text[i] == 'f' || text[i] == 'F' || text[i] == 'h' || text[i] == 'H') t.kind = TOKEN_FLOAT;
+                    i++;
+                }
+            } else {
+                t.kind = TOKEN_PUNCT;
+                u32 len = u32(1);
+                for (char const *p : puncts) {
+                    u32 plen = u32(strlen(p));
+                    if (i + plen <= size && memcmp(text + i, p, plen) == 0) {
+                        len = plen;
+                        break;
+                    }
+                }
+                i += len;
+            }
+            t.end = i;
+            tokens.push_back(t);
+        }
+        Token eof = {};
+        eof.begin = eof.end = size;
+        eof.line            = line;
+        tokens.push_back(eof);
+        return true;
+    }
+    static bool IsIdentifierStart(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; }
+    Token const &Peek(u32 _offset = u32(0)) const { return tokens[std::min(u32(tokens.size()) - u32(1), cursor + _offset)]; }
+    bool         Is(Token const &_t, char const *_s) const {
+        u32 len = u32(strlen(_s));
+        return _t.end - _t.begin == len && memcmp(text + _t.begin, _s, len) == 0;
+    }
+    bool        IsNext(char const *_s, u32 _offset = u32(0)) const { return Is(Peek(_offset), _s); }
+    std::string GetText(Token const &_t) const { return std::string(text + _t.begin, _t.end - _t.begin); }
+    bool        Accept(char const *_s) {
+        if (!IsNext(_s)) return false;
+        cursor++;
+        return true;
+    }
+    u32 Fail(char const *_fmt, ...) {
+        if (error.size()) return invalid;
+        char    buf[0x200];
+        va_list args;
+        va_start(args, _fmt);
+        vsnprintf(buf, sizeof(buf), _fmt, args);
+        va_end(args);
+        Token const &t          = Peek();
+        u32          line_begin = t.begin;
+        while (line_begin > u32(0) && text[line_begin - u32(1)] != '\n') line_begin--;
+        char const *line_end = strchr(text + line_begin, '\n');
+        u32         len      = line_end ? u32(line_end - text) - line_begin : u32(strlen(text + line_begin));
+        error                = "line " + std::to_string(t.line) + ": " + buf + " at '" + std::string(text + line_begin, std::min(len, u32(120))) + "'";
+        return invalid;
+    }
+    bool Expect(char const *_s) {
+        if (Accept(_s)) return true;
+        Fail("expected '%s'", _s);
+        return false;
+    }
+    // Past the matching closing bracket
+    void SkipBalanced() {
+        i32 depth = i32(0);
+        do {
+            if (Peek().kind == TOKEN_EOF) return;
+            if (IsNext("{") || IsNext("(") || IsNext("[")) depth++;
+            if (IsNext("}") || IsNext(")") || IsNext("]")) depth--;
+            cursor++;
+        } while (depth > i32(0));
+    }
+    bool ParseType(ValueType &_type) {
+        Accept("const");
+        Token const &t = Peek();
+        if (t.kind != TOKEN_IDENT || !ParseTypeName(text + t.begin, t.end - t.begin, _type)) return false;
+        cursor++;
+        return true;
+    }
+    bool IsTypeNext() const {
+        ValueType   t    = {};
+        Token const &tok = IsNext("const") ? Peek(1) : Peek();
+        return tok.kind == TOKEN_IDENT && ParseTypeName(text + tok.begin, tok.end - tok.begin, t);
+    }
+
+    ////////////////////////////////////////////
+    // Slots and nodes
+    ////////////////////////////////////////////
+    u32 AllocSlot(u32 _words) {
+        u32 slot = num_words;
+        num_words += std::max(_words, u32(1));
+        return slot;
+    }
+    u32 NewNode(NodeKind _kind, ValueType _type) {
+        Node n = {};
+        n.kind = _kind;
+        n.type = _type;
+        if (_kind != NODE_ALIAS && _kind != NODE_RESOURCE) n.slot = AllocSlot(GetWords(_type));
+        nodes.push_back(n);
+        return u32(nodes.size() - size_t(1));
+    }
+    u32 MakeConstant(ValueType _type, Array<u32> const &_words) {
+        u32 n           = NewNode(NODE_ALIAS, _type);
+        nodes[n].slot   = AllocSlot(GetWords(_type));
+        nodes[n].op     = u32(1); // Marks a constant
+        constants.push_back({nodes[n].slot, _words});
+        return n;
+    }
+    bool IsConstant(u32 _node) const { return nodes[_node].kind == NODE_ALIAS && nodes[_node].op == u32(1) && nodes[_node].args.size() == size_t(0); }
+    u32  GetConstantWord(u32 _node, u32 _word) const {
+        for (auto &c : constants)
+            if (c.first == nodes[_node].slot) return c.second[_word];
+        return u32(0);
+    }
+    u32 MakeScalarConstant(ValueKind _kind, u32 _bits) { return MakeConstant(MakeType(_kind), {_bits}); }
+    // Word offsets of the components of a value, matrices in resources are column major like on the GPU
+    void AppendComps(ValueType const &_type, u32 _base, bool _in_resource, Array<u32> &_comps) const {
+        u32 elem_words = GetElemWords(_type);
+        ifor(std::max(_type.num_elems, u32(1))) {
+            u32 base = _base + i * elem_words;
+            if (_type.kind == VALUE_STRUCT) {
+                for (auto &f : structs[_type.structure].fields) AppendComps(std::get<1>(f), base + std::get<2>(f), _in_resource, _comps);
+            } else if (_in_resource && _type.rows > u32(1)) {
+                for (u32 r = u32(0); r < _type.rows; r++)
+                    for (u32 c = u32(0); c < _type.cols; c++) _comps.push_back(base + c * _type.rows + r);
+            } else {
+                jfor(elem_words) _comps.push_back(base + j);
+            }
+        }
+    }
+    u32 MakePlaceNode(Place const &_place) {
+        bool is_alias = !_place.is_resource && _place.steps.size() == size_t(0);
+        ifor(_place.comps.size()) is_alias &= _place.comps[i] == _place.comps[0] + i;
+        ValueType type = _place.type;
+        if (_place.is_swizzled) type = MakeType(type.kind, u32(_place.comps.size()));
+        u32 n = NewNode(is_alias ? NODE_ALIAS : NODE_LOAD, type);
+        places.push_back(_place);
+        places.back().type = type;
+        nodes[n].place     = u32(places.size() - size_t(1));
+        if (is_alias) nodes[n].slot = _place.root + _place.offset + (_place.comps.size() ? _place.comps[0] : u32(0));
+        if (_place.coord != invalid) nodes[n].args.push_back(_place.coord);
+        for (auto &s : _place.steps) nodes[n].args.push_back(s.node);
+        return n;
+    }
+    u32 MakeVariablePlace(Variable const &_var) {
+        Place p = {};
+        p.root  = _var.slot;
+        p.type  = _var.type;
+        AppendComps(_var.type, u32(0), false, p.comps);
+        return MakePlaceNode(p);
+    }
+    u32 MakeSwizzle(u32 _node, Array<u32> const &_comps, ValueType _type) {
+        bool contiguous = true;
+        ifor(_comps.size()) contiguous &= _comps[i] == _comps[0] + i;
+        u32 n = NewNode(contiguous ? NODE_ALIAS : NODE_SWIZZLE, _type);
+        nodes[n].args.push_back(_node);
+        if (contiguous)
+            nodes[n].slot = nodes[_node].slot + _comps[0];
+        else
+            nodes[n].comps = _comps;
+        return n;
+    }
+    // Implicit conversions: scalars splat, longer vectors are truncated
+    u32 Convert(u32 _node, ValueType _to) {
+        if (_node == invalid) return invalid;
+        ValueType from = nodes[_node].type;
+        if (from == _to) return _node;
+        if (!from.IsNumeric() || !_to.IsNumeric()) return Fail("can't convert between these types");
+        if (from.GetNumComps() > _to.GetNumComps() && _to.GetNumComps() != u32(1) ? from.rows != _to.rows && _to.rows > u32(1) : false) return Fail("can't convert between these shapes");
+        if (from.GetNumComps() > _to.GetNumComps()) {
+            Array<u32> comps = {};
+            if (from.IsMatrix() && _to.IsMatrix()) {
+                for (u32 r = u32(0); r < _to.rows; r++)
+                    for (u32 c = u32(0); c < _to.cols; c++) comps.push_back(r * from.cols + c);
+            } else {
+                ifor(_to.GetNumComps()) comps.push_back(i);
+            }
+            _node = MakeSwizzle(_node, comps, MakeType(from.kind, _to.cols, _to.rows));
+            from  = nodes[_node].type;
+        }
+        if (from == _to) return _node;
+        if (from.GetNumComps() != _to.GetNumComps() && from.GetNumComps() != u32(1)) return Fail("can't convert between these shapes");
+        if (IsConstant(_node)) { // Folded right away, literals are everywhere
+            Array<u32> words = {};
+            ifor(_to.GetNumComps()) words.push_back(ConvertWord(GetConstantWord(_node, from.GetNumComps() == u32(1) ? u32(0) : i), from.kind, _to.kind));
+            return MakeConstant(_to, words);
+        }
+        u32 n = NewNode(NODE_CONVERT, _to);
+        nodes[n].args.push_back(_node);
+        nodes[n].op = u32(from.kind);
+        return n;
+    }
+    u32 ConvertKind(u32 _node, ValueKind _kind) {
+        if (_node == invalid) return invalid;
+        ValueType t = nodes[_node].type;
+        t.kind      = _kind;
+        return Convert(_node, t);
+    }
+    // Result shape of a component wise operation
+    bool GetBroadcastType(Array<u32> const &_args, ValueKind _kind, ValueType &_type) {
+        _type = MakeType(_kind);
+        for (u32 a : _args) {
+            ValueType const &t = nodes[a].type;
+            if (!t.IsNumeric()) {
+                Fail("expected a scalar, vector or matrix");
+                return false;
+            }
+            if (t.GetNumComps() == u32(1)) continue;
+            if (_type.GetNumComps() == u32(1) || t.GetNumComps() < _type.GetNumComps()) _type = MakeType(_kind, t.cols, t.rows);
+        }
+        return true;
+    }
+
+    ////////////////////////////////////////////
+    // Expressions
+    ////////////////////////////////////////////
+    Variable *FindVariable(std::string const &_name) {
+        for (size_t i = scopes.size(); i-- > size_t(0);) {
+            auto it = scopes[i].vars.find(_name);
+            if (it != scopes[i].vars.end()) return &it.value();
+        }
+        return NULL;
+    }
+    u32 FindResource(std::string const &_name) {
+        ifor(resources.size()) if (resources[i].name == _name) return i;
+        return invalid;
+    }
+    u32 ParseNumber() {
+        Token const t   = Peek();
+        std::string str = GetText(t);
+        cursor++;
+        if (t.kind == TOKEN_FLOAT) {
+            while (str.size() && strchr("fFhH", str.back()) != NULL) str.pop_back();
+            return MakeScalarConstant(VALUE_F32, AsU(f32(strtod(str.c_str(), NULL))));
+        }
+        bool is_unsigned = false;
+        while (str.size() && strchr("uUlL", str.back()) != NULL) {
+            is_unsigned |= str.back() == 'u' || str.back() == 'U';
+            str.pop_back();
+        }
+        u64 v = strtoull(str.c_str(), NULL, 0);
+        return MakeScalarConstant(is_unsigned || v > u64(0x7fffffff) ? VALUE_U32 : VALUE_I32, u32(v));
+    }
+    u32 ParsePrimary() {
+        Token const t = Peek();
+        if (t.kind == TOKEN_INT || t.kind == TOKEN_FLOAT) return ParseNumber();
+        if (Accept("(")) {
+            u32 n = ParseExpression();
+            if (n == invalid || !Expect(")")) return invalid;
+            return n;
+        }
+        if (t.kind != TOKEN_IDENT) return Fail("expected an expression");
+        std::string name = GetText(t);
+        cursor++;
+        if (name == "true" || name == "false") return MakeScalarConstant(VALUE_BOOL, name == "true" ? u32(1) : u32(0));
+        if (IsNext("(")) return ParseCall(name);
+        if (Variable *var = FindVariable(name)) return MakeVariablePlace(*var);
+        u32 res = FindResource(name);
+        if (res != invalid) {
+            ResourceInfo const &info = resources[res];
+            if (info.kind == RESOURCE_UNSUPPORTED) return Fail("resource '%s' isn't supported by the CPU backend", name.c_str());
+            if (info.kind == RESOURCE_CONSTANT) {
+                Place p       = {};
+                p.root        = res;
+                p.is_resource = true;
+                p.type        = info.elem;
+                AppendComps(info.elem, u32(0), true, p.comps);
+                return MakePlaceNode(p);
+            }
+            u32 n      = NewNode(NODE_RESOURCE, info.elem);
+            nodes[n].op = res;
+            return n;
+        }
+        return Fail("unknown identifier '%s'", name.c_str());
+    }
+    u32 ParseIndex(u32 _node) {
+        u32 index = ParseExpression();
+        if (index == invalid || !Expect("]")) return invalid;
+        index = ConvertKind(index, VALUE_U32);
+        if (index == invalid) return invalid;
+        Node const &n = nodes[_node];
+        if (n.kind == NODE_RESOURCE) {
+            ResourceInfo const &info = resources[n.op];
+            Place               p    = {};
+            p.root                   = n.op;
+            p.is_resource            = true;
+            p.coord                  = Convert(index, MakeType(VALUE_U32, info.num_dims));
+            p.type                   = info.elem;
+            if (p.coord == invalid) return invalid;
+            AppendComps(info.elem, u32(0), true, p.comps);
+            return MakePlaceNode(p);
+        }
+        if (n.place == invalid) return Fail("only variables and resources can be indexed");
+        Place     p    = places[n.place];
+        ValueType type = p.type;
+        if (p.is_swizzled) return Fail("can't index a swizzle");
+        u32 stride = u32(0);
+        u32 bound  = u32(0);
+        if (type.num_elems) {
+            stride         = GetElemWords(type);
+            bound          = type.num_elems;
+            type.num_elems = u32(0);
+            p.comps.clear();
+            AppendComps(type, u32(0), p.is_resource, p.comps);
+        } else if (type.IsMatrix()) {
+            bool column_major = p.is_resource;
+            stride            = column_major ? u32(1) : type.cols;
+            bound             = type.rows;
+            p.comps.clear();
+            ifor(type.cols) p.comps.push_back(column_major ? i * type.rows : i);
+            type = MakeType(type.kind, type.cols);
+        } else if (type.IsNumeric() && type.cols > u32(1)) {
+            stride = u32(1);
+            bound  = type.cols;
+            p.comps.resize(1);
+            p.comps[0] = u32(0);
+            type       = MakeType(type.kind);
+        } else
+            return Fail("this can't be indexed");
+        p.type = type;
+        if (IsConstant(index))
+            p.offset += std::min(GetConstantWord(index, u32(0)), bound - u32(1)) * stride;
+        else
+            p.steps.push_back({index, stride, bound});
+        return MakePlaceNode(p);
+    }
+    static bool GetSwizzleComp(char c, u32 &_comp) {
+        switch (c) {
+        case 'x':
+        case 'r': _comp = u32(0); return true;
+        case 'y':
+        case 'g': _comp = u32(1); return true;
+        case 'z':
+        case 'b': _comp = u32(2); return true;
+        case 'w':
+        case 'a': _comp = u32(3); return true;
+        default: return false;
+        }
+    }
+    u32 ParseMember(u32 _node) {
+        if (Peek().kind != TOKEN_IDENT) return Fail("expected a member");
+        std::string name = GetText(Peek());
+        cursor++;
+        Node const &n = nodes[_node];
+        if (n.kind == NODE_RESOURCE) {
+            if (IsNext("(")) return ParseResourceMethod(_node, name);
+            return Fail("unknown resource member '%s'", name.c_str());
+        }
+        ValueType const &type = n.type;
+        if (type.kind == VALUE_STRUCT && type.num_elems == u32(0)) {
+            for (auto &f : structs[type.structure].fields) {
+                if (std::get<0>(f) != name) continue;
+                ValueType ftype = std::get<1>(f);
+                if (n.place != invalid) {
+                    Place p = places[n.place];
+                    p.offset += std::get<2>(f);
+                    p.type = ftype;
+                    p.comps.clear();
+                    AppendComps(ftype, u32(0), p.is_resource, p.comps);
+                    return MakePlaceNode(p);
+                }
+                Array<u32> comps = {};
+                ifor(GetWords(ftype)) comps.push_back(std::get<2>(f) + i);
+                return MakeSwizzle(_node, comps, ftype);
+            }
+            return Fail("unknown field '%s'", name.c_str());
+        }
+        if (!type.IsNumeric() || type.IsMatrix() || name.size() > size_t(4)) return Fail("unknown member '%s'", name.c_str());
+        Array<u32> sel = {};
+        for (char c : name) {
+            u32 comp = u32(0);
+            if (!GetSwizzleComp(c, comp) || comp >= type.cols) return Fail("invalid swizzle '%s'", name.c_str());
+            sel.push_back(comp);
+        }
+        if (n.place != invalid) {
+            Place      p     = places[n.place];
+            Array<u32> comps = {};
+            for (u32 s : sel) comps.push_back(p.comps[s]);
+            p.comps       = comps;
+            p.is_swizzled = true;
+            p.type        = MakeType(type.kind, u32(comps.size()));
+            return MakePlaceNode(p);
+        }
+        return MakeSwizzle(_node, sel, MakeType(type.kind, u32(sel.size())));
+    }
+    u32 ParsePostfix(u32 _node) {
+        while (_node != invalid) {
+            if (Accept("["))
+                _node = ParseIndex(_node);
+            else if (Accept("."))
+                _node = ParseMember(_node);
+            else
+                break;
+        }
+        return _node;
+    }
+    u32 ParseUnary() {
+        if (Accept("-") || Accept("!") || Accept("~") || Accept("+")) {
+            char op = text[tokens[cursor - u32(1)].begin];
+            u32  a  = ParseUnary();
+            if (a == invalid || op == '+') return a;
+            if (!nodes[a].type.IsNumeric()) return Fail("expected a number");
+            ValueKind kind = op == '!' ? VALUE_BOOL : nodes[a].type.kind == VALUE_BOOL ? VALUE_I32 : nodes[a].type.kind;
+            a              = ConvertKind(a, kind);
+            if (a == invalid) return invalid;
+            if (IsConstant(a) && op == '-') { // -1 and -0.5 are literals
+                Array<u32> words = {};
+                ifor(nodes[a].type.GetNumComps()) {
+                    u32 w = GetConstantWord(a, i);
+                    words.push_back(kind == VALUE_F32 ? w ^ u32(0x80000000) : u32(0) - w);
+                }
+                return MakeConstant(nodes[a].type, words);
+            }
+            u32 n      = NewNode(NODE_UNARY, nodes[a].type);
+            nodes[n].op = op == '-' ? u32(OP_MINUS) : op == '!' ? u32(OP_LOGICAL_NOT) : u32(OP_BIT_NEG);
+            nodes[n].args.push_back(a);
+            return n;
+        }
+        // (T)x casts
+        if (IsNext("(") && Peek(1).kind == TOKEN_IDENT && Is(Peek(2), ")")) {
+            ValueType type = {};
+            Token const &t = Peek(1);
+            if (ParseTypeName(text + t.begin, t.end - t.begin, type)) {
+                cursor += u32(3);
+                u32 a = ParseUnary();
+                if (a == invalid) return invalid;
+                if (type.kind == VALUE_STRUCT) { // Only (T)0
+                    if (!IsConstant(a) || nodes[a].type.GetNumComps() != u32(1) || GetConstantWord(a, u32(0)) != u32(0)) return Fail("unsupported struct cast");
+                    return MakeConstant(type, Array<u32>(GetWords(type)));
+                }
+                return Convert(a, type);
+            }
+        }
+        return ParsePostfix(ParsePrimary());
+    }
+    static i32 GetBinaryPrecedence(std::string const &_op, OpType &_type) {
+        static struct {
+            char const *str;
+            OpType      type;
+            i32         prec;
+        } const ops[] = {
+            {"||", OP_LOGICAL_OR, 1},   {"&&", OP_LOGICAL_AND, 2}, {"|", OP_BIT_OR, 3},        {"^", OP_BIT_XOR, 4},       {"&", OP_BIT_AND, 5},
+            {"==", OP_EQUAL, 6},        {"!=", OP_NOT_EQUAL, 6},   {"<", OP_LESS, 7},          {">", OP_GREATER, 7},       {"<=", OP_LESS_OR_EQUAL, 7},
+            {">=", OP_GREATER_OR_EQUAL, 7}, {"<<", OP_SHIFT_LEFT, 8}, {">>", OP_SHIFT_RIGHT, 8}, {"+", OP_PLUS, 9},        {"-", OP_MINUS, 9},
+            {"*", OP_MUL, 10},          {"/", OP_DIV, 10},         {"%", OP_MODULO, 10},
+        };
+        for (auto &o : ops) {
+            if (_op == o.str) {
+                _type = o.type;
+                return o.prec;
+            }
+        }
+        return i32(-1);
+    }
+    static bool IsComparison(OpType _op) {
+        return _op == OP_EQUAL || _op == OP_NOT_EQUAL || _op == OP_LESS || _op == OP_GREATER || _op == OP_LESS_OR_EQUAL || _op == OP_GREATER_OR_EQUAL;
+    }
+    u32 MakeBinary(OpType _op, u32 _a, u32 _b) {
+        if (_a == invalid || _b == invalid) return invalid;
+        ValueType ta = nodes[_a].type;
+        ValueType tb = nodes[_b].type;
+        if (!ta.IsNumeric() || !tb.IsNumeric()) return Fail("expected numbers");
+        ValueKind kind = Promote(ta.kind, tb.kind);
+        if (_op == OP_LOGICAL_AND || _op == OP_LOGICAL_OR) kind = VALUE_BOOL;
+        if ((_op == OP_BIT_AND || _op == OP_BIT_OR || _op == OP_BIT_XOR) && ta.kind == VALUE_BOOL && tb.kind == VALUE_BOOL) kind = VALUE_BOOL;
+        if (_op == OP_SHIFT_LEFT || _op == OP_SHIFT_RIGHT) kind = ta.kind == VALUE_BOOL ? VALUE_I32 : ta.kind == VALUE_F32 ? VALUE_I32 : ta.kind;
+        ValueType type = {};
+        if (!GetBroadcastType({_a, _b}, kind, type)) return invalid;
+        ValueType operand_type = type;
+        if (ta.GetNumComps() == u32(1)) operand_type = MakeType(kind);
+        _a = Convert(_a, operand_type);
+        operand_type = tb.GetNumComps() == u32(1) ? MakeType(kind) : type;
+        if (_op == OP_SHIFT_LEFT || _op == OP_SHIFT_RIGHT) operand_type.kind = VALUE_U32;
+        _b = Convert(_b, operand_type);
+        if (_a == invalid || _b == invalid) return invalid;
+        if (IsComparison(_op)) type.kind = VALUE_BOOL;
+        u32 n      = NewNode(NODE_BINARY, type);
+        nodes[n].op = u32(_op);
+        nodes[n].args.push_back(_a);
+        nodes[n].args.push_back(_b);
+        return n;
+    }
+    u32 ParseBinary(i32 _min_prec) {
+        u32 lhs = ParseUnary();
+        while (lhs != invalid) {
+            Token const &t = Peek();
+            if (t.kind != TOKEN_PUNCT) break;
+            OpType op   = OP_UNKNOWN;
+            i32    prec = GetBinaryPrecedence(GetText(t), op);
+            if (prec < _min_prec) break;
+            cursor++;
+            u32 rhs = ParseBinary(prec + i32(1));
+            lhs     = MakeBinary(op, lhs, rhs);
+        }
+        return lhs;
+    }
+    u32 ParseExpression() {
+        u32 cond = ParseBinary(i32(1));
+        if (cond == invalid || !Accept("?")) return cond;
+        u32 a = ParseExpression();
+        if (a == invalid || !Expect(":")) return invalid;
+        u32 b = ParseExpression();
+        if (b == invalid) return invalid;
+        ValueType type = {};
+        if (nodes[a].type.IsNumeric()) {
+            if (!GetBroadcastType({a, b}, Promote(nodes[a].type.kind, nodes[b].type.kind), type)) return invalid;
+            if (nodes[a].type.kind == VALUE_BOOL && nodes[b].type.kind == VALUE_BOOL) type.kind = VALUE_BOOL;
+        } else
+            type = nodes[a].type;
+        cond = ConvertKind(cond, VALUE_BOOL);
+        a    = Convert(a, type);
+        b    = Convert(b, type);
+        if (cond == invalid || a == invalid || b == invalid) return invalid;
+        if (nodes[cond].type.GetNumComps() != u32(1) && nodes[cond].type.GetNumComps() != type.GetNumComps()) return Fail("condition doesn't match the values");
+        u32 n = NewNode(NODE_SELECT, type);
+        nodes[n].args = {cond, a, b};
+        return n;
+    }
+    bool ParseArguments(Array<u32> &_args) {
+        if (!Expect("(")) return false;
+        if (Accept(")")) return true;
+        for (;;) {
+            u32 a = ParseExpression();
+            if (a == invalid) return false;
+            _args.push_back(a);
+            if (Accept(")")) return true;
+            if (!Expect(",")) return false;
+        }
+    }
+    u32 MakeConstruct(ValueType const &_type, Array<u32> &_args) {
+        u32 total = u32(0);
+        for (u32 &a : _args) {
+            if (!nodes[a].type.IsNumeric()) return Fail("expected numbers");
+            a = ConvertKind(a, _type.kind);
+            if (a == invalid) return invalid;
+            total += nodes[a].type.GetNumComps();
+        }
+        if (total == u32(1) && _type.GetNumComps() > u32(1)) return Convert(_args[0], _type); // Splat
+        if (total != _type.GetNumComps()) return Fail("wrong number of components");
+        if (_args.size() == size_t(1)) return _args[0];
+        bool all_constant = true;
+        for (u32 a : _args) all_constant &= IsConstant(a);
+        if (all_constant) {
+            Array<u32> words = {};
+            for (u32 a : _args) ifor(nodes[a].type.GetNumComps()) words.push_back(GetConstantWord(a, i));
+            return MakeConstant(_type, words);
+        }
+        u32 n         = NewNode(NODE_CONSTRUCT, _type);
+        nodes[n].args = _args;
+        return n;
+    }
+    bool FindIntrinsic(std::string const &_name, Intrinsic &_intrinsic) {
+        static HashMap<std::string, Intrinsic> const table = {
+            {"sin", INTRINSIC_SIN},
+            {"cos", INTRINSIC_COS},
+            {"tan", INTRINSIC_TAN},
+            {"asin", INTRINSIC_ASIN},
+            {"acos", INTRINSIC_ACOS},
+            {"atan", INTRINSIC_ATAN},
+            {"exp", INTRINSIC_EXP},
+            {"exp2", INTRINSIC_EXP2},
+            {"log", INTRINSIC_LOG},
+            {"log2", INTRINSIC_LOG2},
+            {"sqrt", INTRINSIC_SQRT},
+            {"rsqrt", INTRINSIC_RSQRT},
+            {"rcp", INTRINSIC_RCP},
+            {"frac", INTRINSIC_FRAC},
+            {"floor", INTRINSIC_FLOOR},
+            {"ceil", INTRINSIC_CEIL},
+            {"round", INTRINSIC_ROUND},
+            {"trunc", INTRINSIC_TRUNC},
+            {"saturate", INTRINSIC_SATURATE},
+            {"pow", INTRINSIC_POW},
+            {"atan2", INTRINSIC_ATAN2},
+            {"fmod", INTRINSIC_FMOD},
+            {"step", INTRINSIC_STEP},
+            {"lerp", INTRINSIC_LERP},
+            {"smoothstep", INTRINSIC_SMOOTHSTEP},
+            {"abs", INTRINSIC_ABS},
+            {"sign", INTRINSIC_SIGN},
+            {"min", INTRINSIC_MIN},
+            {"max", INTRINSIC_MAX},
+            {"clamp", INTRINSIC_CLAMP},
+            {"mad", INTRINSIC_MAD},
+            {"isnan", INTRINSIC_ISNAN},
+            {"isinf", INTRINSIC_ISINF},
+            {"dot", INTRINSIC_DOT},
+            {"length", INTRINSIC_LENGTH},
+            {"distance", INTRINSIC_DISTANCE},
+            {"normalize", INTRINSIC_NORMALIZE},
+            {"cross", INTRINSIC_CROSS},
+            {"reflect", INTRINSIC_REFLECT},
+            {"any", INTRINSIC_ANY},
+            {"all", INTRINSIC_ALL},
+            {"countbits", INTRINSIC_COUNTBITS},
+            {"firstbithigh", INTRINSIC_FIRSTBITHIGH},
+            {"firstbitlow", INTRINSIC_FIRSTBITLOW},
+            {"reversebits", INTRINSIC_REVERSEBITS},
+            {"asf32", INTRINSIC_ASF32},
+            {"asfloat", INTRINSIC_ASF32},
+            {"asu32", INTRINSIC_ASU32},
+            {"asuint", INTRINSIC_ASU32},
+            {"asi32", INTRINSIC_ASI32},
+            {"asint", INTRINSIC_ASI32},
+            {"f32tof16", INTRINSIC_F32TOF16},
+            {"f16tof32", INTRINSIC_F16TOF32},
+            {"mul", INTRINSIC_MUL},
+            {"transpose", INTRINSIC_TRANSPOSE},
+            {"WaveGetLaneIndex", INTRINSIC_LANE_INDEX},
+            {"WaveGetLaneCount", INTRINSIC_LANE_COUNT},
+            {"__get_lane_bit", INTRINSIC_LANE_BIT},
+            {"WaveIsFirstLane", INTRINSIC_IS_FIRST_LANE},
+            {"WaveActiveBallot", INTRINSIC_BALLOT},
+            {"WaveActiveCountBits", INTRINSIC_ACTIVE_COUNT_BITS},
+            {"WaveActiveAnyTrue", INTRINSIC_ACTIVE_ANY_TRUE},
+            {"WaveActiveAllTrue", INTRINSIC_ACTIVE_ALL_TRUE},
+            {"WaveReadLaneFirst", INTRINSIC_READ_LANE_FIRST},
+            {"WaveActiveSum", INTRINSIC_ACTIVE_SUM},
+            {"WaveActiveMin", INTRINSIC_ACTIVE_MIN},
+            {"WaveActiveMax", INTRINSIC_ACTIVE_MAX},
+            {"WavePrefixSum", INTRINSIC_PREFIX_SUM},
+            {"WavePrefixCountBits", INTRINSIC_PREFIX_COUNT_BITS},
+            {"NonUniformResourceIndex", INTRINSIC_IDENTITY},
+        };
+        auto it = table.find(_name);
+        if (it == table.end()) return false;
+        _intrinsic = it->second;
+        return true;
+    }
+    // Converts the arguments and figures out the result type
+    u32 MakeIntrinsic(Intrinsic _intrinsic, Array<u32> &_args) {
+        static u32 const num_args[] = {
+            1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // sin .. saturate
+            2, 2, 2, 2, 3, 3,                                        // pow .. smoothstep
+            1, 1, 2, 2, 3, 3,                                        // abs .. mad
+            1, 1,                                                    // isnan, isinf
+            2, 1, 2, 1, 2, 2, 1, 1,                                  // dot .. all
+            1, 1, 1, 1, 1, 1, 1, 1, 1,                               // countbits .. f16tof32
+            2, 1,                                                    // mul, transpose
+            0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,                // wave
+            1,                                                       // identity
+        };
+        static_assert(SJIT_ARRAYSIZE(num_args) == size_t(INTRINSIC_IDENTITY) + size_t(1), "");
+        if (_args.size() != size_t(num_args[_intrinsic])) return Fail("wrong number of arguments");
+        for (u32 a : _args)
+            if (!nodes[a].type.IsNumeric()) return Fail("expected numbers");
+        ValueType type = {};
+        auto      convert_all = [&](ValueType const &_type) {
+            for (u32 &a : _args) {
+                a = Convert(a, nodes[a].type.GetNumComps() == u32(1) ? MakeType(_type.kind) : _type);
+                if (a == invalid) return false;
+            }
+            return true;
+        };
+        switch (_intrinsic) {
+        case INTRINSIC_ISNAN:
+        case INTRINSIC_ISINF:
+            if (!GetBroadcastType(_args, VALUE_F32, type) || !convert_all(type)) return invalid;
+            type.kind = VALUE_BOOL;
+            break;
+        case INTRINSIC_ABS:
+        case INTRINSIC_SIGN:
+        case INTRINSIC_MIN:
+        case INTRINSIC_MAX:
+        case INTRINSIC_CLAMP:
+        case INTRINSIC_MAD: {
+            ValueKind kind = nodes[_args[0]].type.kind;
+            for (u32 a : _args) kind = Promote(kind, nodes[a].type.kind);
+            if (!GetBroadcastType(_args, kind, type) || !convert_all(type)) return invalid;
+            if (_intrinsic == INTRINSIC_SIGN) type.kind = VALUE_I32;
+            break;
+        }
+        case INTRINSIC_DOT:
+        case INTRINSIC_DISTANCE:
+        case INTRINSIC_CROSS:
+        case INTRINSIC_REFLECT:
+            if (!GetBroadcastType(_args, VALUE_F32, type) || !convert_all(type)) return invalid;
+            if (_intrinsic == INTRINSIC_DOT || _intrinsic == INTRINSIC_DISTANCE) type = MakeType(VALUE_F32);
+            if (_intrinsic == INTRINSIC_CROSS && type.cols != u32(3)) return Fail("cross needs 3 component vectors");
+            break;
+        case INTRINSIC_LENGTH:
+            if (!GetBroadcastType(_args, VALUE_F32, type) || !convert_all(type)) return invalid;
+            type = MakeType(VALUE_F32);
+            break;
+        case INTRINSIC_ANY:
+        case INTRINSIC_ALL:
+            if (!GetBroadcastType(_args, VALUE_BOOL, type) || !convert_all(type)) return invalid;
+            type = MakeType(VALUE_BOOL);
+            break;
+        case INTRINSIC_COUNTBITS:
+        case INTRINSIC_FIRSTBITHIGH:
+        case INTRINSIC_FIRSTBITLOW:
+        case INTRINSIC_REVERSEBITS:
+        case INTRINSIC_F32TOF16:
+            if (!GetBroadcastType(_args, _intrinsic == INTRINSIC_F32TOF16 ? VALUE_F32 : VALUE_U32, type) || !convert_all(type)) return invalid;
+            type.kind = VALUE_U32;
+            break;
+        case INTRINSIC_F16TOF32:
+            if (!GetBroadcastType(_args, VALUE_U32, type) || !convert_all(type)) return invalid;
+            type.kind = VALUE_F32;
+            break;
+        case INTRINSIC_ASF32:
+        case INTRINSIC_ASU32:
+        case INTRINSIC_ASI32:
+            type      = nodes[_args[0]].type;
+            type.kind = _intrinsic == INTRINSIC_ASF32 ? VALUE_F32 : _intrinsic == INTRINSIC_ASU32 ? VALUE_U32 : VALUE_I32;
+            if (nodes[_args[0]].type.kind == VALUE_BOOL) _args[0] = ConvertKind(_args[0], VALUE_U32);
+            break;
+        case INTRINSIC_MUL: {
+            ValueType ta = nodes[_args[0]].type;
+            ValueType tb = nodes[_args[1]].type;
+            if (ta.GetNumComps() == u32(1) || tb.GetNumComps() == u32(1)) return MakeBinary(OP_MUL, _args[0], _args[1]);
+            ValueKind kind = Promote(ta.kind, tb.kind);
+            if (ta.cols != (tb.IsMatrix() ? tb.rows : tb.cols)) return Fail("mul sizes don't match");
+            _args[0] = ConvertKind(_args[0], kind);
+            _args[1] = ConvertKind(_args[1], kind);
+            if (_args[0] == invalid || _args[1] == invalid) return invalid;
+            if (ta.IsMatrix() && tb.IsMatrix())
+                type = MakeType(kind, tb.cols, ta.rows);
+            else if (ta.IsMatrix())
+                type = MakeType(kind, ta.rows);
+            else if (tb.IsMatrix())
+                type = MakeType(kind, tb.cols);
+            else
+                type = MakeType(kind);
+            break;
+        }
+        case INTRINSIC_TRANSPOSE:
+            type = MakeType(nodes[_args[0]].type.kind, nodes[_args[0]].type.rows, nodes[_args[0]].type.cols);
+            break;
+        case INTRINSIC_LANE_INDEX:
+        case INTRINSIC_LANE_COUNT:
+        case INTRINSIC_LANE_BIT: type = MakeType(VALUE_U32); break;
+        case INTRINSIC_IS_FIRST_LANE: type = MakeType(VALUE_BOOL); break;
+        case INTRINSIC_BALLOT:
+        case INTRINSIC_ACTIVE_COUNT_BITS:
+        case INTRINSIC_ACTIVE_ANY_TRUE:
+        case INTRINSIC_ACTIVE_ALL_TRUE:
+        case INTRINSIC_PREFIX_COUNT_BITS:
+            _args[0] = Convert(_args[0], MakeType(VALUE_BOOL));
+            if (_args[0] == invalid) return invalid;
+            type = _intrinsic == INTRINSIC_BALLOT ? MakeType(VALUE_U32, u32(4)) : _intrinsic == INTRINSIC_ACTIVE_ANY_TRUE || _intrinsic == INTRINSIC_ACTIVE_ALL_TRUE ? MakeType(VALUE_BOOL) : MakeType(VALUE_U32);
+            break;
+        case INTRINSIC_READ_LANE_FIRST:
+        case INTRINSIC_ACTIVE_SUM:
+        case INTRINSIC_ACTIVE_MIN:
+        case INTRINSIC_ACTIVE_MAX:
+        case INTRINSIC_PREFIX_SUM:
+        case INTRINSIC_IDENTITY:
+            type = nodes[_args[0]].type;
+            if (type.kind == VALUE_BOOL && _intrinsic != INTRINSIC_READ_LANE_FIRST && _intrinsic != INTRINSIC_IDENTITY) return Fail("expected numbers");
+            break;
+        default: // Float math
+            if (!GetBroadcastType(_args, VALUE_F32, type) || !convert_all(type)) return invalid;
+            break;
+        }
+        u32 n         = NewNode(NODE_INTRINSIC, type);
+        nodes[n].op   = u32(_intrinsic);
+        nodes[n].args = _args;
+        return n;
+    }
+    u32 ParseResourceMethod(u32 _resource, std::string const &_name) {
+        Array<u32> args = {};
+        if (!ParseArguments(args)) return invalid;
+        ResourceInfo const &info = resources[nodes[_resource].op];
+        if (info.kind != RESOURCE_TEXTURE || info.num_dims != u32(2)) return Fail("'%s' is only supported on 2D textures", _name.c_str());
+        if (_name == "SampleLevel") { // Bilinear from mip 0 with clamped coordinates, the sampler is ignored
+            if (args.size() != size_t(3) || nodes[args[0]].kind != NODE_RESOURCE) return Fail("expected SampleLevel(sampler, uv, lod)");
+            u32 uv = Convert(args[1], MakeType(VALUE_F32, u32(2)));
+            if (uv == invalid) return invalid;
+            ValueType type = info.elem;
+            type.kind      = VALUE_F32;
+            u32 n          = NewNode(NODE_SAMPLE, type);
+            nodes[n].op    = nodes[_resource].op;
+            nodes[n].args  = {uv};
+            return n;
+        }
+        if (_name == "Load") { // Mip level is ignored
+            if (args.size() != size_t(1) || nodes[args[0]].type.GetNumComps() < u32(2)) return Fail("expected Load(coord)");
+            u32 coord = Convert(args[0], MakeType(VALUE_U32, u32(2)));
+            if (coord == invalid) return invalid;
+            Place p       = {};
+            p.root        = nodes[_resource].op;
+            p.is_resource = true;
+            p.coord       = coord;
+            p.type        = info.elem;
+            AppendComps(info.elem, u32(0), true, p.comps);
+            return MakePlaceNode(p);
+        }
+        return Fail("'%s' isn't supported by the CPU backend", _name.c_str());
+    }
+    u32 ParseCall(std::string const &_name) {
+        ValueType type = {};
+        if (ParseTypeName(_name.c_str(), u32(_name.size()), type)) {
+            Array<u32> args = {};
+            if (!ParseArguments(args)) return invalid;
+            if (!type.IsNumeric()) return Fail("can't construct '%s'", _name.c_str());
+            return MakeConstruct(type, args);
+        }
+        size_t splat = _name.rfind("_splat");
+        if (splat != std::string::npos && splat + size_t(6) == _name.size() && ParseTypeName(_name.c_str(), u32(splat), type)) {
+            Array<u32> args = {};
+            if (!ParseArguments(args)) return invalid;
+            if (args.size() != size_t(1)) return Fail("expected one argument");
+            return Convert(ConvertKind(args[0], type.kind), type);
+        }
+        if (_name == "__get_dimensions") {
+            Array<u32> args = {};
+            if (!ParseArguments(args)) return invalid;
+            if (args.size() != size_t(1) || nodes[args[0]].kind != NODE_RESOURCE) return Fail("expected a resource");
+            ResourceInfo const &info = resources[nodes[args[0]].op];
+            u32                 n    = NewNode(NODE_DIMENSIONS, MakeType(VALUE_U32, info.num_dims));
+            nodes[n].op              = nodes[args[0]].op;
+            return n;
+        }
+        Intrinsic intrinsic = INTRINSIC_IDENTITY;
+        if (FindIntrinsic(_name, intrinsic)) {
+            Array<u32> args = {};
+            if (!ParseArguments(args)) return invalid;
+            return MakeIntrinsic(intrinsic, args);
+        }
+        auto it = functions.find(_name);
+        if (it == functions.end()) return Fail("unknown function '%s'", _name.c_str());
+        Array<u32> args = {};
+        if (!ParseArguments(args)) return invalid;
+        return InlineCall(it->second, args);
+    }
+    bool ParseParams(FunctionDef const &_def, Array<std::tuple<ValueType, bool, std::string>> &_params) {
+        u32 saved = cursor;
+        defer(cursor = saved);
+        cursor = _def.params_begin;
+        while (cursor < _def.params_end) {
+            bool is_inout = Accept("inout") || Accept("out");
+            Accept("in");
+            ValueType type = {};
+            if (!ParseType(type) || Peek().kind != TOKEN_IDENT) return false;
+            _params.push_back({type, is_inout, GetText(Peek())});
+            cursor++;
+            if (Accept(":")) cursor++; // Semantic
+            Accept(",");
+        }
+        return true;
+    }
+    // Every call site gets its own copy of the function, HLSL has no recursion
+    u32 InlineCall(Array<FunctionDef> const &_defs, Array<u32> &_args) {
+        FunctionDef const                              *def    = NULL;
+        Array<std::tuple<ValueType, bool, std::string>> params = {};
+        u32                                             best   = u32(0);
+        for (auto &d : _defs) { // Overloads, the most exact match wins
+            Array<std::tuple<ValueType, bool, std::string>> p = {};
+            if (!ParseParams(d, p) || p.size() != _args.size()) continue;
+            u32 score = u32(1);
+            ifor(p.size()) score += std::get<0>(p[i]) == nodes[_args[i]].type ? u32(2) : std::get<0>(p[i]).IsNumeric() == nodes[_args[i]].type.IsNumeric() ? u32(1) : u32(0);
+            if (score > best) {
+                best   = score;
+                def    = &d;
+                params = p;
+            }
+        }
+        if (def == NULL) return Fail("no matching overload");
+        if (call_depth > u32(32)) return Fail("calls nested too deep");
+        ValueType ret_type = {};
+        u32       saved    = cursor;
+        cursor             = def->ret_type;
+        if (!IsNext("void") && !ParseType(ret_type)) {
+            cursor = saved;
+            return Fail("unsupported return type");
+        }
+        cursor = saved;
+
+        Call call = {};
+        ifor(params.size()) {
+            ValueType const &ptype = std::get<0>(params[i]);
+            _args[i]               = Convert(_args[i], ptype);
+            if (_args[i] == invalid) return invalid;
+            call.params.push_back(AllocSlot(GetWords(ptype)));
+            u32 out = invalid;
+            if (std::get<1>(params[i])) {
+                if (nodes[_args[i]].place == invalid) return Fail("inout argument has to be a variable");
+                out = nodes[_args[i]].place;
+            }
+            call.out_places.push_back(out);
+        }
+        call.ret_slot = AllocSlot(GetWords(ret_type));
+
+        Array<Scope> saved_scopes = std::move(scopes);
+        scopes                    = {};
+        scopes.push_back({});
+        ifor(params.size()) scopes.back().vars[std::get<2>(params[i])] = {call.params[i], std::get<0>(params[i])};
+        fn_stack.push_back({call.ret_slot, ret_type});
+        call_depth++;
+        saved  = cursor;
+        cursor = def->body_begin;
+        u32 body = ParseBlock();
+        cursor   = saved;
+        call_depth--;
+        fn_stack.pop_back();
+        scopes = std::move(saved_scopes);
+        if (body == invalid) return invalid;
+        call.body = body;
+
+        calls.push_back(call);
+        u32 n         = NewNode(NODE_CALL, ret_type);
+        nodes[n].op   = u32(calls.size() - size_t(1));
+        nodes[n].args = _args;
+        nodes[n].slot = call.ret_slot;
+        return n;
+    }
+
+    ////////////////////////////////////////////
+    // Statements
+    ////////////////////////////////////////////
+    // Post order, aliases only bring in what they read from
+    void AppendCode(u32 _node, Array<u32> &_code) const {
+        Node const &n = nodes[_node];
+        for (u32 a : n.args) AppendCode(a, _code);
+        if (n.kind != NODE_ALIAS && n.kind != NODE_RESOURCE) _code.push_back(_node);
+    }
+    void AppendPlaceCode(Place const &_place, Array<u32> &_code) const {
+        if (_place.coord != invalid) AppendCode(_place.coord, _code);
+        for (auto &s : _place.steps) AppendCode(s.node, _code);
+    }
+    u32 NewStmt(StmtKind _kind) {
+        Stmt s = {};
+        s.kind = _kind;
+        stmts.push_back(s);
+        return u32(stmts.size() - size_t(1));
+    }
+    u32 MakeStore(u32 _place, OpType _op, u32 _value) {
+        Place const &p = places[_place];
+        if (p.is_resource && !resources[p.root].writable) return Fail("resource '%s' is read only", resources[p.root].name.c_str());
+        if (p.is_swizzled) {
+            for (u32 i = u32(0); i < u32(p.comps.size()); i++)
+                for (u32 j = i + u32(1); j < u32(p.comps.size()); j++)
+                    if (p.comps[i] == p.comps[j]) return Fail("a swizzle that's written to can't repeat components");
+        }
+        ValueType type = p.type;
+        if (_op != OP_ASSIGN && !type.IsNumeric()) return Fail("expected a number");
+        _value = Convert(_value, _op == OP_SHIFT_LEFT || _op == OP_SHIFT_RIGHT ? MakeType(VALUE_U32, type.cols, type.rows) : type);
+        if (_value == invalid) return invalid;
+        u32   s    = NewStmt(STMT_STORE);
+        Stmt &stmt = stmts[s];
+        AppendCode(_value, stmt.code);
+        AppendPlaceCode(p, stmt.code);
+        stmt.place = _place;
+        stmt.op    = _op;
+        stmt.value = _value;
+        return s;
+    }
+    static bool GetAssignOp(std::string const &_str, OpType &_op) {
+        static struct {
+            char const *str;
+            OpType      op;
+        } const ops[] = {
+            {"=", OP_ASSIGN},         {"+=", OP_PLUS_ASSIGN},   {"-=", OP_MINUS_ASSIGN},  {"*=", OP_MUL_ASSIGN},     {"/=", OP_DIV_ASSIGN},
+            {"|=", OP_BIT_OR_ASSIGN}, {"&=", OP_BIT_AND_ASSIGN}, {"^=", OP_BIT_XOR_ASSIGN}, {"%=", OP_MODULO},          {"<<=", OP_SHIFT_LEFT},
+            {">>=", OP_SHIFT_RIGHT},
+        };
+        for (auto &o : ops) {
+            if (_str == o.str) {
+                _op = o.op;
+                return true;
+            }
+        }
+        return false;
+    }
+    // Assignments, ++/-- and calls
+    u32 ParseSimpleStatement() {
+        if (IsNext("++") || IsNext("--")) {
+            bool inc = Accept("++") || !Accept("--");
+            u32  n   = ParseUnary();
+            if (n == invalid) return invalid;
+            if (nodes[n].place == invalid) return Fail("expected a variable");
+            return MakeStore(nodes[n].place, inc ? OP_PLUS_ASSIGN : OP_MINUS_ASSIGN, MakeScalarConstant(VALUE_I32, u32(1)));
+        }
+        u32 n = ParseUnary();
+        if (n == invalid) return invalid;
+        OpType op = OP_UNKNOWN;
+        if (IsNext("++") || IsNext("--")) {
+            bool inc = Accept("++") || !Accept("--");
+            if (nodes[n].place == invalid) return Fail("expected a variable");
+            return MakeStore(nodes[n].place, inc ? OP_PLUS_ASSIGN : OP_MINUS_ASSIGN, MakeScalarConstant(VALUE_I32, u32(1)));
+        }
+        if (Peek().kind == TOKEN_PUNCT && GetAssignOp(GetText(Peek()), op)) {
+            cursor++;
+            if (nodes[n].place == invalid) return Fail("expected a variable");
+            u32 value = ParseExpression();
+            if (value == invalid) return invalid;
+            return MakeStore(nodes[n].place, op, value);
+        }
+        // Anything else is only run for its side effects
+        n       = ParsePostfix(ParseBinaryRest(n));
+        u32 s   = NewStmt(STMT_CODE);
+        if (n == invalid) return invalid;
+        AppendCode(n, stmts[s].code);
+        return s;
+    }
+    u32 ParseBinaryRest(u32 _lhs) {
+        while (_lhs != invalid && Peek().kind == TOKEN_PUNCT) {
+            OpType op   = OP_UNKNOWN;
+            i32    prec = GetBinaryPrecedence(GetText(Peek()), op);
+            if (prec < i32(0)) break;
+            cursor++;
+            _lhs = MakeBinary(op, _lhs, ParseBinary(prec + i32(1)));
+        }
+        return _lhs;
+    }
+    u32 DeclareVariable(std::string const &_name, ValueType const &_type, u32 _slot = invalid) {
+        Variable var = {};
+        var.type     = _type;
+        var.slot     = _slot == invalid ? AllocSlot(GetWords(_type)) : _slot;
+        scopes.back().vars[_name] = var;
+        return var.slot;
+    }
+    // T name; T name = x; T name[N]; T name[N] = {...};
+    bool ParseDeclaration(Array<u32> &_block) {
+        ValueType type = {};
+        if (!ParseType(type)) {
+            Fail("expected a type");
+            return false;
+        }
+        for (;;) {
+            if (Peek().kind != TOKEN_IDENT) {
+                Fail("expected a name");
+                return false;
+            }
+            std::string name  = GetText(Peek());
+            ValueType   vtype = type;
+            cursor++;
+            if (Accept("[")) {
+                if (Peek().kind != TOKEN_INT) {
+                    Fail("expected an array size");
+                    return false;
+                }
+                vtype.num_elems = u32(strtoul(GetText(Peek()).c_str(), NULL, 0));
+                cursor++;
+                if (!Expect("]")) return false;
+            }
+            if (Accept("=")) {
+                if (vtype.num_elems) {
+                    u32 slot = DeclareVariable(name, vtype);
+                    if (!Expect("{")) return false;
+                    ifor(vtype.num_elems) {
+                        u32 value = ParseExpression();
+                        if (value == invalid) return false;
+                        Place p = {};
+                        p.root  = slot;
+                        p.type  = type;
+                        AppendComps(type, i * GetElemWords(type), false, p.comps);
+                        MakePlaceNode(p);
+                        u32 s = MakeStore(u32(places.size() - size_t(1)), OP_ASSIGN, value);
+                        if (s == invalid) return false;
+                        _block.push_back(s);
+                        if (!Accept(",")) break;
+                    }
+                    if (!Expect("}")) return false;
+                } else {
+                    u32 value = ParseExpression();
+                    if (value == invalid) return false;
+                    value = Convert(value, vtype);
+                    if (value == invalid) return false;
+                    Node const &n = nodes[value];
+                    if (n.kind != NODE_ALIAS && n.kind != NODE_CALL && n.kind != NODE_RESOURCE) { // Takes over the slot of the value, no copy
+                        u32 s = NewStmt(STMT_CODE);
+                        AppendCode(value, stmts[s].code);
+                        _block.push_back(s);
+                        DeclareVariable(name, vtype, n.slot);
+                    } else {
+                        DeclareVariable(name, vtype);
+                        u32 place = nodes[MakeVariablePlace(*FindVariable(name))].place;
+                        u32 s     = MakeStore(place, OP_ASSIGN, value);
+                        if (s == invalid) return false;
+                        _block.push_back(s);
+                    }
+                }
+            } else {
+                DeclareVariable(name, vtype);
+            }
+            if (Accept(";")) return true;
+            if (!Expect(",")) return false;
+        }
+    }
+    u32 NewBlock() {
+        blocks.push_back({});
+        return u32(blocks.size() - size_t(1));
+    }
+    // A statement that's its own block, if (x) y;
+    u32 ParseBody() {
+        if (IsNext("{")) return ParseBlock();
+        u32 b = NewBlock();
+        scopes.push_back({});
+        Array<u32> block = {};
+        bool       ok    = ParseStatement(block);
+        scopes.pop_back();
+        if (!ok) return invalid;
+        blocks[b] = block;
+        return b;
+    }
+    u32 ParseBlock() {
+        if (!Expect("{")) return invalid;
+        u32 b = NewBlock();
+        scopes.push_back({});
+        Array<u32> block = {};
+        while (!Accept("}")) {
+            if (Peek().kind == TOKEN_EOF || !ParseStatement(block)) {
+                scopes.pop_back();
+                return Fail("unterminated block");
+            }
+        }
+        scopes.pop_back();
+        blocks[b] = block;
+        return b;
+    }
+    u32 ParseCondition() {
+        if (!Expect("(")) return invalid;
+        u32 cond = ParseExpression();
+        if (cond == invalid || !Expect(")")) return invalid;
+        cond = ConvertKind(cond, VALUE_BOOL);
+        if (cond != invalid && nodes[cond].type.GetNumComps() != u32(1)) return Fail("condition has to be a scalar");
+        return cond;
+    }
+    bool ParseStatement(Array<u32> &_block) {
+        if (Accept(";")) return true;
+        if (IsNext("{")) {
+            u32 body = ParseBlock();
+            if (body == invalid) return false;
+            u32 s          = NewStmt(STMT_BLOCK);
+            stmts[s].body  = body;
+            _block.push_back(s);
+            return true;
+        }
+        if (Accept("if")) {
+            u32 cond = ParseCondition();
+            if (cond == invalid) return false;
+            u32 body = ParseBody();
+            if (body == invalid) return false;
+            u32 else_body = invalid;
+            if (Accept("else")) {
+                else_body = ParseBody();
+                if (else_body == invalid) return false;
+            }
+            u32 s = NewStmt(STMT_IF);
+            AppendCode(cond, stmts[s].code);
+            stmts[s].value     = cond;
+            stmts[s].body      = body;
+            stmts[s].else_body = else_body;
+            _block.push_back(s);
+            return true;
+        }
+        if (Accept("while")) {
+            u32 cond = ParseCondition();
+            if (cond == invalid) return false;
+            u32 body = ParseBody();
+            if (body == invalid) return false;
+            u32 s = NewStmt(STMT_LOOP);
+            AppendCode(cond, stmts[s].code);
+            stmts[s].value = cond;
+            stmts[s].body  = body;
+            _block.push_back(s);
+            return true;
+        }
+        if (Accept("for")) {
+            if (!Expect("(")) return false;
+            scopes.push_back({});
+            defer(scopes.pop_back());
+            if (!Accept(";")) {
+                if (IsTypeNext()) {
+                    if (!ParseDeclaration(_block)) return false;
+                } else {
+                    u32 init = ParseSimpleStatement();
+                    if (init == invalid || !Expect(";")) return false;
+                    _block.push_back(init);
+                }
+            }
+            u32 cond = IsNext(";") ? MakeScalarConstant(VALUE_BOOL, u32(1)) : ParseExpression();
+            if (cond == invalid || !Expect(";")) return false;
+            cond = ConvertKind(cond, VALUE_BOOL);
+            if (cond == invalid) return false;
+            u32 step = NewBlock();
+            if (!IsNext(")")) {
+                u32 s = ParseSimpleStatement();
+                if (s == invalid) return false;
+                blocks[step].push_back(s);
+            }
+            if (!Expect(")")) return false;
+            u32 body = ParseBody();
+            if (body == invalid) return false;
+            u32 s = NewStmt(STMT_LOOP);
+            AppendCode(cond, stmts[s].code);
+            stmts[s].value = cond;
+            stmts[s].body  = body;
+            stmts[s].step  = step;
+            _block.push_back(s);
+            return true;
+        }
+        if (Accept("switch")) {
+            if (!Expect("(")) return false;
+            u32 value = ParseExpression();
+            if (value == invalid || !Expect(")") || !Expect("{")) return false;
+            if (!nodes[value].type.IsNumeric() || nodes[value].type.GetNumComps() != u32(1) || nodes[value].type.kind == VALUE_F32) {
+                Fail("switch needs an integer");
+                return false;
+            }
+            u32 s    = NewStmt(STMT_SWITCH);
+            u32 body = NewBlock();
+            AppendCode(value, stmts[s].code);
+            stmts[s].value   = value;
+            stmts[s].body    = body;
+            Array<u32> block = {};
+            scopes.push_back({});
+            defer(scopes.pop_back());
+            while (!Accept("}")) {
+                if (Accept("case")) {
+                    u32 label = ParseExpression();
+                    if (label == invalid || !Expect(":")) return false;
+                    if (!IsConstant(label)) {
+                        Fail("case labels have to be constants");
+                        return false;
+                    }
+                    Case c     = {};
+                    c.label    = i64(i32(GetConstantWord(label, u32(0))));
+                    c.position = u32(block.size());
+                    stmts[s].cases.push_back(c);
+                } else if (Accept("default")) {
+                    if (!Expect(":")) return false;
+                    Case c       = {};
+                    c.is_default = true;
+                    c.position   = u32(block.size());
+                    stmts[s].cases.push_back(c);
+                } else if (Peek().kind == TOKEN_EOF || !ParseStatement(block)) {
+                    Fail("unterminated switch");
+                    return false;
+                }
+            }
+            blocks[body] = block;
+            _block.push_back(s);
+            return true;
+        }
+        if (Accept("break")) {
+            _block.push_back(NewStmt(STMT_BREAK));
+            return Expect(";");
+        }
+        if (Accept("continue")) {
+            _block.push_back(NewStmt(STMT_CONTINUE));
+            return Expect(";");
+        }
+        if (Accept("return")) {
+            u32 s = NewStmt(STMT_RETURN);
+            if (!IsNext(";")) {
+                if (fn_stack.size() == size_t(0)) {
+                    Fail("main can't return a value");
+                    return false;
+                }
+                u32 value = Convert(ParseExpression(), fn_stack.back().second);
+                if (value == invalid) return false;
+                AppendCode(value, stmts[s].code);
+                stmts[s].value    = value;
+                stmts[s].ret_slot = fn_stack.back().first;
+            }
+            _block.push_back(s);
+            return Expect(";");
+        }
+        if (IsNext("groupshared") || IsNext("GroupMemoryBarrierWithGroupSync") || IsNext("GroupMemoryBarrier") || IsNext("AllMemoryBarrierWithGroupSync")) {
+            Fail("group shared memory and barriers aren't supported by the CPU backend");
+            return false;
+        }
+        if (IsNext("RayQuery") || IsNext("RayDesc")) {
+            Fail("ray queries aren't supported by the CPU backend");
+            return false;
+        }
+        if (IsTypeNext() && (Peek(1).kind == TOKEN_IDENT || IsNext("const"))) return ParseDeclaration(_block);
+        u32 s = ParseSimpleStatement();
+        if (s == invalid) return false;
+        _block.push_back(s);
+        return Expect(";");
+    }
+
+    ////////////////////////////////////////////
+    // Top level
+    ////////////////////////////////////////////
+    bool ParseStruct() {
+        StructInfo info = {};
+        if (Peek().kind != TOKEN_IDENT) return false;
+        info.name = GetText(Peek());
+        cursor++;
+        if (!Expect("{")) return false;
+        while (!Accept("}")) {
+            ValueType type = {};
+            if (!ParseType(type) || Peek().kind != TOKEN_IDENT) { // Anything the backend can't represent stays unusable
+                while (!IsNext(";") && Peek().kind != TOKEN_EOF) cursor++;
+                Accept(";");
+                info.num_words = u32(-1);
+                continue;
+            }
+            std::string name = GetText(Peek());
+            cursor++;
+            if (Accept("[")) {
+                type.num_elems = u32(strtoul(GetText(Peek()).c_str(), NULL, 0));
+                cursor++;
+                Expect("]");
+            }
+            if (info.num_words != u32(-1)) {
+                info.fields.push_back({name, type, info.num_words});
+                info.num_words += GetWords(type);
+            }
+            if (!Expect(";")) return false;
+        }
+        Accept(";");
+        if (info.num_words != u32(-1)) structs.push_back(info);
+        return true;
+    }
+    // StructuredBuffer<T> name; RWTexture2D<T> name; T name;
+    void AddResource(std::string const &_kind, ValueType const &_elem, std::string const &_name, bool _is_template, bool _is_array) {
+        ResourceInfo info = {};
+        info.name         = _name;
+        info.elem         = _elem;
+        info.elem_words   = GetWords(_elem);
+        bool is_rw        = _kind.size() > size_t(2) && _kind[0] == 'R' && _kind[1] == 'W';
+        std::string base  = is_rw ? _kind.substr(2) : _kind;
+        if (_is_array || _elem.kind == VALUE_VOID) {
+            info.kind = RESOURCE_UNSUPPORTED;
+        } else if (!_is_template) {
+            info.kind = RESOURCE_CONSTANT;
+        } else if (base == "StructuredBuffer" || base == "Buffer") {
+            info.kind     = RESOURCE_BUFFER;
+            info.writable = is_rw;
+        } else if (base == "Texture2D" || base == "Texture3D") {
+            info.kind     = RESOURCE_TEXTURE;
+            info.writable = is_rw;
+            info.num_dims = base == "Texture3D" ? u32(3) : u32(2);
+        }
+        resources.push_back(info);
+    }
+    bool ParseTopLevel() {
+        while (Peek().kind != TOKEN_EOF) {
+            if (Accept(";")) continue;
+            if (Accept("struct")) {
+                if (!ParseStruct()) return false;
+                continue;
+            }
+            if (IsNext("groupshared")) return Fail("group shared memory isn't supported by the CPU backend") != invalid;
+            if (IsNext("[")) { // [numthreads(x, y, z)] void main(...)
+                cursor++;
+                if (!IsNext("numthreads")) {
+                    SkipBalanced();
+                    continue;
+                }
+                cursor++;
+                if (!Expect("(")) return false;
+                ifor(3) {
+                    if (Peek().kind != TOKEN_INT) return Fail("expected the group size") != invalid;
+                    group_size[i] = u32(strtoul(GetText(Peek()).c_str(), NULL, 0));
+                    cursor++;
+                    if (i < u32(2) && !Expect(",")) return false;
+                }
+                if (!Expect(")") || !Expect("]") || !Expect("void") || !Expect("main") || !Expect("(")) return false;
+                while (!Accept(")")) {
+                    ValueType type = {};
+                    if (!ParseType(type) || Peek().kind != TOKEN_IDENT) return Fail("unsupported main parameter") != invalid;
+                    std::string name = GetText(Peek());
+                    cursor++;
+                    if (!Expect(":")) return false;
+                    std::string semantic = GetText(Peek());
+                    cursor++;
+                    u32 slot = semantic == "SV_DispatchThreadID" ? tid_slot
+                             : semantic == "SV_GroupThreadID"    ? gid_slot
+                             : semantic == "SV_GroupID"          ? group_id_slot
+                             : semantic == "SV_GroupIndex"       ? group_index_slot
+                                                                 : invalid;
+                    if (slot == invalid) return Fail("unsupported semantic '%s'", semantic.c_str()) != invalid;
+                    scopes.back().vars[name] = {slot, type};
+                    Accept(",");
+                }
+                main_body = ParseBlock();
+                return main_body != invalid;
+            }
+            if (Peek().kind != TOKEN_IDENT) return Fail("unexpected token") != invalid;
+            // Type or Type<T>, then a name
+            u32         start = cursor;
+            std::string kind  = GetText(Peek());
+            ValueType   elem  = {};
+            cursor++;
+            bool is_template = false;
+            if (Accept("<")) {
+                is_template = true;
+                if (!ParseType(elem)) elem = {};
+                while (!Accept(">") && Peek().kind != TOKEN_EOF) cursor++;
+            } else {
+                cursor = start;
+                if (!ParseType(elem)) {
+                    elem = {};
+                    cursor++;
+                }
+            }
+            if (Peek().kind != TOKEN_IDENT) { // MAKE__get_dimensions(f32); and the like
+                cursor = start;
+                while (!IsNext(";") && !IsNext("{") && Peek().kind != TOKEN_EOF) cursor++;
+                if (IsNext("{")) SkipBalanced();
+                continue;
+            }
+            std::string name = GetText(Peek());
+            cursor++;
+            if (IsNext("(")) { // Function definition, parsed at the call sites
+                FunctionDef def = {};
+                def.name        = name;
+                def.ret_type    = start;
+                cursor++;
+                def.params_begin = cursor;
+                cursor--;
+                SkipBalanced();
+                def.params_end = cursor - u32(1);
+                if (Accept(":")) cursor++;
+                if (!IsNext("{")) return Fail("expected a function body") != invalid;
+                def.body_begin = cursor;
+                SkipBalanced();
+                functions[name].push_back(def);
+                continue;
+            }
+            bool is_array = false;
+            if (IsNext("[")) {
+                is_array = true;
+                SkipBalanced();
+            }
+            while (!Accept(";") && Peek().kind != TOKEN_EOF) cursor++; // : register(...)
+            AddResource(kind, elem, name, is_template, is_array);
+        }
+        return Fail("no main function") != invalid;
+    }
+
+    ////////////////////////////////////////////
+    // Execution
+    ////////////////////////////////////////////
+    template <u32 W>
+    static u32 *GetSlot(State<W> &_s, u32 _slot) {
+        return _s.words + size_t(_slot) * size_t(W);
+    }
+    template <u32 W>
+    static u32 GetLaneMask(u32 const *_bools) {
+        u32 m = u32(0);
+        ifor(W) m |= _bools[i] ? (u32(1) << i) : u32(0);
+        return m;
+    }
+    template <u32 W>
+    static void CopyMasked(u32 *_dst, u32 const *_src, u32 _num_words, u32 _mask) {
+        if (_mask == (u32(1) << W) - u32(1)) {
+            memmove(_dst, _src, sizeof(u32) * W * _num_words);
+            return;
+        }
+        ifor(_num_words) jfor(W) if (_mask & (u32(1) << j)) _dst[i * W + j] = _src[i * W + j];
+    }
+    template <u32 W, typename F>
+    static void Map1(u32 *_r, u32 const *_a, u32 _num, F _f) {
+        ifor(_num * W) _r[i] = _f(_a[i]);
+    }
+    template <u32 W, typename F>
+    static void Map2(u32 *_r, u32 const *_a, u32 const *_b, u32 _num, bool _va, bool _vb, F _f) {
+        ifor(_num) {
+            u32 const *a = _a + (_va ? i * W : u32(0));
+            u32 const *b = _b + (_vb ? i * W : u32(0));
+            u32       *r = _r + i * W;
+            jfor(W) r[j] = _f(a[j], b[j]);
+        }
+    }
+    template <u32 W, typename F>
+    static void Map3(u32 *_r, u32 const *_a, u32 const *_b, u32 const *_c, u32 _num, bool _va, bool _vb, bool _vc, F _f) {
+        ifor(_num) {
+            u32 const *a = _a + (_va ? i * W : u32(0));
+            u32 const *b = _b + (_vb ? i * W : u32(0));
+            u32 const *c = _c + (_vc ? i * W : u32(0));
+            u32       *r = _r + i * W;
+            jfor(W) r[j] = _f(a[j], b[j], c[j]);
+        }
+    }
+    template <u32 W, typename F>
+    static void MapF1(u32 *_r, u32 const *_a, u32 _num, F _f) {
+        ifor(_num * W) _r[i] = AsU(_f(AsF(_a[i])));
+    }
+    template <u32 W, typename F>
+    static void MapF2(u32 *_r, u32 const *_a, u32 const *_b, u32 _num, bool _va, bool _vb, F _f) {
+        Map2<W>(_r, _a, _b, _num, _va, _vb, [&](u32 a, u32 b) { return AsU(_f(AsF(a), AsF(b))); });
+    }
+    template <u32 W, typename F>
+    static void MapF3(u32 *_r, u32 const *_a, u32 const *_b, u32 const *_c, u32 _num, bool _va, bool _vb, bool _vc, F _f) {
+        Map3<W>(_r, _a, _b, _c, _num, _va, _vb, _vc, [&](u32 a, u32 b, u32 c) { return AsU(_f(AsF(a), AsF(b), AsF(c))); });
+    }
+    // Word address of every lane, lanes out of bounds of a resource are cleared from _valid
+    template <u32 W>
+    void GetAddresses(State<W> &_s, Place const &_place, u32 *_addr, u32 &_valid) const {
+        ifor(W) _addr[i] = _place.offset;
+        for (auto &step : _place.steps) {
+            u32 const *idx = GetSlot(_s, nodes[step.node].slot);
+            ifor(W) _addr[i] += std::min(idx[i], step.bound - u32(1)) * step.stride;
+        }
+        if (!_place.is_resource) {
+            ifor(W) _addr[i] += _place.root;
+            return;
+        }
+        ResourceInfo const &res = resources[_place.root];
+        if (res.data == NULL) {
+            _valid = u32(0);
+            return;
+        }
+        if (_place.coord == invalid) return;
+        u32 const *coord = GetSlot(_s, nodes[_place.coord].slot);
+        ifor(W) {
+            u64  elem   = u64(0);
+            bool inside = true;
+            for (u32 d = res.num_dims; d-- > u32(0);) {
+                u32 c = coord[d * W + i];
+                inside &= c < res.size[d];
+                elem = elem * u64(res.size[d]) + u64(c);
+            }
+            if (!inside) _valid &= ~(u32(1) << i);
+            _addr[i] += inside ? u32(elem * u64(res.elem_words)) : u32(0);
+        }
+    }
+    template <u32 W>
+    void ExecLoad(State<W> &_s, Node const &_node, u32 _mask) const {
+        Place const &p     = places[_node.place];
+        u32          addr[W];
+        u32          valid = _mask;
+        GetAddresses(_s, p, addr, valid);
+        u32       *dst  = GetSlot(_s, _node.slot);
+        u32 const *base = p.is_resource ? resources[p.root].data : _s.words;
+        u32 const  num  = u32(p.comps.size());
+        if (p.is_resource) {
+            ifor(num) jfor(W) dst[i * W + j] = (valid & (u32(1) << j)) ? base[addr[j] + p.comps[i]] : u32(0);
+        } else {
+            ifor(num) jfor(W) dst[i * W + j] = base[size_t(addr[j] + p.comps[i]) * W + j];
+        }
+    }
+    template <u32 W>
+    void ExecStore(State<W> &_s, Stmt const &_stmt, u32 _mask) const {
+        Place const &p     = places[_stmt.place];
+        u32          addr[W];
+        u32          valid = _mask;
+        GetAddresses(_s, p, addr, valid);
+        u32 const *src = GetSlot(_s, nodes[_stmt.value].slot);
+        u32 const  num = u32(p.comps.size());
+        // Old value for op=, computed in place in a scratch copy
+        u32 scratch[16 * max_lanes];
+        if (_stmt.op != OP_ASSIGN) {
+            sjit_assert(num <= u32(16));
+            bool vb = nodes[_stmt.value].type.GetNumComps() != u32(1);
+            ifor(num) jfor(W) {
+                u32 a              = p.is_resource ? ((valid & (u32(1) << j)) ? resources[p.root].data[addr[j] + p.comps[i]] : u32(0)) : _s.words[size_t(addr[j] + p.comps[i]) * W + j];
+                scratch[i * W + j] = ApplyOp(_stmt.op, p.type.kind, a, src[(vb ? i : u32(0)) * W + j]);
+            }
+            src = scratch;
+        }
+        if (p.is_resource) {
+            u32 *base = resources[p.root].data;
+            ifor(num) jfor(W) if (valid & (u32(1) << j)) base[addr[j] + p.comps[i]] = src[i * W + j];
+        } else {
+            ifor(num) jfor(W) if (valid & (u32(1) << j)) _s.words[size_t(addr[j] + p.comps[i]) * W + j] = src[i * W + j];
+        }
+    }
+    // Scalar fallback for op= stores
+    static u32 ApplyOp(OpType _op, ValueKind _kind, u32 _a, u32 _b) {
+        switch (_op) {
+        case OP_PLUS_ASSIGN: _op = OP_PLUS; break;
+        case OP_MINUS_ASSIGN: _op = OP_MINUS; break;
+        case OP_MUL_ASSIGN: _op = OP_MUL; break;
+        case OP_DIV_ASSIGN: _op = OP_DIV; break;
+        case OP_BIT_OR_ASSIGN: _op = OP_BIT_OR; break;
+        case OP_BIT_AND_ASSIGN: _op = OP_BIT_AND; break;
+        case OP_BIT_XOR_ASSIGN: _op = OP_BIT_XOR; break;
+        default: break;
+        }
+        return BinaryOp(_op, _kind, _a, _b);
+    }
+    static u32 BinaryOp(OpType _op, ValueKind _kind, u32 a, u32 b) {
+        if (_kind == VALUE_F32) {
+            f32 x = AsF(a);
+            f32 y = AsF(b);
+            switch (_op) {
+            case OP_PLUS: return AsU(x + y);
+            case OP_MINUS: return AsU(x - y);
+            case OP_MUL: return AsU(x * y);
+            case OP_DIV: return AsU(x / y);
+            case OP_MODULO: return AsU(std::fmod(x, y));
+            case OP_LESS: return u32(x < y);
+            case OP_LESS_OR_EQUAL: return u32(x <= y);
+            case OP_GREATER: return u32(x > y);
+            case OP_GREATER_OR_EQUAL: return u32(x >= y);
+            case OP_EQUAL: return u32(x == y);
+            case OP_NOT_EQUAL: return u32(x != y);
+            default: return u32(0);
+            }
+        }
+        bool is_signed = _kind == VALUE_I32;
+        switch (_op) {
+        case OP_PLUS: return a + b;
+        case OP_MINUS: return a - b;
+        case OP_MUL: return a * b;
+        // Division by zero gives all ones like on D3D hardware
+        case OP_DIV: return b == u32(0) ? u32(-1) : is_signed ? (i32(b) == i32(-1) ? u32(0) - a : u32(i32(a) / i32(b))) : a / b;
+        case OP_MODULO: return b == u32(0) ? u32(-1) : is_signed ? (i32(b) == i32(-1) ? u32(0) : u32(i32(a) % i32(b))) : a % b;
+        case OP_LESS: return is_signed ? u32(i32(a) < i32(b)) : u32(a < b);
+        case OP_LESS_OR_EQUAL: return is_signed ? u32(i32(a) <= i32(b)) : u32(a <= b);
+        case OP_GREATER: return is_signed ? u32(i32(a) > i32(b)) : u32(a > b);
+        case OP_GREATER_OR_EQUAL: return is_signed ? u32(i32(a) >= i32(b)) : u32(a >= b);
+        case OP_EQUAL: return u32(a == b);
+        case OP_NOT_EQUAL: return u32(a != b);
+        case OP_BIT_AND: return a & b;
+        case OP_BIT_OR: return a | b;
+        case OP_BIT_XOR: return a ^ b;
+        case OP_LOGICAL_AND: return u32(a && b);
+        case OP_LOGICAL_OR: return u32(a || b);
+        case OP_SHIFT_LEFT: return a << (b & u32(31));
+        case OP_SHIFT_RIGHT: return is_signed ? u32(i32(a) >> i32(b & u32(31))) : a >> (b & u32(31));
+        default: return u32(0);
+        }
+    }
+    template <u32 W>
+    void ExecBinary(State<W> &_s, Node const &_node) const {
+        Node const &a    = nodes[_node.args[0]];
+        Node const &b    = nodes[_node.args[1]];
+        u32        *r    = GetSlot(_s, _node.slot);
+        u32 const  *pa   = GetSlot(_s, a.slot);
+        u32 const  *pb   = GetSlot(_s, b.slot);
+        u32         num  = _node.type.GetNumComps();
+        bool        va   = a.type.GetNumComps() != u32(1);
+        bool        vb   = b.type.GetNumComps() != u32(1);
+        ValueKind   kind = a.type.kind;
+        OpType      op   = OpType(_node.op);
+        // The common float and integer ops get their own loops, the rest goes through BinaryOp
+        if (kind == VALUE_F32) {
+            switch (op) {
+            case OP_PLUS: MapF2<W>(r, pa, pb, num, va, vb, [](f32 x, f32 y) { return x + y; }); return;
+            case OP_MINUS: MapF2<W>(r, pa, pb, num, va, vb, [](f32 x, f32 y) { return x - y; }); return;
+            case OP_MUL: MapF2<W>(r, pa, pb, num, va, vb, [](f32 x, f32 y) { return x * y; }); return;
+            case OP_DIV: MapF2<W>(r, pa, pb, num, va, vb, [](f32 x, f32 y) { return x / y; }); return;
+            case OP_LESS: Map2<W>(r, pa, pb, num, va, vb, [](u32 x, u32 y) { return u32(AsF(x) < AsF(y)); }); return;
+            case OP_GREATER: Map2<W>(r, pa, pb, num, va, vb, [](u32 x, u32 y) { return u32(AsF(x) > AsF(y)); }); return;
+            default: break;
+            }
+        } else {
+            switch (op) {
+            case OP_PLUS: Map2<W>(r, pa, pb, num, va, vb, [](u32 x, u32 y) { return x + y; }); return;
+            case OP_MINUS: Map2<W>(r, pa, pb, num, va, vb, [](u32 x, u32 y) { return x - y; }); return;
+            case OP_MUL: Map2<W>(r, pa, pb, num, va, vb, [](u32 x, u32 y) { return x * y; }); return;
+            case OP_BIT_AND: Map2<W>(r, pa, pb, num, va, vb, [](u32 x, u32 y) { return x & y; }); return;
+            case OP_BIT_OR: Map2<W>(r, pa, pb, num, va, vb, [](u32 x, u32 y) { return x | y; }); return;
+            case OP_EQUAL: Map2<W>(r, pa, pb, num, va, vb, [](u32 x, u32 y) { return u32(x == y); }); return;
+            case OP_NOT_EQUAL: Map2<W>(r, pa, pb, num, va, vb, [](u32 x, u32 y) { return u32(x != y); }); return;
+            case OP_LOGICAL_AND: Map2<W>(r, pa, pb, num, va, vb, [](u32 x, u32 y) { return u32(x && y); }); return;
+            case OP_LOGICAL_OR: Map2<W>(r, pa, pb, num, va, vb, [](u32 x, u32 y) { return u32(x || y); }); return;
+            case OP_SHIFT_LEFT: Map2<W>(r, pa, pb, num, va, vb, [](u32 x, u32 y) { return x << (y & u32(31)); }); return;
+            case OP_MODULO:
+                if (kind != VALUE_U32) break;
+                Map2<W>(r, pa, pb, num, va, vb, [](u32 x, u32 y) { return y == u32(0) ? u32(-1) : x % y; });
+                return;
+            case OP_LESS:
+                if (kind != VALUE_U32) break;
+                Map2<W>(r, pa, pb, num, va, vb, [](u32 x, u32 y) { return u32(x < y); });
+                return;
+            default: break;
+            }
+        }
+        Map2<W>(r, pa, pb, num, va, vb, [&](u32 x, u32 y) { return BinaryOp(op, kind, x, y); });
+    }
+    template <u32 W>
+    void ExecUnary(State<W> &_s, Node const &_node) const {
+        u32       *r   = GetSlot(_s, _node.slot);
+        u32 const *a   = GetSlot(_s, nodes[_node.args[0]].slot);
+        u32        num = _node.type.GetNumComps();
+        switch (OpType(_node.op)) {
+        case OP_MINUS:
+            if (_node.type.kind == VALUE_F32)
+                Map1<W>(r, a, num, [](u32 x) { return x ^ u32(0x80000000); });
+            else
+                Map1<W>(r, a, num, [](u32 x) { return u32(0) - x; });
+            break;
+        case OP_LOGICAL_NOT: Map1<W>(r, a, num, [](u32 x) { return u32(x == u32(0)); }); break;
+        case OP_BIT_NEG: Map1<W>(r, a, num, [](u32 x) { return ~x; }); break;
+        default: SJIT_UNIMPLEMENTED;
+        }
+    }
+    template <u32 W>
+    void ExecIntrinsic(State<W> &_s, Node const &_node, u32 _mask) const {
+        u32       *r   = GetSlot(_s, _node.slot);
+        u32        num = _node.type.GetNumComps();
+        u32 const *a   = _node.args.size() > size_t(0) ? GetSlot(_s, nodes[_node.args[0]].slot) : NULL;
+        u32 const *b   = _node.args.size() > size_t(1) ? GetSlot(_s, nodes[_node.args[1]].slot) : NULL;
+        u32 const *c   = _node.args.size() > size_t(2) ? GetSlot(_s, nodes[_node.args[2]].slot) : NULL;
+        bool       va  = _node.args.size() > size_t(0) && nodes[_node.args[0]].type.GetNumComps() != u32(1);
+        bool       vb  = _node.args.size() > size_t(1) && nodes[_node.args[1]].type.GetNumComps() != u32(1);
+        bool       vc  = _node.args.size() > size_t(2) && nodes[_node.args[2]].type.GetNumComps() != u32(1);
+        u32        an  = _node.args.size() > size_t(0) ? nodes[_node.args[0]].type.GetNumComps() : u32(0);
+        ValueKind  kind = _node.args.size() > size_t(0) ? nodes[_node.args[0]].type.kind : VALUE_VOID;
+        auto       lane_bits = [&](u32 const *_bools) { return GetLaneMask<W>(_bools) & _mask; };
+        switch (Intrinsic(_node.op)) {
+        case INTRINSIC_SIN: MapF1<W>(r, a, num, [](f32 x) { return std::sin(x); }); break;
+        case INTRINSIC_COS: MapF1<W>(r, a, num, [](f32 x) { return std::cos(x); }); break;
+        case INTRINSIC_TAN: MapF1<W>(r, a, num, [](f32 x) { return std::tan(x); }); break;
+        case INTRINSIC_ASIN: MapF1<W>(r, a, num, [](f32 x) { return std::asin(x); }); break;
+        case INTRINSIC_ACOS: MapF1<W>(r, a, num, [](f32 x) { return std::acos(x); }); break;
+        case INTRINSIC_ATAN: MapF1<W>(r, a, num, [](f32 x) { return std::atan(x); }); break;
+        case INTRINSIC_EXP: MapF1<W>(r, a, num, [](f32 x) { return std::exp(x); }); break;
+        case INTRINSIC_EXP2: MapF1<W>(r, a, num, [](f32 x) { return std::exp2(x); }); break;
+        case INTRINSIC_LOG: MapF1<W>(r, a, num, [](f32 x) { return std::log(x); }); break;
+        case INTRINSIC_LOG2: MapF1<W>(r, a, num, [](f32 x) { return std::log2(x); }); break;
+        case INTRINSIC_SQRT: MapF1<W>(r, a, num, [](f32 x) { return std::sqrt(x); }); break;
+        case INTRINSIC_RSQRT: MapF1<W>(r, a, num, [](f32 x) { return f32(1.0) / std::sqrt(x); }); break;
+        case INTRINSIC_RCP: MapF1<W>(r, a, num, [](f32 x) { return f32(1.0) / x; }); break;
+        case INTRINSIC_FRAC: MapF1<W>(r, a, num, [](f32 x) { return x - std::floor(x); }); break;
+        case INTRINSIC_FLOOR: MapF1<W>(r, a, num, [](f32 x) { return std::floor(x); }); break;
+        case INTRINSIC_CEIL: MapF1<W>(r, a, num, [](f32 x) { return std::ceil(x); }); break;
+        case INTRINSIC_ROUND: MapF1<W>(r, a, num, [](f32 x) { return std::nearbyint(x); }); break;
+        case INTRINSIC_TRUNC: MapF1<W>(r, a, num, [](f32 x) { return std::trunc(x); }); break;
+        case INTRINSIC_SATURATE: MapF1<W>(r, a, num, [](f32 x) { return std::min(std::max(x, f32(0.0)), f32(1.0)); }); break;
+        case INTRINSIC_POW: MapF2<W>(r, a, b, num, va, vb, [](f32 x, f32 y) { return std::pow(x, y); }); break;
+        case INTRINSIC_ATAN2: MapF2<W>(r, a, b, num, va, vb, [](f32 x, f32 y) { return std::atan2(x, y); }); break;
+        case INTRINSIC_FMOD: MapF2<W>(r, a, b, num, va, vb, [](f32 x, f32 y) { return std::fmod(x, y); }); break;
+        case INTRINSIC_STEP: MapF2<W>(r, a, b, num, va, vb, [](f32 x, f32 y) { return y >= x ? f32(1.0) : f32(0.0); }); break;
+        case INTRINSIC_LERP: MapF3<W>(r, a, b, c, num, va, vb, vc, [](f32 x, f32 y, f32 t) { return x + (y - x) * t; }); break;
+        case INTRINSIC_SMOOTHSTEP:
+            MapF3<W>(r, a, b, c, num, va, vb, vc, [](f32 e0, f32 e1, f32 x) {
+                f32 t = std::min(std::max((x - e0) / (e1 - e0), f32(0.0)), f32(1.0));
+                return t * t * (f32(3.0) - f32(2.0) * t);
+            });
+            break;
+        case INTRINSIC_ABS:
+            if (kind == VALUE_F32)
+                Map1<W>(r, a, num, [](u32 x) { return x & u32(0x7fffffff); });
+            else if (kind == VALUE_I32)
+                Map1<W>(r, a, num, [](u32 x) { return i32(x) < i32(0) ? u32(0) - x : x; });
+            else
+                Map1<W>(r, a, num, [](u32 x) { return x; });
+            break;
+        case INTRINSIC_SIGN:
+            Map1<W>(r, a, num, [&](u32 x) {
+                if (kind == VALUE_F32) return AsF(x) > f32(0.0) ? u32(1) : AsF(x) < f32(0.0) ? u32(-1) : u32(0);
+                if (kind == VALUE_I32) return i32(x) > i32(0) ? u32(1) : i32(x) < i32(0) ? u32(-1) : u32(0);
+                return x ? u32(1) : u32(0);
+            });
+            break;
+        case INTRINSIC_MIN:
+        case INTRINSIC_MAX: {
+            bool is_min = Intrinsic(_node.op) == INTRINSIC_MIN;
+            Map2<W>(r, a, b, num, va, vb, [&](u32 x, u32 y) {
+                bool less = BinaryOp(OP_LESS, kind, x, y) != u32(0);
+                if (kind == VALUE_F32 && AsF(x) != AsF(x)) return y; // NaN loses
+                if (kind == VALUE_F32 && AsF(y) != AsF(y)) return x;
+                return less == is_min ? x : y;
+            });
+            break;
+        }
+        case INTRINSIC_CLAMP:
+            Map3<W>(r, a, b, c, num, va, vb, vc, [&](u32 x, u32 lo, u32 hi) {
+                if (BinaryOp(OP_LESS, kind, x, lo)) x = lo;
+                if (BinaryOp(OP_GREATER, kind, x, hi)) x = hi;
+                return x;
+            });
+            break;
+        case INTRINSIC_MAD: Map3<W>(r, a, b, c, num, va, vb, vc, [&](u32 x, u32 y, u32 z) { return BinaryOp(OP_PLUS, kind, BinaryOp(OP_MUL, kind, x, y), z); }); break;
+        case INTRINSIC_ISNAN: Map1<W>(r, a, num, [](u32 x) { return u32(AsF(x) != AsF(x)); }); break;
+        case INTRINSIC_ISINF: Map1<W>(r, a, num, [](u32 x) { return u32((x & u32(0x7fffffff)) == u32(0x7f800000)); }); break;
+        case INTRINSIC_DOT:
+        case INTRINSIC_LENGTH:
+        case INTRINSIC_DISTANCE:
+        case INTRINSIC_NORMALIZE: {
+            Intrinsic op = Intrinsic(_node.op);
+            jfor(W) {
+                f32 sum = f32(0.0);
+                ifor(an) {
+                    f32 x = AsF(a[i * W + j]);
+                    f32 y = op == INTRINSIC_DOT ? AsF(b[(vb ? i : u32(0)) * W + j]) : op == INTRINSIC_DISTANCE ? x - AsF(b[(vb ? i : u32(0)) * W + j]) : x;
+                    if (op == INTRINSIC_DISTANCE) x = y;
+                    sum += x * y;
+                }
+                if (op == INTRINSIC_DOT)
+                    r[j] = AsU(sum);
+                else if (op == INTRINSIC_NORMALIZE) {
+                    f32 inv = f32(1.0) / std::sqrt(sum);
+                    ifor(num) r[i * W + j] = AsU(AsF(a[i * W + j]) * inv);
+                } else
+                    r[j] = AsU(std::sqrt(sum));
+            }
+            break;
+        }
+        case INTRINSIC_CROSS:
+            jfor(W) {
+                f32 x0 = AsF(a[0 * W + j]), x1 = AsF(a[1 * W + j]), x2 = AsF(a[2 * W + j]);
+                f32 y0 = AsF(b[0 * W + j]), y1 = AsF(b[1 * W + j]), y2 = AsF(b[2 * W + j]);
+                r[0 * W + j] = AsU(x1 * y2 - x2 * y1);
+                r[1 * W + j] = AsU(x2 * y0 - x0 * y2);
+                r[2 * W + j] = AsU(x0 * y1 - x1 * y0);
+            }
+            break;
+        case INTRINSIC_REFLECT:
+            jfor(W) {
+                f32 d = f32(0.0);
+                ifor(num) d += AsF(a[i * W + j]) * AsF(b[i * W + j]);
+                ifor(num) r[i * W + j] = AsU(AsF(a[i * W + j]) - f32(2.0) * d * AsF(b[i * W + j]));
+            }
+            break;
+        case INTRINSIC_ANY:
+        case INTRINSIC_ALL:
+            jfor(W) {
+                bool any = false;
+                bool all = true;
+                ifor(an) {
+                    any |= a[i * W + j] != u32(0);
+                    all &= a[i * W + j] != u32(0);
+                }
+                r[j] = u32(Intrinsic(_node.op) == INTRINSIC_ANY ? any : all);
+            }
+            break;
+        case INTRINSIC_COUNTBITS: Map1<W>(r, a, num, [](u32 x) { return CountBits(x); }); break;
+        case INTRINSIC_FIRSTBITHIGH: Map1<W>(r, a, num, [](u32 x) { return FirstBitHigh(x); }); break;
+        case INTRINSIC_FIRSTBITLOW: Map1<W>(r, a, num, [](u32 x) { return FirstBitLow(x); }); break;
+        case INTRINSIC_REVERSEBITS:
+            Map1<W>(r, a, num, [](u32 x) {
+                u32 y = u32(0);
+                ifor(32) y |= ((x >> i) & u32(1)) << (u32(31) - i);
+                return y;
+            });
+            break;
+        case INTRINSIC_ASF32:
+        case INTRINSIC_ASU32:
+        case INTRINSIC_ASI32:
+        case INTRINSIC_IDENTITY: memcpy(r, a, sizeof(u32) * W * GetWords(_node.type)); break;
+        case INTRINSIC_F32TOF16: Map1<W>(r, a, num, [](u32 x) { return u32(half_float::detail::float2half<std::round_to_nearest>(AsF(x))); }); break;
+        case INTRINSIC_F16TOF32: Map1<W>(r, a, num, [](u32 x) { return AsU(half_float::detail::half2float<f32>(half_float::detail::uint16(x))); }); break;
+        case INTRINSIC_MUL: {
+            ValueType const &ta = nodes[_node.args[0]].type;
+            ValueType const &tb = nodes[_node.args[1]].type;
+            u32              k  = ta.cols;
+            u32              rr = ta.IsMatrix() ? ta.rows : u32(1);
+            u32              rc = tb.IsMatrix() ? tb.cols : u32(1);
+            ValueKind        mk = ta.kind;
+            jfor(W) for (u32 i = u32(0); i < rr; i++) for (u32 o = u32(0); o < rc; o++) {
+                u32 acc = mk == VALUE_F32 ? AsU(f32(0.0)) : u32(0);
+                for (u32 t = u32(0); t < k; t++) {
+                    u32 x = a[(i * ta.cols + t) * W + j];
+                    u32 y = b[(tb.IsMatrix() ? t * tb.cols + o : t) * W + j];
+                    acc   = BinaryOp(OP_PLUS, mk, acc, BinaryOp(OP_MUL, mk, x, y));
+                }
+                r[(i * rc + o) * W + j] = acc;
+            }
+            break;
+        }
+        case INTRINSIC_TRANSPOSE: {
+            ValueType const &ta = nodes[_node.args[0]].type;
+            for (u32 i = u32(0); i < ta.rows; i++)
+                for (u32 o = u32(0); o < ta.cols; o++) memcpy(r + (o * ta.rows + i) * W, a + (i * ta.cols + o) * W, sizeof(u32) * W);
+            break;
+        }
+        case INTRINSIC_LANE_INDEX: memcpy(r, GetSlot(_s, lane_index_slot), sizeof(u32) * W); break;
+        case INTRINSIC_LANE_COUNT: jfor(W) r[j] = W; break;
+        case INTRINSIC_LANE_BIT: jfor(W) r[j] = u32(1) << j; break;
+        case INTRINSIC_IS_FIRST_LANE: jfor(W) r[j] = u32(j == FirstBitLow(_mask)); break;
+        case INTRINSIC_BALLOT: {
+            u32 bits = lane_bits(a);
+            jfor(W) {
+                r[0 * W + j] = bits;
+                r[1 * W + j] = r[2 * W + j] = r[3 * W + j] = u32(0);
+            }
+            break;
+        }
+        case INTRINSIC_ACTIVE_COUNT_BITS: {
+            u32 bits = CountBits(lane_bits(a));
+            jfor(W) r[j] = bits;
+            break;
+        }
+        case INTRINSIC_ACTIVE_ANY_TRUE: {
+            u32 any = u32(lane_bits(a) != u32(0));
+            jfor(W) r[j] = any;
+            break;
+        }
+        case INTRINSIC_ACTIVE_ALL_TRUE: {
+            u32 all = u32(lane_bits(a) == _mask);
+            jfor(W) r[j] = all;
+            break;
+        }
+        case INTRINSIC_PREFIX_COUNT_BITS: {
+            u32 bits = lane_bits(a);
+            jfor(W) r[j] = CountBits(bits & ((u32(1) << j) - u32(1)));
+            break;
+        }
+        case INTRINSIC_READ_LANE_FIRST: {
+            u32 first = _mask ? FirstBitLow(_mask) : u32(0);
+            ifor(GetWords(_node.type)) jfor(W) r[i * W + j] = a[i * W + first];
+            break;
+        }
+        case INTRINSIC_ACTIVE_SUM:
+        case INTRINSIC_ACTIVE_MIN:
+        case INTRINSIC_ACTIVE_MAX:
+        case INTRINSIC_PREFIX_SUM: {
+            Intrinsic op = Intrinsic(_node.op);
+            ifor(num) {
+                u32  acc     = kind == VALUE_F32 ? AsU(f32(0.0)) : u32(0);
+                bool has_acc = op == INTRINSIC_ACTIVE_SUM || op == INTRINSIC_PREFIX_SUM;
+                u32  out[W];
+                jfor(W) {
+                    out[j] = acc;
+                    if (!(_mask & (u32(1) << j))) continue;
+                    u32 x = a[i * W + j];
+                    if (op == INTRINSIC_ACTIVE_SUM || op == INTRINSIC_PREFIX_SUM)
+                        acc = BinaryOp(OP_PLUS, kind, acc, x);
+                    else if (!has_acc || (BinaryOp(OP_LESS, kind, x, acc) != u32(0)) == (op == INTRINSIC_ACTIVE_MIN))
+                        acc = x;
+                    has_acc = true;
+                }
+                jfor(W) r[i * W + j] = op == INTRINSIC_PREFIX_SUM ? out[j] : acc;
+            }
+            break;
+        }
+        default: SJIT_UNIMPLEMENTED;
+        }
+    }
+    template <u32 W>
+    void ExecSample(State<W> &_s, Node const &_node) const {
+        ResourceInfo const &res = resources[_node.op];
+        u32                *r   = GetSlot(_s, _node.slot);
+        u32 const          *uv  = GetSlot(_s, nodes[_node.args[0]].slot);
+        u32                 num = _node.type.GetNumComps();
+        if (res.data == NULL || res.size[0] == u32(0) || res.size[1] == u32(0)) {
+            memset(r, 0, sizeof(u32) * W * num);
+            return;
+        }
+        jfor(W) {
+            f32 x  = AsF(uv[j]) * f32(res.size[0]) - f32(0.5);
+            f32 y  = AsF(uv[W + j]) * f32(res.size[1]) - f32(0.5);
+            f32 fx = std::floor(x);
+            f32 fy = std::floor(y);
+            f32 tx = x - fx;
+            f32 ty = y - fy;
+            auto texel = [&](f32 _x, f32 _y, u32 _c) {
+                i32 ix = std::min(std::max(i32(_x), i32(0)), i32(res.size[0]) - i32(1));
+                i32 iy = std::min(std::max(i32(_y), i32(0)), i32(res.size[1]) - i32(1));
+                return AsF(res.data[(u32(iy) * res.size[0] + u32(ix)) * res.elem_words + _c]);
+            };
+            ifor(num) {
+                f32 top    = texel(fx, fy, i) * (f32(1.0) - tx) + texel(fx + f32(1.0), fy, i) * tx;
+                f32 bottom = texel(fx, fy + f32(1.0), i) * (f32(1.0) - tx) + texel(fx + f32(1.0), fy + f32(1.0), i) * tx;
+                r[i * W + j] = AsU(top * (f32(1.0) - ty) + bottom * ty);
+            }
+        }
+    }
+    template <u32 W>
+    void ExecNode(State<W> &_s, u32 _node, u32 _mask) const {
+        Node const &n = nodes[_node];
+        switch (n.kind) {
+        case NODE_LOAD: ExecLoad(_s, n, _mask); break;
+        case NODE_SWIZZLE: {
+            u32       *r = GetSlot(_s, n.slot);
+            u32 const *a = GetSlot(_s, nodes[n.args[0]].slot);
+            ifor(n.comps.size()) memcpy(r + i * W, a + n.comps[i] * W, sizeof(u32) * W);
+            break;
+        }
+        case NODE_CONVERT: {
+            u32       *r    = GetSlot(_s, n.slot);
+            u32 const *a    = GetSlot(_s, nodes[n.args[0]].slot);
+            bool       va   = nodes[n.args[0]].type.GetNumComps() != u32(1);
+            ValueKind  from = ValueKind(n.op);
+            ValueKind  to   = n.type.kind;
+            ifor(n.type.GetNumComps()) {
+                u32 const *src = a + (va ? i * W : u32(0));
+                if (from == VALUE_I32 && to == VALUE_F32)
+                    jfor(W) r[i * W + j] = AsU(f32(i32(src[j])));
+                else if (from == VALUE_U32 && to == VALUE_F32)
+                    jfor(W) r[i * W + j] = AsU(f32(src[j]));
+                else
+                    jfor(W) r[i * W + j] = ConvertWord(src[j], from, to);
+            }
+            break;
+        }
+        case NODE_UNARY: ExecUnary(_s, n); break;
+        case NODE_BINARY: ExecBinary(_s, n); break;
+        case NODE_SELECT: {
+            u32       *r  = GetSlot(_s, n.slot);
+            u32 const *c  = GetSlot(_s, nodes[n.args[0]].slot);
+            u32 const *a  = GetSlot(_s, nodes[n.args[1]].slot);
+            u32 const *b  = GetSlot(_s, nodes[n.args[2]].slot);
+            bool       vc = nodes[n.args[0]].type.GetNumComps() != u32(1);
+            ifor(GetWords(n.type)) jfor(W) r[i * W + j] = c[(vc ? i : u32(0)) * W + j] ? a[i * W + j] : b[i * W + j];
+            break;
+        }
+        case NODE_CONSTRUCT: {
+            u32 *r = GetSlot(_s, n.slot);
+            for (u32 a : n.args) {
+                u32 words = nodes[a].type.GetNumComps();
+                memcpy(r, GetSlot(_s, nodes[a].slot), sizeof(u32) * W * words);
+                r += words * W;
+            }
+            break;
+        }
+        case NODE_INTRINSIC: ExecIntrinsic(_s, n, _mask); break;
+        case NODE_CALL: {
+            Call const &call = calls[n.op];
+            ifor(call.params.size()) CopyMasked<W>(GetSlot(_s, call.params[i]), GetSlot(_s, nodes[n.args[i]].slot), GetWords(nodes[n.args[i]].type), _mask);
+            u32 saved_ret = _s.ret;
+            _s.ret        = u32(0);
+            ExecBlock(_s, call.body, _mask);
+            _s.ret = saved_ret;
+            ifor(call.params.size()) {
+                if (call.out_places[i] == invalid) continue;
+                CopyOut(_s, call.out_places[i], call.params[i], _mask);
+            }
+            break;
+        }
+        case NODE_DIMENSIONS: {
+            ResourceInfo const &res = resources[n.op];
+            u32                *r   = GetSlot(_s, n.slot);
+            ifor(res.num_dims) jfor(W) r[i * W + j] = res.size[i];
+            break;
+        }
+        case NODE_SAMPLE: ExecSample(_s, n); break;
+        default: break;
+        }
+    }
+    template <u32 W>
+    void CopyOut(State<W> &_s, u32 _place, u32 _slot, u32 _mask) const {
+        Place const &p     = places[_place];
+        u32          addr[W];
+        u32          valid = _mask;
+        GetAddresses(_s, p, addr, valid);
+        u32 const *src = GetSlot(_s, _slot);
+        ifor(p.comps.size()) jfor(W) {
+            if (!(valid & (u32(1) << j))) continue;
+            if (p.is_resource)
+                resources[p.root].data[addr[j] + p.comps[i]] = src[i * W + j];
+            else
+                _s.words[size_t(addr[j] + p.comps[i]) * W + j] = src[i * W + j];
+        }
+    }
+    template <u32 W>
+    void ExecCode(State<W> &_s, Array<u32> const &_code, u32 _mask) const {
+        for (u32 n : _code) ExecNode(_s, n, _mask);
+    }
+    // Returns the lanes that get to the next statement
+    template <u32 W>
+    u32 ExecStmt(State<W> &_s, u32 _stmt, u32 _mask) const {
+        Stmt const &stmt = stmts[_stmt];
+        switch (stmt.kind) {
+        case STMT_CODE: ExecCode(_s, stmt.code, _mask); return _mask;
+        case STMT_STORE:
+            ExecCode(_s, stmt.code, _mask);
+            ExecStore(_s, stmt, _mask);
+            return _mask;
+        case STMT_BLOCK: return ExecBlock(_s, stmt.body, _mask);
+        case STMT_IF: {
+            ExecCode(_s, stmt.code, _mask);
+            u32 cond      = GetLaneMask<W>(GetSlot(_s, nodes[stmt.value].slot));
+            u32 then_mask = _mask & cond;
+            u32 else_mask = _mask & ~cond;
+            u32 result    = u32(0);
+            if (then_mask) result |= ExecBlock(_s, stmt.body, then_mask);
+            if (else_mask) result |= stmt.else_body != invalid ? ExecBlock(_s, stmt.else_body, else_mask) : else_mask;
+            return result;
+        }
+        case STMT_LOOP: {
+            u32 saved_brk  = _s.brk;
+            u32 saved_cont = _s.cont;
+            _s.brk         = u32(0);
+            u32 active     = _mask;
+            u32 exited     = u32(0);
+            for (;;) {
+                ExecCode(_s, stmt.code, active);
+                u32 cond = GetLaneMask<W>(GetSlot(_s, nodes[stmt.value].slot));
+                exited |= active & ~cond;
+                active &= cond;
+                if (!active) break;
+                _s.cont = u32(0);
+                active  = ExecBlock(_s, stmt.body, active) | _s.cont;
+                if (!active) break;
+                if (stmt.step != invalid) active = ExecBlock(_s, stmt.step, active);
+            }
+            u32 result = exited | _s.brk;
+            _s.brk     = saved_brk;
+            _s.cont    = saved_cont;
+            return result;
+        }
+        case STMT_SWITCH: {
+            ExecCode(_s, stmt.code, _mask);
+            u32 const *value     = GetSlot(_s, nodes[stmt.value].slot);
+            u32        matched   = u32(0);
+            bool       has_default = false;
+            u32        case_mask[64];
+            sjit_assert(stmt.cases.size() <= size_t(64));
+            ifor(stmt.cases.size()) {
+                case_mask[i] = u32(0);
+                if (stmt.cases[i].is_default) {
+                    has_default = true;
+                    continue;
+                }
+                jfor(W) if (value[j] == u32(stmt.cases[i].label)) case_mask[i] |= u32(1) << j;
+                case_mask[i] &= _mask & ~matched;
+                matched |= case_mask[i];
+            }
+            ifor(stmt.cases.size()) if (stmt.cases[i].is_default) case_mask[i] = _mask & ~matched;
+            u32 saved_brk         = _s.brk;
+            _s.brk                = u32(0);
+            u32               running = u32(0);
+            Array<u32> const &body    = blocks[stmt.body];
+            u32               next    = u32(0);
+            // Case positions only grow, lanes join at their label and lanes that broke out drop off
+            for (u32 pos = u32(0);;) {
+                while (next < u32(stmt.cases.size()) && stmt.cases[next].position == pos) running |= case_mask[next++];
+                if (pos == u32(body.size())) break;
+                if (!running) {
+                    if (next == u32(stmt.cases.size())) break;
+                    pos = stmt.cases[next].position;
+                    continue;
+                }
+                running = ExecStmt(_s, body[pos], running);
+                pos++;
+            }
+            u32 result = running | _s.brk | (has_default ? u32(0) : _mask & ~matched);
+            _s.brk     = saved_brk;
+            return result;
+        }
+        case STMT_BREAK: _s.brk |= _mask; return u32(0);
+        case STMT_CONTINUE: _s.cont |= _mask; return u32(0);
+        case STMT_RETURN:
+            if (stmt.value != invalid) {
+                ExecCode(_s, stmt.code, _mask);
+                CopyMasked<W>(GetSlot(_s, stmt.ret_slot), GetSlot(_s, nodes[stmt.value].slot), GetWords(nodes[stmt.value].type), _mask);
+            }
+            _s.ret |= _mask;
+            return u32(0);
+        default: SJIT_UNIMPLEMENTED;
+        }
+        return _mask;
+    }
+    template <u32 W>
+    u32 ExecBlock(State<W> &_s, u32 _block, u32 _mask) const {
+        for (u32 stmt : blocks[_block]) {
+            if (!_mask) break;
+            _mask = ExecStmt(_s, stmt, _mask);
+        }
+        return _mask;
+    }
+    template <u32 W>
+    void DispatchLanes(u32x3 _num_groups) const {
+        u32              total       = _num_groups.x * _num_groups.y * _num_groups.z;
+        u32              group_count = group_size.x * group_size.y * group_size.z;
+        std::atomic<u32> next        = {u32(0)};
+        auto             worker      = [&] {
+            Array<u32> words = Array<u32>(size_t(num_words) * size_t(W));
+            for (auto &c : constants) ifor(c.second.size()) jfor(W) words[size_t(c.first + i) * W + j] = c.second[i];
+            State<W> s = {};
+            s.words    = words.data();
+            jfor(W) GetSlot(s, lane_index_slot)[j] = j;
+            for (;;) {
+                u32 g = next.fetch_add(u32(1));
+                if (g >= total) break;
+                u32x3 group_id = u32x3(g % _num_groups.x, (g / _num_groups.x) % _num_groups.y, g / (_num_groups.x * _num_groups.y));
+                for (u32 first = u32(0); first < group_count; first += W) {
+                    u32  mask        = u32(0);
+                    u32 *tid         = GetSlot(s, tid_slot);
+                    u32 *gid         = GetSlot(s, gid_slot);
+                    u32 *gr          = GetSlot(s, group_id_slot);
+                    u32 *group_index = GetSlot(s, group_index_slot);
+                    jfor(W) {
+                        u32   flat  = std::min(first + j, group_count - u32(1));
+                        u32x3 local = u32x3(flat % group_size.x, (flat / group_size.x) % group_size.y, flat / (group_size.x * group_size.y));
+                        ifor(3) {
+                            gid[i * W + j] = local[i];
+                            gr[i * W + j]  = group_id[i];
+                            tid[i * W + j] = group_id[i] * group_size[i] + local[i];
+                        }
+                        group_index[j] = flat;
+                        if (first + j < group_count) mask |= u32(1) << j;
+                    }
+                    s.brk = s.cont = s.ret = u32(0);
+                    ExecBlock(s, main_body, mask);
+                }
+            }
+        };
+        u32 num_workers = num_threads ? num_threads : std::max(u32(std::thread::hardware_concurrency()), u32(1));
+        num_workers     = std::min(num_workers, total);
+        Array<std::thread> threads = {};
+        for (u32 i = u32(1); i < num_workers; i++) threads.push_back(std::thread(worker));
+        worker();
+        for (auto &t : threads) t.join();
+    }
+
+public:
+    CPUKernel() = default;
+    SJIT_DONT_MOVE(CPUKernel);
+
+    // Text from HLSLModule::Finalize, false with GetError() set if the kernel uses something the backend can't run
+    bool Compile(char const *_text) {
+        error            = {};
+        structs          = {};
+        resources        = {};
+        functions        = {};
+        scopes           = {};
+        fn_stack         = {};
+        nodes            = {};
+        places           = {};
+        calls            = {};
+        stmts            = {};
+        blocks           = {};
+        constants        = {};
+        num_words        = u32(0);
+        main_body        = invalid;
+        group_size       = u32x3(1, 1, 1);
+        cursor           = u32(0);
+        text             = _text;
+        tid_slot         = AllocSlot(u32(3));
+        gid_slot         = AllocSlot(u32(3));
+        group_id_slot    = AllocSlot(u32(3));
+        group_index_slot = AllocSlot(u32(1));
+        lane_index_slot  = AllocSlot(u32(1));
+        scopes.push_back({});
+        Tokenize();
+        bool ok = ParseTopLevel() && error.size() == size_t(0);
+        text    = NULL;
+        tokens  = {};
+        if (!ok && error.size() == size_t(0)) error = "unknown error";
+        return ok;
+    }
+    bool        Compile(HLSLModule &_module) { return Compile(_module.Finalize()); }
+    char const *GetError() { return error.c_str(); }
+    u32x3       GetGroupSize() { return group_size; }
+    void        SetNumLanes(u32 _num_lanes) {
+        sjit_assert(_num_lanes == u32(8) || _num_lanes == u32(16));
+        num_lanes = _num_lanes;
+    }
+    void SetNumThreads(u32 _num_threads) { num_threads = _num_threads; }
+    // Host memory for a resource, every component is 32 bits (f16 included) and matrices are column major like in GPU buffers.
+    // Buffers take the element count as the width, constants don't need a size. The memory has to outlive the dispatches.
+    bool Bind(char const *_name, void *_data, u32 _width = u32(1), u32 _height = u32(1), u32 _depth = u32(1)) {
+        for (auto &r : resources) {
+            if (r.name != _name) continue;
+            r.data    = (u32 *)_data;
+            r.size[0] = _width;
+            r.size[1] = _height;
+            r.size[2] = _depth;
+            return true;
+        }
+        return false;
+    }
+    void Dispatch(u32x3 _num_groups) {
+        sjit_assert(main_body != invalid);
+        if (_num_groups.x * _num_groups.y * _num_groups.z == u32(0)) return;
+        if (num_lanes == u32(16))
+            DispatchLanes<16>(_num_groups);
+        else
+            DispatchLanes<8>(_num_groups);
+    }
+};
+
+// The register machine from jit_test.cpp, the first kernel that runs on both backends.
+// Lives here so the test below can check the CPU backend against a plain C++ run of the same program.
+namespace RegisterMachine {
+enum {
+    REG_UV_X = 30, //
+    REG_UV_Y = 31, //
+    REG_TIME = 29, //
+};
+enum {
+    CMD_UNKNOWON = 0,
+    CMD_MOV,
+    CMD_MOV_IMM,
+    CMD_ADD,
+    CMD_SUB,
+    CMD_MUL,
+    CMD_DIV,
+    CMD_FRAC,
+    CMD_SIN,
+    CMD_COS,
+    CMD_SQRT,
+    CMD_SQR,
+    CMD_RSQRT,
+    CMD_POW,
+    CMD_SET_OUTPUT,
+    CMD_PCK,
+    CMD_END,
+};
+static constexpr u32 num_registers = u32(32);
+
+struct InsrTy {
+    u32 _type;
+    u32 _dst;
+    u32 _src0;
+    u32 _src1;
+};
+
+static Array<InsrTy> GetDemoProgram() {
+#    define REG(x) u32(x)
+#    define IMMF32(x) u32(asu32(f32(x)))
+#    define IMMU32(x) u32(x)
+    Array<InsrTy> instructions = {
+        {CMD_MOV_IMM, REG(20), IMMF32(0.5)},
+        {CMD_MOV_IMM, REG(10), IMMF32(0.3333)},
+        {CMD_MOV_IMM, REG(12), IMMF32(0.03)},
+        {CMD_MOV_IMM, REG(11), IMMF32(1.0)},
+        {CMD_MOV_IMM, REG(13), IMMF32(3.14159265358979323846264338327950288)},
+        {CMD_MOV_IMM, REG(15), IMMF32(8.0)},
+
+        {CMD_MUL, REG(16), REG_TIME, REG(20)},
+        {CMD_SIN, REG(3), REG(16)},
+        {CMD_COS, REG(4), REG(16)},
+
+        {CMD_MUL, REG(5), REG_UV_X, REG(3)},
+        {CMD_MUL, REG(6), REG_UV_Y, REG(4)},
+
+        {CMD_ADD, REG(7), REG_UV_Y, REG_UV_X},
+
+        {CMD_MUL, REG(5), REG(15), REG(5)},
+        {CMD_MUL, REG(6), REG(15), REG(6)},
+        {CMD_MUL, REG(7), REG(15), REG(7)},
+
+        {CMD_SIN, REG(0), REG(5)},
+        {CMD_COS, REG(1), REG(6)},
+        {CMD_SIN, REG(2), REG(7)},
+
+        {CMD_MUL, REG(3), REG(10), REG(0)},
+        {CMD_MUL, REG(4), REG(10), REG(1)},
+        {CMD_MUL, REG(5), REG(10), REG(2)},
+
+        {CMD_MUL, REG(3), REG(20), REG(0)},
+        {CMD_MUL, REG(4), REG(20), REG(1)},
+        {CMD_MUL, REG(5), REG(20), REG(2)},
+
+        {CMD_ADD, REG(3), REG(3), REG_UV_Y},
+        {CMD_ADD, REG(4), REG(4), REG_UV_X},
+        {CMD_ADD, REG(5), REG(5), REG_UV_Y},
+
+        {CMD_ADD, REG(0), REG(0), REG(4)},
+        {CMD_ADD, REG(1), REG(1), REG(5)},
+        {CMD_ADD, REG(2), REG(2), REG(3)},
+
+        {CMD_SIN, REG(0), REG(0)},
+        {CMD_COS, REG(1), REG(1)},
+        {CMD_SIN, REG(2), REG(2)},
+
+        {CMD_PCK, REG(0), REG(0)},
+        {CMD_PCK, REG(1), REG(1)},
+        {CMD_PCK, REG(2), REG(2)},
+
+        {CMD_MOV_IMM, REG(15), IMMF32(16.0)},
+
+        {CMD_POW, REG(0), REG(0), REG(15)},
+        {CMD_POW, REG(1), REG(1), REG(15)},
+        {CMD_POW, REG(2), REG(2), REG(15)},
+
+        {CMD_SET_OUTPUT, IMMU32(0), REG(0)},
+        {CMD_SET_OUTPUT, IMMU32(1), REG(1)},
+        {CMD_SET_OUTPUT, IMMU32(2), REG(2)},
+
+        {CMD_END}, //
+    };
+#    undef REG
+#    undef IMMF32
+#    undef IMMU32
+    return instructions;
+}
+// One pixel per thread, g_cmd_list is a StructuredBuffer<u32x4> of InsrTy and g_output a RWTexture2D<f32x4>
+static void Emit(var g_cmd_list, var g_output) {
+    var registers  = EmitArray(f32Ty, u32(num_registers));
+    var output_reg = EmitArray(f32Ty, u32(4));
+
+    output_reg[u32(0)] = f32(1.0);
+    output_reg[u32(1)] = f32(1.0);
+    output_reg[u32(2)] = f32(1.0);
+    output_reg[u32(3)] = f32(1.0);
+
+    var tid = Input(IN_TYPE_DISPATCH_THREAD_ID)["xy"];
+    var dim = g_output.GetDimensions();
+    var uv  = (tid.ToF32() + f32x2(0.5, 0.5)) / dim.ToF32();
+
+    registers[REG_UV_X] = uv.x();
+    registers[REG_UV_Y] = uv.y();
+    registers[REG_TIME] = f32(6.0);
+
+    var pc = var(u32(0)).Copy();
+    EmitWhileLoop([&] {
+        var i = g_cmd_list.Load(pc);
+        pc += u32(1);
+        var src0 = registers[i.z() % num_registers];
+        EmitIfElse((i.x() == u32(CMD_UNKNOWON)) || (i.x() == u32(CMD_END)), [&] { EmitBreak(); });
+        EmitSwitchCase(i.x(), {
+                                  //
+                                  {CMD_UNKNOWON, [&] {}},
+                                  {CMD_MOV, [&] { registers[i.y()] = src0; }},                                        //
+                                  {CMD_MOV_IMM, [&] { registers[i.y()] = i.z().AsF32(); }},                           //
+                                  {CMD_ADD, [&] { registers[i.y()] = src0 + registers[i.w() % num_registers]; }},     //
+                                  {CMD_SUB, [&] { registers[i.y()] = src0 - registers[i.w() % num_registers]; }},     //
+                                  {CMD_MUL, [&] { registers[i.y()] = src0 * registers[i.w() % num_registers]; }},     //
+                                  {CMD_DIV, [&] { registers[i.y()] = src0 / registers[i.w() % num_registers]; }},     //
+                                  {CMD_FRAC, [&] { registers[i.y()] = frac(src0); }},                                 //
+                                  {CMD_SIN, [&] { registers[i.y()] = sin(src0); }},                                   //
+                                  {CMD_COS, [&] { registers[i.y()] = cos(src0); }},                                   //
+                                  {CMD_SQR, [&] { registers[i.y()] = pow(src0, f32(2.0)); }},                         //
+                                  {CMD_POW, [&] { registers[i.y()] = pow(src0, registers[i.w() % num_registers]); }}, //
+                                  {CMD_SQRT, [&] { registers[i.y()] = sqrt(src0); }},                                 //
+                                  {CMD_RSQRT, [&] { registers[i.y()] = rsqrt(src0); }},                               //
+                                  {CMD_PCK, [&] { registers[i.y()] = f32(0.5) * src0 + f32(0.5); }},                  //
+                                  {CMD_SET_OUTPUT, [&] { output_reg[i.y()] = registers[i.z() % num_registers]; }},    //
+                                  {CMD_END, [&] {}},                                                                  //
+
+                              });
+    });
+
+    g_output.Store(tid, make_f32x4(output_reg[u32(0)], output_reg[u32(1)], output_reg[u32(2)], output_reg[u32(3)]));
+}
+// Plain C++ run of a program for one pixel
+static f32x4 Run(Array<InsrTy> const &_program, f32x2 _uv) {
+    f32 registers[num_registers] = {};
+    f32 output_reg[4]            = {f32(1.0), f32(1.0), f32(1.0), f32(1.0)};
+    registers[REG_UV_X]          = _uv.x;
+    registers[REG_UV_Y]          = _uv.y;
+    registers[REG_TIME]          = f32(6.0);
+    for (auto &i : _program) {
+        if (i._type == u32(CMD_UNKNOWON) || i._type == u32(CMD_END)) break;
+        f32  src0 = registers[i._src0 % num_registers];
+        f32  src1 = registers[i._src1 % num_registers];
+        f32 &dst  = registers[std::min(i._dst, num_registers - u32(1))];
+        switch (i._type) {
+        case CMD_MOV: dst = src0; break;
+        case CMD_MOV_IMM: memcpy(&dst, &i._src0, 4); break;
+        case CMD_ADD: dst = src0 + src1; break;
+        case CMD_SUB: dst = src0 - src1; break;
+        case CMD_MUL: dst = src0 * src1; break;
+        case CMD_DIV: dst = src0 / src1; break;
+        case CMD_FRAC: dst = src0 - std::floor(src0); break;
+        case CMD_SIN: dst = std::sin(src0); break;
+        case CMD_COS: dst = std::cos(src0); break;
+        case CMD_SQR: dst = std::pow(src0, f32(2.0)); break;
+        case CMD_POW: dst = std::pow(src0, src1); break;
+        case CMD_SQRT: dst = std::sqrt(src0); break;
+        case CMD_RSQRT: dst = f32(1.0) / std::sqrt(src0); break;
+        case CMD_PCK: dst = f32(0.5) * src0 + f32(0.5); break;
+        case CMD_SET_OUTPUT: output_reg[std::min(i._dst, u32(3))] = src0; break;
+        default: break;
+        }
+    }
+    return f32x4(output_reg[0], output_reg[1], output_reg[2], output_reg[3]);
+}
+} // namespace RegisterMachine
+
+// Runs kernels on the CPU backend and checks them against plain C++, nothing here needs a device
+static void TestCPUBackend() {
+    auto compile = [](CPUKernel &_kernel, std::function<void()> _emit) {
+        PushModule();
+        defer(PopModule());
+        _emit();
+        bool ok = _kernel.Compile(GetGlobalModule());
+        if (!ok) fprintf(stderr, "[CPU BACKEND] %s\n", _kernel.GetError());
+        sjit_assert(ok);
+    };
+    { // The register machine, every lane count and a few threads
+        GFX_JIT_MAKE_GLOBAL_RESOURCE(g_cpu_test_cmd_list, Type::CreateStructuredBuffer(u32x4Ty));
+        GFX_JIT_MAKE_GLOBAL_RESOURCE(g_cpu_test_output, RWTexture2D_f32x4_Ty);
+        u32                                    width   = u32(40);
+        u32                                    height  = u32(24);
+        Array<RegisterMachine::InsrTy>         program = RegisterMachine::GetDemoProgram();
+        CPUKernel                              kernel  = {};
+        compile(kernel, [&] { RegisterMachine::Emit(g_cpu_test_cmd_list, g_cpu_test_output); });
+        for (u32 num_lanes : {u32(8), u32(16)}) {
+            Array<f32x4> output = Array<f32x4>(width * height, f32x4(-1.0, -1.0, -1.0, -1.0));
+            kernel.SetNumLanes(num_lanes);
+            kernel.SetNumThreads(u32(3));
+            sjit_assert(kernel.Bind("g_cpu_test_cmd_list", &program[0], u32(program.size())));
+            sjit_assert(kernel.Bind("g_cpu_test_output", &output[0], width, height));
+            u32x3 group_size = kernel.GetGroupSize();
+            kernel.Dispatch(u32x3((width + group_size.x - u32(1)) / group_size.x, (height + group_size.y - u32(1)) / group_size.y, u32(1)));
+            yfor(height) xfor(width) {
+                f32x4 expected = RegisterMachine::Run(program, (f32x2(f32(x), f32(y)) + f32x2(0.5, 0.5)) / f32x2(f32(width), f32(height)));
+                f32x4 got      = output[y * width + x];
+                ifor(4) sjit_assert(std::abs(got[i] - expected[i]) < f32(1.0e-4));
+            }
+        }
+    }
+    { // Divergent control flow, dynamic indexing and a structured buffer
+        GFX_JIT_MAKE_GLOBAL_RESOURCE(g_cpu_test_buffer, Type::CreateRWStructuredBuffer(u32Ty));
+        u32       num_threads = u32(100);
+        CPUKernel kernel      = {};
+        compile(kernel, [&] {
+            var tid = Input(IN_TYPE_DISPATCH_THREAD_ID)["x"];
+            var acc = var(u32(0)).Copy();
+            EmitIfElse(tid % u32(3) == u32(0), [&] { acc += u32(100); }, [&] { acc += u32(7); });
+            var n = var(u32(0)).Copy();
+            EmitWhileLoop([&] {
+                EmitIfElse(n >= tid % u32(5), [&] { EmitBreak(); });
+                acc += n;
+                n += u32(1);
+            });
+            EmitSwitchCase(tid % u32(4), {
+                                             {0, [&] { acc += acc; }},
+                                             {2, [&] { acc += u32(1000); }},
+                                         });
+            var table = EmitArray(u32Ty, u32(8));
+            EmitForLoop(u32(0), u32(7), [&](var i) { table[i] = i * tid; });
+            acc += table[tid % u32(8)];
+            EmitIfElse(tid < var(num_threads), [&] { g_cpu_test_buffer.Store(tid, acc); });
+        });
+        Array<u32> buffer = Array<u32>(num_threads, u32(0));
+        sjit_assert(kernel.Bind("g_cpu_test_buffer", &buffer[0], num_threads));
+        kernel.SetNumLanes(u32(16));
+        u32x3 group_size = kernel.GetGroupSize();
+        kernel.Dispatch(u32x3((num_threads + group_size.x - u32(1)) / group_size.x, u32(1), u32(1)));
+        ifor(num_threads) {
+            u32 acc = i % u32(3) == u32(0) ? u32(100) : u32(7);
+            for (u32 n = u32(0); n < i % u32(5); n++) acc += n;
+            if (i % u32(4) == u32(0)) acc += acc;
+            if (i % u32(4) == u32(2)) acc += u32(1000);
+            acc += (i % u32(8)) * i;
+            sjit_assert(buffer[i] == acc);
+        }
+    }
+    { // wave32 masks, the lanes of a batch are the wave
+        GFX_JIT_MAKE_GLOBAL_RESOURCE(g_cpu_test_wave_buffer, Type::CreateRWStructuredBuffer(u32Ty));
+        u32       num_threads = u32(64);
+        CPUKernel kernel      = {};
+        compile(kernel, [&] {
+            wave32::EnableWave32MaskMode();
+            var tid = Input(IN_TYPE_DISPATCH_THREAD_ID)["x"];
+            var acc = var(u32(0)).Copy();
+            // The masks are uniform, the whole wave enters the branch and the lanes pick themselves out
+            wave32::EmitIfElse(tid % u32(3) == u32(0), [&] { wave32::EmitIfLaneActive([&] { acc += u32(1); }); });
+            wave32::EmitIfElse(tid % u32(3) != u32(0), [&] { wave32::EmitIfLaneActive([&] { acc += u32(2); }); });
+            g_cpu_test_wave_buffer.Store(tid, acc);
+        });
+        Array<u32> buffer = Array<u32>(num_threads, u32(0));
+        sjit_assert(kernel.Bind("g_cpu_test_wave_buffer", &buffer[0], num_threads));
+        for (u32 num_lanes : {u32(8), u32(16)}) {
+            kernel.SetNumLanes(num_lanes);
+            kernel.Dispatch(u32x3(num_threads / kernel.GetGroupSize().x, u32(1), u32(1)));
+            ifor(num_threads) sjit_assert(buffer[i] == (i % u32(3) == u32(0) ? u32(1) : u32(2)));
+        }
+    }
+}
+// Throughput of the register machine on the CPU backend
+static f64 BenchCPUBackend(u32 _width = u32(512), u32 _height = u32(512), u32 _num_iters = u32(4)) {
+    GFX_JIT_MAKE_GLOBAL_RESOURCE(g_cpu_bench_cmd_list, Type::CreateStructuredBuffer(u32x4Ty));
+    GFX_JIT_MAKE_GLOBAL_RESOURCE(g_cpu_bench_output, RWTexture2D_f32x4_Ty);
+    Array<RegisterMachine::InsrTy> program = RegisterMachine::GetDemoProgram();
+    Array<f32x4>                   output  = Array<f32x4>(_width * _height);
+    CPUKernel                      kernel  = {};
+    {
+        PushModule();
+        defer(PopModule());
+        RegisterMachine::Emit(g_cpu_bench_cmd_list, g_cpu_bench_output);
+        if (!kernel.Compile(GetGlobalModule())) {
+            fprintf(stderr, "[CPU BACKEND] %s\n", kernel.GetError());
+            return f64(0.0);
+        }
+    }
+    kernel.Bind("g_cpu_bench_cmd_list", &program[0], u32(program.size()));
+    kernel.Bind("g_cpu_bench_output", &output[0], _width, _height);
+    u32x3 group_size = kernel.GetGroupSize();
+    u32x3 num_groups = u32x3((_width + group_size.x - u32(1)) / group_size.x, (_height + group_size.y - u32(1)) / group_size.y, u32(1));
+    f64   seconds[2] = {};
+    ifor(2) {
+        kernel.SetNumLanes(i == 0 ? u32(8) : u32(16));
+        auto start = std::chrono::high_resolution_clock::now();
+        jfor(_num_iters) kernel.Dispatch(num_groups);
+        seconds[i] = std::chrono::duration<f64>(std::chrono::high_resolution_clock::now() - start).count() / f64(std::max(_num_iters, u32(1)));
+    }
+    f64 pixels = f64(_width) * f64(_height);
+    fprintf(stdout, "[CPU BACKEND] register machine %ix%i: %f ms (%f Mpix/s) with 8 lanes, %f ms (%f Mpix/s) with 16 lanes\n", _width, _height, seconds[0] * f64(1.0e3),
+            pixels / seconds[0] * f64(1.0e-6), seconds[1] * f64(1.0e3), pixels / seconds[1] * f64(1.0e-6));
+    return std::min(seconds[0], seconds[1]);
+}
+
+} // namespace SJIT
+
+#endif // SJIT_CPU_HPP
@@ -0,0 +1,295 @@
+// MIT License
+//
+// Copyright (c) 2023 Anton Schreiner
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined(STRING_HASH_HPP)
+#    define STRING_HASH_HPP
+
+#    include <stdint.h>
+#    include <string.h>
+
+#    include <cassert>
+#    include <chrono>
+#    include <filesystem>
+#    include <stdio.h>
+#    include <stdlib.h>
+#    include <string>
+#    include <type_traits>
+#    include <unordered_set>
+#    include <vector>
+
+#    if defined(_MSC_VER)
+#        include <intrin.h>
+#    endif
+
+// String hash shared by SJIT::String, StringRef and the sexpr symbol tables. It's wyhash (final 4): 64x64->128 bit multiply folds, 16 bytes per step for short
+// strings and three independent lanes over 48 byte blocks for long ones. The same function runs in constant evaluation with byte loads and a portable multiply, so
+// hashes of literals are folded at compile time and match the runtime ones bit for bit.
+namespace SJIT {
+using u8  = unsigned char;
+using u32 = unsigned int;
+using u64 = uint64_t;
+
+namespace StringHashDetail {
+static constexpr u64 P0 = u64(0xa0761d6478bd642f);
+static constexpr u64 P1 = u64(0xe7037ed1a0b428db);
+static constexpr u64 P2 = u64(0x8ebc6af09c88c6db);
+static constexpr u64 P3 = u64(0x589965cc75374cc3);
+
+// 64x64->128 bit product
+static constexpr void MulConstexpr(u64 _a, u64 _b, u64 &_lo, u64 &_hi) {
+    u64 a_lo = _a & u64(0xffffffff), a_hi = _a >> u64(32);
+    u64 b_lo = _b & u64(0xffffffff), b_hi = _b >> u64(32);
+    u64 ll = a_lo * b_lo, lh = a_lo * b_hi, hl = a_hi * b_lo, hh = a_hi * b_hi;
+    u64 mid = (ll >> u64(32)) + (lh & u64(0xffffffff)) + (hl & u64(0xffffffff));
+    _lo     = (ll & u64(0xffffffff)) | (mid << u64(32));
+    _hi     = hh + (lh >> u64(32)) + (hl >> u64(32)) + (mid >> u64(32));
+}
+static inline void Mul(u64 _a, u64 _b, u64 &_lo, u64 &_hi) {
+#    if defined(_MSC_VER) && defined(_M_X64)
+    _lo = _umul128(_a, _b, &_hi);
+#    elif defined(__SIZEOF_INT128__)
+    unsigned __int128 r = (unsigned __int128)_a * _b;
+    _lo                 = u64(r);
+    _hi                 = u64(r >> 64);
+#    else
+    MulConstexpr(_a, _b, _lo, _hi);
+#    endif
+}
+template <bool CONSTEXPR>
+static constexpr void MulAny(u64 _a, u64 _b, u64 &_lo, u64 &_hi) {
+    if constexpr (CONSTEXPR)
+        MulConstexpr(_a, _b, _lo, _hi);
+    else
+        Mul(_a, _b, _lo, _hi);
+}
+// Product folded with xor
+template <bool CONSTEXPR>
+static constexpr u64 MixAny(u64 _a, u64 _b) {
+    u64 lo = u64(0), hi = u64(0);
+    MulAny<CONSTEXPR>(_a, _b, lo, hi);
+    return lo ^ hi;
+}
+
+// Little endian loads, byte by byte when constant evaluated
+template <bool CONSTEXPR>
+static constexpr u64 Read8(char const *_p) {
+    if constexpr (CONSTEXPR) {
+        u64 v = u64(0);
+        for (u32 i = u32(0); i < u32(8); i++) v |= u64(u8(_p[i])) << u64(i * u32(8));
+        return v;
+    } else {
+        u64 v = u64(0);
+        memcpy(&v, _p, sizeof(v));
+        return v;
+    }
+}
+template <bool CONSTEXPR>
+static constexpr u64 Read4(char const *_p) {
+    if constexpr (CONSTEXPR) {
+        u64 v = u64(0);
+        for (u32 i = u32(0); i < u32(4); i++) v |= u64(u8(_p[i])) << u64(i * u32(8));
+        return v;
+    } else {
+        u32 v = u32(0);
+        memcpy(&v, _p, sizeof(v));
+        return u64(v);
+    }
+}
+template <bool CONSTEXPR>
+static constexpr u64 Hash(char const *_p, u64 _len, u64 _seed) {
+    u64 seed = _seed ^ MixAny<CONSTEXPR>(_seed ^ P0, P1);
+    u64 a    = u64(0);
+    u64 b    = u64(0);
+    if (_len <= u64(16)) {
+        if (_len >= u64(4)) {
+            u64 step = (_len >> u64(3)) << u64(2);
+            a        = (Read4<CONSTEXPR>(_p) << u64(32)) | Read4<CONSTEXPR>(_p + step);
+            b        = (Read4<CONSTEXPR>(_p + _len - u64(4)) << u64(32)) | Read4<CONSTEXPR>(_p + _len - u64(4) - step);
+        } else if (_len > u64(0)) {
+            a = (u64(u8(_p[0])) << u64(16)) | (u64(u8(_p[_len >> u64(1)])) << u64(8)) | u64(u8(_p[_len - u64(1)]));
+        }
+    } else {
+        u64 i = _len;
+        if (i > u64(48)) {
+            u64 see1 = seed;
+            u64 see2 = seed;
+            do {
+                seed = MixAny<CONSTEXPR>(Read8<CONSTEXPR>(_p) ^ P1, Read8<CONSTEXPR>(_p + 8) ^ seed);
+                see1 = MixAny<CONSTEXPR>(Read8<CONSTEXPR>(_p + 16) ^ P2, Read8<CONSTEXPR>(_p + 24) ^ see1);
+                see2 = MixAny<CONSTEXPR>(Read8<CONSTEXPR>(_p + 32) ^ P3, Read8<CONSTEXPR>(_p + 40) ^ see2);
+                _p += 48;
+                i -= u64(48);
+            } while (i > u64(48));
+            seed ^= see1 ^ see2;
+        }
+        while (i > u64(16)) {
+            seed = MixAny<CONSTEXPR>(Read8<CONSTEXPR>(_p) ^ P1, Read8<CONSTEXPR>(_p + 8) ^ seed);
+            _p += 16;
+            i -= u64(16);
+        }
+        a = Read8<CONSTEXPR>(_p + i - u64(16));
+        b = Read8<CONSTEXPR>(_p + i - u64(8));
+    }
+    u64 lo = u64(0), hi = u64(0);
+    MulAny<CONSTEXPR>(a ^ P1, b ^ seed, lo, hi);
+    return MixAny<CONSTEXPR>(lo ^ P0 ^ _len, hi ^ P1);
+}
+} // namespace StringHashDetail
+
+static constexpr u64 STRING_HASH_SEED = u64(0);
+
+static inline u64 HashBytes(void const *_data, u64 _len, u64 _seed = STRING_HASH_SEED) { return StringHashDetail::Hash<false>((char const *)_data, _len, _seed); }
+// Constant evaluated version, same result as HashBytes
+static constexpr u64 HashBytesConstexpr(char const *_data, u64 _len, u64 _seed = STRING_HASH_SEED) { return StringHashDetail::Hash<true>(_data, _len, _seed); }
+// Pointers. A template so that the array overload below wins for literals, a plain char const * overload would be picked over it.
+template <typename T, typename std::enable_if<std::is_same<T, char const *>::value || std::is_same<T, char *>::value, int>::type = 0>
+static inline u64 HashString(T const &_c_str) {
+    return _c_str ? HashBytes(_c_str, u64(strlen(_c_str))) : u64(0);
+}
+// Literals and char arrays, hashes up to the first null
+template <size_t N>
+static constexpr u64 HashString(char const (&_c_str)[N]) {
+    u64 len = u64(0);
+    while (len < u64(N) && _c_str[len] != '\0') len++;
+    return HashBytesConstexpr(_c_str, len);
+}
+
+namespace StringHashDetail {
+static_assert(HashString("") == HashBytesConstexpr("", u64(0)));
+static_assert(HashString("ab") != HashString("ba"));
+static_assert(HashString("g_TextureFeedback") != HashString("g_TextureFeedbacl"));
+
+// The old per character xor hash, kept as the benchmark baseline
+static u64 LegacyHash(char const *_p, u64 _len) {
+    u64 hash = u64(5381);
+    for (u64 i = u64(0); i < _len; i++) hash ^= u64(_p[i]) * u64(3935559000370003845) + u64(2691343689449507681);
+    return hash;
+}
+
+// _corpus_dir defaults to the experiments directory next to this header, so the benchmark doesn't depend on the working directory
+static void Test(char const *_corpus_dir = NULL) {
+    // Runtime and constant evaluated paths agree for every length class and alignment
+    {
+        char buf[256 + 8] = {};
+        u32  seed         = u32(7);
+        for (u32 i = u32(0); i < u32(sizeof(buf)); i++) {
+            seed   = seed * u32(747796405) + u32(2891336453);
+            buf[i] = char(seed >> u32(24));
+        }
+        for (u32 i = u32(0); i < u32(8); i++)
+            for (u32 j = u32(0); j < u32(256); j++) {
+                assert(HashBytes(buf + i, u64(j)) == HashBytesConstexpr(buf + i, u64(j)));
+                assert(HashBytes(buf + i, u64(j), u64(0x1234)) == HashBytesConstexpr(buf + i, u64(j), u64(0x1234)));
+            }
+        assert(HashString("MyKernel") == HashString((char const *)"MyKernel"));
+        char array[32] = "Symbol";
+        assert(HashString(array) == HashString((char const *)array));
+        assert(HashString((char const *)NULL) == u64(0));
+    }
+
+    // Identifier corpus: every identifier in the experiment sources, plus suffixed variants like the generated names in gfx_jit
+    std::filesystem::path    corpus_dir = _corpus_dir ? std::filesystem::path(_corpus_dir) : std::filesystem::path(__FILE__).parent_path().parent_path() / "experiments";
+    std::vector<std::string> corpus     = {};
+    {
+        std::unordered_set<std::string> unique = {};
+        std::error_code                 ec     = {};
+        for (auto const &entry : std::filesystem::recursive_directory_iterator(corpus_dir, ec)) {
+            if (!entry.is_regular_file()) continue;
+            FILE *file = fopen(entry.path().string().c_str(), "rb");
+            if (file == NULL) continue;
+            std::string text = {};
+            char        chunk[1 << 12];
+            size_t      n = size_t(0);
+            while ((n = fread(chunk, 1, sizeof(chunk), file)) != size_t(0)) text.append(chunk, n);
+            fclose(file);
+            size_t i = size_t(0);
+            while (i < text.size()) {
+                auto is_alpha = [](char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; };
+                auto is_digit = [](char c) { return c >= '0' && c <= '9'; };
+                if (!is_alpha(text[i])) {
+                    i++;
+                    continue;
+                }
+                size_t begin = i;
+                while (i < text.size() && (is_alpha(text[i]) || is_digit(text[i]))) i++;
+                unique.insert(text.substr(begin, i - begin));
+            }
+        }
+        std::vector<std::string> base(unique.begin(), unique.end());
+        for (auto const &s : base) {
+            for (u32 i = u32(0); i < u32(16); i++) unique.insert(s + "_" + std::to_string(i));
+        }
+        corpus.assign(unique.begin(), unique.end());
+    }
+    // An empty corpus would silently benchmark nothing
+    if (corpus.empty()) {
+        fprintf(stderr, "[STRING HASH TEST] [FAIL] no identifiers found in %s\n", corpus_dir.string().c_str());
+        abort();
+    }
+
+    auto evaluate = [&](char const *_name, auto _hash) {
+        std::vector<u64> hashes = {};
+        hashes.reserve(corpus.size());
+        u64 num_bytes = u64(0);
+        for (auto const &s : corpus) {
+            hashes.push_back(_hash(s.c_str(), u64(s.size())));
+            num_bytes += u64(s.size());
+        }
+        // Full and truncated collisions, SJIT::String keeps the low 32 bits
+        std::unordered_set<u64> full = {}, low = {};
+        for (u64 h : hashes) {
+            full.insert(h);
+            low.insert(h & u64(0xffffffff));
+        }
+        // Clustering: average probe length of a linear probed table at 50% load indexed by the low bits
+        u64 table_size = u64(1);
+        while (table_size < u64(hashes.size()) * u64(2)) table_size <<= u64(1);
+        std::vector<u8> occupied(size_t(table_size), u8(0));
+        u64             num_probes = u64(0);
+        for (u64 h : hashes) {
+            u64 slot = h & (table_size - u64(1));
+            while (occupied[size_t(slot)]) {
+                slot = (slot + u64(1)) & (table_size - u64(1));
+                num_probes++;
+            }
+            occupied[size_t(slot)] = u8(1);
+        }
+        u32 const num_runs = u32(64);
+        u64       sink     = u64(0);
+        auto      start    = std::chrono::high_resolution_clock::now();
+        for (u32 i = u32(0); i < num_runs; i++)
+            for (auto const &s : corpus) sink += _hash(s.c_str(), u64(s.size()));
+        double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        fprintf(stdout, "[STRING HASH TEST] %-8s %i identifiers: %i collisions, %i 32 bit collisions, %f probes per insert, %f ns per hash, %f GB/s (%llx)\n", _name,
+                int(corpus.size()), int(corpus.size() - full.size()), int(corpus.size() - low.size()), double(num_probes) / double(hashes.size()),
+                seconds * 1.0e9 / (double(num_runs) * double(corpus.size())), double(num_bytes) * double(num_runs) / seconds * 1.0e-9, (unsigned long long)sink);
+        return corpus.size() - full.size();
+    };
+    evaluate("legacy", [](char const *_p, u64 _len) { return LegacyHash(_p, _len); });
+    size_t num_collisions = evaluate("wyhash", [](char const *_p, u64 _len) { return HashBytes(_p, _len); });
+    assert(num_collisions == size_t(0));
+}
+} // namespace StringHashDetail
+
+} // namespace SJIT
+
+#endif // STRING_HASH_HPP
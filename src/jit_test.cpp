@@ -58,164 +58,60 @@ int main(int argc, char **argv) {
         defer(gfxDestroyTexture(gfx, output));
         g_global_runtime_resource_registry[g_output->GetResource()->GetName()] = output;
 
-        enum {
-            REG_UV_X = 30,         //
-            REG_UV_Y = 31,         //
-            REG_TIME = 29,         //
-            REG_NIL  = 0xdeadbeef, //
-        };
-
-#define REG(x) u32(x)
-#define IMMF32(x) u32(asu32(f32(x)))
-#define IMMU32(x) u32(x)
-
-        enum {
-            CMD_UNKNOWON = 0,
-            CMD_MOV,
-            CMD_MOV_IMM,
-            CMD_ADD,
-            CMD_SUB,
-            CMD_MUL,
-            CMD_DIV,
-            CMD_FRAC,
-            CMD_SIN,
-            CMD_COS,
-            CMD_SQRT,
-            CMD_SQR,
-            CMD_RSQRT,
-            CMD_POW,
-            CMD_SET_OUTPUT,
-            CMD_PCK,
-            CMD_END,
-        };
-
-        struct InsrTy {
-            u32 _type;
-            u32 _dst;
-            u32 _src0;
-            u32 _src1;
-        };
-
-        Array<InsrTy> instructions = {
-            {CMD_MOV_IMM, REG(20), IMMF32(0.5)},
-            {CMD_MOV_IMM, REG(10), IMMF32(0.3333)},
-            {CMD_MOV_IMM, REG(12), IMMF32(0.03)},
-            {CMD_MOV_IMM, REG(11), IMMF32(1.0)},
-            {CMD_MOV_IMM, REG(13), IMMF32(3.14159265358979323846264338327950288)},
-            {CMD_MOV_IMM, REG(15), IMMF32(8.0)},
-
-            {CMD_MUL, REG(16), REG_TIME, REG(20)},
-            {CMD_SIN, REG(3), REG(16)},
-            {CMD_COS, REG(4), REG(16)},
-
-            {CMD_MUL, REG(5), REG_UV_X, REG(3)},
-            {CMD_MUL, REG(6), REG_UV_Y, REG(4)},
-
-            {CMD_ADD, REG(7), REG_UV_Y, REG_UV_X},
-
-            {CMD_MUL, REG(5), REG(15), REG(5)},
-            {CMD_MUL, REG(6), REG(15), REG(6)},
-            {CMD_MUL, REG(7), REG(15), REG(7)},
-
-            {CMD_SIN, REG(0), REG(5)},
-            {CMD_COS, REG(1), REG(6)},
-            {CMD_SIN, REG(2), REG(7)},
-
-            {CMD_MUL, REG(3), REG(10), REG(0)},
-            {CMD_MUL, REG(4), REG(10), REG(1)},
-            {CMD_MUL, REG(5), REG(10), REG(2)},
-
-            {CMD_MUL, REG(3), REG(20), REG(0)},
-            {CMD_MUL, REG(4), REG(20), REG(1)},
-            {CMD_MUL, REG(5), REG(20), REG(2)},
-
-            {CMD_ADD, REG(3), REG(3), REG_UV_Y},
-            {CMD_ADD, REG(4), REG(4), REG_UV_X},
-            {CMD_ADD, REG(5), REG(5), REG_UV_Y},
-
-            {CMD_ADD, REG(0), REG(0), REG(4)},
-            {CMD_ADD, REG(1), REG(1), REG(5)},
-            {CMD_ADD, REG(2), REG(2), REG(3)},
-
-            {CMD_SIN, REG(0), REG(0)},
-            {CMD_COS, REG(1), REG(1)},
-            {CMD_SIN, REG(2), REG(2)},
+        Array<RegisterMachine::InsrTy> instructions = RegisterMachine::GetDemoProgram();
 
-            {CMD_PCK, REG(0), REG(0)},
-            {CMD_PCK, REG(1), REG(1)},
-            {CMD_PCK, REG(2), REG(2)},
-
-            {CMD_MOV_IMM, REG(15), IMMF32(16.0)},
-
-            {CMD_POW, REG(0), REG(0), REG(15)},
-            {CMD_POW, REG(1), REG(1), REG(15)},
-            {CMD_POW, REG(2), REG(2), REG(15)},
-
-            {CMD_SET_OUTPUT, IMMU32(0), REG(0)},
-            {CMD_SET_OUTPUT, IMMU32(1), REG(1)},
-            {CMD_SET_OUTPUT, IMMU32(2), REG(2)},
-
-            {CMD_END}, //
-        };
-
-        GfxBuffer cmd = gfxCreateBuffer<InsrTy>(gfx, instructions.size(), &instructions[0]);
+        GfxBuffer cmd = gfxCreateBuffer<RegisterMachine::InsrTy>(gfx, instructions.size(), &instructions[0]);
         defer(gfxDestroyBuffer(gfx, cmd));
         g_global_runtime_resource_registry[g_cmd_list->GetResource()->GetName()] = cmd;
 
-        LaunchKernel(
-            gfx, {width / u32(8), height / u32(8), 1},
-            [&] {
-                u32 num_registers = u32(32);
-                var registers     = EmitArray(f32Ty, u32(num_registers));
-                var output_reg    = EmitArray(f32Ty, u32(4));
-
-                output_reg[u32(0)] = f32(1.0);
-                output_reg[u32(1)] = f32(1.0);
-                output_reg[u32(2)] = f32(1.0);
-                output_reg[u32(3)] = f32(1.0);
-
-                var tid = Input(IN_TYPE_DISPATCH_THREAD_ID)["xy"];
-                var dim = g_output.GetDimensions();
-                var uv  = (tid.ToF32() + f32x2(0.5, 0.5)) / dim.ToF32();
-
-                registers[REG_UV_X] = uv.x();
-                registers[REG_UV_Y] = uv.y();
-                registers[REG_TIME] = f32(6.0);
-
-                var pc = var(u32(0)).Copy();
-                EmitWhileLoop([&] {
-                    var i = g_cmd_list.Load(pc);
-                    pc += u32(1);
-                    var src0 = registers[i.z() % num_registers];
-                    EmitIfElse((i.x() == u32(CMD_UNKNOWON)) || (i.x() == u32(CMD_END)), [&] { EmitBreak(); });
-                    EmitSwitchCase(i.x(), {
-                                              //
-                                              {CMD_UNKNOWON, [&] {}},
-                                              {CMD_MOV, [&] { registers[i.y()] = src0; }},                                        //
-                                              {CMD_MOV_IMM, [&] { registers[i.y()] = i.z().AsF32(); }},                           //
-                                              {CMD_ADD, [&] { registers[i.y()] = src0 + registers[i.w() % num_registers]; }},     //
-                                              {CMD_SUB, [&] { registers[i.y()] = src0 - registers[i.w() % num_registers]; }},     //
-                                              {CMD_MUL, [&] { registers[i.y()] = src0 * registers[i.w() % num_registers]; }},     //
-                                              {CMD_DIV, [&] { registers[i.y()] = src0 / registers[i.w() % num_registers]; }},     //
-                                              {CMD_FRAC, [&] { registers[i.y()] = frac(src0); }},                                 //
-                                              {CMD_SIN, [&] { registers[i.y()] = sin(src0); }},                                   //
-                                              {CMD_COS, [&] { registers[i.y()] = cos(src0); }},                                   //
-                                              {CMD_SQR, [&] { registers[i.y()] = pow(src0, f32(2.0)); }},                         //
-                                              {CMD_POW, [&] { registers[i.y()] = pow(src0, registers[i.w() % num_registers]); }}, //
-                                              {CMD_SQRT, [&] { registers[i.y()] = sqrt(src0); }},                                 //
-                                              {CMD_RSQRT, [&] { registers[i.y()] = rsqrt(src0); }},                               //
-                                              {CMD_PCK, [&] { registers[i.y()] = f32(0.5) * src0 + f32(0.5); }},                  //
-                                              {CMD_SET_OUTPUT, [&] { output_reg[i.y()] = registers[i.z() % num_registers]; }},    //
-                                              {CMD_END, [&] {}},                                                                  //
-
-                                          });
-                });
+        auto emit_interpreter = [&] { RegisterMachine::Emit(g_cmd_list, g_output); };
+
+        BenchKernelCacheHit("jit_test/interpreter", emit_interpreter);
+        BenchOptimizer("jit_test/interpreter", emit_interpreter);
+        BenchScheduler("jit_test/interpreter", emit_interpreter);
 
-                g_output.Store(tid, make_f32x4(output_reg[u32(0)], output_reg[u32(1)], output_reg[u32(2)], output_reg[u32(3)]));
-            },
-            /*_print*/ true);
+        LaunchKernel(gfx, {width / u32(8), height / u32(8), 1}, emit_interpreter, /*_print*/ true);
 
         write_texture_to_file(gfx, output, "build/test1.png");
+
+        // Same kernel on the CPU backend
+        {
+            CPUKernel kernel = {};
+            PushModule();
+            emit_interpreter();
+            bool compiled = kernel.Compile(GetGlobalModule());
+            PopModule();
+            if (compiled) {
+                Array<f32x4> host_output = Array<f32x4>(width * height);
+                kernel.Bind(g_cmd_list->GetResource()->GetName().c_str(), &instructions[0], u32(instructions.size()));
+                kernel.Bind(g_output->GetResource()->GetName().c_str(), &host_output[0], width, height);
+                u32x3 group_size = kernel.GetGroupSize();
+                kernel.Dispatch(u32x3(width / group_size.x, height / group_size.y, u32(1)));
+                write_f32x4_png("build/test1_cpu.png", &host_output[0], width, height);
+            } else {
+                fprintf(stderr, "[CPU BACKEND] %s\n", kernel.GetError());
+            }
+            BenchCPUBackend(width, height);
+        }
+        // And as C++ built with the system compiler
+        {
+            CPPKernel kernel = {};
+            PushModule();
+            emit_interpreter();
+            bool compiled = kernel.Compile(GetGlobalModule(), "build/sjit_cpp");
+            PopModule();
+            if (compiled) {
+                Array<f32x4> host_output = Array<f32x4>(width * height);
+                kernel.Bind(g_cmd_list->GetResource()->GetName().c_str(), &instructions[0], u32(instructions.size()));
+                kernel.Bind(g_output->GetResource()->GetName().c_str(), &host_output[0], width, height);
+                u32x3 group_size = kernel.GetGroupSize();
+                kernel.Dispatch(u32x3(width / group_size.x, height / group_size.y, u32(1)));
+                write_f32x4_png("build/test1_cpp.png", &host_output[0], width, height);
+            } else {
+                fprintf(stderr, "[CPP BACKEND] %s\n", kernel.GetError());
+            }
+            BenchCPPBackend(width, height, u32(4), "build/sjit_cpp");
+        }
     }
 
 #if 0
@@ -283,8 +179,8 @@ int main(int argc, char **argv) {
 
                 var tid            = var::Input(IN_TYPE_DISPATCH_THREAD_ID).Swizzle("xy");
                 u32 num_components = GetNumComponents(src_texture.getFormat());
-                var input          = var::Resource(Resource::Create(texture_2d_type_table[BASIC_TYPE_F32][num_components], "g_input"));
-                var output         = var::Resource(Resource::Create(rw_texture_2d_type_table[BASIC_TYPE_F32][num_components], "g_output"));
+                var input          = var::Resource(Resource::Create(texture_2d_types.Get(BASIC_TYPE_F32, num_components), "g_input"));
+                var output         = var::Resource(Resource::Create(rw_texture_2d_types.Get(BASIC_TYPE_F32, num_components), "g_output"));
                 var val_sum        = var::Zero(input->resource->GetType()->GetTemplateType());
                 var weight_sum     = var(f32(0.0));
 
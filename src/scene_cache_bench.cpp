@@ -0,0 +1,315 @@
+// MIT License
+//
+// Copyright (c) 2023 Anton Schreiner
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Cold vs. warm scene load without a GPU, the glTFs are parsed with the cgltf copy that ships with gfx.
+// Also reports what the compact vertex stream saves per scene and how far it is off, the world space instance bounds, and the meshlets with what the reference culler
+// removes around the scene.
+// Not part of the gfx build since gfx compiles its own cgltf, on Linux:
+//   g++ -std=c++17 -O2 -DGLM_FORCE_SWIZZLE -I. -I3rdparty -Isjit/3rdparty -I3rdparty/gfx/third_party -I3rdparty/gfx/third_party/imgui src/scene_cache_bench.cpp -o scene_cache_bench -lpthread
+//   ./scene_cache_bench [scenes]
+
+#include <cmath>
+#include <cstdio>
+#undef M_PI
+
+#if !defined(_WIN32)
+static int fopen_s(FILE **_file, char const *_name, char const *_mode) {
+    *_file = fopen(_name, _mode);
+    return *_file ? 0 : 1;
+}
+#endif
+
+#include "dgfx/camera.hpp"
+#include "dgfx/common.h"
+#include "dgfx/meshlet_builder.hpp"
+#include "dgfx/scene_cache.hpp"
+#include "dgfx/vertex_quantization.hpp"
+
+#define CGLTF_IMPLEMENTATION
+#include "cgltf/cgltf.h"
+
+#include <chrono>
+
+using namespace GfxJit;
+
+namespace {
+
+struct ImportedVertex {
+    f32x3 position = {};
+    f32x3 normal   = {};
+    f32x2 uv       = {};
+};
+struct ImportedMesh {
+    std::vector<ImportedVertex> vertices    = {};
+    std::vector<u32>            indices     = {};
+    u32                         material_id = u32(0);
+};
+// What the scene importer hands over, one mesh per glTF primitive
+struct ImportedScene {
+    std::vector<ImportedMesh>       meshes     = {};
+    std::vector<SceneCacheMaterial> materials  = {};
+    std::vector<SceneCacheInstance> instances  = {};
+    std::vector<f32x4x4>            transforms = {};
+};
+
+f64 Now() { return std::chrono::duration<f64, std::milli>(std::chrono::high_resolution_clock::now().time_since_epoch()).count(); }
+
+bool ImportGltf(char const *_path, ImportedScene &_scene) {
+    cgltf_options options = {};
+    cgltf_data   *data    = NULL;
+    if (cgltf_parse_file(&options, _path, &data) != cgltf_result_success) return false;
+    if (cgltf_load_buffers(&options, data, _path) != cgltf_result_success) {
+        cgltf_free(data);
+        return false;
+    }
+
+    ifor(data->materials_count) {
+        cgltf_material const &m        = data->materials[i];
+        SceneCacheMaterial    material = {};
+        material.albedo                = f32x4(m.pbr_metallic_roughness.base_color_factor[0], m.pbr_metallic_roughness.base_color_factor[1],
+                                               m.pbr_metallic_roughness.base_color_factor[2], f32(0.0));
+        material.metallicity_roughness = f32x4(m.pbr_metallic_roughness.metallic_factor, f32(0.0), m.pbr_metallic_roughness.roughness_factor, f32(0.0));
+        _scene.materials.push_back(material);
+    }
+    std::vector<u32> first_primitive = {};
+    ifor(data->meshes_count) {
+        cgltf_mesh const &m = data->meshes[i];
+        first_primitive.push_back(u32(_scene.meshes.size()));
+        jfor(m.primitives_count) {
+            cgltf_primitive const &p    = m.primitives[j];
+            ImportedMesh           mesh = {};
+            mesh.material_id            = p.material ? u32(p.material - data->materials) : u32(0);
+            kfor(p.attributes_count) {
+                cgltf_attribute const &a = p.attributes[k];
+                if (a.index != 0) continue;
+                if (a.type != cgltf_attribute_type_position && a.type != cgltf_attribute_type_normal && a.type != cgltf_attribute_type_texcoord) continue;
+                mesh.vertices.resize(a.data->count);
+                u32 num_components = a.type == cgltf_attribute_type_texcoord ? u32(2) : u32(3);
+                std::vector<f32> tmp = std::vector<f32>(a.data->count * num_components);
+                cgltf_accessor_unpack_floats(a.data, tmp.data(), tmp.size());
+                xfor(a.data->count) {
+                    f32 const *v = &tmp[x * num_components];
+                    if (a.type == cgltf_attribute_type_position) mesh.vertices[x].position = f32x3(v[0], v[1], v[2]);
+                    if (a.type == cgltf_attribute_type_normal) mesh.vertices[x].normal = f32x3(v[0], v[1], v[2]);
+                    if (a.type == cgltf_attribute_type_texcoord) mesh.vertices[x].uv = f32x2(v[0], v[1]);
+                }
+            }
+            if (p.indices) {
+                mesh.indices.resize(p.indices->count);
+                xfor(p.indices->count) mesh.indices[x] = u32(cgltf_accessor_read_index(p.indices, x));
+            } else {
+                mesh.indices.resize(mesh.vertices.size());
+                xfor(mesh.vertices.size()) mesh.indices[x] = x;
+            }
+            _scene.meshes.push_back(std::move(mesh));
+        }
+    }
+    ifor(data->nodes_count) {
+        cgltf_node const &n = data->nodes[i];
+        if (!n.mesh) continue;
+        f32x4x4 transform = {};
+        cgltf_node_transform_world(&n, &transform[0][0]);
+        u32 first = first_primitive[n.mesh - data->meshes];
+        jfor(n.mesh->primitives_count) {
+            SceneCacheInstance instance = {};
+            instance.mesh_id            = first + j;
+            _scene.instances.push_back(instance);
+            _scene.transforms.push_back(transform);
+        }
+    }
+    cgltf_free(data);
+    return true;
+}
+
+SceneCacheSource GetSource(ImportedScene const &_scene) {
+    SceneCacheSource source = {};
+    source.materials        = _scene.materials;
+    source.instances        = _scene.instances;
+    source.transforms       = _scene.transforms;
+    for (auto &m : _scene.meshes) {
+        SceneCacheMeshSource mesh = {};
+        mesh.indices              = m.indices.data();
+        mesh.num_indices          = u32(m.indices.size());
+        mesh.positions            = (u8 const *)m.vertices.data() + offsetof(ImportedVertex, position);
+        mesh.normals              = (u8 const *)m.vertices.data() + offsetof(ImportedVertex, normal);
+        mesh.uvs                  = (u8 const *)m.vertices.data() + offsetof(ImportedVertex, uv);
+        mesh.position_stride      = u32(sizeof(ImportedVertex));
+        mesh.normal_stride        = u32(sizeof(ImportedVertex));
+        mesh.uv_stride            = u32(sizeof(ImportedVertex));
+        mesh.num_vertices         = u32(m.vertices.size());
+        mesh.material_id          = m.material_id;
+        source.meshes.push_back(mesh);
+    }
+    return source;
+}
+
+// The flattening UploadSceneToGpuMemory used to do: one thread, push_back per element
+u64 FlattenLegacy(ImportedScene const &_scene) {
+    std::vector<u32>              indices  = {};
+    std::vector<SceneCacheVertex> vertices = {};
+    for (auto &m : _scene.meshes) {
+        for (u32 index : m.indices) indices.push_back(index);
+        for (ImportedVertex vertex : m.vertices) {
+            SceneCacheVertex gpu_vertex = {};
+            gpu_vertex.position         = f32x4(vertex.position, 1.0f);
+            gpu_vertex.normal           = f32x4(vertex.normal, 0.0f);
+            gpu_vertex.uv               = vertex.uv;
+            vertices.push_back(gpu_vertex);
+        }
+    }
+    return u64(indices.size()) + u64(vertices.size());
+}
+
+// Builds the meshlets and culls them from a ring of cameras around the scene
+void BenchMeshlets(SceneCacheData const &_data) {
+    MeshletData meshlets = {};
+    f64         t0       = Now();
+    BuildMeshlets(_data, meshlets, u32(1));
+    f64 t1 = Now();
+    BuildMeshlets(_data, meshlets);
+    f64 t2    = Now();
+    bool valid = ValidateMeshlets(_data, meshlets);
+
+    u32 num_vertices = u32(0);
+    for (auto &m : meshlets.meshlets) num_vertices += m.vertex_count;
+    fprintf(stdout, "    meshlets: %i meshlets, %f triangles and %f vertices per meshlet, %f vertices per triangle, build %f ms (1 thread %f ms), %s\n",
+            i32(meshlets.meshlets.size()), f64(meshlets.GetNumTriangles()) / f64(std::max(meshlets.meshlets.size(), size_t(1))),
+            f64(num_vertices) / f64(std::max(meshlets.meshlets.size(), size_t(1))), f64(num_vertices) / f64(std::max(meshlets.GetNumTriangles(), u32(1))), t2 - t1, t1 - t0,
+            valid ? "valid" : "INVALID");
+
+    f32x3 center = (_data.aabb_min + _data.aabb_max) * f32(0.5);
+    f32   size   = f32(0.0);
+    xfor(3) size = std::max(size, _data.aabb_max[x] - _data.aabb_min[x]);
+    MeshletCullStats stats            = {};
+    u32              num_views        = u32(8);
+    u32              num_wrong_culls  = u32(0);
+    f64              cull_ms          = f64(0.0);
+    ifor(num_views) {
+        Camera camera   = {};
+        camera.look_at  = center;
+        camera.distance = size * f32(0.5);
+        camera.phi      = f32(2.0) * Camera::PI * f32(i) / f32(num_views);
+        camera.theta    = Camera::PI / f32(3.0);
+        camera.aspect   = f32(16.0) / f32(9.0);
+        camera.fov      = Camera::PI / f32(3.0);
+        camera.pos      = camera.look_at + f32x3(std::sin(camera.theta) * std::cos(camera.phi), std::cos(camera.theta), std::sin(camera.theta) * std::sin(camera.phi)) * camera.distance;
+        camera.UpdateMatrices();
+        MeshletFrustum frustum = MeshletFrustum::Create(transpose(camera.view_proj), camera.pos);
+        f64            t3      = Now();
+        jfor(_data.num_instances) CullMeshMeshlets(meshlets, _data.instances[j].mesh_id, frustum, MeshletInstance::Create(_data.transforms[j]), stats);
+        cull_ms += Now() - t3;
+        jfor(_data.num_instances) {
+            MeshletInstance instance = MeshletInstance::Create(_data.transforms[j]);
+            num_wrong_culls += u32(!ValidateMeshlets(_data, meshlets, &frustum, &instance));
+        }
+    }
+    fprintf(stdout, "    culling over %i views: %f%% of meshlets culled (frustum %f%%, backface %f%%), %f%% of triangles, %f ms per view, %s\n", i32(num_views),
+            f64(100.0) * stats.GetCulledFraction(), f64(100.0) * f64(stats.num_frustum_culled) / f64(std::max(stats.num_meshlets, u64(1))),
+            f64(100.0) * f64(stats.num_backface_culled) / f64(std::max(stats.num_meshlets, u64(1))), f64(100.0) * stats.GetCulledTriangleFraction(), cull_ms / f64(num_views),
+            num_wrong_culls ? "WRONG CULLS" : "conservative");
+}
+
+void BenchSceneCache(char const *_scenes_dir) {
+    std::error_code       ec        = {};
+    std::filesystem::path cache_dir = std::filesystem::temp_directory_path(ec) / "dgfx_scene_cache";
+    std::filesystem::create_directories(cache_dir, ec);
+
+    std::vector<std::filesystem::path> scenes = {};
+    for (auto &e : std::filesystem::recursive_directory_iterator(_scenes_dir, ec))
+        if (e.path().extension() == ".gltf") scenes.push_back(e.path());
+    std::sort(scenes.begin(), scenes.end());
+
+    for (auto &path : scenes) {
+        std::string   path_str = path.string();
+        ImportedScene scene    = {};
+        f64           t0       = Now();
+        if (!ImportGltf(path_str.c_str(), scene)) {
+            fprintf(stdout, "[SCENE CACHE] %s: skipped, failed to load the glTF or its buffers\n", path_str.c_str());
+            continue;
+        }
+        f64 t1 = Now();
+        FlattenLegacy(scene);
+        f64              t2     = Now();
+        SceneCacheSource source = GetSource(scene);
+        SceneCacheData   built  = {};
+        BuildSceneCacheData(source, built);
+        f64         t3         = Now();
+        u64         source_key = SceneCache::GetSourceKey(path_str.c_str());
+        std::string cache_path = (cache_dir / (std::to_string(source_key) + ".bin")).string();
+        bool        written    = SceneCache::Write(cache_path.c_str(), source_key, built);
+        f64         t4         = Now();
+
+        SceneCache     cache  = {};
+        SceneCacheData mapped = {};
+        f64            t5     = Now();
+        bool           hit    = cache.Open(cache_path.c_str(), SceneCache::GetSourceKey(path_str.c_str()), mapped);
+        f64            t6     = Now();
+        // Reading every page is what the upload would do
+        u64 checksum = u64(0);
+        ifor(mapped.num_indices) checksum += u64(mapped.indices[i]);
+        ifor(mapped.num_vertices) checksum += u64(mapped.vertices[i].position.x != f32(0.0));
+        f64 t7 = Now();
+
+        bool same = hit && written && mapped.num_indices == built.num_indices && mapped.num_vertices == built.num_vertices && mapped.num_meshes == built.num_meshes &&
+                    memcmp(mapped.indices, built.indices, sizeof(u32) * built.num_indices) == 0 &&
+                    memcmp(mapped.vertices, built.vertices, sizeof(SceneCacheVertex) * built.num_vertices) == 0 &&
+                    memcmp(mapped.meshes, built.meshes, sizeof(SceneCacheMesh) * built.num_meshes) == 0;
+        fprintf(stdout, "[SCENE CACHE] %s: %i meshes, %i instances, %i indices, %i vertices\n", path_str.c_str(), i32(built.num_meshes), i32(built.num_instances),
+                i32(built.num_indices), i32(built.num_vertices));
+        fprintf(stdout, "    cold: import %f ms, flatten %f ms (push_back %f ms), write %f ms, total %f ms\n", t1 - t0, t3 - t2, t2 - t1, t4 - t3, t4 - t0 - (t2 - t1));
+        fprintf(stdout, "    warm: map %f ms, map + read %f ms, %s %llu\n", t6 - t5, t7 - t5, same ? "matches" : "MISMATCH", (unsigned long long)checksum);
+
+        std::vector<CompactVertex>       compact_vertices = {};
+        std::vector<CompactVertexBounds> compact_bounds   = {};
+        f64                              t8               = Now();
+        EncodeCompactVertices(built, compact_vertices, compact_bounds);
+        f64                t9    = Now();
+        CompactVertexStats stats = GetCompactVertexStats(built, compact_vertices, compact_bounds);
+        fprintf(stdout, "    compact vertices: %f MB -> %f MB (%f%% saved), encode %f ms, max error: position %f, normal %f rad, uv %f\n", f64(stats.full_bytes) / f64(1 << 20),
+                f64(stats.compact_bytes) / f64(1 << 20), f64(100.0) * (f64(1.0) - f64(stats.compact_bytes) / f64(std::max(stats.full_bytes, u64(1)))), t9 - t8,
+                stats.max_position_error, stats.max_normal_error, stats.max_uv_error);
+
+        std::vector<AABB> mesh_bounds     = {};
+        std::vector<AABB> instance_bounds = {};
+        AABB              scene_bounds    = {};
+        f64               t10             = Now();
+        ComputeMeshBounds(built, mesh_bounds, u32(1));
+        ComputeInstanceBounds(built, mesh_bounds, instance_bounds, scene_bounds, u32(1));
+        f64 t11 = Now();
+        ComputeMeshBounds(built, mesh_bounds);
+        ComputeInstanceBounds(built, mesh_bounds, instance_bounds, scene_bounds);
+        f64   t12    = Now();
+        f32x3 extent = scene_bounds.hi - scene_bounds.lo;
+        fprintf(stdout, "    instance bounds: %f ms (1 thread %f ms), scene %f x %f x %f\n", t12 - t11, t11 - t10, extent.x, extent.y, extent.z);
+
+        BenchMeshlets(built);
+        cache.Close();
+        std::filesystem::remove(cache_path, ec);
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    BenchSceneCache(argc > 1 ? argv[1] : "scenes");
+    return 0;
+}